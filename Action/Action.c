@@ -0,0 +1,388 @@
+/********************************************************************************
+*  File:		Action.c														*
+*  Purpose:		Runs response actions on a small worker pool, off the event		*
+*				path.															*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#include <limits.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <sys/eventfd.h>
+#endif	// _WIN32
+#include "Action.h"
+#include <Clock.h>
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Enum:		ACTION_STATE													*
+*  Purpose:		The state of an action slot.									*
+*  Remarks:		* The requester moves it out of idle and into running-again,	*
+*					workers move it out of pending and running.					*
+********************************************************************************/
+typedef enum
+{
+	ACTION_STATE_IDLE,
+	ACTION_STATE_PENDING,							// Requests wait for a worker
+	ACTION_STATE_RUNNING,							// A worker runs one
+	ACTION_STATE_RUNNING_AGAIN						// Then more were queued
+} ACTION_STATE, *PACTION_STATE;
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	action_Signal													*
+*  Purpose:		Wakes a worker.													*
+*  Parameters:	@ ptExecutor ~[inout]~ The executor.							*
+*  Remarks:		* Spurious wakeups are harmless, workers re-check every slot.	*
+********************************************************************************/
+static
+VOID
+action_Signal(
+	__inout PACTION_EXECUTOR ptExecutor
+)
+{
+#ifdef _WIN32
+	(VOID)ReleaseSemaphore(ptExecutor->hWakeup, 1, NULL);
+#else	// _WIN32
+	// Cannot block, the counter saturates long after a worker reads it
+	(VOID)eventfd_write(ptExecutor->nWakeup, 1);
+#endif	// _WIN32
+}
+
+/********************************************************************************
+*  Function:	action_Block													*
+*  Purpose:		Blocks a worker until signalled.								*
+*  Parameters:	@ ptExecutor ~[inout]~ The executor.							*
+********************************************************************************/
+static
+VOID
+action_Block(
+	__inout PACTION_EXECUTOR ptExecutor
+)
+{
+#ifdef _WIN32
+	(VOID)WaitForSingleObject(ptExecutor->hWakeup, INFINITE);
+#else	// _WIN32
+	eventfd_t qwValue = 0;
+
+	// A semaphore eventfd, reading takes a single count
+	while ((0 > eventfd_read(ptExecutor->nWakeup, &qwValue)) && (EINTR == errno))
+	{
+		// Retry
+	}
+#endif	// _WIN32
+}
+
+/********************************************************************************
+*  Function:	action_IsCovered												*
+*  Purpose:		Checks whether a pending request covers a new one.				*
+*  Parameters:	@ ptSlot ~[in]~ The action's slot.								*
+*				@ eKind ~[in]~ The action.										*
+*				@ qwDeviceId ~[in]~ The device the new one is for.				*
+*  Returns:		TRUE if it does (see ACTION_SLOT).								*
+*  Remarks:		* Requester only. Requests still pending once nHead is read		*
+*					run after this call, even if a worker takes them meanwhile.	*
+********************************************************************************/
+static
+BOOL
+action_IsCovered(
+	__in PACTION_SLOT ptSlot,
+	__in ACTION_KIND eKind,
+	__in ULONGLONG qwDeviceId
+)
+{
+	ULONG dwTail = (ULONG)(ptSlot->nTail);
+	ULONG dwHead = (ULONG)ATOMIC_LOAD_ACQUIRE(&(ptSlot->nHead));
+	ULONG dwIndex = 0;
+
+	// Too many pending, the newest takes it
+	if (ACTION_MAX_PENDING == dwTail - dwHead)
+	{
+		return TRUE;
+	}
+
+	// Newest first, only alerts depend on the device
+	for (dwIndex = dwTail; dwIndex != dwHead; dwIndex--)
+	{
+		if ((ACTION_KIND_ALERT != eKind) ||
+			(qwDeviceId == ptSlot->atPending[(dwIndex - 1) % ACTION_MAX_PENDING].qwDeviceId))
+		{
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/********************************************************************************
+*  Function:	action_RunNext													*
+*  Purpose:		Runs the highest priority pending action, if any.				*
+*  Parameters:	@ ptExecutor ~[inout]~ The executor.							*
+*  Returns:		TRUE if an action ran.											*
+********************************************************************************/
+static
+BOOL
+action_RunNext(
+	__inout PACTION_EXECUTOR ptExecutor
+)
+{
+	PACTION_SLOT ptSlot = NULL;
+	ACTION_REQUEST tRequest = { 0 };
+	ULONG dwHead = 0;
+	DWORD dwKind = 0;
+
+	for (dwKind = 0; dwKind < ACTION_KIND_COUNT; dwKind++)
+	{
+		// Claim it, another worker may be quicker
+		ptSlot = &(ptExecutor->atSlots[dwKind]);
+		if (ACTION_STATE_PENDING != ATOMIC_COMPARE_EXCHANGE(&(ptSlot->nState), ACTION_STATE_RUNNING, ACTION_STATE_PENDING))
+		{
+			continue;
+		}
+		// Take the oldest request, which frees its entry for the requester
+		dwHead = (ULONG)(ptSlot->nHead);
+		ASSERT(dwHead != (ULONG)ATOMIC_LOAD_ACQUIRE(&(ptSlot->nTail)));
+		tRequest = ptSlot->atPending[dwHead % ACTION_MAX_PENDING];
+		ATOMIC_STORE_RELEASE(&(ptSlot->nHead), (LONG)(dwHead + 1));
+		ptExecutor->pfnAction((ACTION_KIND)dwKind, &tRequest, ptExecutor->pvContext);
+		ptSlot->qwRun++;
+
+		// Done, unless more were queued, before it ran or meanwhile
+		if ((dwHead + 1 != (ULONG)ATOMIC_LOAD_ACQUIRE(&(ptSlot->nTail))) ||
+			(ACTION_STATE_RUNNING != ATOMIC_COMPARE_EXCHANGE(&(ptSlot->nState), ACTION_STATE_IDLE, ACTION_STATE_RUNNING)))
+		{
+			ATOMIC_STORE_RELEASE(&(ptSlot->nState), ACTION_STATE_PENDING);
+		}
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/********************************************************************************
+*  Function:	action_WorkerThread												*
+*  Purpose:		Runs pending actions, highest priority first, until stopped.	*
+*  Parameters:	@ pvExecutor ~[inout]~ The executor.							*
+*  Returns:		0.																*
+*  Remarks:		* Only blocks when nothing is pending, and only exits then.		*
+********************************************************************************/
+static
+UINT
+WINAPI
+action_WorkerThread(
+	__inout_opt PVOID pvExecutor
+)
+{
+	PACTION_EXECUTOR ptExecutor = (PACTION_EXECUTOR)pvExecutor;
+
+	for (;;)
+	{
+		// After every action, start over from the highest priority
+		if (action_RunNext(ptExecutor))
+		{
+			continue;
+		}
+		if (ATOMIC_LOAD_ACQUIRE(&(ptExecutor->nIsStopping)))
+		{
+			break;
+		}
+		action_Block(ptExecutor);
+	}
+
+	// Return result
+	return 0;
+}
+
+/********************************************************************************
+*  Function:	ACTION_Start													*
+********************************************************************************/
+RETSTATUS
+ACTION_Start(
+	__in PFN_ACTION pfnAction,
+	__in_opt PVOID pvContext,
+	__out PACTION_EXECUTOR ptExecutor
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	DWORD dwWorker = 0;
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != pfnAction);
+	ASSERT(NULL != ptExecutor);
+
+	// Initialize
+	RtlZeroMemory(ptExecutor, sizeof(*ptExecutor));
+	ptExecutor->pfnAction = pfnAction;
+	ptExecutor->pvContext = pvContext;
+#ifndef _WIN32
+	ptExecutor->nWakeup = -1;
+#endif	// _WIN32
+
+	// Create the wakeup semaphore
+#ifdef _WIN32
+	ptExecutor->hWakeup = CreateSemaphoreW(NULL, 0, LONG_MAX, NULL);
+	if (NULL == ptExecutor->hWakeup)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"CreateSemaphoreW() failure (LastError=%lu).",
+			GetLastError());
+		goto lblCleanup;
+	}
+#else	// _WIN32
+	ptExecutor->nWakeup = eventfd(0, EFD_CLOEXEC | EFD_SEMAPHORE);
+	if (0 > ptExecutor->nWakeup)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"eventfd() failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+#endif	// _WIN32
+
+	// Start the workers
+	for (dwWorker = 0; dwWorker < ACTION_WORKERS; dwWorker++)
+	{
+		ptExecutor->ahWorkers[dwWorker] = BEGIN_THREAD(action_WorkerThread, ptExecutor, 0);
+		if (NULL == ptExecutor->ahWorkers[dwWorker])
+		{
+			eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+				LOG_SEV_ERROR,
+				"BEGIN_THREAD() failure.");
+			goto lblCleanup;
+		}
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	ACTION_Request													*
+********************************************************************************/
+BOOL
+ACTION_Request(
+	__inout PACTION_EXECUTOR ptExecutor,
+	__in ACTION_KIND eKind,
+	__in ULONGLONG qwReceiptTimestamp,
+	__in ULONGLONG qwDeviceId
+)
+{
+	PACTION_SLOT ptSlot = &(ptExecutor->atSlots[eKind]);
+	PACTION_REQUEST ptRequest = NULL;
+	ULONG dwTail = (ULONG)(ptSlot->nTail);
+
+	ptSlot->qwRequested++;
+
+	// A pending request will run for this one too
+	if (action_IsCovered(ptSlot, eKind, qwDeviceId))
+	{
+		ptSlot->qwAbsorbed++;
+		return FALSE;
+	}
+
+	// Queue it, then make sure the running worker sees it
+	ptRequest = &(ptSlot->atPending[dwTail % ACTION_MAX_PENDING]);
+	ptRequest->qwReceiptTimestamp = qwReceiptTimestamp;
+	ptRequest->qwRequestedTimestamp = CLOCK_GetTimestamp();
+	ptRequest->qwDeviceId = qwDeviceId;
+	ATOMIC_STORE_RELEASE(&(ptSlot->nTail), (LONG)(dwTail + 1));
+	ATOMIC_FULL_BARRIER();
+
+	// At most two rounds, a worker may finish the running action in between
+	for (;;)
+	{
+		switch (ATOMIC_LOAD_ACQUIRE(&(ptSlot->nState)))
+		{
+		case ACTION_STATE_IDLE:
+
+			// Only the requester leaves this state
+			ATOMIC_STORE_RELEASE(&(ptSlot->nState), ACTION_STATE_PENDING);
+			action_Signal(ptExecutor);
+			return TRUE;
+
+		case ACTION_STATE_RUNNING:
+
+			// The worker runs it when done (and rescans, so no signal is needed)
+			if (ACTION_STATE_RUNNING == ATOMIC_COMPARE_EXCHANGE(&(ptSlot->nState), ACTION_STATE_RUNNING_AGAIN, ACTION_STATE_RUNNING))
+			{
+				return TRUE;
+			}
+			break;
+
+		default:
+
+			// Already pending, a worker runs it in turn
+			return TRUE;
+		}
+	}
+}
+
+/********************************************************************************
+*  Function:	ACTION_Stop														*
+********************************************************************************/
+VOID
+ACTION_Stop(
+	__inout PACTION_EXECUTOR ptExecutor
+)
+{
+	DWORD dwWorker = 0;
+
+	// Validations
+	ASSERT(NULL != ptExecutor);
+	if (NULL == ptExecutor->pfnAction)
+	{
+		return;
+	}
+
+	// Workers drain what is pending, then each takes a count and exits
+	ATOMIC_STORE_RELEASE(&(ptExecutor->nIsStopping), TRUE);
+	for (dwWorker = 0; dwWorker < ACTION_WORKERS; dwWorker++)
+	{
+		action_Signal(ptExecutor);
+	}
+	for (dwWorker = 0; dwWorker < ACTION_WORKERS; dwWorker++)
+	{
+		JOIN_THREAD(ptExecutor->ahWorkers[dwWorker]);
+	}
+
+	// Free resources
+#ifdef _WIN32
+	CLOSE_HANDLE(ptExecutor->hWakeup);
+#else	// _WIN32
+	CLOSE_FD(ptExecutor->nWakeup);
+#endif	// _WIN32
+	ptExecutor->pfnAction = NULL;
+}
+
+/********************************************************************************
+*  Function:	ACTION_GetStats													*
+********************************************************************************/
+VOID
+ACTION_GetStats(
+	__in PACTION_EXECUTOR ptExecutor,
+	__in ACTION_KIND eKind,
+	__out PACTION_STATS ptStats
+)
+{
+	// Validations
+	ASSERT(NULL != ptExecutor);
+	ASSERT(ACTION_KIND_COUNT > eKind);
+	ASSERT(NULL != ptStats);
+
+	ptStats->qwRequested = ptExecutor->atSlots[eKind].qwRequested;
+	ptStats->qwAbsorbed = ptExecutor->atSlots[eKind].qwAbsorbed;
+	ptStats->qwRun = ptExecutor->atSlots[eKind].qwRun;
+}
@@ -0,0 +1,197 @@
+/********************************************************************************
+*  File:		Action.h														*
+*  Purpose:		Runs response actions on a small worker pool, off the event		*
+*				path.															*
+********************************************************************************/
+#pragma once
+
+
+/** Includes *******************************************************************/
+#include <Utilities.h>
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	ACTION_WORKERS													*
+*  Purpose:		Worker threads, so a slow action does not hold back the			*
+*				others.															*
+********************************************************************************/
+#define ACTION_WORKERS (2)
+
+/********************************************************************************
+*  Constant:	ACTION_MAX_PENDING												*
+*  Purpose:		Requests of one action pending at once (a power of 2). When		*
+*				that many are pending, the newest absorbs further ones.			*
+********************************************************************************/
+#define ACTION_MAX_PENDING (16)
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Enum:		ACTION_KIND														*
+*  Purpose:		Response actions, highest priority first.						*
+********************************************************************************/
+typedef enum
+{
+	ACTION_KIND_LOCK,								// Lock the session(s)
+	ACTION_KIND_ALERT,								// Raise an alert
+	ACTION_KIND_SNAPSHOT,							// Get the log on disk
+	ACTION_KIND_PROFILE,							// Save the typing profile
+
+	// Must be last
+	ACTION_KIND_COUNT
+} ACTION_KIND, *PACTION_KIND;
+
+/********************************************************************************
+*  Structure:	ACTION_REQUEST													*
+*  Purpose:		What an action was requested for.								*
+********************************************************************************/
+typedef struct _ACTION_REQUEST
+{
+	ULONGLONG qwReceiptTimestamp;					// When the event that called for it was received
+	ULONGLONG qwRequestedTimestamp;					// When it was requested
+	ULONGLONG qwDeviceId;							// The device that called for it
+} ACTION_REQUEST, *PACTION_REQUEST;
+typedef const ACTION_REQUEST *PCACTION_REQUEST;
+
+/********************************************************************************
+*  Callback:	PFN_ACTION														*
+*  Purpose:		Runs an action.													*
+*  Parameters:	@ eKind ~[in]~ The action.										*
+*				@ ptRequest ~[in]~ The (earliest) request it runs for.			*
+*				@ pvContext ~[inout]~ The executor's context.					*
+*  Remarks:		* Runs on a worker. Actions of the same kind never run at once,	*
+*					actions of different kinds may.								*
+********************************************************************************/
+typedef VOID (*PFN_ACTION)(
+	__in ACTION_KIND eKind,
+	__in PCACTION_REQUEST ptRequest,
+	__inout_opt PVOID pvContext
+);
+
+/********************************************************************************
+*  Structure:	ACTION_SLOT														*
+*  Purpose:		The state of one kind of action.								*
+*  Remarks:		* An action is idle, pending, running, or running with more		*
+*					runs pending. Pending requests wait in order in a ring.		*
+*				* A request is absorbed by a pending one that covers it: any	*
+*					pending lock, snapshot or profile save (they do not depend	*
+*					on the device), but only an alert for the same device, so	*
+*					alerts for different devices are never merged.				*
+*				* Padded to a cache line, as workers of different kinds write	*
+*					their slots at once.										*
+********************************************************************************/
+typedef struct _ACTION_SLOT
+{
+	volatile LONG nState;							// ACTION_STATE
+	ACTION_REQUEST atPending[ACTION_MAX_PENDING];	// Pending requests, oldest at nHead
+	volatile LONG nTail;							// Next request to queue (requester only)
+	volatile LONG nHead;							// Next request to run (running worker only)
+	volatile ULONGLONG qwRequested;					// Requests (requester only)
+	volatile ULONGLONG qwAbsorbed;					// Requests absorbed by a pending one (requester only)
+	volatile ULONGLONG qwRun;						// Runs (workers)
+	BYTE abPadding[CACHE_LINE_SIZE];
+} ACTION_SLOT, *PACTION_SLOT;
+
+/********************************************************************************
+*  Structure:	ACTION_EXECUTOR													*
+*  Purpose:		Response actions requested by a single thread, run by a pool	*
+*				of workers in priority order.									*
+*  Remarks:		* Requesting never blocks: it is a couple of atomic operations	*
+*					and a semaphore post.										*
+********************************************************************************/
+typedef struct _ACTION_EXECUTOR
+{
+	ACTION_SLOT atSlots[ACTION_KIND_COUNT];			// By kind
+	PFN_ACTION pfnAction;							// Runs the actions, or NULL until started
+	PVOID pvContext;								// pfnAction's context
+	volatile LONG nIsStopping;						// Workers should exit once nothing is pending
+	HANDLE ahWorkers[ACTION_WORKERS];				// The workers
+#ifdef _WIN32
+	HANDLE hWakeup;									// Semaphore, one count per pending action
+#else	// _WIN32
+	INT nWakeup;									// eventfd (semaphore), one count per pending action
+#endif	// _WIN32
+} ACTION_EXECUTOR, *PACTION_EXECUTOR;
+
+/********************************************************************************
+*  Structure:	ACTION_STATS													*
+*  Purpose:		A snapshot of an action's counters.								*
+*  Remarks:		* Counters may be slightly stale, as they are read while the	*
+*					executor is in use.											*
+********************************************************************************/
+typedef struct _ACTION_STATS
+{
+	ULONGLONG qwRequested;							// Requests
+	ULONGLONG qwAbsorbed;							// Requests absorbed by a pending one
+	ULONGLONG qwRun;								// Runs
+} ACTION_STATS, *PACTION_STATS;
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	ACTION_Start													*
+*  Purpose:		Starts the workers.												*
+*  Parameters:	@ pfnAction ~[in]~ Runs the actions.							*
+*				@ pvContext ~[in_opt]~ pfnAction's context.						*
+*				@ ptExecutor ~[out]~ Gets the executor.							*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Stop with ACTION_Stop, even on failure.						*
+********************************************************************************/
+RETSTATUS
+ACTION_Start(
+	__in PFN_ACTION pfnAction,
+	__in_opt PVOID pvContext,
+	__out PACTION_EXECUTOR ptExecutor
+);
+
+/********************************************************************************
+*  Function:	ACTION_Request													*
+*  Purpose:		Requests an action (requester only).							*
+*  Parameters:	@ ptExecutor ~[inout]~ The executor.							*
+*				@ eKind ~[in]~ The action.										*
+*				@ qwReceiptTimestamp ~[in]~ When the event that calls for it	*
+*				was received.													*
+*				@ qwDeviceId ~[in]~ The device that calls for it.				*
+*  Returns:		TRUE if the action will run for this request, FALSE if it was	*
+*				absorbed by a pending one that covers it (see ACTION_SLOT).		*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+*				* Never blocks.													*
+*				* An action requested while it runs runs again afterwards.		*
+********************************************************************************/
+BOOL
+ACTION_Request(
+	__inout PACTION_EXECUTOR ptExecutor,
+	__in ACTION_KIND eKind,
+	__in ULONGLONG qwReceiptTimestamp,
+	__in ULONGLONG qwDeviceId
+);
+
+/********************************************************************************
+*  Function:	ACTION_Stop														*
+*  Purpose:		Runs the pending actions, then stops the workers.				*
+*  Parameters:	@ ptExecutor ~[inout]~ The executor (or a zeroed one).			*
+*  Remarks:		* No more actions may be requested.								*
+********************************************************************************/
+VOID
+ACTION_Stop(
+	__inout PACTION_EXECUTOR ptExecutor
+);
+
+/********************************************************************************
+*  Function:	ACTION_GetStats													*
+*  Purpose:		Gets an action's counters.										*
+*  Parameters:	@ ptExecutor ~[in]~ The executor.								*
+*				@ eKind ~[in]~ The action.										*
+*				@ ptStats ~[out]~ Gets the counters.							*
+*  Remarks:		* May be called from any thread.								*
+********************************************************************************/
+VOID
+ACTION_GetStats(
+	__in PACTION_EXECUTOR ptExecutor,
+	__in ACTION_KIND eKind,
+	__out PACTION_STATS ptStats
+);
@@ -0,0 +1,217 @@
+/********************************************************************************
+*  File:		Agent.c															*
+*  Purpose:		Per-session agent: locks its own session on the decisions the	*
+*				monitor publishes on the bus (POSIX).							*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#ifndef _WIN32
+#include <spawn.h>
+#include <sys/wait.h>
+#endif	// _WIN32
+#include "Agent.h"
+#include <Clock.h>
+#include "../Bus/Bus.h"
+#include "../Metrics/Metrics.h"
+
+#ifndef _WIN32
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Structure:	AGENT_CONTEXT													*
+*  Purpose:		The module context.												*
+********************************************************************************/
+typedef struct _AGENT_CONTEXT
+{
+	BUS_AGENT tBus;									// Our side of the bus
+	ULONGLONG qwStartTimestamp;						// When the process started
+	ULONGLONG qwArmedTimestamp;						// When the bus was followed
+} AGENT_CONTEXT, *PAGENT_CONTEXT;
+
+
+/** Globals ********************************************************************/
+
+/********************************************************************************
+*  Global:		g_tContext														*
+*  Purpose:		The module context.												*
+********************************************************************************/
+static
+AGENT_CONTEXT
+g_tContext = { 0 };
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	agent_LockSession												*
+*  Purpose:		Locks the session the agent runs in.							*
+********************************************************************************/
+static
+VOID
+agent_LockSession(VOID)
+{
+	static PSTR s_apszArgs[] = { "loginctl", "lock-session", NULL };
+	pid_t nChild = -1;
+
+	// Ask logind to lock the caller's session (best-effort)
+	if (0 == posix_spawnp(&nChild, s_apszArgs[0], NULL, NULL, s_apszArgs, NULL))
+	{
+		(VOID)waitpid(nChild, NULL, 0);
+	}
+}
+
+/********************************************************************************
+*  Function:	agent_DumpStartup												*
+*  Purpose:		Writes the startup time and the process footprint.				*
+*  Parameters:	@ ptStream ~[in]~ The stream to write to.						*
+*				@ ptContext ~[in]~ The module context.							*
+********************************************************************************/
+static
+VOID
+agent_DumpStartup(
+	__in FILE *ptStream,
+	__in PAGENT_CONTEXT ptContext
+)
+{
+	METRICS_MEMORY tMemory = { 0 };
+
+	(VOID)METRICS_GetMemory(&tMemory);
+	(VOID)fprintf(ptStream,
+		"startup: armed in %llu us, resident %lu KB (peak %lu KB)\n",
+		(ptContext->qwArmedTimestamp - ptContext->qwStartTimestamp) / 1000,
+		(unsigned long)(tMemory.cbResident / 1024),
+		(unsigned long)(tMemory.cbPeakResident / 1024));
+}
+
+/********************************************************************************
+*  Function:	agent_Dump														*
+*  Purpose:		Writes the latency histograms and bus counters, then the		*
+*				startup line.													*
+*  Parameters:	@ ptStream ~[in]~ The stream to write to.						*
+*				@ pvContext ~[inout]~ The module context.						*
+********************************************************************************/
+static
+VOID
+agent_Dump(
+	__in FILE *ptStream,
+	__inout_opt PVOID pvContext
+)
+{
+	PAGENT_CONTEXT ptContext = (PAGENT_CONTEXT)pvContext;
+	BUS_AGENT_STATS tStats = { 0 };
+
+	METRICS_Dump(ptStream);
+	BUS_GetAgentStats(&(ptContext->tBus), &tStats);
+	(VOID)fprintf(ptStream,
+		"agent: %s, %llu decisions, %llu overruns, %llu attaches\n",
+		tStats.bIsAttached ? "attached" : "waiting for the monitor",
+		tStats.qwReceived,
+		tStats.qwOverruns,
+		tStats.qwAttaches);
+	agent_DumpStartup(ptStream, ptContext);
+	(VOID)fflush(ptStream);
+}
+
+/********************************************************************************
+*  Function:	AGENT_Run														*
+********************************************************************************/
+RETSTATUS
+AGENT_Run(
+	__in_z PCSTR pszBusPath,
+	__in ULONGLONG qwStartTimestamp,
+	__in BOOL bExitWhenArmed
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	BOOL bIsAttached = FALSE;
+	BOOL bIsTriggerStarted = FALSE;
+	BUS_DECISION tDecision = { 0 };
+	ULONGLONG qwReceivedTimestamp = 0;
+	ULONGLONG qwLockedTimestamp = 0;
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != pszBusPath);
+
+	g_tContext.qwStartTimestamp = qwStartTimestamp;
+
+	// Follow the bus
+	eStatus = BUS_Attach(pszBusPath, &(g_tContext.tBus));
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		DEBUG_MSG(LOG_SEV_ERROR,
+			"BUS_Attach() failed (eStatus=0x%.8x).",
+			eStatus);
+		goto lblCleanup;
+	}
+	bIsAttached = TRUE;
+	g_tContext.qwArmedTimestamp = CLOCK_GetTimestamp();
+	DEBUG_MSG(LOG_SEV_INFO,
+		"Armed %llu us after start.",
+		(g_tContext.qwArmedTimestamp - qwStartTimestamp) / 1000);
+	if (bExitWhenArmed)
+	{
+		agent_DumpStartup(stdout, &g_tContext);
+		(VOID)fflush(stdout);
+		eStatus = RETSTATUS_SUCCESS;
+		goto lblCleanup;
+	}
+
+	// Dump on demand (see METRICS_StartDumpTrigger)
+	eStatus = METRICS_StartDumpTrigger(agent_Dump, &g_tContext);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		DEBUG_MSG(LOG_SEV_ERROR,
+			"METRICS_StartDumpTrigger() failed (eStatus=0x%.8x).",
+			eStatus);
+		goto lblCleanup;
+	}
+	bIsTriggerStarted = TRUE;
+
+	// Lock on every decision, the missed ones included
+	while (BUS_Receive(&(g_tContext.tBus), &tDecision))
+	{
+		qwReceivedTimestamp = CLOCK_GetTimestamp();
+		if (0 == (BUS_FLAG_OVERRUN & tDecision.dwFlags))
+		{
+			METRICS_Record(METRICS_STAGE_FAN_OUT, tDecision.qwPublishedTimestamp, qwReceivedTimestamp);
+		}
+		DEBUG_MSG(LOG_SEV_INFO, "Locking (decision %ld).", (long)(tDecision.nSequence));
+		agent_LockSession();
+		qwLockedTimestamp = CLOCK_GetTimestamp();
+		METRICS_Record(METRICS_STAGE_LOCK, qwReceivedTimestamp, qwLockedTimestamp);
+		if (0 == (BUS_FLAG_OVERRUN & tDecision.dwFlags))
+		{
+			METRICS_Record(METRICS_STAGE_RECEIPT_TO_LOCK, tDecision.qwEventTimestamp, qwLockedTimestamp);
+		}
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Stop dumping, and leave a final report in debug builds
+	if (bIsTriggerStarted)
+	{
+		METRICS_StopDumpTrigger();
+#ifdef _DEBUG
+		agent_Dump(stderr, &g_tContext);
+#endif	// _DEBUG
+	}
+
+	// Free resources
+	if (bIsAttached)
+	{
+		BUS_Detach(&(g_tContext.tBus));
+	}
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+#endif	// _WIN32
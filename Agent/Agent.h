@@ -0,0 +1,40 @@
+/********************************************************************************
+*  File:		Agent.h															*
+*  Purpose:		Per-session agent: locks its own session on the decisions the	*
+*				monitor publishes on the bus (POSIX).							*
+********************************************************************************/
+#pragma once
+
+
+/** Includes *******************************************************************/
+#include <Utilities.h>
+
+#ifndef _WIN32
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	AGENT_Run														*
+*  Purpose:		Follows the bus and locks the calling session on every			*
+*				decision.														*
+*  Parameters:	@ pszBusPath ~[in]~ The bus file (see Bus/Bus.h), it need not	*
+*				exist yet.														*
+*				@ qwStartTimestamp ~[in]~ When the process started				*
+*				(CLOCK_GetTimestamp), startup time is measured from it.			*
+*				@ bExitWhenArmed ~[in]~ Whether to return as soon as the bus	*
+*				is followed, writing the startup line to stdout.				*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Detects nothing itself: one monitor (run with -b) serves		*
+*					every agent, each agent only costs a read-only mapping		*
+*					and a sleeping thread.										*
+*				* A decision the agent missed (it fell too far behind) locks	*
+*					too.														*
+********************************************************************************/
+RETSTATUS
+AGENT_Run(
+	__in_z PCSTR pszBusPath,
+	__in ULONGLONG qwStartTimestamp,
+	__in BOOL bExitWhenArmed
+);
+
+#endif	// _WIN32
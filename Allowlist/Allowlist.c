@@ -0,0 +1,284 @@
+/********************************************************************************
+*  File:		Allowlist.c														*
+*  Purpose:		Approved device allowlist (open addressing hash table).			*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#include "Allowlist.h"
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	ALLOWLIST_LINE_CHARS											*
+*  Purpose:		Line buffer size when loading a file (longer lines are			*
+*				malformed).														*
+********************************************************************************/
+#define ALLOWLIST_LINE_CHARS (256)
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	allowlist_Find													*
+*  Purpose:		Probes for a fingerprint.										*
+*  Parameters:	@ ptAllowlist ~[in]~ The (created) allowlist.					*
+*				@ qwFingerprint ~[in]~ The fingerprint.							*
+*  Returns:		The fingerprint's slot, or the free slot that ends its probe	*
+*				sequence.														*
+*  Remarks:		* Fingerprints are already mixed, so the low bits are the home	*
+*					slot.														*
+********************************************************************************/
+static
+__inline
+DWORD
+allowlist_Find(
+	__in PCALLOWLIST ptAllowlist,
+	__in ULONGLONG qwFingerprint
+)
+{
+	DWORD dwSlot = 0;
+
+	// Probe, stopping at the fingerprint or the first free slot (one always exists)
+	for (dwSlot = (DWORD)qwFingerprint & ptAllowlist->dwMask;
+		(0 != ptAllowlist->pqwSlots[dwSlot]) && (qwFingerprint != ptAllowlist->pqwSlots[dwSlot]);
+		dwSlot = (dwSlot + 1) & ptAllowlist->dwMask)
+	{
+	}
+
+	// Return result
+	return dwSlot;
+}
+
+/********************************************************************************
+*  Function:	ALLOWLIST_Create												*
+********************************************************************************/
+RETSTATUS
+ALLOWLIST_Create(
+	__in DWORD dwMaxEntries,
+	__out PALLOWLIST ptAllowlist
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	DWORD dwSlots = ALLOWLIST_MIN_SLOTS;
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != ptAllowlist);
+	if (ALLOWLIST_MAX_ENTRIES < dwMaxEntries)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"Too many entries (%lu).",
+			(unsigned long)dwMaxEntries);
+		goto lblCleanup;
+	}
+
+	// Keep at most 50% load, so that misses end within a couple of probes
+	RtlZeroMemory(ptAllowlist, sizeof(*ptAllowlist));
+	while (dwSlots < dwMaxEntries * 2)
+	{
+		dwSlots *= 2;
+	}
+	ptAllowlist->pqwSlots = ALLOCZ(dwSlots * sizeof(ptAllowlist->pqwSlots[0]));
+	if (NULL == ptAllowlist->pqwSlots)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"ALLOCZ() failure.");
+		goto lblCleanup;
+	}
+	ptAllowlist->dwMask = dwSlots - 1;
+	ptAllowlist->dwMaxEntries = dwMaxEntries;
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	ALLOWLIST_Load													*
+********************************************************************************/
+RETSTATUS
+ALLOWLIST_Load(
+	__in_z PCSTR pszPath,
+	__out PALLOWLIST ptAllowlist
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	FILE *ptFile = NULL;
+	CHAR szLine[ALLOWLIST_LINE_CHARS] = { 0 };
+	DWORD dwLines = 0;
+	DWORD dwLine = 0;
+	DEVICEID tId = { 0 };
+	PCSTR pszCurrent = NULL;
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != pszPath);
+	ASSERT(NULL != ptAllowlist);
+
+	RtlZeroMemory(ptAllowlist, sizeof(*ptAllowlist));
+
+	// Open the file
+	ptFile = fopen(pszPath, "r");
+	if (NULL == ptFile)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_INFO,
+			"Cannot open '%s'.",
+			pszPath);
+		goto lblCleanup;
+	}
+
+	// Size the table by the line count, so it is allocated once
+	while (NULL != fgets(szLine, sizeof(szLine), ptFile))
+	{
+		dwLines++;
+	}
+	eStatus = ALLOWLIST_Create(dwLines, ptAllowlist);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		DEBUG_MSG(LOG_SEV_ERROR,
+			"ALLOWLIST_Create() failed (eStatus=0x%.8x).",
+			eStatus);
+		goto lblCleanup;
+	}
+
+	// Add every identity
+	rewind(ptFile);
+	for (dwLine = 1; (dwLine <= dwLines) && (NULL != fgets(szLine, sizeof(szLine), ptFile)); dwLine++)
+	{
+		for (pszCurrent = szLine; (' ' == *pszCurrent) || ('\t' == *pszCurrent); pszCurrent++)
+		{
+		}
+		if (('#' == *pszCurrent) || ('\r' == *pszCurrent) || ('\n' == *pszCurrent) || ('\0' == *pszCurrent))
+		{
+			continue;
+		}
+		if (!DEVICEID_ParseText(pszCurrent, &tId))
+		{
+			DEBUG_MSG(LOG_SEV_ERROR, "Skipping malformed line %lu of '%s'.", (unsigned long)dwLine, pszPath);
+			continue;
+		}
+		(VOID)ALLOWLIST_Add(ptAllowlist, &tId);
+	}
+	DEBUG_MSG(LOG_SEV_INFO, "Loaded %lu approved devices from '%s'.", (unsigned long)ptAllowlist->dwEntries, pszPath);
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	CLOSE(ptFile, fclose);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		ALLOWLIST_Destroy(ptAllowlist);
+	}
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	ALLOWLIST_Destroy												*
+********************************************************************************/
+VOID
+ALLOWLIST_Destroy(
+	__inout PALLOWLIST ptAllowlist
+)
+{
+	// Validations
+	ASSERT(NULL != ptAllowlist);
+
+	// Free resources
+	FREE(ptAllowlist->pqwSlots);
+	RtlZeroMemory(ptAllowlist, sizeof(*ptAllowlist));
+}
+
+/********************************************************************************
+*  Function:	ALLOWLIST_Add													*
+********************************************************************************/
+BOOL
+ALLOWLIST_Add(
+	__inout PALLOWLIST ptAllowlist,
+	__in PCDEVICEID ptId
+)
+{
+	ULONGLONG qwFingerprint = 0;
+	DWORD dwSlot = 0;
+
+	// Validations
+	ASSERT(NULL != ptAllowlist);
+	ASSERT(NULL != ptId);
+	ASSERT(ptId->bIsValid);
+
+	// Duplicates take no room
+	qwFingerprint = DEVICEID_GetFingerprint(ptId);
+	dwSlot = allowlist_Find(ptAllowlist, qwFingerprint);
+	if (qwFingerprint == ptAllowlist->pqwSlots[dwSlot])
+	{
+		return TRUE;
+	}
+
+	// Insert into the free slot that ended the probe
+	if (ptAllowlist->dwMaxEntries <= ptAllowlist->dwEntries)
+	{
+		return FALSE;
+	}
+	ptAllowlist->pqwSlots[dwSlot] = qwFingerprint;
+	ptAllowlist->dwEntries++;
+	return TRUE;
+}
+
+/********************************************************************************
+*  Function:	ALLOWLIST_Contains												*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+********************************************************************************/
+BOOL
+ALLOWLIST_Contains(
+	__in PCALLOWLIST ptAllowlist,
+	__in PCDEVICEID ptId
+)
+{
+	ULONGLONG qwFingerprint = 0;
+	DEVICEID tAnyInstance = { 0 };
+
+	// Validations
+	ASSERT(NULL != ptAllowlist);
+	ASSERT(NULL != ptId);
+
+	// Unidentified devices (or an empty list) are never approved
+	if ((0 == ptAllowlist->dwEntries) || (!ptId->bIsValid))
+	{
+		return FALSE;
+	}
+
+	// The exact identity
+	qwFingerprint = DEVICEID_GetFingerprint(ptId);
+	if (qwFingerprint == ptAllowlist->pqwSlots[allowlist_Find(ptAllowlist, qwFingerprint)])
+	{
+		return TRUE;
+	}
+
+	// Any instance of the VID and PID
+	if ('\0' == ptId->szInstance[0])
+	{
+		return FALSE;
+	}
+	tAnyInstance.bIsValid = TRUE;
+	tAnyInstance.wVendorId = ptId->wVendorId;
+	tAnyInstance.wProductId = ptId->wProductId;
+	qwFingerprint = DEVICEID_GetFingerprint(&tAnyInstance);
+	return qwFingerprint == ptAllowlist->pqwSlots[allowlist_Find(ptAllowlist, qwFingerprint)];
+}
@@ -0,0 +1,127 @@
+/********************************************************************************
+*  File:		Allowlist.h														*
+*  Purpose:		Approved device allowlist (open addressing hash table).			*
+********************************************************************************/
+#pragma once
+
+
+/** Includes *******************************************************************/
+#include <Utilities.h>
+#include "../EventSource/DeviceId.h"
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	ALLOWLIST_DEFAULT_PATH											*
+*  Purpose:		The default allowlist file, in the working directory.			*
+********************************************************************************/
+#define ALLOWLIST_DEFAULT_PATH ("AntiDuck.allow")
+
+/********************************************************************************
+*  Constant:	ALLOWLIST_MAX_ENTRIES											*
+*  Purpose:		Maximal number of approved devices.								*
+********************************************************************************/
+#define ALLOWLIST_MAX_ENTRIES (1024 * 1024)
+
+/********************************************************************************
+*  Constant:	ALLOWLIST_MIN_SLOTS												*
+*  Purpose:		Minimal number of hash table slots.								*
+*  Remarks:		* Must be a power of 2.											*
+********************************************************************************/
+#define ALLOWLIST_MIN_SLOTS (16)
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Structure:	ALLOWLIST														*
+*  Purpose:		Approved device fingerprints (open addressing, linear probing).	*
+*  Remarks:		* Slots hold DEVICEID_GetFingerprint values, 0 marks a free		*
+*					slot. At most half of the slots are ever occupied.			*
+*				* An entry without an instance approves every instance of its	*
+*					VID and PID.												*
+*				* Read-only once built, so lookups need no locking.				*
+********************************************************************************/
+typedef struct _ALLOWLIST
+{
+	PULONGLONG pqwSlots;							// Fingerprints, or NULL while empty
+	DWORD dwMask;									// Number of slots minus 1
+	DWORD dwEntries;								// Number of occupied slots
+	DWORD dwMaxEntries;								// Capacity given at creation
+} ALLOWLIST, *PALLOWLIST;
+typedef const ALLOWLIST *PCALLOWLIST;
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	ALLOWLIST_Create												*
+*  Purpose:		Creates an empty allowlist.										*
+*  Parameters:	@ dwMaxEntries ~[in]~ Number of entries to make room for (at	*
+*				most ALLOWLIST_MAX_ENTRIES).									*
+*				@ ptAllowlist ~[out]~ Gets the allowlist.						*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Free with ALLOWLIST_Destroy.									*
+*				* This is the only allocation, adding and looking up never		*
+*					allocate.													*
+********************************************************************************/
+RETSTATUS
+ALLOWLIST_Create(
+	__in DWORD dwMaxEntries,
+	__out PALLOWLIST ptAllowlist
+);
+
+/********************************************************************************
+*  Function:	ALLOWLIST_Load													*
+*  Purpose:		Creates an allowlist from a file with a "VVVV:PPPP:INSTANCE"	*
+*				identity per line.												*
+*  Parameters:	@ pszPath ~[in]~ The file.										*
+*				@ ptAllowlist ~[out]~ Gets the allowlist.						*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Free with ALLOWLIST_Destroy.									*
+*				* Empty lines and lines starting with '#' are skipped,			*
+*					malformed lines are logged and skipped.						*
+********************************************************************************/
+RETSTATUS
+ALLOWLIST_Load(
+	__in_z PCSTR pszPath,
+	__out PALLOWLIST ptAllowlist
+);
+
+/********************************************************************************
+*  Function:	ALLOWLIST_Destroy												*
+*  Purpose:		Frees an allowlist.												*
+*  Parameters:	@ ptAllowlist ~[inout]~ The allowlist (may be zeroed).			*
+********************************************************************************/
+VOID
+ALLOWLIST_Destroy(
+	__inout PALLOWLIST ptAllowlist
+);
+
+/********************************************************************************
+*  Function:	ALLOWLIST_Add													*
+*  Purpose:		Approves a device identity.										*
+*  Parameters:	@ ptAllowlist ~[inout]~ The allowlist.							*
+*				@ ptId ~[in]~ A valid identity.									*
+*  Returns:		FALSE if the allowlist is full.									*
+********************************************************************************/
+BOOL
+ALLOWLIST_Add(
+	__inout PALLOWLIST ptAllowlist,
+	__in PCDEVICEID ptId
+);
+
+/********************************************************************************
+*  Function:	ALLOWLIST_Contains												*
+*  Purpose:		Checks whether a device identity is approved.					*
+*  Parameters:	@ ptAllowlist ~[in]~ The allowlist (may be zeroed).				*
+*				@ ptId ~[in]~ The identity (may be invalid).					*
+*  Returns:		A boolean value.												*
+*  Remarks:		* At most two probe sequences, never allocates.					*
+********************************************************************************/
+BOOL
+ALLOWLIST_Contains(
+	__in PCALLOWLIST ptAllowlist,
+	__in PCDEVICEID ptId
+);
@@ -0,0 +1,5850 @@
+/********************************************************************************
+*  File:		Bench.c															*
+*  Purpose:		Microbenchmarks for the detection hot paths.					*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#include <Utilities.h>
+#include <Clock.h>
+#include <stdarg.h>
+#include "../Action/Action.h"
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <linux/input.h>
+#endif	// _WIN32
+#include "../Allowlist/Allowlist.h"
+#ifndef _WIN32
+#include "../Bus/Bus.h"
+#include "../Quarantine/Quarantine.h"
+#include "../Telemetry/Telemetry.h"
+#endif	// _WIN32
+#include "../Cadence/Cadence.h"
+#include "../Decision/Decision.h"
+#include "../EventSource/EventSource.h"
+#include "../Layout/Layout.h"
+#include "../Log/BinaryLog.h"
+#include "../Policy/Policy.h"
+#include "../Pool/Pool.h"
+#include "../Queue/SpscQueue.h"
+#include "../Rules/Rules.h"
+#include "../Signature/Signature.h"
+#include "../Timer/TimerWheel.h"
+#include "../Trace/Trace.h"
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	BENCH_MIN_DURATION_NS											*
+*  Purpose:		Minimal measured duration of a single benchmark.				*
+********************************************************************************/
+#define BENCH_MIN_DURATION_NS (200ULL * 1000 * 1000)
+
+/********************************************************************************
+*  Constant:	BENCH_BURST_INTERVALS											*
+*  Purpose:		Interval count of a payload burst (thousands of reports).		*
+********************************************************************************/
+#define BENCH_BURST_INTERVALS (4096)
+
+/********************************************************************************
+*  Constant:	BENCH_ALLOWLIST_ENTRIES											*
+*  Purpose:		Approved devices of a large fleet.								*
+********************************************************************************/
+#define BENCH_ALLOWLIST_ENTRIES (50000)
+
+/********************************************************************************
+*  Constant:	BENCH_LOG_BURST													*
+*  Purpose:		Records logged between flushes (fits a thread's ring).			*
+********************************************************************************/
+#define BENCH_LOG_BURST (LOG_RING_CAPACITY / 2)
+
+/********************************************************************************
+*  Constant:	BENCH_LOG_PATH													*
+*  Purpose:		Scratch log file, removed once measured.						*
+********************************************************************************/
+#define BENCH_LOG_PATH ("antiduck-bench.adlog")
+
+/********************************************************************************
+*  Constant:	BENCH_LOG_CONTROL_PATH											*
+*  Purpose:		Scratch log control file, removed once measured.				*
+********************************************************************************/
+#define BENCH_LOG_CONTROL_PATH ("antiduck-bench.tracepoints")
+
+/********************************************************************************
+*  Constant:	BENCH_POLICY_PATH												*
+*  Purpose:		Scratch policy file, removed once measured.						*
+********************************************************************************/
+#define BENCH_POLICY_PATH ("antiduck-bench.policy")
+
+/********************************************************************************
+*  Constant:	BENCH_TRACE_PATH												*
+*  Purpose:		Scratch trace file, removed once checked.						*
+********************************************************************************/
+#define BENCH_TRACE_PATH ("antiduck-bench.adtrace")
+
+/********************************************************************************
+*  Constant:	BENCH_SIGNATURE_PATH											*
+*  Purpose:		Scratch signature file, removed once loaded.					*
+********************************************************************************/
+#define BENCH_SIGNATURE_PATH ("antiduck-bench.signatures")
+
+/********************************************************************************
+*  Constant:	BENCH_POLICY_RELOAD_TIMEOUT_NS									*
+*  Purpose:		How long a published revision may take to be swapped in.		*
+********************************************************************************/
+#define BENCH_POLICY_RELOAD_TIMEOUT_NS (5ULL * 1000 * 1000 * 1000)
+
+/********************************************************************************
+*  Constant:	BENCH_QUEUE_CAPACITY											*
+*  Purpose:		Slots of the benchmarked queue (as the notifier's).				*
+********************************************************************************/
+#define BENCH_QUEUE_CAPACITY (1024)
+
+/********************************************************************************
+*  Constant:	BENCH_QUEUE_BATCH												*
+*  Purpose:		Events enqueued between two drains on a single thread.			*
+********************************************************************************/
+#define BENCH_QUEUE_BATCH (64)
+
+/********************************************************************************
+*  Constant:	BENCH_QUEUE_TIMEOUT_MS											*
+*  Purpose:		How long a wait on the empty queue lasts while signals keep		*
+*				interrupting it.												*
+********************************************************************************/
+#define BENCH_QUEUE_TIMEOUT_MS (50)
+
+/********************************************************************************
+*  Constant:	BENCH_QUEUE_SIGNAL_US											*
+*  Purpose:		The interval between those signals.								*
+********************************************************************************/
+#define BENCH_QUEUE_SIGNAL_US (5000)
+
+/********************************************************************************
+*  Constant:	BENCH_CADENCE_DEVICES											*
+*  Purpose:		Keyboards typing at once in the cadence benchmark.				*
+********************************************************************************/
+#define BENCH_CADENCE_DEVICES (4)
+
+/********************************************************************************
+*  Constant:	BENCH_CHURN_DEVICES												*
+*  Purpose:		Keyboards typing in turn in the detector churn benchmark, so	*
+*				every keystroke evicts a detector and allocates another.		*
+********************************************************************************/
+#define BENCH_CHURN_DEVICES (CADENCE_MAX_DEVICES * 4)
+
+/********************************************************************************
+*  Constant:	BENCH_POOL_LIVE													*
+*  Purpose:		Blocks kept allocated while churning, freed and replaced out of	*
+*				order.															*
+********************************************************************************/
+#define BENCH_POOL_LIVE (64)
+
+/********************************************************************************
+*  Macro:		BENCH_POOL_BLOB_BYTES											*
+*  Purpose:		The size of a live blob of mixed sizes, from 1 byte up to the	*
+*				largest size class.												*
+*  Parameters:	@ dwBlob ~[in]~ The blob's index.								*
+********************************************************************************/
+#define BENCH_POOL_BLOB_BYTES(dwBlob) (1 + (((SIZE_T)(dwBlob) * 97) % POOL_MAX_CLASS_BYTES))
+
+/********************************************************************************
+*  Constant:	BENCH_SKETCH_VALUES												*
+*  Purpose:		Values streamed into the quantile sketches.						*
+********************************************************************************/
+#define BENCH_SKETCH_VALUES (65536)
+
+/********************************************************************************
+*  Constant:	BENCH_SKETCH_MAX_ERROR_PERMILLE									*
+*  Purpose:		The largest rank error (in permille) a sketch quantile may have.	*
+********************************************************************************/
+#define BENCH_SKETCH_MAX_ERROR_PERMILLE (30)
+
+/********************************************************************************
+*  Constant:	BENCH_PROFILE_KEYS												*
+*  Purpose:		Keys typed in each phase of the typing profile benchmark.		*
+********************************************************************************/
+#define BENCH_PROFILE_KEYS (4096)
+
+/********************************************************************************
+*  Constant:	BENCH_INJECTOR_INTERVAL_US										*
+*  Purpose:		The interval (in microseconds) of an injector that waits between	*
+*				keys to look human, well above CADENCE_MAX_MEAN_US.				*
+********************************************************************************/
+#define BENCH_INJECTOR_INTERVAL_US (150000)
+
+/********************************************************************************
+*  Constant:	BENCH_PROFILE_PATH												*
+*  Purpose:		The typing profile file written and read back by the benchmark.	*
+********************************************************************************/
+#define BENCH_PROFILE_PATH ("antiduck-bench.profile")
+
+/********************************************************************************
+*  Constant:	BENCH_STORM_DEVICES												*
+*  Purpose:		Devices behind a dock in the arrival storm.						*
+********************************************************************************/
+#define BENCH_STORM_DEVICES (50)
+
+/********************************************************************************
+*  Constant:	BENCH_STORM_INTERFACES											*
+*  Purpose:		Arrivals per storm device: two keyboard interfaces (boot and	*
+*				NKRO) and two other nodes, all with the device's identity.		*
+********************************************************************************/
+#define BENCH_STORM_INTERFACES (4)
+
+/********************************************************************************
+*  Constant:	BENCH_RULES_VENDORS												*
+*  Purpose:		Vendors the synthetic rules and events draw from.				*
+********************************************************************************/
+#define BENCH_RULES_VENDORS (64)
+
+/********************************************************************************
+*  Constant:	BENCH_RULES_INPUTS												*
+*  Purpose:		Events each rule set is verified and measured on.				*
+********************************************************************************/
+#define BENCH_RULES_INPUTS (4096)
+
+/********************************************************************************
+*  Constant:	BENCH_RULES_MAX_SLOWDOWN										*
+*  Purpose:		How much slower evaluating the largest rule set may be than		*
+*				the smallest: its table outgrows the caches, costing a few		*
+*				misses per event, while a scan would be 1000 times slower.		*
+********************************************************************************/
+#define BENCH_RULES_MAX_SLOWDOWN (8.0)
+
+/********************************************************************************
+*  Constant:	BENCH_RULES_HOT_INPUTS											*
+*  Purpose:		Events of the fixed working set: the table lines they reach		*
+*				stay cached whatever the rule set, so their cost is that of		*
+*				the lookups alone.												*
+********************************************************************************/
+#define BENCH_RULES_HOT_INPUTS (16)
+
+/********************************************************************************
+*  Constant:	BENCH_RULES_MAX_HOT_SLOWDOWN									*
+*  Purpose:		How much slower the largest rule set may evaluate the fixed		*
+*				working set than the smallest: the lookups are as many, but		*
+*				for the serial's, which go as deep as the rules' serials.		*
+********************************************************************************/
+#define BENCH_RULES_MAX_HOT_SLOWDOWN (3.0)
+
+/********************************************************************************
+*  Constant:	BENCH_SIGNATURE_CHARS											*
+*  Purpose:		Characters of the text typed through the signature matcher.		*
+********************************************************************************/
+#define BENCH_SIGNATURE_CHARS (16384)
+
+/********************************************************************************
+*  Constant:	BENCH_SIGNATURE_MAX_KEYS										*
+*  Purpose:		Key events typing the text takes at most (Shift, the key, and	*
+*				their releases).												*
+********************************************************************************/
+#define BENCH_SIGNATURE_MAX_KEYS (BENCH_SIGNATURE_CHARS * 4)
+
+/********************************************************************************
+*  Constant:	BENCH_SIGNATURE_MAX_RANDOM										*
+*  Purpose:		Random signatures added to the payloads in the largest set.		*
+********************************************************************************/
+#define BENCH_SIGNATURE_MAX_RANDOM (4096)
+
+/********************************************************************************
+*  Constant:	BENCH_SIGNATURE_RANDOM_CHARS									*
+*  Purpose:		Longest random signature (the shortest is 6 characters).		*
+********************************************************************************/
+#define BENCH_SIGNATURE_RANDOM_CHARS (16)
+
+/********************************************************************************
+*  Constant:	BENCH_SIGNATURE_RELEASE											*
+*  Purpose:		Marks key releases in g_adwSignatureKeys, g_atLayoutCases and	*
+*				g_adwLayoutKeys.												*
+********************************************************************************/
+#define BENCH_SIGNATURE_RELEASE (0x10000)
+
+/********************************************************************************
+*  Constant:	BENCH_LAYOUT_CASE_KEYS											*
+*  Purpose:		Key events of a layout case at most.							*
+********************************************************************************/
+#define BENCH_LAYOUT_CASE_KEYS (8)
+
+/********************************************************************************
+*  Constant:	BENCH_LAYOUT_MAX_KEYS											*
+*  Purpose:		Key events of a corpus trace decoded at most.					*
+********************************************************************************/
+#define BENCH_LAYOUT_MAX_KEYS (4096)
+
+/********************************************************************************
+*  Constant:	BENCH_TIMERS													*
+*  Purpose:		Timers armed at once, as by that many held keyboards.			*
+********************************************************************************/
+#define BENCH_TIMERS (4096)
+
+/********************************************************************************
+*  Constant:	BENCH_TIMER_MAX_DELAY_MS										*
+*  Purpose:		Latest timer deadline (about 17 minutes), so that timers wait	*
+*				on every level of the wheel.									*
+********************************************************************************/
+#define BENCH_TIMER_MAX_DELAY_MS (1 << 20)
+
+/********************************************************************************
+*  Constant:	BENCH_SYSCALLS_PER_LOCK											*
+*  Purpose:		System calls the notifier makes per lock (posix_spawnp and		*
+*				waitpid, LockWorkStation alone on Windows).						*
+********************************************************************************/
+#define BENCH_SYSCALLS_PER_LOCK (2)
+
+/********************************************************************************
+*  Constant:	BENCH_EVDEV_DEVICES												*
+*  Purpose:		Keyboard stand-ins fed to the evdev source at once.				*
+********************************************************************************/
+#define BENCH_EVDEV_DEVICES (4)
+
+/********************************************************************************
+*  Constant:	BENCH_EVDEV_BURST												*
+*  Purpose:		Keystrokes per write when flooding (press, report, release,		*
+*				report: 3 KB, within PIPE_BUF so that writes stay whole).		*
+********************************************************************************/
+#define BENCH_EVDEV_BURST (32)
+
+/********************************************************************************
+*  Constant:	BENCH_EVDEV_PACE_NS												*
+*  Purpose:		Time between keystrokes of each stand-in when paced, as fast	*
+*				as a typical injection device types.							*
+********************************************************************************/
+#define BENCH_EVDEV_PACE_NS (1000ULL * 1000)
+
+/********************************************************************************
+*  Constant:	BENCH_EVDEV_KEY													*
+*  Purpose:		The key the stand-ins type, and its set 1 scan code.			*
+********************************************************************************/
+#define BENCH_EVDEV_KEY (KEY_A)
+#define BENCH_EVDEV_SCAN_CODE (0x1E)
+
+/********************************************************************************
+*  Constant:	BENCH_QUARANTINE_KEYSTROKES										*
+*  Purpose:		Keystrokes a held stand-in types before it is judged human		*
+*				(more than a cadence window).									*
+********************************************************************************/
+#define BENCH_QUARANTINE_KEYSTROKES (40)
+
+/********************************************************************************
+*  Constant:	BENCH_QUARANTINE_SAMPLES										*
+*  Purpose:		Key events passed through a released keyboard one at a time,	*
+*				to measure the latency the quarantine adds.						*
+********************************************************************************/
+#define BENCH_QUARANTINE_SAMPLES (256)
+
+/********************************************************************************
+*  Constant:	BENCH_QUARANTINE_INJECTED_KEYSTROKES							*
+*  Purpose:		Keystrokes a held stand-in injects, all of which must be		*
+*				dropped.														*
+********************************************************************************/
+#define BENCH_QUARANTINE_INJECTED_KEYSTROKES (64)
+
+/********************************************************************************
+*  Constant:	BENCH_QUARANTINE_INTERVAL_US									*
+*  Purpose:		Mean interval of the human keystrokes, jittered by up to a		*
+*				half, and their hold.											*
+********************************************************************************/
+#define BENCH_QUARANTINE_INTERVAL_US (150000)
+#define BENCH_QUARANTINE_HOLD_US (80000)
+
+/********************************************************************************
+*  Constant:	BENCH_QUARANTINE_MAX_LATENCY_NS									*
+*  Purpose:		The most latency a released keyboard's keys may get on			*
+*				average (1 ms).													*
+********************************************************************************/
+#define BENCH_QUARANTINE_MAX_LATENCY_NS (1000ULL * 1000)
+
+/********************************************************************************
+*  Constant:	BENCH_QUARANTINE_TIMEOUT_MS										*
+*  Purpose:		How long replayed keys are waited for.							*
+********************************************************************************/
+#define BENCH_QUARANTINE_TIMEOUT_MS (5000)
+
+/********************************************************************************
+*  Constant:	BENCH_QUARANTINE_PAYLOAD_INTERVAL_NS							*
+*  Purpose:		Interval of the keystrokes typing a payload inside a lock		*
+*				burst (all of it well within the burst's quiet time).			*
+********************************************************************************/
+#define BENCH_QUARANTINE_PAYLOAD_INTERVAL_NS (12ULL * 1000 * 1000)
+
+/********************************************************************************
+*  Constant:	BENCH_STARTUP_RUNS												*
+*  Purpose:		How many times the notifier is started to measure its startup.	*
+********************************************************************************/
+#define BENCH_STARTUP_RUNS (10)
+
+/********************************************************************************
+*  Constant:	BENCH_STARTUP_DIRECTORY											*
+*  Purpose:		Where the notifier is started, so that it finds no policy and	*
+*				its log does not replace a real one.							*
+********************************************************************************/
+#define BENCH_STARTUP_DIRECTORY ("antiduck-bench.d")
+
+/********************************************************************************
+*  Constant:	BENCH_IDLE_SETTLE_MS											*
+*  Purpose:		How long the notifier runs before its wakeups are counted, to	*
+*				leave its startup out.											*
+********************************************************************************/
+#define BENCH_IDLE_SETTLE_MS (1000)
+
+/********************************************************************************
+*  Constant:	BENCH_IDLE_WINDOW_MS											*
+*  Purpose:		How long the idle notifier's wakeups are counted.				*
+********************************************************************************/
+#define BENCH_IDLE_WINDOW_MS (2000)
+
+/********************************************************************************
+*  Constant:	BENCH_BUS_PATH													*
+*  Purpose:		The scratch bus file of the fan-out benchmark.					*
+********************************************************************************/
+#define BENCH_BUS_PATH ("antiduck-bench.bus")
+
+/********************************************************************************
+*  Constant:	BENCH_BUS_MAX_AGENTS											*
+*  Purpose:		The most stand-in session agents following the bus at once.		*
+********************************************************************************/
+#define BENCH_BUS_MAX_AGENTS (64)
+
+/********************************************************************************
+*  Constant:	BENCH_TELEMETRY_PATH											*
+*  Purpose:		The stand-in collector's socket.								*
+********************************************************************************/
+#define BENCH_TELEMETRY_PATH ("antiduck-bench.telemetry")
+
+/********************************************************************************
+*  Constant:	BENCH_TELEMETRY_BURST											*
+*  Purpose:		Events recorded between flushes, about what an arrival storm	*
+*				reports.														*
+********************************************************************************/
+#define BENCH_TELEMETRY_BURST (512)
+
+/********************************************************************************
+*  Constant:	BENCH_TELEMETRY_DEVICES											*
+*  Purpose:		Distinct device IDs in the exported events.						*
+********************************************************************************/
+#define BENCH_TELEMETRY_DEVICES (16)
+
+/********************************************************************************
+*  Constant:	BENCH_ACTION_DISPATCHES											*
+*  Purpose:		Actions requested one at a time on idle workers, to measure the	*
+*				time until a worker starts them.								*
+********************************************************************************/
+#define BENCH_ACTION_DISPATCHES (1000)
+
+/********************************************************************************
+*  Constant:	BENCH_ACTION_REPEATS											*
+*  Purpose:		Identical requests made while an action runs, all but the		*
+*				first absorbed.													*
+********************************************************************************/
+#define BENCH_ACTION_REPEATS (8)
+
+/********************************************************************************
+*  Constant:	BENCH_ACTION_MAX_ORDER											*
+*  Purpose:		Action runs whose order is recorded.							*
+********************************************************************************/
+#define BENCH_ACTION_MAX_ORDER (8)
+
+/********************************************************************************
+*  Constant:	BENCH_MAX_RESULTS												*
+*  Purpose:		Maximal number of reported results.								*
+********************************************************************************/
+#define BENCH_MAX_RESULTS (96)
+
+/********************************************************************************
+*  Constant:	BENCH_MAX_NAME_CHARS											*
+*  Purpose:		Maximal length of a result name, including the NUL.				*
+********************************************************************************/
+#define BENCH_MAX_NAME_CHARS (48)
+
+/********************************************************************************
+*  Constant:	BENCH_TOLERANCE_PERCENT											*
+*  Purpose:		Slowdown a CPU-bound benchmark may show against the baseline	*
+*				before it fails the regression gate.							*
+********************************************************************************/
+#define BENCH_TOLERANCE_PERCENT (25)
+
+/********************************************************************************
+*  Constant:	BENCH_SYSTEM_TOLERANCE_PERCENT									*
+*  Purpose:		Slowdown allowed for benchmarks that depend on the file system	*
+*				or the scheduler, which are noisier.							*
+********************************************************************************/
+#define BENCH_SYSTEM_TOLERANCE_PERCENT (200)
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Structure:	BENCH_RESULT													*
+*  Purpose:		A reported measurement.											*
+*  Remarks:		* Lower values are better for every result.						*
+********************************************************************************/
+typedef struct _BENCH_RESULT
+{
+	CHAR szName[BENCH_MAX_NAME_CHARS];				// Stable name, such as "allowlist/hit"
+	double dValue;									// The measurement
+	PCSTR pszUnit;									// Unit of dValue, such as "ns/lookup"
+	DWORD dwTolerancePercent;						// Allowed slowdown against the baseline
+} BENCH_RESULT, *PBENCH_RESULT;
+
+/********************************************************************************
+*  Enum:		BENCH_PARSER													*
+*  Purpose:		The device identity parsers.									*
+********************************************************************************/
+typedef enum
+{
+	BENCH_PARSER_INTERFACE,							// DEVICEID_ParseInterfaceName
+	BENCH_PARSER_INPUT,								// DEVICEID_ParseInputProduct
+	BENCH_PARSER_TEXT,								// DEVICEID_ParseText
+
+	// Must be last
+	BENCH_PARSER_COUNT
+} BENCH_PARSER, *PBENCH_PARSER;
+
+/********************************************************************************
+*  Structure:	BENCH_LAYOUT_CASE												*
+*  Purpose:		Key events, and the characters a layout decodes them to.		*
+********************************************************************************/
+typedef struct _BENCH_LAYOUT_CASE
+{
+	LAYOUT_ID eLayout;								// The layout
+	DWORD adwKeys[BENCH_LAYOUT_CASE_KEYS];			// Scan codes (see BENCH_SIGNATURE_RELEASE), 0-terminated
+	WORD awChars[LAYOUT_MAX_CHARS * 2];				// The characters, 0-terminated
+} BENCH_LAYOUT_CASE, *PBENCH_LAYOUT_CASE;
+typedef const BENCH_LAYOUT_CASE *PCBENCH_LAYOUT_CASE;
+
+/********************************************************************************
+*  Structure:	BENCH_LAYOUT_TRACE												*
+*  Purpose:		A corpus trace, and the text it types.							*
+********************************************************************************/
+typedef struct _BENCH_LAYOUT_TRACE
+{
+	PCSTR pszPath;									// The trace, from the repository root
+	PCSTR pszText;									// The text it types (US layout)
+	DWORD dwRepeats;								// How many times
+} BENCH_LAYOUT_TRACE, *PBENCH_LAYOUT_TRACE;
+typedef const BENCH_LAYOUT_TRACE *PCBENCH_LAYOUT_TRACE;
+
+/********************************************************************************
+*  Structure:	BENCH_TIMER														*
+*  Purpose:		A benchmarked timer, and when it ran.							*
+********************************************************************************/
+typedef struct _BENCH_TIMER
+{
+	TIMERWHEEL_TIMER tTimer;						// The timer
+	ULONGLONG qwDelay;								// Its deadline, from when it is armed
+	ULONGLONG qwRunTimestamp;						// When it ran, or 0
+} BENCH_TIMER, *PBENCH_TIMER;
+
+
+#ifndef _WIN32
+/********************************************************************************
+*  Structure:	BENCH_EVDEV_RUN													*
+*  Purpose:		An evdev source run on a thread of its own.						*
+********************************************************************************/
+typedef struct _BENCH_EVDEV_RUN
+{
+	EVENTSOURCE tSource;							// The source
+	RETSTATUS eStatus;								// What EVENTSOURCE_Run returned
+	ULONGLONG qwCpuNs;								// CPU time of the thread
+	ULONGLONG qwKeys;								// Key events delivered
+	BOOL bIsWrong;									// A key event was not as typed
+} BENCH_EVDEV_RUN, *PBENCH_EVDEV_RUN;
+
+/********************************************************************************
+*  Structure:	BENCH_QUARANTINE_RUN											*
+*  Purpose:		The notifier's pipeline with a quarantine: an evdev source		*
+*				and an analysis thread, each on a thread of its own.			*
+********************************************************************************/
+typedef struct _BENCH_QUARANTINE_RUN
+{
+	EVENTSOURCE tSource;							// The source
+	SPSCQUEUE tQueue;								// From the source to the analysis
+	DECISION tDecision;								// Judges the keystrokes
+	QUARANTINE tQuarantine;							// Holds, replays or drops them
+	TIMERWHEEL tTimers;								// Replays the keys held long enough
+	RETSTATUS eStatus;								// What EVENTSOURCE_Run returned
+} BENCH_QUARANTINE_RUN, *PBENCH_QUARANTINE_RUN;
+
+/********************************************************************************
+*  Structure:	BENCH_COLLECTOR													*
+*  Purpose:		A stand-in telemetry collector, on a thread of its own.			*
+********************************************************************************/
+typedef struct _BENCH_COLLECTOR
+{
+	INT nSocket;									// Bound datagram socket
+	volatile LONG nIsStopping;						// Collector should exit
+	volatile ULONGLONG qwEvents;					// Events decoded
+	ULONGLONG qwBatches;							// Batches decoded
+	BOOL bIsWrong;									// A batch or event was not as exported
+} BENCH_COLLECTOR, *PBENCH_COLLECTOR;
+
+/********************************************************************************
+*  Structure:	BENCH_ACTIONS													*
+*  Purpose:		Stand-in response actions that can be held, and record when		*
+*				and in which order they run.									*
+********************************************************************************/
+typedef struct _BENCH_ACTIONS
+{
+	volatile LONG anIsHeld[ACTION_KIND_COUNT];		// Actions of this kind wait while set
+	volatile LONG nRuns;							// Actions started
+	ACTION_KIND aeOrder[BENCH_ACTION_MAX_ORDER];	// Kinds, in the order they started
+	ULONGLONG qwDispatchNs;							// Request to start, summed (locks only)
+} BENCH_ACTIONS, *PBENCH_ACTIONS;
+#endif	// _WIN32
+
+
+/** Globals ********************************************************************/
+
+/********************************************************************************
+*  Global:		g_adwIntervalsUs												*
+*  Purpose:		Pseudo-random intervals, shared by the scoring benchmarks.		*
+********************************************************************************/
+static
+DWORD
+g_adwIntervalsUs[BENCH_BURST_INTERVALS] = { 0 };
+
+/********************************************************************************
+*  Global:		g_qwSink														*
+*  Purpose:		Consumes results so that measured work is not optimized out.	*
+********************************************************************************/
+static
+volatile ULONGLONG
+g_qwSink = 0;
+
+/********************************************************************************
+*  Global:		g_awSketchValues												*
+*  Purpose:		Pseudo-random values, shaped like typing intervals, streamed	*
+*				into the quantile sketches.										*
+********************************************************************************/
+static
+WORD
+g_awSketchValues[BENCH_SKETCH_VALUES] = { 0 };
+
+/********************************************************************************
+*  Global:		g_apszKernelNames												*
+*  Purpose:		Printable kernel names, indexed by CADENCE_KERNEL.				*
+********************************************************************************/
+static
+const PCSTR
+g_apszKernelNames[CADENCE_KERNEL_COUNT] = { "scalar", "sse4.1", "avx2" };
+
+/********************************************************************************
+*  Global:		g_apszParserNames												*
+*  Purpose:		Printable parser names, indexed by BENCH_PARSER.				*
+********************************************************************************/
+static
+const PCSTR
+g_apszParserNames[BENCH_PARSER_COUNT] = { "interface", "input", "text" };
+
+/********************************************************************************
+*  Global:		g_acUevent														*
+*  Purpose:		A keyboard arrival, as the kernel sends it.						*
+********************************************************************************/
+static
+const CHAR
+g_acUevent[] =
+	"add@/devices/pci0000:00/0000:00:14.0/usb1/1-2/1-2:1.0/0003:046D:C31C.0007/input/input21\0"
+	"ACTION=add\0"
+	"DEVPATH=/devices/pci0000:00/0000:00:14.0/usb1/1-2/1-2:1.0/0003:046D:C31C.0007/input/input21\0"
+	"SUBSYSTEM=input\0"
+	"PRODUCT=3/46d/c31c/110\0"
+	"NAME=\"Logitech USB Keyboard\"\0"
+	"PHYS=\"usb-0000:00:14.0-2/input0\"\0"
+	"UNIQ=\"\"\0"
+	"PROP=0\0"
+	"EV=120013\0"
+	"KEY=1000000000007 ff800000000007ff febeffdfffefffff fffffffffffffffe\0"
+	"MSC=10\0"
+	"LED=1f\0"
+	"MODALIAS=input:b0003v046DpC31Ce0110-e0,1,4,11,14,k71,72,73,ram4,l0,1,2,3,4,sfw\0"
+	"SEQNUM=4471\0";
+
+/********************************************************************************
+*  Global:		g_atStorm														*
+*  Purpose:		The arrival storm, in time order.								*
+********************************************************************************/
+static
+EVENTSOURCE_EVENT
+g_atStorm[BENCH_STORM_DEVICES * BENCH_STORM_INTERFACES] = { { 0 } };
+
+/********************************************************************************
+*  Global:		g_adwRuleCounts													*
+*  Purpose:		Sizes of the synthetic rule sets, smallest first.				*
+********************************************************************************/
+static
+const DWORD
+g_adwRuleCounts[] = { 10, 100, 1000, 10000 };
+
+/********************************************************************************
+*  Global:		g_atRuleEvents													*
+*  Purpose:		The events of the rules benchmark.								*
+********************************************************************************/
+static
+EVENTSOURCE_EVENT
+g_atRuleEvents[BENCH_RULES_INPUTS] = { { 0 } };
+
+/********************************************************************************
+*  Global:		g_atRuleInputs													*
+*  Purpose:		The rule inputs, pointing to g_atRuleEvents.					*
+********************************************************************************/
+static
+RULES_INPUT
+g_atRuleInputs[BENCH_RULES_INPUTS] = { { 0 } };
+
+/********************************************************************************
+*  Global:		g_apszSignaturePayloads											*
+*  Purpose:		Payload signatures, as a signature file would list them.		*
+********************************************************************************/
+static
+const PCSTR
+g_apszSignaturePayloads[] =
+{
+	"\x80rpowershell",
+	"powershell -w hidden",
+	"-windowstyle hidden",
+	"cmd /c",
+	"iex(",
+	"downloadstring(",
+	"invoke-webrequest",
+	"new-object net.webclient"
+};
+
+/********************************************************************************
+*  Global:		g_aacSignatureLayout											*
+*  Purpose:		The US layout, by Shift state then scan code, to type text.		*
+********************************************************************************/
+static
+const CHAR
+g_aacSignatureLayout[2][0x3A + 1] =
+{
+	"\0\x1b" "1234567890-=\b\t" "qwertyuiop[]\n\0" "asdfghjkl;'`\0\\" "zxcvbnm,./\0*\0 ",
+	"\0\x1b" "!@#$%^&*()_+\b\t" "QWERTYUIOP{}\n\0" "ASDFGHJKL:\"~\0|" "ZXCVBNM<>?\0*\0 "
+};
+
+/********************************************************************************
+*  Global:		g_adwSignatureRandom											*
+*  Purpose:		Random signatures added to the payloads, smallest set first.	*
+********************************************************************************/
+static
+const DWORD
+g_adwSignatureRandom[] = { 0, 1024, BENCH_SIGNATURE_MAX_RANDOM };
+
+/********************************************************************************
+*  Global:		g_acSignatureText												*
+*  Purpose:		The text typed through the signature matcher: random words,		*
+*				some capitalized, and payloads in random case.					*
+********************************************************************************/
+static
+CHAR
+g_acSignatureText[BENCH_SIGNATURE_CHARS] = { 0 };
+
+/********************************************************************************
+*  Global:		g_adwSignatureKeys												*
+*  Purpose:		The key events typing g_acSignatureText: scan codes, with		*
+*				BENCH_SIGNATURE_RELEASE set on releases.						*
+********************************************************************************/
+static
+DWORD
+g_adwSignatureKeys[BENCH_SIGNATURE_MAX_KEYS] = { 0 };
+
+/********************************************************************************
+*  Global:		g_aacSignatureRandom											*
+*  Purpose:		The random signatures' characters.								*
+********************************************************************************/
+static
+CHAR
+g_aacSignatureRandom[BENCH_SIGNATURE_MAX_RANDOM][BENCH_SIGNATURE_RANDOM_CHARS] = { { 0 } };
+
+/********************************************************************************
+*  Global:		g_apszSignatures												*
+*  Purpose:		The signatures of a set: the payloads, then random ones.		*
+********************************************************************************/
+static
+PCSTR
+g_apszSignatures[sizeof(g_apszSignaturePayloads) / sizeof(g_apszSignaturePayloads[0]) + BENCH_SIGNATURE_MAX_RANDOM] = { NULL };
+
+/********************************************************************************
+*  Global:		g_adwSignatureChars												*
+*  Purpose:		The lengths of g_apszSignatures.								*
+********************************************************************************/
+static
+DWORD
+g_adwSignatureChars[sizeof(g_apszSignaturePayloads) / sizeof(g_apszSignaturePayloads[0]) + BENCH_SIGNATURE_MAX_RANDOM] = { 0 };
+
+/********************************************************************************
+*  Global:		g_atLayoutCases													*
+*  Purpose:		Keystrokes whose decoding is checked, a few per layout:			*
+*				Shift, AltGr, Caps Lock, Ctrl, the Windows key and dead keys.	*
+********************************************************************************/
+static
+const BENCH_LAYOUT_CASE
+g_atLayoutCases[] =
+{
+	{ LAYOUT_ID_US, { 0x2A, 0x03, 0x2A | BENCH_SIGNATURE_RELEASE }, { '@' } },
+	{ LAYOUT_ID_US, { 0xE038, 0x10 }, { 'q' } },
+	{ LAYOUT_ID_US, { 0x1D, 0x2E, 0x2E | BENCH_SIGNATURE_RELEASE }, { 0x03 } },
+	{ LAYOUT_ID_US, { 0xE05B, 0xE05B | BENCH_SIGNATURE_RELEASE, 0x13 }, { LAYOUT_GUI_CHAR, 'r' } },
+	{ LAYOUT_ID_US, { 0x3A, 0x3A, 0x3A | BENCH_SIGNATURE_RELEASE, 0x10, 0x02 }, { 'Q', '1' } },
+	{ LAYOUT_ID_UK, { 0x2A, 0x03, 0x2A | BENCH_SIGNATURE_RELEASE, 0x2B }, { '"', '#' } },
+	{ LAYOUT_ID_UK, { 0xE038, 0x05, 0xE038 | BENCH_SIGNATURE_RELEASE, 0x05 }, { 0x20AC, '4' } },
+	{ LAYOUT_ID_DE, { 0x15, 0x2C, 0x0C }, { 'z', 'y', 0x00DF } },
+	{ LAYOUT_ID_DE, { 0xE038, 0x10, 0xE038 | BENCH_SIGNATURE_RELEASE }, { '@' } },
+	{ LAYOUT_ID_DE, { 0x29, 0x29 | BENCH_SIGNATURE_RELEASE, 0x12 }, { 0x00EA } },
+	{ LAYOUT_ID_DE, { 0x0D, 0x39 }, { 0x00B4 } },
+	{ LAYOUT_ID_DE, { 0x29, 0x2D }, { '^', 'x' } },
+	{ LAYOUT_ID_FR, { 0x02, 0x2A, 0x02 }, { '&', '1' } },
+	{ LAYOUT_ID_FR, { 0x3A, 0x3A | BENCH_SIGNATURE_RELEASE, 0x10, 0x03 }, { 'A', '2' } },
+	{ LAYOUT_ID_FR, { 0x1A, 0x12 }, { 0x00EA } },
+	{ LAYOUT_ID_FR, { 0x2A, 0x1A, 0x2A | BENCH_SIGNATURE_RELEASE, 0x12 }, { 0x00EB } },
+	{ LAYOUT_ID_IL, { 0x14, 0x2A, 0x14 }, { 0x05D0, 'T' } },
+	{ LAYOUT_ID_IL, { 0xE038, 0x05 }, { 0x20AA } }
+};
+
+/********************************************************************************
+*  Global:		g_atLayoutTraces												*
+*  Purpose:		Corpus traces checked against the text they type.				*
+********************************************************************************/
+static
+const BENCH_LAYOUT_TRACE
+g_atLayoutTraces[] =
+{
+	{ "Trace/Corpus/human-1.adtrace", TRACE_CORPUS_TEXT, TRACE_CORPUS_TEXT_REPEATS },
+	{ "Trace/Corpus/human-fast-1.adtrace", TRACE_CORPUS_TEXT, TRACE_CORPUS_TEXT_REPEATS },
+	{ "Trace/Corpus/injection-1.adtrace", TRACE_CORPUS_PAYLOAD, 1 },
+	{ "Trace/Corpus/injection-jitter-1.adtrace", TRACE_CORPUS_PAYLOAD, 1 }
+};
+
+/********************************************************************************
+*  Global:		g_adwLayoutKeys													*
+*  Purpose:		The key events of the first of g_atLayoutTraces, decoded by		*
+*				every layout to measure it.										*
+********************************************************************************/
+static
+DWORD
+g_adwLayoutKeys[BENCH_LAYOUT_MAX_KEYS] = { 0 };
+
+/********************************************************************************
+*  Global:		g_atTimers														*
+*  Purpose:		The timers of the timer wheel benchmark.						*
+********************************************************************************/
+static
+BENCH_TIMER
+g_atTimers[BENCH_TIMERS] = { { { NULL }, 0, 0 } };
+
+#ifndef _WIN32
+/********************************************************************************
+*  Global:		g_adwBusAgents													*
+*  Purpose:		Numbers of stand-in session agents, smallest first.				*
+********************************************************************************/
+static
+const DWORD
+g_adwBusAgents[] = { 1, 8, BENCH_BUS_MAX_AGENTS };
+
+/********************************************************************************
+*  Global:		g_nBusReceived													*
+*  Purpose:		Decisions received by the stand-in agents, all together.		*
+********************************************************************************/
+static
+volatile LONG
+g_nBusReceived = 0;
+
+/********************************************************************************
+*  Global:		g_pszBenchPath													*
+*  Purpose:		How the benchmark was run (argv[0]), to find the notifier.		*
+********************************************************************************/
+static
+PCSTR
+g_pszBenchPath = NULL;
+#endif	// _WIN32
+
+/********************************************************************************
+*  Global:		g_atResults														*
+*  Purpose:		The results reported so far.									*
+********************************************************************************/
+static
+BENCH_RESULT
+g_atResults[BENCH_MAX_RESULTS] = { { { 0 }, 0, NULL, 0 } };
+
+/********************************************************************************
+*  Global:		g_dwResults														*
+*  Purpose:		Number of results in g_atResults.								*
+********************************************************************************/
+static
+DWORD
+g_dwResults = 0;
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	bench_Report													*
+*  Purpose:		Keeps a measurement for the printed table, the JSON output and	*
+*				the regression gate.											*
+*  Parameters:	@ dValue ~[in]~ The measurement (lower is better).				*
+*				@ pszUnit ~[in]~ Its unit, such as "ns/call".					*
+*				@ dwTolerancePercent ~[in]~ Allowed slowdown against the		*
+*				baseline.														*
+*				@ pszNameFormat ~[in]~ printf format of the result name.		*
+*  Remarks:		* A result measured again (see main's -r) keeps its best value,	*
+*					which filters out preemption and frequency noise.			*
+********************************************************************************/
+static
+VOID
+bench_Report(
+	__in double dValue,
+	__in_z PCSTR pszUnit,
+	__in DWORD dwTolerancePercent,
+	__in_z PCSTR pszNameFormat,
+	...
+)
+{
+	CHAR szName[BENCH_MAX_NAME_CHARS] = { 0 };
+	PBENCH_RESULT ptResult = NULL;
+	DWORD dwIndex = 0;
+	va_list vaArgs;
+
+	va_start(vaArgs, pszNameFormat);
+	(VOID)vsnprintf(szName, sizeof(szName), pszNameFormat, vaArgs);
+	va_end(vaArgs);
+
+	// Keep the best of repeated measurements
+	for (dwIndex = 0; dwIndex < g_dwResults; dwIndex++)
+	{
+		if (0 == strcmp(g_atResults[dwIndex].szName, szName))
+		{
+			g_atResults[dwIndex].dValue = MIN(g_atResults[dwIndex].dValue, dValue);
+			return;
+		}
+	}
+
+	// A new result
+	ASSERT(BENCH_MAX_RESULTS > g_dwResults);
+	ptResult = &(g_atResults[g_dwResults++]);
+	(VOID)strcpy(ptResult->szName, szName);
+	ptResult->dValue = dValue;
+	ptResult->pszUnit = pszUnit;
+	ptResult->dwTolerancePercent = dwTolerancePercent;
+}
+
+/********************************************************************************
+*  Function:	bench_WriteJson													*
+*  Purpose:		Writes every result as JSON.									*
+*  Parameters:	@ pszPath ~[in]~ The output file.								*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* One result per line, which is also what bench_CheckBaseline	*
+*					reads back.													*
+********************************************************************************/
+static
+RETSTATUS
+bench_WriteJson(
+	__in_z PCSTR pszPath
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	FILE* ptFile = NULL;
+	DWORD dwIndex = 0;
+
+	ptFile = fopen(pszPath, "w");
+	if (NULL == ptFile)
+	{
+		(VOID)printf("json: cannot create %s\n", pszPath);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	(VOID)fprintf(ptFile, "{\n\t\"benchmarks\": [\n");
+	for (dwIndex = 0; dwIndex < g_dwResults; dwIndex++)
+	{
+		(VOID)fprintf(ptFile, "\t\t{\"name\": \"%s\", \"value\": %.3f, \"unit\": \"%s\", \"tolerance\": %lu}%s\n",
+			g_atResults[dwIndex].szName,
+			g_atResults[dwIndex].dValue,
+			g_atResults[dwIndex].pszUnit,
+			(unsigned long)g_atResults[dwIndex].dwTolerancePercent,
+			(dwIndex + 1 < g_dwResults) ? "," : "");
+	}
+	(VOID)fprintf(ptFile, "\t]\n}\n");
+	if (0 != ferror(ptFile))
+	{
+		(VOID)printf("json: cannot write %s\n", pszPath);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	if (NULL != ptFile)
+	{
+		(VOID)fclose(ptFile);
+	}
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_CheckBaseline												*
+*  Purpose:		Compares every result with a baseline written by				*
+*				bench_WriteJson.												*
+*  Parameters:	@ pszPath ~[in]~ The baseline file.								*
+*  Returns:		A RETSTATUS, failed if a result is slower than its baseline		*
+*				by more than the baseline's tolerance.							*
+*  Remarks:		* Results missing from the baseline are reported as new and		*
+*					pass, so adding a benchmark does not break the gate.		*
+*				* Tolerances are read from the baseline, so a noisy result can	*
+*					be relaxed there without a rebuild.							*
+********************************************************************************/
+static
+RETSTATUS
+bench_CheckBaseline(
+	__in_z PCSTR pszPath
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	FILE* ptFile = NULL;
+	CHAR szLine[256] = { 0 };
+	CHAR szName[BENCH_MAX_NAME_CHARS] = { 0 };
+	BOOL abIsCompared[BENCH_MAX_RESULTS] = { FALSE };
+	double dBaseline = 0;
+	double dLimit = 0;
+	unsigned long nTolerancePercent = 0;
+	DWORD dwIndex = 0;
+	DWORD dwCompared = 0;
+	DWORD dwRegressed = 0;
+
+	ptFile = fopen(pszPath, "r");
+	if (NULL == ptFile)
+	{
+		(VOID)printf("baseline: cannot open %s\n", pszPath);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Compare the results the baseline has
+	while (NULL != fgets(szLine, sizeof(szLine), ptFile))
+	{
+		if (3 != sscanf(szLine, " {\"name\": \"%47[^\"]\", \"value\": %lf, \"unit\": \"%*[^\"]\", \"tolerance\": %lu",
+			szName,
+			&dBaseline,
+			&nTolerancePercent))
+		{
+			continue;
+		}
+		for (dwIndex = 0; dwIndex < g_dwResults; dwIndex++)
+		{
+			if (0 != strcmp(g_atResults[dwIndex].szName, szName))
+			{
+				continue;
+			}
+			abIsCompared[dwIndex] = TRUE;
+			dwCompared++;
+			dLimit = dBaseline * (100 + nTolerancePercent) / 100;
+			if (g_atResults[dwIndex].dValue > dLimit)
+			{
+				(VOID)printf("REGRESSION %-28s %12.1f %s (baseline %.1f, limit +%lu%%)\n",
+					szName,
+					g_atResults[dwIndex].dValue,
+					g_atResults[dwIndex].pszUnit,
+					dBaseline,
+					nTolerancePercent);
+				dwRegressed++;
+			}
+			break;
+		}
+	}
+	for (dwIndex = 0; dwIndex < g_dwResults; dwIndex++)
+	{
+		if (!abIsCompared[dwIndex])
+		{
+			(VOID)printf("new        %-28s (not in the baseline)\n", g_atResults[dwIndex].szName);
+		}
+	}
+	(VOID)printf("baseline: %lu compared, %lu regressed\n", (unsigned long)dwCompared, (unsigned long)dwRegressed);
+	if (0 != dwRegressed)
+	{
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	if (NULL != ptFile)
+	{
+		(VOID)fclose(ptFile);
+	}
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_FillIntervals												*
+*  Purpose:		Fills the shared intervals with a deterministic mix of human	*
+*				and injected cadence.											*
+********************************************************************************/
+static
+VOID
+bench_FillIntervals(VOID)
+{
+	DWORD dwIndex = 0;
+	DWORD dwState = 0x12345678;
+
+	// xorshift32, spread over 1 us .. 256 ms
+	for (dwIndex = 0; dwIndex < BENCH_BURST_INTERVALS; dwIndex++)
+	{
+		dwState ^= dwState << 13;
+		dwState ^= dwState >> 17;
+		dwState ^= dwState << 5;
+		g_adwIntervalsUs[dwIndex] = (dwState >> 14) + 1;
+	}
+}
+
+/********************************************************************************
+*  Function:	bench_ScoreKernel												*
+*  Purpose:		Measures a scoring kernel on a window size.						*
+*  Parameters:	@ eKernel ~[in]~ A supported kernel.							*
+*				@ dwCount ~[in]~ The window size.								*
+*  Returns:		Nanoseconds per call.											*
+********************************************************************************/
+static
+double
+bench_ScoreKernel(
+	__in CADENCE_KERNEL eKernel,
+	__in DWORD dwCount
+)
+{
+	CADENCE_STATS tStats = { 0 };
+	ULONGLONG qwStart = 0;
+	ULONGLONG qwElapsed = 0;
+	ULONGLONG qwCalls = 0;
+	ULONGLONG qwBatch = 0;
+
+	// Run batches until the minimal duration passes
+	qwStart = CLOCK_GetTimestamp();
+	do
+	{
+		for (qwBatch = 0; qwBatch < 1024; qwBatch++)
+		{
+			CADENCE_ScoreIntervalsWithKernel(eKernel, g_adwIntervalsUs, dwCount, CADENCE_FAST_INTERVAL_US, &tStats);
+			g_qwSink += tStats.qwSumSquaresUs2;
+		}
+		qwCalls += qwBatch;
+		qwElapsed = CLOCK_GetTimestamp() - qwStart;
+	} while (BENCH_MIN_DURATION_NS > qwElapsed);
+
+	// Return result
+	return (double)qwElapsed / (double)qwCalls;
+}
+
+/********************************************************************************
+*  Function:	bench_Score														*
+*  Purpose:		Verifies and measures every supported scoring kernel against	*
+*				the scalar kernel.												*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+bench_Score(VOID)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	static const DWORD s_adwCounts[] = { CADENCE_WINDOW_INTERVALS, 1023, BENCH_BURST_INTERVALS };
+	CADENCE_STATS tExpected = { 0 };
+	CADENCE_STATS tActual = { 0 };
+	DWORD dwCountIndex = 0;
+	DWORD dwCount = 0;
+	INT nKernel = 0;
+	double dScalarNs = 0;
+	double dKernelNs = 0;
+
+	for (dwCountIndex = 0; dwCountIndex < sizeof(s_adwCounts) / sizeof(s_adwCounts[0]); dwCountIndex++)
+	{
+		dwCount = s_adwCounts[dwCountIndex];
+		CADENCE_ScoreIntervalsWithKernel(CADENCE_KERNEL_SCALAR, g_adwIntervalsUs, dwCount, CADENCE_FAST_INTERVAL_US, &tExpected);
+		dScalarNs = bench_ScoreKernel(CADENCE_KERNEL_SCALAR, dwCount);
+		for (nKernel = CADENCE_KERNEL_SCALAR; nKernel < CADENCE_KERNEL_COUNT; nKernel++)
+		{
+			if (!CADENCE_IsKernelSupported((CADENCE_KERNEL)nKernel))
+			{
+				(VOID)printf("score/%s/%lu unsupported\n", g_apszKernelNames[nKernel], (unsigned long)dwCount);
+				continue;
+			}
+
+			// Results must be bit-identical to the scalar kernel
+			CADENCE_ScoreIntervalsWithKernel((CADENCE_KERNEL)nKernel, g_adwIntervalsUs, dwCount, CADENCE_FAST_INTERVAL_US, &tActual);
+			if (0 != memcmp(&tExpected, &tActual, sizeof(tActual)))
+			{
+				(VOID)printf("score/%s n=%lu: results differ from the scalar kernel\n",
+					g_apszKernelNames[nKernel],
+					(unsigned long)dwCount);
+				eStatus = DEBUG_GEN_FAIL_STATUS();
+				goto lblCleanup;
+			}
+
+			// Measure
+			dKernelNs = (CADENCE_KERNEL_SCALAR == nKernel) ? dScalarNs : bench_ScoreKernel((CADENCE_KERNEL)nKernel, dwCount);
+			bench_Report(dKernelNs, "ns/call", BENCH_TOLERANCE_PERCENT, "score/%s/%lu", g_apszKernelNames[nKernel], (unsigned long)dwCount);
+		}
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_MakeIdentity												*
+*  Purpose:		Builds a distinct, fleet-like device identity.					*
+*  Parameters:	@ dwIndex ~[in]~ The device index.								*
+*				@ ptId ~[out]~ Gets the identity.								*
+********************************************************************************/
+static
+VOID
+bench_MakeIdentity(
+	__in DWORD dwIndex,
+	__out PDEVICEID ptId
+)
+{
+	RtlZeroMemory(ptId, sizeof(*ptId));
+	ptId->bIsValid = TRUE;
+	ptId->wVendorId = 0x046D;
+	ptId->wProductId = (WORD)(0xC300 + (dwIndex % 16));
+	(VOID)snprintf(ptId->szInstance, sizeof(ptId->szInstance), "7&2A8B3C1&0&%.8lX", (unsigned long)dwIndex);
+}
+
+/********************************************************************************
+*  Function:	bench_AllowlistLookups											*
+*  Purpose:		Measures allowlist lookups of a range of identities.			*
+*  Parameters:	@ ptAllowlist ~[in]~ The allowlist.								*
+*				@ dwFirst ~[in]~ The first device index.						*
+*  Returns:		Nanoseconds per lookup.											*
+********************************************************************************/
+static
+double
+bench_AllowlistLookups(
+	__in PCALLOWLIST ptAllowlist,
+	__in DWORD dwFirst
+)
+{
+	static DEVICEID s_atIds[1024] = { { 0 } };
+	DWORD dwIndex = 0;
+	ULONGLONG qwStart = 0;
+	ULONGLONG qwElapsed = 0;
+	ULONGLONG qwCalls = 0;
+
+	// Spread the probed identities over the table
+	for (dwIndex = 0; dwIndex < sizeof(s_atIds) / sizeof(s_atIds[0]); dwIndex++)
+	{
+		bench_MakeIdentity(dwFirst + (dwIndex * 37) % BENCH_ALLOWLIST_ENTRIES, &(s_atIds[dwIndex]));
+	}
+
+	// Run batches until the minimal duration passes
+	qwStart = CLOCK_GetTimestamp();
+	do
+	{
+		for (dwIndex = 0; dwIndex < sizeof(s_atIds) / sizeof(s_atIds[0]); dwIndex++)
+		{
+			g_qwSink += (ULONGLONG)ALLOWLIST_Contains(ptAllowlist, &(s_atIds[dwIndex]));
+		}
+		qwCalls += dwIndex;
+		qwElapsed = CLOCK_GetTimestamp() - qwStart;
+	} while (BENCH_MIN_DURATION_NS > qwElapsed);
+
+	// Return result
+	return (double)qwElapsed / (double)qwCalls;
+}
+
+/********************************************************************************
+*  Function:	bench_Allowlist													*
+*  Purpose:		Verifies and measures allowlist lookups on a large fleet.		*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+bench_Allowlist(VOID)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	ALLOWLIST tAllowlist = { 0 };
+	DEVICEID tId = { 0 };
+	DWORD dwIndex = 0;
+
+	eStatus = ALLOWLIST_Create(BENCH_ALLOWLIST_ENTRIES, &tAllowlist);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		(VOID)printf("allowlist: cannot create\n");
+		goto lblCleanup;
+	}
+	for (dwIndex = 0; dwIndex < BENCH_ALLOWLIST_ENTRIES; dwIndex++)
+	{
+		bench_MakeIdentity(dwIndex, &tId);
+		(VOID)ALLOWLIST_Add(&tAllowlist, &tId);
+	}
+
+	// Every approved device must be found, and no other
+	for (dwIndex = 0; dwIndex < BENCH_ALLOWLIST_ENTRIES * 2; dwIndex++)
+	{
+		bench_MakeIdentity(dwIndex, &tId);
+		if ((BENCH_ALLOWLIST_ENTRIES > dwIndex) != ALLOWLIST_Contains(&tAllowlist, &tId))
+		{
+			(VOID)printf("allowlist: wrong answer for device %lu\n", (unsigned long)dwIndex);
+			eStatus = DEBUG_GEN_FAIL_STATUS();
+			goto lblCleanup;
+		}
+	}
+
+	// Measure
+	bench_Report(bench_AllowlistLookups(&tAllowlist, 0), "ns/lookup", BENCH_TOLERANCE_PERCENT, "allowlist/hit");
+	bench_Report(bench_AllowlistLookups(&tAllowlist, BENCH_ALLOWLIST_ENTRIES), "ns/lookup", BENCH_TOLERANCE_PERCENT, "allowlist/miss");
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	ALLOWLIST_Destroy(&tAllowlist);
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_Policy													*
+*  Purpose:		Verifies and measures the policy file: lookups through the		*
+*				mapped view, mapping a file, and a hot reload.					*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+bench_Policy(VOID)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	static DEVICEID s_atIds[1024] = { { 0 } };
+	ALLOWLIST tAllowlist = { 0 };
+	POLICY tPolicy = { 0 };
+	POLICY_STATS tStats = { 0 };
+	PPOLICY_VIEW ptView = NULL;
+	PCPOLICY_VIEW ptCurrent = NULL;
+	DEVICEID tId = { 0 };
+	DWORD dwIndex = 0;
+	BOOL bIsStarted = FALSE;
+	ULONGLONG qwStart = 0;
+	ULONGLONG qwElapsed = 0;
+	ULONGLONG qwCalls = 0;
+
+	// Publish revision 1 and follow it
+	eStatus = ALLOWLIST_Create(BENCH_ALLOWLIST_ENTRIES, &tAllowlist);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		(VOID)printf("policy: cannot create the allowlist\n");
+		goto lblCleanup;
+	}
+	for (dwIndex = 0; dwIndex < BENCH_ALLOWLIST_ENTRIES; dwIndex++)
+	{
+		bench_MakeIdentity(dwIndex, &tId);
+		(VOID)ALLOWLIST_Add(&tAllowlist, &tId);
+	}
+	eStatus = POLICY_Write(BENCH_POLICY_PATH, &tAllowlist, NULL, 0, 1);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		(VOID)printf("policy: cannot write %s\n", BENCH_POLICY_PATH);
+		goto lblCleanup;
+	}
+	eStatus = POLICY_Start(BENCH_POLICY_PATH, &tPolicy);
+	bIsStarted = TRUE;
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		(VOID)printf("policy: cannot follow %s\n", BENCH_POLICY_PATH);
+		goto lblCleanup;
+	}
+
+	// Every approved device must be found through the view, and no other
+	ptCurrent = POLICY_Enter(&tPolicy, 0);
+	for (dwIndex = 0; (NULL != ptCurrent) && (dwIndex < BENCH_ALLOWLIST_ENTRIES * 2); dwIndex++)
+	{
+		bench_MakeIdentity(dwIndex, &tId);
+		if ((BENCH_ALLOWLIST_ENTRIES > dwIndex) != ALLOWLIST_Contains(&(ptCurrent->tAllowlist), &tId))
+		{
+			break;
+		}
+	}
+	POLICY_Leave(&tPolicy, 0);
+	if (BENCH_ALLOWLIST_ENTRIES * 2 != dwIndex)
+	{
+		(VOID)printf("policy: wrong answer for device %lu\n", (unsigned long)dwIndex);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Measure a lookup the way the analysis thread does it, hits and misses alike
+	for (dwIndex = 0; dwIndex < sizeof(s_atIds) / sizeof(s_atIds[0]); dwIndex++)
+	{
+		bench_MakeIdentity((dwIndex * 37) % (BENCH_ALLOWLIST_ENTRIES * 2), &(s_atIds[dwIndex]));
+	}
+	qwStart = CLOCK_GetTimestamp();
+	do
+	{
+		for (dwIndex = 0; dwIndex < sizeof(s_atIds) / sizeof(s_atIds[0]); dwIndex++)
+		{
+			ptCurrent = POLICY_Enter(&tPolicy, 0);
+			g_qwSink += (ULONGLONG)ALLOWLIST_Contains(&(ptCurrent->tAllowlist), &(s_atIds[dwIndex]));
+			POLICY_Leave(&tPolicy, 0);
+		}
+		qwCalls += dwIndex;
+		qwElapsed = CLOCK_GetTimestamp() - qwStart;
+	} while (BENCH_MIN_DURATION_NS > qwElapsed);
+	bench_Report((double)qwElapsed / (double)qwCalls, "ns/lookup", BENCH_TOLERANCE_PERCENT, "policy/lookup");
+
+	// Measure mapping and validating a file, the bulk of a reload
+	qwCalls = 0;
+	qwStart = CLOCK_GetTimestamp();
+	do
+	{
+		eStatus = POLICY_MapView(BENCH_POLICY_PATH, &ptView);
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			(VOID)printf("policy: cannot map %s\n", BENCH_POLICY_PATH);
+			goto lblCleanup;
+		}
+		POLICY_UnmapView(ptView);
+		qwCalls++;
+		qwElapsed = CLOCK_GetTimestamp() - qwStart;
+	} while (BENCH_MIN_DURATION_NS > qwElapsed);
+	bench_Report((double)qwElapsed / (double)qwCalls / 1000, "us/map", BENCH_SYSTEM_TOLERANCE_PERCENT, "policy/map");
+
+	// Publishing revision 2 must swap it in without a restart
+	qwStart = CLOCK_GetTimestamp();
+	eStatus = POLICY_Write(BENCH_POLICY_PATH, &tAllowlist, NULL, 0, 2);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		(VOID)printf("policy: cannot write %s\n", BENCH_POLICY_PATH);
+		goto lblCleanup;
+	}
+	do
+	{
+		POLICY_GetStats(&tPolicy, &tStats);
+		qwElapsed = CLOCK_GetTimestamp() - qwStart;
+	} while ((2 != tStats.qwRevision) && (BENCH_POLICY_RELOAD_TIMEOUT_NS > qwElapsed));
+	if (2 != tStats.qwRevision)
+	{
+		(VOID)printf("policy: revision 2 was not swapped in\n");
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	bench_Report((double)qwElapsed / 1000, "us/publish", BENCH_SYSTEM_TOLERANCE_PERCENT, "policy/reload");
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	if (bIsStarted)
+	{
+		POLICY_Stop(&tPolicy);
+	}
+	(VOID)remove(BENCH_POLICY_PATH);
+	ALLOWLIST_Destroy(&tAllowlist);
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_Decode													*
+*  Purpose:		Verifies and measures decoding a kernel uevent.					*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+bench_Decode(VOID)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	EVENTSOURCE_EVENT tEvent = { 0 };
+	ULONGLONG qwStart = 0;
+	ULONGLONG qwElapsed = 0;
+	ULONGLONG qwCalls = 0;
+	DWORD dwIndex = 0;
+
+	// The message is a keyboard arrival with an identity
+	if ((!EVENTSOURCE_DecodeUevent(g_acUevent, sizeof(g_acUevent) - 1, &tEvent)) ||
+		(EVENTSOURCE_EVENT_TYPE_ARRIVAL != tEvent.eType) ||
+		(EVENTSOURCE_DEVICE_CLASS_KEYBOARD != tEvent.eClass) ||
+		(!tEvent.tIdentity.bIsValid) ||
+		(0x046D != tEvent.tIdentity.wVendorId) ||
+		(0xC31C != tEvent.tIdentity.wProductId))
+	{
+		(VOID)printf("decode: wrong event\n");
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Measure
+	qwStart = CLOCK_GetTimestamp();
+	do
+	{
+		for (dwIndex = 0; dwIndex < 1024; dwIndex++)
+		{
+			g_qwSink += (ULONGLONG)EVENTSOURCE_DecodeUevent(g_acUevent, sizeof(g_acUevent) - 1, &tEvent);
+		}
+		qwCalls += dwIndex;
+		qwElapsed = CLOCK_GetTimestamp() - qwStart;
+	} while (BENCH_MIN_DURATION_NS > qwElapsed);
+	bench_Report((double)qwElapsed / (double)qwCalls, "ns/message", BENCH_TOLERANCE_PERCENT, "decode/uevent");
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_ParseIdentity												*
+*  Purpose:		Parses the same keyboard's identity with one of the parsers.	*
+*  Parameters:	@ eParser ~[in]~ The parser.									*
+*				@ ptId ~[out]~ Gets the identity.								*
+*  Returns:		TRUE if the parser accepted its input.							*
+********************************************************************************/
+static
+BOOL
+bench_ParseIdentity(
+	__in BENCH_PARSER eParser,
+	__out PDEVICEID ptId
+)
+{
+	switch (eParser)
+	{
+	case BENCH_PARSER_INTERFACE:
+		return DEVICEID_ParseInterfaceName("\\\\?\\HID#VID_046D&PID_C31C&MI_00#7&2a8b3c1&0&0000#{884b96c3-56ef-11d1-bc8c-00a0c91405dd}", ptId);
+
+	case BENCH_PARSER_INPUT:
+		return DEVICEID_ParseInputProduct("3/46d/c31c/110", "\"7&2a8b3c1&0&0000\"", ptId);
+
+	default:
+		return DEVICEID_ParseText("046d:c31c:7&2a8b3c1&0&0000", ptId);
+	}
+}
+
+/********************************************************************************
+*  Function:	bench_DeviceId													*
+*  Purpose:		Verifies and measures every device identity parser.				*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+bench_DeviceId(VOID)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	DEVICEID tId = { 0 };
+	INT nParser = 0;
+	ULONGLONG qwStart = 0;
+	ULONGLONG qwElapsed = 0;
+	ULONGLONG qwCalls = 0;
+	DWORD dwIndex = 0;
+
+	for (nParser = 0; nParser < BENCH_PARSER_COUNT; nParser++)
+	{
+		// Every parser must find the same VID and PID
+		if ((!bench_ParseIdentity((BENCH_PARSER)nParser, &tId)) ||
+			(0x046D != tId.wVendorId) ||
+			(0xC31C != tId.wProductId))
+		{
+			(VOID)printf("deviceid/%s: wrong identity\n", g_apszParserNames[nParser]);
+			eStatus = DEBUG_GEN_FAIL_STATUS();
+			goto lblCleanup;
+		}
+
+		// Measure
+		qwCalls = 0;
+		qwStart = CLOCK_GetTimestamp();
+		do
+		{
+			for (dwIndex = 0; dwIndex < 1024; dwIndex++)
+			{
+				g_qwSink += (ULONGLONG)bench_ParseIdentity((BENCH_PARSER)nParser, &tId);
+			}
+			qwCalls += dwIndex;
+			qwElapsed = CLOCK_GetTimestamp() - qwStart;
+		} while (BENCH_MIN_DURATION_NS > qwElapsed);
+		bench_Report((double)qwElapsed / (double)qwCalls, "ns/parse", BENCH_TOLERANCE_PERCENT, "deviceid/%s", g_apszParserNames[nParser]);
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_Cadence													*
+*  Purpose:		Measures feeding keystrokes to the cadence detectors, the way	*
+*				the analysis thread does for every key report.					*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+bench_Cadence(VOID)
+{
+	CADENCE_TABLE tTable = { 0 };
+	ULONGLONG qwTimestamp = NANOSECONDS_IN_SECOND;
+	ULONGLONG qwStart = 0;
+	ULONGLONG qwElapsed = 0;
+	ULONGLONG qwCalls = 0;
+	DWORD dwIndex = 0;
+
+	// Presses and releases from a few keyboards, at the shared intervals
+	qwStart = CLOCK_GetTimestamp();
+	do
+	{
+		for (dwIndex = 0; dwIndex < BENCH_BURST_INTERVALS; dwIndex++)
+		{
+			qwTimestamp += (ULONGLONG)g_adwIntervalsUs[dwIndex] * 1000;
+			g_qwSink += (ULONGLONG)CADENCE_OnKey(&tTable,
+				dwIndex % BENCH_CADENCE_DEVICES,
+				qwTimestamp,
+				(WORD)(0x10 + (dwIndex % 26)),
+				(BOOLEAN)(0 == (dwIndex & 1)),
+				NULL);
+		}
+		qwCalls += dwIndex;
+		qwElapsed = CLOCK_GetTimestamp() - qwStart;
+	} while (BENCH_MIN_DURATION_NS > qwElapsed);
+	bench_Report((double)qwElapsed / (double)qwCalls, "ns/key", BENCH_TOLERANCE_PERCENT, "cadence/onkey");
+
+	// Free resources
+	CADENCE_Finalize(&tTable);
+
+	// Return result
+	return RETSTATUS_SUCCESS;
+}
+
+/********************************************************************************
+*  Function:	bench_Churn														*
+*  Purpose:		Frees and reallocates blocks out of order, the way device		*
+*				state and event records come and go.							*
+*  Parameters:	@ ptPool ~[inout]~ The pool to allocate from, or NULL for the	*
+*				process heap.													*
+*				@ cbBlock ~[in]~ The block size.								*
+*				@ pszName ~[in]~ The block name, for the report.				*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+bench_Churn(
+	__inout_opt PPOOL ptPool,
+	__in SIZE_T cbBlock,
+	__in_z PCSTR pszName
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	PVOID apvBlocks[BENCH_POOL_LIVE] = { NULL };
+	ULONGLONG qwStart = 0;
+	ULONGLONG qwElapsed = 0;
+	ULONGLONG qwCalls = 0;
+	DWORD dwIndex = 0;
+	DWORD dwBlock = 0;
+
+	// Replace every block once per round, in a scattered order (37 is coprime with the count)
+	qwStart = CLOCK_GetTimestamp();
+	do
+	{
+		for (dwIndex = 0; dwIndex < BENCH_POOL_LIVE; dwIndex++)
+		{
+			dwBlock = (dwIndex * 37 + (DWORD)qwCalls) % BENCH_POOL_LIVE;
+			if (NULL == ptPool)
+			{
+				FREE(apvBlocks[dwBlock]);
+				apvBlocks[dwBlock] = ALLOCZ(cbBlock);
+			}
+			else
+			{
+				POOL_FREE(ptPool, apvBlocks[dwBlock]);
+				apvBlocks[dwBlock] = POOL_Alloc(ptPool, cbBlock);
+			}
+			if (NULL == apvBlocks[dwBlock])
+			{
+				(VOID)printf("%s: allocation failure\n", pszName);
+				eStatus = DEBUG_GEN_FAIL_STATUS();
+				goto lblCleanup;
+			}
+			*(PBYTE)(apvBlocks[dwBlock]) = (BYTE)dwIndex;
+		}
+		qwCalls += dwIndex;
+		qwElapsed = CLOCK_GetTimestamp() - qwStart;
+	} while (BENCH_MIN_DURATION_NS > qwElapsed);
+	bench_Report((double)qwElapsed / (double)qwCalls,
+		"ns/block",
+		(NULL == ptPool) ? BENCH_SYSTEM_TOLERANCE_PERCENT : BENCH_TOLERANCE_PERCENT,
+		"%s/%s",
+		(NULL == ptPool) ? "heap" : "pool",
+		pszName);
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	for (dwBlock = 0; dwBlock < BENCH_POOL_LIVE; dwBlock++)
+	{
+		if (NULL == ptPool)
+		{
+			FREE(apvBlocks[dwBlock]);
+		}
+		else
+		{
+			POOL_FREE(ptPool, apvBlocks[dwBlock]);
+		}
+	}
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_ChurnSized												*
+*  Purpose:		Frees and reallocates blobs of mixed sizes out of order.		*
+*  Parameters:	@ ptClasses ~[inout]~ The size classes to allocate from (with	*
+*				ALLOCZ_POOLED), or NULL for the process heap (with ALLOCZ).		*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+bench_ChurnSized(
+	__inout_opt PPOOL_CLASSES ptClasses
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	PVOID apvBlobs[BENCH_POOL_LIVE] = { NULL };
+	ULONGLONG qwStart = 0;
+	ULONGLONG qwElapsed = 0;
+	ULONGLONG qwCalls = 0;
+	DWORD dwIndex = 0;
+	DWORD dwBlob = 0;
+
+	// Same order as bench_Churn, each blob keeps its size (97 scatters them over every class)
+	qwStart = CLOCK_GetTimestamp();
+	do
+	{
+		for (dwIndex = 0; dwIndex < BENCH_POOL_LIVE; dwIndex++)
+		{
+			dwBlob = (dwIndex * 37 + (DWORD)qwCalls) % BENCH_POOL_LIVE;
+			if (NULL == ptClasses)
+			{
+				FREE(apvBlobs[dwBlob]);
+				apvBlobs[dwBlob] = ALLOCZ(BENCH_POOL_BLOB_BYTES(dwBlob));
+			}
+			else
+			{
+				FREE_POOLED(ptClasses, apvBlobs[dwBlob], BENCH_POOL_BLOB_BYTES(dwBlob));
+				apvBlobs[dwBlob] = ALLOCZ_POOLED(ptClasses, BENCH_POOL_BLOB_BYTES(dwBlob));
+			}
+			if (NULL == apvBlobs[dwBlob])
+			{
+				(VOID)printf("sized: allocation failure\n");
+				eStatus = DEBUG_GEN_FAIL_STATUS();
+				goto lblCleanup;
+			}
+			*(PBYTE)(apvBlobs[dwBlob]) = (BYTE)dwIndex;
+		}
+		qwCalls += dwIndex;
+		qwElapsed = CLOCK_GetTimestamp() - qwStart;
+	} while (BENCH_MIN_DURATION_NS > qwElapsed);
+	bench_Report((double)qwElapsed / (double)qwCalls,
+		"ns/block",
+		(NULL == ptClasses) ? BENCH_SYSTEM_TOLERANCE_PERCENT : BENCH_TOLERANCE_PERCENT,
+		"%s/sized",
+		(NULL == ptClasses) ? "heap" : "pool");
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	for (dwBlob = 0; dwBlob < BENCH_POOL_LIVE; dwBlob++)
+	{
+		if (NULL == ptClasses)
+		{
+			FREE(apvBlobs[dwBlob]);
+		}
+		else
+		{
+			FREE_POOLED(ptClasses, apvBlobs[dwBlob], BENCH_POOL_BLOB_BYTES(dwBlob));
+		}
+	}
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_Pool														*
+*  Purpose:		Compares the block pools with the process heap for device		*
+*				detectors, event records and blobs of mixed sizes, then			*
+*				measures detector churn through the cadence table and checks	*
+*				the pools stay bounded.											*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+bench_Pool(VOID)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	POOL tPool = { 0 };
+	POOL_STATS tStats = { 0 };
+	POOL_CLASSES tClasses = { { { 0 } } };
+	CADENCE_TABLE tTable = { 0 };
+	PVOID pvLarge = NULL;
+	SIZE_T cbClass = 0;
+	ULONG dwInUse = 0;
+	ULONG dwPeakInUse = 0;
+	ULONGLONG qwTimestamp = NANOSECONDS_IN_SECOND;
+	ULONGLONG qwStart = 0;
+	ULONGLONG qwElapsed = 0;
+	ULONGLONG qwCalls = 0;
+	DWORD dwIndex = 0;
+	DWORD dwPerSlab = 0;
+
+	// Blocks of both kinds, from the heap then from a pool
+	eStatus = bench_Churn(NULL, sizeof(CADENCE_DETECTOR), "detector");
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		goto lblCleanup;
+	}
+	eStatus = bench_Churn(&tPool, sizeof(CADENCE_DETECTOR), "detector");
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		goto lblCleanup;
+	}
+	POOL_Finalize(&tPool);
+	eStatus = bench_Churn(NULL, sizeof(EVENTSOURCE_EVENT), "event");
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		goto lblCleanup;
+	}
+	eStatus = bench_Churn(&tPool, sizeof(EVENTSOURCE_EVENT), "event");
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		goto lblCleanup;
+	}
+
+	// Verify the churn never grew the pool past its peak
+	POOL_GetStats(&tPool, &tStats);
+	dwPerSlab = (POOL_SLAB_BYTES - POOL_ALIGNMENT) / tStats.cbBlock;
+	if ((0 != tStats.dwInUse) ||
+		(BENCH_POOL_LIVE != tStats.dwPeakInUse) ||
+		(tStats.dwSlabs != (BENCH_POOL_LIVE + dwPerSlab - 1) / dwPerSlab))
+	{
+		(VOID)printf("pool: %lu in use, peak %lu, %lu slabs\n",
+			(unsigned long)tStats.dwInUse,
+			(unsigned long)tStats.dwPeakInUse,
+			(unsigned long)tStats.dwSlabs);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Blobs of every size class, from the heap then through ALLOCZ_POOLED
+	eStatus = bench_ChurnSized(NULL);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		goto lblCleanup;
+	}
+	eStatus = bench_ChurnSized(&tClasses);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		goto lblCleanup;
+	}
+
+	// Verify every blob went back to its class, and that larger ones still come from the heap
+	for (cbClass = POOL_ALIGNMENT;
+		POOL_MAX_CLASS_BYTES >= cbClass;
+		cbClass = (POOL_SMALL_CLASS_BYTES > cbClass) ? cbClass + POOL_ALIGNMENT : cbClass * 2)
+	{
+		POOL_GetClassStats(&tClasses, cbClass, &tStats);
+		dwInUse += tStats.dwInUse;
+		dwPeakInUse += tStats.dwPeakInUse;
+	}
+	pvLarge = ALLOCZ_POOLED(&tClasses, POOL_MAX_CLASS_BYTES + 1);
+	if ((0 != dwInUse) || (BENCH_POOL_LIVE != dwPeakInUse) || (NULL == pvLarge))
+	{
+		(VOID)printf("pool/sized: %lu in use, peak %lu, large blob %p\n",
+			(unsigned long)dwInUse,
+			(unsigned long)dwPeakInUse,
+			pvLarge);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// More keyboards than tracked devices, typing in turn, so every key evicts
+	qwStart = CLOCK_GetTimestamp();
+	do
+	{
+		for (dwIndex = 0; dwIndex < BENCH_BURST_INTERVALS; dwIndex++)
+		{
+			qwTimestamp += (ULONGLONG)g_adwIntervalsUs[dwIndex] * 1000;
+			g_qwSink += (ULONGLONG)CADENCE_OnKey(&tTable,
+				dwIndex % BENCH_CHURN_DEVICES,
+				qwTimestamp,
+				(WORD)(0x10 + (dwIndex % 26)),
+				TRUE,
+				NULL);
+		}
+		qwCalls += dwIndex;
+		qwElapsed = CLOCK_GetTimestamp() - qwStart;
+	} while (BENCH_MIN_DURATION_NS > qwElapsed);
+	POOL_GetClassStats(&(tTable.tDetectors), sizeof(CADENCE_DETECTOR), &tStats);
+	if ((CADENCE_MAX_DEVICES != tStats.dwPeakInUse) || (qwCalls > tStats.qwAllocations + CADENCE_MAX_DEVICES))
+	{
+		(VOID)printf("cadence: %llu allocations for %llu keys, peak %lu\n",
+			tStats.qwAllocations,
+			qwCalls,
+			(unsigned long)tStats.dwPeakInUse);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	bench_Report((double)qwElapsed / (double)qwCalls, "ns/key", BENCH_TOLERANCE_PERCENT, "cadence/churn");
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	CADENCE_Finalize(&tTable);
+	FREE_POOLED(&tClasses, pvLarge, POOL_MAX_CLASS_BYTES + 1);
+	POOL_FinalizeClasses(&tClasses);
+	POOL_Finalize(&tPool);
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_FillStorm													*
+*  Purpose:		Builds the arrival storm of a dock with many composite devices.	*
+*  Remarks:		* Devices enumerate 12 ms apart, their interfaces 1 ms apart.	*
+********************************************************************************/
+static
+VOID
+bench_FillStorm(VOID)
+{
+	PEVENTSOURCE_EVENT ptEvent = NULL;
+	DWORD dwDevice = 0;
+	DWORD dwInterface = 0;
+
+	for (dwDevice = 0; dwDevice < BENCH_STORM_DEVICES; dwDevice++)
+	{
+		for (dwInterface = 0; dwInterface < BENCH_STORM_INTERFACES; dwInterface++)
+		{
+			ptEvent = &(g_atStorm[dwDevice * BENCH_STORM_INTERFACES + dwInterface]);
+			ptEvent->eType = EVENTSOURCE_EVENT_TYPE_ARRIVAL;
+			ptEvent->eClass = (2 > dwInterface) ? EVENTSOURCE_DEVICE_CLASS_KEYBOARD : EVENTSOURCE_DEVICE_CLASS_OTHER;
+			ptEvent->qwTimestamp = NANOSECONDS_IN_SECOND + (dwDevice * 12 + dwInterface) * 1000000ULL;
+			bench_MakeIdentity(dwDevice, &(ptEvent->tIdentity));
+			(VOID)snprintf(ptEvent->szName, sizeof(ptEvent->szName), "/devices/usb1/1-%lu/1-%lu:1.%lu/input/input%lu",
+				(unsigned long)dwDevice,
+				(unsigned long)dwDevice,
+				(unsigned long)dwInterface,
+				(unsigned long)(dwDevice * BENCH_STORM_INTERFACES + dwInterface));
+		}
+	}
+}
+
+/********************************************************************************
+*  Function:	bench_Coalesce													*
+*  Purpose:		Verifies and measures coalescing on an arrival storm, and		*
+*				reports the locks and system calls it saves.					*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Decided as by a source without keystrokes, where every		*
+*					unapproved keyboard arrival calls for a lock.				*
+*				* Without coalescing, every arrival is decided on its own.		*
+********************************************************************************/
+static
+RETSTATUS
+bench_Coalesce(VOID)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	static DECISION s_tDecision = { 0 };
+	COALESCE_STATS tStats = { 0 };
+	DWORD dwUncoalescedLocks = 0;
+	DWORD dwLocks = 0;
+	DWORD dwIndex = 0;
+	ULONGLONG qwStart = 0;
+	ULONGLONG qwElapsed = 0;
+	ULONGLONG qwCalls = 0;
+
+	bench_FillStorm();
+
+	// Without coalescing, each keyboard interface locks (and logs)
+	for (dwIndex = 0; dwIndex < sizeof(g_atStorm) / sizeof(g_atStorm[0]); dwIndex++)
+	{
+		DECISION_Initialize(NULL, NULL, NULL, 0, FALSE, 0, &s_tDecision);
+		dwUncoalescedLocks += DECISION_Decide(&s_tDecision, &(g_atStorm[dwIndex]), NULL, NULL, NULL) ? 1 : 0;
+		DECISION_Finalize(&s_tDecision);
+	}
+
+	// With coalescing, the storm must still lock, once
+	DECISION_Initialize(NULL, NULL, NULL, 0, FALSE, 0, &s_tDecision);
+	for (dwIndex = 0; dwIndex < sizeof(g_atStorm) / sizeof(g_atStorm[0]); dwIndex++)
+	{
+		dwLocks += DECISION_Decide(&s_tDecision, &(g_atStorm[dwIndex]), NULL, NULL, NULL) ? 1 : 0;
+	}
+	COALESCE_GetStats(&(s_tDecision.tCoalescer), &tStats);
+	DECISION_Finalize(&s_tDecision);
+	if ((1 != dwLocks) || (BENCH_STORM_DEVICES * 2 != dwUncoalescedLocks))
+	{
+		(VOID)printf("coalesce: %lu locks, %lu uncoalesced\n", (unsigned long)dwLocks, (unsigned long)dwUncoalescedLocks);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	(VOID)printf("coalesce/storm: %lu devices, %llu arrivals, %llu decided, %lu lock calls saved, %lu syscalls saved\n",
+		(unsigned long)BENCH_STORM_DEVICES,
+		tStats.qwArrivals,
+		tStats.qwArrivals - tStats.qwAbsorbedArrivals,
+		(unsigned long)(dwUncoalescedLocks - dwLocks),
+		(unsigned long)((dwUncoalescedLocks - dwLocks) * BENCH_SYSCALLS_PER_LOCK));
+
+	// Measure deciding the storm
+	qwStart = CLOCK_GetTimestamp();
+	do
+	{
+		DECISION_Initialize(NULL, NULL, NULL, 0, FALSE, 0, &s_tDecision);
+		for (dwIndex = 0; dwIndex < sizeof(g_atStorm) / sizeof(g_atStorm[0]); dwIndex++)
+		{
+			g_qwSink += (ULONGLONG)DECISION_Decide(&s_tDecision, &(g_atStorm[dwIndex]), NULL, NULL, NULL);
+		}
+		DECISION_Finalize(&s_tDecision);
+		qwCalls += dwIndex;
+		qwElapsed = CLOCK_GetTimestamp() - qwStart;
+	} while (BENCH_MIN_DURATION_NS > qwElapsed);
+	bench_Report((double)qwElapsed / (double)qwCalls, "ns/arrival", BENCH_TOLERANCE_PERCENT, "coalesce/storm");
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_Random													*
+*  Purpose:		Draws a pseudo-random number (xorshift32).						*
+*  Parameters:	@ pdwState ~[inout]~ The generator state (nonzero).				*
+*  Returns:		The number.														*
+********************************************************************************/
+static
+DWORD
+bench_Random(
+	__inout PDWORD pdwState
+)
+{
+	*pdwState ^= *pdwState << 13;
+	*pdwState ^= *pdwState >> 17;
+	*pdwState ^= *pdwState << 5;
+
+	// Return result
+	return *pdwState;
+}
+
+/********************************************************************************
+*  Function:	bench_GetRankError												*
+*  Purpose:		Measures how far the quantiles of a sketch are from the exact	*
+*				ones.															*
+*  Parameters:	@ ptSketch ~[in]~ A sketch of g_awSketchValues.					*
+*  Returns:		The largest rank error, in permille.							*
+********************************************************************************/
+static
+DWORD
+bench_GetRankError(
+	__in PCSKETCH ptSketch
+)
+{
+	static const DWORD s_adwQuantiles[] = { 1000, 5000, 25000, 50000, 75000, 95000, 99000 };
+	WORD awValues[sizeof(s_adwQuantiles) / sizeof(s_adwQuantiles[0])] = { 0 };
+	DWORD dwQuantile = 0;
+	DWORD dwIndex = 0;
+	DWORD dwBelow = 0;
+	DWORD dwRankPermille = 0;
+	DWORD dwExpectedPermille = 0;
+	DWORD dwWorstPermille = 0;
+
+	(VOID)SKETCH_GetQuantiles(ptSketch, s_adwQuantiles, sizeof(s_adwQuantiles) / sizeof(s_adwQuantiles[0]), awValues);
+	for (dwQuantile = 0; dwQuantile < sizeof(s_adwQuantiles) / sizeof(s_adwQuantiles[0]); dwQuantile++)
+	{
+		// The exact rank of the value the sketch gives
+		dwBelow = 0;
+		for (dwIndex = 0; dwIndex < BENCH_SKETCH_VALUES; dwIndex++)
+		{
+			dwBelow += (g_awSketchValues[dwIndex] <= awValues[dwQuantile]);
+		}
+		dwRankPermille = (DWORD)(((ULONGLONG)dwBelow * 1000) / BENCH_SKETCH_VALUES);
+		dwExpectedPermille = s_adwQuantiles[dwQuantile] / (SKETCH_QUANTILE_SCALE / 1000);
+		dwWorstPermille = MAX(dwWorstPermille, MAX(dwRankPermille, dwExpectedPermille) - MIN(dwRankPermille, dwExpectedPermille));
+	}
+
+	// Return result
+	return dwWorstPermille;
+}
+
+/********************************************************************************
+*  Function:	bench_Type														*
+*  Purpose:		Types keys on a device, the way a person does or the way an		*
+*				injector that waits between keys does.							*
+*  Parameters:	@ ptTable ~[inout]~ The detectors.								*
+*				@ qwDeviceId ~[in]~ The typing device.							*
+*				@ bIsInjector ~[in]~ Whether to type like the injector.			*
+*				@ dwKeys ~[in]~ Number of keys.									*
+*				@ pdwState ~[inout]~ The generator state.						*
+*				@ pqwTimestamp ~[inout]~ The time to start at, gets the time	*
+*				after the last key.												*
+*  Returns:		The number of injection verdicts.								*
+********************************************************************************/
+static
+DWORD
+bench_Type(
+	__inout PCADENCE_TABLE ptTable,
+	__in ULONGLONG qwDeviceId,
+	__in BOOL bIsInjector,
+	__in DWORD dwKeys,
+	__inout PDWORD pdwState,
+	__inout PULONGLONG pqwTimestamp
+)
+{
+	DWORD dwKey = 0;
+	DWORD dwHoldUs = 0;
+	DWORD dwIntervalUs = 0;
+	DWORD dwInjections = 0;
+
+	for (dwKey = 0; dwKey < dwKeys; dwKey++)
+	{
+		// Injectors barely hold keys and keep their pace, people do neither
+		if (bIsInjector)
+		{
+			dwHoldUs = 1000;
+			dwIntervalUs = BENCH_INJECTOR_INTERVAL_US + (bench_Random(pdwState) % 500);
+		}
+		else
+		{
+			dwHoldUs = 60000 + (bench_Random(pdwState) % 80000);
+			dwIntervalUs = dwHoldUs + 20000 + (bench_Random(pdwState) % 200000);
+		}
+		dwInjections += (CADENCE_VERDICT_INJECTION == CADENCE_OnKey(ptTable,
+			qwDeviceId,
+			*pqwTimestamp,
+			(WORD)(0x10 + (dwKey % 26)),
+			TRUE,
+			NULL));
+		(VOID)CADENCE_OnKey(ptTable,
+			qwDeviceId,
+			*pqwTimestamp + ((ULONGLONG)dwHoldUs * 1000),
+			(WORD)(0x10 + (dwKey % 26)),
+			FALSE,
+			NULL);
+		*pqwTimestamp += (ULONGLONG)dwIntervalUs * 1000;
+	}
+
+	// Return result
+	return dwInjections;
+}
+
+/********************************************************************************
+*  Function:	bench_Profile													*
+*  Purpose:		Measures the accuracy and cost of the quantile sketches, and	*
+*				checks that a learned typing profile catches an injector the	*
+*				fixed thresholds miss.											*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+bench_Profile(VOID)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	SKETCH tSketch = { 0 };
+	SKETCH tOther = { 0 };
+	CADENCE_PROFILE tProfile = { 0 };
+	CADENCE_PROFILE tLoaded = { 0 };
+	CADENCE_TABLE tTable = { 0 };
+	CADENCE_TABLE tUntrained = { 0 };
+	ULONGLONG qwTimestamp = NANOSECONDS_IN_SECOND;
+	ULONGLONG qwStart = 0;
+	ULONGLONG qwElapsed = 0;
+	ULONGLONG qwCalls = 0;
+	DWORD dwState = 0x9E3779B9;
+	DWORD dwIndex = 0;
+	DWORD dwErrorPermille = 0;
+	DWORD dwMergedErrorPermille = 0;
+	DWORD dwMissed = 0;
+	DWORD dwCaught = 0;
+	DWORD dwFalse = 0;
+
+	// Values shaped like typing intervals (in CADENCE_PROFILE_UNIT_US), two uniforms summed
+	for (dwIndex = 0; dwIndex < BENCH_SKETCH_VALUES; dwIndex++)
+	{
+		g_awSketchValues[dwIndex] = (WORD)(2000 + (bench_Random(&dwState) % 12000) + (bench_Random(&dwState) % 12000));
+	}
+
+	// Accuracy of one sketch, and of two merged halves
+	for (dwIndex = 0; dwIndex < BENCH_SKETCH_VALUES; dwIndex++)
+	{
+		SKETCH_Add(&tSketch, g_awSketchValues[dwIndex]);
+	}
+	dwErrorPermille = bench_GetRankError(&tSketch);
+	RtlZeroMemory(&tSketch, sizeof(tSketch));
+	for (dwIndex = 0; dwIndex < BENCH_SKETCH_VALUES; dwIndex++)
+	{
+		SKETCH_Add((0 == (dwIndex & 1)) ? &tSketch : &tOther, g_awSketchValues[dwIndex]);
+	}
+	SKETCH_Merge(&tSketch, &tOther);
+	dwMergedErrorPermille = bench_GetRankError(&tSketch);
+	if ((BENCH_SKETCH_MAX_ERROR_PERMILLE < dwErrorPermille) || (BENCH_SKETCH_MAX_ERROR_PERMILLE < dwMergedErrorPermille))
+	{
+		(VOID)printf("sketch: rank error %lu permille, merged %lu permille\n",
+			(unsigned long)dwErrorPermille,
+			(unsigned long)dwMergedErrorPermille);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	bench_Report((double)dwErrorPermille, "permille", BENCH_TOLERANCE_PERCENT, "sketch/rank-error");
+	bench_Report((double)dwMergedErrorPermille, "permille", BENCH_TOLERANCE_PERCENT, "sketch/merged-rank-error");
+
+	// Adding a value, and learning one (which derives thresholds now and then)
+	qwStart = CLOCK_GetTimestamp();
+	do
+	{
+		for (dwIndex = 0; dwIndex < BENCH_SKETCH_VALUES; dwIndex++)
+		{
+			SKETCH_Add(&tSketch, g_awSketchValues[dwIndex]);
+		}
+		qwCalls += dwIndex;
+		qwElapsed = CLOCK_GetTimestamp() - qwStart;
+	} while (BENCH_MIN_DURATION_NS > qwElapsed);
+	bench_Report((double)qwElapsed / (double)qwCalls, "ns/value", BENCH_TOLERANCE_PERCENT, "sketch/add");
+	qwCalls = 0;
+	qwStart = CLOCK_GetTimestamp();
+	do
+	{
+		for (dwIndex = 0; dwIndex < BENCH_SKETCH_VALUES; dwIndex++)
+		{
+			CADENCE_LearnInterval(&tProfile, (DWORD)g_awSketchValues[dwIndex] * CADENCE_PROFILE_UNIT_US);
+		}
+		qwCalls += dwIndex;
+		qwElapsed = CLOCK_GetTimestamp() - qwStart;
+	} while (BENCH_MIN_DURATION_NS > qwElapsed);
+	bench_Report((double)qwElapsed / (double)qwCalls, "ns/value", BENCH_TOLERANCE_PERCENT, "profile/learn");
+	bench_Report((double)sizeof(CADENCE_PROFILE), "bytes", BENCH_TOLERANCE_PERCENT, "profile/bytes");
+
+	// Learn the user, an injector that waits between keys then only fools the fixed thresholds
+	(VOID)bench_Type(&tTable, 1, FALSE, BENCH_PROFILE_KEYS, &dwState, &qwTimestamp);
+	dwMissed = bench_Type(&tUntrained, 2, TRUE, BENCH_PROFILE_KEYS, &dwState, &qwTimestamp);
+	dwCaught = bench_Type(&tTable, 2, TRUE, BENCH_PROFILE_KEYS, &dwState, &qwTimestamp);
+	dwFalse = bench_Type(&tTable, 1, FALSE, BENCH_PROFILE_KEYS, &dwState, &qwTimestamp);
+	if ((0 != dwMissed) || (0 == dwCaught) || (0 != dwFalse))
+	{
+		(VOID)printf("profile: injector caught %lu times untrained, %lu trained, user flagged %lu times\n",
+			(unsigned long)dwMissed,
+			(unsigned long)dwCaught,
+			(unsigned long)dwFalse);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// What is saved is what is loaded
+	CADENCE_RefreshProfile(&(tTable.tProfile));
+	eStatus = CADENCE_SaveProfile(&(tTable.tProfile), BENCH_PROFILE_PATH);
+	if (RETSTATUS_SUCCEEDED(eStatus))
+	{
+		eStatus = CADENCE_LoadProfile(BENCH_PROFILE_PATH, &tLoaded);
+	}
+	(VOID)remove(BENCH_PROFILE_PATH);
+	if ((RETSTATUS_FAILED(eStatus)) ||
+		(tLoaded.dwSteadyStddevUs != tTable.tProfile.dwSteadyStddevUs) ||
+		(tLoaded.dwShortHoldUs != tTable.tProfile.dwShortHoldUs))
+	{
+		(VOID)printf("profile: not saved and loaded as-is\n");
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	CADENCE_Finalize(&tUntrained);
+	CADENCE_Finalize(&tTable);
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_MakeRules													*
+*  Purpose:		Creates a synthetic rule set, shaped like a fleet policy.		*
+*  Parameters:	@ dwCount ~[in]~ The number of rules.							*
+*				@ ptList ~[out]~ Gets the rules.								*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Mostly approved VID:PID pairs, then vendor ranges, serial		*
+*					prefixes, time windows and cadence alerts. Free with		*
+*					RULES_Destroy.												*
+********************************************************************************/
+static
+RETSTATUS
+bench_MakeRules(
+	__in DWORD dwCount,
+	__out PRULES_LIST ptList
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	RULES_RULE tRule = { 0 };
+	CHAR szText[128] = { 0 };
+	DWORD dwState = 0x2545F491;
+	DWORD dwIndex = 0;
+	DWORD dwKind = 0;
+	DWORD dwVendor = 0;
+	DWORD dwHour = 0;
+
+	eStatus = RULES_Create(dwCount, ptList);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		goto lblCleanup;
+	}
+	for (dwIndex = 0; dwIndex < dwCount; dwIndex++)
+	{
+		dwKind = bench_Random(&dwState) % 100;
+		dwVendor = 0x0400 + (bench_Random(&dwState) % BENCH_RULES_VENDORS) * 0x11;
+		dwHour = (bench_Random(&dwState) % 4) * 6;
+		if (80 > dwKind)
+		{
+			(VOID)snprintf(szText, sizeof(szText), "allow vid=%04lX pid=%04lX",
+				(unsigned long)dwVendor,
+				(unsigned long)(bench_Random(&dwState) & 0xFFFF));
+		}
+		else if (85 > dwKind)
+		{
+			(VOID)snprintf(szText, sizeof(szText), "allow class=other vid=%04lX-%04lX",
+				(unsigned long)dwVendor,
+				(unsigned long)(dwVendor + 0x10));
+		}
+		else if (87 > dwKind)
+		{
+			(VOID)snprintf(szText, sizeof(szText), "allow vid=%04lX serial=SN%02lX*",
+				(unsigned long)dwVendor,
+				(unsigned long)(bench_Random(&dwState) & 0xFF));
+		}
+		else if (90 > dwKind)
+		{
+			(VOID)snprintf(szText, sizeof(szText), "lock event=arrival class=keyboard time=%02lu:00-%02lu:30",
+				(unsigned long)dwHour,
+				(unsigned long)((dwHour + 8) % 24));
+		}
+		else
+		{
+			(VOID)snprintf(szText, sizeof(szText), "alert event=key cadence=injection vid=%04lX",
+				(unsigned long)dwVendor);
+		}
+		if ((!RULES_ParseRule(szText, dwIndex + 1, &tRule)) || (!RULES_Add(ptList, &tRule)))
+		{
+			(VOID)printf("rules: cannot add \"%s\"\n", szText);
+			eStatus = DEBUG_GEN_FAIL_STATUS();
+			goto lblCleanup;
+		}
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		RULES_Destroy(ptList);
+	}
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_FillRuleInputs											*
+*  Purpose:		Fills the rule inputs, half of them identities the rules		*
+*				name, the rest anything.										*
+*  Parameters:	@ ptList ~[in]~ The largest rule set.							*
+********************************************************************************/
+static
+VOID
+bench_FillRuleInputs(
+	__in PCRULES_LIST ptList
+)
+{
+	PEVENTSOURCE_EVENT ptEvent = NULL;
+	PCRULES_RULE ptRule = NULL;
+	DWORD dwState = 0x7F4A7C15;
+	DWORD dwIndex = 0;
+
+	for (dwIndex = 0; dwIndex < BENCH_RULES_INPUTS; dwIndex++)
+	{
+		ptEvent = &(g_atRuleEvents[dwIndex]);
+		ptRule = &(ptList->ptRules[bench_Random(&dwState) % ptList->dwRules]);
+		ptEvent->eType = (EVENTSOURCE_EVENT_TYPE)(bench_Random(&dwState) % 3);
+		ptEvent->eClass = (EVENTSOURCE_DEVICE_CLASS)(bench_Random(&dwState) % 2);
+		ptEvent->tIdentity.bIsValid = (0 != bench_Random(&dwState) % 8);
+		ptEvent->tIdentity.wVendorId = (WORD)(0x0400 + (bench_Random(&dwState) % BENCH_RULES_VENDORS) * 0x11);
+		ptEvent->tIdentity.wProductId = (WORD)bench_Random(&dwState);
+		if ((0 != bench_Random(&dwState) % 2) && (ptRule->bHasVendorId))
+		{
+			ptEvent->tIdentity.wVendorId = ptRule->wVendorLow;
+			ptEvent->tIdentity.wProductId = ptRule->bHasProductId ? ptRule->wProductLow : ptEvent->tIdentity.wProductId;
+		}
+		(VOID)snprintf(ptEvent->tIdentity.szInstance, sizeof(ptEvent->tIdentity.szInstance), "SN%.6lX",
+			(unsigned long)(bench_Random(&dwState) & 0xFFFFFF));
+		g_atRuleInputs[dwIndex].ptEvent = ptEvent;
+		g_atRuleInputs[dwIndex].eVerdict = (CADENCE_VERDICT)(bench_Random(&dwState) % 3);
+		g_atRuleInputs[dwIndex].eSession = (RULES_SESSION)(bench_Random(&dwState) % 3);
+		g_atRuleInputs[dwIndex].dwMinuteOfDay = bench_Random(&dwState) % RULES_MINUTES_PER_DAY;
+	}
+}
+
+/********************************************************************************
+*  Function:	bench_LinearRules												*
+*  Purpose:		Finds the first matching rule by scanning the list, the			*
+*				reference and the cost compilation avoids.						*
+*  Parameters:	@ ptList ~[in]~ The rules.										*
+*				@ ptInput ~[in]~ The input.										*
+*  Returns:		The 1-based index of the rule, or 0.							*
+********************************************************************************/
+static
+DWORD
+bench_LinearRules(
+	__in PCRULES_LIST ptList,
+	__in PCRULES_INPUT ptInput
+)
+{
+	DWORD dwIndex = 0;
+
+	for (dwIndex = 0; dwIndex < ptList->dwRules; dwIndex++)
+	{
+		if (RULES_IsMatch(&(ptList->ptRules[dwIndex]), ptInput))
+		{
+			return dwIndex + 1;
+		}
+	}
+
+	return 0;
+}
+
+/********************************************************************************
+*  Function:	bench_Rules														*
+*  Purpose:		Measures evaluating compiled rule sets of growing sizes, on		*
+*				many events and on a fixed working set, and checks how the		*
+*				cost grows with them.											*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Every compiled table is first verified against a linear		*
+*					scan of its rules.											*
+*				* Also checks that session= is rejected.						*
+********************************************************************************/
+static
+RETSTATUS
+bench_Rules(VOID)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	RULES_LIST tList = { 0 };
+	RULES_RULE tRule = { 0 };
+	RULES_TABLE tTable = { 0 };
+	PVOID pvTable = NULL;
+	SIZE_T cbTable = 0;
+	DWORD dwSet = 0;
+	DWORD dwIndex = 0;
+	DWORD dwLine = 0;
+	DWORD dwExpected = 0;
+	RULES_ACTION eAction = RULES_ACTION_NONE;
+	ULONGLONG qwStart = 0;
+	ULONGLONG qwElapsed = 0;
+	ULONGLONG qwCompileNs = 0;
+	ULONGLONG qwCalls = 0;
+	double dEvalNs = 0;
+	double dFirstEvalNs = 0;
+	double dHotNs = 0;
+	double dFirstHotNs = 0;
+
+	// The session state is not tracked, so a rule asking for one is malformed
+	if (RULES_ParseRule("lock event=arrival session=locked", 1, &tRule))
+	{
+		(VOID)printf("rules: session= is accepted\n");
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// The inputs name identities of the largest set, so every set sees the same events
+	eStatus = bench_MakeRules(g_adwRuleCounts[sizeof(g_adwRuleCounts) / sizeof(g_adwRuleCounts[0]) - 1], &tList);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		goto lblCleanup;
+	}
+	bench_FillRuleInputs(&tList);
+	RULES_Destroy(&tList);
+
+	for (dwSet = 0; dwSet < sizeof(g_adwRuleCounts) / sizeof(g_adwRuleCounts[0]); dwSet++)
+	{
+		eStatus = bench_MakeRules(g_adwRuleCounts[dwSet], &tList);
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			goto lblCleanup;
+		}
+		qwStart = CLOCK_GetTimestamp();
+		eStatus = RULES_Compile(&tList, &pvTable, &cbTable);
+		qwCompileNs = CLOCK_GetTimestamp() - qwStart;
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			(VOID)printf("rules/%lu: cannot compile\n", (unsigned long)g_adwRuleCounts[dwSet]);
+			goto lblCleanup;
+		}
+		eStatus = RULES_MapTable(pvTable, cbTable, &tTable);
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			(VOID)printf("rules/%lu: the compiled table does not verify\n", (unsigned long)g_adwRuleCounts[dwSet]);
+			goto lblCleanup;
+		}
+
+		// The table must decide exactly as the rules
+		for (dwIndex = 0; dwIndex < BENCH_RULES_INPUTS; dwIndex++)
+		{
+			dwExpected = bench_LinearRules(&tList, &(g_atRuleInputs[dwIndex]));
+			eAction = RULES_Evaluate(&tTable, &(g_atRuleInputs[dwIndex]), &dwLine);
+			if ((dwExpected != dwLine) ||
+				((0 != dwExpected) && (tList.ptRules[dwExpected - 1].eAction != eAction)) ||
+				((0 == dwExpected) && (RULES_ACTION_NONE != eAction)))
+			{
+				(VOID)printf("rules/%lu: input %lu matches line %lu, expected %lu\n",
+					(unsigned long)g_adwRuleCounts[dwSet],
+					(unsigned long)dwIndex,
+					(unsigned long)dwLine,
+					(unsigned long)dwExpected);
+				eStatus = DEBUG_GEN_FAIL_STATUS();
+				goto lblCleanup;
+			}
+		}
+
+		// Measure the compiled table
+		qwCalls = 0;
+		qwStart = CLOCK_GetTimestamp();
+		do
+		{
+			for (dwIndex = 0; dwIndex < BENCH_RULES_INPUTS; dwIndex++)
+			{
+				g_qwSink += (ULONGLONG)RULES_Evaluate(&tTable, &(g_atRuleInputs[dwIndex]), NULL);
+			}
+			qwCalls += dwIndex;
+			qwElapsed = CLOCK_GetTimestamp() - qwStart;
+		} while (BENCH_MIN_DURATION_NS > qwElapsed);
+		dEvalNs = (double)qwElapsed / (double)qwCalls;
+		dFirstEvalNs = (0 == dwSet) ? dEvalNs : dFirstEvalNs;
+		bench_Report(dEvalNs, "ns/event", BENCH_TOLERANCE_PERCENT, "rules/eval/%lu", (unsigned long)g_adwRuleCounts[dwSet]);
+
+		// And on the fixed working set
+		qwCalls = 0;
+		qwStart = CLOCK_GetTimestamp();
+		do
+		{
+			for (dwIndex = 0; dwIndex < BENCH_RULES_HOT_INPUTS; dwIndex++)
+			{
+				g_qwSink += (ULONGLONG)RULES_Evaluate(&tTable, &(g_atRuleInputs[dwIndex]), NULL);
+			}
+			qwCalls += dwIndex;
+			qwElapsed = CLOCK_GetTimestamp() - qwStart;
+		} while (BENCH_MIN_DURATION_NS > qwElapsed);
+		dHotNs = (double)qwElapsed / (double)qwCalls;
+		dFirstHotNs = (0 == dwSet) ? dHotNs : dFirstHotNs;
+		bench_Report(dHotNs, "ns/event", BENCH_TOLERANCE_PERCENT, "rules/hot/%lu", (unsigned long)g_adwRuleCounts[dwSet]);
+
+		// And the scan it replaces, once over the inputs
+		qwStart = CLOCK_GetTimestamp();
+		for (dwIndex = 0; dwIndex < BENCH_RULES_INPUTS; dwIndex++)
+		{
+			g_qwSink += bench_LinearRules(&tList, &(g_atRuleInputs[dwIndex]));
+		}
+		qwElapsed = CLOCK_GetTimestamp() - qwStart;
+		(VOID)printf("rules/%lu: %lu device and %lu environment classes, %llu KB, compiled in %.1f ms, "
+			"%.1f ns/event (a linear scan takes %.1f)\n",
+			(unsigned long)g_adwRuleCounts[dwSet],
+			(unsigned long)tTable.ptHeader->adwClasses[RULES_CLASS_DEVICE],
+			(unsigned long)tTable.ptHeader->adwClasses[RULES_CLASS_ENVIRONMENT],
+			(ULONGLONG)(cbTable / 1024),
+			(double)qwCompileNs / 1e6,
+			dEvalNs,
+			(double)qwElapsed / BENCH_RULES_INPUTS);
+
+		FREE(pvTable);
+		RULES_Destroy(&tList);
+	}
+
+	// Evaluation must not grow with the rules, only the table's cache footprint may
+	if (dEvalNs > dFirstEvalNs * BENCH_RULES_MAX_SLOWDOWN)
+	{
+		(VOID)printf("rules: %lu rules evaluate %.1fx slower than %lu\n",
+			(unsigned long)g_adwRuleCounts[dwSet - 1],
+			dEvalNs / dFirstEvalNs,
+			(unsigned long)g_adwRuleCounts[0]);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	if (dHotNs > dFirstHotNs * BENCH_RULES_MAX_HOT_SLOWDOWN)
+	{
+		(VOID)printf("rules: %lu rules evaluate a fixed working set %.1fx slower than %lu\n",
+			(unsigned long)g_adwRuleCounts[dwSet - 1],
+			dHotNs / dFirstHotNs,
+			(unsigned long)g_adwRuleCounts[0]);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	FREE(pvTable);
+	RULES_Destroy(&tList);
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_TypeSignatureText											*
+*  Purpose:		Writes the text typed through the signature matcher, and the	*
+*				key events that type it.										*
+*  Parameters:	@ pdwChars ~[out]~ Gets the characters of g_acSignatureText.	*
+*  Returns:		The key events of g_adwSignatureKeys.							*
+********************************************************************************/
+static
+DWORD
+bench_TypeSignatureText(
+	__out PDWORD pdwChars
+)
+{
+	DWORD dwState = 0x2545F491;
+	DWORD dwChars = 0;
+	DWORD dwKeys = 0;
+	DWORD dwIndex = 0;
+	DWORD dwLength = 0;
+	DWORD dwShift = 0;
+	DWORD dwScanCode = 0;
+	PCSTR pszPayload = NULL;
+	CHAR cChar = 0;
+
+	// Words, with a payload now and then
+	while (BENCH_SIGNATURE_CHARS - 64 > dwChars)
+	{
+		if (0 == (bench_Random(&dwState) % 24))
+		{
+			pszPayload = g_apszSignaturePayloads[bench_Random(&dwState) % (sizeof(g_apszSignaturePayloads) / sizeof(g_apszSignaturePayloads[0]))];
+			for (dwIndex = 0; '\0' != pszPayload[dwIndex]; dwIndex++)
+			{
+				cChar = pszPayload[dwIndex];
+				g_acSignatureText[dwChars++] = (('a' <= cChar) && ('z' >= cChar) && (0 != (bench_Random(&dwState) & 1))) ?
+					(CHAR)(cChar - 'a' + 'A') :
+					cChar;
+			}
+		}
+		else
+		{
+			dwLength = 2 + (bench_Random(&dwState) % 7);
+			for (dwIndex = 0; dwIndex < dwLength; dwIndex++)
+			{
+				g_acSignatureText[dwChars++] = (CHAR)('a' + (bench_Random(&dwState) % 26));
+			}
+			if (0 == (bench_Random(&dwState) % 8))
+			{
+				g_acSignatureText[dwChars - dwLength] = (CHAR)(g_acSignatureText[dwChars - dwLength] - 'a' + 'A');
+			}
+		}
+		g_acSignatureText[dwChars++] = ' ';
+	}
+
+	// Type every character: the Windows key, or a key of the layout (with Shift if needed)
+	for (dwIndex = 0; dwIndex < dwChars; dwIndex++)
+	{
+		if ((CHAR)LAYOUT_GUI_CHAR == g_acSignatureText[dwIndex])
+		{
+			g_adwSignatureKeys[dwKeys++] = 0xE05B;
+			g_adwSignatureKeys[dwKeys++] = 0xE05B | BENCH_SIGNATURE_RELEASE;
+			continue;
+		}
+		for (dwShift = 0; dwShift < 2; dwShift++)
+		{
+			for (dwScanCode = 1; dwScanCode < 0x3A; dwScanCode++)
+			{
+				if (g_acSignatureText[dwIndex] == g_aacSignatureLayout[dwShift][dwScanCode])
+				{
+					goto lblFound;
+				}
+			}
+		}
+		continue;
+lblFound:
+		if (0 != dwShift)
+		{
+			g_adwSignatureKeys[dwKeys++] = 0x2A;
+		}
+		g_adwSignatureKeys[dwKeys++] = dwScanCode;
+		g_adwSignatureKeys[dwKeys++] = dwScanCode | BENCH_SIGNATURE_RELEASE;
+		if (0 != dwShift)
+		{
+			g_adwSignatureKeys[dwKeys++] = 0x2A | BENCH_SIGNATURE_RELEASE;
+		}
+	}
+
+	// Return result
+	*pdwChars = dwChars;
+	return dwKeys;
+}
+
+/********************************************************************************
+*  Function:	bench_CountPayloads												*
+*  Purpose:		Counts the characters of g_acSignatureText that end a payload,	*
+*				the slow way.													*
+*  Parameters:	@ dwChars ~[in]~ The characters of the text.					*
+*  Returns:		The number of characters.										*
+********************************************************************************/
+static
+DWORD
+bench_CountPayloads(
+	__in DWORD dwChars
+)
+{
+	DWORD dwEnds = 0;
+	DWORD dwEnd = 0;
+	DWORD dwPayload = 0;
+	DWORD dwLength = 0;
+	DWORD dwIndex = 0;
+	CHAR cChar = 0;
+
+	for (dwEnd = 1; dwEnd <= dwChars; dwEnd++)
+	{
+		for (dwPayload = 0; dwPayload < sizeof(g_apszSignaturePayloads) / sizeof(g_apszSignaturePayloads[0]); dwPayload++)
+		{
+			dwLength = (DWORD)strlen(g_apszSignaturePayloads[dwPayload]);
+			for (dwIndex = 0; (dwIndex < dwLength) && (dwLength <= dwEnd); dwIndex++)
+			{
+				cChar = g_acSignatureText[dwEnd - dwLength + dwIndex];
+				cChar = (('A' <= cChar) && ('Z' >= cChar)) ? (CHAR)(cChar - 'A' + 'a') : cChar;
+				if (cChar != g_apszSignaturePayloads[dwPayload][dwIndex])
+				{
+					break;
+				}
+			}
+			if ((dwLength <= dwEnd) && (dwIndex == dwLength))
+			{
+				dwEnds++;
+				break;
+			}
+		}
+	}
+
+	// Return result
+	return dwEnds;
+}
+
+/********************************************************************************
+*  Function:	bench_Signature													*
+*  Purpose:		Checks the signature matcher against a slow count, and			*
+*				measures it per key event with growing signature sets.			*
+*				Also checks that a line too long to load is skipped whole.		*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* The key events run through SIGNATURE_OnKey as a keyboard		*
+*					types them, releases and Shift included.					*
+********************************************************************************/
+static
+RETSTATUS
+bench_Signature(VOID)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	SIGNATURE_SET tSet;
+	SIGNATURE_STREAMS tStreams;
+	FILE *ptFile = NULL;
+	DWORD dwPayloads = sizeof(g_apszSignaturePayloads) / sizeof(g_apszSignaturePayloads[0]);
+	DWORD dwSignatures = 0;
+	DWORD dwChars = 0;
+	DWORD dwKeys = 0;
+	DWORD dwExpected = 0;
+	DWORD dwMatches = 0;
+	DWORD dwState = 0x1B873593;
+	DWORD dwSet = 0;
+	DWORD dwIndex = 0;
+	DWORD dwLength = 0;
+	ULONGLONG qwStart = 0;
+	ULONGLONG qwElapsed = 0;
+	ULONGLONG qwCompileNs = 0;
+	ULONGLONG qwCalls = 0;
+	double dKeyNs = 0;
+
+	RtlZeroMemory(&tSet, sizeof(tSet));
+
+	// A line of 258 characters between two that fit (the last one, without a line break, just does)
+	ptFile = fopen(BENCH_SIGNATURE_PATH, "w");
+	if (NULL == ptFile)
+	{
+		(VOID)printf("signature: cannot write %s\n", BENCH_SIGNATURE_PATH);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	(VOID)fprintf(ptFile, "iwr http\n%0255dxyz\n%0255d", 0, 0);
+	CLOSE(ptFile, fclose);
+	eStatus = SIGNATURE_Load(BENCH_SIGNATURE_PATH, &tSet);
+	if ((RETSTATUS_FAILED(eStatus)) || (2 != tSet.dwSignatures))
+	{
+		(VOID)printf("signature: %lu signatures loaded of 2\n", (unsigned long)tSet.dwSignatures);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	SIGNATURE_Destroy(&tSet);
+	dwKeys = bench_TypeSignatureText(&dwChars);
+	dwExpected = bench_CountPayloads(dwChars);
+
+	// The payloads, then random signatures
+	for (dwIndex = 0; dwIndex < dwPayloads; dwIndex++)
+	{
+		g_apszSignatures[dwIndex] = g_apszSignaturePayloads[dwIndex];
+		g_adwSignatureChars[dwIndex] = (DWORD)strlen(g_apszSignaturePayloads[dwIndex]);
+	}
+	for (dwIndex = 0; dwIndex < BENCH_SIGNATURE_MAX_RANDOM; dwIndex++)
+	{
+		dwLength = 6 + (bench_Random(&dwState) % (BENCH_SIGNATURE_RANDOM_CHARS - 5));
+		g_apszSignatures[dwPayloads + dwIndex] = g_aacSignatureRandom[dwIndex];
+		g_adwSignatureChars[dwPayloads + dwIndex] = dwLength;
+		while (0 != dwLength)
+		{
+			g_aacSignatureRandom[dwIndex][--dwLength] = (CHAR)('a' + (bench_Random(&dwState) % 26));
+		}
+	}
+
+	for (dwSet = 0; dwSet < sizeof(g_adwSignatureRandom) / sizeof(g_adwSignatureRandom[0]); dwSet++)
+	{
+		dwSignatures = dwPayloads + g_adwSignatureRandom[dwSet];
+		qwStart = CLOCK_GetTimestamp();
+		eStatus = SIGNATURE_Compile(g_apszSignatures, g_adwSignatureChars, dwSignatures, &tSet);
+		qwCompileNs = CLOCK_GetTimestamp() - qwStart;
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			(VOID)printf("signature/%lu: cannot compile\n", (unsigned long)dwSignatures);
+			goto lblCleanup;
+		}
+
+		// Every payload typed must match, random signatures may only add matches
+		RtlZeroMemory(&tStreams, sizeof(tStreams));
+		dwMatches = 0;
+		for (dwIndex = 0; dwIndex < dwKeys; dwIndex++)
+		{
+			dwMatches += (0 != SIGNATURE_OnKey(&tSet,
+				&tStreams,
+				1,
+				dwIndex,
+				(WORD)g_adwSignatureKeys[dwIndex],
+				0 == (g_adwSignatureKeys[dwIndex] & BENCH_SIGNATURE_RELEASE)));
+		}
+		if ((0 == dwExpected) ||
+			((0 == g_adwSignatureRandom[dwSet]) && (dwExpected != dwMatches)) ||
+			(dwExpected > dwMatches))
+		{
+			(VOID)printf("signature/%lu: %lu payloads matched, expected %lu\n",
+				(unsigned long)dwSignatures,
+				(unsigned long)dwMatches,
+				(unsigned long)dwExpected);
+			eStatus = DEBUG_GEN_FAIL_STATUS();
+			goto lblCleanup;
+		}
+
+		// Measure a key event
+		qwCalls = 0;
+		qwStart = CLOCK_GetTimestamp();
+		do
+		{
+			for (dwIndex = 0; dwIndex < dwKeys; dwIndex++)
+			{
+				g_qwSink += SIGNATURE_OnKey(&tSet,
+					&tStreams,
+					1,
+					dwIndex,
+					(WORD)g_adwSignatureKeys[dwIndex],
+					0 == (g_adwSignatureKeys[dwIndex] & BENCH_SIGNATURE_RELEASE));
+			}
+			qwCalls += dwIndex;
+			qwElapsed = CLOCK_GetTimestamp() - qwStart;
+		} while (BENCH_MIN_DURATION_NS > qwElapsed);
+		dKeyNs = (double)qwElapsed / (double)qwCalls;
+		bench_Report(dKeyNs, "ns/key", BENCH_TOLERANCE_PERCENT, "signature/onkey/%lu", (unsigned long)dwSignatures);
+		(VOID)printf("signature/%lu: %lu states of %lu classes, %llu KB, compiled in %.1f ms, %.1f ns/key (%.1f M keys/s)\n",
+			(unsigned long)dwSignatures,
+			(unsigned long)tSet.dwStates,
+			(unsigned long)tSet.dwClasses,
+			(ULONGLONG)tSet.dwStates * tSet.dwClasses * sizeof(tSet.pwTransitions[0]) / 1024,
+			(double)qwCompileNs / 1e6,
+			dKeyNs,
+			1e3 / dKeyNs);
+		SIGNATURE_Destroy(&tSet);
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	SIGNATURE_Destroy(&tSet);
+	CLOSE(ptFile, fclose);
+	(VOID)remove(BENCH_SIGNATURE_PATH);
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_DecodeTrace												*
+*  Purpose:		Checks that a corpus trace decodes (US layout) to the text it	*
+*				types.															*
+*  Parameters:	@ ptTrace ~[in]~ The trace.										*
+*				@ adwKeys ~[out_opt]~ Gets its key events (up to				*
+*				BENCH_LAYOUT_MAX_KEYS), or NULL.								*
+*				@ pdwKeys ~[out]~ Gets the number of key events.				*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+bench_DecodeTrace(
+	__in PCBENCH_LAYOUT_TRACE ptTrace,
+	__out_opt PDWORD adwKeys,
+	__out PDWORD pdwKeys
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	TRACE_READER tReader = { 0 };
+	EVENTSOURCE_EVENT tEvent = { 0 };
+	LAYOUT_STATE tState = { 0 };
+	WORD awChars[LAYOUT_MAX_CHARS] = { 0 };
+	DWORD dwTextChars = (DWORD)strlen(ptTrace->pszText);
+	DWORD dwChars = 0;
+	DWORD dwDecoded = 0;
+	DWORD dwKeys = 0;
+	DWORD dwIndex = 0;
+
+	eStatus = TRACE_Open(ptTrace->pszPath, &tReader);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		(VOID)printf("layout: cannot load %s\n", ptTrace->pszPath);
+		goto lblCleanup;
+	}
+
+	// Every character typed must be the next of the text
+	while (TRACE_Read(&tReader, &tEvent))
+	{
+		if (EVENTSOURCE_EVENT_TYPE_KEY != tEvent.eType)
+		{
+			continue;
+		}
+		if ((NULL != adwKeys) && (BENCH_LAYOUT_MAX_KEYS > dwKeys))
+		{
+			adwKeys[dwKeys] = tEvent.wScanCode | (tEvent.bIsKeyDown ? 0 : BENCH_SIGNATURE_RELEASE);
+		}
+		dwKeys++;
+		dwChars = LAYOUT_Decode(LAYOUT_ID_US, &tState, tEvent.wScanCode, tEvent.bIsKeyDown, awChars);
+		for (dwIndex = 0; dwIndex < dwChars; dwIndex++)
+		{
+			if ((dwDecoded >= dwTextChars * ptTrace->dwRepeats) ||
+				((WORD)(BYTE)ptTrace->pszText[dwDecoded % dwTextChars] != awChars[dwIndex]))
+			{
+				(VOID)printf("layout: %s decodes 0x%.4x at character %lu\n",
+					ptTrace->pszPath,
+					(unsigned)awChars[dwIndex],
+					(unsigned long)dwDecoded);
+				eStatus = DEBUG_GEN_FAIL_STATUS();
+				goto lblCleanup;
+			}
+			dwDecoded++;
+		}
+	}
+	if ((tReader.bIsCorrupt) || (dwTextChars * ptTrace->dwRepeats != dwDecoded) || (BENCH_LAYOUT_MAX_KEYS < dwKeys))
+	{
+		(VOID)printf("layout: %s decodes %lu characters of %lu\n",
+			ptTrace->pszPath,
+			(unsigned long)dwDecoded,
+			(unsigned long)(dwTextChars * ptTrace->dwRepeats));
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Success
+	*pdwKeys = dwKeys;
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	TRACE_CloseReader(&tReader);
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_Layout													*
+*  Purpose:		Checks the layout decoder on known keystrokes and on the		*
+*				recorded corpus, and measures it per key event on every			*
+*				layout.															*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* The measured key events are those of a human corpus trace,	*
+*					releases included, as the signature matcher decodes them.	*
+*					Other layouts decode them to their own characters, dead		*
+*					keys included.												*
+********************************************************************************/
+static
+RETSTATUS
+bench_Layout(VOID)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	PCBENCH_LAYOUT_CASE ptCase = NULL;
+	LAYOUT_STATE tState = { 0 };
+	WORD awChars[LAYOUT_MAX_CHARS * 2] = { 0 };
+	DWORD dwChars = 0;
+	DWORD dwKeys = 0;
+	DWORD dwIgnored = 0;
+	DWORD dwIndex = 0;
+	DWORD dwLayout = 0;
+	ULONGLONG qwStart = 0;
+	ULONGLONG qwElapsed = 0;
+	ULONGLONG qwCalls = 0;
+	double dKeyNs = 0;
+
+	// Known keystrokes
+	for (dwIndex = 0; dwIndex < sizeof(g_atLayoutCases) / sizeof(g_atLayoutCases[0]); dwIndex++)
+	{
+		ptCase = &(g_atLayoutCases[dwIndex]);
+		RtlZeroMemory(&tState, sizeof(tState));
+		RtlZeroMemory(awChars, sizeof(awChars));
+		dwChars = 0;
+		for (dwKeys = 0; (dwKeys < BENCH_LAYOUT_CASE_KEYS) && (0 != ptCase->adwKeys[dwKeys]); dwKeys++)
+		{
+			dwChars += LAYOUT_Decode(ptCase->eLayout,
+				&tState,
+				(WORD)ptCase->adwKeys[dwKeys],
+				0 == (ptCase->adwKeys[dwKeys] & BENCH_SIGNATURE_RELEASE),
+				&(awChars[MIN(dwChars, LAYOUT_MAX_CHARS)]));
+		}
+		if ((sizeof(awChars) / sizeof(awChars[0]) <= dwChars) || (0 != memcmp(awChars, ptCase->awChars, sizeof(awChars))))
+		{
+			(VOID)printf("layout/%s: case %lu decodes 0x%.4x 0x%.4x (%lu characters), expected 0x%.4x 0x%.4x\n",
+				LAYOUT_GetName(ptCase->eLayout),
+				(unsigned long)dwIndex,
+				(unsigned)awChars[0],
+				(unsigned)awChars[1],
+				(unsigned long)dwChars,
+				(unsigned)ptCase->awChars[0],
+				(unsigned)ptCase->awChars[1]);
+			eStatus = DEBUG_GEN_FAIL_STATUS();
+			goto lblCleanup;
+		}
+	}
+
+	// The recorded corpus, keeping the key events of the first trace
+	for (dwIndex = 0; dwIndex < sizeof(g_atLayoutTraces) / sizeof(g_atLayoutTraces[0]); dwIndex++)
+	{
+		eStatus = bench_DecodeTrace(&(g_atLayoutTraces[dwIndex]),
+			(0 == dwIndex) ? g_adwLayoutKeys : NULL,
+			(0 == dwIndex) ? &dwKeys : &dwIgnored);
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			goto lblCleanup;
+		}
+	}
+
+	// Measure a key event on every layout
+	for (dwLayout = 0; dwLayout < LAYOUT_ID_COUNT; dwLayout++)
+	{
+		RtlZeroMemory(&tState, sizeof(tState));
+		qwCalls = 0;
+		qwStart = CLOCK_GetTimestamp();
+		do
+		{
+			for (dwIndex = 0; dwIndex < dwKeys; dwIndex++)
+			{
+				g_qwSink += LAYOUT_Decode((LAYOUT_ID)dwLayout,
+					&tState,
+					(WORD)g_adwLayoutKeys[dwIndex],
+					0 == (g_adwLayoutKeys[dwIndex] & BENCH_SIGNATURE_RELEASE),
+					awChars);
+			}
+			g_qwSink += awChars[0];
+			qwCalls += dwIndex;
+			qwElapsed = CLOCK_GetTimestamp() - qwStart;
+		} while (BENCH_MIN_DURATION_NS > qwElapsed);
+		dKeyNs = (double)qwElapsed / (double)qwCalls;
+		bench_Report(dKeyNs, "ns/key", BENCH_TOLERANCE_PERCENT, "layout/decode/%s", LAYOUT_GetName((LAYOUT_ID)dwLayout));
+		(VOID)printf("layout/%s: %.1f ns/key (%.1f M keys/s)\n", LAYOUT_GetName((LAYOUT_ID)dwLayout), dKeyNs, 1e3 / dKeyNs);
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_TraceClock												*
+*  Purpose:		Verifies that a recorded trace carries its clock offsets as		*
+*				they move, and that the decision state drops readings within	*
+*				a second of its offset.											*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+bench_TraceClock(VOID)
+{
+	static DECISION s_tDecision;
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	TRACE_WRITER tWriter = { 0 };
+	TRACE_READER tReader = { 0 };
+	EVENTSOURCE_EVENT tEvent;
+	ULONGLONG aqwOffsets[2] = { 0 };
+	BOOL abMoved[2] = { FALSE };
+
+	// An event, the clock moves by an hour, another event, and it moves again as the recorder stops
+	RtlZeroMemory(&tEvent, sizeof(tEvent));
+	tEvent.eType = EVENTSOURCE_EVENT_TYPE_KEY;
+	tEvent.eClass = EVENTSOURCE_DEVICE_CLASS_KEYBOARD;
+	tEvent.qwTimestamp = 5 * NANOSECONDS_IN_SECOND;
+	eStatus = TRACE_Create(BENCH_TRACE_PATH, TRUE, 3600 * NANOSECONDS_IN_SECOND, &tWriter);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		(VOID)printf("trace/clock: cannot create %s\n", BENCH_TRACE_PATH);
+		goto lblCleanup;
+	}
+	if ((!TRACE_Write(&tWriter, &tEvent)) ||
+		(!TRACE_WriteClock(&tWriter, 7200 * NANOSECONDS_IN_SECOND)) ||
+		(!TRACE_Write(&tWriter, &tEvent)) ||
+		(!TRACE_WriteClock(&tWriter, 60 * NANOSECONDS_IN_SECOND)))
+	{
+		(VOID)printf("trace/clock: cannot write %s\n", BENCH_TRACE_PATH);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	TRACE_CloseWriter(&tWriter);
+
+	// Each event sees the offset of its time, the trailing record is not an event
+	eStatus = TRACE_Open(BENCH_TRACE_PATH, &tReader);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		(VOID)printf("trace/clock: cannot load %s\n", BENCH_TRACE_PATH);
+		goto lblCleanup;
+	}
+	aqwOffsets[0] = TRACE_Read(&tReader, &tEvent) ? tReader.qwClockOffset : 0;
+	aqwOffsets[1] = TRACE_Read(&tReader, &tEvent) ? tReader.qwClockOffset : 0;
+	if ((3600 * NANOSECONDS_IN_SECOND != aqwOffsets[0]) ||
+		(7200 * NANOSECONDS_IN_SECOND != aqwOffsets[1]) ||
+		(TRACE_Read(&tReader, &tEvent)) ||
+		(tReader.bIsCorrupt))
+	{
+		(VOID)printf("trace/clock: events read at offsets %llu and %llu s\n",
+			aqwOffsets[0] / NANOSECONDS_IN_SECOND,
+			aqwOffsets[1] / NANOSECONDS_IN_SECOND);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	TRACE_Rewind(&tReader);
+	if (3600 * NANOSECONDS_IN_SECOND != tReader.qwClockOffset)
+	{
+		(VOID)printf("trace/clock: rewound to offset %llu s\n", tReader.qwClockOffset / NANOSECONDS_IN_SECOND);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// A reading within a second (either way, across midnight too) is the same clock
+	DECISION_Initialize(NULL, NULL, NULL, 0, TRUE, NANOSECONDS_IN_SECOND / 2, &s_tDecision);
+	abMoved[0] = DECISION_SetClockOffset(&s_tDecision, 24 * 3600 * NANOSECONDS_IN_SECOND - NANOSECONDS_IN_SECOND / 4);
+	abMoved[1] = DECISION_SetClockOffset(&s_tDecision, 2 * NANOSECONDS_IN_SECOND);
+	aqwOffsets[0] = s_tDecision.qwClockOffset;
+	DECISION_Finalize(&s_tDecision);
+	if ((abMoved[0]) || (!abMoved[1]) || (2 * NANOSECONDS_IN_SECOND != aqwOffsets[0]))
+	{
+		(VOID)printf("trace/clock: the decision state follows the wrong readings\n");
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	TRACE_CloseWriter(&tWriter);
+	TRACE_CloseReader(&tReader);
+	(VOID)remove(BENCH_TRACE_PATH);
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_QueueConsumer												*
+*  Purpose:		Drains the benchmarked queue, as the analysis thread does.		*
+*  Parameters:	@ pvQueue ~[inout]~ The queue.									*
+*  Returns:		Zero.															*
+********************************************************************************/
+static
+UINT
+WINAPI
+bench_QueueConsumer(
+	__inout_opt PVOID pvQueue
+)
+{
+	PSPSCQUEUE ptQueue = (PSPSCQUEUE)pvQueue;
+	PEVENTSOURCE_EVENT ptEvents = NULL;
+	ULONG dwCount = 0;
+
+	while (SPSCQUEUE_Wait(ptQueue))
+	{
+		dwCount = SPSCQUEUE_Peek(ptQueue, (PVOID *)&ptEvents);
+		g_qwSink += (0 != dwCount) ? ptEvents[0].qwTimestamp : 0;
+		SPSCQUEUE_Release(ptQueue, dwCount);
+	}
+
+	return 0;
+}
+
+#ifndef _WIN32
+/********************************************************************************
+*  Function:	bench_OnAlarm													*
+*  Purpose:		Interrupts the consumer's wait, and nothing else.				*
+*  Parameters:	@ nSignal ~[in]~ The signal.									*
+********************************************************************************/
+static
+VOID
+bench_OnAlarm(
+	__in INT nSignal
+)
+{
+	UNREFERENCED_PARAMETER(nSignal);
+}
+
+/********************************************************************************
+*  Function:	bench_QueueInterrupted											*
+*  Purpose:		Checks that a bounded wait on the empty queue ends on time		*
+*				while signals keep interrupting it.								*
+*  Parameters:	@ ptQueue ~[inout]~ The empty queue.							*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+bench_QueueInterrupted(
+	__inout PSPSCQUEUE ptQueue
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	struct sigaction tAction = { 0 };
+	struct sigaction tPrevious = { 0 };
+	struct itimerval tTimer = { { 0 }, { 0 } };
+	BOOL bIsInstalled = FALSE;
+	ULONGLONG qwStart = 0;
+	ULONGLONG qwElapsed = 0;
+
+	// Without SA_RESTART, so the signals interrupt poll()
+	tAction.sa_handler = bench_OnAlarm;
+	(VOID)sigemptyset(&(tAction.sa_mask));
+	tTimer.it_value.tv_usec = BENCH_QUEUE_SIGNAL_US;
+	tTimer.it_interval.tv_usec = BENCH_QUEUE_SIGNAL_US;
+	if (0 != sigaction(SIGALRM, &tAction, &tPrevious))
+	{
+		(VOID)printf("queue/interrupted: cannot handle SIGALRM\n");
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	bIsInstalled = TRUE;
+	if (0 != setitimer(ITIMER_REAL, &tTimer, NULL))
+	{
+		(VOID)printf("queue/interrupted: cannot arm the timer\n");
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Must neither end early nor block past the timeout
+	qwStart = CLOCK_GetTimestamp();
+	(VOID)SPSCQUEUE_WaitFor(ptQueue, BENCH_QUEUE_TIMEOUT_MS);
+	qwElapsed = CLOCK_GetTimestamp() - qwStart;
+	if ((BENCH_QUEUE_TIMEOUT_MS * NANOSECONDS_IN_MILLISECOND > qwElapsed) ||
+		(BENCH_QUEUE_TIMEOUT_MS * 4 * NANOSECONDS_IN_MILLISECOND < qwElapsed))
+	{
+		(VOID)printf("queue/interrupted: a %lu ms wait took %llu ms\n",
+			(unsigned long)BENCH_QUEUE_TIMEOUT_MS,
+			qwElapsed / NANOSECONDS_IN_MILLISECOND);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	RtlZeroMemory(&tTimer, sizeof(tTimer));
+	(VOID)setitimer(ITIMER_REAL, &tTimer, NULL);
+	if (bIsInstalled)
+	{
+		(VOID)sigaction(SIGALRM, &tPrevious, NULL);
+	}
+
+	// Return result
+	return eStatus;
+}
+#endif	// _WIN32
+
+/********************************************************************************
+*  Function:	bench_Queue														*
+*  Purpose:		Measures passing events through the capture queue, on one		*
+*				thread and between two, and checks that an interrupted wait		*
+*				keeps its timeout.												*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+bench_Queue(VOID)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	SPSCQUEUE tQueue = { 0 };
+	EVENTSOURCE_EVENT tEvent = { 0 };
+	PEVENTSOURCE_EVENT ptEvents = NULL;
+	HANDLE hConsumer = NULL;
+	BOOL bIsCreated = FALSE;
+	ULONG dwCount = 0;
+	DWORD dwIndex = 0;
+	ULONGLONG qwStart = 0;
+	ULONGLONG qwElapsed = 0;
+	ULONGLONG qwCalls = 0;
+
+	eStatus = SPSCQUEUE_Create(sizeof(EVENTSOURCE_EVENT), BENCH_QUEUE_CAPACITY, &tQueue);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		(VOID)printf("queue: cannot create\n");
+		goto lblCleanup;
+	}
+	bIsCreated = TRUE;
+	tEvent.eType = EVENTSOURCE_EVENT_TYPE_KEY;
+
+	// A batch in, then drained, on one thread (the cost without contention)
+	qwStart = CLOCK_GetTimestamp();
+	do
+	{
+		for (dwIndex = 0; dwIndex < BENCH_QUEUE_BATCH; dwIndex++)
+		{
+			tEvent.qwTimestamp = dwIndex;
+			(VOID)SPSCQUEUE_Enqueue(&tQueue, &tEvent);
+		}
+		for (dwCount = 0; dwCount < BENCH_QUEUE_BATCH; dwCount += dwIndex)
+		{
+			dwIndex = SPSCQUEUE_Peek(&tQueue, (PVOID *)&ptEvents);
+			g_qwSink += ptEvents[0].qwTimestamp;
+			SPSCQUEUE_Release(&tQueue, dwIndex);
+		}
+		qwCalls += dwCount;
+		qwElapsed = CLOCK_GetTimestamp() - qwStart;
+	} while (BENCH_MIN_DURATION_NS > qwElapsed);
+	bench_Report((double)qwElapsed / (double)qwCalls, "ns/event", BENCH_TOLERANCE_PERCENT, "queue/batch");
+
+#ifndef _WIN32
+	// Drained, so nothing wakes the wait but the signals
+	eStatus = bench_QueueInterrupted(&tQueue);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		goto lblCleanup;
+	}
+#endif	// _WIN32
+
+	// A stream to a consumer thread (the cost with cache line transfers and wakeups)
+	hConsumer = BEGIN_THREAD(bench_QueueConsumer, &tQueue, 0);
+	if (NULL == hConsumer)
+	{
+		(VOID)printf("queue: cannot start the consumer\n");
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	qwCalls = 0;
+	qwStart = CLOCK_GetTimestamp();
+	do
+	{
+		for (dwIndex = 0; dwIndex < BENCH_QUEUE_CAPACITY * 16; dwIndex++)
+		{
+			tEvent.qwTimestamp = dwIndex;
+			while (!SPSCQUEUE_Enqueue(&tQueue, &tEvent))
+			{
+				// Full, let the consumer catch up (it may share the CPU)
+#ifdef _WIN32
+				(VOID)SwitchToThread();
+#else	// _WIN32
+				(VOID)sched_yield();
+#endif	// _WIN32
+			}
+		}
+		qwCalls += dwIndex;
+		qwElapsed = CLOCK_GetTimestamp() - qwStart;
+	} while (BENCH_MIN_DURATION_NS > qwElapsed);
+	SPSCQUEUE_Close(&tQueue);
+	JOIN_THREAD(hConsumer);
+	qwElapsed = CLOCK_GetTimestamp() - qwStart;
+	bench_Report((double)qwElapsed / (double)qwCalls, "ns/event", BENCH_SYSTEM_TOLERANCE_PERCENT, "queue/threads");
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	if (bIsCreated)
+	{
+		SPSCQUEUE_Destroy(&tQueue);
+	}
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_OnTimer													*
+*  Purpose:		Records when a benchmarked timer runs.							*
+*  Parameters:	@ ptTimer ~[inout]~ The timer.									*
+*				@ qwNow ~[in]~ The time the wheel was advanced to.				*
+*				@ pvRuns ~[inout]~ The DWORD counting the timers run.			*
+********************************************************************************/
+static
+VOID
+bench_OnTimer(
+	__inout PTIMERWHEEL_TIMER ptTimer,
+	__in ULONGLONG qwNow,
+	__inout_opt PVOID pvRuns
+)
+{
+	PBENCH_TIMER ptBenchTimer = (PBENCH_TIMER)((PBYTE)ptTimer - offsetof(BENCH_TIMER, tTimer));
+
+	ptBenchTimer->qwRunTimestamp = qwNow;
+	(*(PDWORD)pvRuns)++;
+}
+
+/********************************************************************************
+*  Function:	bench_TimerWheel												*
+*  Purpose:		Measures arming, cancelling and running many timers, and		*
+*				verifies that each runs once, neither early nor more than a		*
+*				tick late.														*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Runs on simulated time, waiting as the analysis thread does:	*
+*					for the wheel's timeout, then advancing it.					*
+********************************************************************************/
+static
+RETSTATUS
+bench_TimerWheel(VOID)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	static TIMERWHEEL s_tWheel = { 0 };
+	TIMERWHEEL_STATS tStats = { 0 };
+	PBENCH_TIMER ptTimer = NULL;
+	ULONGLONG qwArmed = NANOSECONDS_IN_SECOND;
+	ULONGLONG qwDeadline = 0;
+	ULONGLONG qwNow = 0;
+	ULONGLONG qwStart = 0;
+	ULONGLONG qwArmNs = 0;
+	ULONGLONG qwCancelNs = 0;
+	ULONGLONG qwRunNs = 0;
+	ULONGLONG qwCalls = 0;
+	DWORD dwState = 0x3C6EF372;
+	DWORD dwRuns = 0;
+	DWORD dwWakeups = 0;
+	DWORD dwTimeoutMs = 0;
+	DWORD dwIndex = 0;
+
+	// Deadlines spread over every level
+	for (dwIndex = 0; dwIndex < BENCH_TIMERS; dwIndex++)
+	{
+		TIMERWHEEL_InitializeTimer(&(g_atTimers[dwIndex].tTimer), bench_OnTimer, &dwRuns);
+		g_atTimers[dwIndex].qwDelay = (ULONGLONG)(bench_Random(&dwState) % BENCH_TIMER_MAX_DELAY_MS) * NANOSECONDS_IN_MILLISECOND +
+			bench_Random(&dwState) % NANOSECONDS_IN_MILLISECOND;
+	}
+
+	// Arm them all, then cancel them in a scattered order (37 is coprime with the count)
+	TIMERWHEEL_Initialize(&s_tWheel, qwArmed);
+	do
+	{
+		qwStart = CLOCK_GetTimestamp();
+		for (dwIndex = 0; dwIndex < BENCH_TIMERS; dwIndex++)
+		{
+			TIMERWHEEL_Arm(&s_tWheel, &(g_atTimers[dwIndex].tTimer), qwArmed + g_atTimers[dwIndex].qwDelay);
+		}
+		qwNow = CLOCK_GetTimestamp();
+		qwArmNs += qwNow - qwStart;
+		for (dwIndex = 0; dwIndex < BENCH_TIMERS; dwIndex++)
+		{
+			TIMERWHEEL_Cancel(&s_tWheel, &(g_atTimers[(dwIndex * 37) % BENCH_TIMERS].tTimer));
+		}
+		qwCancelNs += CLOCK_GetTimestamp() - qwNow;
+		qwCalls += BENCH_TIMERS;
+	} while (BENCH_MIN_DURATION_NS > qwArmNs + qwCancelNs);
+	TIMERWHEEL_GetStats(&s_tWheel, &tStats);
+	if ((0 != tStats.dwArmed) || (0 != dwRuns))
+	{
+		(VOID)printf("timerwheel: %lu armed after cancelling, %lu run\n",
+			(unsigned long)tStats.dwArmed,
+			(unsigned long)dwRuns);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	bench_Report((double)qwArmNs / (double)qwCalls, "ns/timer", BENCH_TOLERANCE_PERCENT, "timerwheel/arm");
+	bench_Report((double)qwCancelNs / (double)qwCalls, "ns/timer", BENCH_TOLERANCE_PERCENT, "timerwheel/cancel");
+
+	// Arm them all, then wait for the timeout and advance until none is left
+	qwCalls = 0;
+	do
+	{
+		TIMERWHEEL_Initialize(&s_tWheel, qwArmed);
+		for (dwIndex = 0; dwIndex < BENCH_TIMERS; dwIndex++)
+		{
+			g_atTimers[dwIndex].qwRunTimestamp = 0;
+			TIMERWHEEL_Arm(&s_tWheel, &(g_atTimers[dwIndex].tTimer), qwArmed + g_atTimers[dwIndex].qwDelay);
+		}
+		dwRuns = 0;
+		dwWakeups = 0;
+		qwNow = qwArmed;
+		qwStart = CLOCK_GetTimestamp();
+		for (;;)
+		{
+			dwTimeoutMs = TIMERWHEEL_GetTimeoutMs(&s_tWheel, qwNow);
+			if (TIMERWHEEL_WAIT_FOREVER == dwTimeoutMs)
+			{
+				break;
+			}
+			qwNow += (ULONGLONG)dwTimeoutMs * NANOSECONDS_IN_MILLISECOND;
+			TIMERWHEEL_Advance(&s_tWheel, qwNow);
+			dwWakeups++;
+		}
+		qwRunNs += CLOCK_GetTimestamp() - qwStart;
+		qwCalls += BENCH_TIMERS;
+
+		// Verify every timer ran once, on time
+		for (dwIndex = 0; dwIndex < BENCH_TIMERS; dwIndex++)
+		{
+			ptTimer = &(g_atTimers[dwIndex]);
+			qwDeadline = qwArmed + ptTimer->qwDelay;
+			if ((ptTimer->qwRunTimestamp < qwDeadline) || (ptTimer->qwRunTimestamp - qwDeadline > TIMERWHEEL_TICK_NS))
+			{
+				(VOID)printf("timerwheel: timer %lu due at %llu ns ran at %llu ns\n",
+					(unsigned long)dwIndex,
+					qwDeadline,
+					ptTimer->qwRunTimestamp);
+				eStatus = DEBUG_GEN_FAIL_STATUS();
+				goto lblCleanup;
+			}
+		}
+		if (BENCH_TIMERS != dwRuns)
+		{
+			(VOID)printf("timerwheel: %lu of %lu timers run\n", (unsigned long)dwRuns, (unsigned long)BENCH_TIMERS);
+			eStatus = DEBUG_GEN_FAIL_STATUS();
+			goto lblCleanup;
+		}
+	} while (BENCH_MIN_DURATION_NS > qwRunNs);
+	TIMERWHEEL_GetStats(&s_tWheel, &tStats);
+	(VOID)printf("timerwheel/run: %lu timers over %lu s, %lu wakeups, %llu cascaded\n",
+		(unsigned long)BENCH_TIMERS,
+		(unsigned long)(BENCH_TIMER_MAX_DELAY_MS / 1000),
+		(unsigned long)dwWakeups,
+		tStats.qwCascaded);
+	bench_Report((double)qwRunNs / (double)qwCalls, "ns/timer", BENCH_TOLERANCE_PERCENT, "timerwheel/run");
+	bench_Report((double)dwWakeups / (double)BENCH_TIMERS, "wakeups/timer", BENCH_TOLERANCE_PERCENT, "timerwheel/wakeups");
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Return result
+	return eStatus;
+}
+
+#ifdef _BINARY_LOG
+/********************************************************************************
+*  Function:	bench_LogControl												*
+*  Purpose:		Writes the log control file, and waits for the flusher to		*
+*				apply it.														*
+*  Parameters:	@ pszRules ~[in]~ Its content, or NULL to remove it.			*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+bench_LogControl(
+	__in_z_opt PCSTR pszRules
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	FILE *ptFile = NULL;
+
+	if (NULL == pszRules)
+	{
+		(VOID)remove(BENCH_LOG_CONTROL_PATH);
+	}
+	else
+	{
+		ptFile = fopen(BENCH_LOG_CONTROL_PATH, "w");
+		if ((NULL == ptFile) || (0 > fputs(pszRules, ptFile)))
+		{
+			(VOID)printf("log: cannot write %s\n", BENCH_LOG_CONTROL_PATH);
+			eStatus = DEBUG_GEN_FAIL_STATUS();
+			goto lblCleanup;
+		}
+		CLOSE(ptFile, fclose);
+	}
+	LOG_Flush();
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	CLOSE(ptFile, fclose);
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_GetLogSize												*
+*  Purpose:		Gets the log file's size.										*
+*  Returns:		The size in bytes, or 0 if it cannot be read.					*
+********************************************************************************/
+static
+LONG
+bench_GetLogSize(VOID)
+{
+	FILE *ptFile = NULL;
+	LONG nSize = 0;
+
+	ptFile = fopen(BENCH_LOG_PATH, "rb");
+	if (NULL == ptFile)
+	{
+		return 0;
+	}
+	if (0 == fseek(ptFile, 0, SEEK_END))
+	{
+		nSize = MAX(ftell(ptFile), 0);
+	}
+	CLOSE(ptFile, fclose);
+
+	// Return result
+	return nSize;
+}
+
+/********************************************************************************
+*  Function:	bench_LogTrace													*
+*  Purpose:		Measures a trace call site.										*
+*  Parameters:	@ pszName ~[in]~ The result's name.								*
+*  Returns:		How many bytes the log file grew by.							*
+*  Remarks:		* Only logging is timed, the ring is flushed between bursts.	*
+*				* The call site is selected by "bench_LogTrace".				*
+********************************************************************************/
+static
+LONG
+bench_LogTrace(
+	__in_z PCSTR pszName
+)
+{
+	ULONGLONG qwStart = 0;
+	ULONGLONG qwElapsed = 0;
+	ULONGLONG qwCalls = 0;
+	DWORD dwIndex = 0;
+	LONG nSize = bench_GetLogSize();
+
+	do
+	{
+		qwStart = CLOCK_GetTimestamp();
+		for (dwIndex = 0; dwIndex < BENCH_LOG_BURST; dwIndex++)
+		{
+			DEBUG_MSG(LOG_SEV_TRACE, "Traced %lu.", (unsigned long)dwIndex);
+		}
+		qwElapsed += CLOCK_GetTimestamp() - qwStart;
+		qwCalls += BENCH_LOG_BURST;
+		LOG_Flush();
+	} while (BENCH_MIN_DURATION_NS > qwElapsed);
+	bench_Report((double)qwElapsed / (double)qwCalls, "ns/call", BENCH_TOLERANCE_PERCENT, "%s", pszName);
+
+	// Return result
+	return bench_GetLogSize() - nSize;
+}
+
+/********************************************************************************
+*  Function:	bench_Log														*
+*  Purpose:		Measures a DEBUG_MSG call with the binary log backend.			*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Only logging is timed, the ring is flushed between bursts.	*
+*				* The log is started by main, as it cannot be restarted.		*
+********************************************************************************/
+static
+RETSTATUS
+bench_Log(VOID)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	ULONGLONG qwStart = 0;
+	ULONGLONG qwElapsed = 0;
+	ULONGLONG qwCalls = 0;
+	DWORD dwIndex = 0;
+
+	// Integers (the injection verdict message)
+	do
+	{
+		qwStart = CLOCK_GetTimestamp();
+		for (dwIndex = 0; dwIndex < BENCH_LOG_BURST; dwIndex++)
+		{
+			DEBUG_MSG(LOG_SEV_INFO,
+				"Injection cadence on device 0x%llx (mean=%llu us, variance=%llu us^2).",
+				(ULONGLONG)dwIndex,
+				(ULONGLONG)g_adwIntervalsUs[dwIndex],
+				(ULONGLONG)g_adwIntervalsUs[dwIndex] * 3);
+		}
+		qwElapsed += CLOCK_GetTimestamp() - qwStart;
+		qwCalls += BENCH_LOG_BURST;
+		LOG_Flush();
+	} while (BENCH_MIN_DURATION_NS > qwElapsed);
+	bench_Report((double)qwElapsed / (double)qwCalls, "ns/call", BENCH_TOLERANCE_PERCENT, "log/ints");
+
+	// A string (the source name message)
+	qwElapsed = 0;
+	qwCalls = 0;
+	do
+	{
+		qwStart = CLOCK_GetTimestamp();
+		for (dwIndex = 0; dwIndex < BENCH_LOG_BURST; dwIndex++)
+		{
+			DEBUG_MSG(LOG_SEV_INFO, "Running event source '%s'.", g_apszKernelNames[dwIndex % CADENCE_KERNEL_COUNT]);
+		}
+		qwElapsed += CLOCK_GetTimestamp() - qwStart;
+		qwCalls += BENCH_LOG_BURST;
+		LOG_Flush();
+	} while (BENCH_MIN_DURATION_NS > qwElapsed);
+	bench_Report((double)qwElapsed / (double)qwCalls, "ns/call", BENCH_TOLERANCE_PERCENT, "log/string");
+
+	// Skipped severities must cost next to nothing
+	qwCalls = 0;
+	qwStart = CLOCK_GetTimestamp();
+	do
+	{
+		for (dwIndex = 0; dwIndex < BENCH_LOG_BURST; dwIndex++)
+		{
+			DEBUG_MSG(LOG_SEV_TRACE, "Skipped %lu.", (unsigned long)dwIndex);
+		}
+		qwCalls += BENCH_LOG_BURST;
+		qwElapsed = CLOCK_GetTimestamp() - qwStart;
+	} while (BENCH_MIN_DURATION_NS > qwElapsed);
+	bench_Report((double)qwElapsed / (double)qwCalls, "ns/call", BENCH_TOLERANCE_PERCENT, "log/skipped");
+
+	// Trace sites toggled at runtime: by the control file, then back off by a later rule
+	eStatus = bench_LogControl("# Bench\n+bench_LogTrace\n");
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		goto lblCleanup;
+	}
+	if (0 >= bench_LogTrace("log/trace/enabled"))
+	{
+		(VOID)printf("log: the enabled trace site was not logged\n");
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	eStatus = bench_LogControl("+bench_*\n-bench_LogTrace:0\n-bench_LogTrace\n");
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		goto lblCleanup;
+	}
+	if (0 != bench_LogTrace("log/trace/disabled"))
+	{
+		(VOID)printf("log: the disabled trace site was logged\n");
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	(VOID)bench_LogControl(NULL);
+
+	// Return result
+	return eStatus;
+}
+#endif	// _BINARY_LOG
+
+#ifndef _WIN32
+/********************************************************************************
+*  Function:	bench_GetThreadCpuNs											*
+*  Purpose:		Gets the CPU time of the calling thread.						*
+*  Returns:		The time, in nanoseconds.										*
+********************************************************************************/
+static
+ULONGLONG
+bench_GetThreadCpuNs(VOID)
+{
+	struct timespec tNow = { 0 };
+
+	(VOID)clock_gettime(CLOCK_THREAD_CPUTIME_ID, &tNow);
+	return ((ULONGLONG)tNow.tv_sec * NANOSECONDS_IN_SECOND) + (ULONGLONG)tNow.tv_nsec;
+}
+
+/********************************************************************************
+*  Function:	bench_EvdevCallback												*
+*  Purpose:		Counts and checks the key events of the evdev benchmark.		*
+*  Parameters:	@ ptEvent ~[in]~ The event.										*
+*				@ pvContext ~[inout]~ The run.									*
+********************************************************************************/
+static
+VOID
+bench_EvdevCallback(
+	__in PCEVENTSOURCE_EVENT ptEvent,
+	__inout_opt PVOID pvContext
+)
+{
+	PBENCH_EVDEV_RUN ptRun = (PBENCH_EVDEV_RUN)pvContext;
+
+	ptRun->qwKeys++;
+	ptRun->bIsWrong = ptRun->bIsWrong ||
+		(EVENTSOURCE_EVENT_TYPE_KEY != ptEvent->eType) ||
+		(BENCH_EVDEV_SCAN_CODE != ptEvent->wScanCode) ||
+		(0 == ptEvent->qwDeviceId) || (BENCH_EVDEV_DEVICES < ptEvent->qwDeviceId) ||
+		(ptEvent->qwTimestamp > ptEvent->qwClassifiedTimestamp);
+}
+
+/********************************************************************************
+*  Function:	bench_EvdevConsumer												*
+*  Purpose:		Runs the evdev source until stopped, and measures its CPU time.	*
+*  Parameters:	@ pvRun ~[inout]~ The run.										*
+*  Returns:		Zero.															*
+********************************************************************************/
+static
+UINT
+WINAPI
+bench_EvdevConsumer(
+	__inout_opt PVOID pvRun
+)
+{
+	PBENCH_EVDEV_RUN ptRun = (PBENCH_EVDEV_RUN)pvRun;
+	ULONGLONG qwStart = bench_GetThreadCpuNs();
+
+	ptRun->eStatus = EVENTSOURCE_Run(&(ptRun->tSource), bench_EvdevCallback, ptRun);
+	ptRun->qwCpuNs = bench_GetThreadCpuNs() - qwStart;
+	return 0;
+}
+
+/********************************************************************************
+*  Function:	bench_EvdevType													*
+*  Purpose:		Types keystrokes into the stand-ins, as struct input_event		*
+*				records stamped with the current time.							*
+*  Parameters:	@ panWriters ~[in]~ The stand-ins' write ends.					*
+*				@ bIsPaced ~[in]~ Whether to type one keystroke per stand-in	*
+*				every BENCH_EVDEV_PACE_NS, rather than bursts without pause.	*
+*  Returns:		The number of key events typed (presses and releases).			*
+********************************************************************************/
+static
+ULONGLONG
+bench_EvdevType(
+	__in_ecount(BENCH_EVDEV_DEVICES) const INT *panWriters,
+	__in BOOL bIsPaced
+)
+{
+	static struct input_event s_atRecords[BENCH_EVDEV_BURST * 4] = { { { 0 }, 0, 0, 0 } };
+	struct timespec tPace = { 0, (long)BENCH_EVDEV_PACE_NS };
+	ULONGLONG qwNow = 0;
+	ULONGLONG qwStart = CLOCK_GetTimestamp();
+	ULONGLONG qwKeys = 0;
+	DWORD dwKeystrokes = bIsPaced ? 1 : BENCH_EVDEV_BURST;
+	DWORD dwIndex = 0;
+	DWORD dwDevice = 0;
+
+	do
+	{
+		for (dwDevice = 0; dwDevice < BENCH_EVDEV_DEVICES; dwDevice++)
+		{
+			qwNow = CLOCK_GetTimestamp();
+			for (dwIndex = 0; dwIndex < dwKeystrokes * 4; dwIndex++)
+			{
+				s_atRecords[dwIndex].input_event_sec = (time_t)(qwNow / NANOSECONDS_IN_SECOND);
+				s_atRecords[dwIndex].input_event_usec = (suseconds_t)((qwNow % NANOSECONDS_IN_SECOND) / NANOSECONDS_IN_MICROSECOND);
+				s_atRecords[dwIndex].type = (0 == dwIndex % 2) ? EV_KEY : EV_SYN;
+				s_atRecords[dwIndex].code = (0 == dwIndex % 2) ? BENCH_EVDEV_KEY : SYN_REPORT;
+				s_atRecords[dwIndex].value = (0 == dwIndex % 4) ? 1 : 0;
+			}
+			if ((ssize_t)(dwKeystrokes * 4 * sizeof(s_atRecords[0])) !=
+				write(panWriters[dwDevice], s_atRecords, dwKeystrokes * 4 * sizeof(s_atRecords[0])))
+			{
+				return qwKeys;
+			}
+			qwKeys += dwKeystrokes * 2;
+		}
+		if (bIsPaced)
+		{
+			(VOID)nanosleep(&tPace, NULL);
+		}
+	} while (BENCH_MIN_DURATION_NS > CLOCK_GetTimestamp() - qwStart);
+
+	// Return result
+	return qwKeys;
+}
+
+/********************************************************************************
+*  Function:	bench_EvdevPhase												*
+*  Purpose:		Feeds pipe stand-ins to an evdev source running on a thread,	*
+*				and reports its system calls and CPU time per key event.		*
+*  Parameters:	@ eEngine ~[in]~ The source's engine (EPOLL or IO_URING).		*
+*				@ bIsPaced ~[in]~ See bench_EvdevType.							*
+*				@ pszPhase ~[in]~ The phase's name in the results.				*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Skipped, successfully, if the engine is unavailable.			*
+********************************************************************************/
+static
+RETSTATUS
+bench_EvdevPhase(
+	__in EVENTSOURCE_EVDEV_ENGINE eEngine,
+	__in BOOL bIsPaced,
+	__in_z PCSTR pszPhase
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	BENCH_EVDEV_RUN tRun = { 0 };
+	EVENTSOURCE_EVDEV_STATS tStats = { 0 };
+	INT anUevents[2] = { -1, -1 };
+	INT anPipe[2] = { -1, -1 };
+	INT anWriters[BENCH_EVDEV_DEVICES] = { 0 };
+	HANDLE hConsumer = NULL;
+	BOOL bIsCreated = FALSE;
+	PCSTR pszEngine = (EVENTSOURCE_EVDEV_ENGINE_IO_URING == eEngine) ? "uring" : "epoll";
+	ULONGLONG qwTyped = 0;
+	ULONGLONG qwStart = 0;
+	DWORD dwDevice = 0;
+
+	for (dwDevice = 0; dwDevice < BENCH_EVDEV_DEVICES; dwDevice++)
+	{
+		anWriters[dwDevice] = -1;
+	}
+
+	// A source with a stand-in uevent socket, and a pipe per keyboard
+	if (0 != socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, anUevents))
+	{
+		(VOID)printf("evdev: cannot create a socket pair\n");
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	eStatus = EVENTSOURCE_CreateEvdevSource(anUevents[0], eEngine, &(tRun.tSource));
+	anUevents[0] = -1;
+	if ((RETSTATUS_FAILED(eStatus)) && (EVENTSOURCE_EVDEV_ENGINE_IO_URING == eEngine))
+	{
+		(VOID)printf("evdev/%s/%s: skipped, io_uring is unavailable\n", pszEngine, pszPhase);
+		eStatus = RETSTATUS_SUCCESS;
+		goto lblCleanup;
+	}
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		(VOID)printf("evdev: cannot create the source\n");
+		goto lblCleanup;
+	}
+	bIsCreated = TRUE;
+	for (dwDevice = 0; dwDevice < BENCH_EVDEV_DEVICES; dwDevice++)
+	{
+		if (0 != pipe2(anPipe, O_CLOEXEC))
+		{
+			(VOID)printf("evdev: cannot create a pipe\n");
+			eStatus = DEBUG_GEN_FAIL_STATUS();
+			goto lblCleanup;
+		}
+		anWriters[dwDevice] = anPipe[1];
+		eStatus = EVENTSOURCE_AttachEvdevDevice(&(tRun.tSource), anPipe[0], dwDevice + 1, NULL, FALSE);
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			(VOID)printf("evdev: cannot attach a stand-in\n");
+			goto lblCleanup;
+		}
+	}
+	hConsumer = BEGIN_THREAD(bench_EvdevConsumer, &tRun, 0);
+	if (NULL == hConsumer)
+	{
+		(VOID)printf("evdev: cannot start the source\n");
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Type, then hang up: every stand-in is detached once read to the end
+	qwTyped = bench_EvdevType(anWriters, bIsPaced);
+	for (dwDevice = 0; dwDevice < BENCH_EVDEV_DEVICES; dwDevice++)
+	{
+		CLOSE_FD(anWriters[dwDevice]);
+	}
+	qwStart = CLOCK_GetTimestamp();
+	do
+	{
+		(VOID)sched_yield();
+		(VOID)EVENTSOURCE_GetEvdevStats(&(tRun.tSource), &tStats);
+	} while ((0 != tStats.dwDevices) && (BENCH_POLICY_RELOAD_TIMEOUT_NS > CLOCK_GetTimestamp() - qwStart));
+	EVENTSOURCE_Stop(&(tRun.tSource));
+	JOIN_THREAD(hConsumer);
+	(VOID)EVENTSOURCE_GetEvdevStats(&(tRun.tSource), &tStats);
+
+	// Every key typed must have been delivered, as typed
+	if ((RETSTATUS_FAILED(tRun.eStatus)) || (0 == qwTyped) ||
+		(qwTyped != tRun.qwKeys) || (qwTyped != tStats.qwKeys) || (tRun.bIsWrong))
+	{
+		(VOID)printf("evdev/%s/%s: typed %llu key events, %llu delivered%s\n",
+			pszEngine,
+			pszPhase,
+			qwTyped,
+			tRun.qwKeys,
+			tRun.bIsWrong ? " (some wrong)" : "");
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	bench_Report((double)(tStats.qwWaits + tStats.qwReads) * 1000 / (double)tStats.qwKeys,
+		"syscalls/1k keys",
+		BENCH_TOLERANCE_PERCENT,
+		"evdev/%s/%s/syscalls",
+		pszEngine,
+		pszPhase);
+	bench_Report((double)tRun.qwCpuNs / (double)tStats.qwKeys,
+		"cpu ns/key",
+		BENCH_SYSTEM_TOLERANCE_PERCENT,
+		"evdev/%s/%s/cpu",
+		pszEngine,
+		pszPhase);
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	for (dwDevice = 0; dwDevice < BENCH_EVDEV_DEVICES; dwDevice++)
+	{
+		CLOSE_FD(anWriters[dwDevice]);
+	}
+	CLOSE_FD(anUevents[0]);
+	CLOSE_FD(anUevents[1]);
+	if (bIsCreated)
+	{
+		EVENTSOURCE_Destroy(&(tRun.tSource));
+	}
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_Evdev														*
+*  Purpose:		Verifies and measures the evdev keystroke capture, flooded		*
+*				and at an injection device's pace, with each engine.			*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+bench_Evdev(VOID)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+
+	eStatus = bench_EvdevPhase(EVENTSOURCE_EVDEV_ENGINE_EPOLL, FALSE, "flood");
+	if (RETSTATUS_SUCCEEDED(eStatus))
+	{
+		eStatus = bench_EvdevPhase(EVENTSOURCE_EVDEV_ENGINE_EPOLL, TRUE, "paced");
+	}
+	if (RETSTATUS_SUCCEEDED(eStatus))
+	{
+		eStatus = bench_EvdevPhase(EVENTSOURCE_EVDEV_ENGINE_IO_URING, FALSE, "flood");
+	}
+	if (RETSTATUS_SUCCEEDED(eStatus))
+	{
+		eStatus = bench_EvdevPhase(EVENTSOURCE_EVDEV_ENGINE_IO_URING, TRUE, "paced");
+	}
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_QuarantineCapture											*
+*  Purpose:		Queues a key event for the analysis thread.						*
+*  Parameters:	@ ptEvent ~[in]~ The event.										*
+*				@ pvContext ~[inout]~ The run.									*
+********************************************************************************/
+static
+VOID
+bench_QuarantineCapture(
+	__in PCEVENTSOURCE_EVENT ptEvent,
+	__inout_opt PVOID pvContext
+)
+{
+	PBENCH_QUARANTINE_RUN ptRun = (PBENCH_QUARANTINE_RUN)pvContext;
+
+	(VOID)SPSCQUEUE_Enqueue(&(ptRun->tQueue), ptEvent);
+}
+
+/********************************************************************************
+*  Function:	bench_QuarantineSource											*
+*  Purpose:		Runs the evdev source until stopped.							*
+*  Parameters:	@ pvRun ~[inout]~ The run.										*
+*  Returns:		Zero.															*
+********************************************************************************/
+static
+UINT
+WINAPI
+bench_QuarantineSource(
+	__inout_opt PVOID pvRun
+)
+{
+	PBENCH_QUARANTINE_RUN ptRun = (PBENCH_QUARANTINE_RUN)pvRun;
+
+	ptRun->eStatus = EVENTSOURCE_Run(&(ptRun->tSource), bench_QuarantineCapture, ptRun);
+	return 0;
+}
+
+/********************************************************************************
+*  Function:	bench_QuarantineAnalysis										*
+*  Purpose:		Judges the queued key events and holds, replays or drops		*
+*				them, as the notifier's analysis thread does.					*
+*  Parameters:	@ pvRun ~[inout]~ The run.										*
+*  Returns:		Zero.															*
+********************************************************************************/
+static
+UINT
+WINAPI
+bench_QuarantineAnalysis(
+	__inout_opt PVOID pvRun
+)
+{
+	PBENCH_QUARANTINE_RUN ptRun = (PBENCH_QUARANTINE_RUN)pvRun;
+	PEVENTSOURCE_EVENT ptEvents = NULL;
+	CADENCE_VERDICT eVerdict = CADENCE_VERDICT_PENDING;
+	BOOL bIsHostile = FALSE;
+	ULONG dwCount = 0;
+	ULONG dwIndex = 0;
+
+	while (SPSCQUEUE_WaitFor(&(ptRun->tQueue), TIMERWHEEL_GetTimeoutMs(&(ptRun->tTimers), CLOCK_GetTimestamp())))
+	{
+		dwCount = SPSCQUEUE_Peek(&(ptRun->tQueue), (PVOID *)&ptEvents);
+		for (dwIndex = 0; dwIndex < dwCount; dwIndex++)
+		{
+			if ((EVENTSOURCE_EVENT_TYPE_REMOVAL == ptEvents[dwIndex].eType) && (0 != ptEvents[dwIndex].dwHoldId))
+			{
+				QUARANTINE_OnDetach(&(ptRun->tQuarantine), ptEvents[dwIndex].dwHoldId);
+				continue;
+			}
+			(VOID)DECISION_Decide(&(ptRun->tDecision), &(ptEvents[dwIndex]), NULL, &bIsHostile, &eVerdict);
+			if (0 != ptEvents[dwIndex].dwHoldId)
+			{
+				QUARANTINE_OnKey(&(ptRun->tQuarantine), &(ptEvents[dwIndex]), eVerdict, bIsHostile);
+			}
+		}
+		SPSCQUEUE_Release(&(ptRun->tQueue), dwCount);
+		TIMERWHEEL_Advance(&(ptRun->tTimers), CLOCK_GetTimestamp());
+	}
+
+	return 0;
+}
+
+/********************************************************************************
+*  Function:	bench_QuarantineStamp											*
+*  Purpose:		Lays out a key record and its report.							*
+*  Parameters:	@ patRecords ~[out]~ Gets the two records.						*
+*				@ wKeyCode ~[in]~ The key code.									*
+*				@ bIsKeyDown ~[in]~ Whether the key is pressed.					*
+*				@ qwTimestamp ~[in]~ When it is typed (CLOCK_GetTimestamp).		*
+********************************************************************************/
+static
+VOID
+bench_QuarantineStamp(
+	__out_ecount(2) struct input_event *patRecords,
+	__in WORD wKeyCode,
+	__in BOOL bIsKeyDown,
+	__in ULONGLONG qwTimestamp
+)
+{
+	DWORD dwIndex = 0;
+
+	for (dwIndex = 0; dwIndex < 2; dwIndex++)
+	{
+		patRecords[dwIndex].input_event_sec = (time_t)(qwTimestamp / NANOSECONDS_IN_SECOND);
+		patRecords[dwIndex].input_event_usec = (suseconds_t)((qwTimestamp % NANOSECONDS_IN_SECOND) / NANOSECONDS_IN_MICROSECOND);
+	}
+	patRecords[0].type = EV_KEY;
+	patRecords[0].code = wKeyCode;
+	patRecords[0].value = bIsKeyDown ? 1 : 0;
+	patRecords[1].type = EV_SYN;
+	patRecords[1].code = SYN_REPORT;
+	patRecords[1].value = 0;
+}
+
+/********************************************************************************
+*  Function:	bench_QuarantineRead											*
+*  Purpose:		Reads replayed records, and checks they are the typed keys.		*
+*  Parameters:	@ nOutput ~[in]~ The read end of the replaying stand-in.		*
+*				@ patTyped ~[in]~ The typed records, reports included.			*
+*				@ dwRecords ~[in]~ Their number.								*
+*  Returns:		TRUE if they were all replayed, in order, in time.				*
+*  Remarks:		* Replayed records carry no time, the kernel's is used.			*
+********************************************************************************/
+static
+BOOL
+bench_QuarantineRead(
+	__in INT nOutput,
+	__in_ecount(dwRecords) const struct input_event *patTyped,
+	__in DWORD dwRecords
+)
+{
+	static struct input_event s_atRecords[BENCH_QUARANTINE_KEYSTROKES * 4] = { { { 0 }, 0, 0, 0 } };
+	struct pollfd tPoll = { nOutput, POLLIN, 0 };
+	SIZE_T cbRead = 0;
+	ssize_t cbChunk = 0;
+	DWORD dwIndex = 0;
+
+	ASSERT(sizeof(s_atRecords) / sizeof(s_atRecords[0]) >= dwRecords);
+
+	while (dwRecords * sizeof(s_atRecords[0]) > cbRead)
+	{
+		if (0 >= poll(&tPoll, 1, BENCH_QUARANTINE_TIMEOUT_MS))
+		{
+			return FALSE;
+		}
+		cbChunk = read(nOutput, (PBYTE)s_atRecords + cbRead, dwRecords * sizeof(s_atRecords[0]) - cbRead);
+		if (0 >= cbChunk)
+		{
+			return FALSE;
+		}
+		cbRead += (SIZE_T)cbChunk;
+	}
+	for (dwIndex = 0; dwIndex < dwRecords; dwIndex++)
+	{
+		if ((patTyped[dwIndex].type != s_atRecords[dwIndex].type) ||
+			(patTyped[dwIndex].code != s_atRecords[dwIndex].code) ||
+			(patTyped[dwIndex].value != s_atRecords[dwIndex].value))
+		{
+			return FALSE;
+		}
+	}
+
+	// Success
+	return TRUE;
+}
+
+/********************************************************************************
+*  Function:	bench_Quarantine												*
+*  Purpose:		Verifies that the keys of a held keyboard typing like a human	*
+*				are replayed, and those of one injecting are dropped, and		*
+*				measures the latency a released keyboard's keys get.			*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Pipes stand in for the keyboards and the replaying one.		*
+*				* The human keystrokes are stamped ahead of time, so that the	*
+*					verdict forms before any of them is due for replay.			*
+********************************************************************************/
+static
+RETSTATUS
+bench_Quarantine(VOID)
+{
+	static BENCH_QUARANTINE_RUN s_tRun;
+	static struct input_event s_atRecords[BENCH_QUARANTINE_INJECTED_KEYSTROKES * 4] = { { { 0 }, 0, 0, 0 } };
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	QUARANTINE_STATS tStats = { 0 };
+	struct pollfd tPoll = { -1, POLLIN, 0 };
+	INT anUevents[2] = { -1, -1 };
+	INT anPipe[2] = { -1, -1 };
+	INT anOutput[2] = { -1, -1 };
+	INT anWriters[2] = { -1, -1 };
+	HANDLE hSource = NULL;
+	HANDLE hAnalysis = NULL;
+	BOOL bIsCreated = FALSE;
+	BOOL bIsQueueCreated = FALSE;
+	BOOL bIsInitialized = FALSE;
+	ULONGLONG qwTimeline = 0;
+	ULONGLONG qwStart = 0;
+	ULONGLONG qwLatencyNs = 0;
+	DWORD dwRandom = 0x51A7E;
+	DWORD dwIndex = 0;
+	WORD wKeyCode = 0;
+
+	RtlZeroMemory(&s_tRun, sizeof(s_tRun));
+
+	// The notifier's pipeline, replaying into a pipe
+	if ((0 != socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, anUevents)) || (0 != pipe2(anOutput, O_CLOEXEC)))
+	{
+		(VOID)printf("quarantine: cannot create the stand-ins\n");
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	tPoll.fd = anOutput[0];
+	eStatus = EVENTSOURCE_CreateEvdevSource(anUevents[0], EVENTSOURCE_EVDEV_ENGINE_EPOLL, &(s_tRun.tSource));
+	anUevents[0] = -1;
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		(VOID)printf("quarantine: cannot create the source\n");
+		goto lblCleanup;
+	}
+	bIsCreated = TRUE;
+	eStatus = SPSCQUEUE_Create(sizeof(EVENTSOURCE_EVENT), BENCH_QUEUE_CAPACITY, &(s_tRun.tQueue));
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		(VOID)printf("quarantine: cannot create the queue\n");
+		goto lblCleanup;
+	}
+	bIsQueueCreated = TRUE;
+	DECISION_Initialize(NULL, NULL, NULL, 0, TRUE, 0, &(s_tRun.tDecision));
+	TIMERWHEEL_Initialize(&(s_tRun.tTimers), CLOCK_GetTimestamp());
+	QUARANTINE_Initialize(anOutput[1], &(s_tRun.tTimers), &(s_tRun.tQuarantine));
+	anOutput[1] = -1;
+	bIsInitialized = TRUE;
+
+	// Two held keyboards: one human, one injecting
+	for (dwIndex = 0; dwIndex < 2; dwIndex++)
+	{
+		if (0 != pipe2(anPipe, O_CLOEXEC))
+		{
+			(VOID)printf("quarantine: cannot create a pipe\n");
+			eStatus = DEBUG_GEN_FAIL_STATUS();
+			goto lblCleanup;
+		}
+		anWriters[dwIndex] = anPipe[1];
+		eStatus = EVENTSOURCE_AttachEvdevDevice(&(s_tRun.tSource), anPipe[0], dwIndex + 1, NULL, TRUE);
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			(VOID)printf("quarantine: cannot attach a stand-in\n");
+			goto lblCleanup;
+		}
+	}
+	hSource = BEGIN_THREAD(bench_QuarantineSource, &s_tRun, 0);
+	hAnalysis = BEGIN_THREAD(bench_QuarantineAnalysis, &s_tRun, 0);
+	if ((NULL == hSource) || (NULL == hAnalysis))
+	{
+		(VOID)printf("quarantine: cannot start the pipeline\n");
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Human typing is held until judged, then replayed whole and in order
+	qwTimeline = CLOCK_GetTimestamp();
+	for (dwIndex = 0; dwIndex < BENCH_QUARANTINE_KEYSTROKES; dwIndex++)
+	{
+		qwTimeline += ((ULONGLONG)BENCH_QUARANTINE_INTERVAL_US * 3 / 4 +
+			bench_Random(&dwRandom) % (BENCH_QUARANTINE_INTERVAL_US / 2)) * NANOSECONDS_IN_MICROSECOND;
+		wKeyCode = (WORD)(KEY_Q + dwIndex % 10);
+		bench_QuarantineStamp(&(s_atRecords[dwIndex * 4]), wKeyCode, TRUE, qwTimeline);
+		bench_QuarantineStamp(&(s_atRecords[dwIndex * 4 + 2]), wKeyCode, FALSE,
+			qwTimeline + (ULONGLONG)BENCH_QUARANTINE_HOLD_US * NANOSECONDS_IN_MICROSECOND);
+	}
+	if (((ssize_t)(BENCH_QUARANTINE_KEYSTROKES * 4 * sizeof(s_atRecords[0])) !=
+		write(anWriters[0], s_atRecords, BENCH_QUARANTINE_KEYSTROKES * 4 * sizeof(s_atRecords[0]))) ||
+		(!bench_QuarantineRead(anOutput[0], s_atRecords, BENCH_QUARANTINE_KEYSTROKES * 4)))
+	{
+		(VOID)printf("quarantine: human keystrokes were not replayed as typed\n");
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Released, its keys pass straight through
+	for (dwIndex = 0; dwIndex < BENCH_QUARANTINE_SAMPLES; dwIndex++)
+	{
+		if (0 == dwIndex % 2)
+		{
+			qwTimeline += ((ULONGLONG)BENCH_QUARANTINE_INTERVAL_US * 3 / 4 +
+				bench_Random(&dwRandom) % (BENCH_QUARANTINE_INTERVAL_US / 2)) * NANOSECONDS_IN_MICROSECOND;
+		}
+		bench_QuarantineStamp(s_atRecords,
+			(WORD)(KEY_Q + (dwIndex / 2) % 10),
+			0 == dwIndex % 2,
+			qwTimeline + ((0 == dwIndex % 2) ? 0 : (ULONGLONG)BENCH_QUARANTINE_HOLD_US * NANOSECONDS_IN_MICROSECOND));
+		qwStart = CLOCK_GetTimestamp();
+		if (((ssize_t)(2 * sizeof(s_atRecords[0])) != write(anWriters[0], s_atRecords, 2 * sizeof(s_atRecords[0]))) ||
+			(!bench_QuarantineRead(anOutput[0], s_atRecords, 2)))
+		{
+			(VOID)printf("quarantine: released keystrokes were not passed through\n");
+			eStatus = DEBUG_GEN_FAIL_STATUS();
+			goto lblCleanup;
+		}
+		qwLatencyNs += CLOCK_GetTimestamp() - qwStart;
+	}
+	if (BENCH_QUARANTINE_MAX_LATENCY_NS <= qwLatencyNs / BENCH_QUARANTINE_SAMPLES)
+	{
+		(VOID)printf("quarantine: released keystrokes took %llu ns\n", qwLatencyNs / BENCH_QUARANTINE_SAMPLES);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	bench_Report((double)qwLatencyNs / BENCH_QUARANTINE_SAMPLES / NANOSECONDS_IN_MICROSECOND,
+		"us/key",
+		BENCH_SYSTEM_TOLERANCE_PERCENT,
+		"quarantine/passthrough");
+
+	// Injected keystrokes are all dropped, none replayed
+	qwTimeline = CLOCK_GetTimestamp();
+	for (dwIndex = 0; dwIndex < BENCH_QUARANTINE_INJECTED_KEYSTROKES; dwIndex++)
+	{
+		bench_QuarantineStamp(&(s_atRecords[dwIndex * 4]), KEY_A, TRUE, qwTimeline + dwIndex * BENCH_EVDEV_PACE_NS);
+		bench_QuarantineStamp(&(s_atRecords[dwIndex * 4 + 2]), KEY_A, FALSE, qwTimeline + dwIndex * BENCH_EVDEV_PACE_NS + BENCH_EVDEV_PACE_NS / 2);
+	}
+	if ((ssize_t)sizeof(s_atRecords) != write(anWriters[1], s_atRecords, sizeof(s_atRecords)))
+	{
+		(VOID)printf("quarantine: cannot inject\n");
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	qwStart = CLOCK_GetTimestamp();
+	do
+	{
+		(VOID)sched_yield();
+		QUARANTINE_GetStats(&(s_tRun.tQuarantine), &tStats);
+	} while ((BENCH_QUARANTINE_INJECTED_KEYSTROKES * 2 > tStats.qwDropped) &&
+		(BENCH_POLICY_RELOAD_TIMEOUT_NS > CLOCK_GetTimestamp() - qwStart));
+	if ((BENCH_QUARANTINE_INJECTED_KEYSTROKES * 2 != tStats.qwDropped) || (0 != poll(&tPoll, 1, 0)) ||
+		(1 != tStats.qwReleasedDevices) || (1 != tStats.qwBlockedDevices) || (0 != tStats.qwLost))
+	{
+		(VOID)printf("quarantine: %llu of %d injected key events dropped, %llu released, %llu blocked, %llu lost\n",
+			tStats.qwDropped,
+			BENCH_QUARANTINE_INJECTED_KEYSTROKES * 2,
+			tStats.qwReleasedDevices,
+			tStats.qwBlockedDevices,
+			tStats.qwLost);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	if (NULL != hSource)
+	{
+		EVENTSOURCE_Stop(&(s_tRun.tSource));
+		JOIN_THREAD(hSource);
+	}
+	if (NULL != hAnalysis)
+	{
+		SPSCQUEUE_Close(&(s_tRun.tQueue));
+		JOIN_THREAD(hAnalysis);
+	}
+	if ((RETSTATUS_SUCCEEDED(eStatus)) && (RETSTATUS_FAILED(s_tRun.eStatus)))
+	{
+		(VOID)printf("quarantine: the source failed\n");
+		eStatus = s_tRun.eStatus;
+	}
+	if (bIsInitialized)
+	{
+		QUARANTINE_Finalize(&(s_tRun.tQuarantine));
+		DECISION_Finalize(&(s_tRun.tDecision));
+	}
+	if (bIsQueueCreated)
+	{
+		SPSCQUEUE_Destroy(&(s_tRun.tQueue));
+	}
+	if (bIsCreated)
+	{
+		EVENTSOURCE_Destroy(&(s_tRun.tSource));
+	}
+	CLOSE_FD(anWriters[0]);
+	CLOSE_FD(anWriters[1]);
+	CLOSE_FD(anOutput[0]);
+	CLOSE_FD(anOutput[1]);
+	CLOSE_FD(anUevents[0]);
+	CLOSE_FD(anUevents[1]);
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_QuarantineDecide											*
+*  Purpose:		Decides a stamped key event, and holds or drops it.				*
+*  Parameters:	@ ptDecision ~[inout]~ The decision state.						*
+*				@ ptQuarantine ~[inout]~ The quarantine state.					*
+*				@ ptEvent ~[inout]~ The event, gets the timestamp.				*
+*				@ wKeyCode ~[in]~ The key code.									*
+*				@ bIsKeyDown ~[in]~ Whether the key is pressed.					*
+*				@ qwTimestamp ~[in]~ When it is typed.							*
+*  Returns:		TRUE if the session should be locked.							*
+********************************************************************************/
+static
+BOOL
+bench_QuarantineDecide(
+	__inout PDECISION ptDecision,
+	__inout PQUARANTINE ptQuarantine,
+	__inout PEVENTSOURCE_EVENT ptEvent,
+	__in WORD wKeyCode,
+	__in BOOL bIsKeyDown,
+	__in ULONGLONG qwTimestamp
+)
+{
+	CADENCE_VERDICT eVerdict = CADENCE_VERDICT_PENDING;
+	BOOL bShouldLock = FALSE;
+	BOOL bIsHostile = FALSE;
+
+	ptEvent->qwTimestamp = qwTimestamp;
+	ptEvent->wScanCode = wKeyCode;
+	ptEvent->wKeyCode = wKeyCode;
+	ptEvent->bIsKeyDown = (BOOLEAN)bIsKeyDown;
+	bShouldLock = DECISION_Decide(ptDecision, ptEvent, NULL, &bIsHostile, &eVerdict);
+	QUARANTINE_OnKey(ptQuarantine, ptEvent, eVerdict, bIsHostile);
+
+	// Return result
+	return bShouldLock;
+}
+
+/********************************************************************************
+*  Function:	bench_QuarantineBurst											*
+*  Purpose:		Verifies that a held keyboard typing a payload is blocked,		*
+*				though its lock is folded into another keyboard's lock burst,	*
+*				and that blocked keyboards keep their slots.					*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Decides stamped key events on this thread, with the			*
+*					payload signatures.											*
+*				* The payload is shorter than a cadence window, so only its		*
+*					signature can judge the keyboard.							*
+********************************************************************************/
+static
+RETSTATUS
+bench_QuarantineBurst(VOID)
+{
+	static const WORD s_awPayload[] = { KEY_C, KEY_M, KEY_D, KEY_SPACE, KEY_SLASH, KEY_C };
+	static DECISION s_tDecision;
+	static QUARANTINE s_tQuarantine;
+	static TIMERWHEEL s_tTimers;
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	SIGNATURE_SET tSet;
+	EVENTSOURCE_EVENT tEvent;
+	QUARANTINE_STATS tStats = { 0 };
+	struct pollfd tPoll = { -1, POLLIN, 0 };
+	INT anOutput[2] = { -1, -1 };
+	BOOL bIsInitialized = FALSE;
+	DWORD dwPayloads = sizeof(g_apszSignaturePayloads) / sizeof(g_apszSignaturePayloads[0]);
+	DWORD dwLocks = 0;
+	DWORD dwPayloadLocks = 0;
+	DWORD dwIndex = 0;
+	ULONGLONG qwTimeline = 0;
+	ULONGLONG qwHeld = 0;
+	ULONGLONG qwDropped = 0;
+
+	RtlZeroMemory(&tSet, sizeof(tSet));
+	RtlZeroMemory(&tEvent, sizeof(tEvent));
+	for (dwIndex = 0; dwIndex < dwPayloads; dwIndex++)
+	{
+		g_apszSignatures[dwIndex] = g_apszSignaturePayloads[dwIndex];
+		g_adwSignatureChars[dwIndex] = (DWORD)strlen(g_apszSignaturePayloads[dwIndex]);
+	}
+	eStatus = SIGNATURE_Compile(g_apszSignatures, g_adwSignatureChars, dwPayloads, &tSet);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		(VOID)printf("quarantine/burst: cannot compile the payloads\n");
+		goto lblCleanup;
+	}
+	if (0 != pipe2(anOutput, O_CLOEXEC | O_NONBLOCK))
+	{
+		(VOID)printf("quarantine/burst: cannot create the stand-in\n");
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	tPoll.fd = anOutput[0];
+	qwTimeline = CLOCK_GetTimestamp();
+	DECISION_Initialize(NULL, &tSet, NULL, 0, TRUE, 0, &s_tDecision);
+	TIMERWHEEL_Initialize(&s_tTimers, qwTimeline);
+	QUARANTINE_Initialize(anOutput[1], &s_tTimers, &s_tQuarantine);
+	anOutput[1] = -1;
+	bIsInitialized = TRUE;
+
+	// One held keyboard injects, and its lock opens a burst
+	tEvent.eType = EVENTSOURCE_EVENT_TYPE_KEY;
+	tEvent.eClass = EVENTSOURCE_DEVICE_CLASS_KEYBOARD;
+	tEvent.qwDeviceId = 1;
+	tEvent.dwHoldId = 1;
+	for (dwIndex = 0; dwIndex < BENCH_QUARANTINE_INJECTED_KEYSTROKES; dwIndex++)
+	{
+		qwTimeline += BENCH_EVDEV_PACE_NS;
+		dwLocks += bench_QuarantineDecide(&s_tDecision, &s_tQuarantine, &tEvent, KEY_A, TRUE, qwTimeline) ? 1 : 0;
+		dwLocks += bench_QuarantineDecide(&s_tDecision, &s_tQuarantine, &tEvent, KEY_A, FALSE, qwTimeline + BENCH_EVDEV_PACE_NS / 2) ? 1 : 0;
+	}
+
+	// Another types a payload within the burst, then keeps typing
+	tEvent.qwDeviceId = 2;
+	tEvent.dwHoldId = 2;
+	for (dwIndex = 0; dwIndex <= sizeof(s_awPayload) / sizeof(s_awPayload[0]); dwIndex++)
+	{
+		qwTimeline += BENCH_QUARANTINE_PAYLOAD_INTERVAL_NS;
+		dwPayloadLocks += bench_QuarantineDecide(&s_tDecision,
+			&s_tQuarantine,
+			&tEvent,
+			(dwIndex < sizeof(s_awPayload) / sizeof(s_awPayload[0])) ? s_awPayload[dwIndex] : KEY_A,
+			TRUE,
+			qwTimeline) ? 1 : 0;
+		dwPayloadLocks += bench_QuarantineDecide(&s_tDecision,
+			&s_tQuarantine,
+			&tEvent,
+			(dwIndex < sizeof(s_awPayload) / sizeof(s_awPayload[0])) ? s_awPayload[dwIndex] : KEY_A,
+			FALSE,
+			qwTimeline + BENCH_QUARANTINE_PAYLOAD_INTERVAL_NS / 2) ? 1 : 0;
+	}
+
+	// Both are blocked, though the session was locked once, and nothing was replayed
+	QUARANTINE_GetStats(&s_tQuarantine, &tStats);
+	if ((1 != dwLocks) || (0 != dwPayloadLocks) || (2 != tStats.qwBlockedDevices) || (0 != tStats.qwPassed) ||
+		((BENCH_QUARANTINE_INJECTED_KEYSTROKES + sizeof(s_awPayload) / sizeof(s_awPayload[0]) + 1) * 2 != tStats.qwDropped) ||
+		(0 != poll(&tPoll, 1, 0)))
+	{
+		(VOID)printf("quarantine/burst: %lu locks, %lu by the payload, %llu blocked, %llu passed, %llu dropped\n",
+			(unsigned long)dwLocks,
+			(unsigned long)dwPayloadLocks,
+			tStats.qwBlockedDevices,
+			tStats.qwPassed,
+			tStats.qwDropped);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// New keyboards take the free slots, then find no room: blocked ones are never evicted
+	qwHeld = tStats.qwHeld;
+	qwDropped = tStats.qwDropped;
+	for (dwIndex = 3; dwIndex <= QUARANTINE_MAX_DEVICES + 1; dwIndex++)
+	{
+		qwTimeline += BENCH_QUARANTINE_PAYLOAD_INTERVAL_NS;
+		tEvent.qwDeviceId = dwIndex;
+		tEvent.dwHoldId = dwIndex;
+		(VOID)bench_QuarantineDecide(&s_tDecision, &s_tQuarantine, &tEvent, KEY_A, TRUE, qwTimeline);
+	}
+	for (dwIndex = 1; dwIndex <= 2; dwIndex++)
+	{
+		qwTimeline += BENCH_QUARANTINE_PAYLOAD_INTERVAL_NS;
+		tEvent.qwDeviceId = dwIndex;
+		tEvent.dwHoldId = dwIndex;
+		(VOID)bench_QuarantineDecide(&s_tDecision, &s_tQuarantine, &tEvent, KEY_A, TRUE, qwTimeline);
+	}
+	QUARANTINE_GetStats(&s_tQuarantine, &tStats);
+	if ((qwHeld + QUARANTINE_MAX_DEVICES - 2 != tStats.qwHeld) || (qwDropped + 3 != tStats.qwDropped) ||
+		(QUARANTINE_MAX_DEVICES - 2 != tStats.dwHolding) || (2 != tStats.qwBlockedDevices))
+	{
+		(VOID)printf("quarantine/burst: %llu of %d new keyboards' keys held, %llu dropped, %llu blocked\n",
+			tStats.qwHeld - qwHeld,
+			QUARANTINE_MAX_DEVICES - 1,
+			tStats.qwDropped - qwDropped,
+			tStats.qwBlockedDevices);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	if (bIsInitialized)
+	{
+		QUARANTINE_Finalize(&s_tQuarantine);
+		DECISION_Finalize(&s_tDecision);
+	}
+	SIGNATURE_Destroy(&tSet);
+	CLOSE_FD(anOutput[0]);
+	CLOSE_FD(anOutput[1]);
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_QuarantineDetach											*
+*  Purpose:		Verifies that detached keyboards free their slots, held or		*
+*				blocked, so keyboards plugged in later are still held and		*
+*				released, and that a detached keyboard's keys are released.		*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Verdicts are given, the quarantine alone is checked.			*
+********************************************************************************/
+static
+RETSTATUS
+bench_QuarantineDetach(VOID)
+{
+	static QUARANTINE s_tQuarantine;
+	static TIMERWHEEL s_tTimers;
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	EVENTSOURCE_EVENT tEvent;
+	QUARANTINE_STATS tStats = { 0 };
+	struct input_event atRecords[16];
+	INT anOutput[2] = { -1, -1 };
+	BOOL bIsInitialized = FALSE;
+	DWORD dwHoldId = 0;
+	ssize_t cbRead = 0;
+
+	RtlZeroMemory(&tEvent, sizeof(tEvent));
+	RtlZeroMemory(atRecords, sizeof(atRecords));
+	if (0 != pipe2(anOutput, O_CLOEXEC | O_NONBLOCK))
+	{
+		(VOID)printf("quarantine/detach: cannot create the stand-in\n");
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	TIMERWHEEL_Initialize(&s_tTimers, CLOCK_GetTimestamp());
+	QUARANTINE_Initialize(anOutput[1], &s_tTimers, &s_tQuarantine);
+	anOutput[1] = -1;
+	bIsInitialized = TRUE;
+
+	// Keyboards unplugged before their verdict (every other one blocked first), more than there are slots
+	tEvent.eType = EVENTSOURCE_EVENT_TYPE_KEY;
+	tEvent.eClass = EVENTSOURCE_DEVICE_CLASS_KEYBOARD;
+	tEvent.wKeyCode = KEY_A;
+	tEvent.bIsKeyDown = TRUE;
+	for (dwHoldId = 1; dwHoldId <= QUARANTINE_MAX_DEVICES * 2; dwHoldId++)
+	{
+		tEvent.qwTimestamp = CLOCK_GetTimestamp();
+		tEvent.dwHoldId = dwHoldId;
+		QUARANTINE_OnKey(&s_tQuarantine, &tEvent, CADENCE_VERDICT_PENDING, FALSE);
+		if (0 == dwHoldId % 2)
+		{
+			QUARANTINE_OnKey(&s_tQuarantine, &tEvent, CADENCE_VERDICT_INJECTION, FALSE);
+		}
+		QUARANTINE_OnDetach(&s_tQuarantine, dwHoldId);
+	}
+
+	// A keyboard plugged in now is held, then released with its held key
+	tEvent.dwHoldId = dwHoldId;
+	tEvent.qwTimestamp = CLOCK_GetTimestamp();
+	QUARANTINE_OnKey(&s_tQuarantine, &tEvent, CADENCE_VERDICT_PENDING, FALSE);
+	QUARANTINE_GetStats(&s_tQuarantine, &tStats);
+	if ((1 != tStats.dwHolding) || (QUARANTINE_MAX_DEVICES * 2 + 1 != tStats.qwHeld))
+	{
+		(VOID)printf("quarantine/detach: %lu keyboards held, %llu keys held\n",
+			(unsigned long)tStats.dwHolding,
+			tStats.qwHeld);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	tEvent.wKeyCode = KEY_B;
+	QUARANTINE_OnKey(&s_tQuarantine, &tEvent, CADENCE_VERDICT_HUMAN, FALSE);
+
+	// Unplugged with both keys down, they are released
+	QUARANTINE_OnDetach(&s_tQuarantine, dwHoldId);
+	QUARANTINE_GetStats(&s_tQuarantine, &tStats);
+	cbRead = read(anOutput[0], atRecords, sizeof(atRecords));
+	if ((0 != tStats.dwHolding) ||
+		(1 != tStats.qwReleasedDevices) ||
+		(1 != tStats.qwReplayed) ||
+		(1 != tStats.qwPassed) ||
+		(QUARANTINE_MAX_DEVICES * 2 + 1 != tStats.qwDetachedDevices) ||
+		(sizeof(atRecords[0]) * 8 != (SIZE_T)cbRead) ||
+		(0 != atRecords[4].value) ||
+		(0 != atRecords[6].value))
+	{
+		(VOID)printf("quarantine/detach: %llu released, %llu replayed, %llu passed, %llu detached, %ld bytes out\n",
+			tStats.qwReleasedDevices,
+			tStats.qwReplayed,
+			tStats.qwPassed,
+			tStats.qwDetachedDevices,
+			(long)cbRead);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	if (bIsInitialized)
+	{
+		QUARANTINE_Finalize(&s_tQuarantine);
+	}
+	CLOSE_FD(anOutput[0]);
+	CLOSE_FD(anOutput[1]);
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_BusAgent													*
+*  Purpose:		A stand-in session agent: counts the decisions it receives.		*
+*  Parameters:	@ pvAgent ~[inout]~ Its side of the bus.						*
+*  Returns:		Zero.															*
+********************************************************************************/
+static
+UINT
+WINAPI
+bench_BusAgent(
+	__inout_opt PVOID pvAgent
+)
+{
+	PBUS_AGENT ptAgent = (PBUS_AGENT)pvAgent;
+	BUS_DECISION tDecision = { 0 };
+
+	while (BUS_Receive(ptAgent, &tDecision))
+	{
+		(VOID)ATOMIC_INCREMENT(&g_nBusReceived);
+	}
+	return 0;
+}
+
+/********************************************************************************
+*  Function:	bench_BusFanOut													*
+*  Purpose:		Measures publishing a decision until every stand-in agent		*
+*				received it.													*
+*  Parameters:	@ dwAgents ~[in]~ How many agents follow the bus.				*
+*				@ ptAgents ~[out]~ Their sides, at least dwAgents.				*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Every agent has a mapping of its own, as separate processes	*
+*					would.														*
+********************************************************************************/
+static
+RETSTATUS
+bench_BusFanOut(
+	__in DWORD dwAgents,
+	__out_ecount(dwAgents) PBUS_AGENT ptAgents
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	BUS tBus = { 0 };
+	HANDLE ahAgents[BENCH_BUS_MAX_AGENTS] = { NULL };
+	BUS_AGENT_STATS tStats = { 0 };
+	DWORD dwAttached = 0;
+	DWORD dwAgent = 0;
+	LONG nExpected = 0;
+	ULONGLONG qwStart = 0;
+	ULONGLONG qwElapsed = 0;
+	ULONGLONG qwDecisions = 0;
+
+	eStatus = BUS_Create(BENCH_BUS_PATH, &tBus);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		(VOID)printf("bus: cannot create %s\n", BENCH_BUS_PATH);
+		goto lblCleanup;
+	}
+	ATOMIC_STORE_RELEASE(&g_nBusReceived, 0);
+	for (dwAttached = 0; dwAttached < dwAgents; dwAttached++)
+	{
+		eStatus = BUS_Attach(BENCH_BUS_PATH, &(ptAgents[dwAttached]));
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			(VOID)printf("bus: cannot attach\n");
+			goto lblCleanup;
+		}
+		ahAgents[dwAttached] = BEGIN_THREAD(bench_BusAgent, &(ptAgents[dwAttached]), 0);
+		if (NULL == ahAgents[dwAttached])
+		{
+			(VOID)printf("bus: cannot start an agent\n");
+			BUS_Detach(&(ptAgents[dwAttached]));
+			eStatus = DEBUG_GEN_FAIL_STATUS();
+			goto lblCleanup;
+		}
+	}
+
+	// One decision at a time, until the last agent has it (agents may share the CPU)
+	do
+	{
+		nExpected += (LONG)dwAgents;
+		qwStart = CLOCK_GetTimestamp();
+		BUS_Publish(&tBus, qwStart, 1);
+		while (nExpected != ATOMIC_LOAD_ACQUIRE(&g_nBusReceived))
+		{
+			(VOID)sched_yield();
+		}
+		qwElapsed += CLOCK_GetTimestamp() - qwStart;
+		qwDecisions++;
+	} while (BENCH_MIN_DURATION_NS > qwElapsed);
+
+	// Verify every agent got every decision
+	for (dwAgent = 0; dwAgent < dwAgents; dwAgent++)
+	{
+		BUS_GetAgentStats(&(ptAgents[dwAgent]), &tStats);
+		if ((!tStats.bIsAttached) || (qwDecisions != tStats.qwReceived) || (0 != tStats.qwOverruns))
+		{
+			(VOID)printf("bus: agent %lu received %llu of %llu decisions, %llu overruns\n",
+				(unsigned long)dwAgent,
+				tStats.qwReceived,
+				qwDecisions,
+				tStats.qwOverruns);
+			eStatus = DEBUG_GEN_FAIL_STATUS();
+			goto lblCleanup;
+		}
+	}
+	bench_Report((double)qwElapsed / (double)qwDecisions, "ns/decision", BENCH_SYSTEM_TOLERANCE_PERCENT, "bus/fanout/%lu", (unsigned long)dwAgents);
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	for (dwAgent = 0; dwAgent < dwAttached; dwAgent++)
+	{
+		BUS_StopAgent(&(ptAgents[dwAgent]));
+		JOIN_THREAD(ahAgents[dwAgent]);
+		BUS_Detach(&(ptAgents[dwAgent]));
+	}
+	BUS_Destroy(&tBus);
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_Bus														*
+*  Purpose:		Measures the decision bus fan-out to growing numbers of			*
+*				stand-in session agents.										*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+bench_Bus(VOID)
+{
+	RETSTATUS eStatus = RETSTATUS_SUCCESS;
+	PBUS_AGENT ptAgents = NULL;
+	DWORD dwSet = 0;
+
+	ptAgents = (PBUS_AGENT)ALLOCZ(BENCH_BUS_MAX_AGENTS * sizeof(*ptAgents));
+	if (NULL == ptAgents)
+	{
+		(VOID)printf("bus: out of memory\n");
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	for (dwSet = 0; (dwSet < sizeof(g_adwBusAgents) / sizeof(g_adwBusAgents[0])) && RETSTATUS_SUCCEEDED(eStatus); dwSet++)
+	{
+		eStatus = bench_BusFanOut(g_adwBusAgents[dwSet], ptAgents);
+	}
+
+lblCleanup:
+
+	// Free resources
+	FREE(ptAgents);
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_CollectorEvent											*
+*  Purpose:		Counts and checks an event the stand-in collector decoded.		*
+*  Parameters:	@ ptEvent ~[in]~ The event.										*
+*				@ pvCollector ~[inout]~ The collector.							*
+********************************************************************************/
+static
+VOID
+bench_CollectorEvent(
+	__in PCTELEMETRY_EVENT ptEvent,
+	__inout_opt PVOID pvCollector
+)
+{
+	PBENCH_COLLECTOR ptCollector = (PBENCH_COLLECTOR)pvCollector;
+
+	ptCollector->qwEvents++;
+	ptCollector->bIsWrong = ptCollector->bIsWrong ||
+		(BENCH_TELEMETRY_DEVICES < ptEvent->qwDeviceId) ||
+		((TELEMETRY_KIND_ARRIVAL == ptEvent->eKind) && (0x046D != ptEvent->wVendorId)) ||
+		((TELEMETRY_KIND_LOCK == ptEvent->eKind) && (0 == ptEvent->qwLatencyNs));
+}
+
+/********************************************************************************
+*  Function:	bench_CollectorThread											*
+*  Purpose:		Receives and decodes batches until stopped.						*
+*  Parameters:	@ pvCollector ~[inout]~ The collector.							*
+*  Returns:		Zero.															*
+********************************************************************************/
+static
+UINT
+WINAPI
+bench_CollectorThread(
+	__inout_opt PVOID pvCollector
+)
+{
+	PBENCH_COLLECTOR ptCollector = (PBENCH_COLLECTOR)pvCollector;
+	static BYTE s_abBatch[TELEMETRY_BATCH_BYTES] = { 0 };
+	TELEMETRY_BATCH_HEADER tHeader = { 0 };
+	struct pollfd tSocket = { 0 };
+	ssize_t cbBatch = 0;
+
+	tSocket.fd = ptCollector->nSocket;
+	tSocket.events = POLLIN;
+	while (!ATOMIC_LOAD_ACQUIRE(&(ptCollector->nIsStopping)))
+	{
+		if (0 >= poll(&tSocket, 1, 10))
+		{
+			continue;
+		}
+		cbBatch = recv(ptCollector->nSocket, s_abBatch, sizeof(s_abBatch), MSG_DONTWAIT);
+		if (0 >= cbBatch)
+		{
+			continue;
+		}
+		ptCollector->bIsWrong = ptCollector->bIsWrong ||
+			(!TELEMETRY_DecodeBatch(s_abBatch, (SIZE_T)cbBatch, &tHeader, bench_CollectorEvent, ptCollector)) ||
+			(ptCollector->qwBatches != tHeader.qwSequence) ||
+			(0 != tHeader.qwDroppedEvents);
+		ptCollector->qwBatches++;
+	}
+	return 0;
+}
+
+/********************************************************************************
+*  Function:	bench_Telemetry													*
+*  Purpose:		Measures exporting telemetry to a stand-in collector: the		*
+*				producer's cost, the exporter's CPU time and the bytes sent		*
+*				per event. Then checks that a missing collector only costs		*
+*				counted drops.													*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+bench_Telemetry(VOID)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	BENCH_COLLECTOR tCollector = { -1, FALSE, 0, 0, FALSE };
+	TELEMETRY tTelemetry = { 0 };
+	TELEMETRY_EVENT tEvent = { 0 };
+	TELEMETRY_STATS tStats = { 0 };
+	struct sockaddr_un tAddress = { 0 };
+	HANDLE hCollector = NULL;
+	DWORD dwIndex = 0;
+	ULONGLONG qwStart = 0;
+	ULONGLONG qwElapsed = 0;
+	ULONGLONG qwCalls = 0;
+	ULONGLONG qwDeadline = 0;
+
+	// The stand-in collector
+	tAddress.sun_family = AF_UNIX;
+	(VOID)snprintf(tAddress.sun_path, sizeof(tAddress.sun_path), "%s", BENCH_TELEMETRY_PATH);
+	(VOID)remove(BENCH_TELEMETRY_PATH);
+	tCollector.nSocket = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if ((0 > tCollector.nSocket) || (0 != bind(tCollector.nSocket, (const struct sockaddr *)&tAddress, sizeof(tAddress))))
+	{
+		(VOID)printf("telemetry: cannot bind %s\n", BENCH_TELEMETRY_PATH);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	hCollector = BEGIN_THREAD(bench_CollectorThread, &tCollector, 0);
+	if (NULL == hCollector)
+	{
+		(VOID)printf("telemetry: cannot start the collector\n");
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	eStatus = TELEMETRY_Start(BENCH_TELEMETRY_PATH, &tTelemetry);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		(VOID)printf("telemetry: cannot start the exporter\n");
+		goto lblCleanup;
+	}
+
+	// Bursts of arrivals, verdicts and locks a microsecond apart, each flushed
+	tEvent.eType = EVENTSOURCE_EVENT_TYPE_ARRIVAL;
+	tEvent.eClass = EVENTSOURCE_DEVICE_CLASS_KEYBOARD;
+	tEvent.wVendorId = 0x046D;
+	tEvent.wProductId = 0xC31C;
+	do
+	{
+		qwStart = CLOCK_GetTimestamp();
+		for (dwIndex = 0; dwIndex < BENCH_TELEMETRY_BURST; dwIndex++)
+		{
+			tEvent.eKind = (TELEMETRY_KIND)(TELEMETRY_KIND_ARRIVAL + (dwIndex % 3));
+			tEvent.bIsLocked = (0 != (dwIndex & 1));
+			tEvent.qwTimestamp = qwStart + (dwIndex * NANOSECONDS_IN_MICROSECOND);
+			tEvent.qwDeviceId = 1 + (dwIndex % BENCH_TELEMETRY_DEVICES);
+			tEvent.qwLatencyNs = 150000 + dwIndex;
+			TELEMETRY_Record(&tTelemetry, &tEvent);
+		}
+		qwElapsed += CLOCK_GetTimestamp() - qwStart;
+		qwCalls += dwIndex;
+		TELEMETRY_Flush(&tTelemetry);
+	} while (BENCH_MIN_DURATION_NS > qwElapsed);
+
+	// Verify the collector got every event (it may share the CPU)
+	TELEMETRY_GetStats(&tTelemetry, &tStats);
+	qwDeadline = CLOCK_GetTimestamp() + NANOSECONDS_IN_SECOND;
+	while ((tStats.qwExported != ATOMIC_LOAD_ACQUIRE(&(tCollector.qwEvents))) && (CLOCK_GetTimestamp() < qwDeadline))
+	{
+		(VOID)sched_yield();
+	}
+	if ((qwCalls != tStats.qwRecorded) || (qwCalls != tStats.qwExported) || (0 != tStats.qwDroppedEvents) ||
+		(tStats.qwExported != ATOMIC_LOAD_ACQUIRE(&(tCollector.qwEvents))) || tCollector.bIsWrong)
+	{
+		(VOID)printf("telemetry: %llu recorded, %llu exported, %llu dropped, %llu collected%s\n",
+			tStats.qwRecorded,
+			tStats.qwExported,
+			tStats.qwDroppedEvents,
+			(ULONGLONG)ATOMIC_LOAD_ACQUIRE(&(tCollector.qwEvents)),
+			tCollector.bIsWrong ? ", some wrong" : "");
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	bench_Report((double)qwElapsed / (double)qwCalls, "ns/event", BENCH_SYSTEM_TOLERANCE_PERCENT, "telemetry/record");
+	bench_Report((double)tStats.qwCpuNs / (double)tStats.qwExported, "cpu ns/event", BENCH_SYSTEM_TOLERANCE_PERCENT, "telemetry/export");
+	bench_Report((double)tStats.qwBytes / (double)tStats.qwExported, "bytes/event", BENCH_TOLERANCE_PERCENT, "telemetry/bytes");
+
+	// Without a collector, a burst is dropped and counted
+	ATOMIC_STORE_RELEASE(&(tCollector.nIsStopping), TRUE);
+	JOIN_THREAD(hCollector);
+	CLOSE_FD(tCollector.nSocket);
+	(VOID)remove(BENCH_TELEMETRY_PATH);
+	for (dwIndex = 0; dwIndex < BENCH_TELEMETRY_BURST; dwIndex++)
+	{
+		TELEMETRY_Record(&tTelemetry, &tEvent);
+	}
+	TELEMETRY_Flush(&tTelemetry);
+	TELEMETRY_GetStats(&tTelemetry, &tStats);
+	if ((qwCalls != tStats.qwExported) || (BENCH_TELEMETRY_BURST != tStats.qwDroppedEvents) || (0 == tStats.qwDroppedBatches))
+	{
+		(VOID)printf("telemetry: %llu dropped without a collector, expected %lu\n",
+			tStats.qwDroppedEvents,
+			(unsigned long)BENCH_TELEMETRY_BURST);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	TELEMETRY_Stop(&tTelemetry);
+	if (NULL != hCollector)
+	{
+		ATOMIC_STORE_RELEASE(&(tCollector.nIsStopping), TRUE);
+		JOIN_THREAD(hCollector);
+	}
+	CLOSE_FD(tCollector.nSocket);
+	(VOID)remove(BENCH_TELEMETRY_PATH);
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_RunAction													*
+*  Purpose:		A stand-in response action.										*
+*  Parameters:	@ eKind ~[in]~ The action.										*
+*				@ ptRequest ~[in]~ The request it runs for.						*
+*				@ pvActions ~[inout]~ The stand-in actions.						*
+********************************************************************************/
+static
+VOID
+bench_RunAction(
+	__in ACTION_KIND eKind,
+	__in PCACTION_REQUEST ptRequest,
+	__inout_opt PVOID pvActions
+)
+{
+	PBENCH_ACTIONS ptActions = (PBENCH_ACTIONS)pvActions;
+	LONG nRun = ATOMIC_INCREMENT(&(ptActions->nRuns)) - 1;
+
+	if (ACTION_KIND_LOCK == eKind)
+	{
+		ptActions->qwDispatchNs += CLOCK_GetTimestamp() - ptRequest->qwRequestedTimestamp;
+	}
+	if (BENCH_ACTION_MAX_ORDER > nRun)
+	{
+		ptActions->aeOrder[nRun] = eKind;
+	}
+	while (ATOMIC_LOAD_ACQUIRE(&(ptActions->anIsHeld[eKind])))
+	{
+		(VOID)sched_yield();
+	}
+}
+
+/********************************************************************************
+*  Function:	bench_WaitActions												*
+*  Purpose:		Waits until a number of stand-in actions started.				*
+*  Parameters:	@ ptActions ~[in]~ The stand-in actions.						*
+*				@ nRuns ~[in]~ The number of actions.							*
+*  Returns:		TRUE on success, FALSE after a second.							*
+********************************************************************************/
+static
+BOOL
+bench_WaitActions(
+	__in PBENCH_ACTIONS ptActions,
+	__in LONG nRuns
+)
+{
+	ULONGLONG qwDeadline = CLOCK_GetTimestamp() + NANOSECONDS_IN_SECOND;
+
+	while (nRuns > ATOMIC_LOAD_ACQUIRE(&(ptActions->nRuns)))
+	{
+		if (CLOCK_GetTimestamp() > qwDeadline)
+		{
+			return FALSE;
+		}
+		(VOID)sched_yield();
+	}
+	return TRUE;
+}
+
+/********************************************************************************
+*  Function:	bench_Action													*
+*  Purpose:		Measures requesting response actions during a storm and			*
+*				dispatching them to idle workers, then checks that identical	*
+*				pending actions are absorbed, that alerts for different			*
+*				devices are not, and that a lock goes before an alert.			*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+bench_Action(VOID)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	static BENCH_ACTIONS s_tActions = { { 0 }, 0, { 0 }, 0 };
+	ACTION_EXECUTOR tExecutor = { 0 };
+	ACTION_STATS tStats = { 0 };
+	ULONGLONG qwStart = 0;
+	ULONGLONG qwElapsed = 0;
+	ULONGLONG qwCalls = 0;
+	DWORD dwIndex = 0;
+	DWORD dwKind = 0;
+
+	// A storm: every decision asks for all three, mostly while they are pending
+	RtlZeroMemory(&s_tActions, sizeof(s_tActions));
+	eStatus = ACTION_Start(bench_RunAction, &s_tActions, &tExecutor);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		goto lblCleanup;
+	}
+	do
+	{
+		qwStart = CLOCK_GetTimestamp();
+		for (dwIndex = 0; dwIndex < BENCH_BURST_INTERVALS; dwIndex++)
+		{
+			(VOID)ACTION_Request(&tExecutor, (ACTION_KIND)(dwIndex % ACTION_KIND_COUNT), qwStart, dwIndex);
+		}
+		qwElapsed += CLOCK_GetTimestamp() - qwStart;
+		qwCalls += dwIndex;
+		(VOID)sched_yield();
+	} while (BENCH_MIN_DURATION_NS > qwElapsed);
+	ACTION_Stop(&tExecutor);
+	for (dwKind = 0; dwKind < ACTION_KIND_COUNT; dwKind++)
+	{
+		ACTION_GetStats(&tExecutor, (ACTION_KIND)dwKind, &tStats);
+		if ((0 == tStats.qwRun) || (tStats.qwRequested != tStats.qwRun + tStats.qwAbsorbed))
+		{
+			(VOID)printf("action/%lu: %llu requested, %llu run, %llu absorbed\n",
+				(unsigned long)dwKind,
+				tStats.qwRequested,
+				tStats.qwRun,
+				tStats.qwAbsorbed);
+			eStatus = DEBUG_GEN_FAIL_STATUS();
+			goto lblCleanup;
+		}
+	}
+	bench_Report((double)qwElapsed / (double)qwCalls, "ns/request", BENCH_SYSTEM_TOLERANCE_PERCENT, "action/request");
+
+	// One lock at a time on idle workers
+	RtlZeroMemory(&s_tActions, sizeof(s_tActions));
+	eStatus = ACTION_Start(bench_RunAction, &s_tActions, &tExecutor);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		goto lblCleanup;
+	}
+	for (dwIndex = 0; dwIndex < BENCH_ACTION_DISPATCHES; dwIndex++)
+	{
+		(VOID)ACTION_Request(&tExecutor, ACTION_KIND_LOCK, 0, dwIndex);
+		if (!bench_WaitActions(&s_tActions, (LONG)dwIndex + 1))
+		{
+			(VOID)printf("action/dispatch: a lock never ran\n");
+			eStatus = DEBUG_GEN_FAIL_STATUS();
+			goto lblCleanup;
+		}
+	}
+	ACTION_Stop(&tExecutor);
+	bench_Report((double)s_tActions.qwDispatchNs / BENCH_ACTION_DISPATCHES,
+		"ns/action",
+		BENCH_SYSTEM_TOLERANCE_PERCENT,
+		"action/dispatch");
+
+	// Hold both workers (an alert and a snapshot), then ask again for both, for alerts on other devices and for locks
+	RtlZeroMemory(&s_tActions, sizeof(s_tActions));
+	s_tActions.anIsHeld[ACTION_KIND_ALERT] = TRUE;
+	s_tActions.anIsHeld[ACTION_KIND_SNAPSHOT] = TRUE;
+	eStatus = ACTION_Start(bench_RunAction, &s_tActions, &tExecutor);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		goto lblCleanup;
+	}
+	(VOID)ACTION_Request(&tExecutor, ACTION_KIND_SNAPSHOT, 0, 0);
+	(VOID)ACTION_Request(&tExecutor, ACTION_KIND_ALERT, 0, 0);
+	if (!bench_WaitActions(&s_tActions, 2))
+	{
+		(VOID)printf("action/priority: the held actions never ran\n");
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	for (dwIndex = 0; dwIndex < BENCH_ACTION_REPEATS; dwIndex++)
+	{
+		(VOID)ACTION_Request(&tExecutor, ACTION_KIND_ALERT, 0, 0);
+		(VOID)ACTION_Request(&tExecutor, ACTION_KIND_SNAPSHOT, 0, 0);
+	}
+	(VOID)ACTION_Request(&tExecutor, ACTION_KIND_ALERT, 0, 1);
+	(VOID)ACTION_Request(&tExecutor, ACTION_KIND_ALERT, 0, 2);
+	(VOID)ACTION_Request(&tExecutor, ACTION_KIND_LOCK, 0, 0);
+	(VOID)ACTION_Request(&tExecutor, ACTION_KIND_LOCK, 0, 1);
+
+	// Release the alert worker alone: one lock must go first, then an alert for each device
+	ATOMIC_STORE_RELEASE(&(s_tActions.anIsHeld[ACTION_KIND_ALERT]), FALSE);
+	(VOID)bench_WaitActions(&s_tActions, 6);
+	ATOMIC_STORE_RELEASE(&(s_tActions.anIsHeld[ACTION_KIND_SNAPSHOT]), FALSE);
+	ACTION_Stop(&tExecutor);
+	ACTION_GetStats(&tExecutor, ACTION_KIND_ALERT, &tStats);
+	if ((7 != s_tActions.nRuns) ||
+		(ACTION_KIND_LOCK != s_tActions.aeOrder[2]) ||
+		(ACTION_KIND_ALERT != s_tActions.aeOrder[3]) ||
+		(ACTION_KIND_ALERT != s_tActions.aeOrder[5]) ||
+		(ACTION_KIND_SNAPSHOT != s_tActions.aeOrder[6]) ||
+		(4 != tStats.qwRun) ||
+		(BENCH_ACTION_REPEATS - 1 != tStats.qwAbsorbed))
+	{
+		(VOID)printf("action/priority: %ld runs (third %d, fourth %d), alert run %llu times, %llu absorbed\n",
+			(long)s_tActions.nRuns,
+			(INT)s_tActions.aeOrder[2],
+			(INT)s_tActions.aeOrder[3],
+			tStats.qwRun,
+			tStats.qwAbsorbed);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	ACTION_GetStats(&tExecutor, ACTION_KIND_LOCK, &tStats);
+	if ((1 != tStats.qwRun) || (1 != tStats.qwAbsorbed))
+	{
+		(VOID)printf("action/priority: lock run %llu times, %llu absorbed\n", tStats.qwRun, tStats.qwAbsorbed);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	s_tActions.anIsHeld[ACTION_KIND_ALERT] = FALSE;
+	s_tActions.anIsHeld[ACTION_KIND_SNAPSHOT] = FALSE;
+	ACTION_Stop(&tExecutor);
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_StartOnce													*
+*  Purpose:		Starts the notifier (or a session agent) until armed, and		*
+*				reads its startup line.											*
+*  Parameters:	@ pszNotifier ~[in]~ The notifier's absolute path.				*
+*				@ pszRole ~[in_opt]~ "-a" for a session agent, or NULL.			*
+*				@ pqwArmedUs ~[out]~ Gets the time until armed.					*
+*				@ pdwResidentKb ~[out]~ Gets the resident set by then.			*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Runs in BENCH_STARTUP_DIRECTORY.								*
+********************************************************************************/
+static
+RETSTATUS
+bench_StartOnce(
+	__in_z PCSTR pszNotifier,
+	__in_z_opt PCSTR pszRole,
+	__out PULONGLONG pqwArmedUs,
+	__out unsigned long *pdwResidentKb
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	CHAR szLine[256] = { 0 };
+	INT anPipe[2] = { -1, -1 };
+	pid_t nChild = -1;
+	INT nExitStatus = 0;
+	FILE *ptOutput = NULL;
+	BOOL bIsParsed = FALSE;
+
+	if (0 != pipe(anPipe))
+	{
+		(VOID)printf("startup: cannot create a pipe\n");
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	nChild = fork();
+	if (0 == nChild)
+	{
+		// Only async-signal-safe calls until exec, other threads are running
+		(VOID)dup2(anPipe[1], STDOUT_FILENO);
+		(VOID)close(anPipe[0]);
+		(VOID)close(anPipe[1]);
+		if (0 == chdir(BENCH_STARTUP_DIRECTORY))
+		{
+			(VOID)execl(pszNotifier, pszNotifier, "-s", pszRole, (PSTR)NULL);
+		}
+		_exit(1);
+	}
+	CLOSE_FD(anPipe[1]);
+	if (0 > nChild)
+	{
+		(VOID)printf("startup: cannot start %s\n", pszNotifier);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	ptOutput = fdopen(anPipe[0], "r");
+	if (NULL == ptOutput)
+	{
+		(VOID)printf("startup: cannot read the pipe\n");
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	anPipe[0] = -1;
+	bIsParsed = (NULL != fgets(szLine, sizeof(szLine), ptOutput)) &&
+		(2 == sscanf(szLine, "startup: armed in %llu us, resident %lu KB", pqwArmedUs, pdwResidentKb));
+	CLOSE(ptOutput, fclose);
+	(VOID)waitpid(nChild, &nExitStatus, 0);
+	nChild = -1;
+	if ((!bIsParsed) || (!WIFEXITED(nExitStatus)) || (0 != WEXITSTATUS(nExitStatus)))
+	{
+		(VOID)printf("startup: %s -s %s failed\n", pszNotifier, (NULL != pszRole) ? pszRole : "");
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	if (0 < nChild)
+	{
+		(VOID)waitpid(nChild, NULL, 0);
+	}
+	CLOSE(ptOutput, fclose);
+	CLOSE_FD(anPipe[0]);
+	CLOSE_FD(anPipe[1]);
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_CountWakeups												*
+*  Purpose:		Counts the times a process's threads blocked, each of which		*
+*				took a wakeup to resume.										*
+*  Parameters:	@ nProcess ~[in]~ The process.									*
+*				@ pqwWakeups ~[out]~ Gets the count, over all its threads.		*
+*  Returns:		TRUE on success.												*
+********************************************************************************/
+static
+BOOL
+bench_CountWakeups(
+	__in pid_t nProcess,
+	__out PULONGLONG pqwWakeups
+)
+{
+	CHAR szPath[PATH_MAX] = { 0 };
+	CHAR szLine[256] = { 0 };
+	DIR *ptTasks = NULL;
+	struct dirent *ptTask = NULL;
+	FILE *ptStatus = NULL;
+	unsigned long long qwSwitches = 0;
+
+	*pqwWakeups = 0;
+	(VOID)snprintf(szPath, sizeof(szPath), "/proc/%ld/task", (long)nProcess);
+	ptTasks = opendir(szPath);
+	if (NULL == ptTasks)
+	{
+		return FALSE;
+	}
+	for (ptTask = readdir(ptTasks); NULL != ptTask; ptTask = readdir(ptTasks))
+	{
+		if ('.' == ptTask->d_name[0])
+		{
+			continue;
+		}
+		(VOID)snprintf(szPath, sizeof(szPath), "/proc/%ld/task/%s/status", (long)nProcess, ptTask->d_name);
+		ptStatus = fopen(szPath, "r");
+		if (NULL == ptStatus)
+		{
+			continue;
+		}
+		while (NULL != fgets(szLine, sizeof(szLine), ptStatus))
+		{
+			if (1 == sscanf(szLine, "voluntary_ctxt_switches: %llu", &qwSwitches))
+			{
+				*pqwWakeups += qwSwitches;
+			}
+		}
+		CLOSE(ptStatus, fclose);
+	}
+	(VOID)closedir(ptTasks);
+
+	// Return result
+	return TRUE;
+}
+
+/********************************************************************************
+*  Function:	bench_Idle														*
+*  Purpose:		Measures how often the notifier wakes up while nothing			*
+*				happens.														*
+*  Parameters:	@ pszNotifier ~[in]~ The notifier's absolute path.				*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Runs in BENCH_STARTUP_DIRECTORY, until terminated.			*
+********************************************************************************/
+static
+RETSTATUS
+bench_Idle(
+	__in_z PCSTR pszNotifier
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	struct timespec tSettle = { BENCH_IDLE_SETTLE_MS / 1000, (BENCH_IDLE_SETTLE_MS % 1000) * 1000000L };
+	struct timespec tWindow = { BENCH_IDLE_WINDOW_MS / 1000, (BENCH_IDLE_WINDOW_MS % 1000) * 1000000L };
+	ULONGLONG qwBefore = 0;
+	ULONGLONG qwAfter = 0;
+	INT nNull = -1;
+	pid_t nChild = -1;
+
+	nNull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	if (0 > nNull)
+	{
+		(VOID)printf("idle: cannot open /dev/null\n");
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	nChild = fork();
+	if (0 == nChild)
+	{
+		// Only async-signal-safe calls until exec, other threads are running
+		(VOID)dup2(nNull, STDOUT_FILENO);
+		if (0 == chdir(BENCH_STARTUP_DIRECTORY))
+		{
+			(VOID)execl(pszNotifier, pszNotifier, (PSTR)NULL);
+		}
+		_exit(1);
+	}
+	if (0 > nChild)
+	{
+		(VOID)printf("idle: cannot start %s\n", pszNotifier);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Count its wakeups once started, while nothing happens
+	(VOID)nanosleep(&tSettle, NULL);
+	if (!bench_CountWakeups(nChild, &qwBefore))
+	{
+		(VOID)printf("idle: %s is not running\n", pszNotifier);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	(VOID)nanosleep(&tWindow, NULL);
+	if ((!bench_CountWakeups(nChild, &qwAfter)) || (0 != waitpid(nChild, NULL, WNOHANG)))
+	{
+		(VOID)printf("idle: %s exited\n", pszNotifier);
+		nChild = -1;
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	bench_Report((double)(qwAfter - qwBefore) * 60000 / BENCH_IDLE_WINDOW_MS,
+		"wakeups/min",
+		BENCH_TOLERANCE_PERCENT,
+		"idle/notifier");
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	if (0 < nChild)
+	{
+		(VOID)kill(nChild, SIGTERM);
+		(VOID)waitpid(nChild, NULL, 0);
+	}
+	CLOSE_FD(nNull);
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	bench_Startup													*
+*  Purpose:		Measures the notifier's startup: the time from main until it	*
+*				listens for devices, and its resident set by then. Then the		*
+*				same for a session agent, whose footprint is the cost of		*
+*				each session on a multi-seat host. Then the notifier's			*
+*				wakeups while idle.												*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Runs antiduck -s (and antiduck -s -a, next to a bus), from	*
+*					next to the benchmark, in BENCH_STARTUP_DIRECTORY.			*
+*				* Skipped if the notifier was not built.						*
+********************************************************************************/
+static
+RETSTATUS
+bench_Startup(VOID)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	CHAR szNotifier[PATH_MAX] = { 0 };
+	CHAR szPath[PATH_MAX] = { 0 };
+	PSTR pszName = NULL;
+	BUS tBus = { 0 };
+	ULONGLONG qwArmedUs = 0;
+	unsigned long dwResidentKb = 0;
+	DWORD dwRun = 0;
+
+	// Find the notifier (by absolute path, it runs in the scratch directory)
+	if (NULL == realpath(g_pszBenchPath, szNotifier))
+	{
+		(VOID)printf("startup: cannot resolve %s\n", g_pszBenchPath);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	pszName = strrchr(szNotifier, '/') + 1;
+	if (sizeof(szNotifier) - (SIZE_T)(pszName - szNotifier) <= (SIZE_T)snprintf(pszName, sizeof(szNotifier) - (SIZE_T)(pszName - szNotifier), "antiduck"))
+	{
+		(VOID)printf("startup: path too long\n");
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	if (0 != access(szNotifier, X_OK))
+	{
+		(VOID)printf("startup: %s not built, skipped\n", szNotifier);
+		eStatus = RETSTATUS_SUCCESS;
+		goto lblCleanup;
+	}
+	if ((0 != mkdir(BENCH_STARTUP_DIRECTORY, 0700)) && (EEXIST != errno))
+	{
+		(VOID)printf("startup: cannot create %s\n", BENCH_STARTUP_DIRECTORY);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Start it until armed, each run reports its own startup
+	for (dwRun = 0; dwRun < BENCH_STARTUP_RUNS; dwRun++)
+	{
+		eStatus = bench_StartOnce(szNotifier, NULL, &qwArmedUs, &dwResidentKb);
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			goto lblCleanup;
+		}
+		bench_Report((double)qwArmedUs, "us/start", BENCH_SYSTEM_TOLERANCE_PERCENT, "startup/armed");
+		bench_Report((double)dwResidentKb, "KB", BENCH_TOLERANCE_PERCENT, "startup/resident");
+	}
+
+	// Then a session agent, following a bus as it would the monitor's
+	(VOID)snprintf(szPath, sizeof(szPath), "%s/%s", BENCH_STARTUP_DIRECTORY, BUS_DEFAULT_PATH);
+	eStatus = BUS_Create(szPath, &tBus);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		(VOID)printf("startup: cannot create %s\n", szPath);
+		goto lblCleanup;
+	}
+	for (dwRun = 0; dwRun < BENCH_STARTUP_RUNS; dwRun++)
+	{
+		eStatus = bench_StartOnce(szNotifier, "-a", &qwArmedUs, &dwResidentKb);
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			goto lblCleanup;
+		}
+		bench_Report((double)qwArmedUs, "us/start", BENCH_SYSTEM_TOLERANCE_PERCENT, "startup/agent-armed");
+		bench_Report((double)dwResidentKb, "KB", BENCH_TOLERANCE_PERCENT, "startup/agent-resident");
+	}
+
+	// Then the notifier, left running without devices or decisions
+	eStatus = bench_Idle(szNotifier);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		goto lblCleanup;
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	BUS_Destroy(&tBus);
+	(VOID)snprintf(szPath, sizeof(szPath), "%s/%s", BENCH_STARTUP_DIRECTORY, LOG_DEFAULT_PATH);
+	(VOID)remove(szPath);
+	(VOID)rmdir(BENCH_STARTUP_DIRECTORY);
+
+	// Return result
+	return eStatus;
+}
+#endif	// _WIN32
+
+/********************************************************************************
+*  Function:	main															*
+*  Purpose:		Runs all benchmarks.											*
+*  Returns:		Zero if every benchmark passed its verification and, given a	*
+*				baseline, none regressed.										*
+*  Remarks:		* Usage: antiduck-bench [-r runs] [-j results.json]				*
+*					[-b baseline.json]											*
+*				* -r runs the suite several times and keeps the best of each	*
+*					result, -j writes the results as JSON, -b gates them		*
+*					against a previous -j output.								*
+********************************************************************************/
+INT
+main(
+	__in INT nArgs,
+	__in_ecount(nArgs) PSTR* ppszArgs
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	static RETSTATUS (*const s_apfnBenchmarks[])(VOID) = {
+		bench_Decode,
+		bench_DeviceId,
+		bench_Allowlist,
+		bench_Policy,
+		bench_Score,
+		bench_Cadence,
+		bench_Pool,
+		bench_Profile,
+		bench_Coalesce,
+		bench_Rules,
+		bench_Signature,
+		bench_Layout,
+		bench_TraceClock,
+		bench_Queue,
+		bench_TimerWheel,
+#ifndef _WIN32
+		bench_Evdev,
+		bench_Quarantine,
+		bench_QuarantineBurst,
+		bench_QuarantineDetach,
+		bench_Bus,
+		bench_Telemetry,
+		bench_Action,
+		bench_Startup,
+#endif	// _WIN32
+#ifdef _BINARY_LOG
+		bench_Log,
+#endif	// _BINARY_LOG
+	};
+	PCSTR pszJsonPath = NULL;
+	PCSTR pszBaselinePath = NULL;
+#ifdef _BINARY_LOG
+	BOOL bIsLogStarted = FALSE;
+#endif	// _BINARY_LOG
+	DWORD dwRuns = 1;
+	DWORD dwRun = 0;
+	DWORD dwIndex = 0;
+	INT nArg = 0;
+
+	// Parse the arguments
+#ifndef _WIN32
+	g_pszBenchPath = ppszArgs[0];
+#endif	// _WIN32
+	for (nArg = 1; nArg < nArgs; nArg++)
+	{
+		if ((0 == strcmp(ppszArgs[nArg], "-r")) && (nArg + 1 < nArgs))
+		{
+			dwRuns = (DWORD)strtoul(ppszArgs[++nArg], NULL, DECIMAL_BASE);
+			dwRuns = MAX(dwRuns, 1);
+		}
+		else if ((0 == strcmp(ppszArgs[nArg], "-j")) && (nArg + 1 < nArgs))
+		{
+			pszJsonPath = ppszArgs[++nArg];
+		}
+		else if ((0 == strcmp(ppszArgs[nArg], "-b")) && (nArg + 1 < nArgs))
+		{
+			pszBaselinePath = ppszArgs[++nArg];
+		}
+		else
+		{
+			(VOID)fprintf(stderr, "Usage: %s [-r runs] [-j results.json] [-b baseline.json]\n", ppszArgs[0]);
+			eStatus = DEBUG_GEN_FAIL_STATUS();
+			goto lblCleanup;
+		}
+	}
+
+	// Prepare the shared data
+	bench_FillIntervals();
+#ifdef _BINARY_LOG
+	eStatus = LOG_Start(BENCH_LOG_PATH, LOG_SEV_INFO, BENCH_LOG_CONTROL_PATH);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		(VOID)printf("log: cannot start %s\n", BENCH_LOG_PATH);
+		goto lblCleanup;
+	}
+	bIsLogStarted = TRUE;
+#endif	// _BINARY_LOG
+
+	// Run every benchmark, stopping at the first failed verification
+	for (dwRun = 0; dwRun < dwRuns; dwRun++)
+	{
+		for (dwIndex = 0; dwIndex < sizeof(s_apfnBenchmarks) / sizeof(s_apfnBenchmarks[0]); dwIndex++)
+		{
+			eStatus = s_apfnBenchmarks[dwIndex]();
+			if (RETSTATUS_FAILED(eStatus))
+			{
+				goto lblCleanup;
+			}
+		}
+	}
+
+	// Report
+	for (dwIndex = 0; dwIndex < g_dwResults; dwIndex++)
+	{
+		(VOID)printf("%-28s %12.1f %s\n", g_atResults[dwIndex].szName, g_atResults[dwIndex].dValue, g_atResults[dwIndex].pszUnit);
+	}
+	if (NULL != pszJsonPath)
+	{
+		eStatus = bench_WriteJson(pszJsonPath);
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			goto lblCleanup;
+		}
+	}
+	if (NULL != pszBaselinePath)
+	{
+		eStatus = bench_CheckBaseline(pszBaselinePath);
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			goto lblCleanup;
+		}
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+#ifdef _BINARY_LOG
+	if (bIsLogStarted)
+	{
+		LOG_Stop();
+		(VOID)remove(BENCH_LOG_PATH);
+	}
+#endif	// _BINARY_LOG
+
+	// Return result
+	return RETSTATUS_FAILED(eStatus) ? 1 : 0;
+}
@@ -0,0 +1,467 @@
+/********************************************************************************
+*  File:		Bus.c															*
+*  Purpose:		Shared-memory decision bus: a single monitor publishes lock		*
+*				decisions, and thin per-session agents carry them out (POSIX).	*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#endif	// _WIN32
+#include "Bus.h"
+#include <Clock.h>
+
+#ifndef _WIN32
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	BUS_TEMP_SUFFIX													*
+*  Purpose:		Appended to the bus path for the file created before the		*
+*				rename.															*
+********************************************************************************/
+#define BUS_TEMP_SUFFIX (".tmp")
+
+/********************************************************************************
+*  Constant:	BUS_FILE_MODE													*
+*  Purpose:		The bus file's permissions (agents run as the session users).	*
+********************************************************************************/
+#define BUS_FILE_MODE (0644)
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	bus_Futex														*
+*  Purpose:		Waits on, or wakes the waiters of, a futex.						*
+*  Parameters:	@ pnWord ~[in]~ The futex word.									*
+*				@ nOperation ~[in]~ FUTEX_WAIT or FUTEX_WAKE, possibly with		*
+*				FUTEX_PRIVATE_FLAG.												*
+*				@ nValue ~[in]~ The expected value (wait), or the number of		*
+*				waiters to wake.												*
+*				@ qwTimeoutNs ~[in]~ The longest wait, 0 for waking.			*
+********************************************************************************/
+static
+VOID
+bus_Futex(
+	__in volatile const LONG *pnWord,
+	__in INT nOperation,
+	__in LONG nValue,
+	__in ULONGLONG qwTimeoutNs
+)
+{
+	struct timespec tTimeout = { 0 };
+
+	tTimeout.tv_sec = (time_t)(qwTimeoutNs / NANOSECONDS_IN_SECOND);
+	tTimeout.tv_nsec = (long)(qwTimeoutNs % NANOSECONDS_IN_SECOND);
+
+	// Best-effort, callers check their condition again either way
+	(VOID)syscall(SYS_futex, pnWord, nOperation, nValue, (0 != qwTimeoutNs) ? &tTimeout : NULL, NULL, 0);
+}
+
+/********************************************************************************
+*  Function:	bus_MapFile														*
+*  Purpose:		Maps the current bus file read-only, if it is new.				*
+*  Parameters:	@ ptAgent ~[inout]~ The agent's side.							*
+*  Returns:		TRUE if a new file was mapped (the cursor starts at its			*
+*				latest decision).												*
+*  Remarks:		* The old mapping is kept if the file is missing, invalid or	*
+*					the same one.												*
+********************************************************************************/
+static
+BOOL
+bus_MapFile(
+	__inout PBUS_AGENT ptAgent
+)
+{
+	PCBUS_FILE ptFile = NULL;
+	PVOID pvMapping = MAP_FAILED;
+	struct stat tStat = { 0 };
+	INT nFile = -1;
+	BOOL bIsMapped = FALSE;
+
+	nFile = open(ptAgent->szPath, O_RDONLY | O_CLOEXEC);
+	if ((0 > nFile) || (0 != fstat(nFile, &tStat)))
+	{
+		goto lblCleanup;
+	}
+	if ((NULL != ptAgent->ptFile) &&
+		((ULONGLONG)(tStat.st_dev) == ptAgent->qwDevice) &&
+		((ULONGLONG)(tStat.st_ino) == ptAgent->qwInode))
+	{
+		goto lblCleanup;
+	}
+	if (sizeof(*ptFile) != (SIZE_T)(tStat.st_size))
+	{
+		DEBUG_MSG(LOG_SEV_ERROR, "'%s' is not a bus file.", ptAgent->szPath);
+		goto lblCleanup;
+	}
+	pvMapping = mmap(NULL, sizeof(*ptFile), PROT_READ, MAP_SHARED, nFile, 0);
+	if (MAP_FAILED == pvMapping)
+	{
+		DEBUG_MSG(LOG_SEV_ERROR, "mmap() failure (errno=%d).", errno);
+		goto lblCleanup;
+	}
+	ptFile = (PCBUS_FILE)pvMapping;
+	if ((0 != memcmp(ptFile->acMagic, BUS_FILE_MAGIC, sizeof(ptFile->acMagic))) ||
+		(BUS_FORMAT_VERSION != ptFile->dwFormatVersion) ||
+		(BUS_SLOTS != ptFile->dwSlots))
+	{
+		DEBUG_MSG(LOG_SEV_ERROR, "'%s' is not a bus file of this version.", ptAgent->szPath);
+		(VOID)munmap(pvMapping, sizeof(*ptFile));
+		goto lblCleanup;
+	}
+
+	// Swap it in, and start from its latest decision
+	if (NULL != ptAgent->ptFile)
+	{
+		(VOID)munmap((PVOID)(ptAgent->ptFile), sizeof(*(ptAgent->ptFile)));
+	}
+	ptAgent->ptFile = ptFile;
+	ptAgent->qwDevice = (ULONGLONG)(tStat.st_dev);
+	ptAgent->qwInode = (ULONGLONG)(tStat.st_ino);
+	ptAgent->nCursor = ATOMIC_LOAD_ACQUIRE(&(ptFile->nPublished));
+	ptAgent->qwAttaches++;
+	bIsMapped = TRUE;
+	DEBUG_MSG(LOG_SEV_INFO, "Attached to '%s' (%ld decisions so far).", ptAgent->szPath, (long)(ptAgent->nCursor));
+
+lblCleanup:
+
+	// Free resources (the mapping outlives the descriptor)
+	CLOSE_FD(nFile);
+
+	// Return result
+	return bIsMapped;
+}
+
+/********************************************************************************
+*  Function:	BUS_Create														*
+********************************************************************************/
+RETSTATUS
+BUS_Create(
+	__in_z PCSTR pszPath,
+	__out PBUS ptBus
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	CHAR szTempPath[MAX_PATH] = { 0 };
+	PBUS_FILE ptFile = NULL;
+	PVOID pvMapping = MAP_FAILED;
+	INT nFile = -1;
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != pszPath);
+	ASSERT(NULL != ptBus);
+
+	RtlZeroMemory(ptBus, sizeof(*ptBus));
+	if ((sizeof(ptBus->szPath) <= (SIZE_T)snprintf(ptBus->szPath, sizeof(ptBus->szPath), "%s", pszPath)) ||
+		(sizeof(szTempPath) <= (SIZE_T)snprintf(szTempPath, sizeof(szTempPath), "%s%s", pszPath, BUS_TEMP_SUFFIX)))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"Path too long ('%s').",
+			pszPath);
+		goto lblCleanup;
+	}
+
+	// Lay the file out next to the bus file (zeroed by ftruncate)
+	(VOID)remove(szTempPath);
+	nFile = open(szTempPath, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, BUS_FILE_MODE);
+	if (0 > nFile)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"Cannot create '%s' (errno=%d).",
+			szTempPath,
+			errno);
+		goto lblCleanup;
+	}
+	if ((0 != fchmod(nFile, BUS_FILE_MODE)) || (0 != ftruncate(nFile, sizeof(*ptFile))))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"Cannot size '%s' (errno=%d).",
+			szTempPath,
+			errno);
+		goto lblCleanup;
+	}
+	pvMapping = mmap(NULL, sizeof(*ptFile), PROT_READ | PROT_WRITE, MAP_SHARED, nFile, 0);
+	if (MAP_FAILED == pvMapping)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"mmap() failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+	ptFile = (PBUS_FILE)pvMapping;
+	RtlCopyMemory(ptFile->acMagic, BUS_FILE_MAGIC, sizeof(ptFile->acMagic));
+	ptFile->dwFormatVersion = BUS_FORMAT_VERSION;
+	ptFile->dwSlots = BUS_SLOTS;
+
+	// Then make it the bus file in one step
+	if (0 != rename(szTempPath, pszPath))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"rename() failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+	ptBus->ptFile = ptFile;
+	ptFile = NULL;
+	DEBUG_MSG(LOG_SEV_INFO, "Publishing decisions on '%s'.", pszPath);
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources (the mapping outlives the descriptor)
+	if (NULL != ptFile)
+	{
+		(VOID)munmap(ptFile, sizeof(*ptFile));
+		(VOID)remove(szTempPath);
+	}
+	CLOSE_FD(nFile);
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	BUS_Destroy														*
+********************************************************************************/
+VOID
+BUS_Destroy(
+	__inout PBUS ptBus
+)
+{
+	if (NULL == ptBus->ptFile)
+	{
+		return;
+	}
+
+	// Free resources
+	(VOID)remove(ptBus->szPath);
+	(VOID)munmap(ptBus->ptFile, sizeof(*(ptBus->ptFile)));
+	ptBus->ptFile = NULL;
+}
+
+/********************************************************************************
+*  Function:	BUS_Publish														*
+********************************************************************************/
+VOID
+BUS_Publish(
+	__inout PBUS ptBus,
+	__in ULONGLONG qwEventTimestamp,
+	__in ULONGLONG qwDeviceId
+)
+{
+	PBUS_FILE ptFile = ptBus->ptFile;
+	LONG nPublished = ptFile->nPublished;
+	PBUS_DECISION ptSlot = &(ptFile->atSlots[(ULONG)nPublished & (BUS_SLOTS - 1)]);
+
+	// Invalidate the slot, fill it, then number it (readers check the number on both sides)
+	ATOMIC_STORE_RELEASE(&(ptSlot->nSequence), 0);
+	ATOMIC_FULL_BARRIER();
+	ptSlot->dwFlags = 0;
+	ptSlot->qwEventTimestamp = qwEventTimestamp;
+	ptSlot->qwDeviceId = qwDeviceId;
+	ptSlot->qwPublishedTimestamp = CLOCK_GetTimestamp();
+	ATOMIC_STORE_RELEASE(&(ptSlot->nSequence), nPublished + 1);
+
+	// Publish, and wake every agent at once
+	ATOMIC_STORE_RELEASE(&(ptFile->nPublished), nPublished + 1);
+	bus_Futex(&(ptFile->nPublished), FUTEX_WAKE, INT_MAX, 0);
+}
+
+/********************************************************************************
+*  Function:	BUS_GetPublished												*
+********************************************************************************/
+ULONGLONG
+BUS_GetPublished(
+	__in const BUS *ptBus
+)
+{
+	if (NULL == ptBus->ptFile)
+	{
+		return 0;
+	}
+	return (ULONG)ATOMIC_LOAD_ACQUIRE(&(ptBus->ptFile->nPublished));
+}
+
+/********************************************************************************
+*  Function:	BUS_Attach														*
+********************************************************************************/
+RETSTATUS
+BUS_Attach(
+	__in_z PCSTR pszPath,
+	__out PBUS_AGENT ptAgent
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != pszPath);
+	ASSERT(NULL != ptAgent);
+
+	RtlZeroMemory(ptAgent, sizeof(*ptAgent));
+	if (sizeof(ptAgent->szPath) <= (SIZE_T)snprintf(ptAgent->szPath, sizeof(ptAgent->szPath), "%s", pszPath))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"Path too long ('%s').",
+			pszPath);
+		goto lblCleanup;
+	}
+
+	// Map it if it is there already
+	if (!bus_MapFile(ptAgent))
+	{
+		DEBUG_MSG(LOG_SEV_INFO, "No bus at '%s' yet, waiting for the monitor.", pszPath);
+	}
+	ptAgent->qwRecheck = CLOCK_GetTimestamp() + (BUS_RECHECK_MS * NANOSECONDS_IN_MILLISECOND);
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	BUS_Detach														*
+********************************************************************************/
+VOID
+BUS_Detach(
+	__inout PBUS_AGENT ptAgent
+)
+{
+	if (NULL == ptAgent->ptFile)
+	{
+		return;
+	}
+
+	// Free resources
+	(VOID)munmap((PVOID)(ptAgent->ptFile), sizeof(*(ptAgent->ptFile)));
+	ptAgent->ptFile = NULL;
+}
+
+/********************************************************************************
+*  Function:	BUS_Receive														*
+********************************************************************************/
+BOOL
+BUS_Receive(
+	__inout PBUS_AGENT ptAgent,
+	__out PBUS_DECISION ptDecision
+)
+{
+	PCBUS_FILE ptFile = NULL;
+	PCBUS_DECISION ptSlot = NULL;
+	LONG nPublished = 0;
+	LONG nSequence = 0;
+	ULONGLONG qwNow = 0;
+
+	RtlZeroMemory(ptDecision, sizeof(*ptDecision));
+	while (!ATOMIC_LOAD_ACQUIRE(&(ptAgent->nIsStopped)))
+	{
+		ptFile = ptAgent->ptFile;
+		nPublished = (NULL != ptFile) ? ATOMIC_LOAD_ACQUIRE(&(ptFile->nPublished)) : ptAgent->nCursor;
+		if (nPublished != ptAgent->nCursor)
+		{
+			// Copy the next decision, unless it was overwritten before or while copying it
+			ptSlot = &(ptFile->atSlots[(ULONG)(ptAgent->nCursor) & (BUS_SLOTS - 1)]);
+			nSequence = ATOMIC_LOAD_ACQUIRE(&(ptSlot->nSequence));
+			ptDecision->qwEventTimestamp = ptSlot->qwEventTimestamp;
+			ptDecision->qwPublishedTimestamp = ptSlot->qwPublishedTimestamp;
+			ptDecision->qwDeviceId = ptSlot->qwDeviceId;
+			ATOMIC_FULL_BARRIER();
+			if ((BUS_SLOTS < (ULONG)(nPublished - ptAgent->nCursor)) ||
+				(ptAgent->nCursor + 1 != nSequence) ||
+				(nSequence != ATOMIC_LOAD_ACQUIRE(&(ptSlot->nSequence))))
+			{
+				RtlZeroMemory(ptDecision, sizeof(*ptDecision));
+				ptDecision->dwFlags = BUS_FLAG_OVERRUN;
+				ptDecision->nSequence = nPublished;
+				ptAgent->nCursor = nPublished;
+				ptAgent->qwOverruns++;
+				return TRUE;
+			}
+			ptDecision->nSequence = nSequence;
+			ptAgent->nCursor++;
+			ptAgent->qwReceived++;
+			return TRUE;
+		}
+
+		// Look for a new monitor now and then, sleep otherwise
+		qwNow = CLOCK_GetTimestamp();
+		if (qwNow >= ptAgent->qwRecheck)
+		{
+			(VOID)bus_MapFile(ptAgent);
+			ptAgent->qwRecheck = qwNow + (BUS_RECHECK_MS * NANOSECONDS_IN_MILLISECOND);
+			continue;
+		}
+		if (NULL != ptFile)
+		{
+			bus_Futex(&(ptFile->nPublished), FUTEX_WAIT, nPublished, ptAgent->qwRecheck - qwNow);
+		}
+		else
+		{
+			bus_Futex(&(ptAgent->nIsStopped), FUTEX_WAIT | FUTEX_PRIVATE_FLAG, 0, ptAgent->qwRecheck - qwNow);
+		}
+	}
+
+	// Return result
+	return FALSE;
+}
+
+/********************************************************************************
+*  Function:	BUS_StopAgent													*
+********************************************************************************/
+VOID
+BUS_StopAgent(
+	__inout PBUS_AGENT ptAgent
+)
+{
+	PCBUS_FILE ptFile = ptAgent->ptFile;
+
+	ATOMIC_STORE_RELEASE(&(ptAgent->nIsStopped), TRUE);
+	bus_Futex(&(ptAgent->nIsStopped), FUTEX_WAKE | FUTEX_PRIVATE_FLAG, INT_MAX, 0);
+	if (NULL != ptFile)
+	{
+		bus_Futex(&(ptFile->nPublished), FUTEX_WAKE, INT_MAX, 0);
+	}
+}
+
+/********************************************************************************
+*  Function:	BUS_GetAgentStats												*
+********************************************************************************/
+VOID
+BUS_GetAgentStats(
+	__in const BUS_AGENT *ptAgent,
+	__out PBUS_AGENT_STATS ptStats
+)
+{
+	ptStats->bIsAttached = (NULL != ptAgent->ptFile);
+	ptStats->qwReceived = ptAgent->qwReceived;
+	ptStats->qwOverruns = ptAgent->qwOverruns;
+	ptStats->qwAttaches = ptAgent->qwAttaches;
+}
+
+#endif	// _WIN32
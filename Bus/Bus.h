@@ -0,0 +1,280 @@
+/********************************************************************************
+*  File:		Bus.h															*
+*  Purpose:		Shared-memory decision bus: a single monitor publishes lock		*
+*				decisions, and thin per-session agents carry them out (POSIX).	*
+********************************************************************************/
+#pragma once
+
+
+/** Includes *******************************************************************/
+#include <Utilities.h>
+
+#ifndef _WIN32
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	BUS_DEFAULT_PATH												*
+*  Purpose:		The default bus file, in the working directory.					*
+********************************************************************************/
+#define BUS_DEFAULT_PATH ("AntiDuck.bus")
+
+/********************************************************************************
+*  Constant:	BUS_FILE_MAGIC													*
+*  Purpose:		The bus file signature (8 characters).							*
+********************************************************************************/
+#define BUS_FILE_MAGIC ("ADDECBUS")
+
+/********************************************************************************
+*  Constant:	BUS_FORMAT_VERSION												*
+*  Purpose:		The bus file format version. Files of any other version are		*
+*				rejected.														*
+********************************************************************************/
+#define BUS_FORMAT_VERSION (1)
+
+/********************************************************************************
+*  Constant:	BUS_SLOTS														*
+*  Purpose:		Decisions kept in the ring (a power of two). An agent that		*
+*				falls further behind has missed some.							*
+********************************************************************************/
+#define BUS_SLOTS (256)
+
+/********************************************************************************
+*  Constant:	BUS_RECHECK_MS													*
+*  Purpose:		How often an idle agent checks whether the monitor replaced		*
+*				(restarted) or created the bus file.							*
+********************************************************************************/
+#define BUS_RECHECK_MS (1000)
+
+/********************************************************************************
+*  Constant:	BUS_FLAG_OVERRUN												*
+*  Purpose:		Set on a received decision that stands for decisions the agent	*
+*				missed (it fell BUS_SLOTS behind), its other fields are 0.		*
+********************************************************************************/
+#define BUS_FLAG_OVERRUN (0x00000001UL)
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Structure:	BUS_DECISION													*
+*  Purpose:		A lock decision, as published.									*
+*  Remarks:		* The sequence is 0 while the monitor writes the slot, so a		*
+*					reader that sees the same sequence before and after			*
+*					copying it has a whole decision (a seqlock).				*
+********************************************************************************/
+typedef struct _BUS_DECISION
+{
+	volatile LONG nSequence;						// Decision number, from 1 (0 while written)
+	DWORD dwFlags;									// BUS_FLAG_* (received copies only)
+	ULONGLONG qwEventTimestamp;						// Receipt of the event that called for it
+	ULONGLONG qwPublishedTimestamp;					// When it was published
+	ULONGLONG qwDeviceId;							// Source-specific device ID of that event
+} BUS_DECISION, *PBUS_DECISION;
+typedef const BUS_DECISION *PCBUS_DECISION;
+
+/********************************************************************************
+*  Structure:	BUS_FILE														*
+*  Purpose:		The bus file, shared by the monitor (read-write) and the		*
+*				agents (read-only).												*
+*  Remarks:		* Used in place, so it is laid out for the native ABI only.		*
+*				* Agents never write it: each keeps its own cursor, so a		*
+*					stuck or hostile agent cannot hold back the monitor or		*
+*					the other sessions.											*
+*				* nPublished is also the futex agents sleep on.					*
+********************************************************************************/
+typedef struct _BUS_FILE
+{
+	CHAR acMagic[8];								// BUS_FILE_MAGIC
+	DWORD dwFormatVersion;							// BUS_FORMAT_VERSION
+	DWORD dwSlots;									// BUS_SLOTS
+	BYTE abPadding[CACHE_LINE_SIZE];				// Keeps the constants off the counter's line
+	volatile LONG nPublished;						// Decisions published so far
+	BYTE abCounterPadding[CACHE_LINE_SIZE];			// Keeps the ring off the counter's line
+	BUS_DECISION atSlots[BUS_SLOTS];				// The ring, decision N in slot (N - 1) % BUS_SLOTS
+} BUS_FILE, *PBUS_FILE;
+typedef const BUS_FILE *PCBUS_FILE;
+
+/********************************************************************************
+*  Structure:	BUS																*
+*  Purpose:		The monitor's side of the bus.									*
+*  Remarks:		* Only published to from a single thread.						*
+********************************************************************************/
+typedef struct _BUS
+{
+	PBUS_FILE ptFile;								// The mapping, or NULL
+	CHAR szPath[MAX_PATH];							// The bus file
+} BUS, *PBUS;
+
+/********************************************************************************
+*  Structure:	BUS_AGENT														*
+*  Purpose:		An agent's side of the bus: its own mapping and cursor.			*
+*  Remarks:		* Only received from on a single thread. The counters may be	*
+*					read from any thread, see BUS_GetAgentStats.				*
+********************************************************************************/
+typedef struct _BUS_AGENT
+{
+	PCBUS_FILE ptFile;								// The mapping, or NULL while detached
+	ULONGLONG qwDevice;								// The mapped file's device
+	ULONGLONG qwInode;								// The mapped file's inode
+	LONG nCursor;									// Decisions received or skipped so far
+	ULONGLONG qwRecheck;							// When to check the file next
+	volatile LONG nIsStopped;						// Set by BUS_StopAgent
+	volatile ULONGLONG qwReceived;					// Decisions received
+	volatile ULONGLONG qwOverruns;					// Times decisions were missed
+	volatile ULONGLONG qwAttaches;					// Bus files mapped (monitor restarts + 1)
+	CHAR szPath[MAX_PATH];							// The bus file
+} BUS_AGENT, *PBUS_AGENT;
+
+/********************************************************************************
+*  Structure:	BUS_AGENT_STATS													*
+*  Purpose:		A snapshot of an agent's counters.								*
+********************************************************************************/
+typedef struct _BUS_AGENT_STATS
+{
+	BOOL bIsAttached;								// Whether a bus file is mapped
+	ULONGLONG qwReceived;							// Decisions received
+	ULONGLONG qwOverruns;							// Times decisions were missed
+	ULONGLONG qwAttaches;							// Bus files mapped
+} BUS_AGENT_STATS, *PBUS_AGENT_STATS;
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	BUS_Create														*
+*  Purpose:		Creates (or replaces) the bus file and maps it for				*
+*				publishing.														*
+*  Parameters:	@ pszPath ~[in]~ The file.										*
+*				@ ptBus ~[out]~ Gets the bus.									*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Writes a temporary file next to it and renames it over the	*
+*					file, so agents never map a partial file, and agents of a	*
+*					previous monitor move over on their next recheck.			*
+*				* The file is readable by every user, and writable by none		*
+*					but the caller.												*
+*				* Free with BUS_Destroy.										*
+********************************************************************************/
+RETSTATUS
+BUS_Create(
+	__in_z PCSTR pszPath,
+	__out PBUS ptBus
+);
+
+/********************************************************************************
+*  Function:	BUS_Destroy														*
+*  Purpose:		Unmaps and removes the bus file.								*
+*  Parameters:	@ ptBus ~[inout]~ The bus, after BUS_Create (even a failed		*
+*				one).															*
+*  Remarks:		* Agents keep their mapping, and wait for the next monitor.		*
+********************************************************************************/
+VOID
+BUS_Destroy(
+	__inout PBUS ptBus
+);
+
+/********************************************************************************
+*  Function:	BUS_Publish														*
+*  Purpose:		Publishes a lock decision and wakes every waiting agent.		*
+*  Parameters:	@ ptBus ~[inout]~ The bus.										*
+*				@ qwEventTimestamp ~[in]~ Receipt of the event that called for	*
+*				it.																*
+*				@ qwDeviceId ~[in]~ Its device ID.								*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+*				* Never waits for agents: the oldest decision is overwritten,	*
+*					and agents that had not read it yet find out.				*
+*				* A single futex wake reaches every agent, whatever their		*
+*					number.														*
+********************************************************************************/
+VOID
+BUS_Publish(
+	__inout PBUS ptBus,
+	__in ULONGLONG qwEventTimestamp,
+	__in ULONGLONG qwDeviceId
+);
+
+/********************************************************************************
+*  Function:	BUS_GetPublished												*
+*  Purpose:		Gets the number of decisions published.							*
+*  Parameters:	@ ptBus ~[in]~ The bus.											*
+*  Returns:		The number of decisions.										*
+*  Remarks:		* May be called from any thread.								*
+********************************************************************************/
+ULONGLONG
+BUS_GetPublished(
+	__in const BUS *ptBus
+);
+
+/********************************************************************************
+*  Function:	BUS_Attach														*
+*  Purpose:		Maps the bus file read-only, as an agent.						*
+*  Parameters:	@ pszPath ~[in]~ The file (need not exist yet).					*
+*				@ ptAgent ~[out]~ Gets the agent's side.						*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Only decisions published from now on are received.			*
+*				* A missing or invalid file leaves the agent detached until		*
+*					a valid one appears (see BUS_RECHECK_MS).					*
+*				* Free with BUS_Detach.											*
+********************************************************************************/
+RETSTATUS
+BUS_Attach(
+	__in_z PCSTR pszPath,
+	__out PBUS_AGENT ptAgent
+);
+
+/********************************************************************************
+*  Function:	BUS_Detach														*
+*  Purpose:		Unmaps the bus file.											*
+*  Parameters:	@ ptAgent ~[inout]~ The agent's side.							*
+********************************************************************************/
+VOID
+BUS_Detach(
+	__inout PBUS_AGENT ptAgent
+);
+
+/********************************************************************************
+*  Function:	BUS_Receive														*
+*  Purpose:		Gets the next decision, waiting for one if there is none.		*
+*  Parameters:	@ ptAgent ~[inout]~ The agent's side.							*
+*				@ ptDecision ~[out]~ Gets the decision.							*
+*  Returns:		TRUE with a decision, FALSE once stopped.						*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+*				* Sleeps on the bus file's futex, so an idle agent costs no		*
+*					CPU but its recheck once per BUS_RECHECK_MS.				*
+*				* An agent that fell behind gets a single BUS_FLAG_OVERRUN		*
+*					decision for everything it missed, then resumes with the	*
+*					next one published.											*
+********************************************************************************/
+BOOL
+BUS_Receive(
+	__inout PBUS_AGENT ptAgent,
+	__out PBUS_DECISION ptDecision
+);
+
+/********************************************************************************
+*  Function:	BUS_StopAgent													*
+*  Purpose:		Makes BUS_Receive return FALSE.									*
+*  Parameters:	@ ptAgent ~[inout]~ The agent's side.							*
+*  Remarks:		* May be called from any thread, or a signal handler.			*
+*				* Other agents of the same bus wake up too, and go back to		*
+*					sleep.														*
+********************************************************************************/
+VOID
+BUS_StopAgent(
+	__inout PBUS_AGENT ptAgent
+);
+
+/********************************************************************************
+*  Function:	BUS_GetAgentStats												*
+*  Purpose:		Gets an agent's counters.										*
+*  Parameters:	@ ptAgent ~[in]~ The agent's side.								*
+*				@ ptStats ~[out]~ Gets the counters.							*
+*  Remarks:		* May be called from any thread.								*
+********************************************************************************/
+VOID
+BUS_GetAgentStats(
+	__in const BUS_AGENT *ptAgent,
+	__out PBUS_AGENT_STATS ptStats
+);
+
+#endif	// _WIN32
@@ -0,0 +1,379 @@
+/********************************************************************************
+*  File:		Cadence.c														*
+*  Purpose:		Per-device keystroke cadence detector.							*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#include "Cadence.h"
+#include <Clock.h>
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	cadence_HashDeviceId											*
+*  Purpose:		Hashes a device ID to a home slot.								*
+*  Parameters:	@ qwDeviceId ~[in]~ The device ID.								*
+*  Returns:		The slot index.													*
+*  Remarks:		* Device IDs are often pointers, so the low bits are mixed in	*
+*					from the high bits (Fibonacci hashing).						*
+********************************************************************************/
+static
+__inline
+DWORD
+cadence_HashDeviceId(
+	__in ULONGLONG qwDeviceId
+)
+{
+	return (DWORD)((qwDeviceId * 0x9E3779B97F4A7C15ULL) >> 32) & (CADENCE_TABLE_SLOTS - 1);
+}
+
+/********************************************************************************
+*  Function:	cadence_RemoveSlot												*
+*  Purpose:		Frees a slot and its detector, keeping probe chains intact.		*
+*  Parameters:	@ ptTable ~[inout]~ The table.									*
+*				@ dwSlot ~[in]~ The occupied slot to free.						*
+*  Remarks:		* Uses backward-shift deletion, so no tombstones are needed.	*
+********************************************************************************/
+static
+VOID
+cadence_RemoveSlot(
+	__inout PCADENCE_TABLE ptTable,
+	__in DWORD dwSlot
+)
+{
+	DWORD dwNext = 0;
+	DWORD dwHome = 0;
+
+	// Free the detector
+	FREE_POOLED(&(ptTable->tDetectors), ptTable->atSlots[dwSlot].ptDetector, sizeof(CADENCE_DETECTOR));
+	ptTable->dwDevices--;
+
+	// Shift back every following entry that may not be reachable anymore
+	for (dwNext = (dwSlot + 1) & (CADENCE_TABLE_SLOTS - 1);
+		NULL != ptTable->atSlots[dwNext].ptDetector;
+		dwNext = (dwNext + 1) & (CADENCE_TABLE_SLOTS - 1))
+	{
+		// Move it if the freed slot lies cyclically between its home and its position
+		dwHome = cadence_HashDeviceId(ptTable->atSlots[dwNext].qwDeviceId);
+		if (((dwNext - dwHome) & (CADENCE_TABLE_SLOTS - 1)) >= ((dwNext - dwSlot) & (CADENCE_TABLE_SLOTS - 1)))
+		{
+			ptTable->atSlots[dwSlot] = ptTable->atSlots[dwNext];
+			ptTable->atSlots[dwNext].ptDetector = NULL;
+			dwSlot = dwNext;
+		}
+	}
+}
+
+/********************************************************************************
+*  Function:	cadence_EvictIdlest												*
+*  Purpose:		Frees the detector of the least recently active device.			*
+*  Parameters:	@ ptTable ~[inout]~ The (full) table.							*
+*  Remarks:		* Only runs when a new device shows up on a full table.			*
+********************************************************************************/
+static
+VOID
+cadence_EvictIdlest(
+	__inout PCADENCE_TABLE ptTable
+)
+{
+	DWORD dwSlot = 0;
+	DWORD dwIdlest = 0;
+	ULONGLONG qwIdlestTimestamp = (ULONGLONG)-1;
+
+	// Find the idlest device
+	for (dwSlot = 0; dwSlot < CADENCE_TABLE_SLOTS; dwSlot++)
+	{
+		if ((NULL != ptTable->atSlots[dwSlot].ptDetector) &&
+			(ptTable->atSlots[dwSlot].ptDetector->qwLastKeyTimestamp < qwIdlestTimestamp))
+		{
+			qwIdlestTimestamp = ptTable->atSlots[dwSlot].ptDetector->qwLastKeyTimestamp;
+			dwIdlest = dwSlot;
+		}
+	}
+
+	// Evict it
+	DEBUG_MSG(LOG_SEV_INFO, "Evicting device 0x%llx.", ptTable->atSlots[dwIdlest].qwDeviceId);
+	cadence_RemoveSlot(ptTable, dwIdlest);
+}
+
+/********************************************************************************
+*  Function:	cadence_Lookup													*
+*  Purpose:		Gets the detector of a device, creating it on first sight.		*
+*  Parameters:	@ ptTable ~[inout]~ The table.									*
+*				@ qwDeviceId ~[in]~ The device ID.								*
+*  Returns:		The detector, or NULL on allocation failure.					*
+********************************************************************************/
+static
+PCADENCE_DETECTOR
+cadence_Lookup(
+	__inout PCADENCE_TABLE ptTable,
+	__in ULONGLONG qwDeviceId
+)
+{
+	PCADENCE_DETECTOR ptDetector = NULL;
+	DWORD dwSlot = 0;
+
+	// Probe for the device, stopping at the first free slot
+	for (dwSlot = cadence_HashDeviceId(qwDeviceId);
+		NULL != ptTable->atSlots[dwSlot].ptDetector;
+		dwSlot = (dwSlot + 1) & (CADENCE_TABLE_SLOTS - 1))
+	{
+		if (qwDeviceId == ptTable->atSlots[dwSlot].qwDeviceId)
+		{
+			ptDetector = ptTable->atSlots[dwSlot].ptDetector;
+			goto lblCleanup;
+		}
+	}
+
+	// First sight, make room if needed (eviction may shift entries, so probe again)
+	if (CADENCE_MAX_DEVICES <= ptTable->dwDevices)
+	{
+		cadence_EvictIdlest(ptTable);
+		for (dwSlot = cadence_HashDeviceId(qwDeviceId);
+			NULL != ptTable->atSlots[dwSlot].ptDetector;
+			dwSlot = (dwSlot + 1) & (CADENCE_TABLE_SLOTS - 1))
+		{
+		}
+	}
+
+	// Allocate the detector, reusing an evicted one's block
+	ptDetector = (PCADENCE_DETECTOR)ALLOCZ_POOLED(&(ptTable->tDetectors), sizeof(*ptDetector));
+	if (NULL == ptDetector)
+	{
+		DEBUG_MSG(LOG_SEV_ERROR, "ALLOCZ_POOLED() failure.");
+		goto lblCleanup;
+	}
+	ptTable->atSlots[dwSlot].qwDeviceId = qwDeviceId;
+	ptTable->atSlots[dwSlot].ptDetector = ptDetector;
+	ptTable->dwDevices++;
+
+lblCleanup:
+
+	// Return result
+	return ptDetector;
+}
+
+/********************************************************************************
+*  Function:	cadence_ResetWindow												*
+*  Purpose:		Clears the interval window of a detector.						*
+*  Parameters:	@ ptDetector ~[inout]~ The detector.							*
+********************************************************************************/
+static
+__inline
+VOID
+cadence_ResetWindow(
+	__inout PCADENCE_DETECTOR ptDetector
+)
+{
+	ptDetector->dwNext = 0;
+	ptDetector->dwCount = 0;
+	ptDetector->bIsHuman = FALSE;
+	ptDetector->wHolds = 0;
+	ptDetector->wShortHolds = 0;
+}
+
+/********************************************************************************
+*  Function:	cadence_AddInterval												*
+*  Purpose:		Pushes an interval into the ring.								*
+*  Parameters:	@ ptDetector ~[inout]~ The detector.							*
+*				@ dwIntervalUs ~[in]~ The interval.								*
+********************************************************************************/
+static
+__inline
+VOID
+cadence_AddInterval(
+	__inout PCADENCE_DETECTOR ptDetector,
+	__in DWORD dwIntervalUs
+)
+{
+	// Push, overwriting the oldest interval once the ring is full
+	ptDetector->adwIntervalsUs[ptDetector->dwNext] = dwIntervalUs;
+	ptDetector->dwNext = (ptDetector->dwNext + 1) & (CADENCE_WINDOW_INTERVALS - 1);
+	if (CADENCE_WINDOW_INTERVALS != ptDetector->dwCount)
+	{
+		ptDetector->dwCount++;
+	}
+}
+
+/********************************************************************************
+*  Function:	cadence_AddHold													*
+*  Purpose:		Counts a key hold, and learns it if typing is human.			*
+*  Parameters:	@ ptProfile ~[inout]~ The profile.								*
+*				@ ptDetector ~[inout]~ The detector.							*
+*				@ dwHoldUs ~[in]~ The hold.										*
+********************************************************************************/
+static
+__inline
+VOID
+cadence_AddHold(
+	__inout PCADENCE_PROFILE ptProfile,
+	__inout PCADENCE_DETECTOR ptDetector,
+	__in DWORD dwHoldUs
+)
+{
+	// Halve the counts once full, so they follow the recent keys
+	if (CADENCE_WINDOW_INTERVALS == ptDetector->wHolds)
+	{
+		ptDetector->wHolds /= 2;
+		ptDetector->wShortHolds /= 2;
+	}
+	ptDetector->wHolds++;
+	if (dwHoldUs < ptProfile->dwShortHoldUs)
+	{
+		ptDetector->wShortHolds++;
+	}
+
+	// Only learn from typing scored human, so injections cannot teach
+	if (ptDetector->bIsHuman)
+	{
+		CADENCE_LearnHold(ptProfile, dwHoldUs);
+	}
+}
+
+/********************************************************************************
+*  Function:	CADENCE_Finalize												*
+********************************************************************************/
+VOID
+CADENCE_Finalize(
+	__inout PCADENCE_TABLE ptTable
+)
+{
+	DWORD dwSlot = 0;
+
+	// Validations
+	ASSERT(NULL != ptTable);
+
+	// Free all detectors
+	for (dwSlot = 0; dwSlot < CADENCE_TABLE_SLOTS; dwSlot++)
+	{
+		FREE_POOLED(&(ptTable->tDetectors), ptTable->atSlots[dwSlot].ptDetector, sizeof(CADENCE_DETECTOR));
+	}
+	ptTable->dwDevices = 0;
+	POOL_FinalizeClasses(&(ptTable->tDetectors));
+}
+
+/********************************************************************************
+*  Function:	CADENCE_OnKey													*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+********************************************************************************/
+CADENCE_VERDICT
+CADENCE_OnKey(
+	__inout PCADENCE_TABLE ptTable,
+	__in ULONGLONG qwDeviceId,
+	__in ULONGLONG qwTimestamp,
+	__in WORD wScanCode,
+	__in BOOLEAN bIsKeyDown,
+	__out_opt PCADENCE_SCORE ptScore
+)
+{
+	CADENCE_VERDICT eVerdict = CADENCE_VERDICT_PENDING;
+	PCADENCE_DETECTOR ptDetector = NULL;
+	ULONGLONG qwIntervalUs = 0;
+	CADENCE_STATS tStats = { 0 };
+	CADENCE_SCORE tScore = { 0 };
+
+	// Validations
+	ASSERT(NULL != ptTable);
+
+	// Get the device's detector
+	ptDetector = cadence_Lookup(ptTable, qwDeviceId);
+	if (NULL == ptDetector)
+	{
+		goto lblCleanup;
+	}
+
+	// Releases only end auto-repeat, and time the hold
+	if (!bIsKeyDown)
+	{
+		if ((ptDetector->bIsKeyHeld) && (wScanCode == ptDetector->wHeldScanCode))
+		{
+			ptDetector->bIsKeyHeld = FALSE;
+			cadence_AddHold(&(ptTable->tProfile),
+				ptDetector,
+				(DWORD)((qwTimestamp - ptDetector->qwLastKeyTimestamp) / NANOSECONDS_IN_MICROSECOND));
+		}
+		goto lblCleanup;
+	}
+
+	// Auto-repeat is perfectly regular, but it is not typing
+	if ((ptDetector->bIsKeyHeld) && (wScanCode == ptDetector->wHeldScanCode))
+	{
+		goto lblCleanup;
+	}
+	ptDetector->wHeldScanCode = wScanCode;
+	ptDetector->bIsKeyHeld = TRUE;
+
+	// Measure the interval, a long pause starts a new burst
+	if (0 != ptDetector->qwLastKeyTimestamp)
+	{
+		qwIntervalUs = (qwTimestamp - ptDetector->qwLastKeyTimestamp) / NANOSECONDS_IN_MICROSECOND;
+		if (CADENCE_IDLE_RESET_US < qwIntervalUs)
+		{
+			cadence_ResetWindow(ptDetector);
+		}
+		else
+		{
+			cadence_AddInterval(ptDetector, (DWORD)qwIntervalUs);
+		}
+	}
+	ptDetector->qwLastKeyTimestamp = qwTimestamp;
+
+	// Only a full window is scored
+	if (CADENCE_WINDOW_INTERVALS != ptDetector->dwCount)
+	{
+		goto lblCleanup;
+	}
+
+	// Score the ring in place
+	CADENCE_ScoreIntervals(ptDetector->adwIntervalsUs, CADENCE_WINDOW_INTERVALS, CADENCE_FAST_INTERVAL_US, &tStats);
+
+	// Var(X) = E[X^2] - E[X]^2, computed exactly as (N * sum(X^2) - sum(X)^2) / N^2
+	tScore.qwMeanUs = tStats.qwSumUs / CADENCE_WINDOW_INTERVALS;
+	tScore.qwVarianceUs2 = ((CADENCE_WINDOW_INTERVALS * tStats.qwSumSquaresUs2) - (tStats.qwSumUs * tStats.qwSumUs)) /
+		(CADENCE_WINDOW_INTERVALS * CADENCE_WINDOW_INTERVALS);
+	tScore.dwMinUs = tStats.dwMinUs;
+	tScore.dwFastPermille = (tStats.dwFastCount * 1000) / CADENCE_WINDOW_INTERVALS;
+
+	// Superhuman and steady, or mostly faster than any human
+	if (((CADENCE_MAX_MEAN_US >= tScore.qwMeanUs) &&
+		((ULONGLONG)CADENCE_MAX_STDDEV_US * CADENCE_MAX_STDDEV_US >= tScore.qwVarianceUs2)) ||
+		(CADENCE_MAX_FAST_PERMILLE <= tScore.dwFastPermille))
+	{
+		eVerdict = CADENCE_VERDICT_INJECTION;
+	}
+
+	// Far steadier than the user, or mostly holds far shorter than theirs (once learned)
+	else if (((0 != ptTable->tProfile.dwSteadyStddevUs) &&
+		((ULONGLONG)ptTable->tProfile.dwSteadyStddevUs * ptTable->tProfile.dwSteadyStddevUs >= tScore.qwVarianceUs2)) ||
+		((CADENCE_WINDOW_INTERVALS / 2 <= ptDetector->wHolds) &&
+		((DWORD)ptDetector->wShortHolds * 1000 >= (DWORD)ptDetector->wHolds * CADENCE_MAX_FAST_PERMILLE)))
+	{
+		eVerdict = CADENCE_VERDICT_INJECTION;
+	}
+	else
+	{
+		eVerdict = CADENCE_VERDICT_HUMAN;
+	}
+
+	// Learn each interval of human typing once, as it enters the window
+	if (CADENCE_VERDICT_HUMAN == eVerdict)
+	{
+		ptDetector->bIsHuman = TRUE;
+		CADENCE_LearnInterval(&(ptTable->tProfile), (DWORD)qwIntervalUs);
+	}
+	else
+	{
+		cadence_ResetWindow(ptDetector);
+	}
+	if (NULL != ptScore)
+	{
+		*ptScore = tScore;
+	}
+
+lblCleanup:
+
+	// Return result
+	return eVerdict;
+}
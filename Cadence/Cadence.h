@@ -0,0 +1,408 @@
+/********************************************************************************
+*  File:		Cadence.h														*
+*  Purpose:		Per-device keystroke cadence detector.							*
+********************************************************************************/
+#pragma once
+
+
+/** Includes *******************************************************************/
+#include <Utilities.h>
+#include "../Pool/Pool.h"
+#include "../Sketch/Sketch.h"
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	CADENCE_WINDOW_INTERVALS										*
+*  Purpose:		Number of inter-key intervals scored per device.				*
+*  Remarks:		* Must be a power of 2.											*
+********************************************************************************/
+#define CADENCE_WINDOW_INTERVALS (32)
+
+/********************************************************************************
+*  Constant:	CADENCE_MAX_DEVICES												*
+*  Purpose:		Maximal number of tracked devices. When exceeded, the least		*
+*				recently active device is evicted.								*
+********************************************************************************/
+#define CADENCE_MAX_DEVICES (32)
+
+/********************************************************************************
+*  Constant:	CADENCE_TABLE_SLOTS												*
+*  Purpose:		Number of hash table slots (kept at 50% load at most).			*
+*  Remarks:		* Must be a power of 2.											*
+********************************************************************************/
+#define CADENCE_TABLE_SLOTS (CADENCE_MAX_DEVICES * 2)
+
+/********************************************************************************
+*  Constant:	CADENCE_IDLE_RESET_US											*
+*  Purpose:		A gap (in microseconds) after which a new burst begins and the	*
+*				window is cleared.												*
+********************************************************************************/
+#define CADENCE_IDLE_RESET_US (500000)
+
+/********************************************************************************
+*  Constant:	CADENCE_MAX_MEAN_US												*
+*  Purpose:		Mean interval (in microseconds) at or below which typing is		*
+*				superhuman (100 keys per second).								*
+********************************************************************************/
+#define CADENCE_MAX_MEAN_US (10000)
+
+/********************************************************************************
+*  Constant:	CADENCE_MAX_STDDEV_US											*
+*  Purpose:		Interval standard deviation (in microseconds) at or below which	*
+*				superhuman typing is considered machine generated.				*
+********************************************************************************/
+#define CADENCE_MAX_STDDEV_US (2000)
+
+/********************************************************************************
+*  Constant:	CADENCE_FAST_INTERVAL_US										*
+*  Purpose:		An interval (in microseconds) below which a keystroke is faster	*
+*				than any sustained human typing.								*
+********************************************************************************/
+#define CADENCE_FAST_INTERVAL_US (5000)
+
+/********************************************************************************
+*  Constant:	CADENCE_MAX_FAST_PERMILLE										*
+*  Purpose:		Fraction (in permille) of fast intervals at or above which a	*
+*				window is machine generated, regardless of its variance.		*
+********************************************************************************/
+#define CADENCE_MAX_FAST_PERMILLE (900)
+
+/********************************************************************************
+*  Constant:	CADENCE_PROFILE_UNIT_US											*
+*  Purpose:		The unit (in microseconds) of the values a typing profile		*
+*				learns, so the longest interval fits in a sketch item.			*
+********************************************************************************/
+#define CADENCE_PROFILE_UNIT_US (10)
+
+/********************************************************************************
+*  Constant:	CADENCE_PROFILE_MIN_VALUES										*
+*  Purpose:		Number of values a profile sketch needs before thresholds are	*
+*				derived from it.												*
+********************************************************************************/
+#define CADENCE_PROFILE_MIN_VALUES (1024)
+
+/********************************************************************************
+*  Constant:	CADENCE_PROFILE_REFRESH_VALUES									*
+*  Purpose:		Number of learned values after which the thresholds are derived	*
+*				again.															*
+********************************************************************************/
+#define CADENCE_PROFILE_REFRESH_VALUES (1024)
+
+/********************************************************************************
+*  Constant:	CADENCE_PROFILE_SPREAD_DIVISOR									*
+*  Purpose:		A window whose interval standard deviation is at or below the	*
+*				user's spread (5th to 95th percentile) divided by this is too	*
+*				steady to be the user, whatever its speed.						*
+********************************************************************************/
+#define CADENCE_PROFILE_SPREAD_DIVISOR (64)
+
+/********************************************************************************
+*  Constant:	CADENCE_PROFILE_HOLD_DIVISOR									*
+*  Purpose:		A hold shorter than the user's 5th percentile hold divided by	*
+*				this is short. Windows mostly of short holds (see				*
+*				CADENCE_MAX_FAST_PERMILLE) are machine generated.				*
+********************************************************************************/
+#define CADENCE_PROFILE_HOLD_DIVISOR (2)
+
+/********************************************************************************
+*  Constant:	CADENCE_PROFILE_DEFAULT_PATH									*
+*  Purpose:		Where the notifier keeps the typing profile (working			*
+*				directory).														*
+********************************************************************************/
+#define CADENCE_PROFILE_DEFAULT_PATH ("AntiDuck.profile")
+
+/********************************************************************************
+*  Constant:	CADENCE_PROFILE_FILE_MAGIC										*
+*  Purpose:		The profile file signature (8 characters).						*
+********************************************************************************/
+#define CADENCE_PROFILE_FILE_MAGIC ("ADPROFIL")
+
+/********************************************************************************
+*  Constant:	CADENCE_PROFILE_FORMAT_VERSION									*
+*  Purpose:		The profile file format version. Files of any other version are	*
+*				ignored, and the profile is learned again.						*
+********************************************************************************/
+#define CADENCE_PROFILE_FORMAT_VERSION (1)
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Enum:		CADENCE_VERDICT													*
+*  Purpose:		The verdict on a device's recent keystrokes.					*
+********************************************************************************/
+typedef enum
+{
+	CADENCE_VERDICT_PENDING,						// Not enough keystrokes yet
+	CADENCE_VERDICT_HUMAN,
+	CADENCE_VERDICT_INJECTION
+} CADENCE_VERDICT, *PCADENCE_VERDICT;
+
+/********************************************************************************
+*  Enum:		CADENCE_KERNEL													*
+*  Purpose:		Interval scoring kernel implementations.						*
+********************************************************************************/
+typedef enum
+{
+	CADENCE_KERNEL_SCALAR,
+	CADENCE_KERNEL_SSE41,
+	CADENCE_KERNEL_AVX2,
+
+	// Must be last
+	CADENCE_KERNEL_COUNT
+} CADENCE_KERNEL, *PCADENCE_KERNEL;
+
+/********************************************************************************
+*  Structure:	CADENCE_STATS													*
+*  Purpose:		Raw statistics of an interval window, as computed by a kernel.	*
+*  Remarks:		* All members are exact integers, so every kernel produces		*
+*					bit-identical results.										*
+********************************************************************************/
+typedef struct _CADENCE_STATS
+{
+	ULONGLONG qwSumUs;								// Sum of the intervals
+	ULONGLONG qwSumSquaresUs2;						// Sum of their squares
+	DWORD dwMinUs;									// Minimal interval
+	DWORD dwFastCount;								// Intervals below the fast threshold
+} CADENCE_STATS, *PCADENCE_STATS;
+
+/********************************************************************************
+*  Structure:	CADENCE_SCORE													*
+*  Purpose:		Statistics of a full interval window.							*
+********************************************************************************/
+typedef struct _CADENCE_SCORE
+{
+	ULONGLONG qwMeanUs;								// Mean interval
+	ULONGLONG qwVarianceUs2;						// Interval variance
+	DWORD dwMinUs;									// Minimal interval
+	DWORD dwFastPermille;							// Fraction of fast intervals
+} CADENCE_SCORE, *PCADENCE_SCORE;
+
+/********************************************************************************
+*  Structure:	CADENCE_DETECTOR												*
+*  Purpose:		The detector state of a single device.							*
+*  Remarks:		* Sums are kept exact (integers), so they never drift.			*
+********************************************************************************/
+typedef struct _CADENCE_DETECTOR
+{
+	DWORD adwIntervalsUs[CADENCE_WINDOW_INTERVALS];	// Ring of inter-key intervals
+	DWORD dwNext;									// Next ring index to write
+	DWORD dwCount;									// Valid intervals in the ring
+	ULONGLONG qwLastKeyTimestamp;					// Last key-down time (ns), or 0
+	WORD wHeldScanCode;								// Last pressed key, to skip auto-repeat
+	BOOLEAN bIsKeyHeld;								// Whether wHeldScanCode is still down
+	BOOLEAN bIsHuman;								// Whether the window was last scored human
+	WORD wHolds;									// Recent holds measured (halved when full)
+	WORD wShortHolds;								// How many of them were short
+} CADENCE_DETECTOR, *PCADENCE_DETECTOR;
+
+/********************************************************************************
+*  Structure:	CADENCE_PROFILE													*
+*  Purpose:		The typing profile of the user, learned from keystrokes scored	*
+*				human, and the thresholds derived from it.						*
+*  Remarks:		* About 1.4 KB whatever the amount of typing, and follows the	*
+*					user as their typing changes (see SKETCH).					*
+*				* Thresholds are 0 until enough has been learned.				*
+********************************************************************************/
+typedef struct _CADENCE_PROFILE
+{
+	SKETCH tIntervals;								// Inter-key intervals (CADENCE_PROFILE_UNIT_US)
+	SKETCH tHolds;									// Key holds (CADENCE_PROFILE_UNIT_US)
+	DWORD dwSteadyStddevUs;							// Windows at most this steady are not the user
+	DWORD dwShortHoldUs;							// Holds below this are short
+	DWORD dwSinceRefresh;							// Values learned since thresholds were derived
+	DWORD dwUnsaved;								// Values learned since last saved
+} CADENCE_PROFILE, *PCADENCE_PROFILE;
+typedef const CADENCE_PROFILE *PCCADENCE_PROFILE;
+
+/********************************************************************************
+*  Structure:	CADENCE_PROFILE_FILE											*
+*  Purpose:		The layout of a profile file.									*
+********************************************************************************/
+typedef struct _CADENCE_PROFILE_FILE
+{
+	CHAR acMagic[8];								// CADENCE_PROFILE_FILE_MAGIC
+	DWORD dwFormatVersion;							// CADENCE_PROFILE_FORMAT_VERSION
+	DWORD cbSketch;									// sizeof(SKETCH)
+	SKETCH tIntervals;								// As in CADENCE_PROFILE
+	SKETCH tHolds;
+} CADENCE_PROFILE_FILE, *PCADENCE_PROFILE_FILE;
+
+/********************************************************************************
+*  Structure:	CADENCE_SLOT													*
+*  Purpose:		A hash table slot (open addressing, linear probing).			*
+********************************************************************************/
+typedef struct _CADENCE_SLOT
+{
+	ULONGLONG qwDeviceId;							// The device ID
+	PCADENCE_DETECTOR ptDetector;					// The detector, or NULL if the slot is free
+} CADENCE_SLOT, *PCADENCE_SLOT;
+
+/********************************************************************************
+*  Structure:	CADENCE_TABLE													*
+*  Purpose:		The detectors of all tracked devices.							*
+********************************************************************************/
+typedef struct _CADENCE_TABLE
+{
+	CADENCE_SLOT atSlots[CADENCE_TABLE_SLOTS];		// Device ID to detector
+	DWORD dwDevices;								// Number of occupied slots
+	POOL_CLASSES tDetectors;						// Where detectors are allocated
+	CADENCE_PROFILE tProfile;						// The user's typing profile
+} CADENCE_TABLE, *PCADENCE_TABLE;
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	CADENCE_IsKernelSupported										*
+*  Purpose:		Checks whether the CPU can run a scoring kernel.				*
+*  Parameters:	@ eKernel ~[in]~ The kernel.									*
+*  Returns:		A boolean value.												*
+********************************************************************************/
+BOOL
+CADENCE_IsKernelSupported(
+	__in CADENCE_KERNEL eKernel
+);
+
+/********************************************************************************
+*  Function:	CADENCE_ScoreIntervalsWithKernel								*
+*  Purpose:		Computes the raw statistics of an interval window.				*
+*  Parameters:	@ eKernel ~[in]~ A supported kernel.							*
+*				@ pdwIntervalsUs ~[in]~ The intervals.							*
+*				@ dwCount ~[in]~ Number of intervals.							*
+*				@ dwFastUs ~[in]~ Intervals strictly below this are fast.		*
+*				@ ptStats ~[out]~ Gets the statistics.							*
+*  Remarks:		* The order of intervals does not matter, so a full ring is		*
+*					scored as-is.												*
+*				* dwMinUs is (DWORD)-1 for an empty window.						*
+********************************************************************************/
+VOID
+CADENCE_ScoreIntervalsWithKernel(
+	__in CADENCE_KERNEL eKernel,
+	__in_ecount(dwCount) const DWORD *pdwIntervalsUs,
+	__in DWORD dwCount,
+	__in DWORD dwFastUs,
+	__out PCADENCE_STATS ptStats
+);
+
+/********************************************************************************
+*  Function:	CADENCE_ScoreIntervals											*
+*  Purpose:		Computes the raw statistics of an interval window with the		*
+*				best kernel the CPU supports.									*
+*  Parameters:	@ pdwIntervalsUs ~[in]~ The intervals.							*
+*				@ dwCount ~[in]~ Number of intervals.							*
+*				@ dwFastUs ~[in]~ Intervals strictly below this are fast.		*
+*				@ ptStats ~[out]~ Gets the statistics.							*
+*  Remarks:		* See CADENCE_ScoreIntervalsWithKernel.							*
+********************************************************************************/
+VOID
+CADENCE_ScoreIntervals(
+	__in_ecount(dwCount) const DWORD *pdwIntervalsUs,
+	__in DWORD dwCount,
+	__in DWORD dwFastUs,
+	__out PCADENCE_STATS ptStats
+);
+
+/********************************************************************************
+*  Function:	CADENCE_Finalize												*
+*  Purpose:		Frees all detectors and their pool.								*
+*  Parameters:	@ ptTable ~[inout]~ The table (initially zeroed).				*
+********************************************************************************/
+VOID
+CADENCE_Finalize(
+	__inout PCADENCE_TABLE ptTable
+);
+
+/********************************************************************************
+*  Function:	CADENCE_OnKey													*
+*  Purpose:		Feeds a keystroke and gets the device's verdict.				*
+*  Parameters:	@ ptTable ~[inout]~ The table (initially zeroed).				*
+*				@ qwDeviceId ~[in]~ The device the key came from.				*
+*				@ qwTimestamp ~[in]~ The key time, in nanoseconds.				*
+*				@ wScanCode ~[in]~ The scan code.								*
+*				@ bIsKeyDown ~[in]~ Press or release.							*
+*				@ ptScore ~[out]~ Optional, gets the window statistics when		*
+*				a verdict is given.												*
+*  Returns:		The verdict.													*
+*  Remarks:		* O(CADENCE_WINDOW_INTERVALS) in SIMD lanes, and allocates only	*
+*					the first time a device is seen.							*
+*				* An injection verdict restarts the device's window.			*
+*				* Windows scored human teach the table's profile, and once it	*
+*					has learned enough, windows far steadier than the user or	*
+*					mostly of holds far shorter than theirs are injections.		*
+********************************************************************************/
+CADENCE_VERDICT
+CADENCE_OnKey(
+	__inout PCADENCE_TABLE ptTable,
+	__in ULONGLONG qwDeviceId,
+	__in ULONGLONG qwTimestamp,
+	__in WORD wScanCode,
+	__in BOOLEAN bIsKeyDown,
+	__out_opt PCADENCE_SCORE ptScore
+);
+
+/********************************************************************************
+*  Function:	CADENCE_LearnInterval											*
+*  Purpose:		Teaches the profile an inter-key interval of the user.			*
+*  Parameters:	@ ptProfile ~[inout]~ The profile.								*
+*				@ dwIntervalUs ~[in]~ The interval.								*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+********************************************************************************/
+VOID
+CADENCE_LearnInterval(
+	__inout PCADENCE_PROFILE ptProfile,
+	__in DWORD dwIntervalUs
+);
+
+/********************************************************************************
+*  Function:	CADENCE_LearnHold												*
+*  Purpose:		Teaches the profile a key hold of the user.						*
+*  Parameters:	@ ptProfile ~[inout]~ The profile.								*
+*				@ dwHoldUs ~[in]~ The hold.										*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+********************************************************************************/
+VOID
+CADENCE_LearnHold(
+	__inout PCADENCE_PROFILE ptProfile,
+	__in DWORD dwHoldUs
+);
+
+/********************************************************************************
+*  Function:	CADENCE_RefreshProfile											*
+*  Purpose:		Derives the thresholds from what the profile has learned.		*
+*  Parameters:	@ ptProfile ~[inout]~ The profile.								*
+********************************************************************************/
+VOID
+CADENCE_RefreshProfile(
+	__inout PCADENCE_PROFILE ptProfile
+);
+
+/********************************************************************************
+*  Function:	CADENCE_LoadProfile												*
+*  Purpose:		Adds a saved profile to a profile.								*
+*  Parameters:	@ pszPath ~[in]~ The profile file.								*
+*				@ ptProfile ~[inout]~ The profile.								*
+*  Returns:		A status code.													*
+*  Remarks:		* The saved profile is merged, so loading into an empty profile	*
+*					restores it.												*
+********************************************************************************/
+RETSTATUS
+CADENCE_LoadProfile(
+	__in_z PCSTR pszPath,
+	__inout PCADENCE_PROFILE ptProfile
+);
+
+/********************************************************************************
+*  Function:	CADENCE_SaveProfile												*
+*  Purpose:		Saves a profile.												*
+*  Parameters:	@ ptProfile ~[in]~ The profile.									*
+*				@ pszPath ~[in]~ The profile file, replaced in one step.		*
+*  Returns:		A status code.													*
+********************************************************************************/
+RETSTATUS
+CADENCE_SaveProfile(
+	__in PCCADENCE_PROFILE ptProfile,
+	__in_z PCSTR pszPath
+);
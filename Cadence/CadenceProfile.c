@@ -0,0 +1,292 @@
+/********************************************************************************
+*  File:		CadenceProfile.c												*
+*  Purpose:		The user's typing profile, and the thresholds derived from it.	*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#ifndef _WIN32
+#include <errno.h>
+#include <unistd.h>
+#endif	// _WIN32
+#include <stdio.h>
+#include <string.h>
+#include "Cadence.h"
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	CADENCE_PROFILE_TEMP_SUFFIX										*
+*  Purpose:		Appended to the profile path while a new profile is written.	*
+********************************************************************************/
+#define CADENCE_PROFILE_TEMP_SUFFIX (".tmp")
+
+/********************************************************************************
+*  Constant:	CADENCE_PROFILE_LOW_QUANTILE									*
+*  Purpose:		The share of the user's values a threshold is derived from the	*
+*				bottom of (5%, out of SKETCH_QUANTILE_SCALE).					*
+********************************************************************************/
+#define CADENCE_PROFILE_LOW_QUANTILE (5000)
+
+/********************************************************************************
+*  Constant:	CADENCE_PROFILE_HIGH_QUANTILE									*
+*  Purpose:		The share of the user's values a threshold is derived from the	*
+*				top of (95%, out of SKETCH_QUANTILE_SCALE).						*
+********************************************************************************/
+#define CADENCE_PROFILE_HIGH_QUANTILE (95000)
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	cadence_Learn													*
+*  Purpose:		Adds a value to a profile sketch.								*
+*  Parameters:	@ ptProfile ~[inout]~ The profile.								*
+*				@ ptSketch ~[inout]~ The profile's sketch.						*
+*				@ dwValueUs ~[in]~ The value.									*
+********************************************************************************/
+static
+__inline
+VOID
+cadence_Learn(
+	__inout PCADENCE_PROFILE ptProfile,
+	__inout PSKETCH ptSketch,
+	__in DWORD dwValueUs
+)
+{
+	// Longer values are all alike for thresholds, clamp them
+	SKETCH_Add(ptSketch, (WORD)MIN(dwValueUs / CADENCE_PROFILE_UNIT_US, 0xFFFF));
+	ptProfile->dwUnsaved++;
+	ptProfile->dwSinceRefresh++;
+	if (CADENCE_PROFILE_REFRESH_VALUES <= ptProfile->dwSinceRefresh)
+	{
+		CADENCE_RefreshProfile(ptProfile);
+	}
+}
+
+/********************************************************************************
+*  Function:	CADENCE_LearnInterval											*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+********************************************************************************/
+VOID
+CADENCE_LearnInterval(
+	__inout PCADENCE_PROFILE ptProfile,
+	__in DWORD dwIntervalUs
+)
+{
+	cadence_Learn(ptProfile, &(ptProfile->tIntervals), dwIntervalUs);
+}
+
+/********************************************************************************
+*  Function:	CADENCE_LearnHold												*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+********************************************************************************/
+VOID
+CADENCE_LearnHold(
+	__inout PCADENCE_PROFILE ptProfile,
+	__in DWORD dwHoldUs
+)
+{
+	cadence_Learn(ptProfile, &(ptProfile->tHolds), dwHoldUs);
+}
+
+/********************************************************************************
+*  Function:	CADENCE_RefreshProfile											*
+********************************************************************************/
+VOID
+CADENCE_RefreshProfile(
+	__inout PCADENCE_PROFILE ptProfile
+)
+{
+	static const DWORD s_adwQuantiles[] = { CADENCE_PROFILE_LOW_QUANTILE, CADENCE_PROFILE_HIGH_QUANTILE };
+	WORD awValues[sizeof(s_adwQuantiles) / sizeof(s_adwQuantiles[0])] = { 0 };
+
+	// Validations
+	ASSERT(NULL != ptProfile);
+
+	ptProfile->dwSinceRefresh = 0;
+
+	// Windows far steadier than the user's spread of intervals
+	ptProfile->dwSteadyStddevUs = 0;
+	if ((CADENCE_PROFILE_MIN_VALUES <= SKETCH_GetCount(&(ptProfile->tIntervals))) &&
+		(SKETCH_GetQuantiles(&(ptProfile->tIntervals), s_adwQuantiles, 2, awValues)))
+	{
+		ptProfile->dwSteadyStddevUs = ((DWORD)(awValues[1] - awValues[0]) * CADENCE_PROFILE_UNIT_US) /
+			CADENCE_PROFILE_SPREAD_DIVISOR;
+	}
+
+	// Holds far shorter than the user's shortest
+	ptProfile->dwShortHoldUs = 0;
+	if ((CADENCE_PROFILE_MIN_VALUES <= SKETCH_GetCount(&(ptProfile->tHolds))) &&
+		(SKETCH_GetQuantiles(&(ptProfile->tHolds), s_adwQuantiles, 1, awValues)))
+	{
+		ptProfile->dwShortHoldUs = ((DWORD)awValues[0] * CADENCE_PROFILE_UNIT_US) / CADENCE_PROFILE_HOLD_DIVISOR;
+	}
+}
+
+/********************************************************************************
+*  Function:	CADENCE_LoadProfile												*
+********************************************************************************/
+RETSTATUS
+CADENCE_LoadProfile(
+	__in_z PCSTR pszPath,
+	__inout PCADENCE_PROFILE ptProfile
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	CADENCE_PROFILE_FILE tFile;
+	FILE *ptFile = NULL;
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != pszPath);
+	ASSERT(NULL != ptProfile);
+
+	// Read the whole file, it is small
+	RtlZeroMemory(&tFile, sizeof(tFile));
+	ptFile = fopen(pszPath, "rb");
+	if (NULL == ptFile)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_INFO,
+			"No profile ('%s').",
+			pszPath);
+		goto lblCleanup;
+	}
+	if ((1 != fread(&tFile, sizeof(tFile), 1, ptFile)) ||
+		(0 != memcmp(tFile.acMagic, CADENCE_PROFILE_FILE_MAGIC, sizeof(tFile.acMagic))) ||
+		(CADENCE_PROFILE_FORMAT_VERSION != tFile.dwFormatVersion) ||
+		(sizeof(SKETCH) != tFile.cbSketch) ||
+		(!SKETCH_IsValid(&(tFile.tIntervals))) ||
+		(!SKETCH_IsValid(&(tFile.tHolds))))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"Invalid profile ('%s').",
+			pszPath);
+		goto lblCleanup;
+	}
+
+	// Merge it, and derive the thresholds right away
+	SKETCH_Merge(&(ptProfile->tIntervals), &(tFile.tIntervals));
+	SKETCH_Merge(&(ptProfile->tHolds), &(tFile.tHolds));
+	CADENCE_RefreshProfile(ptProfile);
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	if (NULL != ptFile)
+	{
+		(VOID)fclose(ptFile);
+	}
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	CADENCE_SaveProfile												*
+********************************************************************************/
+RETSTATUS
+CADENCE_SaveProfile(
+	__in PCCADENCE_PROFILE ptProfile,
+	__in_z PCSTR pszPath
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	CHAR szTempPath[MAX_PATH] = { 0 };
+	CADENCE_PROFILE_FILE tFile;
+	FILE *ptFile = NULL;
+	BOOL bIsCreated = FALSE;
+	BOOL bIsWritten = FALSE;
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != ptProfile);
+	ASSERT(NULL != pszPath);
+	if (sizeof(szTempPath) <= (SIZE_T)snprintf(szTempPath, sizeof(szTempPath), "%s%s", pszPath, CADENCE_PROFILE_TEMP_SUFFIX))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"Path too long ('%s').",
+			pszPath);
+		goto lblCleanup;
+	}
+
+	// Lay the file out
+	RtlZeroMemory(&tFile, sizeof(tFile));
+	RtlCopyMemory(tFile.acMagic, CADENCE_PROFILE_FILE_MAGIC, sizeof(tFile.acMagic));
+	tFile.dwFormatVersion = CADENCE_PROFILE_FORMAT_VERSION;
+	tFile.cbSketch = sizeof(SKETCH);
+	tFile.tIntervals = ptProfile->tIntervals;
+	tFile.tHolds = ptProfile->tHolds;
+
+	// Write it next to the file, durably
+	ptFile = fopen(szTempPath, "wb");
+	if (NULL == ptFile)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"Cannot create '%s'.",
+			szTempPath);
+		goto lblCleanup;
+	}
+	bIsCreated = TRUE;
+	bIsWritten = (1 == fwrite(&tFile, sizeof(tFile), 1, ptFile)) && (0 == fflush(ptFile));
+#ifndef _WIN32
+	bIsWritten = bIsWritten && (0 == fsync(fileno(ptFile)));
+#endif	// _WIN32
+	bIsWritten = (0 == fclose(ptFile)) && bIsWritten;
+	ptFile = NULL;
+	if (!bIsWritten)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"Cannot write '%s'.",
+			szTempPath);
+		goto lblCleanup;
+	}
+
+	// Replace the file in one step
+#ifdef _WIN32
+	if (!MoveFileExA(szTempPath, pszPath, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"MoveFileExA() failure (LastError=%lu).",
+			GetLastError());
+		goto lblCleanup;
+	}
+#else	// _WIN32
+	if (0 != rename(szTempPath, pszPath))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"rename() failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+#endif	// _WIN32
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	if ((RETSTATUS_FAILED(eStatus)) && (bIsCreated))
+	{
+		(VOID)remove(szTempPath);
+	}
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
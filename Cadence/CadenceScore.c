@@ -0,0 +1,369 @@
+/********************************************************************************
+*  File:		CadenceScore.c													*
+*  Purpose:		Interval window scoring kernels (scalar, SSE4.1 and AVX2) with	*
+*				runtime CPU dispatch.											*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#include "Cadence.h"
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CADENCE_HAS_X86_KERNELS
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif	// _MSC_VER
+#endif	// x86
+
+
+/** Macros *********************************************************************/
+
+/********************************************************************************
+*  Macro:		CADENCE_TARGET													*
+*  Purpose:		Allows a function to use an instruction set beyond the			*
+*				compilation baseline.											*
+*  Parameters:	@ pszTarget ~[in]~ The GCC target name (e.g. "avx2").			*
+*  Remarks:		* MSVC always allows intrinsics, so this expands to nothing.	*
+********************************************************************************/
+#ifdef _MSC_VER
+#define CADENCE_TARGET(pszTarget)
+#else	// _MSC_VER
+#define CADENCE_TARGET(pszTarget)				__attribute__((target(pszTarget)))
+#endif	// _MSC_VER
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Callback:	PFN_CADENCE_KERNEL												*
+*  Purpose:		A scoring kernel.												*
+*  Parameters:	See CADENCE_ScoreIntervalsWithKernel.							*
+********************************************************************************/
+typedef VOID (*PFN_CADENCE_KERNEL)(
+	__in_ecount(dwCount) const DWORD *pdwIntervalsUs,
+	__in DWORD dwCount,
+	__in DWORD dwFastUs,
+	__out PCADENCE_STATS ptStats
+);
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	cadence_ScoreScalar												*
+*  Purpose:		The scalar scoring kernel (and the reference for all others).	*
+*  Parameters:	See CADENCE_ScoreIntervalsWithKernel.							*
+********************************************************************************/
+static
+VOID
+cadence_ScoreScalar(
+	__in_ecount(dwCount) const DWORD *pdwIntervalsUs,
+	__in DWORD dwCount,
+	__in DWORD dwFastUs,
+	__out PCADENCE_STATS ptStats
+)
+{
+	DWORD dwIndex = 0;
+	DWORD dwInterval = 0;
+
+	// Start from the identity of every statistic
+	ptStats->qwSumUs = 0;
+	ptStats->qwSumSquaresUs2 = 0;
+	ptStats->dwMinUs = (DWORD)-1;
+	ptStats->dwFastCount = 0;
+
+	// Accumulate
+	for (dwIndex = 0; dwIndex < dwCount; dwIndex++)
+	{
+		dwInterval = pdwIntervalsUs[dwIndex];
+		ptStats->qwSumUs += dwInterval;
+		ptStats->qwSumSquaresUs2 += (ULONGLONG)dwInterval * dwInterval;
+		ptStats->dwMinUs = MIN(ptStats->dwMinUs, dwInterval);
+		ptStats->dwFastCount += (dwInterval < dwFastUs) ? 1 : 0;
+	}
+}
+
+#ifdef CADENCE_HAS_X86_KERNELS
+/********************************************************************************
+*  Function:	cadence_ScoreSse41												*
+*  Purpose:		The SSE4.1 scoring kernel (4 intervals per step).				*
+*  Parameters:	See CADENCE_ScoreIntervalsWithKernel.							*
+*  Remarks:		* "x < t" is computed as "min(x, t - 1) == x", since there is no	*
+*					unsigned comparison. A zero threshold has no fast intervals.	*
+********************************************************************************/
+static
+CADENCE_TARGET("sse4.1")
+VOID
+cadence_ScoreSse41(
+	__in_ecount(dwCount) const DWORD *pdwIntervalsUs,
+	__in DWORD dwCount,
+	__in DWORD dwFastUs,
+	__out PCADENCE_STATS ptStats
+)
+{
+	DWORD dwIndex = 0;
+	DWORD dwLane = 0;
+	CADENCE_STATS tTail = { 0 };
+	__m128i vInterval;
+	__m128i vSum = _mm_setzero_si128();
+	__m128i vSumSquares = _mm_setzero_si128();
+	__m128i vMin = _mm_set1_epi32(-1);
+	__m128i vFast = _mm_setzero_si128();
+	__m128i vFastLimit = _mm_set1_epi32((INT)(dwFastUs - 1));
+	__m128i vFastMask = _mm_set1_epi32((0 == dwFastUs) ? 0 : -1);
+	ULONGLONG aqwLanes[2];
+	DWORD adwLanes[4];
+
+	// Whole vectors
+	for (dwIndex = 0; dwIndex + 4 <= dwCount; dwIndex += 4)
+	{
+		vInterval = _mm_loadu_si128((const __m128i *)(pdwIntervalsUs + dwIndex));
+		vSum = _mm_add_epi64(vSum, _mm_cvtepu32_epi64(vInterval));
+		vSum = _mm_add_epi64(vSum, _mm_cvtepu32_epi64(_mm_srli_si128(vInterval, 8)));
+		vSumSquares = _mm_add_epi64(vSumSquares, _mm_mul_epu32(vInterval, vInterval));
+		vSumSquares = _mm_add_epi64(vSumSquares, _mm_mul_epu32(_mm_srli_epi64(vInterval, 32), _mm_srli_epi64(vInterval, 32)));
+		vMin = _mm_min_epu32(vMin, vInterval);
+		vFast = _mm_sub_epi32(vFast,
+			_mm_and_si128(vFastMask, _mm_cmpeq_epi32(_mm_min_epu32(vInterval, vFastLimit), vInterval)));
+	}
+
+	// Remainder
+	cadence_ScoreScalar(pdwIntervalsUs + dwIndex, dwCount - dwIndex, dwFastUs, &tTail);
+
+	// Reduce the lanes
+	_mm_storeu_si128((__m128i *)aqwLanes, vSum);
+	ptStats->qwSumUs = tTail.qwSumUs + aqwLanes[0] + aqwLanes[1];
+	_mm_storeu_si128((__m128i *)aqwLanes, vSumSquares);
+	ptStats->qwSumSquaresUs2 = tTail.qwSumSquaresUs2 + aqwLanes[0] + aqwLanes[1];
+	_mm_storeu_si128((__m128i *)adwLanes, vMin);
+	ptStats->dwMinUs = tTail.dwMinUs;
+	for (dwLane = 0; dwLane < 4; dwLane++)
+	{
+		ptStats->dwMinUs = MIN(ptStats->dwMinUs, adwLanes[dwLane]);
+	}
+	_mm_storeu_si128((__m128i *)adwLanes, vFast);
+	ptStats->dwFastCount = tTail.dwFastCount + adwLanes[0] + adwLanes[1] + adwLanes[2] + adwLanes[3];
+}
+
+/********************************************************************************
+*  Function:	cadence_ScoreAvx2												*
+*  Purpose:		The AVX2 scoring kernel (8 intervals per step).					*
+*  Parameters:	See CADENCE_ScoreIntervalsWithKernel.							*
+*  Remarks:		* See cadence_ScoreSse41.										*
+********************************************************************************/
+static
+CADENCE_TARGET("avx2")
+VOID
+cadence_ScoreAvx2(
+	__in_ecount(dwCount) const DWORD *pdwIntervalsUs,
+	__in DWORD dwCount,
+	__in DWORD dwFastUs,
+	__out PCADENCE_STATS ptStats
+)
+{
+	DWORD dwIndex = 0;
+	DWORD dwLane = 0;
+	CADENCE_STATS tTail = { 0 };
+	__m256i vInterval;
+	__m256i vOdd;
+	__m256i vSum = _mm256_setzero_si256();
+	__m256i vSumSquares = _mm256_setzero_si256();
+	__m256i vMin = _mm256_set1_epi32(-1);
+	__m256i vFast = _mm256_setzero_si256();
+	__m256i vFastLimit = _mm256_set1_epi32((INT)(dwFastUs - 1));
+	__m256i vFastMask = _mm256_set1_epi32((0 == dwFastUs) ? 0 : -1);
+	ULONGLONG aqwLanes[4];
+	DWORD adwLanes[8];
+
+	// Whole vectors
+	for (dwIndex = 0; dwIndex + 8 <= dwCount; dwIndex += 8)
+	{
+		vInterval = _mm256_loadu_si256((const __m256i *)(pdwIntervalsUs + dwIndex));
+		vOdd = _mm256_srli_epi64(vInterval, 32);
+		vSum = _mm256_add_epi64(vSum, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(vInterval)));
+		vSum = _mm256_add_epi64(vSum, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(vInterval, 1)));
+		vSumSquares = _mm256_add_epi64(vSumSquares, _mm256_mul_epu32(vInterval, vInterval));
+		vSumSquares = _mm256_add_epi64(vSumSquares, _mm256_mul_epu32(vOdd, vOdd));
+		vMin = _mm256_min_epu32(vMin, vInterval);
+		vFast = _mm256_sub_epi32(vFast,
+			_mm256_and_si256(vFastMask, _mm256_cmpeq_epi32(_mm256_min_epu32(vInterval, vFastLimit), vInterval)));
+	}
+
+	// Remainder
+	cadence_ScoreScalar(pdwIntervalsUs + dwIndex, dwCount - dwIndex, dwFastUs, &tTail);
+
+	// Reduce the lanes
+	_mm256_storeu_si256((__m256i *)aqwLanes, vSum);
+	ptStats->qwSumUs = tTail.qwSumUs + aqwLanes[0] + aqwLanes[1] + aqwLanes[2] + aqwLanes[3];
+	_mm256_storeu_si256((__m256i *)aqwLanes, vSumSquares);
+	ptStats->qwSumSquaresUs2 = tTail.qwSumSquaresUs2 + aqwLanes[0] + aqwLanes[1] + aqwLanes[2] + aqwLanes[3];
+	_mm256_storeu_si256((__m256i *)adwLanes, vMin);
+	ptStats->dwMinUs = tTail.dwMinUs;
+	for (dwLane = 0; dwLane < 8; dwLane++)
+	{
+		ptStats->dwMinUs = MIN(ptStats->dwMinUs, adwLanes[dwLane]);
+	}
+	_mm256_storeu_si256((__m256i *)adwLanes, vFast);
+	ptStats->dwFastCount = tTail.dwFastCount;
+	for (dwLane = 0; dwLane < 8; dwLane++)
+	{
+		ptStats->dwFastCount += adwLanes[dwLane];
+	}
+}
+
+/********************************************************************************
+*  Function:	cadence_CpuHasAvx2												*
+*  Purpose:		Checks whether both the CPU and the OS support AVX2.			*
+*  Returns:		A boolean value.												*
+********************************************************************************/
+static
+BOOL
+cadence_CpuHasAvx2(VOID)
+{
+#ifdef _MSC_VER
+	INT anRegisters[4] = { 0 };
+
+	// AVX with OS support for YMM state (CPUID.1:ECX.OSXSAVE[27] and AVX[28], XCR0 bits 1-2)
+	__cpuid(anRegisters, 0);
+	if (7 > anRegisters[0])
+	{
+		return FALSE;
+	}
+	__cpuid(anRegisters, 1);
+	if ((!IS_FLAG_ON((DWORD)anRegisters[2], (1UL << 27) | (1UL << 28))) || (6 != (_xgetbv(0) & 6)))
+	{
+		return FALSE;
+	}
+
+	// AVX2 (CPUID.7.0:EBX[5])
+	__cpuidex(anRegisters, 7, 0);
+	return IS_FLAG_ON((DWORD)anRegisters[1], 1UL << 5);
+#else	// _MSC_VER
+	return __builtin_cpu_supports("avx2");
+#endif	// _MSC_VER
+}
+
+/********************************************************************************
+*  Function:	cadence_CpuHasSse41												*
+*  Purpose:		Checks whether the CPU supports SSE4.1.							*
+*  Returns:		A boolean value.												*
+********************************************************************************/
+static
+BOOL
+cadence_CpuHasSse41(VOID)
+{
+#ifdef _MSC_VER
+	INT anRegisters[4] = { 0 };
+
+	// CPUID.1:ECX.SSE4_1[19]
+	__cpuid(anRegisters, 1);
+	return IS_FLAG_ON((DWORD)anRegisters[2], 1UL << 19);
+#else	// _MSC_VER
+	return __builtin_cpu_supports("sse4.1");
+#endif	// _MSC_VER
+}
+#endif	// CADENCE_HAS_X86_KERNELS
+
+/********************************************************************************
+*  Function:	cadence_GetKernel												*
+*  Purpose:		Gets the routine of a kernel.									*
+*  Parameters:	@ eKernel ~[in]~ The kernel.									*
+*  Returns:		The routine, or NULL if it was not compiled in.					*
+********************************************************************************/
+static
+PFN_CADENCE_KERNEL
+cadence_GetKernel(
+	__in CADENCE_KERNEL eKernel
+)
+{
+	switch (eKernel)
+	{
+	case CADENCE_KERNEL_SCALAR:
+		return cadence_ScoreScalar;
+#ifdef CADENCE_HAS_X86_KERNELS
+	case CADENCE_KERNEL_SSE41:
+		return cadence_ScoreSse41;
+	case CADENCE_KERNEL_AVX2:
+		return cadence_ScoreAvx2;
+#endif	// CADENCE_HAS_X86_KERNELS
+	default:
+		return NULL;
+	}
+}
+
+/********************************************************************************
+*  Function:	CADENCE_IsKernelSupported										*
+********************************************************************************/
+BOOL
+CADENCE_IsKernelSupported(
+	__in CADENCE_KERNEL eKernel
+)
+{
+	switch (eKernel)
+	{
+	case CADENCE_KERNEL_SCALAR:
+		return TRUE;
+#ifdef CADENCE_HAS_X86_KERNELS
+	case CADENCE_KERNEL_SSE41:
+		return cadence_CpuHasSse41();
+	case CADENCE_KERNEL_AVX2:
+		return cadence_CpuHasAvx2();
+#endif	// CADENCE_HAS_X86_KERNELS
+	default:
+		return FALSE;
+	}
+}
+
+/********************************************************************************
+*  Function:	CADENCE_ScoreIntervalsWithKernel								*
+********************************************************************************/
+VOID
+CADENCE_ScoreIntervalsWithKernel(
+	__in CADENCE_KERNEL eKernel,
+	__in_ecount(dwCount) const DWORD *pdwIntervalsUs,
+	__in DWORD dwCount,
+	__in DWORD dwFastUs,
+	__out PCADENCE_STATS ptStats
+)
+{
+	// Validations
+	ASSERT(CADENCE_IsKernelSupported(eKernel));
+	ASSERT(NULL != ptStats);
+
+	// Dispatch
+	cadence_GetKernel(eKernel)(pdwIntervalsUs, dwCount, dwFastUs, ptStats);
+}
+
+/********************************************************************************
+*  Function:	CADENCE_ScoreIntervals											*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+********************************************************************************/
+VOID
+CADENCE_ScoreIntervals(
+	__in_ecount(dwCount) const DWORD *pdwIntervalsUs,
+	__in DWORD dwCount,
+	__in DWORD dwFastUs,
+	__out PCADENCE_STATS ptStats
+)
+{
+	static PFN_CADENCE_KERNEL s_pfnKernel = NULL;
+	PFN_CADENCE_KERNEL pfnKernel = s_pfnKernel;
+	INT nKernel = 0;
+
+	// Pick the best kernel once (racing here is harmless, every thread picks the same)
+	if (NULL == pfnKernel)
+	{
+		for (nKernel = CADENCE_KERNEL_COUNT - 1; nKernel >= CADENCE_KERNEL_SCALAR; nKernel--)
+		{
+			if (CADENCE_IsKernelSupported((CADENCE_KERNEL)nKernel))
+			{
+				pfnKernel = cadence_GetKernel((CADENCE_KERNEL)nKernel);
+				break;
+			}
+		}
+		s_pfnKernel = pfnKernel;
+	}
+
+	// Dispatch
+	pfnKernel(pdwIntervalsUs, dwCount, dwFastUs, ptStats);
+}
@@ -0,0 +1,131 @@
+/********************************************************************************
+*  File:		Coalesce.c														*
+*  Purpose:		Coalesces device arrival storms into one decision and one lock	*
+*				per burst.														*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#include "Coalesce.h"
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	COALESCE_OnArrival												*
+********************************************************************************/
+BOOL
+COALESCE_OnArrival(
+	__inout PCOALESCER ptCoalescer,
+	__in PCEVENTSOURCE_EVENT ptEvent
+)
+{
+	ULONGLONG qwTimestamp = ptEvent->qwTimestamp;
+	ULONGLONG qwFingerprint = 0;
+	DWORD dwSlot = 0;
+
+	// Validations
+	ASSERT(NULL != ptCoalescer);
+	ASSERT(NULL != ptEvent);
+
+	ptCoalescer->qwArrivals++;
+
+	// A quiet gap, or a burst that lasted too long, starts a new burst with no devices
+	if ((0 == ptCoalescer->qwBurstStart) ||
+		(COALESCE_QUIET_NS < qwTimestamp - ptCoalescer->qwLastArrival) ||
+		(COALESCE_MAX_BURST_NS < qwTimestamp - ptCoalescer->qwBurstStart))
+	{
+		if (0 != ptCoalescer->dwDevices)
+		{
+			RtlZeroMemory(ptCoalescer->atSlots, sizeof(ptCoalescer->atSlots));
+			ptCoalescer->dwDevices = 0;
+		}
+		ptCoalescer->qwBurstStart = qwTimestamp;
+		ptCoalescer->qwBursts++;
+	}
+	ptCoalescer->qwLastArrival = qwTimestamp;
+
+	// Devices without an identity cannot be told apart
+	if (!ptEvent->tIdentity.bIsValid)
+	{
+		return TRUE;
+	}
+
+	// Probe, stopping at the device or the first free slot (one always exists)
+	qwFingerprint = DEVICEID_GetFingerprint(&(ptEvent->tIdentity));
+	for (dwSlot = (DWORD)qwFingerprint & (COALESCE_SLOTS - 1);
+		0 != ptCoalescer->atSlots[dwSlot].qwFingerprint;
+		dwSlot = (dwSlot + 1) & (COALESCE_SLOTS - 1))
+	{
+		if ((qwFingerprint == ptCoalescer->atSlots[dwSlot].qwFingerprint) &&
+			(ptEvent->eClass == ptCoalescer->atSlots[dwSlot].eClass))
+		{
+			ptCoalescer->qwAbsorbedArrivals++;
+			return FALSE;
+		}
+	}
+
+	// Remember the device while there is room
+	if (COALESCE_MAX_DEVICES > ptCoalescer->dwDevices)
+	{
+		ptCoalescer->atSlots[dwSlot].qwFingerprint = qwFingerprint;
+		ptCoalescer->atSlots[dwSlot].eClass = ptEvent->eClass;
+		ptCoalescer->dwDevices++;
+	}
+
+	// Return result
+	return TRUE;
+}
+
+/********************************************************************************
+*  Function:	COALESCE_OnLock													*
+********************************************************************************/
+BOOL
+COALESCE_OnLock(
+	__inout PCOALESCER ptCoalescer,
+	__in ULONGLONG qwTimestamp
+)
+{
+	BOOL bShouldLock = FALSE;
+
+	// Validations
+	ASSERT(NULL != ptCoalescer);
+
+	// Fold verdicts that keep coming since the last lock into it
+	if ((0 != ptCoalescer->qwLockBurstStart) &&
+		(COALESCE_QUIET_NS >= qwTimestamp - ptCoalescer->qwLastLockVerdict) &&
+		(COALESCE_MAX_BURST_NS >= qwTimestamp - ptCoalescer->qwLockBurstStart))
+	{
+		ptCoalescer->qwAbsorbedLocks++;
+	}
+	else
+	{
+		ptCoalescer->qwLockBurstStart = qwTimestamp;
+		ptCoalescer->qwLocks++;
+		bShouldLock = TRUE;
+	}
+	ptCoalescer->qwLastLockVerdict = qwTimestamp;
+
+	// Return result
+	return bShouldLock;
+}
+
+/********************************************************************************
+*  Function:	COALESCE_GetStats												*
+********************************************************************************/
+VOID
+COALESCE_GetStats(
+	__in PCCOALESCER ptCoalescer,
+	__out PCOALESCE_STATS ptStats
+)
+{
+	// Validations
+	ASSERT(NULL != ptCoalescer);
+	ASSERT(NULL != ptStats);
+
+	ptStats->qwBursts = ptCoalescer->qwBursts;
+	ptStats->qwArrivals = ptCoalescer->qwArrivals;
+	ptStats->qwAbsorbedArrivals = ptCoalescer->qwAbsorbedArrivals;
+	ptStats->qwLocks = ptCoalescer->qwLocks;
+	ptStats->qwAbsorbedLocks = ptCoalescer->qwAbsorbedLocks;
+}
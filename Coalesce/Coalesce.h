@@ -0,0 +1,140 @@
+/********************************************************************************
+*  File:		Coalesce.h														*
+*  Purpose:		Coalesces device arrival storms (docks, composite devices) into	*
+*				one decision and one lock per burst.							*
+********************************************************************************/
+#pragma once
+
+
+/** Includes *******************************************************************/
+#include <Utilities.h>
+#include "../EventSource/EventSource.h"
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	COALESCE_QUIET_NS												*
+*  Purpose:		A burst ends after this long without arrivals (or without lock	*
+*				verdicts, for locks).											*
+********************************************************************************/
+#define COALESCE_QUIET_NS (200ULL * 1000 * 1000)
+
+/********************************************************************************
+*  Constant:	COALESCE_MAX_BURST_NS											*
+*  Purpose:		The longest a burst lasts, so that a steady stream of events	*
+*				cannot hold back a lock indefinitely.							*
+********************************************************************************/
+#define COALESCE_MAX_BURST_NS (1000ULL * 1000 * 1000)
+
+/********************************************************************************
+*  Constant:	COALESCE_SLOTS													*
+*  Purpose:		Hash table slots for the devices of a burst (a power of two).	*
+********************************************************************************/
+#define COALESCE_SLOTS (256)
+
+/********************************************************************************
+*  Constant:	COALESCE_MAX_DEVICES											*
+*  Purpose:		Distinct devices remembered per burst (at most 75% load).		*
+********************************************************************************/
+#define COALESCE_MAX_DEVICES (COALESCE_SLOTS * 3 / 4)
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Structure:	COALESCE_SLOT													*
+*  Purpose:		A hash table slot (open addressing, linear probing).			*
+********************************************************************************/
+typedef struct _COALESCE_SLOT
+{
+	ULONGLONG qwFingerprint;						// DEVICEID_GetFingerprint, or 0 if free
+	EVENTSOURCE_DEVICE_CLASS eClass;				// The device class
+} COALESCE_SLOT, *PCOALESCE_SLOT;
+
+/********************************************************************************
+*  Structure:	COALESCER														*
+*  Purpose:		The coalescing state.											*
+*  Remarks:		* Fixed size, never allocates.									*
+*				* Only used from a single thread. The counters may be read		*
+*					from any thread, see COALESCE_GetStats.						*
+*				* Driven by event timestamps, like the cadence detector.		*
+********************************************************************************/
+typedef struct _COALESCER
+{
+	COALESCE_SLOT atSlots[COALESCE_SLOTS];			// Devices that arrived in this burst
+	DWORD dwDevices;								// Number of occupied slots
+	ULONGLONG qwBurstStart;							// First arrival of this burst, or 0
+	ULONGLONG qwLastArrival;						// Latest arrival of this burst
+	ULONGLONG qwLockBurstStart;						// Last lock carried out, or 0
+	ULONGLONG qwLastLockVerdict;					// Latest lock verdict since then
+	volatile ULONGLONG qwBursts;					// Arrival bursts
+	volatile ULONGLONG qwArrivals;					// Arrivals seen
+	volatile ULONGLONG qwAbsorbedArrivals;			// Arrivals not decided again
+	volatile ULONGLONG qwLocks;						// Locks carried out
+	volatile ULONGLONG qwAbsorbedLocks;				// Lock verdicts folded into a previous lock
+} COALESCER, *PCOALESCER;
+typedef const COALESCER *PCCOALESCER;
+
+/********************************************************************************
+*  Structure:	COALESCE_STATS													*
+*  Purpose:		A snapshot of the coalescer's counters.							*
+*  Remarks:		* Counters may be slightly stale, as they are read while the	*
+*					coalescer is in use.										*
+********************************************************************************/
+typedef struct _COALESCE_STATS
+{
+	ULONGLONG qwBursts;								// Arrival bursts
+	ULONGLONG qwArrivals;							// Arrivals seen
+	ULONGLONG qwAbsorbedArrivals;					// Arrivals not decided again
+	ULONGLONG qwLocks;								// Locks carried out
+	ULONGLONG qwAbsorbedLocks;						// Lock verdicts folded into a previous lock
+} COALESCE_STATS, *PCOALESCE_STATS;
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	COALESCE_OnArrival												*
+*  Purpose:		Accounts for a device arrival.									*
+*  Parameters:	@ ptCoalescer ~[inout]~ The coalescer (initially zeroed).		*
+*				@ ptEvent ~[in]~ The arrival.									*
+*  Returns:		TRUE if the arrival must be decided, FALSE if the same device	*
+*				(identity and class) already arrived in this burst.				*
+*  Remarks:		* A composite device reports one arrival per interface, all with	*
+*					the same identity, and its decision only depends on that.	*
+*				* Arrivals without an identity are always decided, as are new	*
+*					devices once COALESCE_MAX_DEVICES are remembered.			*
+********************************************************************************/
+BOOL
+COALESCE_OnArrival(
+	__inout PCOALESCER ptCoalescer,
+	__in PCEVENTSOURCE_EVENT ptEvent
+);
+
+/********************************************************************************
+*  Function:	COALESCE_OnLock													*
+*  Purpose:		Accounts for a lock verdict.									*
+*  Parameters:	@ ptCoalescer ~[inout]~ The coalescer (initially zeroed).		*
+*				@ qwTimestamp ~[in]~ The time of the event that called for it.	*
+*  Returns:		TRUE if the lock must be carried out, FALSE if a lock was		*
+*				already carried out in this burst.								*
+********************************************************************************/
+BOOL
+COALESCE_OnLock(
+	__inout PCOALESCER ptCoalescer,
+	__in ULONGLONG qwTimestamp
+);
+
+/********************************************************************************
+*  Function:	COALESCE_GetStats												*
+*  Purpose:		Gets the coalescer's counters.									*
+*  Parameters:	@ ptCoalescer ~[in]~ The coalescer.								*
+*				@ ptStats ~[out]~ Gets the counters.							*
+*  Remarks:		* May be called from any thread.								*
+********************************************************************************/
+VOID
+COALESCE_GetStats(
+	__in PCCOALESCER ptCoalescer,
+	__out PCOALESCE_STATS ptStats
+);
@@ -0,0 +1,71 @@
+/********************************************************************************
+*  File:		Clock.h															*
+*  Purpose:		Monotonic high-resolution timestamps.							*
+********************************************************************************/
+#pragma once
+
+
+/** Includes *******************************************************************/
+#include <Utilities.h>
+#ifndef _WIN32
+#include <time.h>
+#endif	// _WIN32
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	NANOSECONDS_IN_SECOND											*
+*  Purpose:		The number of nanoseconds in a second.							*
+********************************************************************************/
+#define NANOSECONDS_IN_SECOND (1000000000ULL)
+
+/********************************************************************************
+*  Constant:	NANOSECONDS_IN_MICROSECOND										*
+*  Purpose:		The number of nanoseconds in a microsecond.						*
+********************************************************************************/
+#define NANOSECONDS_IN_MICROSECOND (1000ULL)
+
+/********************************************************************************
+*  Constant:	NANOSECONDS_IN_MILLISECOND										*
+*  Purpose:		The number of nanoseconds in a millisecond.						*
+********************************************************************************/
+#define NANOSECONDS_IN_MILLISECOND (1000000ULL)
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	CLOCK_GetTimestamp												*
+*  Purpose:		Gets a monotonic timestamp.										*
+*  Returns:		The timestamp, in nanoseconds since an arbitrary epoch.			*
+*  Remarks:		* Defined as static and inline to be included in object files.	*
+*				* Timestamps are only comparable within the same boot.			*
+********************************************************************************/
+static
+__inline
+ULONGLONG
+CLOCK_GetTimestamp(VOID)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER tFrequency = { 0 };
+	LARGE_INTEGER tCounter = { 0 };
+
+	// Cache the frequency (fixed at boot, so racing here is harmless)
+	if (0 == tFrequency.QuadPart)
+	{
+		(VOID)QueryPerformanceFrequency(&tFrequency);
+	}
+	(VOID)QueryPerformanceCounter(&tCounter);
+
+	// Split the conversion to avoid overflowing the multiplication
+	return (((ULONGLONG)tCounter.QuadPart / (ULONGLONG)tFrequency.QuadPart) * NANOSECONDS_IN_SECOND) +
+		((((ULONGLONG)tCounter.QuadPart % (ULONGLONG)tFrequency.QuadPart) * NANOSECONDS_IN_SECOND) / (ULONGLONG)tFrequency.QuadPart);
+#else	// _WIN32
+	struct timespec tNow = { 0 };
+
+	// Never fails for CLOCK_MONOTONIC
+	(VOID)clock_gettime(CLOCK_MONOTONIC, &tNow);
+	return ((ULONGLONG)tNow.tv_sec * NANOSECONDS_IN_SECOND) + (ULONGLONG)tNow.tv_nsec;
+#endif	// _WIN32
+}
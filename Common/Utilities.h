@@ -10,15 +10,85 @@
 #include <fltKernel.h>
 #include <ntddk.h>
 #include <wdm.h>
-#else					// _KERNEL_MODE
+#elif defined(_WIN32)	// _KERNEL_MODE
 #include <Windows.h>
 #include <process.h>
 #include <sal.h>
 #include <stdio.h>
 #include <strsafe.h>
 #include <initguid.h>
+#else					// _WIN32
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 #endif					// _KERNEL_MODE
 
+
+/** POSIX compatibility ********************************************************/
+
+/********************************************************************************
+*  Typedef:		<Windows base types>											*
+*  Purpose:		Windows base types for POSIX builds, so that portable modules	*
+*				can be shared with the Windows build as-is.						*
+********************************************************************************/
+#if !defined(_KERNEL_MODE) && !defined(_WIN32)
+#define VOID void
+typedef char CHAR, *PSTR;
+typedef const char *PCSTR;
+typedef unsigned char UCHAR, *PUCHAR;
+typedef uint8_t BYTE, *PBYTE;
+typedef uint8_t BOOLEAN;
+typedef int16_t SHORT;
+typedef uint16_t WORD, USHORT, *PWORD;
+typedef int32_t INT, LONG, BOOL, *PINT, *PLONG, *PBOOL;
+typedef uint32_t UINT, ULONG, DWORD, *PULONG, *PDWORD;
+typedef long long LONGLONG, LONG64;
+typedef unsigned long long ULONGLONG, ULONG64, *PULONGLONG;
+typedef size_t SIZE_T, *PSIZE_T;
+typedef void *PVOID, *HANDLE;
+typedef const void *PCVOID;
+#endif	// !_KERNEL_MODE && !_WIN32
+
+/********************************************************************************
+*  Macro:		<Windows compatibility>											*
+*  Purpose:		Windows keywords, SAL annotations and routines for POSIX		*
+*				builds.															*
+*  Remarks:		* SAL annotations are documentation only on POSIX builds.		*
+********************************************************************************/
+#if !defined(_KERNEL_MODE) && !defined(_WIN32)
+#define TRUE (1)
+#define FALSE (0)
+#define WINAPI
+#define UNREFERENCED_PARAMETER(pvParam)		((VOID)(pvParam))
+#define RtlZeroMemory(pvMem, cbBytes)		((VOID)memset((pvMem), 0, (cbBytes)))
+#define RtlCopyMemory(pvDst, pvSrc, cbBytes)	((VOID)memcpy((pvDst), (pvSrc), (cbBytes)))
+#define DebugBreak()						__builtin_trap()
+#define __in
+#define __in_opt
+#define __in_z
+#define __in_z_opt
+#define __in_ecount(n)
+#define __in_ecount_opt(n)
+#define __in_bcount(n)
+#define __in_bcount_opt(n)
+#define __out
+#define __out_opt
+#define __out_ecount(n)
+#define __out_bcount(n)
+#define __out_bcount_opt(n)
+#define __inout
+#define __inout_opt
+#define __inout_ecount(n)
+#define __inout_bcount(n)
+#define __inout_bcount_opt(n)
+#define __notnull
+#endif	// !_KERNEL_MODE && !_WIN32
+
+
 /** Typedefs *******************************************************************/
 
 /********************************************************************************
@@ -33,6 +103,37 @@ typedef enum
 	LOG_SEV_CRITICAL
 } LOG_SEV, *PLOG_SEV;
 
+#if defined(_BINARY_LOG) && !defined(_KERNEL_MODE)
+/********************************************************************************
+*  Constant:	LOG_SITE_MAX_ARGS												*
+*  Purpose:		Maximum number of format arguments of a binary log call site.	*
+********************************************************************************/
+#define LOG_SITE_MAX_ARGS (12)
+
+/********************************************************************************
+*  Structure:	LOG_SITE														*
+*  Purpose:		A binary log call site (one static instance per DEBUG_MSG).		*
+*  Remarks:		* The format is parsed once, on the site's first use.			*
+*				* DEBUG_MSG tests nIsEnabled before anything else, so a			*
+*					disabled site costs a single branch. Sites start enabled,	*
+*					so that their first use registers them (see					*
+*					LOG_CONTROL_DEFAULT_PATH).									*
+*				* See Log/BinaryLog.h.											*
+********************************************************************************/
+typedef struct _LOG_SITE
+{
+	volatile LONG nIsEnabled;						// Whether the site is logged
+	volatile LONG nId;								// 0 until registered, -1 while registering
+	LOG_SEV eSev;									// Severity
+	PCSTR pszFormat;								// printf format
+	PCSTR pszFunction;								// Calling function
+	DWORD dwLine;									// Source line
+	BYTE cArgs;										// Number of arguments
+	BYTE abArgTypes[LOG_SITE_MAX_ARGS];				// LOG_ARG_TYPE per argument
+} LOG_SITE, *PLOG_SITE;
+typedef const LOG_SITE *PCLOG_SITE;
+#endif	// _BINARY_LOG && !_KERNEL_MODE
+
 
 /********************************************************************************
 *  Typedef:		RETSTATUS														*
@@ -77,6 +178,13 @@ typedef UINT (WINAPI *PFN_THREAD_ROUTINE)(
 
 
 
+/********************************************************************************
+*  Constant:	CACHE_LINE_SIZE													*
+*  Purpose:		The CPU cache line size in bytes, used for padding shared data.	*
+********************************************************************************/
+#define CACHE_LINE_SIZE (64)
+
+
 /********************************************************************************
 *  Constant:	MILISECONDS_IN_SECOND											*
 *  Purpose:		The number of miliseconds in a second.							*
@@ -174,23 +282,51 @@ typedef UINT (WINAPI *PFN_THREAD_ROUTINE)(
 *  Parameters:	@ eSev ~[in]~ The severity.										*
 *				@ pszFormat ~[in]~ The format string to log.					*
 *				@ <ellipsis> ~[in]~ Format string arguments.					*
-*  Remarks:		* If _DEBUG_MSGS is not defined, this does nothing.				*
-********************************************************************************/
-#ifdef _DEBUG_MSGS
+*  Remarks:		* If _BINARY_LOG is defined, this writes a binary log record	*
+*					(in any build, see Log/BinaryLog.h), unless the call site	*
+*					is disabled. Its arguments are then not evaluated.			*
+*				* Otherwise, if _DEBUG_MSGS is not defined, this does nothing.	*
+********************************************************************************/
+#if defined(_BINARY_LOG) && !defined(_KERNEL_MODE)
+#ifdef _MSC_VER
+#define DEBUG_MSG(eSev, pszFormat, ...)		FORCE_SEMICOLON_START																			\
+											static LOG_SITE s_tLogSite = { TRUE, 0, (eSev), pszFormat, __FUNCTION__, __LINE__, 0, { 0 } };	\
+											if (0 != s_tLogSite.nIsEnabled)																	\
+											{																								\
+												LOG_Write(&s_tLogSite, __VA_ARGS__);														\
+											}																								\
+											FORCE_SEMICOLON_END
+#else		// _MSC_VER
+#define DEBUG_MSG(eSev, pszFormat, ...)		FORCE_SEMICOLON_START																			\
+											static LOG_SITE s_tLogSite = { TRUE, 0, (eSev), pszFormat, __FUNCTION__, __LINE__, 0, { 0 } };	\
+											if (0 != s_tLogSite.nIsEnabled)																	\
+											{																								\
+												LOG_Write(&s_tLogSite, ##__VA_ARGS__);														\
+											}																								\
+											FORCE_SEMICOLON_END
+#endif		// _MSC_VER
+#elif defined(_DEBUG_MSGS)	// _BINARY_LOG
+#ifdef _MSC_VER
 #define DEBUG_MSG(eSev, pszFormat, ...)		FORCE_SEMICOLON_START																\
 											(VOID)LOG_FUNC("[%d] %s: " ## pszFormat "\n", (eSev), __FUNCTION__, __VA_ARGS__);	\
 											FORCE_SEMICOLON_END
-#else		// _DEBUG_MSGS
+#else		// _MSC_VER
+#define DEBUG_MSG(eSev, pszFormat, ...)		FORCE_SEMICOLON_START																\
+											(VOID)LOG_FUNC("[%d] %s: " pszFormat "\n", (eSev), __FUNCTION__, ##__VA_ARGS__);	\
+											FORCE_SEMICOLON_END
+#endif		// _MSC_VER
+#else		// _BINARY_LOG
 #define DEBUG_MSG(eSev, pszFormat, ...)		FORCE_SEMICOLON_START														\
 											FORCE_SEMICOLON_END
-#endif		// _DEBUG_MSGS
+#endif		// _BINARY_LOG
 
 
 /********************************************************************************
 *  Macro:		DEBUG_ENTER														*
 *  Purpose:		Logs the function when entering.								*
 *  Remarks:		* If _DEBUG_MSGS is not defined, this does nothing.				*
-*				* Always given LOG_SEV_TRACE.									*
+*				* Always given LOG_SEV_TRACE. With _BINARY_LOG, it can be turned	*
+*					on at runtime (see LOG_CONTROL_DEFAULT_PATH).				*
 ********************************************************************************/
 #define DEBUG_ENTER()		DEBUG_MSG(LOG_SEV_TRACE, "entering.")
 
@@ -198,7 +334,8 @@ typedef UINT (WINAPI *PFN_THREAD_ROUTINE)(
 *  Macro:		DEBUG_LEAVE														*
 *  Purpose:		Logs the function when leaving.									*
 *  Remarks:		* If _DEBUG_MSGS is not defined, this does nothing.				*
-*				* Always given LOG_SEV_TRACE.									*
+*				* Always given LOG_SEV_TRACE. With _BINARY_LOG, it can be turned	*
+*					on at runtime (see LOG_CONTROL_DEFAULT_PATH).				*
 ********************************************************************************/
 #define DEBUG_LEAVE()		DEBUG_MSG(LOG_SEV_TRACE, "leaving.")
 
@@ -208,7 +345,8 @@ typedef UINT (WINAPI *PFN_THREAD_ROUTINE)(
 *  Purpose:		Logs the function when leaving with an NT status.				*
 *  Parameters:	@ eStatus ~[in]~ The status to log.								*
 *  Remarks:		* If _DEBUG_MSGS is not defined, this does nothing.				*
-*				* Always given LOG_SEV_TRACE.									*
+*				* Always given LOG_SEV_TRACE. With _BINARY_LOG, it can be turned	*
+*					on at runtime (see LOG_CONTROL_DEFAULT_PATH).				*
 ********************************************************************************/
 #define DEBUG_LEAVE_STATUS(eStatus)		DEBUG_MSG(LOG_SEV_TRACE, "leaving with status 0x%.8x.", (eStatus))
 
@@ -225,8 +363,13 @@ typedef UINT (WINAPI *PFN_THREAD_ROUTINE)(
 *				* Statuses are generated anew based on the source file. This	*
 *					means that editing versioned release files is prohibited.	*
 ********************************************************************************/
+#ifdef _MSC_VER
 #define DEBUG_RETMSG(eStatus, eSev, pszFormat, ...)		(eStatus);													\
 														DEBUG_MSG((eSev), pszFormat, __VA_ARGS__)
+#else		// _MSC_VER
+#define DEBUG_RETMSG(eStatus, eSev, pszFormat, ...)		(eStatus);													\
+														DEBUG_MSG((eSev), pszFormat, ##__VA_ARGS__)
+#endif		// _MSC_VER
 
 /********************************************************************************
 *  Macro:		DEBUG_GEN_FAIL_STATUS											*
@@ -290,6 +433,15 @@ typedef UINT (WINAPI *PFN_THREAD_ROUTINE)(
 #define CLOSE_FILE_HANDLE(hObject)				CLOSE_TO_VALUE((hObject), INVALID_HANDLE_VALUE, CloseHandle)
 #endif
 
+/********************************************************************************
+*  Macro:		CLOSE_FD														*
+*  Purpose:		Closes a POSIX file descriptor with a -1 default value.			*
+*  Parameters:	@ nFd ~[inout]~ The file descriptor variable.					*
+********************************************************************************/
+#if !defined(_KERNEL_MODE) && !defined(_WIN32)
+#define CLOSE_FD(nFd)							CLOSE_TO_VALUE((nFd), -1, close)
+#endif
+
 
 /********************************************************************************
 *  Macro:		SET_UNLESS_NULL													*
@@ -442,8 +594,10 @@ typedef UINT (WINAPI *PFN_THREAD_ROUTINE)(
 ********************************************************************************/
 #ifdef _KERNEL_MODE
 #define ALLOCZ(ePoolType, cbBytes)		(utilities_SafeMemZero(ExAllocatePoolWithTag((ePoolType), (cbBytes), (ALLOC_TAG)), (cbBytes)))
-#else	// _KERNEL_MODE
+#elif defined(_WIN32)	// _KERNEL_MODE
 #define ALLOCZ(cbBytes)					(HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, (cbBytes)))
+#else	// _WIN32
+#define ALLOCZ(cbBytes)					(calloc(1, (cbBytes)))
 #endif	// _KERNEL_MODE
 
 
@@ -462,7 +616,7 @@ typedef UINT (WINAPI *PFN_THREAD_ROUTINE)(
 										}														\
 										FORCE_SEMICOLON_END
 
-#else	// _KERNEL_MODE
+#elif defined(_WIN32)	// _KERNEL_MODE
 #define FREE(pvMem)						FORCE_SEMICOLON_START									\
 										if (NULL != (pvMem))									\
 										{														\
@@ -470,6 +624,49 @@ typedef UINT (WINAPI *PFN_THREAD_ROUTINE)(
 											(pvMem) = NULL;										\
 										}														\
 										FORCE_SEMICOLON_END
+#else	// _WIN32
+#define FREE(pvMem)						FORCE_SEMICOLON_START									\
+										if (NULL != (pvMem))									\
+										{														\
+											free(pvMem);										\
+											(pvMem) = NULL;										\
+										}														\
+										FORCE_SEMICOLON_END
+#endif	// _KERNEL_MODE
+
+
+/********************************************************************************
+*  Macro:		ALLOCZ_POOLED													*
+*  Purpose:		Allocates a blob from size-class pools, like ALLOCZ.			*
+*  Parameters:	@ ptClasses ~[inout]~ The POOL_CLASSES, owned by the caller's	*
+*				thread.															*
+*				@ cbBytes ~[in]~ Number of bytes to allocate.					*
+*  Returns:		A new memory blob on success, or NULL on failure.				*
+*  Remarks:		* User mode only, Pool/Pool.h must be included.					*
+*				* Blobs larger than POOL_MAX_CLASS_BYTES come from ALLOCZ.		*
+*				* Free with FREE_POOLED.										*
+********************************************************************************/
+#ifndef _KERNEL_MODE
+#define ALLOCZ_POOLED(ptClasses, cbBytes)	(POOL_AllocSized((ptClasses), (cbBytes)))
+#endif	// _KERNEL_MODE
+
+
+/********************************************************************************
+*  Macro:		FREE_POOLED														*
+*  Purpose:		Frees a blob from size-class pools.								*
+*  Parameters:	@ ptClasses ~[inout]~ The POOL_CLASSES it came from.			*
+*				@ pvMem ~[in]~ The memory to free.								*
+*				@ cbBytes ~[in]~ The size it was allocated with.				*
+*  Remarks:		* User mode only, Pool/Pool.h must be included.					*
+********************************************************************************/
+#ifndef _KERNEL_MODE
+#define FREE_POOLED(ptClasses, pvMem, cbBytes)	FORCE_SEMICOLON_START									\
+												if (NULL != (pvMem))									\
+												{														\
+													POOL_FreeSized((ptClasses), (pvMem), (cbBytes));	\
+													(pvMem) = NULL;										\
+												}														\
+												FORCE_SEMICOLON_END
 #endif	// _KERNEL_MODE
 
 
@@ -481,16 +678,158 @@ typedef UINT (WINAPI *PFN_THREAD_ROUTINE)(
 *				@ dwFlags ~[in]~ Can be either 0 or CREATE_SUSPENDED.			*
 *  Returns:		A handle to the created process.								*
 *  Remarks:		* Thread routine must be of type PFN_THREAD_ROUTINE.			*
+*				* CREATE_SUSPENDED is unsupported on POSIX (fails).				*
 ********************************************************************************/
-#ifndef _KERNEL_MODE
+#if defined(_WIN32) && !defined(_KERNEL_MODE)
 #define BEGIN_THREAD(pfnRoutine, pvArgs, dwFlags)		((HANDLE)(_beginthreadex(NULL, 0, (PFN_THREAD_ROUTINE)(pfnRoutine), (pvArgs), (dwFlags), NULL)))
-#endif	// _KERNEL_MODE
+#elif !defined(_KERNEL_MODE)	// _WIN32
+#define BEGIN_THREAD(pfnRoutine, pvArgs, dwFlags)		(utilities_BeginThread((PFN_THREAD_ROUTINE)(pfnRoutine), (pvArgs), (dwFlags)))
+#endif	// _WIN32
+
+
+/********************************************************************************
+*  Macro:		JOIN_THREAD														*
+*  Purpose:		Waits for a thread started with BEGIN_THREAD to exit, and		*
+*				closes its handle.												*
+*  Parameters:	@ hThread ~[inout]~ The thread handle variable (NULL after).	*
+********************************************************************************/
+#if defined(_WIN32) && !defined(_KERNEL_MODE)
+#define JOIN_THREAD(hThread)					FORCE_SEMICOLON_START								\
+												if (NULL != (hThread))								\
+												{													\
+													(VOID)WaitForSingleObject((hThread), INFINITE);	\
+													CLOSE_HANDLE(hThread);							\
+												}													\
+												FORCE_SEMICOLON_END
+#elif !defined(_KERNEL_MODE)	// _WIN32
+#define JOIN_THREAD(hThread)					CLOSE((hThread), utilities_JoinThread)
+#endif	// _WIN32
+
+
+/********************************************************************************
+*  Macro:		ATOMIC_LOAD_ACQUIRE												*
+*  Purpose:		Reads a 32-bit variable with acquire semantics (no later		*
+*				memory access moves before it).									*
+*  Parameters:	@ pnVar ~[in]~ Pointer to the (volatile LONG) variable.			*
+*  Returns:		The value.														*
+********************************************************************************/
+#ifdef _MSC_VER
+#if defined(_M_IX86) || defined(_M_X64)
+#define ATOMIC_LOAD_ACQUIRE(pnVar)				(utilities_LoadAcquire(pnVar))
+#else	// x86
+#define ATOMIC_LOAD_ACQUIRE(pnVar)				(InterlockedOr((pnVar), 0))
+#endif	// x86
+#else	// _MSC_VER
+#define ATOMIC_LOAD_ACQUIRE(pnVar)				(__atomic_load_n((pnVar), __ATOMIC_ACQUIRE))
+#endif	// _MSC_VER
+
+
+/********************************************************************************
+*  Macro:		ATOMIC_STORE_RELEASE											*
+*  Purpose:		Writes a 32-bit variable with release semantics (no earlier		*
+*				memory access moves after it).									*
+*  Parameters:	@ pnVar ~[out]~ Pointer to the (volatile LONG) variable.		*
+*				@ nValue ~[in]~ The value.										*
+********************************************************************************/
+#ifdef _MSC_VER
+#if defined(_M_IX86) || defined(_M_X64)
+#define ATOMIC_STORE_RELEASE(pnVar, nValue)		FORCE_SEMICOLON_START		\
+												_ReadWriteBarrier();		\
+												*(pnVar) = (nValue);		\
+												FORCE_SEMICOLON_END
+#else	// x86
+#define ATOMIC_STORE_RELEASE(pnVar, nValue)		((VOID)InterlockedExchange((pnVar), (nValue)))
+#endif	// x86
+#else	// _MSC_VER
+#define ATOMIC_STORE_RELEASE(pnVar, nValue)		(__atomic_store_n((pnVar), (nValue), __ATOMIC_RELEASE))
+#endif	// _MSC_VER
+
+
+/********************************************************************************
+*  Macro:		ATOMIC_LOAD_ACQUIRE_POINTER										*
+*  Purpose:		Reads a pointer variable with acquire semantics.				*
+*  Parameters:	@ ppvVar ~[in]~ Pointer to the (volatile) pointer variable.		*
+*  Returns:		The pointer.													*
+********************************************************************************/
+#ifdef _MSC_VER
+#define ATOMIC_LOAD_ACQUIRE_POINTER(ppvVar)		(InterlockedCompareExchangePointer((PVOID volatile *)(ppvVar), NULL, NULL))
+#else	// _MSC_VER
+#define ATOMIC_LOAD_ACQUIRE_POINTER(ppvVar)		(__atomic_load_n((ppvVar), __ATOMIC_ACQUIRE))
+#endif	// _MSC_VER
+
+
+/********************************************************************************
+*  Macro:		ATOMIC_STORE_RELEASE_POINTER									*
+*  Purpose:		Writes a pointer variable with release semantics.				*
+*  Parameters:	@ ppvVar ~[out]~ Pointer to the (volatile) pointer variable.	*
+*				@ pvValue ~[in]~ The pointer.									*
+********************************************************************************/
+#ifdef _MSC_VER
+#define ATOMIC_STORE_RELEASE_POINTER(ppvVar, pvValue)	((VOID)InterlockedExchangePointer((PVOID volatile *)(ppvVar), (pvValue)))
+#else	// _MSC_VER
+#define ATOMIC_STORE_RELEASE_POINTER(ppvVar, pvValue)	(__atomic_store_n((ppvVar), (pvValue), __ATOMIC_RELEASE))
+#endif	// _MSC_VER
+
+
+/********************************************************************************
+*  Macro:		ATOMIC_INCREMENT												*
+*  Purpose:		Atomically increments a 32-bit variable.						*
+*  Parameters:	@ pnVar ~[inout]~ Pointer to the (volatile LONG) variable.		*
+*  Returns:		The incremented value.											*
+********************************************************************************/
+#ifdef _MSC_VER
+#define ATOMIC_INCREMENT(pnVar)					(InterlockedIncrement(pnVar))
+#else	// _MSC_VER
+#define ATOMIC_INCREMENT(pnVar)					(__atomic_add_fetch((pnVar), 1, __ATOMIC_SEQ_CST))
+#endif	// _MSC_VER
+
+
+/********************************************************************************
+*  Macro:		ATOMIC_COMPARE_EXCHANGE											*
+*  Purpose:		Atomically replaces a 32-bit variable if it holds a given value.	*
+*  Parameters:	@ pnVar ~[inout]~ Pointer to the (volatile LONG) variable.		*
+*				@ nExchange ~[in]~ The new value.								*
+*				@ nComparand ~[in]~ The expected value.							*
+*  Returns:		The initial value (equal to nComparand on success).				*
+********************************************************************************/
+#ifdef _MSC_VER
+#define ATOMIC_COMPARE_EXCHANGE(pnVar, nExchange, nComparand)	(InterlockedCompareExchange((pnVar), (nExchange), (nComparand)))
+#else	// _MSC_VER
+#define ATOMIC_COMPARE_EXCHANGE(pnVar, nExchange, nComparand)	(__sync_val_compare_and_swap((pnVar), (nComparand), (nExchange)))
+#endif	// _MSC_VER
+
+
+/********************************************************************************
+*  Macro:		ATOMIC_FULL_BARRIER												*
+*  Purpose:		A full memory barrier (orders earlier stores before later		*
+*				loads, which acquire and release do not).						*
+********************************************************************************/
+#ifdef _MSC_VER
+#define ATOMIC_FULL_BARRIER()					MemoryBarrier()
+#else	// _MSC_VER
+#define ATOMIC_FULL_BARRIER()					__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif	// _MSC_VER
 
 
 
 
 /** Functions ******************************************************************/
 
+#if defined(_BINARY_LOG) && !defined(_KERNEL_MODE)
+/********************************************************************************
+*  Function:	LOG_Write														*
+*  Purpose:		Writes a binary log record for a call site.						*
+*  Parameters:	@ ptSite ~[inout]~ The call site.								*
+*				@ <ellipsis> ~[in]~ Format string arguments.					*
+*  Remarks:		* Use DEBUG_MSG. Implemented in Log/BinaryLog.c.				*
+********************************************************************************/
+VOID
+LOG_Write(
+	__inout PLOG_SITE ptSite,
+	...
+);
+#endif	// _BINARY_LOG && !_KERNEL_MODE
+
 /********************************************************************************
 *  Function:	utilities_SafeMemZero											*
 *  Purpose:		Safely zeros memory.											*
@@ -517,3 +856,117 @@ utilities_SafeMemZero(
 	// Return result
 	return pvMem;
 }
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+/********************************************************************************
+*  Function:	utilities_LoadAcquire											*
+*  Purpose:		Reads a 32-bit variable with acquire semantics on x86.			*
+*  Parameters:	@ pnVar ~[in]~ The variable.									*
+*  Returns:		The value.														*
+*  Remarks:		* x86 loads are acquires, only the compiler must be fenced.		*
+*				* Use ATOMIC_LOAD_ACQUIRE.										*
+********************************************************************************/
+static
+__inline
+LONG
+utilities_LoadAcquire(
+	__in volatile const LONG *pnVar
+)
+{
+	LONG nValue = *pnVar;
+
+	_ReadWriteBarrier();
+	return nValue;
+}
+#endif	// _MSC_VER && x86
+
+#if !defined(_KERNEL_MODE) && !defined(_WIN32)
+/********************************************************************************
+*  Structure:	UTILITIES_THREAD												*
+*  Purpose:		A POSIX thread started with BEGIN_THREAD.						*
+********************************************************************************/
+typedef struct _UTILITIES_THREAD
+{
+	pthread_t tThread;								// The thread
+	PFN_THREAD_ROUTINE pfnRoutine;					// The thread routine
+	PVOID pvParams;									// The thread routine parameters
+} UTILITIES_THREAD, *PUTILITIES_THREAD;
+
+/********************************************************************************
+*  Function:	utilities_ThreadTrampoline										*
+*  Purpose:		Adapts a PFN_THREAD_ROUTINE to a POSIX thread routine.			*
+*  Parameters:	@ pvThread ~[in]~ The UTILITIES_THREAD.							*
+*  Returns:		The routine's return value.										*
+********************************************************************************/
+static
+PVOID
+utilities_ThreadTrampoline(
+	__in PVOID pvThread
+)
+{
+	PUTILITIES_THREAD ptThread = (PUTILITIES_THREAD)pvThread;
+
+	return (PVOID)(SIZE_T)(ptThread->pfnRoutine(ptThread->pvParams));
+}
+
+/********************************************************************************
+*  Function:	utilities_BeginThread											*
+*  Purpose:		Starts a POSIX thread.											*
+*  Parameters:	@ pfnRoutine ~[in]~ The thread routine.							*
+*				@ pvParams ~[inout]~ Optional arguments (or NULL if unused).	*
+*				@ dwFlags ~[in]~ Must be 0 (CREATE_SUSPENDED is unsupported).	*
+*  Returns:		A thread handle, or NULL on failure.							*
+*  Remarks:		* Use BEGIN_THREAD, and JOIN_THREAD to free the handle.			*
+********************************************************************************/
+static
+__inline
+HANDLE
+utilities_BeginThread(
+	__in PFN_THREAD_ROUTINE pfnRoutine,
+	__inout_opt PVOID pvParams,
+	__in DWORD dwFlags
+)
+{
+	PUTILITIES_THREAD ptThread = NULL;
+
+	// Validations
+	if (0 != dwFlags)
+	{
+		return NULL;
+	}
+
+	// Start the thread
+	ptThread = (PUTILITIES_THREAD)ALLOCZ(sizeof(*ptThread));
+	if (NULL != ptThread)
+	{
+		ptThread->pfnRoutine = pfnRoutine;
+		ptThread->pvParams = pvParams;
+		if (0 != pthread_create(&(ptThread->tThread), NULL, utilities_ThreadTrampoline, ptThread))
+		{
+			FREE(ptThread);
+		}
+	}
+
+	// Return result
+	return ptThread;
+}
+
+/********************************************************************************
+*  Function:	utilities_JoinThread											*
+*  Purpose:		Waits for a POSIX thread to exit and frees its handle.			*
+*  Parameters:	@ hThread ~[in]~ The handle.									*
+*  Remarks:		* Use JOIN_THREAD.												*
+********************************************************************************/
+static
+__inline
+VOID
+utilities_JoinThread(
+	__in HANDLE hThread
+)
+{
+	PUTILITIES_THREAD ptThread = (PUTILITIES_THREAD)hThread;
+
+	(VOID)pthread_join(ptThread->tThread, NULL);
+	FREE(ptThread);
+}
+#endif	// !_KERNEL_MODE && !_WIN32
@@ -0,0 +1,302 @@
+/********************************************************************************
+*  File:		Decision.c														*
+*  Purpose:		Decides whether a device event calls for a lock.				*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#include "Decision.h"
+#include <time.h>
+#include <Clock.h>
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	DECISION_NANOSECONDS_IN_MINUTE									*
+*  Purpose:		Nanoseconds in a minute.										*
+********************************************************************************/
+#define DECISION_NANOSECONDS_IN_MINUTE (60 * NANOSECONDS_IN_SECOND)
+
+/********************************************************************************
+*  Constant:	DECISION_NANOSECONDS_IN_DAY										*
+*  Purpose:		Nanoseconds in a day.											*
+********************************************************************************/
+#define DECISION_NANOSECONDS_IN_DAY (RULES_MINUTES_PER_DAY * DECISION_NANOSECONDS_IN_MINUTE)
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	decision_GetMinuteOfDay											*
+*  Purpose:		Gets the local time of day of an event, for rules.				*
+*  Parameters:	@ ptDecision ~[in]~ The decision state.							*
+*				@ qwTimestamp ~[in]~ The event time.							*
+*  Returns:		The minute of the day.											*
+*  Remarks:		* Never reads the wall clock, so replays are deterministic.		*
+********************************************************************************/
+static
+DWORD
+decision_GetMinuteOfDay(
+	__in const DECISION *ptDecision,
+	__in ULONGLONG qwTimestamp
+)
+{
+	// Return result
+	return (DWORD)((((qwTimestamp % DECISION_NANOSECONDS_IN_DAY) + ptDecision->qwClockOffset) % DECISION_NANOSECONDS_IN_DAY) /
+		DECISION_NANOSECONDS_IN_MINUTE);
+}
+
+/********************************************************************************
+*  Function:	DECISION_GetClockOffset											*
+********************************************************************************/
+ULONGLONG
+DECISION_GetClockOffset(VOID)
+{
+	time_t tNow = 0;
+	struct tm tLocal = { 0 };
+	ULONGLONG qwTimestamp = 0;
+	ULONGLONG qwTimeOfDay = 0;
+
+	qwTimestamp = CLOCK_GetTimestamp();
+	tNow = time(NULL);
+#ifdef _WIN32
+	(VOID)localtime_s(&tLocal, &tNow);
+#else	// _WIN32
+	(VOID)localtime_r(&tNow, &tLocal);
+#endif	// _WIN32
+	qwTimeOfDay = ((((ULONGLONG)tLocal.tm_hour * 60) + (ULONGLONG)tLocal.tm_min) * DECISION_NANOSECONDS_IN_MINUTE) +
+		((ULONGLONG)MIN(tLocal.tm_sec, 59) * NANOSECONDS_IN_SECOND);
+
+	// Return result
+	return (qwTimeOfDay + DECISION_NANOSECONDS_IN_DAY - (qwTimestamp % DECISION_NANOSECONDS_IN_DAY)) % DECISION_NANOSECONDS_IN_DAY;
+}
+
+/********************************************************************************
+*  Function:	DECISION_SetClockOffset											*
+********************************************************************************/
+BOOL
+DECISION_SetClockOffset(
+	__inout PDECISION ptDecision,
+	__in ULONGLONG qwClockOffset
+)
+{
+	ULONGLONG qwDrift = 0;
+
+	// Validations
+	ASSERT(NULL != ptDecision);
+	ASSERT(DECISION_NANOSECONDS_IN_DAY > qwClockOffset);
+
+	// Readings of an unchanged clock differ by up to a second, either way
+	qwDrift = (qwClockOffset + DECISION_NANOSECONDS_IN_DAY - ptDecision->qwClockOffset) % DECISION_NANOSECONDS_IN_DAY;
+	if ((NANOSECONDS_IN_SECOND >= qwDrift) || (DECISION_NANOSECONDS_IN_DAY - NANOSECONDS_IN_SECOND <= qwDrift))
+	{
+		return FALSE;
+	}
+	ptDecision->qwClockOffset = qwClockOffset;
+	return TRUE;
+}
+
+/********************************************************************************
+*  Function:	DECISION_Initialize												*
+********************************************************************************/
+VOID
+DECISION_Initialize(
+	__in_opt PCALLOWLIST ptAllowlist,
+	__in_opt PCSIGNATURE_SET ptSignatures,
+	__inout_opt PPOLICY ptPolicy,
+	__in DWORD dwPolicyReader,
+	__in BOOL bDeliversKeystrokes,
+	__in ULONGLONG qwClockOffset,
+	__out PDECISION ptDecision
+)
+{
+	// Validations
+	ASSERT(NULL != ptDecision);
+	ASSERT(POLICY_STATS_READER > dwPolicyReader);
+	ASSERT(DECISION_NANOSECONDS_IN_DAY > qwClockOffset);
+
+	RtlZeroMemory(ptDecision, sizeof(*ptDecision));
+	ptDecision->ptAllowlist = ptAllowlist;
+	ptDecision->ptSignatures = ptSignatures;
+	ptDecision->ptPolicy = ptPolicy;
+	ptDecision->dwPolicyReader = dwPolicyReader;
+	ptDecision->bDeliversKeystrokes = bDeliversKeystrokes;
+	ptDecision->qwClockOffset = qwClockOffset;
+}
+
+/********************************************************************************
+*  Function:	DECISION_Finalize												*
+********************************************************************************/
+VOID
+DECISION_Finalize(
+	__inout PDECISION ptDecision
+)
+{
+	// Validations
+	ASSERT(NULL != ptDecision);
+
+	// Free resources
+	CADENCE_Finalize(&(ptDecision->tCadence));
+	RtlZeroMemory(ptDecision, sizeof(*ptDecision));
+}
+
+/********************************************************************************
+*  Function:	DECISION_Decide													*
+********************************************************************************/
+BOOL
+DECISION_Decide(
+	__inout PDECISION ptDecision,
+	__in PCEVENTSOURCE_EVENT ptEvent,
+	__out_opt PBOOL pbShouldAlert,
+	__out_opt PBOOL pbIsHostile,
+	__out_opt PCADENCE_VERDICT peVerdict
+)
+{
+	BOOL bShouldLock = FALSE;
+	BOOL bShouldAlert = FALSE;
+	BOOL bIsHostile = FALSE;
+	BOOL bIsApproved = FALSE;
+	CADENCE_VERDICT eVerdict = CADENCE_VERDICT_PENDING;
+	CADENCE_SCORE tScore = { 0 };
+	RULES_INPUT tInput = { 0 };
+	RULES_ACTION eAction = RULES_ACTION_NONE;
+	DWORD dwLine = 0;
+	DWORD dwSignature = 0;
+	PCPOLICY_VIEW ptView = NULL;
+
+	// Repeated arrivals of a device in the same burst (one per interface) were already decided
+	if ((EVENTSOURCE_EVENT_TYPE_ARRIVAL == ptEvent->eType) && (!COALESCE_OnArrival(&(ptDecision->tCoalescer), ptEvent)))
+	{
+		goto lblCleanup;
+	}
+
+	// Approved devices never lock, whether listed locally or by the policy
+	bIsApproved = (NULL != ptDecision->ptAllowlist) && ALLOWLIST_Contains(ptDecision->ptAllowlist, &(ptEvent->tIdentity));
+	if ((!bIsApproved) && (NULL != ptDecision->ptPolicy))
+	{
+		ptView = POLICY_Enter(ptDecision->ptPolicy, ptDecision->dwPolicyReader);
+		bIsApproved = (NULL != ptView) && ALLOWLIST_Contains(&(ptView->tAllowlist), &(ptEvent->tIdentity));
+	}
+	if (bIsApproved)
+	{
+		eVerdict = CADENCE_VERDICT_HUMAN;
+		goto lblCleanup;
+	}
+
+	// Judge keystrokes first, rules may match on the verdict
+	if (EVENTSOURCE_EVENT_TYPE_KEY == ptEvent->eType)
+	{
+		eVerdict = CADENCE_OnKey(&(ptDecision->tCadence),
+			ptEvent->qwDeviceId,
+			ptEvent->qwTimestamp,
+			ptEvent->wScanCode,
+			ptEvent->bIsKeyDown,
+			&tScore);
+		if (NULL != ptDecision->ptSignatures)
+		{
+			dwSignature = SIGNATURE_OnKey(ptDecision->ptSignatures,
+				&(ptDecision->tSignatureStreams),
+				ptEvent->qwDeviceId,
+				ptEvent->qwTimestamp,
+				ptEvent->wScanCode,
+				ptEvent->bIsKeyDown);
+		}
+	}
+
+	// A typed payload makes the device hostile, whatever the rules decide for the session
+	if (0 != dwSignature)
+	{
+		DEBUG_MSG(LOG_SEV_INFO,
+			"Payload signature %lu typed on device 0x%llx.",
+			(unsigned long)dwSignature,
+			ptEvent->qwDeviceId);
+		bIsHostile = TRUE;
+	}
+
+	// The first matching policy rule decides
+	if ((NULL != ptView) && (NULL != ptView->tRules.ptHeader))
+	{
+		tInput.ptEvent = ptEvent;
+		tInput.eVerdict = eVerdict;
+		tInput.eSession = RULES_SESSION_UNKNOWN;
+		tInput.dwMinuteOfDay = decision_GetMinuteOfDay(ptDecision, ptEvent->qwTimestamp);
+		eAction = RULES_Evaluate(&(ptView->tRules), &tInput, &dwLine);
+	}
+	switch (eAction)
+	{
+	case RULES_ACTION_ALLOW:
+
+		// Nothing to do
+		break;
+
+	case RULES_ACTION_LOCK:
+
+		DEBUG_MSG(LOG_SEV_INFO,
+			"Rule on line %lu calls for a lock (event %d, device 0x%llx).",
+			(unsigned long)dwLine,
+			(INT)ptEvent->eType,
+			ptEvent->qwDeviceId);
+		bShouldLock = TRUE;
+		break;
+
+	case RULES_ACTION_ALERT:
+
+		DEBUG_MSG(LOG_SEV_INFO,
+			"Rule on line %lu raised an alert (event %d, device 0x%llx).",
+			(unsigned long)dwLine,
+			(INT)ptEvent->eType,
+			ptEvent->qwDeviceId);
+		bShouldAlert = TRUE;
+		break;
+
+	default:
+
+		// Built-in reactions: injection cadence, payloads, and keyboards that cannot be judged by their keystrokes
+		if (CADENCE_VERDICT_INJECTION == eVerdict)
+		{
+			DEBUG_MSG(LOG_SEV_INFO,
+				"Injection cadence on device 0x%llx (mean=%llu us, variance=%llu us^2).",
+				ptEvent->qwDeviceId,
+				tScore.qwMeanUs,
+				tScore.qwVarianceUs2);
+			bShouldLock = TRUE;
+		}
+		bShouldLock = bShouldLock ||
+			(bIsHostile) ||
+			((EVENTSOURCE_EVENT_TYPE_ARRIVAL == ptEvent->eType) &&
+			(EVENTSOURCE_DEVICE_CLASS_KEYBOARD == ptEvent->eClass) &&
+			(!ptDecision->bDeliversKeystrokes));
+		break;
+	}
+
+	// The session is already being locked by this burst (the device is hostile all the same)
+	bIsHostile = bIsHostile || bShouldLock;
+	if (bShouldLock)
+	{
+		bShouldLock = COALESCE_OnLock(&(ptDecision->tCoalescer), ptEvent->qwTimestamp);
+	}
+
+lblCleanup:
+
+	// Free resources
+	if (NULL != ptDecision->ptPolicy)
+	{
+		POLICY_Leave(ptDecision->ptPolicy, ptDecision->dwPolicyReader);
+	}
+
+	// Return result
+	if (NULL != pbShouldAlert)
+	{
+		*pbShouldAlert = bShouldAlert;
+	}
+	if (NULL != pbIsHostile)
+	{
+		*pbIsHostile = bIsHostile;
+	}
+	if (NULL != peVerdict)
+	{
+		*peVerdict = eVerdict;
+	}
+	return bShouldLock;
+}
@@ -0,0 +1,147 @@
+/********************************************************************************
+*  File:		Decision.h														*
+*  Purpose:		Decides whether a device event calls for a lock.				*
+********************************************************************************/
+#pragma once
+
+
+/** Includes *******************************************************************/
+#include <Utilities.h>
+#include "../Allowlist/Allowlist.h"
+#include "../Cadence/Cadence.h"
+#include "../Coalesce/Coalesce.h"
+#include "../EventSource/EventSource.h"
+#include "../Policy/Policy.h"
+#include "../Rules/Rules.h"
+#include "../Signature/Signature.h"
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Structure:	DECISION														*
+*  Purpose:		The decision state: approvals, policy rules, per-device cadence,	*
+*				payload signatures and arrival coalescing.						*
+*  Remarks:		* Only used from a single thread.								*
+*				* The detector judges keystrokes by their event timestamps, so	*
+*					whoever delivers the events also drives its clock.			*
+*				* Rules see the local time of day of the event times, through	*
+*					a clock offset its owner keeps up to date (see				*
+*					DECISION_SetClockOffset), so replays see the time of the	*
+*					recording.													*
+********************************************************************************/
+typedef struct _DECISION
+{
+	CADENCE_TABLE tCadence;							// Per-device keystroke cadence
+	COALESCER tCoalescer;							// Arrival and lock bursts
+	PCALLOWLIST ptAllowlist;						// Locally approved devices, or NULL
+	PCSIGNATURE_SET ptSignatures;					// Payload signatures, or NULL
+	SIGNATURE_STREAMS tSignatureStreams;			// Per-device typed text
+	PPOLICY ptPolicy;								// Hot-reloaded policy, or NULL
+	DWORD dwPolicyReader;							// Reader index into the policy
+	BOOL bDeliversKeystrokes;						// Whether the source delivers key events
+	ULONGLONG qwClockOffset;						// Turns event times into the local time of day
+} DECISION, *PDECISION;
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	DECISION_GetClockOffset											*
+*  Purpose:		Reads the wall clock, for the local time of day of event times.	*
+*  Returns:		What to add to a timestamp (CLOCK_GetTimestamp), modulo a		*
+*				day, to get the nanoseconds since local midnight.				*
+*  Remarks:		* The time zone and daylight saving time are those of the		*
+*					call, and CLOCK_GetTimestamp stops during a suspend, so the	*
+*					offset must be read again once in a while.					*
+*				* Precise to the second, as is the wall clock read.				*
+********************************************************************************/
+ULONGLONG
+DECISION_GetClockOffset(VOID);
+
+/********************************************************************************
+*  Function:	DECISION_SetClockOffset											*
+*  Purpose:		Follows a new reading of the wall clock.						*
+*  Parameters:	@ ptDecision ~[inout]~ The decision state.						*
+*				@ qwClockOffset ~[in]~ The new clock offset (see				*
+*				DECISION_GetClockOffset).										*
+*  Returns:		TRUE if the offset moved, FALSE if the new one is within a		*
+*				second of it (and dropped).										*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+********************************************************************************/
+BOOL
+DECISION_SetClockOffset(
+	__inout PDECISION ptDecision,
+	__in ULONGLONG qwClockOffset
+);
+
+/********************************************************************************
+*  Function:	DECISION_Initialize												*
+*  Purpose:		Initializes the decision state.									*
+*  Parameters:	@ ptAllowlist ~[in_opt]~ Locally approved devices, or NULL.		*
+*				@ ptSignatures ~[in_opt]~ Payload signatures, or NULL.			*
+*				@ ptPolicy ~[inout_opt]~ The policy, or NULL.					*
+*				@ dwPolicyReader ~[in]~ The calling thread's policy reader		*
+*				index.															*
+*				@ bDeliversKeystrokes ~[in]~ Whether the event source delivers	*
+*				key events.														*
+*				@ qwClockOffset ~[in]~ Turns event times into the local time	*
+*				of day (see DECISION_GetClockOffset), 0 for midnight at 0.		*
+*				@ ptDecision ~[out]~ Gets the decision state.					*
+*  Remarks:		* Free with DECISION_Finalize.									*
+********************************************************************************/
+VOID
+DECISION_Initialize(
+	__in_opt PCALLOWLIST ptAllowlist,
+	__in_opt PCSIGNATURE_SET ptSignatures,
+	__inout_opt PPOLICY ptPolicy,
+	__in DWORD dwPolicyReader,
+	__in BOOL bDeliversKeystrokes,
+	__in ULONGLONG qwClockOffset,
+	__out PDECISION ptDecision
+);
+
+/********************************************************************************
+*  Function:	DECISION_Finalize												*
+*  Purpose:		Frees the decision state.										*
+*  Parameters:	@ ptDecision ~[inout]~ The decision state.						*
+********************************************************************************/
+VOID
+DECISION_Finalize(
+	__inout PDECISION ptDecision
+);
+
+/********************************************************************************
+*  Function:	DECISION_Decide													*
+*  Purpose:		Decides whether a device event calls for a lock.				*
+*  Parameters:	@ ptDecision ~[inout]~ The decision state.						*
+*				@ ptEvent ~[in]~ The event.										*
+*				@ pbShouldAlert ~[out_opt]~ Optional, gets whether a policy		*
+*				rule raised an alert.											*
+*				@ pbIsHostile ~[out_opt]~ Optional, gets whether the event		*
+*				called for a lock, folded or not, or typed a payload (its		*
+*				device acts hostile).											*
+*				@ peVerdict ~[out_opt]~ Optional, gets the cadence verdict of	*
+*				a key event (HUMAN for approved devices, which are trusted).	*
+*  Returns:		TRUE if the session should be locked.							*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+*				* Approved devices never lock. Then the first policy rule that	*
+*					matches decides, and without one the built-in reactions		*
+*					do: injection cadence, payloads, and keyboard arrivals		*
+*					when the source does not deliver keystrokes.				*
+*				* A payload makes the device hostile even when a rule			*
+*					spares the session the lock.								*
+*				* Returns TRUE once per burst: repeated arrivals of a device are	*
+*					not decided again, and locks called for shortly after a		*
+*					lock are folded into it (see Coalesce.h). Folding only		*
+*					spares the session another lock, so the device is still		*
+*					reported hostile.											*
+********************************************************************************/
+BOOL
+DECISION_Decide(
+	__inout PDECISION ptDecision,
+	__in PCEVENTSOURCE_EVENT ptEvent,
+	__out_opt PBOOL pbShouldAlert,
+	__out_opt PBOOL pbIsHostile,
+	__out_opt PCADENCE_VERDICT peVerdict
+);
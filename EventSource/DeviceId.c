@@ -0,0 +1,266 @@
+/********************************************************************************
+*  File:		DeviceId.c														*
+*  Purpose:		Device identity (VID, PID and serial or instance) parsing.		*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#include <ctype.h>
+#include "DeviceId.h"
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	DEVICEID_FNV_OFFSET_BASIS										*
+*  Purpose:		64-bit FNV-1a offset basis.										*
+********************************************************************************/
+#define DEVICEID_FNV_OFFSET_BASIS (0xCBF29CE484222325ULL)
+
+/********************************************************************************
+*  Constant:	DEVICEID_FNV_PRIME												*
+*  Purpose:		64-bit FNV-1a prime.											*
+********************************************************************************/
+#define DEVICEID_FNV_PRIME (0x100000001B3ULL)
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	deviceid_ParseHexWord											*
+*  Purpose:		Parses 1 to 4 hexadecimal digits.								*
+*  Parameters:	@ pszText ~[in]~ The digits.									*
+*				@ ppszEnd ~[out]~ Gets the position after the digits.			*
+*				@ pwValue ~[out]~ Gets the value.								*
+*  Returns:		TRUE if there was at least one digit, and at most four.			*
+********************************************************************************/
+static
+BOOL
+deviceid_ParseHexWord(
+	__in_z PCSTR pszText,
+	__out PCSTR *ppszEnd,
+	__out PWORD pwValue
+)
+{
+	ULONG dwValue = 0;
+	ULONG cchDigits = 0;
+	CHAR cDigit = '\0';
+
+	for (;; pszText++, cchDigits++)
+	{
+		cDigit = (CHAR)tolower((UCHAR)*pszText);
+		if (('0' <= cDigit) && ('9' >= cDigit))
+		{
+			dwValue = (dwValue * HEXADECIMAL_BASE) + (ULONG)(cDigit - '0');
+		}
+		else if (('a' <= cDigit) && ('f' >= cDigit))
+		{
+			dwValue = (dwValue * HEXADECIMAL_BASE) + (ULONG)(cDigit - 'a' + 10);
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	*ppszEnd = pszText;
+	*pwValue = (WORD)dwValue;
+	return (0 < cchDigits) && (4 >= cchDigits);
+}
+
+/********************************************************************************
+*  Function:	deviceid_SetInstance											*
+*  Purpose:		Copies an instance in upper case, up to a terminator.			*
+*  Parameters:	@ ptId ~[inout]~ The identity.									*
+*				@ pszInstance ~[in]~ The instance.								*
+*				@ cTerminator ~[in]~ Ends the instance (as does NUL).			*
+********************************************************************************/
+static
+VOID
+deviceid_SetInstance(
+	__inout PDEVICEID ptId,
+	__in_z PCSTR pszInstance,
+	__in CHAR cTerminator
+)
+{
+	ULONG cchInstance = 0;
+
+	for (cchInstance = 0;
+		('\0' != pszInstance[cchInstance]) && (cTerminator != pszInstance[cchInstance]) &&
+		(cchInstance < sizeof(ptId->szInstance) - 1);
+		cchInstance++)
+	{
+		ptId->szInstance[cchInstance] = (CHAR)toupper((UCHAR)pszInstance[cchInstance]);
+	}
+	ptId->szInstance[cchInstance] = '\0';
+}
+
+/********************************************************************************
+*  Function:	DEVICEID_ParseInterfaceName										*
+********************************************************************************/
+BOOL
+DEVICEID_ParseInterfaceName(
+	__in_z PCSTR pszName,
+	__out PDEVICEID ptId
+)
+{
+	PCSTR pszCurrent = NULL;
+	PCSTR pszEnd = NULL;
+
+	// Validations
+	ASSERT(NULL != pszName);
+	ASSERT(NULL != ptId);
+
+	RtlZeroMemory(ptId, sizeof(*ptId));
+
+	// "<prefix>#VID_xxxx&PID_xxxx[&...]#<instance>#{<class GUID>}"
+	pszCurrent = strchr(pszName, '#');
+	if ((NULL == pszCurrent) || ((0 != strncmp(pszCurrent + 1, "VID_", 4)) && (0 != strncmp(pszCurrent + 1, "vid_", 4))))
+	{
+		return FALSE;
+	}
+	if (!deviceid_ParseHexWord(pszCurrent + 5, &pszEnd, &(ptId->wVendorId)))
+	{
+		return FALSE;
+	}
+	if ((0 != strncmp(pszEnd, "&PID_", 5)) && (0 != strncmp(pszEnd, "&pid_", 5)))
+	{
+		return FALSE;
+	}
+	if (!deviceid_ParseHexWord(pszEnd + 5, &pszEnd, &(ptId->wProductId)))
+	{
+		return FALSE;
+	}
+
+	// The instance is the next segment
+	pszCurrent = strchr(pszEnd, '#');
+	if (NULL != pszCurrent)
+	{
+		deviceid_SetInstance(ptId, pszCurrent + 1, '#');
+	}
+
+	// Success
+	ptId->bIsValid = TRUE;
+	return TRUE;
+}
+
+/********************************************************************************
+*  Function:	DEVICEID_ParseInputProduct										*
+********************************************************************************/
+BOOL
+DEVICEID_ParseInputProduct(
+	__in_z PCSTR pszProduct,
+	__in_z_opt PCSTR pszUniq,
+	__out PDEVICEID ptId
+)
+{
+	WORD wBus = 0;
+	PCSTR pszEnd = NULL;
+
+	// Validations
+	ASSERT(NULL != pszProduct);
+	ASSERT(NULL != ptId);
+
+	RtlZeroMemory(ptId, sizeof(*ptId));
+
+	// "bus/vendor/product/version"
+	if ((!deviceid_ParseHexWord(pszProduct, &pszEnd, &wBus)) || ('/' != *pszEnd) ||
+		(!deviceid_ParseHexWord(pszEnd + 1, &pszEnd, &(ptId->wVendorId))) || ('/' != *pszEnd) ||
+		(!deviceid_ParseHexWord(pszEnd + 1, &pszEnd, &(ptId->wProductId))))
+	{
+		return FALSE;
+	}
+	if (NULL != pszUniq)
+	{
+		if ('"' == *pszUniq)
+		{
+			deviceid_SetInstance(ptId, pszUniq + 1, '"');
+		}
+		else
+		{
+			deviceid_SetInstance(ptId, pszUniq, '\0');
+		}
+	}
+
+	// Success
+	ptId->bIsValid = TRUE;
+	return TRUE;
+}
+
+/********************************************************************************
+*  Function:	DEVICEID_ParseText												*
+********************************************************************************/
+BOOL
+DEVICEID_ParseText(
+	__in_z PCSTR pszText,
+	__out PDEVICEID ptId
+)
+{
+	PCSTR pszEnd = NULL;
+	ULONG cchInstance = 0;
+
+	// Validations
+	ASSERT(NULL != pszText);
+	ASSERT(NULL != ptId);
+
+	RtlZeroMemory(ptId, sizeof(*ptId));
+
+	// "VVVV:PPPP:INSTANCE"
+	while (isspace((UCHAR)*pszText))
+	{
+		pszText++;
+	}
+	if ((!deviceid_ParseHexWord(pszText, &pszEnd, &(ptId->wVendorId))) || (':' != *pszEnd) ||
+		(!deviceid_ParseHexWord(pszEnd + 1, &pszEnd, &(ptId->wProductId))) || (':' != *pszEnd))
+	{
+		return FALSE;
+	}
+	deviceid_SetInstance(ptId, pszEnd + 1, '\0');
+
+	// Trim trailing white space (line endings)
+	cchInstance = (ULONG)strlen(ptId->szInstance);
+	while ((0 < cchInstance) && isspace((UCHAR)ptId->szInstance[cchInstance - 1]))
+	{
+		ptId->szInstance[--cchInstance] = '\0';
+	}
+
+	// Success
+	ptId->bIsValid = TRUE;
+	return TRUE;
+}
+
+/********************************************************************************
+*  Function:	DEVICEID_GetFingerprint											*
+********************************************************************************/
+ULONGLONG
+DEVICEID_GetFingerprint(
+	__in PCDEVICEID ptId
+)
+{
+	ULONGLONG qwHash = DEVICEID_FNV_OFFSET_BASIS;
+	PCSTR pszInstance = NULL;
+
+	// Validations
+	ASSERT(NULL != ptId);
+	ASSERT(ptId->bIsValid);
+
+	// FNV-1a over the IDs (little endian) and the instance
+	qwHash = (qwHash ^ (ptId->wVendorId & 0xFF)) * DEVICEID_FNV_PRIME;
+	qwHash = (qwHash ^ (ptId->wVendorId >> 8)) * DEVICEID_FNV_PRIME;
+	qwHash = (qwHash ^ (ptId->wProductId & 0xFF)) * DEVICEID_FNV_PRIME;
+	qwHash = (qwHash ^ (ptId->wProductId >> 8)) * DEVICEID_FNV_PRIME;
+	for (pszInstance = ptId->szInstance; '\0' != *pszInstance; pszInstance++)
+	{
+		qwHash = (qwHash ^ (UCHAR)*pszInstance) * DEVICEID_FNV_PRIME;
+	}
+
+	// Mix so the low bits can index tables directly (splitmix64 finalizer)
+	qwHash ^= qwHash >> 30;
+	qwHash *= 0xBF58476D1CE4E5B9ULL;
+	qwHash ^= qwHash >> 27;
+	qwHash *= 0x94D049BB133111EBULL;
+	qwHash ^= qwHash >> 31;
+
+	// Zero marks empty slots
+	return (0 == qwHash) ? 1 : qwHash;
+}
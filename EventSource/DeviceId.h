@@ -0,0 +1,102 @@
+/********************************************************************************
+*  File:		DeviceId.h														*
+*  Purpose:		Device identity (VID, PID and serial or instance) parsing.		*
+********************************************************************************/
+#pragma once
+
+
+/** Includes *******************************************************************/
+#include <Utilities.h>
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	DEVICEID_MAX_INSTANCE_CHARS										*
+*  Purpose:		Maximum serial or instance length in characters, including		*
+*				the terminating NUL. Longer ones are truncated.					*
+********************************************************************************/
+#define DEVICEID_MAX_INSTANCE_CHARS (64)
+
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Structure:	DEVICEID														*
+*  Purpose:		A device identity.												*
+*  Remarks:		* The instance is the device's serial where it has one. For		*
+*					Windows HID interfaces without a serial it is the			*
+*					PnP instance, which follows the USB port.					*
+*				* The instance is kept in upper case, identities compare		*
+*					case-insensitively.											*
+********************************************************************************/
+typedef struct _DEVICEID
+{
+	BOOLEAN bIsValid;								// Whether the identity is known
+	WORD wVendorId;									// USB vendor ID
+	WORD wProductId;								// USB product ID
+	CHAR szInstance[DEVICEID_MAX_INSTANCE_CHARS];	// Serial or instance (may be empty)
+} DEVICEID, *PDEVICEID;
+typedef const DEVICEID *PCDEVICEID;
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	DEVICEID_ParseInterfaceName										*
+*  Purpose:		Extracts the identity from a Windows device interface name.		*
+*  Parameters:	@ pszName ~[in]~ The name, such as dbcc_name:					*
+*				"\\?\HID#VID_046D&PID_C31C&MI_00#7&2a8b3c1&0&0000#{...}".		*
+*				@ ptId ~[out]~ Gets the identity.								*
+*  Returns:		TRUE if the name carries a VID and PID.							*
+********************************************************************************/
+BOOL
+DEVICEID_ParseInterfaceName(
+	__in_z PCSTR pszName,
+	__out PDEVICEID ptId
+);
+
+/********************************************************************************
+*  Function:	DEVICEID_ParseInputProduct										*
+*  Purpose:		Builds the identity from a Linux input device's uevent			*
+*				properties.														*
+*  Parameters:	@ pszProduct ~[in]~ PRODUCT ("bus/vendor/product/version", hex).	*
+*				@ pszUniq ~[in_opt]~ UNIQ (the serial, quoted as in uevents),	*
+*				or NULL.														*
+*				@ ptId ~[out]~ Gets the identity.								*
+*  Returns:		TRUE if PRODUCT is well formed.									*
+********************************************************************************/
+BOOL
+DEVICEID_ParseInputProduct(
+	__in_z PCSTR pszProduct,
+	__in_z_opt PCSTR pszUniq,
+	__out PDEVICEID ptId
+);
+
+/********************************************************************************
+*  Function:	DEVICEID_ParseText												*
+*  Purpose:		Parses the textual form "VVVV:PPPP:INSTANCE" (hex IDs, the		*
+*				instance may be empty).											*
+*  Parameters:	@ pszText ~[in]~ The text (surrounding white space is			*
+*				ignored).														*
+*				@ ptId ~[out]~ Gets the identity.								*
+*  Returns:		TRUE if the text is well formed.								*
+********************************************************************************/
+BOOL
+DEVICEID_ParseText(
+	__in_z PCSTR pszText,
+	__out PDEVICEID ptId
+);
+
+/********************************************************************************
+*  Function:	DEVICEID_GetFingerprint											*
+*  Purpose:		Hashes an identity to a 64-bit fingerprint.						*
+*  Parameters:	@ ptId ~[in]~ A valid identity.									*
+*  Returns:		The fingerprint, never 0.										*
+*  Remarks:		* Stable across builds and platforms.							*
+********************************************************************************/
+ULONGLONG
+DEVICEID_GetFingerprint(
+	__in PCDEVICEID ptId
+);
@@ -0,0 +1,1675 @@
+/********************************************************************************
+*  File:		EvdevSource.c													*
+*  Purpose:		Kernel uevent and evdev keystroke based event source (Linux),	*
+*				with an epoll engine and an io_uring engine.					*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/input.h>
+#include <linux/io_uring.h>
+#include "EventSource.h"
+#include <Clock.h>
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	EVDEV_MAX_DEVICES												*
+*  Purpose:		Maximum number of keyboards read at once.						*
+********************************************************************************/
+#define EVDEV_MAX_DEVICES (64)
+
+/********************************************************************************
+*  Constant:	EVDEV_READ_RECORDS												*
+*  Purpose:		input_event records drained per read.							*
+********************************************************************************/
+#define EVDEV_READ_RECORDS (64)
+
+/********************************************************************************
+*  Constant:	EVDEV_MAX_READY													*
+*  Purpose:		Ready descriptors handled per epoll_wait.						*
+********************************************************************************/
+#define EVDEV_MAX_READY (16)
+
+/********************************************************************************
+*  Constant:	EVDEV_TAG_STOP													*
+*  Purpose:		epoll and io_uring tag of the stop event (devices are tagged	*
+*				by slot).														*
+********************************************************************************/
+#define EVDEV_TAG_STOP (0xFFFFFFFFUL)
+
+/********************************************************************************
+*  Constant:	EVDEV_TAG_UEVENT												*
+*  Purpose:		epoll and io_uring tag of the uevent socket.					*
+********************************************************************************/
+#define EVDEV_TAG_UEVENT (0xFFFFFFFEUL)
+
+/********************************************************************************
+*  Constant:	EVDEV_TAG_CANCEL												*
+*  Purpose:		io_uring tag of read cancellations.								*
+********************************************************************************/
+#define EVDEV_TAG_CANCEL (0xFFFFFFFDUL)
+
+/********************************************************************************
+*  Constant:	EVDEV_URING_SQ_ENTRIES											*
+*  Purpose:		io_uring submission queue size (a read per keyboard, plus the	*
+*				two polls, fit at once).										*
+********************************************************************************/
+#define EVDEV_URING_SQ_ENTRIES (128)
+
+/********************************************************************************
+*  Constant:	EVDEV_URING_CQ_ENTRIES											*
+*  Purpose:		io_uring completion queue size (reads complete at most once		*
+*				per buffer, so it cannot overflow).								*
+********************************************************************************/
+#define EVDEV_URING_CQ_ENTRIES (256)
+
+/********************************************************************************
+*  Constant:	EVDEV_URING_BUFFERS												*
+*  Purpose:		Provided read buffers, of EVDEV_READ_RECORDS records each (a	*
+*				power of two).													*
+********************************************************************************/
+#define EVDEV_URING_BUFFERS (32)
+
+/********************************************************************************
+*  Constant:	EVDEV_URING_BUFFER_SIZE											*
+*  Purpose:		Size of a provided read buffer.									*
+********************************************************************************/
+#define EVDEV_URING_BUFFER_SIZE (EVDEV_READ_RECORDS * sizeof(struct input_event))
+
+/********************************************************************************
+*  Constant:	EVDEV_URING_BUFFER_GROUP										*
+*  Purpose:		Buffer group ID of the provided read buffers.					*
+********************************************************************************/
+#define EVDEV_URING_BUFFER_GROUP (0)
+
+/********************************************************************************
+*  Constant:	EVDEV_URING_OP_READ_MULTISHOT									*
+*  Purpose:		IORING_OP_READ_MULTISHOT (Linux 6.7), which older headers lack	*
+*				(it is an enum value, so it cannot be tested for).				*
+********************************************************************************/
+#define EVDEV_URING_OP_READ_MULTISHOT (49)
+
+/********************************************************************************
+*  Constant:	EVDEV_URING_PROBE_OPS											*
+*  Purpose:		Opcodes asked about when probing io_uring.						*
+********************************************************************************/
+#define EVDEV_URING_PROBE_OPS (256)
+
+/********************************************************************************
+*  Constant:	EVDEV_INPUT_DIRECTORY											*
+*  Purpose:		Where the evdev nodes are.										*
+********************************************************************************/
+#define EVDEV_INPUT_DIRECTORY ("/dev/input")
+
+/********************************************************************************
+*  Constant:	EVDEV_NODE_PREFIX												*
+*  Purpose:		The name of an evdev node, before its number.					*
+********************************************************************************/
+#define EVDEV_NODE_PREFIX ("event")
+
+/********************************************************************************
+*  Constant:	EVDEV_EV_KEYBOARD_MASK											*
+*  Purpose:		EV capability bits of a keyboard (EV_KEY and EV_REP).			*
+********************************************************************************/
+#define EVDEV_EV_KEYBOARD_MASK ((1UL << EV_KEY) | (1UL << EV_REP))
+
+/********************************************************************************
+*  Constant:	EVDEV_FIRST_TRANSLATED_KEY										*
+*  Purpose:		Key codes below this one are their own set 1 scan codes.		*
+********************************************************************************/
+#define EVDEV_FIRST_TRANSLATED_KEY (84)
+
+/********************************************************************************
+*  Constant:	EVDEV_MAX_KEY													*
+*  Purpose:		Key codes from this one on are buttons, not keys (BTN_MISC).	*
+********************************************************************************/
+#define EVDEV_MAX_KEY (0x100)
+
+/********************************************************************************
+*  Constant:	EVDEV_KEY_REPEAT												*
+*  Purpose:		The value of a key record that repeats a pressed key.			*
+********************************************************************************/
+#define EVDEV_KEY_REPEAT (2)
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Structure:	EVDEV_DEVICE													*
+*  Purpose:		A keyboard being read.											*
+********************************************************************************/
+typedef struct _EVDEV_DEVICE
+{
+	INT nFd;										// The node (or stand-in), or -1 if the slot is free
+	LONG nNode;										// N of /dev/input/eventN, or -1 for stand-ins
+	DWORD dwGeneration;								// Bumped per attach, tells stale completions apart
+	ULONGLONG qwDeviceId;							// Device ID of its key events
+	DEVICEID tIdentity;								// Identity of its key events
+	DWORD dwHoldId;									// Hold ID of its key events if grabbed, or 0
+} EVDEV_DEVICE, *PEVDEV_DEVICE;
+
+/********************************************************************************
+*  Structure:	EVDEV_URING														*
+*  Purpose:		The io_uring engine's rings and provided buffers.				*
+*  Remarks:		* Entries are queued and harvested by the running thread only	*
+*					(or before it runs).										*
+********************************************************************************/
+typedef struct _EVDEV_URING
+{
+	INT nRing;										// The io_uring, or -1
+	PVOID pvRings;									// Submission and completion rings (one mapping)
+	SIZE_T cbRings;									// Their size
+	struct io_uring_sqe *patSqes;					// Submission queue entries
+	SIZE_T cbSqes;									// Their size
+	PDWORD pdwSqHead;								// Advanced by the kernel
+	PDWORD pdwSqTail;								// Advanced here
+	PDWORD padwSqArray;								// Submission queue entry indexes
+	DWORD dwSqMask;									// Submission ring mask
+	PDWORD pdwCqHead;								// Advanced here
+	PDWORD pdwCqTail;								// Advanced by the kernel
+	struct io_uring_cqe *patCqes;					// Completion queue entries
+	DWORD dwCqMask;									// Completion ring mask
+	struct io_uring_buf_ring *ptBuffers;			// Provided buffer ring, followed by the buffers
+	SIZE_T cbBuffers;								// Their size
+	WORD wBufferTail;								// Buffers handed to the kernel so far
+} EVDEV_URING, *PEVDEV_URING;
+
+/********************************************************************************
+*  Structure:	EVDEVSOURCE_CONTEXT												*
+*  Purpose:		The backend context.											*
+*  Remarks:		* Counters are written by the running thread only.				*
+********************************************************************************/
+typedef struct _EVDEVSOURCE_CONTEXT
+{
+	EVENTSOURCE_EVDEV_ENGINE eEngine;				// EPOLL or IO_URING
+	INT nEpoll;										// Waits on all of the below (epoll engine)
+	EVDEV_URING tUring;								// Reads and polls all of the below (io_uring engine)
+	INT nSocket;									// Uevent socket
+	INT nStopEvent;									// eventfd signalled by pfnStop
+	PFN_EVENTSOURCE_CALLBACK pfnCallback;			// The callback given to pfnRun
+	PVOID pvCallbackContext;						// Its context
+	EVDEV_DEVICE atDevices[EVDEV_MAX_DEVICES];		// Keyboards by slot
+	volatile LONG nDevices;							// Occupied slots
+	volatile LONG nHeldDevices;						// Occupied slots of grabbed keyboards
+	BOOL bShouldHoldNew;							// Grab keyboards as they arrive
+	DWORD dwLastHoldId;								// Hold ID of the last grab
+	volatile ULONGLONG qwKeys;						// Key events delivered
+	volatile ULONGLONG qwWaits;						// epoll_wait or io_uring_enter calls
+	volatile ULONGLONG qwReads;						// read calls on keyboards
+	volatile ULONGLONG qwDroppedReports;			// SYN_DROPPED reports
+	struct input_event atRecords[EVDEV_READ_RECORDS];	// Read buffer (epoll engine)
+	CHAR acBuffer[EVENTSOURCE_UEVENT_BUFFER_SIZE];	// Uevent receive buffer
+} EVDEVSOURCE_CONTEXT, *PEVDEVSOURCE_CONTEXT;
+
+
+/** Globals ********************************************************************/
+
+/********************************************************************************
+*  Global:		g_awTranslatedKeys												*
+*  Purpose:		Set 1 scan codes of key codes EVDEV_FIRST_TRANSLATED_KEY to		*
+*				KEY_COMPOSE, or 0 for keys without one.							*
+********************************************************************************/
+static
+const WORD
+g_awTranslatedKeys[] =
+{
+	0x0000, 0x0076, 0x0056, 0x0057, 0x0058, 0x0073, 0x0078, 0x0077,	// 84..91
+	0x0079, 0x0070, 0x007B, 0x005C, 0xE01C, 0xE01D, 0xE035, 0xE037,	// 92..99
+	0xE038, 0x0000, 0xE047, 0xE048, 0xE049, 0xE04B, 0xE04D, 0xE04F,	// 100..107
+	0xE050, 0xE051, 0xE052, 0xE053, 0x0000, 0xE020, 0xE02E, 0xE030,	// 108..115
+	0xE05E, 0x0059, 0x0000, 0x0000, 0x0000, 0x007E, 0x00F2, 0x00F1,	// 116..123
+	0x007D, 0xE05B, 0xE05C, 0xE05D									// 124..127
+};
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	evdevsource_UringEnter											*
+*  Purpose:		Submits the queued io_uring entries, and optionally waits for	*
+*				completions.													*
+*  Parameters:	@ ptContext ~[inout]~ The backend context.						*
+*				@ dwWaitFor ~[in]~ Completions to wait for, or 0.				*
+*  Returns:		The io_uring_enter result (errno is set on failure).			*
+********************************************************************************/
+static
+INT
+evdevsource_UringEnter(
+	__inout PEVDEVSOURCE_CONTEXT ptContext,
+	__in DWORD dwWaitFor
+)
+{
+	PEVDEV_URING ptUring = &(ptContext->tUring);
+	DWORD dwQueued = *(ptUring->pdwSqTail) - ATOMIC_LOAD_ACQUIRE(ptUring->pdwSqHead);
+
+	ptContext->qwWaits++;
+	return (INT)syscall(__NR_io_uring_enter,
+		ptUring->nRing,
+		dwQueued,
+		dwWaitFor,
+		(0 != dwWaitFor) ? IORING_ENTER_GETEVENTS : 0,
+		NULL,
+		0);
+}
+
+/********************************************************************************
+*  Function:	evdevsource_UringQueue											*
+*  Purpose:		Queues an io_uring entry, to be submitted by the next			*
+*				io_uring_enter.													*
+*  Parameters:	@ ptContext ~[inout]~ The backend context.						*
+*				@ ptEntry ~[in]~ The entry.										*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Submits the queued entries first if the queue is full.		*
+********************************************************************************/
+static
+RETSTATUS
+evdevsource_UringQueue(
+	__inout PEVDEVSOURCE_CONTEXT ptContext,
+	__in const struct io_uring_sqe *ptEntry
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	PEVDEV_URING ptUring = &(ptContext->tUring);
+	DWORD dwTail = *(ptUring->pdwSqTail);
+	DWORD dwIndex = dwTail & ptUring->dwSqMask;
+
+	if ((dwTail - ATOMIC_LOAD_ACQUIRE(ptUring->pdwSqHead) > ptUring->dwSqMask) &&
+		(0 > evdevsource_UringEnter(ptContext, 0)))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"io_uring_enter() failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+	ptUring->patSqes[dwIndex] = *ptEntry;
+	ptUring->padwSqArray[dwIndex] = dwIndex;
+	ATOMIC_STORE_RELEASE(ptUring->pdwSqTail, dwTail + 1);
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	evdevsource_UringArmRead										*
+*  Purpose:		Queues a multishot read of a keyboard into the provided			*
+*				buffers.														*
+*  Parameters:	@ ptContext ~[inout]~ The backend context.						*
+*				@ dwSlot ~[in]~ The keyboard's slot.							*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Completes once per filled buffer until the keyboard is gone,	*
+*					or the buffers run out (then it must be queued again).		*
+********************************************************************************/
+static
+RETSTATUS
+evdevsource_UringArmRead(
+	__inout PEVDEVSOURCE_CONTEXT ptContext,
+	__in DWORD dwSlot
+)
+{
+	struct io_uring_sqe tEntry = { 0 };
+
+	tEntry.opcode = EVDEV_URING_OP_READ_MULTISHOT;
+	tEntry.flags = IOSQE_BUFFER_SELECT;
+	tEntry.fd = ptContext->atDevices[dwSlot].nFd;
+	tEntry.buf_group = EVDEV_URING_BUFFER_GROUP;
+	tEntry.user_data = ((ULONGLONG)(ptContext->atDevices[dwSlot].dwGeneration) << 32) | dwSlot;
+	return evdevsource_UringQueue(ptContext, &tEntry);
+}
+
+/********************************************************************************
+*  Function:	evdevsource_UringArmPoll										*
+*  Purpose:		Queues a multishot poll for input on a descriptor.				*
+*  Parameters:	@ ptContext ~[inout]~ The backend context.						*
+*				@ nFd ~[in]~ The descriptor.									*
+*				@ dwTag ~[in]~ Its tag.											*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+evdevsource_UringArmPoll(
+	__inout PEVDEVSOURCE_CONTEXT ptContext,
+	__in INT nFd,
+	__in DWORD dwTag
+)
+{
+	struct io_uring_sqe tEntry = { 0 };
+
+	tEntry.opcode = IORING_OP_POLL_ADD;
+	tEntry.fd = nFd;
+	tEntry.poll32_events = POLLIN;
+	tEntry.len = IORING_POLL_ADD_MULTI;
+	tEntry.user_data = dwTag;
+	return evdevsource_UringQueue(ptContext, &tEntry);
+}
+
+/********************************************************************************
+*  Function:	evdevsource_UringBuffer											*
+*  Purpose:		Gets a provided buffer.											*
+*  Parameters:	@ ptUring ~[in]~ The io_uring engine.							*
+*				@ wBuffer ~[in]~ The buffer ID.									*
+*  Returns:		Its EVDEV_READ_RECORDS records.									*
+*  Remarks:		* The buffers follow their ring, in the same mapping.			*
+********************************************************************************/
+static
+struct input_event *
+evdevsource_UringBuffer(
+	__in const EVDEV_URING *ptUring,
+	__in WORD wBuffer
+)
+{
+	return (struct input_event *)&(ptUring->ptBuffers->bufs[EVDEV_URING_BUFFERS]) + ((SIZE_T)wBuffer * EVDEV_READ_RECORDS);
+}
+
+/********************************************************************************
+*  Function:	evdevsource_UringRecycle										*
+*  Purpose:		Hands a provided buffer (back) to the kernel.					*
+*  Parameters:	@ ptUring ~[inout]~ The io_uring engine.						*
+*				@ wBuffer ~[in]~ The buffer ID.									*
+********************************************************************************/
+static
+VOID
+evdevsource_UringRecycle(
+	__inout PEVDEV_URING ptUring,
+	__in WORD wBuffer
+)
+{
+	struct io_uring_buf *ptEntry = &(ptUring->ptBuffers->bufs[ptUring->wBufferTail & (EVDEV_URING_BUFFERS - 1)]);
+
+	// Leaves the reserved field alone, the ring's tail overlays the first one
+	ptEntry->addr = (ULONGLONG)(SIZE_T)evdevsource_UringBuffer(ptUring, wBuffer);
+	ptEntry->len = EVDEV_URING_BUFFER_SIZE;
+	ptEntry->bid = wBuffer;
+	ptUring->wBufferTail++;
+	ATOMIC_STORE_RELEASE(&(ptUring->ptBuffers->tail), ptUring->wBufferTail);
+}
+
+/********************************************************************************
+*  Function:	evdevsource_Attach												*
+*  Purpose:		Starts reading a descriptor, in a free slot.					*
+*  Parameters:	@ ptContext ~[inout]~ The backend context.						*
+*				@ nFd ~[in]~ The descriptor (owned by the slot on success).		*
+*				@ nNode ~[in]~ N of /dev/input/eventN, or -1.					*
+*				@ qwDeviceId ~[in]~ The device ID of its key events.			*
+*				@ ptIdentity ~[in_opt]~ The identity of its key events.			*
+*				@ bIsHeld ~[in]~ Whether it is grabbed.							*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+evdevsource_Attach(
+	__inout PEVDEVSOURCE_CONTEXT ptContext,
+	__in INT nFd,
+	__in LONG nNode,
+	__in ULONGLONG qwDeviceId,
+	__in_opt PCDEVICEID ptIdentity,
+	__in BOOL bIsHeld
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	PEVDEV_DEVICE ptDevice = NULL;
+	struct epoll_event tEpollEvent = { 0 };
+	DWORD dwSlot = 0;
+
+	// Find a free slot
+	for (dwSlot = 0; (dwSlot < EVDEV_MAX_DEVICES) && (0 <= ptContext->atDevices[dwSlot].nFd); dwSlot++)
+	{
+	}
+	if (EVDEV_MAX_DEVICES == dwSlot)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"Cannot read more than %d keyboards.",
+			EVDEV_MAX_DEVICES);
+		goto lblCleanup;
+	}
+
+	ptDevice = &(ptContext->atDevices[dwSlot]);
+	if (EVENTSOURCE_EVDEV_ENGINE_IO_URING == ptContext->eEngine)
+	{
+		// Keep a read queued on it
+		ptDevice->nFd = nFd;
+		ptDevice->dwGeneration++;
+		eStatus = evdevsource_UringArmRead(ptContext, dwSlot);
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			ptDevice->nFd = -1;
+			DEBUG_MSG(LOG_SEV_ERROR,
+				"evdevsource_UringArmRead() failed (eStatus=0x%.8x).",
+				eStatus);
+			goto lblCleanup;
+		}
+	}
+	else
+	{
+		// Wait on it (level triggered, a read that fills the buffer is followed by another)
+		tEpollEvent.events = EPOLLIN;
+		tEpollEvent.data.u32 = dwSlot;
+		if (0 != epoll_ctl(ptContext->nEpoll, EPOLL_CTL_ADD, nFd, &tEpollEvent))
+		{
+			eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+				LOG_SEV_ERROR,
+				"epoll_ctl() failure (errno=%d).",
+				errno);
+			goto lblCleanup;
+		}
+		ptDevice->nFd = nFd;
+	}
+	ptDevice->nNode = nNode;
+	ptDevice->qwDeviceId = qwDeviceId;
+	if (NULL != ptIdentity)
+	{
+		ptDevice->tIdentity = *ptIdentity;
+	}
+	else
+	{
+		RtlZeroMemory(&(ptDevice->tIdentity), sizeof(ptDevice->tIdentity));
+	}
+	ptDevice->dwHoldId = 0;
+	ATOMIC_STORE_RELEASE(&(ptContext->nDevices), ptContext->nDevices + 1);
+	if (bIsHeld)
+	{
+		// Never 0, even once wrapped
+		ptContext->dwLastHoldId = MAX(ptContext->dwLastHoldId + 1, 1);
+		ptDevice->dwHoldId = ptContext->dwLastHoldId;
+		ATOMIC_STORE_RELEASE(&(ptContext->nHeldDevices), ptContext->nHeldDevices + 1);
+	}
+	DEBUG_MSG(LOG_SEV_INFO, "Reading keyboard 0x%llx (node %ld%s).", qwDeviceId, (long)nNode, bIsHeld ? ", held" : "");
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	evdevsource_Detach												*
+*  Purpose:		Stops reading a keyboard and frees its slot.					*
+*  Parameters:	@ ptContext ~[inout]~ The backend context.						*
+*				@ dwSlot ~[in]~ Its slot.										*
+*  Remarks:		* A held keyboard's detach is delivered, after its last key		*
+*					event, as a removal with its hold ID.						*
+********************************************************************************/
+static
+VOID
+evdevsource_Detach(
+	__inout PEVDEVSOURCE_CONTEXT ptContext,
+	__in DWORD dwSlot
+)
+{
+	PEVDEV_DEVICE ptDevice = &(ptContext->atDevices[dwSlot]);
+	struct io_uring_sqe tCancel = { 0 };
+	EVENTSOURCE_EVENT tEvent = { 0 };
+
+	if (0 > ptDevice->nFd)
+	{
+		return;
+	}
+	DEBUG_MSG(LOG_SEV_INFO, "Stopped reading keyboard 0x%llx (node %ld).", ptDevice->qwDeviceId, (long)(ptDevice->nNode));
+	if (EVENTSOURCE_EVDEV_ENGINE_IO_URING == ptContext->eEngine)
+	{
+		// Best-effort (a read that already ended is not found), later completions are stale
+		tCancel.opcode = IORING_OP_ASYNC_CANCEL;
+		tCancel.fd = -1;
+		tCancel.addr = ((ULONGLONG)(ptDevice->dwGeneration) << 32) | dwSlot;
+		tCancel.user_data = EVDEV_TAG_CANCEL;
+		(VOID)evdevsource_UringQueue(ptContext, &tCancel);
+	}
+	else
+	{
+		(VOID)epoll_ctl(ptContext->nEpoll, EPOLL_CTL_DEL, ptDevice->nFd, NULL);
+	}
+	CLOSE_FD(ptDevice->nFd);
+	ptDevice->nNode = -1;
+	ATOMIC_STORE_RELEASE(&(ptContext->nDevices), ptContext->nDevices - 1);
+	if (0 != ptDevice->dwHoldId)
+	{
+		tEvent.eType = EVENTSOURCE_EVENT_TYPE_REMOVAL;
+		tEvent.eClass = EVENTSOURCE_DEVICE_CLASS_KEYBOARD;
+		tEvent.qwTimestamp = CLOCK_GetTimestamp();
+		tEvent.qwClassifiedTimestamp = tEvent.qwTimestamp;
+		tEvent.qwDeviceId = ptDevice->qwDeviceId;
+		tEvent.tIdentity = ptDevice->tIdentity;
+		tEvent.dwHoldId = ptDevice->dwHoldId;
+		ptDevice->dwHoldId = 0;
+		ATOMIC_STORE_RELEASE(&(ptContext->nHeldDevices), ptContext->nHeldDevices - 1);
+		ptContext->pfnCallback(&tEvent, ptContext->pvCallbackContext);
+	}
+}
+
+/********************************************************************************
+*  Function:	evdevsource_OpenNode											*
+*  Purpose:		Attaches /dev/input/eventN if it is a keyboard.					*
+*  Parameters:	@ ptContext ~[inout]~ The backend context.						*
+*				@ nNode ~[in]~ N.												*
+*				@ bShouldHold ~[in]~ Whether to grab it.						*
+*  Returns:		A RETSTATUS. Nodes that are not keyboards, or already			*
+*				attached, succeed without being attached again.					*
+*  Remarks:		* errno tells why a node could not be opened.					*
+*				* The grab ends when the node is closed.						*
+********************************************************************************/
+static
+RETSTATUS
+evdevsource_OpenNode(
+	__inout PEVDEVSOURCE_CONTEXT ptContext,
+	__in LONG nNode,
+	__in BOOL bShouldHold
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	CHAR szPath[sizeof(EVDEV_INPUT_DIRECTORY) + sizeof(EVDEV_NODE_PREFIX) + 16] = { 0 };
+	CHAR szProduct[32] = { 0 };
+	CHAR szUniq[DEVICEID_MAX_INSTANCE_CHARS] = { 0 };
+	DEVICEID tIdentity = { 0 };
+	struct input_id tInputId = { 0 };
+	struct stat tStat = { 0 };
+	unsigned long ulEvBits = 0;
+	INT nClock = CLOCK_MONOTONIC;
+	INT nFd = -1;
+	DWORD dwSlot = 0;
+	BOOL bIsHeld = FALSE;
+
+	// Already attached (enumerated, then announced)
+	for (dwSlot = 0; dwSlot < EVDEV_MAX_DEVICES; dwSlot++)
+	{
+		if ((0 <= ptContext->atDevices[dwSlot].nFd) && (nNode == ptContext->atDevices[dwSlot].nNode))
+		{
+			eStatus = RETSTATUS_SUCCESS;
+			goto lblCleanup;
+		}
+	}
+
+	// Open it
+	(VOID)snprintf(szPath, sizeof(szPath), "%s/%s%ld", EVDEV_INPUT_DIRECTORY, EVDEV_NODE_PREFIX, (long)nNode);
+	nFd = open(szPath, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (0 > nFd)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"open() failure on '%s' (errno=%d).",
+			szPath,
+			errno);
+		goto lblCleanup;
+	}
+
+	// Keep keyboards only, like the uevent classification
+	if ((0 > ioctl(nFd, EVIOCGBIT(0, sizeof(ulEvBits)), &ulEvBits)) ||
+		(EVDEV_EV_KEYBOARD_MASK != (ulEvBits & EVDEV_EV_KEYBOARD_MASK)))
+	{
+		eStatus = RETSTATUS_SUCCESS;
+		goto lblCleanup;
+	}
+
+	// Key times on the CLOCK_GetTimestamp clock (best-effort, receipt times otherwise)
+	(VOID)ioctl(nFd, EVIOCSCLOCKID, &nClock);
+
+	// The identity, the way uevents carry it
+	if (0 == ioctl(nFd, EVIOCGID, &tInputId))
+	{
+		// Never read held keys back as they are replayed
+		if ((BUS_VIRTUAL == tInputId.bustype) &&
+			(EVENTSOURCE_REPLAY_VENDOR_ID == tInputId.vendor) &&
+			(EVENTSOURCE_REPLAY_PRODUCT_ID == tInputId.product))
+		{
+			eStatus = RETSTATUS_SUCCESS;
+			goto lblCleanup;
+		}
+		(VOID)snprintf(szProduct,
+			sizeof(szProduct),
+			"%x/%x/%x/%x",
+			tInputId.bustype,
+			tInputId.vendor,
+			tInputId.product,
+			tInputId.version);
+		(VOID)ioctl(nFd, EVIOCGUNIQ(sizeof(szUniq) - 1), szUniq);
+		(VOID)DEVICEID_ParseInputProduct(szProduct, szUniq, &tIdentity);
+	}
+	(VOID)fstat(nFd, &tStat);
+
+	// Withhold its keys from the system, if asked to (best-effort, it is judged all the same)
+	if (bShouldHold)
+	{
+		bIsHeld = (0 == ioctl(nFd, EVIOCGRAB, 1));
+		if (!bIsHeld)
+		{
+			DEBUG_MSG(LOG_SEV_ERROR,
+				"Cannot hold keyboard 0x%llx (errno=%d).",
+				(ULONGLONG)(tStat.st_rdev),
+				errno);
+		}
+	}
+
+	eStatus = evdevsource_Attach(ptContext, nFd, nNode, (ULONGLONG)(tStat.st_rdev), &tIdentity, bIsHeld);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		DEBUG_MSG(LOG_SEV_ERROR,
+			"evdevsource_Attach() failed (eStatus=0x%.8x).",
+			eStatus);
+		goto lblCleanup;
+	}
+	nFd = -1;
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	CLOSE_FD(nFd);
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	evdevsource_ParseNode											*
+*  Purpose:		Gets N from an evdev node's name or device path.				*
+*  Parameters:	@ pszName ~[in]~ "eventN", or a DEVPATH that ends with			*
+*				"/input/inputM/eventN".											*
+*				@ pnNode ~[out]~ Gets N.										*
+*  Returns:		TRUE if the name is an evdev node's.							*
+********************************************************************************/
+static
+BOOL
+evdevsource_ParseNode(
+	__in_z PCSTR pszName,
+	__out PLONG pnNode
+)
+{
+	PCSTR pszBase = strrchr(pszName, '/');
+	PSTR pszEnd = NULL;
+
+	// A path must have the input device as parent
+	if (NULL != pszBase)
+	{
+		if ((NULL == strstr(pszName, "/input/input")) || (NULL == strchr(strstr(pszName, "/input/input") + 1, '/')))
+		{
+			return FALSE;
+		}
+		pszBase++;
+	}
+	else
+	{
+		pszBase = pszName;
+	}
+	if ((0 != strncmp(pszBase, EVDEV_NODE_PREFIX, sizeof(EVDEV_NODE_PREFIX) - 1)) ||
+		(!isdigit((UCHAR)pszBase[sizeof(EVDEV_NODE_PREFIX) - 1])))
+	{
+		return FALSE;
+	}
+	*pnNode = strtol(pszBase + sizeof(EVDEV_NODE_PREFIX) - 1, &pszEnd, DECIMAL_BASE);
+	return '\0' == *pszEnd;
+}
+
+/********************************************************************************
+*  Function:	evdevsource_OnUevent											*
+*  Purpose:		Attaches and detaches evdev nodes as they come and go, then		*
+*				delivers the uevent.											*
+*  Parameters:	@ ptEvent ~[in]~ The decoded uevent.							*
+*				@ pvContext ~[inout]~ The backend context.						*
+********************************************************************************/
+static
+VOID
+evdevsource_OnUevent(
+	__in PCEVENTSOURCE_EVENT ptEvent,
+	__inout_opt PVOID pvContext
+)
+{
+	PEVDEVSOURCE_CONTEXT ptContext = (PEVDEVSOURCE_CONTEXT)pvContext;
+	LONG nNode = 0;
+	DWORD dwSlot = 0;
+
+	if (evdevsource_ParseNode(ptEvent->szName, &nNode))
+	{
+		if (EVENTSOURCE_EVENT_TYPE_ARRIVAL == ptEvent->eType)
+		{
+			// A keyboard that cannot be read is still judged by its arrival rules
+			(VOID)evdevsource_OpenNode(ptContext, nNode, ptContext->bShouldHoldNew);
+		}
+		else
+		{
+			for (dwSlot = 0; dwSlot < EVDEV_MAX_DEVICES; dwSlot++)
+			{
+				if ((0 <= ptContext->atDevices[dwSlot].nFd) && (nNode == ptContext->atDevices[dwSlot].nNode))
+				{
+					evdevsource_Detach(ptContext, dwSlot);
+				}
+			}
+		}
+	}
+	ptContext->pfnCallback(ptEvent, ptContext->pvCallbackContext);
+}
+
+/********************************************************************************
+*  Function:	evdevsource_DeliverRecords										*
+*  Purpose:		Delivers the key records (presses, releases and repeats) read	*
+*				from a keyboard.												*
+*  Parameters:	@ ptContext ~[inout]~ The backend context.						*
+*				@ ptDevice ~[in]~ The keyboard.									*
+*				@ patRecords ~[in]~ The records.								*
+*				@ dwRecords ~[in]~ Their number.								*
+*				@ qwReceived ~[in]~ When they were read.						*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+*				* The keyboard is copied into the event first, as the callback	*
+*					may detach it.												*
+********************************************************************************/
+static
+VOID
+evdevsource_DeliverRecords(
+	__inout PEVDEVSOURCE_CONTEXT ptContext,
+	__in const EVDEV_DEVICE *ptDevice,
+	__in_ecount(dwRecords) const struct input_event *patRecords,
+	__in DWORD dwRecords,
+	__in ULONGLONG qwReceived
+)
+{
+	const struct input_event *ptRecord = NULL;
+	EVENTSOURCE_EVENT tEvent = { 0 };
+	ULONGLONG qwRecordTime = 0;
+	DWORD dwIndex = 0;
+
+	tEvent.eType = EVENTSOURCE_EVENT_TYPE_KEY;
+	tEvent.eClass = EVENTSOURCE_DEVICE_CLASS_KEYBOARD;
+	tEvent.qwDeviceId = ptDevice->qwDeviceId;
+	tEvent.tIdentity = ptDevice->tIdentity;
+	tEvent.dwHoldId = ptDevice->dwHoldId;
+	for (dwIndex = 0; dwIndex < dwRecords; dwIndex++)
+	{
+		ptRecord = &(patRecords[dwIndex]);
+		if ((EV_SYN == ptRecord->type) && (SYN_DROPPED == ptRecord->code))
+		{
+			ptContext->qwDroppedReports++;
+			continue;
+		}
+		if ((EV_KEY != ptRecord->type) || (EVDEV_MAX_KEY <= ptRecord->code))
+		{
+			continue;
+		}
+		qwRecordTime = ((ULONGLONG)(ptRecord->input_event_sec) * NANOSECONDS_IN_SECOND) +
+			((ULONGLONG)(ptRecord->input_event_usec) * NANOSECONDS_IN_MICROSECOND);
+		tEvent.qwTimestamp = (0 != qwRecordTime) ? qwRecordTime : qwReceived;
+		if (EVDEV_FIRST_TRANSLATED_KEY > ptRecord->code)
+		{
+			tEvent.wScanCode = ptRecord->code;
+		}
+		else if (EVDEV_FIRST_TRANSLATED_KEY + sizeof(g_awTranslatedKeys) / sizeof(g_awTranslatedKeys[0]) > ptRecord->code)
+		{
+			tEvent.wScanCode = g_awTranslatedKeys[ptRecord->code - EVDEV_FIRST_TRANSLATED_KEY];
+		}
+		else
+		{
+			tEvent.wScanCode = 0;
+		}
+		tEvent.wKeyCode = ptRecord->code;
+		tEvent.bIsKeyDown = (0 != ptRecord->value);
+		tEvent.bIsRepeat = (EVDEV_KEY_REPEAT == ptRecord->value);
+		tEvent.qwClassifiedTimestamp = CLOCK_GetTimestamp();
+		ptContext->pfnCallback(&tEvent, ptContext->pvCallbackContext);
+		ptContext->qwKeys++;
+	}
+}
+
+/********************************************************************************
+*  Function:	evdevsource_ReadDevice											*
+*  Purpose:		Reads and delivers a keyboard's pending records (epoll engine).	*
+*  Parameters:	@ ptContext ~[inout]~ The backend context.						*
+*				@ dwSlot ~[in]~ The keyboard's slot.							*
+*  Remarks:		* A read that does not fill the buffer drained the device, so	*
+*					no read is spent on EAGAIN.									*
+*				* Detaches the keyboard once it is gone (ENODEV) or at end of	*
+*					file (stand-ins).											*
+********************************************************************************/
+static
+VOID
+evdevsource_ReadDevice(
+	__inout PEVDEVSOURCE_CONTEXT ptContext,
+	__in DWORD dwSlot
+)
+{
+	PEVDEV_DEVICE ptDevice = &(ptContext->atDevices[dwSlot]);
+	ULONGLONG qwReceived = 0;
+	ssize_t cbRead = 0;
+
+	do
+	{
+		cbRead = read(ptDevice->nFd, ptContext->atRecords, sizeof(ptContext->atRecords));
+		qwReceived = CLOCK_GetTimestamp();
+		ptContext->qwReads++;
+		if (0 > cbRead)
+		{
+			if ((EAGAIN != errno) && (EWOULDBLOCK != errno) && (EINTR != errno))
+			{
+				evdevsource_Detach(ptContext, dwSlot);
+			}
+			break;
+		}
+		if (0 == cbRead)
+		{
+			evdevsource_Detach(ptContext, dwSlot);
+			break;
+		}
+		evdevsource_DeliverRecords(ptContext,
+			ptDevice,
+			ptContext->atRecords,
+			(DWORD)((SIZE_T)cbRead / sizeof(ptContext->atRecords[0])),
+			qwReceived);
+	} while ((sizeof(ptContext->atRecords) == (SIZE_T)cbRead) && (0 <= ptDevice->nFd));
+}
+
+/********************************************************************************
+*  Function:	evdevsource_Run													*
+*  Purpose:		Waits on the uevent socket and every keyboard, and delivers		*
+*				events until stopped.											*
+*  Parameters:	@ ptSource ~[inout]~ The event source.							*
+*				@ pfnCallback ~[in]~ The event callback.						*
+*				@ pvContext ~[inout]~ Optional context for the callback.		*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+evdevsource_Run(
+	__inout PEVENTSOURCE ptSource,
+	__in PFN_EVENTSOURCE_CALLBACK pfnCallback,
+	__inout_opt PVOID pvContext
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	PEVDEVSOURCE_CONTEXT ptContext = (PEVDEVSOURCE_CONTEXT)(ptSource->pvBackend);
+	struct epoll_event atReady[EVDEV_MAX_READY] = { { 0 } };
+	INT nReady = 0;
+	INT nIndex = 0;
+
+	DEBUG_ENTER();
+
+	ptContext->pfnCallback = pfnCallback;
+	ptContext->pvCallbackContext = pvContext;
+
+	// The socket was bound and the keyboards attached at creation
+	EVENTSOURCE_SetArmed(ptSource);
+	for (;;)
+	{
+		nReady = epoll_wait(ptContext->nEpoll, atReady, EVDEV_MAX_READY, -1);
+		ptContext->qwWaits++;
+		if (0 > nReady)
+		{
+			if (EINTR == errno)
+			{
+				continue;
+			}
+			eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+				LOG_SEV_ERROR,
+				"epoll_wait() failure (errno=%d).",
+				errno);
+			goto lblCleanup;
+		}
+
+		for (nIndex = 0; nIndex < nReady; nIndex++)
+		{
+			// Stop requested
+			if (EVDEV_TAG_STOP == atReady[nIndex].data.u32)
+			{
+				eStatus = RETSTATUS_SUCCESS;
+				goto lblCleanup;
+			}
+
+			// Arrivals and removals
+			if (EVDEV_TAG_UEVENT == atReady[nIndex].data.u32)
+			{
+				if (0 == (atReady[nIndex].events & EPOLLIN))
+				{
+					// The peer is gone (socketpair stand-in)
+					eStatus = RETSTATUS_SUCCESS;
+					goto lblCleanup;
+				}
+				eStatus = EVENTSOURCE_DrainUevents(ptContext->nSocket, ptContext->acBuffer, evdevsource_OnUevent, ptContext);
+				if (RETSTATUS_FAILED(eStatus))
+				{
+					DEBUG_MSG(LOG_SEV_ERROR,
+						"EVENTSOURCE_DrainUevents() failed (eStatus=0x%.8x).",
+						eStatus);
+					goto lblCleanup;
+				}
+				continue;
+			}
+
+			// Keystrokes (the slot may have been freed by a removal above, reading it then is harmless)
+			if (0 <= ptContext->atDevices[atReady[nIndex].data.u32].nFd)
+			{
+				evdevsource_ReadDevice(ptContext, atReady[nIndex].data.u32);
+			}
+		}
+	}
+
+lblCleanup:
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	evdevsource_RunUring											*
+*  Purpose:		Keeps reads queued on every keyboard and polls on the uevent	*
+*				socket and stop event, and delivers events until stopped.		*
+*  Parameters:	@ ptSource ~[inout]~ The event source.							*
+*				@ pfnCallback ~[in]~ The event callback.						*
+*				@ pvContext ~[inout]~ Optional context for the callback.		*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Each io_uring_enter submits the re-armed reads and harvests	*
+*					every completion since the previous one, so a burst of		*
+*					keystrokes over many keyboards costs a single syscall.		*
+*				* Uevents are rare and must be checked against their sender,	*
+*					so the socket is only polled, and drained with recvfrom.	*
+********************************************************************************/
+static
+RETSTATUS
+evdevsource_RunUring(
+	__inout PEVENTSOURCE ptSource,
+	__in PFN_EVENTSOURCE_CALLBACK pfnCallback,
+	__inout_opt PVOID pvContext
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	PEVDEVSOURCE_CONTEXT ptContext = (PEVDEVSOURCE_CONTEXT)(ptSource->pvBackend);
+	PEVDEV_URING ptUring = &(ptContext->tUring);
+	const struct io_uring_cqe *ptCompletion = NULL;
+	PEVDEV_DEVICE ptDevice = NULL;
+	DWORD dwHead = 0;
+	DWORD dwTail = 0;
+	DWORD dwSlot = 0;
+	BOOL bIsCurrent = FALSE;
+
+	DEBUG_ENTER();
+
+	ptContext->pfnCallback = pfnCallback;
+	ptContext->pvCallbackContext = pvContext;
+
+	// The socket was bound, and the polls and reads queued, at creation
+	EVENTSOURCE_SetArmed(ptSource);
+	for (;;)
+	{
+		if (0 > evdevsource_UringEnter(ptContext, 1))
+		{
+			if (EINTR == errno)
+			{
+				continue;
+			}
+			eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+				LOG_SEV_ERROR,
+				"io_uring_enter() failure (errno=%d).",
+				errno);
+			goto lblCleanup;
+		}
+
+		dwHead = *(ptUring->pdwCqHead);
+		dwTail = ATOMIC_LOAD_ACQUIRE(ptUring->pdwCqTail);
+		for (; dwHead != dwTail; dwHead++)
+		{
+			ptCompletion = &(ptUring->patCqes[dwHead & ptUring->dwCqMask]);
+			dwSlot = (DWORD)(ptCompletion->user_data);
+
+			// Stop requested
+			if (EVDEV_TAG_STOP == dwSlot)
+			{
+				eStatus = RETSTATUS_SUCCESS;
+				goto lblCleanup;
+			}
+
+			// Arrivals and removals
+			if (EVDEV_TAG_UEVENT == dwSlot)
+			{
+				if (0 > ptCompletion->res)
+				{
+					eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+						LOG_SEV_ERROR,
+						"IORING_OP_POLL_ADD failure (errno=%d).",
+						-(ptCompletion->res));
+					goto lblCleanup;
+				}
+				if (0 == (ptCompletion->res & POLLIN))
+				{
+					// The peer is gone (socketpair stand-in)
+					eStatus = RETSTATUS_SUCCESS;
+					goto lblCleanup;
+				}
+				eStatus = EVENTSOURCE_DrainUevents(ptContext->nSocket, ptContext->acBuffer, evdevsource_OnUevent, ptContext);
+				if (RETSTATUS_FAILED(eStatus))
+				{
+					DEBUG_MSG(LOG_SEV_ERROR,
+						"EVENTSOURCE_DrainUevents() failed (eStatus=0x%.8x).",
+						eStatus);
+					goto lblCleanup;
+				}
+				if ((0 == (ptCompletion->flags & IORING_CQE_F_MORE)) &&
+					(RETSTATUS_FAILED(evdevsource_UringArmPoll(ptContext, ptContext->nSocket, EVDEV_TAG_UEVENT))))
+				{
+					eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+						LOG_SEV_ERROR,
+						"evdevsource_UringArmPoll() failed.");
+					goto lblCleanup;
+				}
+				continue;
+			}
+			if (EVDEV_TAG_CANCEL == dwSlot)
+			{
+				continue;
+			}
+
+			// Keystrokes (completions of a detached keyboard, or of the slot's previous keyboard, are stale)
+			ptDevice = &(ptContext->atDevices[dwSlot]);
+			bIsCurrent = (0 <= ptDevice->nFd) && ((DWORD)(ptCompletion->user_data >> 32) == ptDevice->dwGeneration);
+			if (bIsCurrent && (0 < ptCompletion->res))
+			{
+				evdevsource_DeliverRecords(ptContext,
+					ptDevice,
+					evdevsource_UringBuffer(ptUring, (WORD)(ptCompletion->flags >> IORING_CQE_BUFFER_SHIFT)),
+					(DWORD)((SIZE_T)(ptCompletion->res) / sizeof(struct input_event)),
+					CLOCK_GetTimestamp());
+			}
+			else if (bIsCurrent && (-ENOBUFS != ptCompletion->res))
+			{
+				// Gone (ENODEV) or end of file (stand-ins)
+				evdevsource_Detach(ptContext, dwSlot);
+			}
+			if (0 != (ptCompletion->flags & IORING_CQE_F_BUFFER))
+			{
+				evdevsource_UringRecycle(ptUring, (WORD)(ptCompletion->flags >> IORING_CQE_BUFFER_SHIFT));
+			}
+
+			// Queue the read again once it ended (out of buffers), unless the callback detached the keyboard
+			if (bIsCurrent &&
+				(0 <= ptDevice->nFd) &&
+				(0 == (ptCompletion->flags & IORING_CQE_F_MORE)) &&
+				(RETSTATUS_FAILED(evdevsource_UringArmRead(ptContext, dwSlot))))
+			{
+				evdevsource_Detach(ptContext, dwSlot);
+			}
+		}
+		ATOMIC_STORE_RELEASE(ptUring->pdwCqHead, dwHead);
+	}
+
+lblCleanup:
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	evdevsource_UringClose											*
+*  Purpose:		Unmaps the rings and buffers and closes the io_uring.			*
+*  Parameters:	@ ptUring ~[inout]~ The io_uring engine (may be partially		*
+*				opened, or not at all).											*
+*  Remarks:		* Outstanding requests are cancelled by the kernel.				*
+********************************************************************************/
+static
+VOID
+evdevsource_UringClose(
+	__inout PEVDEV_URING ptUring
+)
+{
+	if (NULL != ptUring->ptBuffers)
+	{
+		(VOID)munmap(ptUring->ptBuffers, ptUring->cbBuffers);
+	}
+	if (NULL != ptUring->patSqes)
+	{
+		(VOID)munmap(ptUring->patSqes, ptUring->cbSqes);
+	}
+	if (NULL != ptUring->pvRings)
+	{
+		(VOID)munmap(ptUring->pvRings, ptUring->cbRings);
+	}
+	CLOSE_FD(ptUring->nRing);
+	RtlZeroMemory(ptUring, sizeof(*ptUring));
+	ptUring->nRing = -1;
+}
+
+/********************************************************************************
+*  Function:	evdevsource_UringOpen											*
+*  Purpose:		Sets up the io_uring engine, and queues the polls on the		*
+*				stop event and uevent socket.									*
+*  Parameters:	@ ptContext ~[inout]~ The backend context.						*
+*  Returns:		A RETSTATUS. Fails if io_uring, multishot reads or provided		*
+*				buffer rings are unavailable (kernels before 6.7, or			*
+*				io_uring disabled by sysctl or seccomp).						*
+*  Remarks:		* Close with evdevsource_UringClose, even on failure.			*
+********************************************************************************/
+static
+RETSTATUS
+evdevsource_UringOpen(
+	__inout PEVDEVSOURCE_CONTEXT ptContext
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	PEVDEV_URING ptUring = &(ptContext->tUring);
+	struct io_uring_params tParams = { 0 };
+	struct io_uring_buf_reg tRegistration = { 0 };
+	struct io_uring_probe *ptProbe = NULL;
+	PVOID pvMapping = NULL;
+	WORD wBuffer = 0;
+
+	DEBUG_ENTER();
+
+	// Only this thread (and later the running one) submits, so no interrupt is needed to run completions
+	tParams.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+	tParams.cq_entries = EVDEV_URING_CQ_ENTRIES;
+	ptUring->nRing = (INT)syscall(__NR_io_uring_setup, EVDEV_URING_SQ_ENTRIES, &tParams);
+	if (0 > ptUring->nRing)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_INFO,
+			"io_uring_setup() failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+	if (0 == (tParams.features & IORING_FEAT_SINGLE_MMAP))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_INFO,
+			"io_uring lacks IORING_FEAT_SINGLE_MMAP (features=0x%x).",
+			tParams.features);
+		goto lblCleanup;
+	}
+
+	// Map both rings at once, then the submission queue entries
+	ptUring->cbRings = MAX(tParams.sq_off.array + (tParams.sq_entries * sizeof(DWORD)),
+		tParams.cq_off.cqes + (tParams.cq_entries * sizeof(struct io_uring_cqe)));
+	pvMapping = mmap(NULL, ptUring->cbRings, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ptUring->nRing, IORING_OFF_SQ_RING);
+	if (MAP_FAILED == pvMapping)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"mmap() failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+	ptUring->pvRings = pvMapping;
+	ptUring->cbSqes = tParams.sq_entries * sizeof(struct io_uring_sqe);
+	pvMapping = mmap(NULL, ptUring->cbSqes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ptUring->nRing, IORING_OFF_SQES);
+	if (MAP_FAILED == pvMapping)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"mmap() failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+	ptUring->patSqes = (struct io_uring_sqe *)pvMapping;
+	ptUring->pdwSqHead = (PDWORD)((PBYTE)(ptUring->pvRings) + tParams.sq_off.head);
+	ptUring->pdwSqTail = (PDWORD)((PBYTE)(ptUring->pvRings) + tParams.sq_off.tail);
+	ptUring->padwSqArray = (PDWORD)((PBYTE)(ptUring->pvRings) + tParams.sq_off.array);
+	ptUring->dwSqMask = *(PDWORD)((PBYTE)(ptUring->pvRings) + tParams.sq_off.ring_mask);
+	ptUring->pdwCqHead = (PDWORD)((PBYTE)(ptUring->pvRings) + tParams.cq_off.head);
+	ptUring->pdwCqTail = (PDWORD)((PBYTE)(ptUring->pvRings) + tParams.cq_off.tail);
+	ptUring->patCqes = (struct io_uring_cqe *)((PBYTE)(ptUring->pvRings) + tParams.cq_off.cqes);
+	ptUring->dwCqMask = *(PDWORD)((PBYTE)(ptUring->pvRings) + tParams.cq_off.ring_mask);
+
+	// Multishot reads are what make this engine worth it
+	ptProbe = ALLOCZ(sizeof(*ptProbe) + (EVDEV_URING_PROBE_OPS * sizeof(ptProbe->ops[0])));
+	if (NULL == ptProbe)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"ALLOCZ() failure.");
+		goto lblCleanup;
+	}
+	if ((0 > syscall(__NR_io_uring_register, ptUring->nRing, IORING_REGISTER_PROBE, ptProbe, EVDEV_URING_PROBE_OPS)) ||
+		(EVDEV_URING_OP_READ_MULTISHOT > ptProbe->last_op) ||
+		(0 == (ptProbe->ops[EVDEV_URING_OP_READ_MULTISHOT].flags & IO_URING_OP_SUPPORTED)))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_INFO,
+			"io_uring lacks IORING_OP_READ_MULTISHOT.");
+		goto lblCleanup;
+	}
+
+	// Provide the read buffers, after their ring (which must be page aligned)
+	ptUring->cbBuffers = EVDEV_URING_BUFFERS * (sizeof(struct io_uring_buf) + EVDEV_URING_BUFFER_SIZE);
+	pvMapping = mmap(NULL, ptUring->cbBuffers, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (MAP_FAILED == pvMapping)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"mmap() failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+	ptUring->ptBuffers = (struct io_uring_buf_ring *)pvMapping;
+	tRegistration.ring_addr = (ULONGLONG)(SIZE_T)(ptUring->ptBuffers);
+	tRegistration.ring_entries = EVDEV_URING_BUFFERS;
+	tRegistration.bgid = EVDEV_URING_BUFFER_GROUP;
+	if (0 > syscall(__NR_io_uring_register, ptUring->nRing, IORING_REGISTER_PBUF_RING, &tRegistration, 1))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_INFO,
+			"IORING_REGISTER_PBUF_RING failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+	for (wBuffer = 0; wBuffer < EVDEV_URING_BUFFERS; wBuffer++)
+	{
+		evdevsource_UringRecycle(ptUring, wBuffer);
+	}
+
+	// Poll the stop event and the uevent socket for as long as the source runs
+	eStatus = evdevsource_UringArmPoll(ptContext, ptContext->nStopEvent, EVDEV_TAG_STOP);
+	if (RETSTATUS_SUCCEEDED(eStatus))
+	{
+		eStatus = evdevsource_UringArmPoll(ptContext, ptContext->nSocket, EVDEV_TAG_UEVENT);
+	}
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		DEBUG_MSG(LOG_SEV_ERROR,
+			"evdevsource_UringArmPoll() failed (eStatus=0x%.8x).",
+			eStatus);
+		goto lblCleanup;
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	FREE(ptProbe);
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	evdevsource_Stop												*
+*  Purpose:		Signals the stop event, which makes evdevsource_Run return.		*
+*  Parameters:	@ ptSource ~[inout]~ The event source.							*
+********************************************************************************/
+static
+VOID
+evdevsource_Stop(
+	__inout PEVENTSOURCE ptSource
+)
+{
+	PEVDEVSOURCE_CONTEXT ptContext = (PEVDEVSOURCE_CONTEXT)(ptSource->pvBackend);
+
+	// Best-effort
+	(VOID)eventfd_write(ptContext->nStopEvent, 1);
+}
+
+/********************************************************************************
+*  Function:	evdevsource_FreeContext											*
+*  Purpose:		Closes every descriptor and frees a backend context.			*
+*  Parameters:	@ ptContext ~[in_opt]~ The backend context, or NULL.			*
+********************************************************************************/
+static
+VOID
+evdevsource_FreeContext(
+	__inout_opt PEVDEVSOURCE_CONTEXT ptContext
+)
+{
+	DWORD dwSlot = 0;
+
+	if (NULL == ptContext)
+	{
+		return;
+	}
+	evdevsource_UringClose(&(ptContext->tUring));
+	for (dwSlot = 0; dwSlot < EVDEV_MAX_DEVICES; dwSlot++)
+	{
+		CLOSE_FD(ptContext->atDevices[dwSlot].nFd);
+	}
+	CLOSE_FD(ptContext->nSocket);
+	CLOSE_FD(ptContext->nStopEvent);
+	CLOSE_FD(ptContext->nEpoll);
+	FREE(ptContext);
+}
+
+/********************************************************************************
+*  Function:	evdevsource_Destroy												*
+*  Purpose:		Closes the descriptors and frees the backend context.			*
+*  Parameters:	@ ptSource ~[inout]~ The event source.							*
+********************************************************************************/
+static
+VOID
+evdevsource_Destroy(
+	__inout PEVENTSOURCE ptSource
+)
+{
+	evdevsource_FreeContext((PEVDEVSOURCE_CONTEXT)(ptSource->pvBackend));
+	ptSource->pvBackend = NULL;
+}
+
+/********************************************************************************
+*  Function:	evdevsource_Enumerate											*
+*  Purpose:		Attaches the keyboards already present.							*
+*  Parameters:	@ ptContext ~[inout]~ The backend context.						*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Fails if a node cannot be opened for lack of permissions,		*
+*					as keyboards that arrive later could not be read either.	*
+*				* No input directory means no keyboards.						*
+********************************************************************************/
+static
+RETSTATUS
+evdevsource_Enumerate(
+	__inout PEVDEVSOURCE_CONTEXT ptContext
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	DIR *ptDirectory = NULL;
+	struct dirent *ptEntry = NULL;
+	LONG nNode = 0;
+
+	DEBUG_ENTER();
+
+	ptDirectory = opendir(EVDEV_INPUT_DIRECTORY);
+	if (NULL == ptDirectory)
+	{
+		eStatus = RETSTATUS_SUCCESS;
+		goto lblCleanup;
+	}
+	while (NULL != (ptEntry = readdir(ptDirectory)))
+	{
+		if (!evdevsource_ParseNode(ptEntry->d_name, &nNode))
+		{
+			continue;
+		}
+		eStatus = evdevsource_OpenNode(ptContext, nNode, FALSE);
+		if ((RETSTATUS_FAILED(eStatus)) && ((EACCES == errno) || (EPERM == errno)))
+		{
+			DEBUG_MSG(LOG_SEV_ERROR, "No permission to read input devices.");
+			goto lblCleanup;
+		}
+	}
+
+	// Success (nodes that fail otherwise are left out)
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	CLOSE(ptDirectory, closedir);
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	EVENTSOURCE_CreateEvdevSource									*
+********************************************************************************/
+RETSTATUS
+EVENTSOURCE_CreateEvdevSource(
+	__in INT nSocket,
+	__in EVENTSOURCE_EVDEV_ENGINE eEngine,
+	__out PEVENTSOURCE ptSource
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	PEVDEVSOURCE_CONTEXT ptContext = NULL;
+	struct epoll_event tEpollEvent = { 0 };
+	DWORD dwSlot = 0;
+	BOOL bIsKernelSocket = (0 > nSocket);
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != ptSource);
+
+	// Allocate the context
+	ptContext = ALLOCZ(sizeof(*ptContext));
+	if (NULL == ptContext)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"ALLOCZ() failure.");
+		goto lblCleanup;
+	}
+	ptContext->nSocket = nSocket;
+	nSocket = -1;
+	ptContext->nStopEvent = -1;
+	ptContext->nEpoll = -1;
+	ptContext->tUring.nRing = -1;
+	for (dwSlot = 0; dwSlot < EVDEV_MAX_DEVICES; dwSlot++)
+	{
+		ptContext->atDevices[dwSlot].nFd = -1;
+		ptContext->atDevices[dwSlot].nNode = -1;
+	}
+
+	// Create the stop event
+	ptContext->nStopEvent = eventfd(0, EFD_CLOEXEC);
+	if (0 > ptContext->nStopEvent)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"eventfd() failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+
+	// Open the kernel socket unless a stand-in was given (before enumerating, so that no arrival is missed)
+	if (bIsKernelSocket)
+	{
+		eStatus = EVENTSOURCE_OpenUeventSocket(&(ptContext->nSocket));
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			DEBUG_MSG(LOG_SEV_ERROR,
+				"EVENTSOURCE_OpenUeventSocket() failed (eStatus=0x%.8x).",
+				eStatus);
+			goto lblCleanup;
+		}
+	}
+
+	// Prefer io_uring (before attaching anything, as keyboards are attached per engine)
+	ptContext->eEngine = EVENTSOURCE_EVDEV_ENGINE_EPOLL;
+	if (EVENTSOURCE_EVDEV_ENGINE_EPOLL != eEngine)
+	{
+		eStatus = evdevsource_UringOpen(ptContext);
+		if (RETSTATUS_SUCCEEDED(eStatus))
+		{
+			ptContext->eEngine = EVENTSOURCE_EVDEV_ENGINE_IO_URING;
+		}
+		else if (EVENTSOURCE_EVDEV_ENGINE_IO_URING == eEngine)
+		{
+			DEBUG_MSG(LOG_SEV_ERROR,
+				"evdevsource_UringOpen() failed (eStatus=0x%.8x).",
+				eStatus);
+			goto lblCleanup;
+		}
+		else
+		{
+			DEBUG_MSG(LOG_SEV_INFO, "io_uring is unavailable, falling back to epoll.");
+			evdevsource_UringClose(&(ptContext->tUring));
+		}
+	}
+
+	// Or wait on the stop event and socket with epoll
+	if (EVENTSOURCE_EVDEV_ENGINE_EPOLL == ptContext->eEngine)
+	{
+		ptContext->nEpoll = epoll_create1(EPOLL_CLOEXEC);
+		if (0 > ptContext->nEpoll)
+		{
+			eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+				LOG_SEV_ERROR,
+				"epoll_create1() failure (errno=%d).",
+				errno);
+			goto lblCleanup;
+		}
+		tEpollEvent.events = EPOLLIN;
+		tEpollEvent.data.u32 = EVDEV_TAG_STOP;
+		if (0 != epoll_ctl(ptContext->nEpoll, EPOLL_CTL_ADD, ptContext->nStopEvent, &tEpollEvent))
+		{
+			eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+				LOG_SEV_ERROR,
+				"epoll_ctl() failure (errno=%d).",
+				errno);
+			goto lblCleanup;
+		}
+		tEpollEvent.data.u32 = EVDEV_TAG_UEVENT;
+		if (0 != epoll_ctl(ptContext->nEpoll, EPOLL_CTL_ADD, ptContext->nSocket, &tEpollEvent))
+		{
+			eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+				LOG_SEV_ERROR,
+				"epoll_ctl() failure (errno=%d).",
+				errno);
+			goto lblCleanup;
+		}
+	}
+
+	// Attach the keyboards already present
+	if (bIsKernelSocket)
+	{
+		eStatus = evdevsource_Enumerate(ptContext);
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			DEBUG_MSG(LOG_SEV_ERROR,
+				"evdevsource_Enumerate() failed (eStatus=0x%.8x).",
+				eStatus);
+			goto lblCleanup;
+		}
+	}
+
+	// Fill the dispatch table
+	ptSource->pszName = "evdev";
+	ptSource->bDeliversKeystrokes = TRUE;
+	ptSource->pfnRun = (EVENTSOURCE_EVDEV_ENGINE_IO_URING == ptContext->eEngine) ? evdevsource_RunUring : evdevsource_Run;
+	ptSource->pfnStop = evdevsource_Stop;
+	ptSource->pfnDestroy = evdevsource_Destroy;
+	ptSource->pvBackend = ptContext;
+	ptContext = NULL;
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	evdevsource_FreeContext(ptContext);
+	CLOSE_FD(nSocket);
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	EVENTSOURCE_AttachEvdevDevice									*
+********************************************************************************/
+RETSTATUS
+EVENTSOURCE_AttachEvdevDevice(
+	__inout PEVENTSOURCE ptSource,
+	__in INT nDevice,
+	__in ULONGLONG qwDeviceId,
+	__in_opt PCDEVICEID ptIdentity,
+	__in BOOL bIsHeld
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != ptSource);
+	ASSERT((evdevsource_Run == ptSource->pfnRun) || (evdevsource_RunUring == ptSource->pfnRun));
+
+	// Reads must not block the loop
+	if (0 != fcntl(nDevice, F_SETFL, fcntl(nDevice, F_GETFL) | O_NONBLOCK))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"fcntl() failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+	eStatus = evdevsource_Attach((PEVDEVSOURCE_CONTEXT)(ptSource->pvBackend), nDevice, -1, qwDeviceId, ptIdentity, bIsHeld);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		DEBUG_MSG(LOG_SEV_ERROR,
+			"evdevsource_Attach() failed (eStatus=0x%.8x).",
+			eStatus);
+		goto lblCleanup;
+	}
+	nDevice = -1;
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	CLOSE_FD(nDevice);
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	EVENTSOURCE_HoldNewEvdevDevices									*
+********************************************************************************/
+BOOL
+EVENTSOURCE_HoldNewEvdevDevices(
+	__inout PEVENTSOURCE ptSource
+)
+{
+	// Validations
+	ASSERT(NULL != ptSource);
+
+	if ((evdevsource_Run != ptSource->pfnRun) && (evdevsource_RunUring != ptSource->pfnRun))
+	{
+		return FALSE;
+	}
+	((PEVDEVSOURCE_CONTEXT)(ptSource->pvBackend))->bShouldHoldNew = TRUE;
+	return TRUE;
+}
+
+/********************************************************************************
+*  Function:	EVENTSOURCE_GetEvdevStats										*
+********************************************************************************/
+BOOL
+EVENTSOURCE_GetEvdevStats(
+	__in const EVENTSOURCE *ptSource,
+	__out PEVENTSOURCE_EVDEV_STATS ptStats
+)
+{
+	PEVDEVSOURCE_CONTEXT ptContext = NULL;
+
+	// Validations
+	ASSERT(NULL != ptSource);
+	ASSERT(NULL != ptStats);
+
+	RtlZeroMemory(ptStats, sizeof(*ptStats));
+	if ((evdevsource_Run != ptSource->pfnRun) && (evdevsource_RunUring != ptSource->pfnRun))
+	{
+		return FALSE;
+	}
+	ptContext = (PEVDEVSOURCE_CONTEXT)(ptSource->pvBackend);
+	ptStats->eEngine = ptContext->eEngine;
+	ptStats->dwDevices = (DWORD)ATOMIC_LOAD_ACQUIRE(&(ptContext->nDevices));
+	ptStats->qwKeys = ptContext->qwKeys;
+	ptStats->qwWaits = ptContext->qwWaits;
+	ptStats->qwReads = ptContext->qwReads;
+	ptStats->qwDroppedReports = ptContext->qwDroppedReports;
+	ptStats->dwHeldDevices = (DWORD)ATOMIC_LOAD_ACQUIRE(&(ptContext->nHeldDevices));
+	return TRUE;
+}
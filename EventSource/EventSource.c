@@ -0,0 +1,115 @@
+/********************************************************************************
+*  File:		EventSource.c													*
+*  Purpose:		Device event source interface.									*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#include "EventSource.h"
+#include <Clock.h>
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	EVENTSOURCE_Run													*
+********************************************************************************/
+RETSTATUS
+EVENTSOURCE_Run(
+	__inout PEVENTSOURCE ptSource,
+	__in PFN_EVENTSOURCE_CALLBACK pfnCallback,
+	__inout_opt PVOID pvContext
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != ptSource);
+	ASSERT(NULL != ptSource->pfnRun);
+	ASSERT(NULL != pfnCallback);
+
+	// Dispatch to the backend
+	DEBUG_MSG(LOG_SEV_INFO, "Running event source '%s'.", ptSource->pszName);
+	eStatus = ptSource->pfnRun(ptSource, pfnCallback, pvContext);
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	EVENTSOURCE_Stop												*
+********************************************************************************/
+VOID
+EVENTSOURCE_Stop(
+	__inout PEVENTSOURCE ptSource
+)
+{
+	// Validations
+	ASSERT(NULL != ptSource);
+
+	// Dispatch to the backend
+	if (NULL != ptSource->pfnStop)
+	{
+		ptSource->pfnStop(ptSource);
+	}
+}
+
+/********************************************************************************
+*  Function:	EVENTSOURCE_SetArmed											*
+********************************************************************************/
+VOID
+EVENTSOURCE_SetArmed(
+	__inout PEVENTSOURCE ptSource
+)
+{
+	// Validations
+	ASSERT(NULL != ptSource);
+
+	ptSource->qwArmedTimestamp = CLOCK_GetTimestamp();
+	if (NULL != ptSource->pfnArmed)
+	{
+		ptSource->pfnArmed(ptSource);
+	}
+}
+
+/********************************************************************************
+*  Function:	EVENTSOURCE_Destroy												*
+********************************************************************************/
+VOID
+EVENTSOURCE_Destroy(
+	__inout PEVENTSOURCE ptSource
+)
+{
+	// Validations
+	ASSERT(NULL != ptSource);
+
+	// Dispatch to the backend
+	if (NULL != ptSource->pfnDestroy)
+	{
+		ptSource->pfnDestroy(ptSource);
+	}
+	RtlZeroMemory(ptSource, sizeof(*ptSource));
+}
+
+/********************************************************************************
+*  Function:	EVENTSOURCE_CreateDefault										*
+********************************************************************************/
+RETSTATUS
+EVENTSOURCE_CreateDefault(
+	__out PEVENTSOURCE ptSource
+)
+{
+#ifdef _WIN32
+	return EVENTSOURCE_CreateWindowSource(ptSource);
+#else	// _WIN32
+	if (RETSTATUS_SUCCEEDED(EVENTSOURCE_CreateEvdevSource(-1, EVENTSOURCE_EVDEV_ENGINE_AUTO, ptSource)))
+	{
+		return RETSTATUS_SUCCESS;
+	}
+	DEBUG_MSG(LOG_SEV_INFO, "Cannot read input devices, keystrokes will not be analyzed.");
+	return EVENTSOURCE_CreateUeventSource(-1, ptSource);
+#endif	// _WIN32
+}
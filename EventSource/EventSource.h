@@ -0,0 +1,428 @@
+/********************************************************************************
+*  File:		EventSource.h													*
+*  Purpose:		Device event source interface and backends.						*
+********************************************************************************/
+#pragma once
+
+
+/** Includes *******************************************************************/
+#include <Utilities.h>
+#include "DeviceId.h"
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	EVENTSOURCE_MAX_NAME_CHARS										*
+*  Purpose:		Maximum device name length in characters, including the			*
+*				terminating NUL. Longer names are truncated.					*
+********************************************************************************/
+#define EVENTSOURCE_MAX_NAME_CHARS (256)
+
+#ifndef _WIN32
+/********************************************************************************
+*  Constant:	EVENTSOURCE_UEVENT_BUFFER_SIZE									*
+*  Purpose:		Receive buffer size for a single uevent message (the kernel		*
+*				limits the environment to 2048 bytes plus the header).			*
+********************************************************************************/
+#define EVENTSOURCE_UEVENT_BUFFER_SIZE (8192)
+
+/********************************************************************************
+*  Constant:	EVENTSOURCE_REPLAY_VENDOR_ID									*
+*  Purpose:		Vendor ID of the virtual keyboard that replays held keys (see	*
+*				Quarantine/Quarantine.h), on BUS_VIRTUAL.						*
+*  Remarks:		* Evdev sources never read it, its keys were judged on the		*
+*					keyboard they came from.									*
+********************************************************************************/
+#define EVENTSOURCE_REPLAY_VENDOR_ID (0x4144)
+
+/********************************************************************************
+*  Constant:	EVENTSOURCE_REPLAY_PRODUCT_ID									*
+*  Purpose:		Product ID of the virtual keyboard that replays held keys.		*
+********************************************************************************/
+#define EVENTSOURCE_REPLAY_PRODUCT_ID (0x5250)
+#endif	// _WIN32
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Enum:		EVENTSOURCE_EVENT_TYPE											*
+*  Purpose:		The type of a device event.										*
+********************************************************************************/
+typedef enum
+{
+	EVENTSOURCE_EVENT_TYPE_ARRIVAL,
+	EVENTSOURCE_EVENT_TYPE_REMOVAL,
+	EVENTSOURCE_EVENT_TYPE_KEY
+} EVENTSOURCE_EVENT_TYPE, *PEVENTSOURCE_EVENT_TYPE;
+
+/********************************************************************************
+*  Enum:		EVENTSOURCE_DEVICE_CLASS										*
+*  Purpose:		The class of the device that caused an event.					*
+********************************************************************************/
+typedef enum
+{
+	EVENTSOURCE_DEVICE_CLASS_OTHER,
+	EVENTSOURCE_DEVICE_CLASS_KEYBOARD
+} EVENTSOURCE_DEVICE_CLASS, *PEVENTSOURCE_DEVICE_CLASS;
+
+#ifndef _WIN32
+/********************************************************************************
+*  Enum:		EVENTSOURCE_EVDEV_ENGINE										*
+*  Purpose:		How the evdev source waits on and reads its descriptors.		*
+********************************************************************************/
+typedef enum
+{
+	EVENTSOURCE_EVDEV_ENGINE_AUTO,					// io_uring if available, epoll otherwise
+	EVENTSOURCE_EVDEV_ENGINE_EPOLL,					// epoll_wait, then read on each ready keyboard
+	EVENTSOURCE_EVDEV_ENGINE_IO_URING				// Multishot reads into provided buffers
+} EVENTSOURCE_EVDEV_ENGINE, *PEVENTSOURCE_EVDEV_ENGINE;
+#endif	// _WIN32
+
+/********************************************************************************
+*  Structure:	EVENTSOURCE_EVENT												*
+*  Purpose:		A device event, as delivered by an event source.				*
+*  Remarks:		* Key events carry the device ID and scan code, arrivals and	*
+*					removals carry the device name.								*
+*				* The identity is filled when the source can tell it, for any	*
+*					event type.													*
+*				* Scan codes are in set 1, with 0xE000 set for E0 prefixed keys.	*
+*				* The evdev source stamps key events with the kernel's time of	*
+*					the key (on the same clock), as it reads them in batches.	*
+*				* When it stops reading a held keyboard, the evdev source		*
+*					delivers a removal with its hold ID (and no name). It only	*
+*					frees the keyboard's hold, the device's own removal comes	*
+*					as usual.													*
+********************************************************************************/
+typedef struct _EVENTSOURCE_EVENT
+{
+	EVENTSOURCE_EVENT_TYPE eType;					// Event type
+	EVENTSOURCE_DEVICE_CLASS eClass;				// Device class
+	ULONGLONG qwTimestamp;							// Receipt time (CLOCK_GetTimestamp)
+	ULONGLONG qwClassifiedTimestamp;				// Delivery time, once decoded and classified
+	ULONGLONG qwDeviceId;							// Source-specific device ID (key events)
+	WORD wScanCode;									// Scan code (key events)
+	BOOLEAN bIsKeyDown;								// Press or release (key events)
+	BOOLEAN bIsRepeat;								// Autorepeat of a pressed key (evdev key events)
+	WORD wKeyCode;									// Native key code, to replay it (evdev key events)
+	DWORD dwHoldId;									// Per grab, if withheld from the system (evdev key events and detaches), or 0
+	DEVICEID tIdentity;								// VID, PID and serial (if known)
+	CHAR szName[EVENTSOURCE_MAX_NAME_CHARS];		// OS device name (NUL terminated)
+} EVENTSOURCE_EVENT, *PEVENTSOURCE_EVENT;
+typedef const EVENTSOURCE_EVENT *PCEVENTSOURCE_EVENT;
+
+#ifndef _WIN32
+/********************************************************************************
+*  Structure:	EVENTSOURCE_EVDEV_STATS											*
+*  Purpose:		A snapshot of the evdev source's counters.						*
+*  Remarks:		* Counters may be slightly stale, as they are read while the	*
+*					source runs.												*
+********************************************************************************/
+typedef struct _EVENTSOURCE_EVDEV_STATS
+{
+	EVENTSOURCE_EVDEV_ENGINE eEngine;				// The engine in use (never AUTO)
+	DWORD dwDevices;								// Keyboards being read
+	ULONGLONG qwKeys;								// Key events delivered
+	ULONGLONG qwWaits;								// epoll_wait or io_uring_enter calls
+	ULONGLONG qwReads;								// read calls on keyboards (none with io_uring)
+	ULONGLONG qwDroppedReports;						// SYN_DROPPED reports (kernel buffer overruns)
+	DWORD dwHeldDevices;							// Keyboards grabbed, their keys withheld
+} EVENTSOURCE_EVDEV_STATS, *PEVENTSOURCE_EVDEV_STATS;
+#endif	// _WIN32
+
+/********************************************************************************
+*  Callback:	PFN_EVENTSOURCE_CALLBACK										*
+*  Purpose:		Consumes a single device event.									*
+*  Parameters:	@ ptEvent ~[in]~ The event.										*
+*				@ pvContext ~[inout]~ The context given to EVENTSOURCE_Run.		*
+*  Remarks:		* Invoked on the thread that called EVENTSOURCE_Run.			*
+*				* The event is only valid for the duration of the call.			*
+********************************************************************************/
+typedef VOID (*PFN_EVENTSOURCE_CALLBACK)(
+	__in PCEVENTSOURCE_EVENT ptEvent,
+	__inout_opt PVOID pvContext
+);
+
+struct _EVENTSOURCE;
+
+/********************************************************************************
+*  Callback:	PFN_EVENTSOURCE_RUN												*
+*  Purpose:		Backend routine that delivers events until stopped.				*
+*  Parameters:	@ ptSource ~[inout]~ The event source.							*
+*				@ pfnCallback ~[in]~ The event callback.						*
+*				@ pvContext ~[inout]~ Optional context for the callback.		*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+typedef RETSTATUS (*PFN_EVENTSOURCE_RUN)(
+	__inout struct _EVENTSOURCE *ptSource,
+	__in PFN_EVENTSOURCE_CALLBACK pfnCallback,
+	__inout_opt PVOID pvContext
+);
+
+/********************************************************************************
+*  Callback:	PFN_EVENTSOURCE_ROUTINE											*
+*  Purpose:		Backend routine that operates on the source (stop, destroy).	*
+*  Parameters:	@ ptSource ~[inout]~ The event source.							*
+********************************************************************************/
+typedef VOID (*PFN_EVENTSOURCE_ROUTINE)(
+	__inout struct _EVENTSOURCE *ptSource
+);
+
+/********************************************************************************
+*  Structure:	EVENTSOURCE														*
+*  Purpose:		A device event source (backend dispatch table and context).		*
+*  Remarks:		* pfnArmed is the only member set by the user, before			*
+*					EVENTSOURCE_Run.											*
+********************************************************************************/
+typedef struct _EVENTSOURCE
+{
+	PCSTR pszName;									// Backend name
+	BOOL bDeliversKeystrokes;						// Whether key events are delivered
+	PFN_EVENTSOURCE_RUN pfnRun;						// Delivers events until stopped
+	PFN_EVENTSOURCE_ROUTINE pfnStop;				// Makes pfnRun return (any thread)
+	PFN_EVENTSOURCE_ROUTINE pfnDestroy;				// Frees backend resources
+	PFN_EVENTSOURCE_ROUTINE pfnArmed;				// Optional, see EVENTSOURCE_SetArmed
+	ULONGLONG qwArmedTimestamp;						// When pfnRun began listening, or 0
+	PVOID pvBackend;								// Backend context
+} EVENTSOURCE, *PEVENTSOURCE;
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	EVENTSOURCE_Run													*
+*  Purpose:		Delivers events from the source until it is stopped.			*
+*  Parameters:	@ ptSource ~[inout]~ The event source.							*
+*				@ pfnCallback ~[in]~ The event callback.						*
+*				@ pvContext ~[inout]~ Optional context for the callback.		*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+RETSTATUS
+EVENTSOURCE_Run(
+	__inout PEVENTSOURCE ptSource,
+	__in PFN_EVENTSOURCE_CALLBACK pfnCallback,
+	__inout_opt PVOID pvContext
+);
+
+/********************************************************************************
+*  Function:	EVENTSOURCE_Stop												*
+*  Purpose:		Makes a running EVENTSOURCE_Run return.							*
+*  Parameters:	@ ptSource ~[inout]~ The event source.							*
+*  Remarks:		* May be called from any thread.								*
+********************************************************************************/
+VOID
+EVENTSOURCE_Stop(
+	__inout PEVENTSOURCE ptSource
+);
+
+/********************************************************************************
+*  Function:	EVENTSOURCE_SetArmed											*
+*  Purpose:		Marks a running source as listening for every event.			*
+*  Parameters:	@ ptSource ~[inout]~ The event source.							*
+*  Remarks:		* Called by the backends, once per EVENTSOURCE_Run, on the		*
+*					thread that runs it.										*
+*				* Records qwArmedTimestamp, then calls pfnArmed if set.			*
+********************************************************************************/
+VOID
+EVENTSOURCE_SetArmed(
+	__inout PEVENTSOURCE ptSource
+);
+
+/********************************************************************************
+*  Function:	EVENTSOURCE_Destroy												*
+*  Purpose:		Frees an event source created by one of the backends.			*
+*  Parameters:	@ ptSource ~[inout]~ The event source.							*
+*  Remarks:		* The source must not be running.								*
+********************************************************************************/
+VOID
+EVENTSOURCE_Destroy(
+	__inout PEVENTSOURCE ptSource
+);
+
+/********************************************************************************
+*  Function:	EVENTSOURCE_CreateDefault										*
+*  Purpose:		Creates the default event source for the current platform.		*
+*  Parameters:	@ ptSource ~[out]~ Gets the event source.						*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Free with EVENTSOURCE_Destroy.								*
+*				* On Linux this is the evdev source, or the uevent source		*
+*					(arrivals only) if input devices cannot be read.			*
+********************************************************************************/
+RETSTATUS
+EVENTSOURCE_CreateDefault(
+	__out PEVENTSOURCE ptSource
+);
+
+#ifdef _WIN32
+/********************************************************************************
+*  Function:	EVENTSOURCE_CreateWindowSource									*
+*  Purpose:		Creates a source that receives WM_DEVICECHANGE notifications	*
+*				for keyboard HID interfaces, and raw keyboard input, on a		*
+*				message-only window.											*
+*  Parameters:	@ ptSource ~[out]~ Gets the event source.						*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Free with EVENTSOURCE_Destroy.								*
+*				* The window is created by EVENTSOURCE_Run, on its thread.		*
+********************************************************************************/
+RETSTATUS
+EVENTSOURCE_CreateWindowSource(
+	__out PEVENTSOURCE ptSource
+);
+#else	// _WIN32
+/********************************************************************************
+*  Function:	EVENTSOURCE_CreateUeventSource									*
+*  Purpose:		Creates a source that receives kernel uevents from a			*
+*				NETLINK_KOBJECT_UEVENT socket.									*
+*  Parameters:	@ nSocket ~[in]~ A datagram socket that carries raw uevents, or	*
+*				-1 to open and bind the kernel uevent socket.					*
+*				@ ptSource ~[out]~ Gets the event source.						*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Free with EVENTSOURCE_Destroy.								*
+*				* A given socket is owned (and closed) by the source. This		*
+*					allows feeding the source from a local socketpair.			*
+********************************************************************************/
+RETSTATUS
+EVENTSOURCE_CreateUeventSource(
+	__in INT nSocket,
+	__out PEVENTSOURCE ptSource
+);
+
+/********************************************************************************
+*  Function:	EVENTSOURCE_DecodeUevent										*
+*  Purpose:		Decodes and classifies a raw kernel uevent message.				*
+*  Parameters:	@ pcMessage ~[in]~ The message ("ACTION@DEVPATH\0KEY=VALUE\0...").	*
+*				@ cbMessage ~[in]~ The message size in bytes.					*
+*				@ ptEvent ~[out]~ Gets the event. The timestamp is untouched.	*
+*  Returns:		TRUE if the message is a device arrival or removal.				*
+********************************************************************************/
+BOOL
+EVENTSOURCE_DecodeUevent(
+	__in_bcount(cbMessage) const CHAR *pcMessage,
+	__in SIZE_T cbMessage,
+	__out PEVENTSOURCE_EVENT ptEvent
+);
+
+/********************************************************************************
+*  Function:	EVENTSOURCE_OpenUeventSocket									*
+*  Purpose:		Opens a socket bound to the kernel uevent multicast group.		*
+*  Parameters:	@ pnSocket ~[out]~ Gets the socket.								*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+RETSTATUS
+EVENTSOURCE_OpenUeventSocket(
+	__out PINT pnSocket
+);
+
+/********************************************************************************
+*  Function:	EVENTSOURCE_DrainUevents										*
+*  Purpose:		Receives and delivers all pending uevents without blocking.		*
+*  Parameters:	@ nSocket ~[in]~ The uevent socket (or a stand-in).				*
+*				@ pcBuffer ~[out]~ A receive buffer of							*
+*				EVENTSOURCE_UEVENT_BUFFER_SIZE bytes.							*
+*				@ pfnCallback ~[in]~ The event callback.						*
+*				@ pvContext ~[inout]~ Optional context for the callback.		*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Shared by the uevent and evdev sources.						*
+********************************************************************************/
+RETSTATUS
+EVENTSOURCE_DrainUevents(
+	__in INT nSocket,
+	__out_bcount(EVENTSOURCE_UEVENT_BUFFER_SIZE) CHAR *pcBuffer,
+	__in PFN_EVENTSOURCE_CALLBACK pfnCallback,
+	__inout_opt PVOID pvContext
+);
+
+/********************************************************************************
+*  Function:	EVENTSOURCE_CreateEvdevSource									*
+*  Purpose:		Creates a source that receives kernel uevents like the uevent	*
+*				source, and keystrokes from every keyboard's evdev node			*
+*				(/dev/input/eventN), all from a single loop.					*
+*  Parameters:	@ nSocket ~[in]~ A datagram socket that carries raw uevents, or	*
+*				-1 to open and bind the kernel uevent socket and attach the		*
+*				keyboards already present.										*
+*				@ eEngine ~[in]~ The engine. AUTO falls back to epoll when		*
+*				io_uring (with multishot reads) is unavailable, IO_URING		*
+*				fails then.														*
+*				@ ptSource ~[out]~ Gets the event source.						*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Free with EVENTSOURCE_Destroy.								*
+*				* A given socket is owned (and closed) by the source.			*
+*				* Keyboards are attached and detached as their event nodes		*
+*					arrive and leave. Fails if a keyboard present at creation	*
+*					cannot be read (permissions).								*
+*				* With epoll, each wakeup drains up to 64 input_event records	*
+*					per read. With io_uring, a multishot read stays queued on	*
+*					every keyboard and each io_uring_enter harvests all the		*
+*					completed buffers, so bursts cost no syscall per read.		*
+********************************************************************************/
+RETSTATUS
+EVENTSOURCE_CreateEvdevSource(
+	__in INT nSocket,
+	__in EVENTSOURCE_EVDEV_ENGINE eEngine,
+	__out PEVENTSOURCE ptSource
+);
+
+/********************************************************************************
+*  Function:	EVENTSOURCE_AttachEvdevDevice									*
+*  Purpose:		Reads keystrokes from a given descriptor, such as a pipe		*
+*				stand-in that carries struct input_event records.				*
+*  Parameters:	@ ptSource ~[inout]~ An evdev source.							*
+*				@ nDevice ~[in]~ The descriptor, owned (and closed) by the		*
+*				source from now on.												*
+*				@ qwDeviceId ~[in]~ The device ID of its key events.			*
+*				@ ptIdentity ~[in_opt]~ The identity of its key events, or		*
+*				NULL.															*
+*				@ bIsHeld ~[in]~ Whether its key events carry a hold ID, as a	*
+*				grabbed keyboard's do.											*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Call before EVENTSOURCE_Run, or from its callback.			*
+*				* Records stamped 0 get the time they are read at, others		*
+*					must be on the CLOCK_GetTimestamp clock.					*
+*				* The device is detached at end of file.						*
+********************************************************************************/
+RETSTATUS
+EVENTSOURCE_AttachEvdevDevice(
+	__inout PEVENTSOURCE ptSource,
+	__in INT nDevice,
+	__in ULONGLONG qwDeviceId,
+	__in_opt PCDEVICEID ptIdentity,
+	__in BOOL bIsHeld
+);
+
+/********************************************************************************
+*  Function:	EVENTSOURCE_HoldNewEvdevDevices									*
+*  Purpose:		Makes an evdev source grab (EVIOCGRAB) the keyboards that		*
+*				arrive from now on, so their keys reach the system only when	*
+*				replayed (see Quarantine/Quarantine.h).							*
+*  Parameters:	@ ptSource ~[inout]~ The event source.							*
+*  Returns:		FALSE if the source is not an evdev source.						*
+*  Remarks:		* Call before EVENTSOURCE_Run. Keyboards present at creation	*
+*					are never grabbed.											*
+*				* Key events of grabbed keyboards carry a hold ID, new per grab,	*
+*					so a keyboard plugged again is held again. A keyboard		*
+*					that cannot be grabbed (already grabbed elsewhere) is read	*
+*					as usual.													*
+*				* Only keys (below BTN_MISC) are delivered, so the buttons and	*
+*					other controls of a grabbed keyboard are lost until it is	*
+*					plugged again without quarantine.							*
+********************************************************************************/
+BOOL
+EVENTSOURCE_HoldNewEvdevDevices(
+	__inout PEVENTSOURCE ptSource
+);
+
+/********************************************************************************
+*  Function:	EVENTSOURCE_GetEvdevStats										*
+*  Purpose:		Gets the evdev source's counters.								*
+*  Parameters:	@ ptSource ~[in]~ The event source.								*
+*				@ ptStats ~[out]~ Gets the counters.							*
+*  Returns:		FALSE if the source is not an evdev source.						*
+*  Remarks:		* May be called from any thread.								*
+********************************************************************************/
+BOOL
+EVENTSOURCE_GetEvdevStats(
+	__in const EVENTSOURCE *ptSource,
+	__out PEVENTSOURCE_EVDEV_STATS ptStats
+);
+#endif	// _WIN32
@@ -0,0 +1,540 @@
+/********************************************************************************
+*  File:		UeventSource.c													*
+*  Purpose:		Kernel uevent based event source (Linux).						*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#include <errno.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include "EventSource.h"
+#include <Clock.h>
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	UEVENT_SOCKET_RCVBUF											*
+*  Purpose:		Socket receive buffer size, sized for arrival storms.			*
+********************************************************************************/
+#define UEVENT_SOCKET_RCVBUF (1024 * 1024)
+
+/********************************************************************************
+*  Constant:	UEVENT_KERNEL_GROUP												*
+*  Purpose:		The netlink multicast group of kernel (not udev) uevents.		*
+********************************************************************************/
+#define UEVENT_KERNEL_GROUP (1)
+
+/********************************************************************************
+*  Constant:	UEVENT_EV_KEYBOARD_MASK											*
+*  Purpose:		EV capability bits of a keyboard (EV_KEY and EV_REP).			*
+********************************************************************************/
+#define UEVENT_EV_KEYBOARD_MASK ((1UL << 0x01) | (1UL << 0x14))
+
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Structure:	UEVENTSOURCE_CONTEXT											*
+*  Purpose:		The backend context.											*
+********************************************************************************/
+typedef struct _UEVENTSOURCE_CONTEXT
+{
+	INT nSocket;									// Uevent socket
+	INT nStopEvent;									// eventfd signalled by pfnStop
+	CHAR acBuffer[EVENTSOURCE_UEVENT_BUFFER_SIZE];	// Receive buffer
+} UEVENTSOURCE_CONTEXT, *PUEVENTSOURCE_CONTEXT;
+
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	ueventsource_StartsWith											*
+*  Purpose:		Checks whether a NUL terminated field starts with a prefix.		*
+*  Parameters:	@ pszField ~[in]~ The field.									*
+*				@ pszPrefix ~[in]~ The prefix.									*
+*				@ cchPrefix ~[in]~ The prefix length, in characters.			*
+*  Returns:		A pointer right after the prefix, or NULL.						*
+********************************************************************************/
+static
+__inline
+PCSTR
+ueventsource_StartsWith(
+	__in PCSTR pszField,
+	__in PCSTR pszPrefix,
+	__in SIZE_T cchPrefix
+)
+{
+	return (0 == strncmp(pszField, pszPrefix, cchPrefix)) ? (pszField + cchPrefix) : NULL;
+}
+
+/********************************************************************************
+*  Function:	ueventsource_ParseHex											*
+*  Purpose:		Parses the lowest word of a hexadecimal capability bitmap.		*
+*  Parameters:	@ pszValue ~[in]~ The value (space separated words, most		*
+*				significant first).												*
+*  Returns:		The lowest word.												*
+********************************************************************************/
+static
+ULONGLONG
+ueventsource_ParseHex(
+	__in PCSTR pszValue
+)
+{
+	ULONGLONG qwValue = 0;
+	CHAR cDigit = '\0';
+
+	// Only the last word holds bits 0..63, so restart on every separator
+	for (; '\0' != *pszValue; pszValue++)
+	{
+		cDigit = *pszValue;
+		if (' ' == cDigit)
+		{
+			qwValue = 0;
+		}
+		else if (('0' <= cDigit) && ('9' >= cDigit))
+		{
+			qwValue = (qwValue * HEXADECIMAL_BASE) + (ULONGLONG)(cDigit - '0');
+		}
+		else if (('a' <= cDigit) && ('f' >= cDigit))
+		{
+			qwValue = (qwValue * HEXADECIMAL_BASE) + (ULONGLONG)(cDigit - 'a' + 10);
+		}
+	}
+
+	// Return result
+	return qwValue;
+}
+
+/********************************************************************************
+*  Function:	EVENTSOURCE_DecodeUevent										*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+********************************************************************************/
+BOOL
+EVENTSOURCE_DecodeUevent(
+	__in_bcount(cbMessage) const CHAR *pcMessage,
+	__in SIZE_T cbMessage,
+	__out PEVENTSOURCE_EVENT ptEvent
+)
+{
+	BOOL bIsDevice = FALSE;
+	BOOL bHasAction = FALSE;
+	BOOL bIsInput = FALSE;
+	ULONGLONG qwEvBits = 0;
+	PCSTR pszProduct = NULL;
+	PCSTR pszUniq = NULL;
+	PCSTR pszField = NULL;
+	PCSTR pszValue = NULL;
+	PCSTR pszEnd = pcMessage + cbMessage;
+	SIZE_T cchField = 0;
+
+	// Validations
+	ASSERT(NULL != pcMessage);
+	ASSERT(NULL != ptEvent);
+
+	// Default to an unknown device with no name
+	ptEvent->eClass = EVENTSOURCE_DEVICE_CLASS_OTHER;
+	ptEvent->tIdentity.bIsValid = FALSE;
+	ptEvent->szName[0] = '\0';
+
+	// The message must be NUL terminated so that every field is a C string
+	if ((0 == cbMessage) || ('\0' != pcMessage[cbMessage - 1]))
+	{
+		goto lblCleanup;
+	}
+
+	// Walk the fields (the "ACTION@DEVPATH" header is skipped since ACTION and DEVPATH repeat as properties)
+	for (pszField = pcMessage; pszField < pszEnd; pszField += cchField + 1)
+	{
+		cchField = strlen(pszField);
+		if (NULL != (pszValue = ueventsource_StartsWith(pszField, "ACTION=", sizeof("ACTION=") - 1)))
+		{
+			if (0 == strcmp(pszValue, "add"))
+			{
+				ptEvent->eType = EVENTSOURCE_EVENT_TYPE_ARRIVAL;
+				bHasAction = TRUE;
+			}
+			else if (0 == strcmp(pszValue, "remove"))
+			{
+				ptEvent->eType = EVENTSOURCE_EVENT_TYPE_REMOVAL;
+				bHasAction = TRUE;
+			}
+		}
+		else if (NULL != (pszValue = ueventsource_StartsWith(pszField, "DEVPATH=", sizeof("DEVPATH=") - 1)))
+		{
+			(VOID)snprintf(ptEvent->szName, sizeof(ptEvent->szName), "%s", pszValue);
+		}
+		else if (NULL != (pszValue = ueventsource_StartsWith(pszField, "SUBSYSTEM=", sizeof("SUBSYSTEM=") - 1)))
+		{
+			bIsInput = (0 == strcmp(pszValue, "input"));
+		}
+		else if (NULL != (pszValue = ueventsource_StartsWith(pszField, "EV=", sizeof("EV=") - 1)))
+		{
+			qwEvBits = ueventsource_ParseHex(pszValue);
+		}
+		else if (NULL != (pszValue = ueventsource_StartsWith(pszField, "PRODUCT=", sizeof("PRODUCT=") - 1)))
+		{
+			pszProduct = pszValue;
+		}
+		else if (NULL != (pszValue = ueventsource_StartsWith(pszField, "UNIQ=", sizeof("UNIQ=") - 1)))
+		{
+			pszUniq = pszValue;
+		}
+	}
+
+	// Only arrivals and removals of named devices are interesting
+	if ((!bHasAction) || ('\0' == ptEvent->szName[0]))
+	{
+		goto lblCleanup;
+	}
+
+	// Keyboards are input devices that report keys with auto-repeat (only the inputN node has EV, eventN does not)
+	if ((bIsInput) && (UEVENT_EV_KEYBOARD_MASK == (qwEvBits & UEVENT_EV_KEYBOARD_MASK)))
+	{
+		ptEvent->eClass = EVENTSOURCE_DEVICE_CLASS_KEYBOARD;
+	}
+
+	// Input devices carry their identity as PRODUCT ("bus/vendor/product/version") and UNIQ (the serial)
+	if ((bIsInput) && (NULL != pszProduct))
+	{
+		(VOID)DEVICEID_ParseInputProduct(pszProduct, pszUniq, &(ptEvent->tIdentity));
+	}
+
+	// Success
+	bIsDevice = TRUE;
+
+lblCleanup:
+
+	// Return result
+	return bIsDevice;
+}
+
+/********************************************************************************
+*  Function:	EVENTSOURCE_DrainUevents										*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+********************************************************************************/
+RETSTATUS
+EVENTSOURCE_DrainUevents(
+	__in INT nSocket,
+	__out_bcount(EVENTSOURCE_UEVENT_BUFFER_SIZE) CHAR *pcBuffer,
+	__in PFN_EVENTSOURCE_CALLBACK pfnCallback,
+	__inout_opt PVOID pvContext
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	EVENTSOURCE_EVENT tEvent = { 0 };
+	struct sockaddr_nl tSender = { 0 };
+	socklen_t cbSender = 0;
+	ssize_t cbReceived = 0;
+
+	for (;;)
+	{
+		// Receive a single datagram
+		cbSender = sizeof(tSender);
+		cbReceived = recvfrom(nSocket,
+			pcBuffer,
+			EVENTSOURCE_UEVENT_BUFFER_SIZE - 1,
+			MSG_DONTWAIT,
+			(struct sockaddr *)&tSender,
+			&cbSender);
+		tEvent.qwTimestamp = CLOCK_GetTimestamp();
+		if (0 > cbReceived)
+		{
+			if ((EAGAIN == errno) || (EWOULDBLOCK == errno) || (EINTR == errno))
+			{
+				break;
+			}
+			eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+				LOG_SEV_ERROR,
+				"recvfrom() failure (errno=%d).",
+				errno);
+			goto lblCleanup;
+		}
+
+		// Drop netlink messages that did not come from the kernel
+		if ((sizeof(tSender) <= cbSender) && (AF_NETLINK == tSender.nl_family) && (0 != tSender.nl_pid))
+		{
+			continue;
+		}
+
+		// Decode and deliver (terminate defensively, the kernel already does)
+		pcBuffer[cbReceived] = '\0';
+		if (EVENTSOURCE_DecodeUevent(pcBuffer, (SIZE_T)cbReceived + 1, &tEvent))
+		{
+			tEvent.qwClassifiedTimestamp = CLOCK_GetTimestamp();
+			pfnCallback(&tEvent, pvContext);
+		}
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	ueventsource_Run												*
+*  Purpose:		Blocks on the uevent socket and delivers events until stopped.	*
+*  Parameters:	@ ptSource ~[inout]~ The event source.							*
+*				@ pfnCallback ~[in]~ The event callback.						*
+*				@ pvContext ~[inout]~ Optional context for the callback.		*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+ueventsource_Run(
+	__inout PEVENTSOURCE ptSource,
+	__in PFN_EVENTSOURCE_CALLBACK pfnCallback,
+	__inout_opt PVOID pvContext
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	PUEVENTSOURCE_CONTEXT ptContext = (PUEVENTSOURCE_CONTEXT)(ptSource->pvBackend);
+	struct pollfd atFds[2] = { { 0 } };
+
+	DEBUG_ENTER();
+
+	// Wait on both the socket and the stop event, without any timeout
+	atFds[0].fd = ptContext->nSocket;
+	atFds[0].events = POLLIN;
+	atFds[1].fd = ptContext->nStopEvent;
+	atFds[1].events = POLLIN;
+
+	// The socket was bound at creation, so nothing is missed from here on
+	EVENTSOURCE_SetArmed(ptSource);
+	for (;;)
+	{
+		if (0 > poll(atFds, sizeof(atFds) / sizeof(atFds[0]), -1))
+		{
+			if (EINTR == errno)
+			{
+				continue;
+			}
+			eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+				LOG_SEV_ERROR,
+				"poll() failure (errno=%d).",
+				errno);
+			goto lblCleanup;
+		}
+
+		// Stop requested
+		if (0 != atFds[1].revents)
+		{
+			break;
+		}
+
+		// Deliver everything that is pending
+		if (0 != (atFds[0].revents & POLLIN))
+		{
+			eStatus = EVENTSOURCE_DrainUevents(ptContext->nSocket, ptContext->acBuffer, pfnCallback, pvContext);
+			if (RETSTATUS_FAILED(eStatus))
+			{
+				DEBUG_MSG(LOG_SEV_ERROR,
+					"EVENTSOURCE_DrainUevents() failed (eStatus=0x%.8x).",
+					eStatus);
+				goto lblCleanup;
+			}
+		}
+		else if (0 != atFds[0].revents)
+		{
+			// The peer is gone (socketpair stand-in)
+			break;
+		}
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	ueventsource_Stop												*
+*  Purpose:		Signals the stop event, which makes ueventsource_Run return.	*
+*  Parameters:	@ ptSource ~[inout]~ The event source.							*
+********************************************************************************/
+static
+VOID
+ueventsource_Stop(
+	__inout PEVENTSOURCE ptSource
+)
+{
+	PUEVENTSOURCE_CONTEXT ptContext = (PUEVENTSOURCE_CONTEXT)(ptSource->pvBackend);
+
+	// Best-effort
+	(VOID)eventfd_write(ptContext->nStopEvent, 1);
+}
+
+/********************************************************************************
+*  Function:	ueventsource_Destroy											*
+*  Purpose:		Closes the descriptors and frees the backend context.			*
+*  Parameters:	@ ptSource ~[inout]~ The event source.							*
+********************************************************************************/
+static
+VOID
+ueventsource_Destroy(
+	__inout PEVENTSOURCE ptSource
+)
+{
+	PUEVENTSOURCE_CONTEXT ptContext = (PUEVENTSOURCE_CONTEXT)(ptSource->pvBackend);
+
+	// Free resources
+	if (NULL != ptContext)
+	{
+		CLOSE_FD(ptContext->nSocket);
+		CLOSE_FD(ptContext->nStopEvent);
+	}
+	FREE(ptSource->pvBackend);
+}
+
+/********************************************************************************
+*  Function:	EVENTSOURCE_OpenUeventSocket									*
+********************************************************************************/
+RETSTATUS
+EVENTSOURCE_OpenUeventSocket(
+	__out PINT pnSocket
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	INT nSocket = -1;
+	INT nBufferSize = UEVENT_SOCKET_RCVBUF;
+	struct sockaddr_nl tAddress = { 0 };
+
+	DEBUG_ENTER();
+
+	// Open the socket
+	nSocket = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+	if (0 > nSocket)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"socket() failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+
+	// Make room for arrival storms (best-effort, forcing requires CAP_NET_ADMIN)
+	if (0 != setsockopt(nSocket, SOL_SOCKET, SO_RCVBUFFORCE, &nBufferSize, sizeof(nBufferSize)))
+	{
+		(VOID)setsockopt(nSocket, SOL_SOCKET, SO_RCVBUF, &nBufferSize, sizeof(nBufferSize));
+	}
+
+	// Subscribe to kernel uevents
+	tAddress.nl_family = AF_NETLINK;
+	tAddress.nl_groups = UEVENT_KERNEL_GROUP;
+	if (0 != bind(nSocket, (struct sockaddr *)&tAddress, sizeof(tAddress)))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"bind() failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+
+	// Success
+	*pnSocket = nSocket;
+	nSocket = -1;
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	CLOSE_FD(nSocket);
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	EVENTSOURCE_CreateUeventSource									*
+********************************************************************************/
+RETSTATUS
+EVENTSOURCE_CreateUeventSource(
+	__in INT nSocket,
+	__out PEVENTSOURCE ptSource
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	PUEVENTSOURCE_CONTEXT ptContext = NULL;
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != ptSource);
+
+	// Allocate the context
+	ptContext = ALLOCZ(sizeof(*ptContext));
+	if (NULL == ptContext)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"ALLOCZ() failure.");
+		goto lblCleanup;
+	}
+	ptContext->nSocket = nSocket;
+	nSocket = -1;
+
+	// Create the stop event
+	ptContext->nStopEvent = eventfd(0, EFD_CLOEXEC);
+	if (0 > ptContext->nStopEvent)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"eventfd() failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+
+	// Open the kernel socket unless a stand-in was given
+	if (0 > ptContext->nSocket)
+	{
+		eStatus = EVENTSOURCE_OpenUeventSocket(&(ptContext->nSocket));
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			DEBUG_MSG(LOG_SEV_ERROR,
+				"EVENTSOURCE_OpenUeventSocket() failed (eStatus=0x%.8x).",
+				eStatus);
+			goto lblCleanup;
+		}
+	}
+
+	// Fill the dispatch table
+	ptSource->pszName = "uevent";
+	ptSource->bDeliversKeystrokes = FALSE;
+	ptSource->pfnRun = ueventsource_Run;
+	ptSource->pfnStop = ueventsource_Stop;
+	ptSource->pfnDestroy = ueventsource_Destroy;
+	ptSource->pvBackend = ptContext;
+	ptContext = NULL;
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	if (NULL != ptContext)
+	{
+		CLOSE_FD(ptContext->nSocket);
+		CLOSE_FD(ptContext->nStopEvent);
+		FREE(ptContext);
+	}
+	CLOSE_FD(nSocket);
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
@@ -0,0 +1,669 @@
+/********************************************************************************
+*  File:		WindowSource.c													*
+*  Purpose:		Window-message based event source (Windows), on a message-only	*
+*				window: no GDI object and nothing to paint.						*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#include "EventSource.h"
+#include <Clock.h>
+#include <dbt.h>
+#include <Hidclass.h>
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	WND_CLASS_NAME													*
+*  Purpose:		The registered window class name.								*
+********************************************************************************/
+#define WND_CLASS_NAME (L"USBRND_WindowClass")
+
+/********************************************************************************
+*  Constant:	HID_USAGE_PAGE_GENERIC_DESKTOP									*
+*  Purpose:		The generic desktop HID usage page.								*
+********************************************************************************/
+#define HID_USAGE_PAGE_GENERIC_DESKTOP (0x01)
+
+/********************************************************************************
+*  Constant:	HID_USAGE_KEYBOARD												*
+*  Purpose:		The keyboard HID usage (in the generic desktop page).			*
+********************************************************************************/
+#define HID_USAGE_KEYBOARD (0x06)
+
+/********************************************************************************
+*  Constant:	SCAN_CODE_E0_PREFIX												*
+*  Purpose:		Marks E0 prefixed scan codes in EVENTSOURCE_EVENT.				*
+********************************************************************************/
+#define SCAN_CODE_E0_PREFIX (0xE000)
+
+/********************************************************************************
+*  Constant:	KEYBOARD_HID_GUID_STRING										*
+*  Purpose:		The GUID for a keyboard HID interface.							*
+********************************************************************************/
+#define KEYBOARD_HID_GUID_STRING (L"{884b96c3-56ef-11d1-bc8c-00a0c91405dd}")
+
+/********************************************************************************
+*  Constant:	WINDOWSOURCE_IDENTITY_CACHE_SIZE								*
+*  Purpose:		Number of raw input devices whose identity is cached, so that	*
+*				keystrokes do not query the device name.						*
+********************************************************************************/
+#define WINDOWSOURCE_IDENTITY_CACHE_SIZE (8)
+
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Structure:	WINDOWSOURCE_IDENTITY											*
+*  Purpose:		A cached raw input device identity.								*
+********************************************************************************/
+typedef struct _WINDOWSOURCE_IDENTITY
+{
+	HANDLE hDevice;									// Raw input device, or NULL if unused
+	DEVICEID tIdentity;								// Its identity (may be invalid)
+} WINDOWSOURCE_IDENTITY, *PWINDOWSOURCE_IDENTITY;
+
+/********************************************************************************
+*  Structure:	WINDOWSOURCE_CONTEXT											*
+*  Purpose:		The backend context.											*
+********************************************************************************/
+typedef struct _WINDOWSOURCE_CONTEXT
+{
+	HWND hWnd;										// The notification window
+	HDEVNOTIFY hDeviceNotify;						// Device notification handle
+	PFN_EVENTSOURCE_CALLBACK pfnCallback;			// Event callback
+	PVOID pvCallbackContext;						// Event callback context
+	WINDOWSOURCE_IDENTITY atIdentities[WINDOWSOURCE_IDENTITY_CACHE_SIZE];	// Raw input identity cache
+	DWORD dwNextIdentity;							// Next cache entry to replace
+} WINDOWSOURCE_CONTEXT, *PWINDOWSOURCE_CONTEXT;
+
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	windowsource_RegisterDevice										*
+*  Purpose:		Registers the device interface to the given window.				*
+*  Parameters:	@ hWnd ~[in]~ The window to get the notifications.				*
+*				@ phDeviceNotify ~[out]~ Gets the device notify handle.			*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Free returned handle with UnregisterDeviceNotification.		*
+********************************************************************************/
+static
+RETSTATUS
+windowsource_RegisterDevice(
+	__in __notnull HWND hWnd,
+	__out PHDEVNOTIFY phDeviceNotify
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	DEV_BROADCAST_DEVICEINTERFACE tNotificationFilter = { 0 };
+	HRESULT hrError = E_UNEXPECTED;
+	HDEVNOTIFY hDeviceNotify = NULL;
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != hWnd);
+	ASSERT(NULL != phDeviceNotify);
+
+	// Set the correct guid
+	hrError = IIDFromString(KEYBOARD_HID_GUID_STRING, &(tNotificationFilter.dbcc_classguid));
+	if (FAILED(hrError))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"IIDFromString() failure (hrError=0x%.8x).",
+			hrError);
+		goto lblCleanup;
+	}
+
+	// Initialize other simple members
+	tNotificationFilter.dbcc_size = sizeof(tNotificationFilter);
+	tNotificationFilter.dbcc_devicetype = DBT_DEVTYP_DEVICEINTERFACE;
+
+	// Register for the device notification
+	hDeviceNotify = RegisterDeviceNotificationW(hWnd, &tNotificationFilter, DEVICE_NOTIFY_WINDOW_HANDLE);
+	if (NULL == hDeviceNotify)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"RegisterDeviceNotificationW() failure (LastError=%lu).",
+			GetLastError());
+		goto lblCleanup;
+	}
+
+	// Success
+	*phDeviceNotify = hDeviceNotify;
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	windowsource_RegisterRawInput									*
+*  Purpose:		Registers the given window for raw keyboard input, including	*
+*				when it is not in the foreground.								*
+*  Parameters:	@ hWnd ~[in]~ The window to get the input.						*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+windowsource_RegisterRawInput(
+	__in __notnull HWND hWnd
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	RAWINPUTDEVICE tDevice = { 0 };
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != hWnd);
+
+	// All keyboards, delivered to our window
+	tDevice.usUsagePage = HID_USAGE_PAGE_GENERIC_DESKTOP;
+	tDevice.usUsage = HID_USAGE_KEYBOARD;
+	tDevice.dwFlags = RIDEV_INPUTSINK;
+	tDevice.hwndTarget = hWnd;
+	if (!RegisterRawInputDevices(&tDevice, 1, sizeof(tDevice)))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"RegisterRawInputDevices() failure (LastError=%lu).",
+			GetLastError());
+		goto lblCleanup;
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	windowsource_MessagePump										*
+*  Purpose:		The module's message pump.										*
+*  Parameters:	@ hWnd ~[inout]~ The window to handle.							*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+********************************************************************************/
+static
+VOID
+windowsource_MessagePump(
+	__inout HWND hWnd
+)
+{
+	MSG tMsg = { 0 };
+
+	// Unreferenced parameters
+	UNREFERENCED_PARAMETER(hWnd);
+
+	// Get all messages for any window that belongs to this thread without any filtering
+	// (no character messages are needed, so nothing to translate)
+	while (0 < GetMessageW(&tMsg, NULL, 0, 0))
+	{
+		(VOID)DispatchMessageW(&tMsg);
+	}
+}
+
+/********************************************************************************
+*  Function:	windowsource_GetIdentity										*
+*  Purpose:		Gets the identity of a raw input device.						*
+*  Parameters:	@ ptContext ~[inout]~ The backend context.						*
+*				@ hDevice ~[in]~ The raw input device, or NULL.					*
+*				@ ptId ~[out]~ Gets the identity (invalid if unknown).			*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+*				* Only the first keystroke of a device queries its name.		*
+********************************************************************************/
+static
+VOID
+windowsource_GetIdentity(
+	__inout PWINDOWSOURCE_CONTEXT ptContext,
+	__in_opt HANDLE hDevice,
+	__out PDEVICEID ptId
+)
+{
+	DWORD dwIndex = 0;
+	PWINDOWSOURCE_IDENTITY ptEntry = NULL;
+	CHAR szName[EVENTSOURCE_MAX_NAME_CHARS] = { 0 };
+	UINT cchName = sizeof(szName);
+
+	// Injected input has no device, and no identity
+	ptId->bIsValid = FALSE;
+	if (NULL == hDevice)
+	{
+		goto lblCleanup;
+	}
+
+	// Cached
+	for (dwIndex = 0; dwIndex < WINDOWSOURCE_IDENTITY_CACHE_SIZE; dwIndex++)
+	{
+		if (hDevice == ptContext->atIdentities[dwIndex].hDevice)
+		{
+			*ptId = ptContext->atIdentities[dwIndex].tIdentity;
+			goto lblCleanup;
+		}
+	}
+
+	// The device name is its interface name ("\\?\HID#VID_xxxx&PID_xxxx...")
+	if ((UINT)-1 != GetRawInputDeviceInfoA(hDevice, RIDI_DEVICENAME, szName, &cchName))
+	{
+		(VOID)DEVICEID_ParseInterfaceName(szName, ptId);
+	}
+
+	// Cache, replacing round-robin
+	ptEntry = &(ptContext->atIdentities[ptContext->dwNextIdentity]);
+	ptContext->dwNextIdentity = (ptContext->dwNextIdentity + 1) % WINDOWSOURCE_IDENTITY_CACHE_SIZE;
+	ptEntry->hDevice = hDevice;
+	ptEntry->tIdentity = *ptId;
+
+lblCleanup:
+
+	return;
+}
+
+/********************************************************************************
+*  Function:	windowsource_DeviceChange										*
+*  Purpose:		Converts a WM_DEVICECHANGE notification to an event.			*
+*  Parameters:	@ ptContext ~[inout]~ The backend context.						*
+*				@ tWparam ~[in]~ The device change event type.					*
+*				@ ptHeader ~[in]~ The broadcast header, or NULL.				*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+********************************************************************************/
+static
+VOID
+windowsource_DeviceChange(
+	__inout PWINDOWSOURCE_CONTEXT ptContext,
+	__in WPARAM tWparam,
+	__in_opt PDEV_BROADCAST_HDR ptHeader
+)
+{
+	EVENTSOURCE_EVENT tEvent = { 0 };
+	PDEV_BROADCAST_DEVICEINTERFACE_W ptInterface = NULL;
+
+	// Timestamp first, everything below counts towards the latency
+	tEvent.qwTimestamp = CLOCK_GetTimestamp();
+
+	// Only device interface arrivals and removals are interesting
+	if ((NULL == ptHeader) || (DBT_DEVTYP_DEVICEINTERFACE != ptHeader->dbch_devicetype))
+	{
+		goto lblCleanup;
+	}
+	if (DBT_DEVICEARRIVAL == tWparam)
+	{
+		tEvent.eType = EVENTSOURCE_EVENT_TYPE_ARRIVAL;
+	}
+	else if (DBT_DEVICEREMOVECOMPLETE == tWparam)
+	{
+		// Raw input handles of removed devices may be reused
+		tEvent.eType = EVENTSOURCE_EVENT_TYPE_REMOVAL;
+		RtlZeroMemory(ptContext->atIdentities, sizeof(ptContext->atIdentities));
+	}
+	else
+	{
+		goto lblCleanup;
+	}
+
+	// The registration filter only lets keyboard interfaces through
+	ptInterface = (PDEV_BROADCAST_DEVICEINTERFACE_W)ptHeader;
+	tEvent.eClass = EVENTSOURCE_DEVICE_CLASS_KEYBOARD;
+	(VOID)WideCharToMultiByte(CP_UTF8,
+		0,
+		ptInterface->dbcc_name,
+		-1,
+		tEvent.szName,
+		sizeof(tEvent.szName) - 1,
+		NULL,
+		NULL);
+	(VOID)DEVICEID_ParseInterfaceName(tEvent.szName, &(tEvent.tIdentity));
+
+	// Deliver
+	tEvent.qwClassifiedTimestamp = CLOCK_GetTimestamp();
+	ptContext->pfnCallback(&tEvent, ptContext->pvCallbackContext);
+
+lblCleanup:
+
+	return;
+}
+
+/********************************************************************************
+*  Function:	windowsource_Input												*
+*  Purpose:		Converts a WM_INPUT keyboard report to a key event.				*
+*  Parameters:	@ ptContext ~[inout]~ The backend context.						*
+*				@ hRawInput ~[in]~ The raw input handle.						*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+********************************************************************************/
+static
+VOID
+windowsource_Input(
+	__inout PWINDOWSOURCE_CONTEXT ptContext,
+	__in HRAWINPUT hRawInput
+)
+{
+	EVENTSOURCE_EVENT tEvent = { 0 };
+	RAWINPUT tRawInput = { 0 };
+	UINT cbRawInput = sizeof(tRawInput);
+
+	// Timestamp first, everything below counts towards the latency
+	tEvent.qwTimestamp = CLOCK_GetTimestamp();
+
+	// Keyboard reports always fit in a single RAWINPUT
+	if (((UINT)-1 == GetRawInputData(hRawInput, RID_INPUT, &tRawInput, &cbRawInput, sizeof(RAWINPUTHEADER))) ||
+		(RIM_TYPEKEYBOARD != tRawInput.header.dwType))
+	{
+		goto lblCleanup;
+	}
+
+	// Injected input (SendInput) has no device and gets ID 0
+	tEvent.eType = EVENTSOURCE_EVENT_TYPE_KEY;
+	tEvent.eClass = EVENTSOURCE_DEVICE_CLASS_KEYBOARD;
+	tEvent.qwDeviceId = (ULONGLONG)(ULONG_PTR)(tRawInput.header.hDevice);
+	tEvent.wScanCode = tRawInput.data.keyboard.MakeCode;
+	if (IS_FLAG_ON(tRawInput.data.keyboard.Flags, RI_KEY_E0))
+	{
+		tEvent.wScanCode |= SCAN_CODE_E0_PREFIX;
+	}
+	tEvent.bIsKeyDown = !IS_FLAG_ON(tRawInput.data.keyboard.Flags, RI_KEY_BREAK);
+	windowsource_GetIdentity(ptContext, tRawInput.header.hDevice, &(tEvent.tIdentity));
+
+	// Deliver
+	tEvent.qwClassifiedTimestamp = CLOCK_GetTimestamp();
+	ptContext->pfnCallback(&tEvent, ptContext->pvCallbackContext);
+
+lblCleanup:
+
+	return;
+}
+
+/********************************************************************************
+*  Function:	windowsource_WinProcCallback									*
+*  Purpose:		The callback for our window procedure.							*
+*  Parameters:	@ hWnd ~[in]~ The window.										*
+*				@ dwMessage ~[in]~ The message.									*
+*				@ tWparam ~[in]~ The WPARAM window message parameter.			*
+*				@ tLparam ~[in]~ The LPARAM window message parameter.			*
+*  Returns:		An LRESULT.														*
+********************************************************************************/
+static
+LRESULT
+WINAPI
+windowsource_WinProcCallback(
+	__inout HWND hWnd,
+	__in UINT dwMessage,
+	__inout WPARAM tWparam,
+	__inout LPARAM tLparam
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	LRESULT lRet = 1;
+	PWINDOWSOURCE_CONTEXT ptContext = (PWINDOWSOURCE_CONTEXT)GetWindowLongPtrW(hWnd, GWLP_USERDATA);
+
+	// Act according to the message
+	switch (dwMessage)
+	{
+	case WM_CREATE:
+
+		// Attach the context to the window
+		ptContext = (PWINDOWSOURCE_CONTEXT)(((LPCREATESTRUCTW)tLparam)->lpCreateParams);
+		(VOID)SetWindowLongPtrW(hWnd, GWLP_USERDATA, (LONG_PTR)ptContext);
+
+		// Register the device
+		eStatus = windowsource_RegisterDevice(hWnd, &(ptContext->hDeviceNotify));
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			// Terminate on failure
+			ExitProcess(eStatus);
+		}
+
+		// Register for keystrokes
+		eStatus = windowsource_RegisterRawInput(hWnd);
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			// Terminate on failure
+			ExitProcess(eStatus);
+		}
+		break;
+
+	case WM_INPUT:
+
+		// Deliver keystrokes (DefWindowProcW performs the raw input cleanup)
+		windowsource_Input(ptContext, (HRAWINPUT)tLparam);
+		lRet = DefWindowProcW(hWnd, dwMessage, tWparam, tLparam);
+		break;
+
+	case WM_DEVICECHANGE:
+
+		// Deliver arrivals and removals
+		windowsource_DeviceChange(ptContext, tWparam, (PDEV_BROADCAST_HDR)tLparam);
+		break;
+
+	case WM_CLOSE:
+
+		// Unregister notification (best-effort)
+		(VOID)UnregisterDeviceNotification(ptContext->hDeviceNotify);
+		ptContext->hDeviceNotify = NULL;
+		(VOID)DestroyWindow(hWnd);
+		break;
+
+	case WM_DESTROY:
+
+		// Quit message
+		ptContext->hWnd = NULL;
+		(VOID)PostQuitMessage(0);
+		break;
+
+	default:
+
+		// Send all other messages on to the default windows handler
+		lRet = DefWindowProcW(hWnd, dwMessage, tWparam, tLparam);
+		break;
+	}
+
+	// Return the result
+	return lRet;
+}
+
+/********************************************************************************
+*  Function:	windowsource_InitWindowClass									*
+*  Purpose:		Initializes the window class.									*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* The window only ever gets messages, so the class has no		*
+*					icon, cursor, background brush or device context.			*
+********************************************************************************/
+static
+RETSTATUS
+windowsource_InitWindowClass(VOID)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	WNDCLASSEXW tWndClass = { 0 };
+
+	DEBUG_ENTER();
+
+	// Build the window class
+	tWndClass.cbSize = sizeof(tWndClass);
+	tWndClass.hInstance = GetModuleHandleW(NULL);
+	tWndClass.lpfnWndProc = windowsource_WinProcCallback;
+	tWndClass.lpszClassName = WND_CLASS_NAME;
+
+	// Register the window class (a previous run may have registered it already)
+	if ((!RegisterClassExW(&tWndClass)) && (ERROR_CLASS_ALREADY_EXISTS != GetLastError()))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"RegisterClassExW() failure (LastError=%lu).",
+			GetLastError());
+		goto lblCleanup;
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	windowsource_Run												*
+*  Purpose:		Creates the notification window and pumps its messages.			*
+*  Parameters:	@ ptSource ~[inout]~ The event source.							*
+*				@ pfnCallback ~[in]~ The event callback.						*
+*				@ pvContext ~[inout]~ Optional context for the callback.		*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+windowsource_Run(
+	__inout PEVENTSOURCE ptSource,
+	__in PFN_EVENTSOURCE_CALLBACK pfnCallback,
+	__inout_opt PVOID pvContext
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	PWINDOWSOURCE_CONTEXT ptContext = (PWINDOWSOURCE_CONTEXT)(ptSource->pvBackend);
+
+	DEBUG_ENTER();
+
+	// Save the callback before any notification may arrive
+	ptContext->pfnCallback = pfnCallback;
+	ptContext->pvCallbackContext = pvContext;
+
+	// Initialize the window class
+	eStatus = windowsource_InitWindowClass();
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		DEBUG_MSG(LOG_SEV_ERROR,
+			"windowsource_InitWindowClass() failed (eStatus=0x%.8x).",
+			eStatus);
+		goto lblCleanup;
+	}
+
+	// Message-only window (registers for notifications and keystrokes in WM_CREATE)
+	ptContext->hWnd = CreateWindowExW(0,
+		WND_CLASS_NAME,
+		NULL,
+		0,
+		0,
+		0,
+		0,
+		0,
+		HWND_MESSAGE,
+		NULL,
+		GetModuleHandleW(NULL),
+		ptContext);
+	if (NULL == ptContext->hWnd)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"CreateWindowExW() failure (LastError=%lu).",
+			GetLastError());
+		goto lblCleanup;
+	}
+
+	// Invoke the mssage pump
+	EVENTSOURCE_SetArmed(ptSource);
+	windowsource_MessagePump(ptContext->hWnd);
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	windowsource_Stop												*
+*  Purpose:		Closes the notification window, which ends the message pump.	*
+*  Parameters:	@ ptSource ~[inout]~ The event source.							*
+********************************************************************************/
+static
+VOID
+windowsource_Stop(
+	__inout PEVENTSOURCE ptSource
+)
+{
+	PWINDOWSOURCE_CONTEXT ptContext = (PWINDOWSOURCE_CONTEXT)(ptSource->pvBackend);
+
+	// Best-effort, the window may already be gone
+	if (NULL != ptContext->hWnd)
+	{
+		(VOID)PostMessageW(ptContext->hWnd, WM_CLOSE, 0, 0);
+	}
+}
+
+/********************************************************************************
+*  Function:	windowsource_Destroy											*
+*  Purpose:		Frees the backend context.										*
+*  Parameters:	@ ptSource ~[inout]~ The event source.							*
+********************************************************************************/
+static
+VOID
+windowsource_Destroy(
+	__inout PEVENTSOURCE ptSource
+)
+{
+	FREE(ptSource->pvBackend);
+}
+
+/********************************************************************************
+*  Function:	EVENTSOURCE_CreateWindowSource									*
+********************************************************************************/
+RETSTATUS
+EVENTSOURCE_CreateWindowSource(
+	__out PEVENTSOURCE ptSource
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	PWINDOWSOURCE_CONTEXT ptContext = NULL;
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != ptSource);
+
+	// Allocate the context
+	ptContext = ALLOCZ(sizeof(*ptContext));
+	if (NULL == ptContext)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"ALLOCZ() failure.");
+		goto lblCleanup;
+	}
+
+	// Fill the dispatch table
+	ptSource->pszName = "window";
+	ptSource->bDeliversKeystrokes = TRUE;
+	ptSource->pfnRun = windowsource_Run;
+	ptSource->pfnStop = windowsource_Stop;
+	ptSource->pfnDestroy = windowsource_Destroy;
+	ptSource->pvBackend = ptContext;
+	ptContext = NULL;
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	FREE(ptContext);
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
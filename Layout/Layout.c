@@ -0,0 +1,659 @@
+/********************************************************************************
+*  File:		Layout.c														*
+*  Purpose:		Decodes keystrokes to characters, by keyboard layout.			*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#include "Layout.h"
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	LAYOUT_KEYS														*
+*  Purpose:		Keys of a layout table: set 1 scan codes, E0 codes from 0x80	*
+*				on (see LAYOUT_INDEX).											*
+********************************************************************************/
+#define LAYOUT_KEYS (0x100)
+
+/********************************************************************************
+*  Constant:	LAYOUT_LEVELS													*
+*  Purpose:		Characters per key: plain, with Shift and with AltGr (with or	*
+*				without Shift).													*
+********************************************************************************/
+#define LAYOUT_LEVELS (3)
+
+/********************************************************************************
+*  Constant:	LAYOUT_MODIFIER_*												*
+*  Purpose:		Modifier keys, as bits of LAYOUT_STATE.bModifiers.				*
+*  Remarks:		* Caps Lock is tracked while held, so that its repeats do not	*
+*					toggle it again.											*
+********************************************************************************/
+#define LAYOUT_MODIFIER_LEFT_SHIFT (0x01)
+#define LAYOUT_MODIFIER_RIGHT_SHIFT (0x02)
+#define LAYOUT_MODIFIER_LEFT_CTRL (0x04)
+#define LAYOUT_MODIFIER_RIGHT_CTRL (0x08)
+#define LAYOUT_MODIFIER_ALTGR (0x10)
+#define LAYOUT_MODIFIER_LEFT_GUI (0x20)
+#define LAYOUT_MODIFIER_RIGHT_GUI (0x40)
+#define LAYOUT_MODIFIER_CAPS_LOCK (0x80)
+#define LAYOUT_MODIFIER_SHIFT (LAYOUT_MODIFIER_LEFT_SHIFT | LAYOUT_MODIFIER_RIGHT_SHIFT)
+#define LAYOUT_MODIFIER_CTRL (LAYOUT_MODIFIER_LEFT_CTRL | LAYOUT_MODIFIER_RIGHT_CTRL)
+#define LAYOUT_MODIFIER_GUI (LAYOUT_MODIFIER_LEFT_GUI | LAYOUT_MODIFIER_RIGHT_GUI)
+
+/********************************************************************************
+*  Constant:	LAYOUT_DEAD_*													*
+*  Purpose:		Dead keys, as the combining accents they type.					*
+********************************************************************************/
+#define LAYOUT_DEAD_GRAVE (0x0300)
+#define LAYOUT_DEAD_ACUTE (0x0301)
+#define LAYOUT_DEAD_CIRCUMFLEX (0x0302)
+#define LAYOUT_DEAD_TILDE (0x0303)
+#define LAYOUT_DEAD_DIAERESIS (0x0308)
+
+
+/** Macros *********************************************************************/
+
+/********************************************************************************
+*  Macro:		LAYOUT_INDEX													*
+*  Purpose:		The layout table index of a set 1 scan code (below 0x80, or		*
+*				0xE0 and a code below 0x80).									*
+********************************************************************************/
+#define LAYOUT_INDEX(wScanCode) (((wScanCode) & 0x7F) | (((wScanCode) >> 8) & 0x80))
+
+/********************************************************************************
+*  Macro:		LAYOUT_IS_DEAD_KEY												*
+*  Purpose:		Whether a layout character is a dead key (a combining accent).	*
+********************************************************************************/
+#define LAYOUT_IS_DEAD_KEY(wChar) (0x70 > (WORD)((wChar) - 0x0300))
+
+/********************************************************************************
+*  Macro:		LAYOUT_KEY_ENTRY												*
+*  Purpose:		Expands a key of a layout list into a table entry.				*
+*  Parameters:	@ bScanCode ~[in]~ The table index (see LAYOUT_INDEX).			*
+*				@ bIsCapsKey ~[in]~ Whether Caps Lock reverses its Shift.		*
+*				@ wPlain ~[in]~ Its character, or 0.							*
+*				@ wShift ~[in]~ Its character with Shift, or 0.					*
+*				@ wAltGr ~[in]~ Its character with AltGr, or 0.					*
+********************************************************************************/
+#define LAYOUT_KEY_ENTRY(bScanCode, bIsCapsKey, wPlain, wShift, wAltGr) \
+	[bScanCode] = { { (wPlain), (wShift), (wAltGr) }, (bIsCapsKey) },
+
+/********************************************************************************
+*  Macro:		LAYOUT_COMMON_KEYS												*
+*  Purpose:		Keys that type the same on every layout.						*
+********************************************************************************/
+#define LAYOUT_COMMON_KEYS(KEY) \
+	KEY(0x01, 0, 0x1B, 0x1B, 0) \
+	KEY(0x0E, 0, '\b', '\b', 0) \
+	KEY(0x0F, 0, '\t', '\t', 0) \
+	KEY(0x1C, 0, '\n', '\n', 0) \
+	KEY(0x37, 0, '*', '*', 0) \
+	KEY(0x39, 0, ' ', ' ', ' ') \
+	KEY(0x4A, 0, '-', '-', 0) \
+	KEY(0x4E, 0, '+', '+', 0) \
+	KEY(0x9C, 0, '\n', '\n', 0) \
+	KEY(0xB5, 0, '/', '/', 0)
+
+/********************************************************************************
+*  Macro:		LAYOUT_US_KEYS													*
+*  Purpose:		The United States layout.										*
+********************************************************************************/
+#define LAYOUT_US_KEYS(KEY) \
+	KEY(0x02, 0, '1', '!', 0) \
+	KEY(0x03, 0, '2', '@', 0) \
+	KEY(0x04, 0, '3', '#', 0) \
+	KEY(0x05, 0, '4', '$', 0) \
+	KEY(0x06, 0, '5', '%', 0) \
+	KEY(0x07, 0, '6', '^', 0) \
+	KEY(0x08, 0, '7', '&', 0) \
+	KEY(0x09, 0, '8', '*', 0) \
+	KEY(0x0A, 0, '9', '(', 0) \
+	KEY(0x0B, 0, '0', ')', 0) \
+	KEY(0x0C, 0, '-', '_', 0) \
+	KEY(0x0D, 0, '=', '+', 0) \
+	KEY(0x10, 1, 'q', 'Q', 0) \
+	KEY(0x11, 1, 'w', 'W', 0) \
+	KEY(0x12, 1, 'e', 'E', 0) \
+	KEY(0x13, 1, 'r', 'R', 0) \
+	KEY(0x14, 1, 't', 'T', 0) \
+	KEY(0x15, 1, 'y', 'Y', 0) \
+	KEY(0x16, 1, 'u', 'U', 0) \
+	KEY(0x17, 1, 'i', 'I', 0) \
+	KEY(0x18, 1, 'o', 'O', 0) \
+	KEY(0x19, 1, 'p', 'P', 0) \
+	KEY(0x1A, 0, '[', '{', 0) \
+	KEY(0x1B, 0, ']', '}', 0) \
+	KEY(0x1E, 1, 'a', 'A', 0) \
+	KEY(0x1F, 1, 's', 'S', 0) \
+	KEY(0x20, 1, 'd', 'D', 0) \
+	KEY(0x21, 1, 'f', 'F', 0) \
+	KEY(0x22, 1, 'g', 'G', 0) \
+	KEY(0x23, 1, 'h', 'H', 0) \
+	KEY(0x24, 1, 'j', 'J', 0) \
+	KEY(0x25, 1, 'k', 'K', 0) \
+	KEY(0x26, 1, 'l', 'L', 0) \
+	KEY(0x27, 0, ';', ':', 0) \
+	KEY(0x28, 0, '\'', '"', 0) \
+	KEY(0x29, 0, '`', '~', 0) \
+	KEY(0x2B, 0, '\\', '|', 0) \
+	KEY(0x2C, 1, 'z', 'Z', 0) \
+	KEY(0x2D, 1, 'x', 'X', 0) \
+	KEY(0x2E, 1, 'c', 'C', 0) \
+	KEY(0x2F, 1, 'v', 'V', 0) \
+	KEY(0x30, 1, 'b', 'B', 0) \
+	KEY(0x31, 1, 'n', 'N', 0) \
+	KEY(0x32, 1, 'm', 'M', 0) \
+	KEY(0x33, 0, ',', '<', 0) \
+	KEY(0x34, 0, '.', '>', 0) \
+	KEY(0x35, 0, '/', '?', 0) \
+	KEY(0x56, 0, '\\', '|', 0)
+
+/********************************************************************************
+*  Macro:		LAYOUT_UK_KEYS													*
+*  Purpose:		The United Kingdom layout.										*
+********************************************************************************/
+#define LAYOUT_UK_KEYS(KEY) \
+	KEY(0x02, 0, '1', '!', 0) \
+	KEY(0x03, 0, '2', '"', 0) \
+	KEY(0x04, 0, '3', 0x00A3, 0) \
+	KEY(0x05, 0, '4', '$', 0x20AC) \
+	KEY(0x06, 0, '5', '%', 0) \
+	KEY(0x07, 0, '6', '^', 0) \
+	KEY(0x08, 0, '7', '&', 0) \
+	KEY(0x09, 0, '8', '*', 0) \
+	KEY(0x0A, 0, '9', '(', 0) \
+	KEY(0x0B, 0, '0', ')', 0) \
+	KEY(0x0C, 0, '-', '_', 0) \
+	KEY(0x0D, 0, '=', '+', 0) \
+	KEY(0x10, 1, 'q', 'Q', 0) \
+	KEY(0x11, 1, 'w', 'W', 0) \
+	KEY(0x12, 1, 'e', 'E', 0x00E9) \
+	KEY(0x13, 1, 'r', 'R', 0) \
+	KEY(0x14, 1, 't', 'T', 0) \
+	KEY(0x15, 1, 'y', 'Y', 0) \
+	KEY(0x16, 1, 'u', 'U', 0x00FA) \
+	KEY(0x17, 1, 'i', 'I', 0x00ED) \
+	KEY(0x18, 1, 'o', 'O', 0x00F3) \
+	KEY(0x19, 1, 'p', 'P', 0) \
+	KEY(0x1A, 0, '[', '{', 0) \
+	KEY(0x1B, 0, ']', '}', 0) \
+	KEY(0x1E, 1, 'a', 'A', 0x00E1) \
+	KEY(0x1F, 1, 's', 'S', 0) \
+	KEY(0x20, 1, 'd', 'D', 0) \
+	KEY(0x21, 1, 'f', 'F', 0) \
+	KEY(0x22, 1, 'g', 'G', 0) \
+	KEY(0x23, 1, 'h', 'H', 0) \
+	KEY(0x24, 1, 'j', 'J', 0) \
+	KEY(0x25, 1, 'k', 'K', 0) \
+	KEY(0x26, 1, 'l', 'L', 0) \
+	KEY(0x27, 0, ';', ':', 0) \
+	KEY(0x28, 0, '\'', '@', 0) \
+	KEY(0x29, 0, '`', 0x00AC, 0x00A6) \
+	KEY(0x2B, 0, '#', '~', 0) \
+	KEY(0x2C, 1, 'z', 'Z', 0) \
+	KEY(0x2D, 1, 'x', 'X', 0) \
+	KEY(0x2E, 1, 'c', 'C', 0) \
+	KEY(0x2F, 1, 'v', 'V', 0) \
+	KEY(0x30, 1, 'b', 'B', 0) \
+	KEY(0x31, 1, 'n', 'N', 0) \
+	KEY(0x32, 1, 'm', 'M', 0) \
+	KEY(0x33, 0, ',', '<', 0) \
+	KEY(0x34, 0, '.', '>', 0) \
+	KEY(0x35, 0, '/', '?', 0) \
+	KEY(0x56, 0, '\\', '|', 0)
+
+/********************************************************************************
+*  Macro:		LAYOUT_DE_KEYS													*
+*  Purpose:		The German layout.												*
+********************************************************************************/
+#define LAYOUT_DE_KEYS(KEY) \
+	KEY(0x02, 0, '1', '!', 0) \
+	KEY(0x03, 0, '2', '"', 0x00B2) \
+	KEY(0x04, 0, '3', 0x00A7, 0x00B3) \
+	KEY(0x05, 0, '4', '$', 0) \
+	KEY(0x06, 0, '5', '%', 0) \
+	KEY(0x07, 0, '6', '&', 0) \
+	KEY(0x08, 0, '7', '/', '{') \
+	KEY(0x09, 0, '8', '(', '[') \
+	KEY(0x0A, 0, '9', ')', ']') \
+	KEY(0x0B, 0, '0', '=', '}') \
+	KEY(0x0C, 0, 0x00DF, '?', '\\') \
+	KEY(0x0D, 0, LAYOUT_DEAD_ACUTE, LAYOUT_DEAD_GRAVE, 0) \
+	KEY(0x10, 1, 'q', 'Q', '@') \
+	KEY(0x11, 1, 'w', 'W', 0) \
+	KEY(0x12, 1, 'e', 'E', 0x20AC) \
+	KEY(0x13, 1, 'r', 'R', 0) \
+	KEY(0x14, 1, 't', 'T', 0) \
+	KEY(0x15, 1, 'z', 'Z', 0) \
+	KEY(0x16, 1, 'u', 'U', 0) \
+	KEY(0x17, 1, 'i', 'I', 0) \
+	KEY(0x18, 1, 'o', 'O', 0) \
+	KEY(0x19, 1, 'p', 'P', 0) \
+	KEY(0x1A, 1, 0x00FC, 0x00DC, 0) \
+	KEY(0x1B, 0, '+', '*', '~') \
+	KEY(0x1E, 1, 'a', 'A', 0) \
+	KEY(0x1F, 1, 's', 'S', 0) \
+	KEY(0x20, 1, 'd', 'D', 0) \
+	KEY(0x21, 1, 'f', 'F', 0) \
+	KEY(0x22, 1, 'g', 'G', 0) \
+	KEY(0x23, 1, 'h', 'H', 0) \
+	KEY(0x24, 1, 'j', 'J', 0) \
+	KEY(0x25, 1, 'k', 'K', 0) \
+	KEY(0x26, 1, 'l', 'L', 0) \
+	KEY(0x27, 1, 0x00F6, 0x00D6, 0) \
+	KEY(0x28, 1, 0x00E4, 0x00C4, 0) \
+	KEY(0x29, 0, LAYOUT_DEAD_CIRCUMFLEX, 0x00B0, 0) \
+	KEY(0x2B, 0, '#', '\'', 0) \
+	KEY(0x2C, 1, 'y', 'Y', 0) \
+	KEY(0x2D, 1, 'x', 'X', 0) \
+	KEY(0x2E, 1, 'c', 'C', 0) \
+	KEY(0x2F, 1, 'v', 'V', 0) \
+	KEY(0x30, 1, 'b', 'B', 0) \
+	KEY(0x31, 1, 'n', 'N', 0) \
+	KEY(0x32, 1, 'm', 'M', 0x00B5) \
+	KEY(0x33, 0, ',', ';', 0) \
+	KEY(0x34, 0, '.', ':', 0) \
+	KEY(0x35, 0, '-', '_', 0) \
+	KEY(0x56, 0, '<', '>', '|')
+
+/********************************************************************************
+*  Macro:		LAYOUT_FR_KEYS													*
+*  Purpose:		The French layout.												*
+*  Remarks:		* Caps Lock also reverses Shift on the digit row, as on Windows.	*
+********************************************************************************/
+#define LAYOUT_FR_KEYS(KEY) \
+	KEY(0x02, 1, '&', '1', 0) \
+	KEY(0x03, 1, 0x00E9, '2', LAYOUT_DEAD_TILDE) \
+	KEY(0x04, 1, '"', '3', '#') \
+	KEY(0x05, 1, '\'', '4', '{') \
+	KEY(0x06, 1, '(', '5', '[') \
+	KEY(0x07, 1, '-', '6', '|') \
+	KEY(0x08, 1, 0x00E8, '7', LAYOUT_DEAD_GRAVE) \
+	KEY(0x09, 1, '_', '8', '\\') \
+	KEY(0x0A, 1, 0x00E7, '9', '^') \
+	KEY(0x0B, 1, 0x00E0, '0', '@') \
+	KEY(0x0C, 0, ')', 0x00B0, ']') \
+	KEY(0x0D, 0, '=', '+', '}') \
+	KEY(0x10, 1, 'a', 'A', 0) \
+	KEY(0x11, 1, 'z', 'Z', 0) \
+	KEY(0x12, 1, 'e', 'E', 0x20AC) \
+	KEY(0x13, 1, 'r', 'R', 0) \
+	KEY(0x14, 1, 't', 'T', 0) \
+	KEY(0x15, 1, 'y', 'Y', 0) \
+	KEY(0x16, 1, 'u', 'U', 0) \
+	KEY(0x17, 1, 'i', 'I', 0) \
+	KEY(0x18, 1, 'o', 'O', 0) \
+	KEY(0x19, 1, 'p', 'P', 0) \
+	KEY(0x1A, 0, LAYOUT_DEAD_CIRCUMFLEX, LAYOUT_DEAD_DIAERESIS, 0) \
+	KEY(0x1B, 0, '$', 0x00A3, 0x00A4) \
+	KEY(0x1E, 1, 'q', 'Q', 0) \
+	KEY(0x1F, 1, 's', 'S', 0) \
+	KEY(0x20, 1, 'd', 'D', 0) \
+	KEY(0x21, 1, 'f', 'F', 0) \
+	KEY(0x22, 1, 'g', 'G', 0) \
+	KEY(0x23, 1, 'h', 'H', 0) \
+	KEY(0x24, 1, 'j', 'J', 0) \
+	KEY(0x25, 1, 'k', 'K', 0) \
+	KEY(0x26, 1, 'l', 'L', 0) \
+	KEY(0x27, 1, 'm', 'M', 0) \
+	KEY(0x28, 0, 0x00F9, '%', 0) \
+	KEY(0x29, 0, 0x00B2, 0, 0) \
+	KEY(0x2B, 0, '*', 0x00B5, 0) \
+	KEY(0x2C, 1, 'w', 'W', 0) \
+	KEY(0x2D, 1, 'x', 'X', 0) \
+	KEY(0x2E, 1, 'c', 'C', 0) \
+	KEY(0x2F, 1, 'v', 'V', 0) \
+	KEY(0x30, 1, 'b', 'B', 0) \
+	KEY(0x31, 1, 'n', 'N', 0) \
+	KEY(0x32, 0, ',', '?', 0) \
+	KEY(0x33, 0, ';', '.', 0) \
+	KEY(0x34, 0, ':', '/', 0) \
+	KEY(0x35, 0, '!', 0x00A7, 0) \
+	KEY(0x56, 0, '<', '>', 0)
+
+/********************************************************************************
+*  Macro:		LAYOUT_IL_KEYS													*
+*  Purpose:		The Hebrew layout.												*
+*  Remarks:		* Letter keys type Hebrew letters, and Latin capitals with		*
+*					Shift.														*
+********************************************************************************/
+#define LAYOUT_IL_KEYS(KEY) \
+	KEY(0x02, 0, '1', '!', 0) \
+	KEY(0x03, 0, '2', '@', 0) \
+	KEY(0x04, 0, '3', '#', 0) \
+	KEY(0x05, 0, '4', '$', 0x20AA) \
+	KEY(0x06, 0, '5', '%', 0) \
+	KEY(0x07, 0, '6', '^', 0) \
+	KEY(0x08, 0, '7', '&', 0) \
+	KEY(0x09, 0, '8', '*', 0) \
+	KEY(0x0A, 0, '9', ')', 0) \
+	KEY(0x0B, 0, '0', '(', 0) \
+	KEY(0x0C, 0, '-', '_', 0x05BE) \
+	KEY(0x0D, 0, '=', '+', 0) \
+	KEY(0x10, 0, '/', 'Q', 0) \
+	KEY(0x11, 0, '\'', 'W', 0) \
+	KEY(0x12, 0, 0x05E7, 'E', 0x20AC) \
+	KEY(0x13, 0, 0x05E8, 'R', 0) \
+	KEY(0x14, 0, 0x05D0, 'T', 0) \
+	KEY(0x15, 0, 0x05D8, 'Y', 0) \
+	KEY(0x16, 0, 0x05D5, 'U', 0) \
+	KEY(0x17, 0, 0x05DF, 'I', 0) \
+	KEY(0x18, 0, 0x05DD, 'O', 0) \
+	KEY(0x19, 0, 0x05E4, 'P', 0) \
+	KEY(0x1A, 0, ']', '}', 0) \
+	KEY(0x1B, 0, '[', '{', 0) \
+	KEY(0x1E, 0, 0x05E9, 'A', 0) \
+	KEY(0x1F, 0, 0x05D3, 'S', 0) \
+	KEY(0x20, 0, 0x05D2, 'D', 0) \
+	KEY(0x21, 0, 0x05DB, 'F', 0) \
+	KEY(0x22, 0, 0x05E2, 'G', 0) \
+	KEY(0x23, 0, 0x05D9, 'H', 0) \
+	KEY(0x24, 0, 0x05D7, 'J', 0) \
+	KEY(0x25, 0, 0x05DC, 'K', 0) \
+	KEY(0x26, 0, 0x05DA, 'L', 0) \
+	KEY(0x27, 0, 0x05E3, ':', 0) \
+	KEY(0x28, 0, ',', '"', 0) \
+	KEY(0x29, 0, ';', '~', 0) \
+	KEY(0x2B, 0, '\\', '|', 0) \
+	KEY(0x2C, 0, 0x05D6, 'Z', 0) \
+	KEY(0x2D, 0, 0x05E1, 'X', 0) \
+	KEY(0x2E, 0, 0x05D1, 'C', 0) \
+	KEY(0x2F, 0, 0x05D4, 'V', 0) \
+	KEY(0x30, 0, 0x05E0, 'B', 0) \
+	KEY(0x31, 0, 0x05DE, 'N', 0) \
+	KEY(0x32, 0, 0x05E6, 'M', 0) \
+	KEY(0x33, 0, 0x05EA, '>', 0) \
+	KEY(0x34, 0, 0x05E5, '<', 0) \
+	KEY(0x35, 0, '.', '?', 0) \
+	KEY(0x56, 0, '\\', '|', 0)
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Structure:	LAYOUT_KEY														*
+*  Purpose:		What a key types.												*
+********************************************************************************/
+typedef struct _LAYOUT_KEY
+{
+	WORD awChars[LAYOUT_LEVELS];					// By level, 0 for none
+	BOOLEAN bIsCapsKey;								// Whether Caps Lock reverses Shift
+} LAYOUT_KEY, *PLAYOUT_KEY;
+typedef const LAYOUT_KEY *PCLAYOUT_KEY;
+
+/********************************************************************************
+*  Structure:	LAYOUT															*
+*  Purpose:		A layout table.													*
+********************************************************************************/
+typedef struct _LAYOUT
+{
+	PCSTR pszName;									// As LAYOUT_Parse takes it
+	BOOLEAN bHasAltGr;								// Whether the right Alt is AltGr
+	LAYOUT_KEY atKeys[LAYOUT_KEYS];					// By LAYOUT_INDEX
+} LAYOUT, *PLAYOUT;
+typedef const LAYOUT *PCLAYOUT;
+
+
+/** Globals ********************************************************************/
+
+/********************************************************************************
+*  Global:		g_atLayouts														*
+*  Purpose:		The layout tables, by LAYOUT_ID.								*
+********************************************************************************/
+static
+const LAYOUT
+g_atLayouts[LAYOUT_ID_COUNT] =
+{
+	{ "us", FALSE, { LAYOUT_COMMON_KEYS(LAYOUT_KEY_ENTRY) LAYOUT_US_KEYS(LAYOUT_KEY_ENTRY) } },
+	{ "uk", TRUE, { LAYOUT_COMMON_KEYS(LAYOUT_KEY_ENTRY) LAYOUT_UK_KEYS(LAYOUT_KEY_ENTRY) } },
+	{ "de", TRUE, { LAYOUT_COMMON_KEYS(LAYOUT_KEY_ENTRY) LAYOUT_DE_KEYS(LAYOUT_KEY_ENTRY) } },
+	{ "fr", TRUE, { LAYOUT_COMMON_KEYS(LAYOUT_KEY_ENTRY) LAYOUT_FR_KEYS(LAYOUT_KEY_ENTRY) } },
+	{ "il", TRUE, { LAYOUT_COMMON_KEYS(LAYOUT_KEY_ENTRY) LAYOUT_IL_KEYS(LAYOUT_KEY_ENTRY) } }
+};
+
+/********************************************************************************
+*  Global:		g_abModifiers													*
+*  Purpose:		The LAYOUT_MODIFIER_* bit of every key, by LAYOUT_INDEX (the	*
+*				same on every layout).											*
+********************************************************************************/
+static
+const BYTE
+g_abModifiers[LAYOUT_KEYS] =
+{
+	[0x2A] = LAYOUT_MODIFIER_LEFT_SHIFT,
+	[0x36] = LAYOUT_MODIFIER_RIGHT_SHIFT,
+	[0x1D] = LAYOUT_MODIFIER_LEFT_CTRL,
+	[0x9D] = LAYOUT_MODIFIER_RIGHT_CTRL,
+	[0xB8] = LAYOUT_MODIFIER_ALTGR,
+	[0xDB] = LAYOUT_MODIFIER_LEFT_GUI,
+	[0xDC] = LAYOUT_MODIFIER_RIGHT_GUI,
+	[0x3A] = LAYOUT_MODIFIER_CAPS_LOCK
+};
+
+/********************************************************************************
+*  Global:		g_awDeadKeys													*
+*  Purpose:		The dead keys, as combining accents.							*
+********************************************************************************/
+static
+const WORD
+g_awDeadKeys[] = { LAYOUT_DEAD_GRAVE, LAYOUT_DEAD_ACUTE, LAYOUT_DEAD_CIRCUMFLEX, LAYOUT_DEAD_TILDE, LAYOUT_DEAD_DIAERESIS };
+
+/********************************************************************************
+*  Global:		g_awAccents														*
+*  Purpose:		What the dead keys type alone, by g_awDeadKeys index.			*
+********************************************************************************/
+static
+const WORD
+g_awAccents[sizeof(g_awDeadKeys) / sizeof(g_awDeadKeys[0])] = { '`', 0x00B4, '^', '~', 0x00A8 };
+
+/********************************************************************************
+*  Global:		g_szCombiningBases												*
+*  Purpose:		The characters dead keys combine with.							*
+********************************************************************************/
+static
+const CHAR
+g_szCombiningBases[] = "aeiouyAEIOUYnN";
+
+/********************************************************************************
+*  Global:		g_aawCombined													*
+*  Purpose:		The combined characters, by g_awDeadKeys index then				*
+*				g_szCombiningBases index, or 0 where they do not combine.		*
+********************************************************************************/
+static
+const WORD
+g_aawCombined[sizeof(g_awDeadKeys) / sizeof(g_awDeadKeys[0])][sizeof(g_szCombiningBases) - 1] =
+{
+	{ 0x00E0, 0x00E8, 0x00EC, 0x00F2, 0x00F9, 0, 0x00C0, 0x00C8, 0x00CC, 0x00D2, 0x00D9, 0, 0, 0 },
+	{ 0x00E1, 0x00E9, 0x00ED, 0x00F3, 0x00FA, 0x00FD, 0x00C1, 0x00C9, 0x00CD, 0x00D3, 0x00DA, 0x00DD, 0, 0 },
+	{ 0x00E2, 0x00EA, 0x00EE, 0x00F4, 0x00FB, 0, 0x00C2, 0x00CA, 0x00CE, 0x00D4, 0x00DB, 0, 0, 0 },
+	{ 0x00E3, 0, 0, 0x00F5, 0, 0, 0x00C3, 0, 0, 0x00D5, 0, 0, 0x00F1, 0x00D1 },
+	{ 0x00E4, 0x00EB, 0x00EF, 0x00F6, 0x00FC, 0x00FF, 0x00C4, 0x00CB, 0x00CF, 0x00D6, 0x00DC, 0x0178, 0, 0 }
+};
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	layout_GetAccent												*
+*  Purpose:		Finds a dead key.												*
+*  Parameters:	@ wDeadKey ~[in]~ The dead key (a combining accent).			*
+*  Returns:		Its g_awDeadKeys index.											*
+********************************************************************************/
+static
+DWORD
+layout_GetAccent(
+	__in WORD wDeadKey
+)
+{
+	DWORD dwAccent = 0;
+
+	while ((sizeof(g_awDeadKeys) / sizeof(g_awDeadKeys[0]) - 1 > dwAccent) && (wDeadKey != g_awDeadKeys[dwAccent]))
+	{
+		dwAccent++;
+	}
+
+	// Return result
+	return dwAccent;
+}
+
+/********************************************************************************
+*  Function:	layout_Combine													*
+*  Purpose:		Types a character after a dead key.								*
+*  Parameters:	@ wDeadKey ~[in]~ The pending dead key.							*
+*				@ wChar ~[in]~ The character.									*
+*				@ awChars ~[out]~ Gets the characters typed.					*
+*  Returns:		The number of characters typed.									*
+********************************************************************************/
+static
+DWORD
+layout_Combine(
+	__in WORD wDeadKey,
+	__in WORD wChar,
+	__out_ecount(LAYOUT_MAX_CHARS) PWORD awChars
+)
+{
+	DWORD dwAccent = layout_GetAccent(wDeadKey);
+	PCSTR pszBase = NULL;
+
+	// The combined character, if any
+	if ((0x80 > wChar) && (NULL != (pszBase = strchr(g_szCombiningBases, (CHAR)wChar))) &&
+		(0 != g_aawCombined[dwAccent][pszBase - g_szCombiningBases]))
+	{
+		awChars[0] = g_aawCombined[dwAccent][pszBase - g_szCombiningBases];
+		return 1;
+	}
+
+	// Otherwise the accent, then the character (unless a space, or another accent alone)
+	awChars[0] = g_awAccents[dwAccent];
+	if (' ' == wChar)
+	{
+		return 1;
+	}
+	awChars[1] = LAYOUT_IS_DEAD_KEY(wChar) ? g_awAccents[layout_GetAccent(wChar)] : wChar;
+	return 2;
+}
+
+/********************************************************************************
+*  Function:	LAYOUT_Parse													*
+********************************************************************************/
+BOOL
+LAYOUT_Parse(
+	__in_z PCSTR pszName,
+	__out PLAYOUT_ID peLayout
+)
+{
+	DWORD dwLayout = 0;
+
+	// Validations
+	ASSERT(NULL != pszName);
+	ASSERT(NULL != peLayout);
+
+	for (dwLayout = 0; dwLayout < LAYOUT_ID_COUNT; dwLayout++)
+	{
+		if (0 == strcmp(pszName, g_atLayouts[dwLayout].pszName))
+		{
+			*peLayout = (LAYOUT_ID)dwLayout;
+			return TRUE;
+		}
+	}
+
+	// Return result
+	return FALSE;
+}
+
+/********************************************************************************
+*  Function:	LAYOUT_GetName													*
+********************************************************************************/
+PCSTR
+LAYOUT_GetName(
+	__in LAYOUT_ID eLayout
+)
+{
+	// Validations
+	ASSERT(LAYOUT_ID_COUNT > eLayout);
+
+	// Return result
+	return g_atLayouts[eLayout].pszName;
+}
+
+/********************************************************************************
+*  Function:	LAYOUT_Decode													*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+********************************************************************************/
+DWORD
+LAYOUT_Decode(
+	__in LAYOUT_ID eLayout,
+	__inout PLAYOUT_STATE ptState,
+	__in WORD wScanCode,
+	__in BOOLEAN bIsKeyDown,
+	__out_ecount(LAYOUT_MAX_CHARS) PWORD awChars
+)
+{
+	PCLAYOUT ptLayout = &(g_atLayouts[eLayout]);
+	PCLAYOUT_KEY ptKey = NULL;
+	BYTE bModifier = 0;
+	DWORD dwChars = 0;
+	DWORD dwShift = 0;
+	DWORD dwAltGr = 0;
+	WORD wChar = 0;
+	WORD wDeadKey = 0;
+
+	// Keys outside the tables type nothing
+	if ((0 != (wScanCode & 0x80)) || ((0 != (wScanCode >> 8)) && (0xE0 != (wScanCode >> 8))))
+	{
+		return 0;
+	}
+
+	// Modifiers only change the state (the Windows key opens the run dialog with R)
+	bModifier = g_abModifiers[LAYOUT_INDEX(wScanCode)];
+	if (0 != bModifier)
+	{
+		if ((bIsKeyDown) && (0 == (ptState->bModifiers & bModifier)))
+		{
+			ptState->bIsCapsLocked ^= (LAYOUT_MODIFIER_CAPS_LOCK == bModifier);
+			awChars[0] = LAYOUT_GUI_CHAR;
+			dwChars = (0 != (bModifier & LAYOUT_MODIFIER_GUI));
+		}
+		ptState->bModifiers = bIsKeyDown ? (BYTE)(ptState->bModifiers | bModifier) : (BYTE)(ptState->bModifiers & ~bModifier);
+		return dwChars;
+	}
+	if (!bIsKeyDown)
+	{
+		return 0;
+	}
+
+	// The character: Caps Lock reverses Shift on its keys, AltGr overrides both
+	ptKey = &(ptLayout->atKeys[LAYOUT_INDEX(wScanCode)]);
+	dwShift = (0 != (ptState->bModifiers & LAYOUT_MODIFIER_SHIFT)) ^ (ptState->bIsCapsLocked & ptKey->bIsCapsKey);
+	dwAltGr = (ptLayout->bHasAltGr) & (0 != (ptState->bModifiers & LAYOUT_MODIFIER_ALTGR));
+	wChar = ptKey->awChars[(dwAltGr << 1) | (dwShift & (dwAltGr ^ 1))];
+	if (0 == wChar)
+	{
+		return 0;
+	}
+
+	// Ctrl with a letter is its control character (AltGr may come with Ctrl, as on Windows)
+	if ((0 != (ptState->bModifiers & LAYOUT_MODIFIER_CTRL)) && (0 == dwAltGr) && (26 > (WORD)((wChar | 0x20) - 'a')))
+	{
+		wChar &= 0x1F;
+	}
+
+	// A dead key waits for the next character
+	wDeadKey = ptState->wDeadKey;
+	if (0 != wDeadKey)
+	{
+		ptState->wDeadKey = 0;
+		return layout_Combine(wDeadKey, wChar, awChars);
+	}
+	if (LAYOUT_IS_DEAD_KEY(wChar))
+	{
+		ptState->wDeadKey = wChar;
+		return 0;
+	}
+
+	// Return result
+	awChars[0] = wChar;
+	return 1;
+}
@@ -0,0 +1,116 @@
+/********************************************************************************
+*  File:		Layout.h														*
+*  Purpose:		Decodes keystrokes to characters, by keyboard layout.			*
+*  Remarks:		* The layout tables are built by the preprocessor into constant	*
+*					data, indexed by scan code: decoding a key is a few table	*
+*					lookups, with no allocation.								*
+*				* Characters are Unicode code points (BMP).						*
+********************************************************************************/
+#pragma once
+
+
+/** Includes *******************************************************************/
+#include <Utilities.h>
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	LAYOUT_MAX_CHARS												*
+*  Purpose:		Characters a single keystroke decodes to at most (an accent		*
+*				that does not combine, then the character).						*
+********************************************************************************/
+#define LAYOUT_MAX_CHARS (2)
+
+/********************************************************************************
+*  Constant:	LAYOUT_GUI_CHAR													*
+*  Purpose:		The character a press of the Windows (GUI) key decodes to (a C1	*
+*				control no layout types).										*
+********************************************************************************/
+#define LAYOUT_GUI_CHAR (0x0080)
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Enum:		LAYOUT_ID														*
+*  Purpose:		The supported layouts, as Windows defines them.					*
+********************************************************************************/
+typedef enum _LAYOUT_ID
+{
+	LAYOUT_ID_US = 0,								// United States (QWERTY)
+	LAYOUT_ID_UK,									// United Kingdom (QWERTY)
+	LAYOUT_ID_DE,									// German (QWERTZ)
+	LAYOUT_ID_FR,									// French (AZERTY)
+	LAYOUT_ID_IL,									// Hebrew (standard)
+
+	// Must be last
+	LAYOUT_ID_COUNT
+} LAYOUT_ID, *PLAYOUT_ID;
+
+/********************************************************************************
+*  Structure:	LAYOUT_STATE													*
+*  Purpose:		Where a keyboard's typing stands: modifiers held, Caps Lock		*
+*				and a pending dead key.											*
+*  Remarks:		* Initially zeroed.												*
+********************************************************************************/
+typedef struct _LAYOUT_STATE
+{
+	WORD wDeadKey;									// Combining accent of a pending dead key, or 0
+	BYTE bModifiers;								// Modifier keys down, as bits
+	BOOLEAN bIsCapsLocked;							// Whether Caps Lock is on
+} LAYOUT_STATE, *PLAYOUT_STATE;
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	LAYOUT_Parse													*
+*  Purpose:		Gets a layout by name.											*
+*  Parameters:	@ pszName ~[in]~ The name: "us", "uk", "de", "fr" or "il".		*
+*				@ peLayout ~[out]~ Gets the layout.								*
+*  Returns:		FALSE if there is no such layout.								*
+********************************************************************************/
+BOOL
+LAYOUT_Parse(
+	__in_z PCSTR pszName,
+	__out PLAYOUT_ID peLayout
+);
+
+/********************************************************************************
+*  Function:	LAYOUT_GetName													*
+*  Purpose:		Gets a layout's name.											*
+*  Parameters:	@ eLayout ~[in]~ The layout.									*
+*  Returns:		The name, as LAYOUT_Parse takes it.								*
+********************************************************************************/
+PCSTR
+LAYOUT_GetName(
+	__in LAYOUT_ID eLayout
+);
+
+/********************************************************************************
+*  Function:	LAYOUT_Decode													*
+*  Purpose:		Decodes a keystroke.											*
+*  Parameters:	@ eLayout ~[in]~ The layout.									*
+*				@ ptState ~[inout]~ The keyboard's state.						*
+*				@ wScanCode ~[in]~ The set 1 scan code.							*
+*				@ bIsKeyDown ~[in]~ Press or release (repeats are presses).		*
+*				@ awChars ~[out]~ Gets the characters typed.					*
+*  Returns:		The number of characters typed (up to LAYOUT_MAX_CHARS).		*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+*				* Tracks Shift, Ctrl, AltGr (right Alt, except on the US		*
+*					layout), Caps Lock and the Windows key, whose presses		*
+*					decode to LAYOUT_GUI_CHAR. Ctrl with a letter decodes to its	*
+*					control character.											*
+*				* A dead key types nothing, and combines with the next			*
+*					character when it can. Otherwise both are typed, the		*
+*					accent alone first (a space types only the accent).			*
+********************************************************************************/
+DWORD
+LAYOUT_Decode(
+	__in LAYOUT_ID eLayout,
+	__inout PLAYOUT_STATE ptState,
+	__in WORD wScanCode,
+	__in BOOLEAN bIsKeyDown,
+	__out_ecount(LAYOUT_MAX_CHARS) PWORD awChars
+);
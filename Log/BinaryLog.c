@@ -0,0 +1,1252 @@
+/********************************************************************************
+*  File:		BinaryLog.c														*
+*  Purpose:		Asynchronous binary logging backend for DEBUG_MSG.				*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#include <ctype.h>
+#include <stdarg.h>
+#include <time.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#endif	// _WIN32
+#include "BinaryLog.h"
+#include <Clock.h>
+#include "../Queue/SpscQueue.h"
+
+
+#ifdef _BINARY_LOG
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	LOG_NOTIFY_BUFFER_SIZE											*
+*  Purpose:		Size of the buffer inotify events are drained into.				*
+********************************************************************************/
+#define LOG_NOTIFY_BUFFER_SIZE (4096)
+
+
+/** Macros *********************************************************************/
+
+/********************************************************************************
+*  Macro:		LOG_THREAD_LOCAL												*
+*  Purpose:		Declares a thread-local global.									*
+********************************************************************************/
+#ifdef _MSC_VER
+#define LOG_THREAD_LOCAL __declspec(thread)
+#else	// _MSC_VER
+#define LOG_THREAD_LOCAL __thread
+#endif	// _MSC_VER
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Structure:	LOG_CONTROL_RULE												*
+*  Purpose:		A control file rule (see LOG_CONTROL_DEFAULT_PATH).				*
+********************************************************************************/
+typedef struct _LOG_CONTROL_RULE
+{
+	CHAR szName[LOG_CONTROL_SELECTOR_CHARS];		// Function, or prefix ending with '*'
+	DWORD dwLine;									// Source line of a single site, or 0
+	BOOL bIsEnabled;								// Log or skip what it selects
+} LOG_CONTROL_RULE, *PLOG_CONTROL_RULE;
+typedef const LOG_CONTROL_RULE *PCLOG_CONTROL_RULE;
+
+/********************************************************************************
+*  Structure:	LOG_RING														*
+*  Purpose:		A logging thread's ring.										*
+********************************************************************************/
+typedef struct _LOG_RING
+{
+	SPSCQUEUE tQueue;								// Records (thread to flusher)
+	WORD wThread;									// Thread index
+	ULONGLONG qwReportedDrops;						// Drops already in the file (flusher)
+} LOG_RING, *PLOG_RING;
+
+/********************************************************************************
+*  Structure:	LOG_CONTEXT														*
+*  Purpose:		The module context.												*
+********************************************************************************/
+typedef struct _LOG_CONTEXT
+{
+	volatile LONG nIsRunning;						// Records are accepted
+	LOG_SEV eMinSeverity;							// Less severe sites are skipped
+	CHAR szPath[MAX_PATH];							// The log file's path
+	FILE *ptFile;									// The log file (flusher), or NULL
+	HANDLE hFlusher;								// Flusher thread
+	volatile LONG nIsStopping;						// Flusher should exit
+	volatile LONG nPasses;							// Completed flusher passes
+	volatile LONG nIsFlusherIdle;					// Flusher sleeps until woken
+#ifdef _WIN32
+	HANDLE hWakeup;									// Auto-reset event
+	HANDLE hControlChange;							// Control file's directory changes (flusher), or NULL
+#else	// _WIN32
+	INT nWakeup;									// eventfd
+	INT nControlNotify;								// Control file's directory inotify (flusher), or -1
+#endif	// _WIN32
+	volatile LONG nSites;							// Registered call sites
+	DWORD dwWrittenSites;							// Sites already in the file (flusher)
+	PLOG_SITE volatile aptSites[LOG_MAX_SITES];		// Sites by ID - 1
+	CHAR szControlPath[MAX_PATH];					// The control file, or empty
+	struct stat tControlStat;						// The control file as last read, zeroed if missing (flusher)
+	LOG_CONTROL_RULE atRules[LOG_MAX_CONTROL_RULES];	// Its rules (flusher)
+	DWORD dwRules;									// Number of rules (flusher)
+	DWORD dwControlledSites;						// Sites the rules were applied to (flusher)
+	volatile LONG nRings;							// Created rings
+	PLOG_RING volatile aptRings[LOG_MAX_THREADS];	// Rings by thread index
+} LOG_CONTEXT, *PLOG_CONTEXT;
+
+
+/** Globals ********************************************************************/
+
+/********************************************************************************
+*  Global:		g_tContext														*
+*  Purpose:		The module context.												*
+********************************************************************************/
+static
+LOG_CONTEXT
+g_tContext = { 0 };
+
+/********************************************************************************
+*  Global:		g_ptThreadRing													*
+*  Purpose:		The current thread's ring.										*
+********************************************************************************/
+static
+LOG_THREAD_LOCAL
+PLOG_RING
+g_ptThreadRing = NULL;
+
+/********************************************************************************
+*  Global:		g_bIsThreadRingFailed											*
+*  Purpose:		Whether the current thread could not get a ring.				*
+********************************************************************************/
+static
+LOG_THREAD_LOCAL
+BOOL
+g_bIsThreadRingFailed = FALSE;
+#endif	// _BINARY_LOG
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	LOG_NextConversion												*
+********************************************************************************/
+PCSTR
+LOG_NextConversion(
+	__in_z PCSTR pszFormat,
+	__out PCSTR *ppszNext,
+	__out PLOG_ARG_TYPE peType
+)
+{
+	PCSTR pszConversion = NULL;
+	PCSTR pszCurrent = NULL;
+	INT nLongs = 0;
+	BOOL bIsSize = FALSE;
+
+	*ppszNext = NULL;
+	*peType = LOG_ARG_TYPE_NONE;
+
+	// Find the next '%'
+	pszConversion = strchr(pszFormat, '%');
+	if (NULL == pszConversion)
+	{
+		return NULL;
+	}
+	pszCurrent = pszConversion + 1;
+
+	// Flags, width and precision ('*' would take an argument of its own)
+	while ((NULL != strchr("-+ #0", *pszCurrent)) && ('\0' != *pszCurrent))
+	{
+		pszCurrent++;
+	}
+	while (((('0' <= *pszCurrent) && ('9' >= *pszCurrent)) || ('.' == *pszCurrent)))
+	{
+		pszCurrent++;
+	}
+	if ('*' == *pszCurrent)
+	{
+		return pszConversion;
+	}
+
+	// Length
+	for (;;)
+	{
+		if ('l' == *pszCurrent)
+		{
+			nLongs++;
+		}
+		else if (('z' == *pszCurrent) || ('t' == *pszCurrent))
+		{
+			bIsSize = TRUE;
+		}
+		else if (('j' == *pszCurrent) || (0 == strncmp(pszCurrent, "I64", 3)))
+		{
+			nLongs = 2;
+			pszCurrent += ('j' == *pszCurrent) ? 0 : 2;
+		}
+		else if ('I' == *pszCurrent)
+		{
+			bIsSize = TRUE;
+		}
+		else if ('h' != *pszCurrent)
+		{
+			break;
+		}
+		pszCurrent++;
+	}
+
+	// Conversion
+	switch (*pszCurrent)
+	{
+	case '%':
+		*peType = LOG_ARG_TYPE_NONE;
+		break;
+
+	case 'd':
+	case 'i':
+	case 'u':
+	case 'x':
+	case 'X':
+	case 'o':
+		*peType = bIsSize ? LOG_ARG_TYPE_SIZE :
+			(2 <= nLongs) ? LOG_ARG_TYPE_LONGLONG :
+			(1 == nLongs) ? LOG_ARG_TYPE_LONG :
+			LOG_ARG_TYPE_INT;
+		break;
+
+	case 'c':
+		if (0 != nLongs)
+		{
+			return pszConversion;
+		}
+		*peType = LOG_ARG_TYPE_INT;
+		break;
+
+	case 's':
+		if (0 != nLongs)
+		{
+			return pszConversion;
+		}
+		*peType = LOG_ARG_TYPE_STRING;
+		break;
+
+	case 'p':
+		*peType = LOG_ARG_TYPE_POINTER;
+		break;
+
+	case 'f':
+	case 'F':
+	case 'e':
+	case 'E':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		*peType = LOG_ARG_TYPE_DOUBLE;
+		break;
+
+	default:
+		return pszConversion;
+	}
+
+	// Return result
+	*ppszNext = pszCurrent + 1;
+	return pszConversion;
+}
+
+#ifdef _BINARY_LOG
+/********************************************************************************
+*  Function:	log_RegisterSite												*
+*  Purpose:		Parses a call site's format and gives it an ID.					*
+*  Parameters:	@ ptSite ~[inout]~ The call site.								*
+*  Returns:		TRUE if the site may be logged.									*
+*  Remarks:		* A thread that races another thread's registration drops its	*
+*					record.														*
+*				* Enables the site by severity.									*
+********************************************************************************/
+static
+BOOL
+log_RegisterSite(
+	__inout PLOG_SITE ptSite
+)
+{
+	PCSTR pszCurrent = ptSite->pszFormat;
+	PCSTR pszNext = NULL;
+	LOG_ARG_TYPE eType = LOG_ARG_TYPE_NONE;
+	LONG nId = 0;
+
+	// Claim the registration
+	if (0 != ATOMIC_COMPARE_EXCHANGE(&(ptSite->nId), -1, 0))
+	{
+		return FALSE;
+	}
+
+	// Parse the format
+	ptSite->cArgs = 0;
+	while (NULL != LOG_NextConversion(pszCurrent, &pszNext, &eType))
+	{
+		if ((NULL == pszNext) || (LOG_SITE_MAX_ARGS <= ptSite->cArgs))
+		{
+			ptSite->cArgs = LOG_ARGS_UNSUPPORTED;
+			break;
+		}
+		if (LOG_ARG_TYPE_NONE != eType)
+		{
+			ptSite->abArgTypes[ptSite->cArgs++] = (BYTE)eType;
+		}
+		pszCurrent = pszNext;
+	}
+
+	// Publish it for the flusher, logged by severity until it applies the control rules
+	// (sites beyond the table stay unregistered, and are no longer logged)
+	nId = ATOMIC_INCREMENT(&(g_tContext.nSites));
+	ATOMIC_STORE_RELEASE(&(ptSite->nIsEnabled), (LOG_MAX_SITES >= nId) && (ptSite->eSev >= g_tContext.eMinSeverity));
+	if (LOG_MAX_SITES < nId)
+	{
+		return FALSE;
+	}
+	ATOMIC_STORE_RELEASE_POINTER(&(g_tContext.aptSites[nId - 1]), ptSite);
+	ATOMIC_STORE_RELEASE(&(ptSite->nId), nId);
+
+	// Return result
+	return ptSite->nIsEnabled;
+}
+
+/********************************************************************************
+*  Function:	log_GetThreadRing												*
+*  Purpose:		Gets the current thread's ring, creating it on first use.		*
+*  Returns:		The ring, or NULL if none could be created.						*
+*  Remarks:		* Rings outlive their threads, until LOG_Stop.					*
+********************************************************************************/
+static
+PLOG_RING
+log_GetThreadRing(VOID)
+{
+	PLOG_RING ptRing = NULL;
+	LONG nIndex = 0;
+
+	// Only try once per thread
+	if ((NULL != g_ptThreadRing) || g_bIsThreadRingFailed)
+	{
+		return g_ptThreadRing;
+	}
+	g_bIsThreadRingFailed = TRUE;
+
+	// Reserve a thread index
+	nIndex = ATOMIC_INCREMENT(&(g_tContext.nRings)) - 1;
+	if (LOG_MAX_THREADS <= nIndex)
+	{
+		goto lblCleanup;
+	}
+
+	// Allocate the ring (once per thread and run)
+	ptRing = (PLOG_RING)ALLOCZ(sizeof(*ptRing));
+	if (NULL == ptRing)
+	{
+		goto lblCleanup;
+	}
+	if (RETSTATUS_FAILED(SPSCQUEUE_Create(sizeof(LOG_RECORD), LOG_RING_CAPACITY, &(ptRing->tQueue))))
+	{
+		FREE(ptRing);
+		goto lblCleanup;
+	}
+	ptRing->wThread = (WORD)nIndex;
+
+	// Publish it for the flusher
+	ATOMIC_STORE_RELEASE_POINTER(&(g_tContext.aptRings[nIndex]), ptRing);
+	g_ptThreadRing = ptRing;
+	g_bIsThreadRingFailed = FALSE;
+
+lblCleanup:
+
+	// Return result
+	return g_ptThreadRing;
+}
+
+/********************************************************************************
+*  Function:	log_Wake														*
+*  Purpose:		Wakes the flusher.												*
+*  Parameters:	@ ptContext ~[inout]~ The module context.						*
+********************************************************************************/
+static
+VOID
+log_Wake(
+	__inout PLOG_CONTEXT ptContext
+)
+{
+#ifdef _WIN32
+	(VOID)SetEvent(ptContext->hWakeup);
+#else	// _WIN32
+	(VOID)eventfd_write(ptContext->nWakeup, 1);
+#endif	// _WIN32
+}
+
+/********************************************************************************
+*  Function:	LOG_Write														*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+*				* Never blocks. Only allocates on a thread's first record.		*
+*				* Called by enabled call sites, and by every site until it is	*
+*					registered.													*
+********************************************************************************/
+VOID
+LOG_Write(
+	__inout PLOG_SITE ptSite,
+	...
+)
+{
+	LOG_RECORD tRecord;
+	PLOG_RING ptRing = NULL;
+	va_list vaArgs;
+	ULONG dwArg = 0;
+	ULONG cbUsed = 0;
+	INT nValue = 0;
+	LONGLONG llValue = 0;
+	double dValue = 0;
+	PCSTR pszValue = NULL;
+	WORD cchValue = 0;
+
+	// Cheap rejections first (registered sites only get here while enabled)
+	if (!ATOMIC_LOAD_ACQUIRE(&(g_tContext.nIsRunning)))
+	{
+		return;
+	}
+	if ((0 >= ATOMIC_LOAD_ACQUIRE(&(ptSite->nId))) && (!log_RegisterSite(ptSite)))
+	{
+		return;
+	}
+	ptRing = log_GetThreadRing();
+	if (NULL == ptRing)
+	{
+		return;
+	}
+	tRecord.tHeader.qwTimestamp = CLOCK_GetTimestamp();
+	tRecord.tHeader.dwSiteId = (DWORD)(ptSite->nId);
+	tRecord.tHeader.wThread = ptRing->wThread;
+
+	// Copy the raw arguments, as the format says
+	va_start(vaArgs, ptSite);
+	for (dwArg = 0; (LOG_ARGS_UNSUPPORTED != ptSite->cArgs) && (dwArg < ptSite->cArgs); dwArg++)
+	{
+		switch (ptSite->abArgTypes[dwArg])
+		{
+		case LOG_ARG_TYPE_INT:
+			if (sizeof(tRecord.abArgs) - cbUsed < sizeof(INT))
+			{
+				goto lblDone;
+			}
+			nValue = va_arg(vaArgs, INT);
+			RtlCopyMemory(&(tRecord.abArgs[cbUsed]), &nValue, sizeof(nValue));
+			cbUsed += sizeof(nValue);
+			continue;
+
+		case LOG_ARG_TYPE_LONG:
+			llValue = va_arg(vaArgs, long);
+			break;
+
+		case LOG_ARG_TYPE_LONGLONG:
+			llValue = va_arg(vaArgs, LONGLONG);
+			break;
+
+		case LOG_ARG_TYPE_SIZE:
+			llValue = (LONGLONG)va_arg(vaArgs, SIZE_T);
+			break;
+
+		case LOG_ARG_TYPE_POINTER:
+			llValue = (LONGLONG)(SIZE_T)va_arg(vaArgs, PVOID);
+			break;
+
+		case LOG_ARG_TYPE_DOUBLE:
+			dValue = va_arg(vaArgs, double);
+			RtlCopyMemory(&llValue, &dValue, sizeof(llValue));
+			break;
+
+		case LOG_ARG_TYPE_STRING:
+			pszValue = va_arg(vaArgs, PCSTR);
+			pszValue = (NULL == pszValue) ? "(null)" : pszValue;
+			if (sizeof(tRecord.abArgs) - cbUsed < sizeof(WORD))
+			{
+				goto lblDone;
+			}
+			for (cchValue = 0;
+				('\0' != pszValue[cchValue]) && (cchValue < sizeof(tRecord.abArgs) - cbUsed - sizeof(WORD));
+				cchValue++)
+			{
+				tRecord.abArgs[cbUsed + sizeof(WORD) + cchValue] = (BYTE)(pszValue[cchValue]);
+			}
+			RtlCopyMemory(&(tRecord.abArgs[cbUsed]), &cchValue, sizeof(cchValue));
+			cbUsed += sizeof(WORD) + cchValue;
+			continue;
+
+		default:
+			goto lblDone;
+		}
+
+		// 8 byte values
+		if (sizeof(tRecord.abArgs) - cbUsed < sizeof(llValue))
+		{
+			goto lblDone;
+		}
+		RtlCopyMemory(&(tRecord.abArgs[cbUsed]), &llValue, sizeof(llValue));
+		cbUsed += sizeof(llValue);
+	}
+
+lblDone:
+
+	va_end(vaArgs);
+
+	// Hand it to the flusher (dropped and counted if the ring is full)
+	tRecord.tHeader.cbArgs = (WORD)cbUsed;
+	if (!SPSCQUEUE_Enqueue(&(ptRing->tQueue), &tRecord))
+	{
+		return;
+	}
+
+	// Wake it if it sleeps (the enqueue orders the publish before the flag, see log_Sleep)
+	if ((ATOMIC_LOAD_ACQUIRE(&(g_tContext.nIsFlusherIdle))) &&
+		(TRUE == ATOMIC_COMPARE_EXCHANGE(&(g_tContext.nIsFlusherIdle), FALSE, TRUE)))
+	{
+		log_Wake(&g_tContext);
+	}
+}
+
+/********************************************************************************
+*  Function:	log_WriteSites													*
+*  Purpose:		Writes the definitions of newly registered call sites.			*
+*  Parameters:	@ ptContext ~[inout]~ The module context.						*
+*  Remarks:		* Flusher only.													*
+********************************************************************************/
+static
+VOID
+log_WriteSites(
+	__inout PLOG_CONTEXT ptContext
+)
+{
+	PLOG_SITE ptSite = NULL;
+	BYTE bTag = LOG_CHUNK_SITE;
+	BYTE bSeverity = 0;
+	DWORD dwId = 0;
+	WORD cchFunction = 0;
+	WORD cchFormat = 0;
+
+	if (NULL == ptContext->ptFile)
+	{
+		return;
+	}
+
+	// Stop at the first site that is still being published
+	while (ptContext->dwWrittenSites < MIN((DWORD)ATOMIC_LOAD_ACQUIRE(&(ptContext->nSites)), LOG_MAX_SITES))
+	{
+		ptSite = (PLOG_SITE)ATOMIC_LOAD_ACQUIRE_POINTER(&(ptContext->aptSites[ptContext->dwWrittenSites]));
+		if (NULL == ptSite)
+		{
+			break;
+		}
+		dwId = ptContext->dwWrittenSites + 1;
+		bSeverity = (BYTE)(ptSite->eSev);
+		cchFunction = (WORD)strlen(ptSite->pszFunction);
+		cchFormat = (WORD)strlen(ptSite->pszFormat);
+		(VOID)fwrite(&bTag, sizeof(bTag), 1, ptContext->ptFile);
+		(VOID)fwrite(&dwId, sizeof(dwId), 1, ptContext->ptFile);
+		(VOID)fwrite(&bSeverity, sizeof(bSeverity), 1, ptContext->ptFile);
+		(VOID)fwrite(&cchFunction, sizeof(cchFunction), 1, ptContext->ptFile);
+		(VOID)fwrite(&cchFormat, sizeof(cchFormat), 1, ptContext->ptFile);
+		(VOID)fwrite(ptSite->pszFunction, 1, cchFunction, ptContext->ptFile);
+		(VOID)fwrite(ptSite->pszFormat, 1, cchFormat, ptContext->ptFile);
+		ptContext->dwWrittenSites++;
+	}
+}
+
+/********************************************************************************
+*  Function:	log_WriteRing													*
+*  Purpose:		Writes a ring's records, and its drops if there are new ones.	*
+*  Parameters:	@ ptContext ~[inout]~ The module context.						*
+*				@ ptRing ~[inout]~ The ring.									*
+*  Returns:		TRUE if the ring had records.									*
+*  Remarks:		* Flusher only.													*
+********************************************************************************/
+static
+BOOL
+log_WriteRing(
+	__inout PLOG_CONTEXT ptContext,
+	__inout PLOG_RING ptRing
+)
+{
+	PLOG_RECORD ptRecords = NULL;
+	ULONG dwCount = 0;
+	ULONG dwIndex = 0;
+	BYTE bTag = 0;
+	SPSCQUEUE_STATS tStats = { 0 };
+	BOOL bHadRecords = FALSE;
+
+	// Drain in contiguous batches
+	for (;;)
+	{
+		dwCount = SPSCQUEUE_Peek(&(ptRing->tQueue), (PVOID *)&ptRecords);
+		if (0 == dwCount)
+		{
+			break;
+		}
+		bHadRecords = TRUE;
+		bTag = LOG_CHUNK_RECORD;
+		for (dwIndex = 0; (dwIndex < dwCount) && (NULL != ptContext->ptFile); dwIndex++)
+		{
+			(VOID)fwrite(&bTag, sizeof(bTag), 1, ptContext->ptFile);
+			(VOID)fwrite(&(ptRecords[dwIndex]),
+				sizeof(LOG_RECORD_HEADER) + ptRecords[dwIndex].tHeader.cbArgs,
+				1,
+				ptContext->ptFile);
+		}
+		SPSCQUEUE_Release(&(ptRing->tQueue), dwCount);
+	}
+
+	// Report drops
+	SPSCQUEUE_GetStats(&(ptRing->tQueue), &tStats);
+	if ((tStats.qwDropped != ptRing->qwReportedDrops) && (NULL != ptContext->ptFile))
+	{
+		bTag = LOG_CHUNK_DROPS;
+		(VOID)fwrite(&bTag, sizeof(bTag), 1, ptContext->ptFile);
+		(VOID)fwrite(&(ptRing->wThread), sizeof(ptRing->wThread), 1, ptContext->ptFile);
+		(VOID)fwrite(&(tStats.qwDropped), sizeof(tStats.qwDropped), 1, ptContext->ptFile);
+		ptRing->qwReportedDrops = tStats.qwDropped;
+	}
+
+	// Return result
+	return bHadRecords;
+}
+
+/********************************************************************************
+*  Function:	log_ReadControl													*
+*  Purpose:		Reads the control file's rules again if it changed.				*
+*  Parameters:	@ ptContext ~[inout]~ The module context.						*
+*  Returns:		TRUE if the rules may have changed.								*
+*  Remarks:		* Flusher only.													*
+*				* Malformed rules, and rules beyond LOG_MAX_CONTROL_RULES, are	*
+*					skipped.													*
+********************************************************************************/
+static
+BOOL
+log_ReadControl(
+	__inout PLOG_CONTEXT ptContext
+)
+{
+	struct stat tStat;
+	FILE *ptControl = NULL;
+	PLOG_CONTROL_RULE ptRule = NULL;
+	CHAR szLine[LOG_CONTROL_SELECTOR_CHARS + 16];
+	PSTR pszSelector = NULL;
+	PSTR pszLineNumber = NULL;
+	PSTR pszEnd = NULL;
+	SIZE_T cchLine = 0;
+	BOOL bIsWhole = TRUE;
+	BOOL bWasWhole = TRUE;
+
+	if ('\0' == ptContext->szControlPath[0])
+	{
+		return FALSE;
+	}
+
+	// A missing file stats as zeroed
+	RtlZeroMemory(&tStat, sizeof(tStat));
+	if (0 != stat(ptContext->szControlPath, &tStat))
+	{
+		RtlZeroMemory(&tStat, sizeof(tStat));
+	}
+	if ((tStat.st_mtime == ptContext->tControlStat.st_mtime) &&
+		(tStat.st_size == ptContext->tControlStat.st_size) &&
+		(tStat.st_ino == ptContext->tControlStat.st_ino))
+	{
+		return FALSE;
+	}
+	ptContext->tControlStat = tStat;
+	ptContext->dwRules = 0;
+	ptControl = fopen(ptContext->szControlPath, "r");
+	if (NULL == ptControl)
+	{
+		return TRUE;
+	}
+
+	// One rule per line, lines too long for a rule are skipped whole
+	while ((LOG_MAX_CONTROL_RULES > ptContext->dwRules) && (NULL != fgets(szLine, sizeof(szLine), ptControl)))
+	{
+		cchLine = strlen(szLine);
+		bWasWhole = bIsWhole;
+		bIsWhole = ((0 < cchLine) && ('\n' == szLine[cchLine - 1])) || feof(ptControl);
+		if ((!bWasWhole) || (!bIsWhole))
+		{
+			continue;
+		}
+		while ((0 < cchLine) && (('\r' == szLine[cchLine - 1]) || ('\n' == szLine[cchLine - 1])))
+		{
+			szLine[--cchLine] = '\0';
+		}
+		if (('+' != szLine[0]) && ('-' != szLine[0]))
+		{
+			continue;
+		}
+
+		// An optional line number selects a single site
+		ptRule = &(ptContext->atRules[ptContext->dwRules]);
+		ptRule->dwLine = 0;
+		pszSelector = &(szLine[1]);
+		pszLineNumber = strrchr(pszSelector, ':');
+		if (NULL != pszLineNumber)
+		{
+			*pszLineNumber++ = '\0';
+			ptRule->dwLine = (DWORD)strtoul(pszLineNumber, &pszEnd, 10);
+			if ((0 == ptRule->dwLine) || ('\0' != *pszEnd))
+			{
+				continue;
+			}
+		}
+		cchLine = strlen(pszSelector);
+		if ((0 == cchLine) || (sizeof(ptRule->szName) <= cchLine))
+		{
+			continue;
+		}
+		(VOID)memcpy(ptRule->szName, pszSelector, cchLine + 1);
+		ptRule->bIsEnabled = ('+' == szLine[0]);
+		ptContext->dwRules++;
+	}
+	(VOID)fclose(ptControl);
+
+	// Return result
+	return TRUE;
+}
+
+/********************************************************************************
+*  Function:	log_IsSelected													*
+*  Purpose:		Checks whether a control rule selects a call site.				*
+*  Parameters:	@ ptRule ~[in]~ The rule.										*
+*				@ ptSite ~[in]~ The call site.									*
+*  Returns:		TRUE if it does.												*
+********************************************************************************/
+static
+BOOL
+log_IsSelected(
+	__in PCLOG_CONTROL_RULE ptRule,
+	__in PCLOG_SITE ptSite
+)
+{
+	SIZE_T cchPrefix = strlen(ptRule->szName) - 1;
+	SIZE_T cchIndex = 0;
+
+	// A prefix ignores case, so "usbnotifier_*" also selects USBNOTIFIER_ functions
+	if ('*' == ptRule->szName[cchPrefix])
+	{
+		for (cchIndex = 0; cchIndex < cchPrefix; cchIndex++)
+		{
+			if (toupper((UCHAR)(ptRule->szName[cchIndex])) != toupper((UCHAR)(ptSite->pszFunction[cchIndex])))
+			{
+				return FALSE;
+			}
+		}
+		return TRUE;
+	}
+
+	// Return result
+	return (0 == strcmp(ptRule->szName, ptSite->pszFunction)) &&
+		((0 == ptRule->dwLine) || (ptRule->dwLine == ptSite->dwLine));
+}
+
+/********************************************************************************
+*  Function:	log_ControlSites												*
+*  Purpose:		Enables or disables call sites by severity, then by the			*
+*				control rules.													*
+*  Parameters:	@ ptContext ~[inout]~ The module context.						*
+*  Remarks:		* Flusher only.													*
+*				* Only newly registered sites, unless the rules changed.		*
+********************************************************************************/
+static
+VOID
+log_ControlSites(
+	__inout PLOG_CONTEXT ptContext
+)
+{
+	PLOG_SITE ptSite = NULL;
+	DWORD dwSite = ptContext->dwControlledSites;
+	DWORD dwRule = 0;
+	BOOL bIsEnabled = FALSE;
+
+	if (log_ReadControl(ptContext))
+	{
+		dwSite = 0;
+	}
+
+	// Stop at the first site that is still being published
+	while (dwSite < MIN((DWORD)ATOMIC_LOAD_ACQUIRE(&(ptContext->nSites)), LOG_MAX_SITES))
+	{
+		ptSite = (PLOG_SITE)ATOMIC_LOAD_ACQUIRE_POINTER(&(ptContext->aptSites[dwSite]));
+		if (NULL == ptSite)
+		{
+			break;
+		}
+		bIsEnabled = (ptSite->eSev >= ptContext->eMinSeverity);
+		for (dwRule = 0; dwRule < ptContext->dwRules; dwRule++)
+		{
+			if (log_IsSelected(&(ptContext->atRules[dwRule]), ptSite))
+			{
+				bIsEnabled = ptContext->atRules[dwRule].bIsEnabled;
+			}
+		}
+		ATOMIC_STORE_RELEASE(&(ptSite->nIsEnabled), bIsEnabled);
+		dwSite++;
+	}
+	ptContext->dwControlledSites = dwSite;
+}
+
+/********************************************************************************
+*  Function:	log_FlushPass													*
+*  Purpose:		Writes everything pending to the file.							*
+*  Parameters:	@ ptContext ~[inout]~ The module context.						*
+*  Returns:		TRUE if there were records.										*
+*  Remarks:		* Flusher only (or LOG_Stop, once the flusher is gone).			*
+********************************************************************************/
+static
+BOOL
+log_FlushPass(
+	__inout PLOG_CONTEXT ptContext
+)
+{
+	PLOG_RING ptRing = NULL;
+	LONG nRing = 0;
+	LONG nRings = MIN(ATOMIC_LOAD_ACQUIRE(&(ptContext->nRings)), LOG_MAX_THREADS);
+	BOOL bHadRecords = FALSE;
+
+	// Sites first, so a decoder reading sequentially usually knows them
+	log_ControlSites(ptContext);
+	log_WriteSites(ptContext);
+	for (nRing = 0; nRing < nRings; nRing++)
+	{
+		ptRing = (PLOG_RING)ATOMIC_LOAD_ACQUIRE_POINTER(&(ptContext->aptRings[nRing]));
+		if ((NULL != ptRing) && (log_WriteRing(ptContext, ptRing)))
+		{
+			bHadRecords = TRUE;
+		}
+	}
+	if (NULL != ptContext->ptFile)
+	{
+		(VOID)fflush(ptContext->ptFile);
+	}
+	(VOID)ATOMIC_INCREMENT(&(ptContext->nPasses));
+
+	// Return result
+	return bHadRecords;
+}
+
+/********************************************************************************
+*  Function:	log_OpenFile													*
+*  Purpose:		Opens the log file and writes the header (magic, then a clock	*
+*				anchor).														*
+*  Parameters:	@ ptContext ~[inout]~ The module context.						*
+*  Remarks:		* Flusher only, before its first pass.							*
+*				* On failure ptFile stays NULL, and records are drained and		*
+*					dropped.													*
+********************************************************************************/
+static
+VOID
+log_OpenFile(
+	__inout PLOG_CONTEXT ptContext
+)
+{
+	ULONGLONG qwAnchorTimestamp = 0;
+	ULONGLONG qwAnchorUnixTime = 0;
+
+	ptContext->ptFile = fopen(ptContext->szPath, "wb");
+	if (NULL == ptContext->ptFile)
+	{
+		return;
+	}
+	qwAnchorTimestamp = CLOCK_GetTimestamp();
+	qwAnchorUnixTime = (ULONGLONG)time(NULL);
+	if ((1 != fwrite(LOG_FILE_MAGIC, 8, 1, ptContext->ptFile)) ||
+		(1 != fwrite(&qwAnchorTimestamp, sizeof(qwAnchorTimestamp), 1, ptContext->ptFile)) ||
+		(1 != fwrite(&qwAnchorUnixTime, sizeof(qwAnchorUnixTime), 1, ptContext->ptFile)))
+	{
+		CLOSE(ptContext->ptFile, fclose);
+	}
+}
+
+/********************************************************************************
+*  Function:	log_WatchControl												*
+*  Purpose:		Starts watching the directory of the control file.				*
+*  Parameters:	@ ptContext ~[inout]~ The module context.						*
+*  Remarks:		* Flusher only, before its first pass.							*
+*				* The directory is watched rather than the file, which may be	*
+*					missing or replaced by renaming over it.					*
+*				* On failure the watch stays closed, and the control file is	*
+*					polled every LOG_FLUSH_INTERVAL_MS.							*
+********************************************************************************/
+static
+VOID
+log_WatchControl(
+	__inout PLOG_CONTEXT ptContext
+)
+{
+	CHAR szDirectory[MAX_PATH] = { 0 };
+	SIZE_T cchDirectory = 0;
+	SIZE_T cchIndex = 0;
+
+#ifdef _WIN32
+	ptContext->hControlChange = NULL;
+#else	// _WIN32
+	ptContext->nControlNotify = -1;
+#endif	// _WIN32
+	if ('\0' == ptContext->szControlPath[0])
+	{
+		return;
+	}
+
+	// Take everything up to the file name, or the working directory
+	for (cchIndex = 0; '\0' != ptContext->szControlPath[cchIndex]; cchIndex++)
+	{
+#ifdef _WIN32
+		if (('\\' == ptContext->szControlPath[cchIndex]) || ('/' == ptContext->szControlPath[cchIndex]))
+#else	// _WIN32
+		if ('/' == ptContext->szControlPath[cchIndex])
+#endif	// _WIN32
+		{
+			cchDirectory = cchIndex + 1;
+		}
+	}
+	if (0 == cchDirectory)
+	{
+		szDirectory[0] = '.';
+	}
+	else
+	{
+		RtlCopyMemory(szDirectory, ptContext->szControlPath, cchDirectory);
+	}
+
+#ifdef _WIN32
+	ptContext->hControlChange = FindFirstChangeNotificationA(szDirectory,
+		FALSE,
+		FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE);
+	if (INVALID_HANDLE_VALUE == ptContext->hControlChange)
+	{
+		ptContext->hControlChange = NULL;
+	}
+#else	// _WIN32
+	ptContext->nControlNotify = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	if ((0 <= ptContext->nControlNotify) &&
+		(0 > inotify_add_watch(ptContext->nControlNotify,
+			szDirectory,
+			IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)))
+	{
+		CLOSE_FD(ptContext->nControlNotify);
+	}
+#endif	// _WIN32
+}
+
+/********************************************************************************
+*  Function:	log_IsDrained													*
+*  Purpose:		Checks whether every ring is empty.								*
+*  Parameters:	@ ptContext ~[inout]~ The module context.						*
+*  Returns:		TRUE if they are.												*
+*  Remarks:		* Flusher only.													*
+********************************************************************************/
+static
+BOOL
+log_IsDrained(
+	__inout PLOG_CONTEXT ptContext
+)
+{
+	PLOG_RING ptRing = NULL;
+	PVOID pvRecords = NULL;
+	LONG nRing = 0;
+	LONG nRings = MIN(ATOMIC_LOAD_ACQUIRE(&(ptContext->nRings)), LOG_MAX_THREADS);
+
+	for (nRing = 0; nRing < nRings; nRing++)
+	{
+		ptRing = (PLOG_RING)ATOMIC_LOAD_ACQUIRE_POINTER(&(ptContext->aptRings[nRing]));
+		if ((NULL != ptRing) && (0 != SPSCQUEUE_Peek(&(ptRing->tQueue), &pvRecords)))
+		{
+			return FALSE;
+		}
+	}
+
+	// Return result
+	return TRUE;
+}
+
+/********************************************************************************
+*  Function:	log_Sleep														*
+*  Purpose:		Waits for the next pass: LOG_FLUSH_INTERVAL_MS while records	*
+*				come, or until woken once the rings are drained.				*
+*  Parameters:	@ ptContext ~[inout]~ The module context.						*
+*				@ bMaySleep ~[in]~ Whether the last pass found no records.		*
+*					Records that keep coming are batched every interval			*
+*					rather than each waking the flusher.						*
+*  Remarks:		* Flusher only.													*
+*				* Raising the flag, then checking the rings, pairs with			*
+*					LOG_Write publishing a record, then checking the flag: one	*
+*					of them sees the other, so no record sleeps in a ring.		*
+*				* Also wakes when the control file's directory changes.			*
+********************************************************************************/
+static
+VOID
+log_Sleep(
+	__inout PLOG_CONTEXT ptContext,
+	__in BOOL bMaySleep
+)
+{
+	BOOL bShouldSleep = FALSE;
+#ifdef _WIN32
+	HANDLE ahWaits[2] = { NULL };
+#else	// _WIN32
+	struct pollfd atFds[2] = { { 0 } };
+	union
+	{
+		struct inotify_event tEvent;
+		CHAR acBytes[LOG_NOTIFY_BUFFER_SIZE];
+	} uBuffer;
+	eventfd_t qwValue = 0;
+#endif	// _WIN32
+
+	// Sleep until woken if drained, unless the control file must be polled
+#ifdef _WIN32
+	bMaySleep = bMaySleep && (('\0' == ptContext->szControlPath[0]) || (NULL != ptContext->hControlChange));
+#else	// _WIN32
+	bMaySleep = bMaySleep && (('\0' == ptContext->szControlPath[0]) || (0 <= ptContext->nControlNotify));
+#endif	// _WIN32
+	if (bMaySleep)
+	{
+		ATOMIC_STORE_RELEASE(&(ptContext->nIsFlusherIdle), TRUE);
+		ATOMIC_FULL_BARRIER();
+		bShouldSleep = log_IsDrained(ptContext);
+		if (!bShouldSleep)
+		{
+			ATOMIC_STORE_RELEASE(&(ptContext->nIsFlusherIdle), FALSE);
+		}
+	}
+
+#ifdef _WIN32
+	ahWaits[0] = ptContext->hWakeup;
+	ahWaits[1] = ptContext->hControlChange;
+	if ((WAIT_OBJECT_0 + 1) == WaitForMultipleObjects((NULL != ahWaits[1]) ? 2 : 1,
+		ahWaits,
+		FALSE,
+		bShouldSleep ? INFINITE : LOG_FLUSH_INTERVAL_MS))
+	{
+		if (!FindNextChangeNotification(ptContext->hControlChange))
+		{
+			CLOSE(ptContext->hControlChange, FindCloseChangeNotification);
+		}
+	}
+#else	// _WIN32
+	atFds[0].fd = ptContext->nWakeup;
+	atFds[0].events = POLLIN;
+	atFds[1].fd = ptContext->nControlNotify;
+	atFds[1].events = POLLIN;
+	if (0 < poll(atFds, sizeof(atFds) / sizeof(atFds[0]), bShouldSleep ? -1 : LOG_FLUSH_INTERVAL_MS))
+	{
+		if (0 != atFds[0].revents)
+		{
+			(VOID)eventfd_read(ptContext->nWakeup, &qwValue);
+		}
+
+		// The next pass stats the control file, the events themselves do not matter
+		while ((0 != atFds[1].revents) && (0 < read(ptContext->nControlNotify, &uBuffer, sizeof(uBuffer))))
+		{
+		}
+	}
+#endif	// _WIN32
+	ATOMIC_STORE_RELEASE(&(ptContext->nIsFlusherIdle), FALSE);
+}
+
+/********************************************************************************
+*  Function:	log_FlusherThread												*
+*  Purpose:		Writes batches every LOG_FLUSH_INTERVAL_MS while records		*
+*				come, or when woken.											*
+*  Parameters:	@ pvContext ~[inout]~ The module context.						*
+*  Returns:		0.																*
+********************************************************************************/
+static
+UINT
+WINAPI
+log_FlusherThread(
+	__inout_opt PVOID pvContext
+)
+{
+	PLOG_CONTEXT ptContext = (PLOG_CONTEXT)pvContext;
+	BOOL bHadRecords = FALSE;
+#ifndef _WIN32
+	sigset_t tSignals;
+
+	// Leave signals to the threads that wait for them
+	(VOID)sigfillset(&tSignals);
+	(VOID)pthread_sigmask(SIG_BLOCK, &tSignals, NULL);
+#endif	// _WIN32
+
+	// Off the caller's startup path
+	log_OpenFile(ptContext);
+	log_WatchControl(ptContext);
+	while (!ATOMIC_LOAD_ACQUIRE(&(ptContext->nIsStopping)))
+	{
+		log_Sleep(ptContext, !bHadRecords);
+		bHadRecords = log_FlushPass(ptContext);
+	}
+
+	// Free resources
+#ifdef _WIN32
+	CLOSE(ptContext->hControlChange, FindCloseChangeNotification);
+#else	// _WIN32
+	CLOSE_FD(ptContext->nControlNotify);
+#endif	// _WIN32
+
+	// Return result
+	return 0;
+}
+
+/********************************************************************************
+*  Function:	LOG_Start														*
+********************************************************************************/
+RETSTATUS
+LOG_Start(
+	__in_z PCSTR pszPath,
+	__in LOG_SEV eMinSeverity,
+	__in_z_opt PCSTR pszControlPath
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+
+	// Validations (logging is not up yet, DEBUG_MSG would be dropped)
+	ASSERT(NULL != pszPath);
+	ASSERT(NULL == g_tContext.hFlusher);
+
+	g_tContext.eMinSeverity = eMinSeverity;
+#ifndef _WIN32
+	g_tContext.nWakeup = -1;
+#endif	// _WIN32
+	if ((sizeof(g_tContext.szPath) <= (SIZE_T)snprintf(g_tContext.szPath, sizeof(g_tContext.szPath), "%s", pszPath)) ||
+		(sizeof(g_tContext.szControlPath) <= (SIZE_T)snprintf(g_tContext.szControlPath,
+			sizeof(g_tContext.szControlPath),
+			"%s",
+			(NULL != pszControlPath) ? pszControlPath : "")))
+	{
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Create the wakeup object
+#ifdef _WIN32
+	g_tContext.hWakeup = CreateEventW(NULL, FALSE, FALSE, NULL);
+	if (NULL == g_tContext.hWakeup)
+#else	// _WIN32
+	g_tContext.nWakeup = eventfd(0, EFD_CLOEXEC);
+	if (0 > g_tContext.nWakeup)
+#endif	// _WIN32
+	{
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Start the flusher
+	g_tContext.hFlusher = BEGIN_THREAD(log_FlusherThread, &g_tContext, 0);
+	if (NULL == g_tContext.hFlusher)
+	{
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Accept records
+	ATOMIC_STORE_RELEASE(&(g_tContext.nIsRunning), TRUE);
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	if (RETSTATUS_FAILED(eStatus))
+	{
+#ifdef _WIN32
+		CLOSE_HANDLE(g_tContext.hWakeup);
+#else	// _WIN32
+		CLOSE_FD(g_tContext.nWakeup);
+#endif	// _WIN32
+	}
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	LOG_Flush														*
+********************************************************************************/
+VOID
+LOG_Flush(VOID)
+{
+	LONG nPasses = 0;
+
+	if (!ATOMIC_LOAD_ACQUIRE(&(g_tContext.nIsRunning)))
+	{
+		return;
+	}
+
+	// The pass in progress may have missed our records, wait for the next one
+	nPasses = ATOMIC_LOAD_ACQUIRE(&(g_tContext.nPasses));
+	log_Wake(&g_tContext);
+	while (2 > (ATOMIC_LOAD_ACQUIRE(&(g_tContext.nPasses)) - nPasses))
+	{
+#ifdef _WIN32
+		(VOID)SwitchToThread();
+#else	// _WIN32
+		(VOID)sched_yield();
+#endif	// _WIN32
+		if (1 == (ATOMIC_LOAD_ACQUIRE(&(g_tContext.nPasses)) - nPasses))
+		{
+			log_Wake(&g_tContext);
+		}
+	}
+}
+
+/********************************************************************************
+*  Function:	LOG_Stop														*
+********************************************************************************/
+VOID
+LOG_Stop(VOID)
+{
+	PLOG_RING ptRing = NULL;
+	LONG nRing = 0;
+
+	if (!ATOMIC_LOAD_ACQUIRE(&(g_tContext.nIsRunning)))
+	{
+		return;
+	}
+
+	// Stop accepting, then stop the flusher
+	ATOMIC_STORE_RELEASE(&(g_tContext.nIsRunning), FALSE);
+	ATOMIC_STORE_RELEASE(&(g_tContext.nIsStopping), TRUE);
+	log_Wake(&g_tContext);
+	JOIN_THREAD(g_tContext.hFlusher);
+
+	// The flusher is gone, write what is left on this thread
+	(VOID)log_FlushPass(&g_tContext);
+
+	// Free resources
+	for (nRing = 0; nRing < MIN(g_tContext.nRings, LOG_MAX_THREADS); nRing++)
+	{
+		ptRing = g_tContext.aptRings[nRing];
+		if (NULL != ptRing)
+		{
+			SPSCQUEUE_Destroy(&(ptRing->tQueue));
+			FREE(ptRing);
+			g_tContext.aptRings[nRing] = NULL;
+		}
+	}
+#ifdef _WIN32
+	CLOSE_HANDLE(g_tContext.hWakeup);
+#else	// _WIN32
+	CLOSE_FD(g_tContext.nWakeup);
+#endif	// _WIN32
+	CLOSE(g_tContext.ptFile, fclose);
+}
+#endif	// _BINARY_LOG
@@ -0,0 +1,216 @@
+/********************************************************************************
+*  File:		BinaryLog.h														*
+*  Purpose:		Asynchronous binary logging backend for DEBUG_MSG.				*
+*  Remarks:		* Enabled by defining _BINARY_LOG. Each call site formats		*
+*					nothing: it copies its raw arguments into a fixed-size		*
+*					record on a per-thread ring, and a flusher thread writes	*
+*					batches to a file. Decode with antiduck-logdecode.			*
+*				* Call sites are enabled or disabled one by one while running,	*
+*					through a control file (see LOG_CONTROL_DEFAULT_PATH).		*
+********************************************************************************/
+#pragma once
+
+
+/** Includes *******************************************************************/
+#include <Utilities.h>
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	LOG_DEFAULT_PATH												*
+*  Purpose:		The default log file, in the working directory.					*
+********************************************************************************/
+#define LOG_DEFAULT_PATH ("AntiDuck.adlog")
+
+/********************************************************************************
+*  Constant:	LOG_CONTROL_DEFAULT_PATH										*
+*  Purpose:		The default control file, in the working directory: which		*
+*				call sites to log, beyond those LOG_Start's severity admits.	*
+*  Remarks:		* One rule per line, "+" (log) or "-" (skip) then a selector:	*
+*					"*" for every site, a function name ("USBNOTIFIER_Loop"),	*
+*					a prefix ending with "*" ("usbnotifier_*" for a module,		*
+*					whatever the case) or a single site ("USBNOTIFIER_Loop:681",	*
+*					by source line).											*
+*				* Rules apply in order over the severity, later rules win.		*
+*					Empty lines and lines that start with '#' are skipped.		*
+*				* The flusher picks up changes (by modification time, size		*
+*					and inode) as the file's directory reports them, or within	*
+*					LOG_FLUSH_INTERVAL_MS if it cannot be watched. Removing the	*
+*					file restores the severity alone.							*
+********************************************************************************/
+#define LOG_CONTROL_DEFAULT_PATH ("AntiDuck.tracepoints")
+
+/********************************************************************************
+*  Constant:	LOG_MAX_CONTROL_RULES											*
+*  Purpose:		Maximum number of control file rules (later rules are			*
+*				ignored).														*
+********************************************************************************/
+#define LOG_MAX_CONTROL_RULES (64)
+
+/********************************************************************************
+*  Constant:	LOG_CONTROL_SELECTOR_CHARS										*
+*  Purpose:		Maximal length of a control rule's selector, including the		*
+*				NUL (longer rules are ignored).									*
+********************************************************************************/
+#define LOG_CONTROL_SELECTOR_CHARS (96)
+
+/********************************************************************************
+*  Constant:	LOG_FILE_MAGIC													*
+*  Purpose:		The log file signature (8 characters).							*
+********************************************************************************/
+#define LOG_FILE_MAGIC ("ADBLOG01")
+
+/********************************************************************************
+*  Constant:	LOG_RECORD_SIZE													*
+*  Purpose:		The size of a ring record, in bytes.							*
+********************************************************************************/
+#define LOG_RECORD_SIZE (128)
+
+/********************************************************************************
+*  Constant:	LOG_RING_CAPACITY												*
+*  Purpose:		The number of records a thread can log ahead of the flusher		*
+*				before dropping.												*
+********************************************************************************/
+#define LOG_RING_CAPACITY (1024)
+
+/********************************************************************************
+*  Constant:	LOG_MAX_THREADS													*
+*  Purpose:		Maximum number of logging threads (later threads are dropped).	*
+********************************************************************************/
+#define LOG_MAX_THREADS (64)
+
+/********************************************************************************
+*  Constant:	LOG_MAX_SITES													*
+*  Purpose:		Maximum number of call sites (later sites are dropped).			*
+********************************************************************************/
+#define LOG_MAX_SITES (4096)
+
+/********************************************************************************
+*  Constant:	LOG_FLUSH_INTERVAL_MS											*
+*  Purpose:		How often the flusher writes batches to the file.				*
+*  Remarks:		* Only while records come: once the rings are empty, the		*
+*					flusher sleeps until the next record.						*
+********************************************************************************/
+#define LOG_FLUSH_INTERVAL_MS (100)
+
+/********************************************************************************
+*  Constant:	LOG_ARGS_UNSUPPORTED											*
+*  Purpose:		LOG_SITE.cArgs of a format the backend cannot capture (such		*
+*				as '*' widths). Such sites are logged without arguments.		*
+********************************************************************************/
+#define LOG_ARGS_UNSUPPORTED (0xFF)
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Enum:		LOG_ARG_TYPE													*
+*  Purpose:		How a format argument is read and stored.						*
+********************************************************************************/
+typedef enum
+{
+	LOG_ARG_TYPE_INT,								// int (and promoted types), 4 bytes
+	LOG_ARG_TYPE_LONG,								// long, 8 bytes
+	LOG_ARG_TYPE_LONGLONG,							// long long, 8 bytes
+	LOG_ARG_TYPE_SIZE,								// size_t, 8 bytes
+	LOG_ARG_TYPE_POINTER,							// void *, 8 bytes
+	LOG_ARG_TYPE_DOUBLE,							// double, 8 bytes
+	LOG_ARG_TYPE_STRING,							// char *, 2 bytes length and the characters
+	LOG_ARG_TYPE_NONE								// Literal text or %%
+} LOG_ARG_TYPE, *PLOG_ARG_TYPE;
+
+/********************************************************************************
+*  Enum:		LOG_CHUNK														*
+*  Purpose:		The tag (first byte) of a log file chunk.						*
+*  Remarks:		* All fields are in native byte order, without padding.			*
+********************************************************************************/
+typedef enum
+{
+	LOG_CHUNK_SITE = 1,								// DWORD id, BYTE severity, WORD function and
+													// format lengths, then both strings
+	LOG_CHUNK_RECORD,								// LOG_RECORD header, then cbArgs bytes
+	LOG_CHUNK_DROPS									// WORD thread, ULONGLONG drops so far
+} LOG_CHUNK, *PLOG_CHUNK;
+
+/********************************************************************************
+*  Structure:	LOG_RECORD_HEADER												*
+*  Purpose:		The fixed part of a record.										*
+********************************************************************************/
+typedef struct _LOG_RECORD_HEADER
+{
+	ULONGLONG qwTimestamp;							// CLOCK_GetTimestamp
+	DWORD dwSiteId;									// LOG_SITE.nId
+	WORD wThread;									// Logging thread index
+	WORD cbArgs;									// Size of the encoded arguments
+} LOG_RECORD_HEADER, *PLOG_RECORD_HEADER;
+
+/********************************************************************************
+*  Structure:	LOG_RECORD														*
+*  Purpose:		A ring record.													*
+*  Remarks:		* Arguments are encoded in order, as per LOG_ARG_TYPE. Strings	*
+*					are truncated to fit, later arguments are then dropped.		*
+********************************************************************************/
+typedef struct _LOG_RECORD
+{
+	LOG_RECORD_HEADER tHeader;						// Fixed part
+	BYTE abArgs[LOG_RECORD_SIZE - sizeof(LOG_RECORD_HEADER)];	// Encoded arguments
+} LOG_RECORD, *PLOG_RECORD;
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	LOG_NextConversion												*
+*  Purpose:		Finds the next conversion in a printf format.					*
+*  Parameters:	@ pszFormat ~[in]~ The format (from the current position).		*
+*				@ ppszNext ~[out]~ Gets the position after the conversion.		*
+*				@ peType ~[out]~ Gets the conversion's argument type.			*
+*  Returns:		The conversion ('%' character), or NULL at the end.				*
+*  Remarks:		* Returns an unsupported conversion with *peType set to			*
+*					LOG_ARG_TYPE_NONE and *ppszNext set to NULL.				*
+********************************************************************************/
+PCSTR
+LOG_NextConversion(
+	__in_z PCSTR pszFormat,
+	__out PCSTR *ppszNext,
+	__out PLOG_ARG_TYPE peType
+);
+
+#ifdef _BINARY_LOG
+/********************************************************************************
+*  Function:	LOG_Start														*
+*  Purpose:		Starts the flusher, which opens the log file.					*
+*  Parameters:	@ pszPath ~[in]~ The log file (truncated).						*
+*				@ eMinSeverity ~[in]~ Less severe call sites are skipped,		*
+*				unless the control file enables them.							*
+*				@ pszControlPath ~[in_opt]~ The control file (see				*
+*				LOG_CONTROL_DEFAULT_PATH), which need not exist, or NULL.		*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Records written before starting are dropped.					*
+*				* Only call once per process.									*
+*				* The file is opened on the flusher, so that starting does		*
+*					no file I/O. If it cannot be opened, records are dropped.	*
+********************************************************************************/
+RETSTATUS
+LOG_Start(
+	__in_z PCSTR pszPath,
+	__in LOG_SEV eMinSeverity,
+	__in_z_opt PCSTR pszControlPath
+);
+
+/********************************************************************************
+*  Function:	LOG_Flush														*
+*  Purpose:		Waits until everything logged so far is in the file.			*
+********************************************************************************/
+VOID
+LOG_Flush(VOID);
+
+/********************************************************************************
+*  Function:	LOG_Stop														*
+*  Purpose:		Flushes, stops the flusher and closes the log file.				*
+*  Remarks:		* No other thread may be logging.								*
+********************************************************************************/
+VOID
+LOG_Stop(VOID);
+#endif	// _BINARY_LOG
@@ -0,0 +1,446 @@
+/********************************************************************************
+*  File:		LogDecode.c														*
+*  Purpose:		Offline decoder for binary log files (see Log/BinaryLog.h).		*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#include <Utilities.h>
+#include "../Log/BinaryLog.h"
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Structure:	LOGDECODE_CURSOR												*
+*  Purpose:		A bounded read position in the loaded file.						*
+********************************************************************************/
+typedef struct _LOGDECODE_CURSOR
+{
+	const BYTE *pbCurrent;							// Next byte to read
+	const BYTE *pbEnd;								// End of the file
+} LOGDECODE_CURSOR, *PLOGDECODE_CURSOR;
+
+/********************************************************************************
+*  Structure:	LOGDECODE_SITE													*
+*  Purpose:		A call site definition.											*
+********************************************************************************/
+typedef struct _LOGDECODE_SITE
+{
+	BYTE bSeverity;									// LOG_SEV
+	PSTR pszFunction;								// Calling function
+	PSTR pszFormat;									// printf format
+} LOGDECODE_SITE, *PLOGDECODE_SITE;
+
+
+/** Globals ********************************************************************/
+
+/********************************************************************************
+*  Global:		g_atSites														*
+*  Purpose:		Call site definitions, by ID - 1.								*
+********************************************************************************/
+static
+LOGDECODE_SITE
+g_atSites[LOG_MAX_SITES] = { { 0 } };
+
+/********************************************************************************
+*  Global:		g_apszSeverities												*
+*  Purpose:		Severity names, by LOG_SEV.										*
+********************************************************************************/
+static
+const PCSTR
+g_apszSeverities[] = { "TRACE", "INFO", "ERROR", "CRITICAL" };
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	logdecode_Read													*
+*  Purpose:		Reads bytes from the file.										*
+*  Parameters:	@ ptCursor ~[inout]~ The position.								*
+*				@ pvData ~[out]~ Gets the bytes (NULL to skip them).			*
+*				@ cbData ~[in]~ The number of bytes.							*
+*  Returns:		FALSE if the file ends first.									*
+********************************************************************************/
+static
+BOOL
+logdecode_Read(
+	__inout PLOGDECODE_CURSOR ptCursor,
+	__out_bcount_opt(cbData) PVOID pvData,
+	__in SIZE_T cbData
+)
+{
+	if ((SIZE_T)(ptCursor->pbEnd - ptCursor->pbCurrent) < cbData)
+	{
+		return FALSE;
+	}
+	if (NULL != pvData)
+	{
+		RtlCopyMemory(pvData, ptCursor->pbCurrent, cbData);
+	}
+	ptCursor->pbCurrent += cbData;
+	return TRUE;
+}
+
+/********************************************************************************
+*  Function:	logdecode_ReadString											*
+*  Purpose:		Reads a string into a new NUL-terminated buffer.				*
+*  Parameters:	@ ptCursor ~[inout]~ The position.								*
+*				@ cchString ~[in]~ The string length.							*
+*  Returns:		The string (free with FREE), or NULL on failure.				*
+********************************************************************************/
+static
+PSTR
+logdecode_ReadString(
+	__inout PLOGDECODE_CURSOR ptCursor,
+	__in WORD cchString
+)
+{
+	PSTR pszString = (PSTR)ALLOCZ((SIZE_T)cchString + 1);
+
+	if ((NULL != pszString) && (!logdecode_Read(ptCursor, pszString, cchString)))
+	{
+		FREE(pszString);
+	}
+	return pszString;
+}
+
+/********************************************************************************
+*  Function:	logdecode_PrintMessage											*
+*  Purpose:		Prints a record's message from its site's format and its raw	*
+*				arguments.														*
+*  Parameters:	@ ptSite ~[in]~ The call site.									*
+*				@ ptArgs ~[inout]~ The encoded arguments.						*
+********************************************************************************/
+static
+VOID
+logdecode_PrintMessage(
+	__in PLOGDECODE_SITE ptSite,
+	__inout PLOGDECODE_CURSOR ptArgs
+)
+{
+	PCSTR pszCurrent = ptSite->pszFormat;
+	PCSTR pszConversion = NULL;
+	PCSTR pszNext = NULL;
+	LOG_ARG_TYPE eType = LOG_ARG_TYPE_NONE;
+	CHAR szSpec[32] = { 0 };
+	CHAR szString[LOG_RECORD_SIZE] = { 0 };
+	INT nValue = 0;
+	LONGLONG llValue = 0;
+	double dValue = 0;
+	WORD cchValue = 0;
+	BOOL bIsRead = FALSE;
+
+	for (;;)
+	{
+		// Literal text up to the next conversion
+		pszConversion = LOG_NextConversion(pszCurrent, &pszNext, &eType);
+		if (NULL == pszConversion)
+		{
+			(VOID)fputs(pszCurrent, stdout);
+			break;
+		}
+		(VOID)fwrite(pszCurrent, 1, (SIZE_T)(pszConversion - pszCurrent), stdout);
+		if ((NULL == pszNext) || ((SIZE_T)(pszNext - pszConversion) >= sizeof(szSpec)))
+		{
+			// Unsupported, the arguments were not captured
+			(VOID)fputs(pszConversion, stdout);
+			break;
+		}
+		RtlCopyMemory(szSpec, pszConversion, (SIZE_T)(pszNext - pszConversion));
+		szSpec[pszNext - pszConversion] = '\0';
+		pszCurrent = pszNext;
+
+		// Read the argument, and print it with the original conversion
+		switch (eType)
+		{
+		case LOG_ARG_TYPE_NONE:
+			(VOID)fputc('%', stdout);
+			continue;
+
+		case LOG_ARG_TYPE_INT:
+			bIsRead = logdecode_Read(ptArgs, &nValue, sizeof(nValue));
+			break;
+
+		case LOG_ARG_TYPE_STRING:
+			bIsRead = logdecode_Read(ptArgs, &cchValue, sizeof(cchValue)) &&
+				(cchValue < sizeof(szString)) &&
+				logdecode_Read(ptArgs, szString, cchValue);
+			szString[bIsRead ? cchValue : 0] = '\0';
+			break;
+
+		default:
+			bIsRead = logdecode_Read(ptArgs, &llValue, sizeof(llValue));
+			RtlCopyMemory(&dValue, &llValue, sizeof(dValue));
+			break;
+		}
+		if (!bIsRead)
+		{
+			(VOID)fputs("<truncated>", stdout);
+			continue;
+		}
+		switch (eType)
+		{
+		case LOG_ARG_TYPE_INT:
+			(VOID)printf(szSpec, nValue);
+			break;
+
+		case LOG_ARG_TYPE_LONG:
+			(VOID)printf(szSpec, (long)llValue);
+			break;
+
+		case LOG_ARG_TYPE_SIZE:
+			(VOID)printf(szSpec, (SIZE_T)llValue);
+			break;
+
+		case LOG_ARG_TYPE_POINTER:
+			(VOID)printf(szSpec, (PVOID)(SIZE_T)llValue);
+			break;
+
+		case LOG_ARG_TYPE_DOUBLE:
+			(VOID)printf(szSpec, dValue);
+			break;
+
+		case LOG_ARG_TYPE_STRING:
+			(VOID)printf(szSpec, szString);
+			break;
+
+		default:
+			(VOID)printf(szSpec, llValue);
+			break;
+		}
+	}
+}
+
+/********************************************************************************
+*  Function:	logdecode_LoadSites												*
+*  Purpose:		Loads every call site definition (sites may be defined after	*
+*				their first records).											*
+*  Parameters:	@ tCursor ~[in]~ The position after the file header.			*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+logdecode_LoadSites(
+	__in LOGDECODE_CURSOR tCursor
+)
+{
+	BYTE bTag = 0;
+	DWORD dwId = 0;
+	BYTE bSeverity = 0;
+	WORD cchFunction = 0;
+	WORD cchFormat = 0;
+	LOG_RECORD_HEADER tHeader = { 0 };
+	PLOGDECODE_SITE ptSite = NULL;
+
+	while (logdecode_Read(&tCursor, &bTag, sizeof(bTag)))
+	{
+		switch (bTag)
+		{
+		case LOG_CHUNK_SITE:
+			if ((!logdecode_Read(&tCursor, &dwId, sizeof(dwId))) ||
+				(!logdecode_Read(&tCursor, &bSeverity, sizeof(bSeverity))) ||
+				(!logdecode_Read(&tCursor, &cchFunction, sizeof(cchFunction))) ||
+				(!logdecode_Read(&tCursor, &cchFormat, sizeof(cchFormat))) ||
+				(0 == dwId) || (LOG_MAX_SITES < dwId))
+			{
+				return DEBUG_GEN_FAIL_STATUS();
+			}
+			ptSite = &(g_atSites[dwId - 1]);
+			ptSite->bSeverity = bSeverity;
+			ptSite->pszFunction = logdecode_ReadString(&tCursor, cchFunction);
+			ptSite->pszFormat = logdecode_ReadString(&tCursor, cchFormat);
+			if ((NULL == ptSite->pszFunction) || (NULL == ptSite->pszFormat))
+			{
+				return DEBUG_GEN_FAIL_STATUS();
+			}
+			break;
+
+		case LOG_CHUNK_RECORD:
+			if ((!logdecode_Read(&tCursor, &tHeader, sizeof(tHeader))) ||
+				(!logdecode_Read(&tCursor, NULL, tHeader.cbArgs)))
+			{
+				return DEBUG_GEN_FAIL_STATUS();
+			}
+			break;
+
+		case LOG_CHUNK_DROPS:
+			if (!logdecode_Read(&tCursor, NULL, sizeof(WORD) + sizeof(ULONGLONG)))
+			{
+				return DEBUG_GEN_FAIL_STATUS();
+			}
+			break;
+
+		default:
+			return DEBUG_GEN_FAIL_STATUS();
+		}
+	}
+
+	// Success
+	return RETSTATUS_SUCCESS;
+}
+
+/********************************************************************************
+*  Function:	logdecode_PrintRecords											*
+*  Purpose:		Prints every record and drop report, in file order.				*
+*  Parameters:	@ tCursor ~[in]~ The position after the file header.			*
+*				@ qwAnchorTimestamp ~[in]~ The header's clock anchor.			*
+*				@ qwAnchorUnixTime ~[in]~ The header's wall clock anchor.		*
+*  Remarks:		* Records are ordered per thread, not across threads.			*
+********************************************************************************/
+static
+VOID
+logdecode_PrintRecords(
+	__in LOGDECODE_CURSOR tCursor,
+	__in ULONGLONG qwAnchorTimestamp,
+	__in ULONGLONG qwAnchorUnixTime
+)
+{
+	BYTE bTag = 0;
+	LOG_RECORD_HEADER tHeader = { 0 };
+	LOGDECODE_CURSOR tArgs = { 0 };
+	PLOGDECODE_SITE ptSite = NULL;
+	WORD wThread = 0;
+	WORD cchFunction = 0;
+	WORD cchFormat = 0;
+	ULONGLONG qwDropped = 0;
+	ULONGLONG qwElapsedNs = 0;
+
+	while (logdecode_Read(&tCursor, &bTag, sizeof(bTag)))
+	{
+		// Sites are already loaded
+		if (LOG_CHUNK_SITE == bTag)
+		{
+			if ((!logdecode_Read(&tCursor, NULL, sizeof(DWORD) + sizeof(BYTE))) ||
+				(!logdecode_Read(&tCursor, &cchFunction, sizeof(cchFunction))) ||
+				(!logdecode_Read(&tCursor, &cchFormat, sizeof(cchFormat))) ||
+				(!logdecode_Read(&tCursor, NULL, (SIZE_T)cchFunction + cchFormat)))
+			{
+				break;
+			}
+			continue;
+		}
+		if (LOG_CHUNK_DROPS == bTag)
+		{
+			if ((!logdecode_Read(&tCursor, &wThread, sizeof(wThread))) ||
+				(!logdecode_Read(&tCursor, &qwDropped, sizeof(qwDropped))))
+			{
+				break;
+			}
+			(VOID)printf("[T%u] %llu records dropped so far\n", (unsigned)wThread, qwDropped);
+			continue;
+		}
+
+		// A record
+		if ((LOG_CHUNK_RECORD != bTag) || (!logdecode_Read(&tCursor, &tHeader, sizeof(tHeader))))
+		{
+			break;
+		}
+		tArgs.pbCurrent = tCursor.pbCurrent;
+		if (!logdecode_Read(&tCursor, NULL, tHeader.cbArgs))
+		{
+			break;
+		}
+		tArgs.pbEnd = tCursor.pbCurrent;
+		qwElapsedNs = (tHeader.qwTimestamp > qwAnchorTimestamp) ? (tHeader.qwTimestamp - qwAnchorTimestamp) : 0;
+		(VOID)printf("%llu.%09llu [T%u] ",
+			qwAnchorUnixTime + (qwElapsedNs / 1000000000ULL),
+			qwElapsedNs % 1000000000ULL,
+			(unsigned)tHeader.wThread);
+		ptSite = ((0 != tHeader.dwSiteId) && (LOG_MAX_SITES >= tHeader.dwSiteId)) ? &(g_atSites[tHeader.dwSiteId - 1]) : NULL;
+		if ((NULL == ptSite) || (NULL == ptSite->pszFormat))
+		{
+			(VOID)printf("<unknown site %lu>\n", (unsigned long)tHeader.dwSiteId);
+			continue;
+		}
+		(VOID)printf("[%s] %s: ",
+			(ptSite->bSeverity < sizeof(g_apszSeverities) / sizeof(g_apszSeverities[0])) ? g_apszSeverities[ptSite->bSeverity] : "?",
+			ptSite->pszFunction);
+		logdecode_PrintMessage(ptSite, &tArgs);
+		(VOID)fputc('\n', stdout);
+	}
+}
+
+/********************************************************************************
+*  Function:	main															*
+*  Purpose:		Decodes a binary log file to stdout.							*
+*  Returns:		Zero on success.												*
+********************************************************************************/
+INT
+main(
+	__in INT nArgs,
+	__in_ecount(nArgs) PSTR* ppszArgs
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	FILE *ptFile = NULL;
+	PBYTE pbFile = NULL;
+	long cbFile = 0;
+	LOGDECODE_CURSOR tCursor = { 0 };
+	CHAR acMagic[8] = { 0 };
+	ULONGLONG qwAnchorTimestamp = 0;
+	ULONGLONG qwAnchorUnixTime = 0;
+	DWORD dwSite = 0;
+
+	// Validations
+	if (2 != nArgs)
+	{
+		(VOID)fprintf(stderr, "Usage: %s <log file>\n", ppszArgs[0]);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Load the whole file
+	ptFile = fopen(ppszArgs[1], "rb");
+	if ((NULL == ptFile) ||
+		(0 != fseek(ptFile, 0, SEEK_END)) ||
+		(0 > (cbFile = ftell(ptFile))) ||
+		(0 != fseek(ptFile, 0, SEEK_SET)))
+	{
+		(VOID)fprintf(stderr, "Cannot open %s.\n", ppszArgs[1]);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	pbFile = (PBYTE)ALLOCZ((SIZE_T)cbFile + 1);
+	if ((NULL == pbFile) || ((SIZE_T)cbFile != fread(pbFile, 1, (SIZE_T)cbFile, ptFile)))
+	{
+		(VOID)fprintf(stderr, "Cannot read %s.\n", ppszArgs[1]);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	tCursor.pbCurrent = pbFile;
+	tCursor.pbEnd = pbFile + cbFile;
+
+	// Header
+	if ((!logdecode_Read(&tCursor, acMagic, sizeof(acMagic))) ||
+		(0 != memcmp(acMagic, LOG_FILE_MAGIC, sizeof(acMagic))) ||
+		(!logdecode_Read(&tCursor, &qwAnchorTimestamp, sizeof(qwAnchorTimestamp))) ||
+		(!logdecode_Read(&tCursor, &qwAnchorUnixTime, sizeof(qwAnchorUnixTime))))
+	{
+		(VOID)fprintf(stderr, "%s is not a binary log file.\n", ppszArgs[1]);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Sites first, then the records
+	eStatus = logdecode_LoadSites(tCursor);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		(VOID)fprintf(stderr, "%s is corrupt or truncated, decoding what is readable.\n", ppszArgs[1]);
+	}
+	logdecode_PrintRecords(tCursor, qwAnchorTimestamp, qwAnchorUnixTime);
+
+lblCleanup:
+
+	// Free resources
+	for (dwSite = 0; dwSite < LOG_MAX_SITES; dwSite++)
+	{
+		FREE(g_atSites[dwSite].pszFunction);
+		FREE(g_atSites[dwSite].pszFormat);
+	}
+	FREE(pbFile);
+	CLOSE(ptFile, fclose);
+
+	// Return result
+	return RETSTATUS_FAILED(eStatus) ? 1 : 0;
+}
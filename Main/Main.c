@@ -5,32 +5,250 @@
 
 
 /** Includes *******************************************************************/
+#ifndef _WIN32
+#include <errno.h>
+#endif	// _WIN32
 #include <Utilities.h>
+#include <Clock.h>
+#include "../Agent/Agent.h"
+#include "../Bus/Bus.h"
+#include "../Log/BinaryLog.h"
 #include "../UsbNotifier/UsbNotifier.h"
 
 
 /** Functions ******************************************************************/
 
+/********************************************************************************
+*  Function:	main_Detach														*
+*  Purpose:		Detaches from the terminal or console, to run as a daemon.		*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* POSIX: forks (the parent exits), starts a new session and		*
+*					points stdin and stdout at /dev/null. The working			*
+*					directory stays, as the allowlist and policy are found		*
+*					there, and so does stderr, for the dumps.					*
+*				* Windows: frees the console, nothing else is ever shown.		*
+*				* Call before any thread starts.								*
+********************************************************************************/
+static
+RETSTATUS
+main_Detach(VOID)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+
+	DEBUG_ENTER();
+
+#ifdef _WIN32
+	if (!FreeConsole())
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"FreeConsole() failure (LastError=%lu).",
+			GetLastError());
+		goto lblCleanup;
+	}
+#else	// _WIN32
+	if (0 != daemon(1, 1))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"daemon() failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+	if ((NULL == freopen("/dev/null", "r", stdin)) || (NULL == freopen("/dev/null", "w", stdout)))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"freopen() failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+#endif	// _WIN32
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
 /********************************************************************************
 *  Function:	wmain															*
 *  Purpose:		Main routine.													*
+*  Remarks:		* Named main on POSIX builds.									*
+*				* Usage: antiduck [-d] [-s] [-b | -a] [-q] [-r <trace>]			*
+*					[-t <collector>] [-l <layout>]								*
+*				* "-d" runs as a daemon, detached from the terminal.			*
+*				* "-s" exits as soon as device events are listened to,			*
+*					writing the startup time and footprint to stdout.			*
+*				* "-r <trace>" records every device event into a trace file		*
+*					for replaying (see Replay/Replay.c).						*
+*				* "-b" (POSIX) publishes lock decisions on the bus instead of	*
+*					locking, for the session agents (see Bus/Bus.h).			*
+*				* "-a" (POSIX) runs as the calling session's agent: detects		*
+*					nothing, and locks the session on the decisions of the		*
+*					monitor run with "-b" in the same directory.				*
+*				* "-t <collector>" (POSIX) exports arrivals, verdicts and		*
+*					locks in batches to a UNIX-domain datagram socket (see		*
+*					Telemetry/Telemetry.h).										*
+*				* "-q" (POSIX) holds the keys of keyboards plugged while		*
+*					running until their cadence is judged, then replays or		*
+*					drops them (see Quarantine/Quarantine.h).					*
+*				* "-l <layout>" decodes typed text by a keyboard layout ("us",	*
+*					the default, "uk", "de", "fr" or "il") to match payload		*
+*					signatures (see Layout/Layout.h).							*
 ********************************************************************************/
+#ifdef _WIN32
 INT
 wmain(
 	__in INT nArgs, 
 	__in_ecount(nArgs) PWSTR* ppwszArgs
 )
+#else	// _WIN32
+INT
+main(
+	__in INT nArgs,
+	__in_ecount(nArgs) PSTR* ppszArgs
+)
+#endif	// _WIN32
 {
 	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	ULONGLONG qwStartTimestamp = CLOCK_GetTimestamp();
+	PCSTR pszTracePath = NULL;
+	PCSTR pszTelemetryPath = NULL;
+	BOOL bShouldDetach = FALSE;
+	BOOL bExitWhenArmed = FALSE;
+	BOOL bPublishToBus = FALSE;
+	BOOL bShouldQuarantine = FALSE;
+	LAYOUT_ID eLayout = LAYOUT_ID_US;
+	INT nArg = 0;
+#ifdef _WIN32
+	CHAR szTracePath[MAX_PATH] = { 0 };
+	CHAR szLayout[4] = { 0 };
+#else	// _WIN32
+	BOOL bIsAgent = FALSE;
+#endif	// _WIN32
 
 	DEBUG_ENTER();
 
-	// Unreferenced parameters
-	UNREFERENCED_PARAMETER(nArgs);
-	UNREFERENCED_PARAMETER(ppwszArgs);
+	// Parse the arguments
+	for (nArg = 1; nArg < nArgs; nArg++)
+	{
+#ifdef _WIN32
+		if (0 == wcscmp(ppwszArgs[nArg], L"-d"))
+		{
+			bShouldDetach = TRUE;
+		}
+		else if (0 == wcscmp(ppwszArgs[nArg], L"-s"))
+		{
+			bExitWhenArmed = TRUE;
+		}
+		else if ((0 == wcscmp(ppwszArgs[nArg], L"-r")) && (nArg + 1 < nArgs))
+		{
+			if (0 == WideCharToMultiByte(CP_ACP, 0, ppwszArgs[++nArg], -1, szTracePath, sizeof(szTracePath), NULL, NULL))
+			{
+				eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+					LOG_SEV_ERROR,
+					"WideCharToMultiByte() failure (LastError=%lu).",
+					GetLastError());
+				goto lblCleanup;
+			}
+			pszTracePath = szTracePath;
+		}
+		else if ((0 == wcscmp(ppwszArgs[nArg], L"-l")) && (nArg + 1 < nArgs) &&
+			(0 != WideCharToMultiByte(CP_ACP, 0, ppwszArgs[nArg + 1], -1, szLayout, sizeof(szLayout), NULL, NULL)) &&
+			(LAYOUT_Parse(szLayout, &eLayout)))
+		{
+			nArg++;
+		}
+		else
+		{
+			(VOID)fwprintf(stderr, L"Usage: %ls [-d] [-s] [-r <trace file>] [-l us|uk|de|fr|il]\n", ppwszArgs[0]);
+			eStatus = DEBUG_GEN_FAIL_STATUS();
+			goto lblCleanup;
+		}
+#else	// _WIN32
+		if (0 == strcmp(ppszArgs[nArg], "-d"))
+		{
+			bShouldDetach = TRUE;
+		}
+		else if (0 == strcmp(ppszArgs[nArg], "-s"))
+		{
+			bExitWhenArmed = TRUE;
+		}
+		else if (0 == strcmp(ppszArgs[nArg], "-b"))
+		{
+			bPublishToBus = TRUE;
+		}
+		else if (0 == strcmp(ppszArgs[nArg], "-a"))
+		{
+			bIsAgent = TRUE;
+		}
+		else if (0 == strcmp(ppszArgs[nArg], "-q"))
+		{
+			bShouldQuarantine = TRUE;
+		}
+		else if ((0 == strcmp(ppszArgs[nArg], "-r")) && (nArg + 1 < nArgs))
+		{
+			pszTracePath = ppszArgs[++nArg];
+		}
+		else if ((0 == strcmp(ppszArgs[nArg], "-t")) && (nArg + 1 < nArgs))
+		{
+			pszTelemetryPath = ppszArgs[++nArg];
+		}
+		else if ((0 == strcmp(ppszArgs[nArg], "-l")) && (nArg + 1 < nArgs) && (LAYOUT_Parse(ppszArgs[nArg + 1], &eLayout)))
+		{
+			nArg++;
+		}
+		else
+		{
+			(VOID)fprintf(stderr,
+				"Usage: %s [-d] [-s] [-b | -a] [-q] [-r <trace file>] [-t <collector socket>] [-l us|uk|de|fr|il]\n",
+				ppszArgs[0]);
+			eStatus = DEBUG_GEN_FAIL_STATUS();
+			goto lblCleanup;
+		}
+#endif	// _WIN32
+	}
+
+	// Detach first, while this is the only thread
+	if (bShouldDetach)
+	{
+		eStatus = main_Detach();
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			DEBUG_MSG(LOG_SEV_ERROR,
+				"main_Detach() failed (eStatus=0x%.8x).",
+				eStatus);
+			goto lblCleanup;
+		}
+	}
+
+#ifndef _WIN32
+	// Run as a session agent, if asked to (the monitor keeps the trail)
+	if (bIsAgent)
+	{
+		eStatus = AGENT_Run(BUS_DEFAULT_PATH, qwStartTimestamp, bExitWhenArmed);
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			DEBUG_MSG(LOG_SEV_ERROR,
+				"AGENT_Run() failed (eStatus=0x%.8x).",
+				eStatus);
+		}
+		goto lblCleanup;
+	}
+#endif	// _WIN32
+
+#ifdef _BINARY_LOG
+	// Keep a forensic trail (best-effort, the notifier runs without it)
+	(VOID)LOG_Start(LOG_DEFAULT_PATH, LOG_SEV_INFO, LOG_CONTROL_DEFAULT_PATH);
+#endif	// _BINARY_LOG
 
-	// Initialize the window class
-	eStatus = USBNOTIFIER_Loop();
+	// Run the notifier
+	eStatus = USBNOTIFIER_Loop(pszTracePath, qwStartTimestamp, bExitWhenArmed, bPublishToBus, pszTelemetryPath, bShouldQuarantine, eLayout);
 	if (RETSTATUS_FAILED(eStatus))
 	{
 		DEBUG_MSG(LOG_SEV_ERROR,
@@ -46,5 +264,8 @@ lblCleanup:
 
 	// Return result
 	DEBUG_LEAVE_STATUS(eStatus);
+#ifdef _BINARY_LOG
+	LOG_Stop();
+#endif	// _BINARY_LOG
 	return eStatus;
 }
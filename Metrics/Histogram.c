@@ -0,0 +1,99 @@
+/********************************************************************************
+*  File:		Histogram.c														*
+*  Purpose:		Log-bucketed (HDR-style) value histograms.						*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#include "Histogram.h"
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	HISTOGRAM_GetBucketLimit										*
+********************************************************************************/
+ULONGLONG
+HISTOGRAM_GetBucketLimit(
+	__in ULONG dwBucket
+)
+{
+	ULONG dwShift = 0;
+	ULONGLONG qwMantissa = 0;
+
+	// Small values are exact
+	if (dwBucket < (1UL << HISTOGRAM_SUB_BUCKET_BITS))
+	{
+		return dwBucket;
+	}
+
+	// Invert HISTOGRAM_GetBucket, the mantissa always has its top bit set
+	dwShift = (dwBucket >> (HISTOGRAM_SUB_BUCKET_BITS - 1)) - 1;
+	qwMantissa = dwBucket - (dwShift << (HISTOGRAM_SUB_BUCKET_BITS - 1));
+	return ((qwMantissa + 1) << dwShift) - 1;
+}
+
+/********************************************************************************
+*  Function:	HISTOGRAM_GetCount												*
+********************************************************************************/
+ULONGLONG
+HISTOGRAM_GetCount(
+	__in PCHISTOGRAM ptHistogram
+)
+{
+	ULONGLONG qwCount = 0;
+	ULONG dwBucket = 0;
+
+	// Validations
+	ASSERT(NULL != ptHistogram);
+
+	// Sum the buckets
+	for (dwBucket = 0; dwBucket < HISTOGRAM_BUCKETS; dwBucket++)
+	{
+		qwCount += ptHistogram->aqwCounts[dwBucket];
+	}
+
+	// Return result
+	return qwCount;
+}
+
+/********************************************************************************
+*  Function:	HISTOGRAM_GetQuantile											*
+********************************************************************************/
+ULONGLONG
+HISTOGRAM_GetQuantile(
+	__in PCHISTOGRAM ptHistogram,
+	__in ULONG dwQuantile
+)
+{
+	ULONGLONG qwCount = 0;
+	ULONGLONG qwRank = 0;
+	ULONGLONG qwSeen = 0;
+	ULONG dwBucket = 0;
+
+	// Validations
+	ASSERT(NULL != ptHistogram);
+	ASSERT(HISTOGRAM_QUANTILE_SCALE >= dwQuantile);
+
+	// The rank of the value, rounding up so the maximum is reachable
+	qwCount = HISTOGRAM_GetCount(ptHistogram);
+	if (0 == qwCount)
+	{
+		return 0;
+	}
+	qwRank = ((qwCount * dwQuantile) + HISTOGRAM_QUANTILE_SCALE - 1) / HISTOGRAM_QUANTILE_SCALE;
+	qwRank = MAX(qwRank, 1);
+
+	// Walk up to the bucket holding it
+	for (dwBucket = 0; dwBucket < HISTOGRAM_BUCKETS; dwBucket++)
+	{
+		qwSeen += ptHistogram->aqwCounts[dwBucket];
+		if (qwSeen >= qwRank)
+		{
+			return HISTOGRAM_GetBucketLimit(dwBucket);
+		}
+	}
+
+	// Counts grew while walking, settle for the last bucket seen
+	return HISTOGRAM_GetBucketLimit(HISTOGRAM_BUCKETS - 1);
+}
@@ -0,0 +1,156 @@
+/********************************************************************************
+*  File:		Histogram.h														*
+*  Purpose:		Log-bucketed (HDR-style) value histograms.						*
+********************************************************************************/
+#pragma once
+
+
+/** Includes *******************************************************************/
+#include <Utilities.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif	// _MSC_VER
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	HISTOGRAM_SUB_BUCKET_BITS										*
+*  Purpose:		Log2 of the number of linear sub-buckets per power of two.		*
+*  Remarks:		* Values are kept to within 1 / 2^(bits - 1), about 3%.			*
+********************************************************************************/
+#define HISTOGRAM_SUB_BUCKET_BITS (6)
+
+/********************************************************************************
+*  Constant:	HISTOGRAM_BUCKETS												*
+*  Purpose:		The number of buckets needed to cover every 64-bit value.		*
+********************************************************************************/
+#define HISTOGRAM_BUCKETS (((64 - HISTOGRAM_SUB_BUCKET_BITS + 1) << (HISTOGRAM_SUB_BUCKET_BITS - 1)) + \
+	(1 << (HISTOGRAM_SUB_BUCKET_BITS - 1)))
+
+/********************************************************************************
+*  Constant:	HISTOGRAM_QUANTILE_SCALE										*
+*  Purpose:		The scale of quantiles given to HISTOGRAM_GetQuantile (so		*
+*				99.9% is 99900).												*
+********************************************************************************/
+#define HISTOGRAM_QUANTILE_SCALE (100000)
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Structure:	HISTOGRAM														*
+*  Purpose:		Value counts in log-linear buckets.								*
+*  Remarks:		* Values below 2^HISTOGRAM_SUB_BUCKET_BITS get a bucket each,	*
+*					every later power of two is split into half as many			*
+*					linear sub-buckets.											*
+*				* Written by a single thread, may be read from any thread		*
+*					(counts may then be slightly stale).						*
+********************************************************************************/
+typedef struct _HISTOGRAM
+{
+	volatile ULONGLONG aqwCounts[HISTOGRAM_BUCKETS];	// Count per bucket
+} HISTOGRAM, *PHISTOGRAM;
+typedef const HISTOGRAM *PCHISTOGRAM;
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	HISTOGRAM_GetBucket												*
+*  Purpose:		Maps a value to its bucket.										*
+*  Parameters:	@ qwValue ~[in]~ The value.										*
+*  Returns:		The bucket index.												*
+*  Remarks:		* Defined as static and inline to be included in object files.	*
+********************************************************************************/
+static
+__inline
+ULONG
+HISTOGRAM_GetBucket(
+	__in ULONGLONG qwValue
+)
+{
+	ULONG dwHighestBit = 0;
+	ULONG dwShift = 0;
+
+	// Small values are exact
+	if (qwValue < (1ULL << HISTOGRAM_SUB_BUCKET_BITS))
+	{
+		return (ULONG)qwValue;
+	}
+
+	// Keep the top HISTOGRAM_SUB_BUCKET_BITS bits of larger values
+#if defined(_MSC_VER) && defined(_M_X64)
+	(VOID)_BitScanReverse64((unsigned long *)&dwHighestBit, qwValue);
+#elif defined(_MSC_VER)	// _MSC_VER && _M_X64
+	if (0 != (qwValue >> 32))
+	{
+		(VOID)_BitScanReverse((unsigned long *)&dwHighestBit, (ULONG)(qwValue >> 32));
+		dwHighestBit += 32;
+	}
+	else
+	{
+		(VOID)_BitScanReverse((unsigned long *)&dwHighestBit, (ULONG)qwValue);
+	}
+#else	// _MSC_VER
+	dwHighestBit = 63 - (ULONG)__builtin_clzll(qwValue);
+#endif	// _MSC_VER
+	dwShift = dwHighestBit - (HISTOGRAM_SUB_BUCKET_BITS - 1);
+	return (dwShift << (HISTOGRAM_SUB_BUCKET_BITS - 1)) + (ULONG)(qwValue >> dwShift);
+}
+
+/********************************************************************************
+*  Function:	HISTOGRAM_Record												*
+*  Purpose:		Counts a value.													*
+*  Parameters:	@ ptHistogram ~[inout]~ The histogram.							*
+*				@ qwValue ~[in]~ The value.										*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+*				* Defined as static and inline to be included in object files.	*
+********************************************************************************/
+static
+__inline
+VOID
+HISTOGRAM_Record(
+	__inout PHISTOGRAM ptHistogram,
+	__in ULONGLONG qwValue
+)
+{
+	ptHistogram->aqwCounts[HISTOGRAM_GetBucket(qwValue)]++;
+}
+
+/********************************************************************************
+*  Function:	HISTOGRAM_GetBucketLimit										*
+*  Purpose:		Gets the highest value that maps to a bucket.					*
+*  Parameters:	@ dwBucket ~[in]~ The bucket index.								*
+*  Returns:		The value.														*
+********************************************************************************/
+ULONGLONG
+HISTOGRAM_GetBucketLimit(
+	__in ULONG dwBucket
+);
+
+/********************************************************************************
+*  Function:	HISTOGRAM_GetCount												*
+*  Purpose:		Gets the number of recorded values.								*
+*  Parameters:	@ ptHistogram ~[in]~ The histogram.								*
+*  Returns:		The count.														*
+********************************************************************************/
+ULONGLONG
+HISTOGRAM_GetCount(
+	__in PCHISTOGRAM ptHistogram
+);
+
+/********************************************************************************
+*  Function:	HISTOGRAM_GetQuantile											*
+*  Purpose:		Gets the value below or at which a given share of the recorded	*
+*				values lie.														*
+*  Parameters:	@ ptHistogram ~[in]~ The histogram.								*
+*				@ dwQuantile ~[in]~ The share, out of HISTOGRAM_QUANTILE_SCALE.	*
+*  Returns:		The bucket limit holding the quantile, or 0 if empty.			*
+*  Remarks:		* A quantile of HISTOGRAM_QUANTILE_SCALE gets the maximum.		*
+********************************************************************************/
+ULONGLONG
+HISTOGRAM_GetQuantile(
+	__in PCHISTOGRAM ptHistogram,
+	__in ULONG dwQuantile
+);
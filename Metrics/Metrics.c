@@ -0,0 +1,367 @@
+/********************************************************************************
+*  File:		Metrics.c														*
+*  Purpose:		Per-stage latency histograms, dumpable on demand, and the		*
+*				process footprint.												*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#ifdef _WIN32
+#include <psapi.h>
+#else	// _WIN32
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#endif	// _WIN32
+#include "Metrics.h"
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Structure:	METRICS_TRIGGER													*
+*  Purpose:		The on-demand dump trigger.										*
+********************************************************************************/
+typedef struct _METRICS_TRIGGER
+{
+	PFN_METRICS_DUMP pfnDump;						// The report callback
+	PVOID pvContext;								// The report callback context
+#ifndef _WIN32
+	HANDLE hThread;									// Waits for the signal
+	INT nSignal;									// signalfd for SIGUSR1
+	INT nStopEvent;									// eventfd
+#endif	// _WIN32
+} METRICS_TRIGGER, *PMETRICS_TRIGGER;
+
+
+/** Globals ********************************************************************/
+
+/********************************************************************************
+*  Global:		g_tMetrics														*
+*  Purpose:		The process-wide latency histograms.							*
+********************************************************************************/
+METRICS
+g_tMetrics = { 0 };
+
+/********************************************************************************
+*  Global:		g_tTrigger														*
+*  Purpose:		The on-demand dump trigger.										*
+********************************************************************************/
+static
+METRICS_TRIGGER
+g_tTrigger = { 0 };
+
+/********************************************************************************
+*  Global:		g_apszStageNames												*
+*  Purpose:		Stage names, by METRICS_STAGE.									*
+********************************************************************************/
+static
+PCSTR
+g_apszStageNames[METRICS_STAGE_COUNT] = {
+	"classify",
+	"queue",
+	"decide",
+	"lock",
+	"receipt-to-decision",
+	"receipt-to-lock",
+	"policy-reload",
+	"policy-reclaim",
+	"fan-out",
+	"alert",
+	"snapshot"
+};
+
+
+/** Functions ******************************************************************/
+
+#ifdef _WIN32
+/********************************************************************************
+*  Function:	metrics_CtrlHandler												*
+*  Purpose:		Dumps on Ctrl+Break.											*
+*  Parameters:	@ dwCtrlType ~[in]~ The console control event.					*
+*  Returns:		TRUE if the event was handled.									*
+********************************************************************************/
+static
+BOOL
+WINAPI
+metrics_CtrlHandler(
+	__in DWORD dwCtrlType
+)
+{
+	// Leave everything but Ctrl+Break to the default handler
+	if (CTRL_BREAK_EVENT != dwCtrlType)
+	{
+		return FALSE;
+	}
+	g_tTrigger.pfnDump(stderr, g_tTrigger.pvContext);
+	return TRUE;
+}
+#else	// _WIN32
+/********************************************************************************
+*  Function:	metrics_TriggerThread											*
+*  Purpose:		Dumps on every SIGUSR1 until stopped.							*
+*  Parameters:	@ pvContext ~[inout]~ The trigger.								*
+*  Returns:		0.																*
+********************************************************************************/
+static
+UINT
+WINAPI
+metrics_TriggerThread(
+	__inout_opt PVOID pvContext
+)
+{
+	PMETRICS_TRIGGER ptTrigger = (PMETRICS_TRIGGER)pvContext;
+	struct pollfd atFds[2] = { { 0 } };
+	struct signalfd_siginfo tInfo = { 0 };
+
+	atFds[0].fd = ptTrigger->nSignal;
+	atFds[0].events = POLLIN;
+	atFds[1].fd = ptTrigger->nStopEvent;
+	atFds[1].events = POLLIN;
+	for (;;)
+	{
+		if (0 > poll(atFds, sizeof(atFds) / sizeof(atFds[0]), -1))
+		{
+			if (EINTR == errno)
+			{
+				continue;
+			}
+			break;
+		}
+		if (0 != atFds[1].revents)
+		{
+			break;
+		}
+
+		// Consume the signal, then dump
+		if (sizeof(tInfo) == read(ptTrigger->nSignal, &tInfo, sizeof(tInfo)))
+		{
+			ptTrigger->pfnDump(stderr, ptTrigger->pvContext);
+		}
+	}
+
+	// Return result
+	return 0;
+}
+#endif	// _WIN32
+
+/********************************************************************************
+*  Function:	METRICS_Dump													*
+********************************************************************************/
+VOID
+METRICS_Dump(
+	__in FILE *ptStream
+)
+{
+	INT nStage = 0;
+	PCHISTOGRAM ptHistogram = NULL;
+
+	// Validations
+	ASSERT(NULL != ptStream);
+
+	// One line per stage
+	(VOID)fprintf(ptStream, "%-20s %10s %12s %12s %12s %12s\n", "stage (ns)", "count", "p50", "p99", "p99.9", "max");
+	for (nStage = 0; nStage < METRICS_STAGE_COUNT; nStage++)
+	{
+		ptHistogram = &(g_tMetrics.atStages[nStage]);
+		(VOID)fprintf(ptStream,
+			"%-20s %10llu %12llu %12llu %12llu %12llu\n",
+			g_apszStageNames[nStage],
+			HISTOGRAM_GetCount(ptHistogram),
+			HISTOGRAM_GetQuantile(ptHistogram, 50000),
+			HISTOGRAM_GetQuantile(ptHistogram, 99000),
+			HISTOGRAM_GetQuantile(ptHistogram, 99900),
+			HISTOGRAM_GetQuantile(ptHistogram, HISTOGRAM_QUANTILE_SCALE));
+	}
+	(VOID)fflush(ptStream);
+}
+
+/********************************************************************************
+*  Function:	METRICS_GetMemory												*
+********************************************************************************/
+RETSTATUS
+METRICS_GetMemory(
+	__out PMETRICS_MEMORY ptMemory
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS tCounters = { 0 };
+#else	// _WIN32
+	FILE *ptFile = NULL;
+	CHAR szLine[128] = { 0 };
+	unsigned long nKilobytes = 0;
+#endif	// _WIN32
+
+	// Validations
+	ASSERT(NULL != ptMemory);
+
+	RtlZeroMemory(ptMemory, sizeof(*ptMemory));
+#ifdef _WIN32
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &tCounters, sizeof(tCounters)))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"GetProcessMemoryInfo() failure (LastError=%lu).",
+			GetLastError());
+		goto lblCleanup;
+	}
+	ptMemory->cbResident = tCounters.WorkingSetSize;
+	ptMemory->cbPeakResident = tCounters.PeakWorkingSetSize;
+#else	// _WIN32
+	ptFile = fopen("/proc/self/status", "r");
+	if (NULL == ptFile)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"fopen() failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+
+	// "VmRSS:     1234 kB" and "VmHWM:" for its peak
+	while (NULL != fgets(szLine, sizeof(szLine), ptFile))
+	{
+		if (1 == sscanf(szLine, "VmRSS: %lu kB", &nKilobytes))
+		{
+			ptMemory->cbResident = (SIZE_T)nKilobytes * 1024;
+		}
+		else if (1 == sscanf(szLine, "VmHWM: %lu kB", &nKilobytes))
+		{
+			ptMemory->cbPeakResident = (SIZE_T)nKilobytes * 1024;
+		}
+	}
+#endif	// _WIN32
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+#ifndef _WIN32
+	if (NULL != ptFile)
+	{
+		(VOID)fclose(ptFile);
+	}
+#endif	// _WIN32
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	METRICS_StartDumpTrigger										*
+********************************************************************************/
+RETSTATUS
+METRICS_StartDumpTrigger(
+	__in PFN_METRICS_DUMP pfnDump,
+	__inout_opt PVOID pvContext
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+#ifndef _WIN32
+	sigset_t tSignals;
+#endif	// _WIN32
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != pfnDump);
+
+	g_tTrigger.pfnDump = pfnDump;
+	g_tTrigger.pvContext = pvContext;
+
+#ifdef _WIN32
+	// Install the console handler
+	if (!SetConsoleCtrlHandler(metrics_CtrlHandler, TRUE))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"SetConsoleCtrlHandler() failure (LastError=%lu).",
+			GetLastError());
+		goto lblCleanup;
+	}
+#else	// _WIN32
+	g_tTrigger.nSignal = -1;
+	g_tTrigger.nStopEvent = -1;
+
+	// Block the signal so it is only ever read from the signalfd
+	(VOID)sigemptyset(&tSignals);
+	(VOID)sigaddset(&tSignals, SIGUSR1);
+	if (0 != pthread_sigmask(SIG_BLOCK, &tSignals, NULL))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"pthread_sigmask() failure.");
+		goto lblCleanup;
+	}
+	g_tTrigger.nSignal = signalfd(-1, &tSignals, SFD_CLOEXEC);
+	if (0 > g_tTrigger.nSignal)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"signalfd() failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+	g_tTrigger.nStopEvent = eventfd(0, EFD_CLOEXEC);
+	if (0 > g_tTrigger.nStopEvent)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"eventfd() failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+
+	// Wait for it on a thread of its own
+	g_tTrigger.hThread = BEGIN_THREAD(metrics_TriggerThread, &g_tTrigger, 0);
+	if (NULL == g_tTrigger.hThread)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"BEGIN_THREAD() failure.");
+		goto lblCleanup;
+	}
+#endif	// _WIN32
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+#ifndef _WIN32
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		CLOSE_FD(g_tTrigger.nSignal);
+		CLOSE_FD(g_tTrigger.nStopEvent);
+	}
+#endif	// _WIN32
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	METRICS_StopDumpTrigger											*
+********************************************************************************/
+VOID
+METRICS_StopDumpTrigger(VOID)
+{
+#ifdef _WIN32
+	(VOID)SetConsoleCtrlHandler(metrics_CtrlHandler, FALSE);
+#else	// _WIN32
+	if (NULL != g_tTrigger.hThread)
+	{
+		(VOID)eventfd_write(g_tTrigger.nStopEvent, 1);
+		JOIN_THREAD(g_tTrigger.hThread);
+	}
+	CLOSE_FD(g_tTrigger.nSignal);
+	CLOSE_FD(g_tTrigger.nStopEvent);
+#endif	// _WIN32
+}
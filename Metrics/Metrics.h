@@ -0,0 +1,152 @@
+/********************************************************************************
+*  File:		Metrics.h														*
+*  Purpose:		Per-stage latency histograms, dumpable on demand, and the		*
+*				process footprint.												*
+********************************************************************************/
+#pragma once
+
+
+/** Includes *******************************************************************/
+#include <Utilities.h>
+#include "Histogram.h"
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Enum:		METRICS_STAGE													*
+*  Purpose:		A measured stretch of the event pipeline.						*
+*  Remarks:		* Keep in sync with the names in Metrics.c.						*
+********************************************************************************/
+typedef enum
+{
+	METRICS_STAGE_CLASSIFY,							// Receipt to classified
+	METRICS_STAGE_QUEUE,							// Classified to dequeued
+	METRICS_STAGE_DECIDE,							// Dequeued to decided
+	METRICS_STAGE_LOCK,								// Decided to lock returned (or published)
+	METRICS_STAGE_RECEIPT_TO_DECISION,				// Receipt to decided (every event)
+	METRICS_STAGE_RECEIPT_TO_LOCK,					// Receipt to lock returned (locks only)
+	METRICS_STAGE_POLICY_RELOAD,					// Policy file change to new view published
+	METRICS_STAGE_POLICY_RECLAIM,					// New view published to old view unmapped
+	METRICS_STAGE_FAN_OUT,							// Published on the bus to received by an agent
+	METRICS_STAGE_ALERT,							// Alert requested to raised
+	METRICS_STAGE_SNAPSHOT,							// Log snapshot requested to on disk
+	METRICS_STAGE_COUNT
+} METRICS_STAGE, *PMETRICS_STAGE;
+
+/********************************************************************************
+*  Structure:	METRICS															*
+*  Purpose:		The latency histograms, in nanoseconds.							*
+********************************************************************************/
+typedef struct _METRICS
+{
+	HISTOGRAM atStages[METRICS_STAGE_COUNT];		// Histogram per stage
+} METRICS, *PMETRICS;
+
+/********************************************************************************
+*  Structure:	METRICS_MEMORY													*
+*  Purpose:		The process footprint.											*
+********************************************************************************/
+typedef struct _METRICS_MEMORY
+{
+	SIZE_T cbResident;								// Resident set (working set on Windows)
+	SIZE_T cbPeakResident;							// Its peak so far
+} METRICS_MEMORY, *PMETRICS_MEMORY;
+
+/********************************************************************************
+*  Callback:	PFN_METRICS_DUMP												*
+*  Purpose:		Writes a report when a dump is requested.						*
+*  Parameters:	@ ptStream ~[in]~ The stream to write to.						*
+*				@ pvContext ~[inout]~ The context given to						*
+*				METRICS_StartDumpTrigger.										*
+*  Remarks:		* Invoked on a thread of its own.								*
+********************************************************************************/
+typedef VOID (*PFN_METRICS_DUMP)(
+	__in FILE *ptStream,
+	__inout_opt PVOID pvContext
+);
+
+
+/** Globals ********************************************************************/
+
+/********************************************************************************
+*  Global:		g_tMetrics														*
+*  Purpose:		The process-wide latency histograms.							*
+********************************************************************************/
+extern
+METRICS
+g_tMetrics;
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	METRICS_Record													*
+*  Purpose:		Records the latency of a stage.									*
+*  Parameters:	@ eStage ~[in]~ The stage.										*
+*				@ qwStartNs ~[in]~ The stage's start timestamp.					*
+*				@ qwEndNs ~[in]~ The stage's end timestamp.						*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+*				* Defined as static and inline to be included in object files.	*
+*				* Each stage must only be recorded from a single thread.		*
+********************************************************************************/
+static
+__inline
+VOID
+METRICS_Record(
+	__in METRICS_STAGE eStage,
+	__in ULONGLONG qwStartNs,
+	__in ULONGLONG qwEndNs
+)
+{
+	// Timestamps taken on different threads may be a tick apart
+	HISTOGRAM_Record(&(g_tMetrics.atStages[eStage]), (qwEndNs > qwStartNs) ? (qwEndNs - qwStartNs) : 0);
+}
+
+/********************************************************************************
+*  Function:	METRICS_Dump													*
+*  Purpose:		Writes count, p50, p99, p99.9 and maximum for every stage.		*
+*  Parameters:	@ ptStream ~[in]~ The stream to write to.						*
+********************************************************************************/
+VOID
+METRICS_Dump(
+	__in FILE *ptStream
+);
+
+/********************************************************************************
+*  Function:	METRICS_GetMemory												*
+*  Purpose:		Gets the process footprint.										*
+*  Parameters:	@ ptMemory ~[out]~ Gets the footprint (zeroed if unknown).		*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+RETSTATUS
+METRICS_GetMemory(
+	__out PMETRICS_MEMORY ptMemory
+);
+
+/********************************************************************************
+*  Function:	METRICS_StartDumpTrigger										*
+*  Purpose:		Dumps to stderr whenever the user asks, from a thread of its	*
+*				own.															*
+*  Parameters:	@ pfnDump ~[in]~ The report callback.							*
+*				@ pvContext ~[inout]~ Optional context for the callback.		*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Windows: Ctrl+Break in the console.							*
+*				* POSIX: SIGUSR1. Call before starting any other thread, as		*
+*					the signal is blocked in the calling thread (and so in		*
+*					every thread it starts later).								*
+*				* Stop with METRICS_StopDumpTrigger.							*
+********************************************************************************/
+RETSTATUS
+METRICS_StartDumpTrigger(
+	__in PFN_METRICS_DUMP pfnDump,
+	__inout_opt PVOID pvContext
+);
+
+/********************************************************************************
+*  Function:	METRICS_StopDumpTrigger											*
+*  Purpose:		Stops dumping on demand.										*
+*  Remarks:		* Only call after METRICS_StartDumpTrigger succeeded.			*
+********************************************************************************/
+VOID
+METRICS_StopDumpTrigger(VOID);
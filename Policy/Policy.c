@@ -0,0 +1,1006 @@
+/********************************************************************************
+*  File:		Policy.c														*
+*  Purpose:		Memory-mapped binary policy file with atomic hot reload.		*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif	// _WIN32
+#include "Policy.h"
+#include <Clock.h>
+#include "../Metrics/Metrics.h"
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	POLICY_CRC32_POLYNOMIAL											*
+*  Purpose:		The reflected CRC-32 (IEEE 802.3) polynomial.					*
+********************************************************************************/
+#define POLICY_CRC32_POLYNOMIAL (0xEDB88320UL)
+
+/********************************************************************************
+*  Constant:	POLICY_TEMP_SUFFIX												*
+*  Purpose:		Appended to the policy path for the file written before the		*
+*				rename.															*
+********************************************************************************/
+#define POLICY_TEMP_SUFFIX (".tmp")
+
+#ifndef _WIN32
+/********************************************************************************
+*  Constant:	POLICY_NOTIFY_BUFFER_SIZE										*
+*  Purpose:		Size of the buffer inotify events are read into.				*
+********************************************************************************/
+#define POLICY_NOTIFY_BUFFER_SIZE (4096)
+#endif	// _WIN32
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	policy_Crc32													*
+*  Purpose:		Computes a CRC-32 (IEEE 802.3).									*
+*  Parameters:	@ pbData ~[in]~ The data.										*
+*				@ cbData ~[in]~ Number of bytes.								*
+*  Returns:		The CRC-32.														*
+*  Remarks:		* Builds its table on every call (2K operations), which is		*
+*					nothing next to the files it checks.						*
+********************************************************************************/
+static
+DWORD
+policy_Crc32(
+	__in_bcount(cbData) const BYTE *pbData,
+	__in SIZE_T cbData
+)
+{
+	DWORD adwTable[256] = { 0 };
+	DWORD dwCrc = 0;
+	DWORD dwIndex = 0;
+	DWORD dwBit = 0;
+	SIZE_T cbIndex = 0;
+
+	// Build the table
+	for (dwIndex = 0; dwIndex < sizeof(adwTable) / sizeof(adwTable[0]); dwIndex++)
+	{
+		dwCrc = dwIndex;
+		for (dwBit = 0; dwBit < 8; dwBit++)
+		{
+			dwCrc = (dwCrc >> 1) ^ ((dwCrc & 1) ? POLICY_CRC32_POLYNOMIAL : 0);
+		}
+		adwTable[dwIndex] = dwCrc;
+	}
+
+	// Byte at a time
+	dwCrc = 0xFFFFFFFFUL;
+	for (cbIndex = 0; cbIndex < cbData; cbIndex++)
+	{
+		dwCrc = (dwCrc >> 8) ^ adwTable[(dwCrc ^ pbData[cbIndex]) & 0xFF];
+	}
+
+	// Return result
+	return dwCrc ^ 0xFFFFFFFFUL;
+}
+
+/********************************************************************************
+*  Function:	policy_Validate													*
+*  Purpose:		Checks that a mapped file is a well-formed policy.				*
+*  Parameters:	@ ptHeader ~[in]~ The mapping.									*
+*				@ cbMapping ~[in]~ The mapping size.							*
+*				@ pszPath ~[in]~ The file, for logging.							*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+policy_Validate(
+	__in PCPOLICY_FILE_HEADER ptHeader,
+	__in SIZE_T cbMapping,
+	__in_z PCSTR pszPath
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	const ULONGLONG *pqwSlots = NULL;
+	ULONGLONG qwSlotsEnd = 0;
+	DWORD dwSlot = 0;
+	DWORD dwOccupied = 0;
+
+	// The header
+	if ((sizeof(*ptHeader) > cbMapping) ||
+		(0 != memcmp(ptHeader->acMagic, POLICY_FILE_MAGIC, sizeof(ptHeader->acMagic))))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"'%s' is not a policy file.",
+			pszPath);
+		goto lblCleanup;
+	}
+	if (POLICY_FORMAT_VERSION != ptHeader->dwFormatVersion)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"'%s' has an unsupported format version (%lu).",
+			pszPath,
+			(unsigned long)ptHeader->dwFormatVersion);
+		goto lblCleanup;
+	}
+	if (cbMapping != ptHeader->qwFileSize)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"'%s' is truncated (%llu of %llu bytes).",
+			pszPath,
+			(ULONGLONG)cbMapping,
+			ptHeader->qwFileSize);
+		goto lblCleanup;
+	}
+	if (ptHeader->dwChecksum != policy_Crc32((const BYTE *)&(ptHeader->dwFormatVersion),
+		cbMapping - offsetof(POLICY_FILE_HEADER, dwFormatVersion)))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"'%s' fails its checksum.",
+			pszPath);
+		goto lblCleanup;
+	}
+
+	// The allowlist section must be in bounds and keep a free slot, so every probe sequence ends
+	qwSlotsEnd = ptHeader->qwAllowlistOffset + ((ULONGLONG)ptHeader->dwAllowlistSlots * sizeof(pqwSlots[0]));
+	if ((sizeof(*ptHeader) > ptHeader->qwAllowlistOffset) ||
+		(0 != (ptHeader->qwAllowlistOffset % sizeof(pqwSlots[0]))) ||
+		(cbMapping < ptHeader->qwAllowlistOffset) ||
+		(cbMapping < qwSlotsEnd) ||
+		(ALLOWLIST_MIN_SLOTS > ptHeader->dwAllowlistSlots) ||
+		(0 != (ptHeader->dwAllowlistSlots & (ptHeader->dwAllowlistSlots - 1))) ||
+		(ALLOWLIST_MAX_ENTRIES < ptHeader->dwAllowlistEntries) ||
+		(ptHeader->dwAllowlistSlots / 2 < ptHeader->dwAllowlistEntries))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"'%s' has a malformed allowlist section.",
+			pszPath);
+		goto lblCleanup;
+	}
+	pqwSlots = (const ULONGLONG *)((const BYTE *)ptHeader + ptHeader->qwAllowlistOffset);
+	for (dwSlot = 0; dwSlot < ptHeader->dwAllowlistSlots; dwSlot++)
+	{
+		dwOccupied += (0 != pqwSlots[dwSlot]) ? 1 : 0;
+	}
+	if (dwOccupied != ptHeader->dwAllowlistEntries)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"'%s' has %lu allowlist entries, not %lu.",
+			pszPath,
+			(unsigned long)dwOccupied,
+			(unsigned long)ptHeader->dwAllowlistEntries);
+		goto lblCleanup;
+	}
+
+	// The rules section is optional, and validated as it is mapped
+	if ((0 != ptHeader->qwRulesSize) &&
+		((sizeof(*ptHeader) > ptHeader->qwRulesOffset) ||
+		(0 != (ptHeader->qwRulesOffset % sizeof(pqwSlots[0]))) ||
+		(cbMapping < ptHeader->qwRulesOffset) ||
+		(cbMapping - ptHeader->qwRulesOffset < ptHeader->qwRulesSize)))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"'%s' has a malformed rules section.",
+			pszPath);
+		goto lblCleanup;
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	policy_Unmap													*
+*  Purpose:		Unmaps a file mapping.											*
+*  Parameters:	@ ptHeader ~[in]~ The mapping.									*
+*				@ cbMapping ~[in]~ The mapping size.							*
+********************************************************************************/
+static
+VOID
+policy_Unmap(
+	__in PCPOLICY_FILE_HEADER ptHeader,
+	__in SIZE_T cbMapping
+)
+{
+#ifdef _WIN32
+	UNREFERENCED_PARAMETER(cbMapping);
+	(VOID)UnmapViewOfFile(ptHeader);
+#else	// _WIN32
+	(VOID)munmap((PVOID)ptHeader, cbMapping);
+#endif	// _WIN32
+}
+
+/********************************************************************************
+*  Function:	policy_GetFileName												*
+*  Purpose:		Gets the file name part of a path.								*
+*  Parameters:	@ pszPath ~[in]~ The path.										*
+*  Returns:		The file name, within the path.									*
+********************************************************************************/
+static
+PCSTR
+policy_GetFileName(
+	__in_z PCSTR pszPath
+)
+{
+	PCSTR pszName = pszPath;
+	PCSTR pszCurrent = NULL;
+
+	for (pszCurrent = pszPath; '\0' != *pszCurrent; pszCurrent++)
+	{
+#ifdef _WIN32
+		if (('\\' == *pszCurrent) || ('/' == *pszCurrent))
+#else	// _WIN32
+		if ('/' == *pszCurrent)
+#endif	// _WIN32
+		{
+			pszName = pszCurrent + 1;
+		}
+	}
+
+	// Return result
+	return pszName;
+}
+
+/********************************************************************************
+*  Function:	policy_WatchDirectory											*
+*  Purpose:		Starts watching the directory of the policy file.				*
+*  Parameters:	@ ptPolicy ~[inout]~ The policy.								*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* The directory is watched rather than the file, since			*
+*					publishers replace the file by renaming over it.			*
+********************************************************************************/
+static
+RETSTATUS
+policy_WatchDirectory(
+	__inout PPOLICY ptPolicy
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	CHAR szDirectory[MAX_PATH] = { 0 };
+	SIZE_T cchDirectory = 0;
+
+	// Take everything up to the file name, or the working directory
+	cchDirectory = (SIZE_T)(policy_GetFileName(ptPolicy->szPath) - ptPolicy->szPath);
+	if (0 == cchDirectory)
+	{
+		szDirectory[0] = '.';
+	}
+	else
+	{
+		RtlCopyMemory(szDirectory, ptPolicy->szPath, cchDirectory);
+	}
+
+#ifdef _WIN32
+	ptPolicy->hChange = FindFirstChangeNotificationA(szDirectory,
+		FALSE,
+		FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE);
+	if (INVALID_HANDLE_VALUE == ptPolicy->hChange)
+	{
+		ptPolicy->hChange = NULL;
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"FindFirstChangeNotificationA() failure (LastError=%lu).",
+			GetLastError());
+		goto lblCleanup;
+	}
+#else	// _WIN32
+	ptPolicy->nNotify = inotify_init1(IN_CLOEXEC);
+	if (0 > ptPolicy->nNotify)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"inotify_init1() failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+	if (0 > inotify_add_watch(ptPolicy->nNotify, szDirectory, IN_CLOSE_WRITE | IN_MOVED_TO))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"inotify_add_watch() failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+#endif	// _WIN32
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Return result
+	return eStatus;
+}
+
+#ifndef _WIN32
+/********************************************************************************
+*  Function:	policy_IsFileChanged											*
+*  Purpose:		Reads pending inotify events.									*
+*  Parameters:	@ ptPolicy ~[in]~ The policy.									*
+*  Returns:		TRUE if any of them is about the policy file.					*
+********************************************************************************/
+static
+BOOL
+policy_IsFileChanged(
+	__in PPOLICY ptPolicy
+)
+{
+	union
+	{
+		struct inotify_event tEvent;
+		CHAR acBytes[POLICY_NOTIFY_BUFFER_SIZE];
+	} uBuffer;
+	const struct inotify_event *ptEvent = NULL;
+	ssize_t cbRead = 0;
+	ssize_t cbOffset = 0;
+	PCSTR pszName = policy_GetFileName(ptPolicy->szPath);
+	BOOL bIsChanged = FALSE;
+
+	cbRead = read(ptPolicy->nNotify, &uBuffer, sizeof(uBuffer));
+	for (cbOffset = 0; cbOffset + (ssize_t)sizeof(*ptEvent) <= cbRead; cbOffset += sizeof(*ptEvent) + ptEvent->len)
+	{
+		ptEvent = (const struct inotify_event *)(uBuffer.acBytes + cbOffset);
+		if ((0 != ptEvent->len) && (0 == strcmp(ptEvent->name, pszName)))
+		{
+			bIsChanged = TRUE;
+		}
+	}
+
+	// Return result
+	return bIsChanged;
+}
+#endif	// _WIN32
+
+/********************************************************************************
+*  Function:	policy_WatcherThread											*
+*  Purpose:		Reloads the policy whenever its file changes, until stopped.	*
+*  Parameters:	@ pvContext ~[inout]~ The policy.								*
+*  Returns:		0.																*
+********************************************************************************/
+static
+UINT
+WINAPI
+policy_WatcherThread(
+	__inout_opt PVOID pvContext
+)
+{
+	PPOLICY ptPolicy = (PPOLICY)pvContext;
+#ifdef _WIN32
+	HANDLE ahWaits[2] = { NULL };
+
+	ahWaits[0] = ptPolicy->hChange;
+	ahWaits[1] = ptPolicy->hStopEvent;
+	while (WAIT_OBJECT_0 == WaitForMultipleObjects(sizeof(ahWaits) / sizeof(ahWaits[0]), ahWaits, FALSE, INFINITE))
+	{
+		// Something in the directory changed, the revision check skips unrelated changes
+		(VOID)POLICY_Reload(ptPolicy);
+		if (!FindNextChangeNotification(ptPolicy->hChange))
+		{
+			DEBUG_MSG(LOG_SEV_ERROR,
+				"FindNextChangeNotification() failure (LastError=%lu).",
+				GetLastError());
+			break;
+		}
+	}
+#else	// _WIN32
+	struct pollfd atFds[2] = { { 0 } };
+
+	atFds[0].fd = ptPolicy->nNotify;
+	atFds[0].events = POLLIN;
+	atFds[1].fd = ptPolicy->nStopEvent;
+	atFds[1].events = POLLIN;
+	for (;;)
+	{
+		if (0 > poll(atFds, sizeof(atFds) / sizeof(atFds[0]), -1))
+		{
+			if (EINTR == errno)
+			{
+				continue;
+			}
+			break;
+		}
+		if (0 != atFds[1].revents)
+		{
+			break;
+		}
+		if (policy_IsFileChanged(ptPolicy))
+		{
+			(VOID)POLICY_Reload(ptPolicy);
+		}
+	}
+#endif	// _WIN32
+
+	// Return result
+	return 0;
+}
+
+/********************************************************************************
+*  Function:	POLICY_MapView													*
+********************************************************************************/
+RETSTATUS
+POLICY_MapView(
+	__in_z PCSTR pszPath,
+	__out PPOLICY_VIEW *pptView
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	PPOLICY_VIEW ptView = NULL;
+	PCPOLICY_FILE_HEADER ptHeader = NULL;
+	SIZE_T cbMapping = 0;
+#ifdef _WIN32
+	HANDLE hFile = INVALID_HANDLE_VALUE;
+	HANDLE hMapping = NULL;
+	LARGE_INTEGER tSize = { 0 };
+#else	// _WIN32
+	INT nFile = -1;
+	struct stat tStat = { 0 };
+	PVOID pvMapping = MAP_FAILED;
+#endif	// _WIN32
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != pszPath);
+	ASSERT(NULL != pptView);
+
+	*pptView = NULL;
+
+#ifdef _WIN32
+	// Map the whole file (deletes are shared, so the publisher can replace it)
+	hFile = CreateFileA(pszPath,
+		GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL);
+	if (INVALID_HANDLE_VALUE == hFile)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_INFO,
+			"Cannot open '%s' (LastError=%lu).",
+			pszPath,
+			GetLastError());
+		goto lblCleanup;
+	}
+	if ((!GetFileSizeEx(hFile, &tSize)) || ((ULONGLONG)tSize.QuadPart < sizeof(*ptHeader)) || ((ULONGLONG)tSize.QuadPart > (SIZE_T)-1))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"'%s' is not a policy file.",
+			pszPath);
+		goto lblCleanup;
+	}
+	cbMapping = (SIZE_T)tSize.QuadPart;
+	hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (NULL == hMapping)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"CreateFileMappingA() failure (LastError=%lu).",
+			GetLastError());
+		goto lblCleanup;
+	}
+	ptHeader = (PCPOLICY_FILE_HEADER)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+	if (NULL == ptHeader)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"MapViewOfFile() failure (LastError=%lu).",
+			GetLastError());
+		goto lblCleanup;
+	}
+#else	// _WIN32
+	// Map the whole file
+	nFile = open(pszPath, O_RDONLY | O_CLOEXEC);
+	if (0 > nFile)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_INFO,
+			"Cannot open '%s' (errno=%d).",
+			pszPath,
+			errno);
+		goto lblCleanup;
+	}
+	if ((0 != fstat(nFile, &tStat)) || ((ULONGLONG)tStat.st_size < sizeof(*ptHeader)))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"'%s' is not a policy file.",
+			pszPath);
+		goto lblCleanup;
+	}
+	cbMapping = (SIZE_T)tStat.st_size;
+	pvMapping = mmap(NULL, cbMapping, PROT_READ, MAP_SHARED, nFile, 0);
+	if (MAP_FAILED == pvMapping)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"mmap() failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+	ptHeader = (PCPOLICY_FILE_HEADER)pvMapping;
+#endif	// _WIN32
+
+	// Never trust the file
+	eStatus = policy_Validate(ptHeader, cbMapping, pszPath);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		DEBUG_MSG(LOG_SEV_ERROR,
+			"policy_Validate() failed (eStatus=0x%.8x).",
+			eStatus);
+		goto lblCleanup;
+	}
+
+	// Point the view into the mapping
+	ptView = (PPOLICY_VIEW)ALLOCZ(sizeof(*ptView));
+	if (NULL == ptView)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"ALLOCZ() failure.");
+		goto lblCleanup;
+	}
+	if (0 != ptHeader->qwRulesSize)
+	{
+		eStatus = RULES_MapTable((const BYTE *)ptHeader + ptHeader->qwRulesOffset, (SIZE_T)ptHeader->qwRulesSize, &(ptView->tRules));
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			DEBUG_MSG(LOG_SEV_ERROR,
+				"RULES_MapTable() failed for '%s' (eStatus=0x%.8x).",
+				pszPath,
+				eStatus);
+			goto lblCleanup;
+		}
+	}
+	ptView->qwRevision = ptHeader->qwRevision;
+	ptView->tAllowlist.pqwSlots = (PULONGLONG)((const BYTE *)ptHeader + ptHeader->qwAllowlistOffset);
+	ptView->tAllowlist.dwMask = ptHeader->dwAllowlistSlots - 1;
+	ptView->tAllowlist.dwEntries = ptHeader->dwAllowlistEntries;
+	ptView->tAllowlist.dwMaxEntries = ptHeader->dwAllowlistEntries;
+	ptView->ptHeader = ptHeader;
+	ptView->cbMapping = cbMapping;
+	*pptView = ptView;
+	DEBUG_MSG(LOG_SEV_INFO,
+		"Mapped '%s' (revision %llu, %lu approved devices, %lu rules).",
+		pszPath,
+		ptView->qwRevision,
+		(unsigned long)ptView->tAllowlist.dwEntries,
+		(unsigned long)((NULL != ptView->tRules.ptHeader) ? ptView->tRules.ptHeader->dwRules : 0));
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources (the mapping outlives the handles)
+	if ((RETSTATUS_FAILED(eStatus)) && (NULL != ptHeader))
+	{
+		policy_Unmap(ptHeader, cbMapping);
+		FREE(ptView);
+	}
+#ifdef _WIN32
+	CLOSE_HANDLE(hMapping);
+	CLOSE_FILE_HANDLE(hFile);
+#else	// _WIN32
+	CLOSE_FD(nFile);
+#endif	// _WIN32
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	POLICY_UnmapView												*
+********************************************************************************/
+VOID
+POLICY_UnmapView(
+	__in_opt PPOLICY_VIEW ptView
+)
+{
+	if (NULL == ptView)
+	{
+		return;
+	}
+
+	// Free resources
+	policy_Unmap(ptView->ptHeader, ptView->cbMapping);
+	FREE(ptView);
+}
+
+/********************************************************************************
+*  Function:	POLICY_Write													*
+********************************************************************************/
+RETSTATUS
+POLICY_Write(
+	__in_z PCSTR pszPath,
+	__in PCALLOWLIST ptAllowlist,
+	__in_bcount_opt(cbRules) PCVOID pvRules,
+	__in SIZE_T cbRules,
+	__in ULONGLONG qwRevision
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	CHAR szTempPath[MAX_PATH] = { 0 };
+	PBYTE pbFile = NULL;
+	PPOLICY_FILE_HEADER ptHeader = NULL;
+	SIZE_T cbFile = 0;
+	SIZE_T cbRulesOffset = 0;
+	DWORD dwSlots = ALLOWLIST_MIN_SLOTS;
+	FILE *ptFile = NULL;
+	BOOL bIsWritten = FALSE;
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != pszPath);
+	ASSERT(NULL != ptAllowlist);
+	ASSERT((NULL != pvRules) || (0 == cbRules));
+	if (sizeof(szTempPath) <= (SIZE_T)snprintf(szTempPath, sizeof(szTempPath), "%s%s", pszPath, POLICY_TEMP_SUFFIX))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"Path too long ('%s').",
+			pszPath);
+		goto lblCleanup;
+	}
+
+	// Lay the file out in memory, the slots and rules go as-is (an empty allowlist gets free slots)
+	if (NULL != ptAllowlist->pqwSlots)
+	{
+		dwSlots = ptAllowlist->dwMask + 1;
+	}
+	cbFile = sizeof(*ptHeader) + ((SIZE_T)dwSlots * sizeof(ptAllowlist->pqwSlots[0]));
+	cbRulesOffset = cbFile;
+	cbFile += (cbRules + sizeof(ptAllowlist->pqwSlots[0]) - 1) & ~(sizeof(ptAllowlist->pqwSlots[0]) - 1);
+	pbFile = (PBYTE)ALLOCZ(cbFile);
+	if (NULL == pbFile)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"ALLOCZ() failure.");
+		goto lblCleanup;
+	}
+	ptHeader = (PPOLICY_FILE_HEADER)pbFile;
+	RtlCopyMemory(ptHeader->acMagic, POLICY_FILE_MAGIC, sizeof(ptHeader->acMagic));
+	ptHeader->dwFormatVersion = POLICY_FORMAT_VERSION;
+	ptHeader->qwFileSize = cbFile;
+	ptHeader->qwRevision = qwRevision;
+	ptHeader->qwAllowlistOffset = sizeof(*ptHeader);
+	ptHeader->dwAllowlistSlots = dwSlots;
+	ptHeader->dwAllowlistEntries = ptAllowlist->dwEntries;
+	if (NULL != ptAllowlist->pqwSlots)
+	{
+		RtlCopyMemory(pbFile + ptHeader->qwAllowlistOffset, ptAllowlist->pqwSlots, (SIZE_T)dwSlots * sizeof(ptAllowlist->pqwSlots[0]));
+	}
+	if (0 != cbRules)
+	{
+		ptHeader->qwRulesOffset = cbRulesOffset;
+		ptHeader->qwRulesSize = cbRules;
+		RtlCopyMemory(pbFile + cbRulesOffset, pvRules, cbRules);
+	}
+	ptHeader->dwChecksum = policy_Crc32((const BYTE *)&(ptHeader->dwFormatVersion),
+		cbFile - offsetof(POLICY_FILE_HEADER, dwFormatVersion));
+
+	// Write it next to the file, durably
+	ptFile = fopen(szTempPath, "wb");
+	if (NULL == ptFile)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"Cannot create '%s'.",
+			szTempPath);
+		goto lblCleanup;
+	}
+	bIsWritten = (cbFile == fwrite(pbFile, 1, cbFile, ptFile)) && (0 == fflush(ptFile));
+#ifndef _WIN32
+	bIsWritten = bIsWritten && (0 == fsync(fileno(ptFile)));
+#endif	// _WIN32
+	bIsWritten = (0 == fclose(ptFile)) && bIsWritten;
+	ptFile = NULL;
+	if (!bIsWritten)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"Cannot write '%s'.",
+			szTempPath);
+		goto lblCleanup;
+	}
+
+	// Replace the file in one step
+#ifdef _WIN32
+	if (!MoveFileExA(szTempPath, pszPath, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"MoveFileExA() failure (LastError=%lu).",
+			GetLastError());
+		goto lblCleanup;
+	}
+#else	// _WIN32
+	if (0 != rename(szTempPath, pszPath))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"rename() failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+#endif	// _WIN32
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	if ((RETSTATUS_FAILED(eStatus)) && (NULL != pbFile))
+	{
+		(VOID)remove(szTempPath);
+	}
+	FREE(pbFile);
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	POLICY_Start													*
+********************************************************************************/
+RETSTATUS
+POLICY_Start(
+	__in_z PCSTR pszPath,
+	__out PPOLICY ptPolicy
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != pszPath);
+	ASSERT(NULL != ptPolicy);
+
+	RtlZeroMemory(ptPolicy, sizeof(*ptPolicy));
+#ifndef _WIN32
+	ptPolicy->nNotify = -1;
+	ptPolicy->nStopEvent = -1;
+#endif	// _WIN32
+	if (sizeof(ptPolicy->szPath) <= strlen(pszPath))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"Path too long ('%s').",
+			pszPath);
+		goto lblCleanup;
+	}
+	RtlCopyMemory(ptPolicy->szPath, pszPath, strlen(pszPath) + 1);
+
+	// Watch, then load what is there (best-effort, a file may be published later), so no change is missed
+	eStatus = policy_WatchDirectory(ptPolicy);
+	(VOID)POLICY_Reload(ptPolicy);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		DEBUG_MSG(LOG_SEV_ERROR,
+			"policy_WatchDirectory() failed (eStatus=0x%.8x).",
+			eStatus);
+		goto lblCleanup;
+	}
+
+	// Reload on a thread of its own
+#ifdef _WIN32
+	ptPolicy->hStopEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+	if (NULL == ptPolicy->hStopEvent)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"CreateEventA() failure (LastError=%lu).",
+			GetLastError());
+		goto lblCleanup;
+	}
+#else	// _WIN32
+	ptPolicy->nStopEvent = eventfd(0, EFD_CLOEXEC);
+	if (0 > ptPolicy->nStopEvent)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"eventfd() failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+#endif	// _WIN32
+	ptPolicy->hWatcher = BEGIN_THREAD(policy_WatcherThread, ptPolicy, 0);
+	if (NULL == ptPolicy->hWatcher)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"BEGIN_THREAD() failure.");
+		goto lblCleanup;
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources (the view stays)
+	if (RETSTATUS_FAILED(eStatus))
+	{
+#ifdef _WIN32
+		CLOSE_TO_VALUE(ptPolicy->hChange, NULL, FindCloseChangeNotification);
+		CLOSE_HANDLE(ptPolicy->hStopEvent);
+#else	// _WIN32
+		CLOSE_FD(ptPolicy->nNotify);
+		CLOSE_FD(ptPolicy->nStopEvent);
+#endif	// _WIN32
+	}
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	POLICY_Stop														*
+********************************************************************************/
+VOID
+POLICY_Stop(
+	__inout PPOLICY ptPolicy
+)
+{
+	// Validations
+	ASSERT(NULL != ptPolicy);
+
+	// Stop the watcher
+	if (NULL != ptPolicy->hWatcher)
+	{
+#ifdef _WIN32
+		(VOID)SetEvent(ptPolicy->hStopEvent);
+#else	// _WIN32
+		(VOID)eventfd_write(ptPolicy->nStopEvent, 1);
+#endif	// _WIN32
+		JOIN_THREAD(ptPolicy->hWatcher);
+	}
+
+	// Free resources
+#ifdef _WIN32
+	CLOSE_TO_VALUE(ptPolicy->hChange, NULL, FindCloseChangeNotification);
+	CLOSE_HANDLE(ptPolicy->hStopEvent);
+#else	// _WIN32
+	CLOSE_FD(ptPolicy->nNotify);
+	CLOSE_FD(ptPolicy->nStopEvent);
+#endif	// _WIN32
+	POLICY_UnmapView(ptPolicy->ptCurrent);
+	ptPolicy->ptCurrent = NULL;
+}
+
+/********************************************************************************
+*  Function:	POLICY_Reload													*
+********************************************************************************/
+RETSTATUS
+POLICY_Reload(
+	__inout PPOLICY ptPolicy
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	PPOLICY_VIEW ptNew = NULL;
+	PPOLICY_VIEW ptOld = NULL;
+	ULONGLONG qwStartTimestamp = 0;
+	ULONGLONG qwSwappedTimestamp = 0;
+	DWORD dwReader = 0;
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != ptPolicy);
+
+	// Build the new view
+	qwStartTimestamp = CLOCK_GetTimestamp();
+	eStatus = POLICY_MapView(ptPolicy->szPath, &ptNew);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		(VOID)ATOMIC_INCREMENT(&(ptPolicy->nRejected));
+		DEBUG_MSG(LOG_SEV_ERROR,
+			"POLICY_MapView() failed (eStatus=0x%.8x).",
+			eStatus);
+		goto lblCleanup;
+	}
+
+	// Only this thread publishes, so the current view can be read plainly
+	ptOld = ptPolicy->ptCurrent;
+	if ((NULL != ptOld) && (ptNew->qwRevision <= ptOld->qwRevision))
+	{
+		DEBUG_MSG(LOG_SEV_INFO,
+			"Keeping revision %llu over revision %llu.",
+			ptOld->qwRevision,
+			ptNew->qwRevision);
+		POLICY_UnmapView(ptNew);
+		goto lblCleanup;
+	}
+
+	// Publish
+	ATOMIC_STORE_RELEASE_POINTER(&(ptPolicy->ptCurrent), ptNew);
+	qwSwappedTimestamp = CLOCK_GetTimestamp();
+	METRICS_Record(METRICS_STAGE_POLICY_RELOAD, qwStartTimestamp, qwSwappedTimestamp);
+	(VOID)ATOMIC_INCREMENT(&(ptPolicy->nReloads));
+	DEBUG_MSG(LOG_SEV_INFO,
+		"Swapped in revision %llu (%llu ns).",
+		ptNew->qwRevision,
+		qwSwappedTimestamp - qwStartTimestamp);
+
+	// Reclaim the old view once every reader that could have seen it moved on
+	if (NULL != ptOld)
+	{
+		ATOMIC_FULL_BARRIER();
+		for (dwReader = 0; dwReader < POLICY_MAX_READERS; dwReader++)
+		{
+			while (ptOld == ATOMIC_LOAD_ACQUIRE_POINTER(&(ptPolicy->atReaders[dwReader].ptView)))
+			{
+#ifdef _WIN32
+				(VOID)SwitchToThread();
+#else	// _WIN32
+				(VOID)sched_yield();
+#endif	// _WIN32
+			}
+		}
+		POLICY_UnmapView(ptOld);
+		METRICS_Record(METRICS_STAGE_POLICY_RECLAIM, qwSwappedTimestamp, CLOCK_GetTimestamp());
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	POLICY_GetStats													*
+********************************************************************************/
+VOID
+POLICY_GetStats(
+	__inout PPOLICY ptPolicy,
+	__out PPOLICY_STATS ptStats
+)
+{
+	PCPOLICY_VIEW ptView = NULL;
+
+	// Validations
+	ASSERT(NULL != ptPolicy);
+	ASSERT(NULL != ptStats);
+
+	RtlZeroMemory(ptStats, sizeof(*ptStats));
+	ptView = POLICY_Enter(ptPolicy, POLICY_STATS_READER);
+	if (NULL != ptView)
+	{
+		ptStats->qwRevision = ptView->qwRevision;
+		ptStats->dwAllowlistEntries = ptView->tAllowlist.dwEntries;
+		ptStats->dwRules = (NULL != ptView->tRules.ptHeader) ? ptView->tRules.ptHeader->dwRules : 0;
+	}
+	POLICY_Leave(ptPolicy, POLICY_STATS_READER);
+	ptStats->dwReloads = (DWORD)ATOMIC_LOAD_ACQUIRE(&(ptPolicy->nReloads));
+	ptStats->dwRejected = (DWORD)ATOMIC_LOAD_ACQUIRE(&(ptPolicy->nRejected));
+}
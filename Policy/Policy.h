@@ -0,0 +1,302 @@
+/********************************************************************************
+*  File:		Policy.h														*
+*  Purpose:		Memory-mapped binary policy file with atomic hot reload.		*
+********************************************************************************/
+#pragma once
+
+
+/** Includes *******************************************************************/
+#include <Utilities.h>
+#include "../Allowlist/Allowlist.h"
+#include "../Rules/Rules.h"
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	POLICY_DEFAULT_PATH												*
+*  Purpose:		The default policy file, in the working directory.				*
+********************************************************************************/
+#define POLICY_DEFAULT_PATH ("AntiDuck.policy")
+
+/********************************************************************************
+*  Constant:	POLICY_FILE_MAGIC												*
+*  Purpose:		The policy file signature (8 characters).						*
+********************************************************************************/
+#define POLICY_FILE_MAGIC ("ADPOLICY")
+
+/********************************************************************************
+*  Constant:	POLICY_FORMAT_VERSION											*
+*  Purpose:		The policy file format version. Files of any other version are	*
+*				rejected.														*
+********************************************************************************/
+#define POLICY_FORMAT_VERSION (2)
+
+/********************************************************************************
+*  Constant:	POLICY_MAX_READERS												*
+*  Purpose:		Maximal number of threads reading the policy.					*
+********************************************************************************/
+#define POLICY_MAX_READERS (4)
+
+/********************************************************************************
+*  Constant:	POLICY_STATS_READER												*
+*  Purpose:		The reader index reserved for POLICY_GetStats.					*
+********************************************************************************/
+#define POLICY_STATS_READER (POLICY_MAX_READERS - 1)
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Structure:	POLICY_FILE_HEADER												*
+*  Purpose:		The policy file header.											*
+*  Remarks:		* Little endian, and used in place, so sections are 8-byte		*
+*					aligned.													*
+*				* The checksum is a CRC-32 of everything after it, up to		*
+*					qwFileSize.													*
+*				* The allowlist section is the ALLOWLIST slot array as-is.		*
+*				* The rules section is a compiled rule table (RULES_Compile)	*
+*					as-is, and may be missing.									*
+********************************************************************************/
+typedef struct _POLICY_FILE_HEADER
+{
+	CHAR acMagic[8];								// POLICY_FILE_MAGIC
+	DWORD dwChecksum;								// CRC-32 of the rest of the file
+	DWORD dwFormatVersion;							// POLICY_FORMAT_VERSION
+	ULONGLONG qwFileSize;							// Size of the whole file
+	ULONGLONG qwRevision;							// Publisher's revision, only ever increases
+	ULONGLONG qwAllowlistOffset;					// Allowlist slots, from the file start
+	DWORD dwAllowlistSlots;							// Number of slots (a power of 2)
+	DWORD dwAllowlistEntries;						// Number of occupied slots
+	ULONGLONG qwRulesOffset;						// Rule table, from the file start, or 0
+	ULONGLONG qwRulesSize;							// Size of the rule table, or 0
+} POLICY_FILE_HEADER, *PPOLICY_FILE_HEADER;
+typedef const POLICY_FILE_HEADER *PCPOLICY_FILE_HEADER;
+
+/********************************************************************************
+*  Structure:	POLICY_VIEW														*
+*  Purpose:		A validated, mapped policy file.								*
+*  Remarks:		* tAllowlist and tRules point into the mapping and are			*
+*					read-only. Never ALLOWLIST_Destroy the allowlist.			*
+********************************************************************************/
+typedef struct _POLICY_VIEW
+{
+	ULONGLONG qwRevision;							// The file's revision
+	ALLOWLIST tAllowlist;							// Approved devices
+	RULES_TABLE tRules;								// Compiled rules (zeroed without rules)
+	PCPOLICY_FILE_HEADER ptHeader;					// The mapping
+	SIZE_T cbMapping;								// The mapping size
+} POLICY_VIEW, *PPOLICY_VIEW;
+typedef const POLICY_VIEW *PCPOLICY_VIEW;
+
+/********************************************************************************
+*  Structure:	POLICY_READER													*
+*  Purpose:		The view a reader currently uses (a hazard pointer).			*
+********************************************************************************/
+typedef struct _POLICY_READER
+{
+	PPOLICY_VIEW volatile ptView;					// The view in use, or NULL
+	BYTE abPadding[CACHE_LINE_SIZE];				// Keeps readers off each other's cache line
+} POLICY_READER, *PPOLICY_READER;
+
+/********************************************************************************
+*  Structure:	POLICY_STATS													*
+*  Purpose:		Policy counters.												*
+********************************************************************************/
+typedef struct _POLICY_STATS
+{
+	ULONGLONG qwRevision;							// Current revision (0 without a policy)
+	DWORD dwAllowlistEntries;						// Current approved devices
+	DWORD dwRules;									// Current rules
+	DWORD dwReloads;								// Views swapped in since started
+	DWORD dwRejected;								// Missing or invalid files since started
+} POLICY_STATS, *PPOLICY_STATS;
+
+/********************************************************************************
+*  Structure:	POLICY															*
+*  Purpose:		The current policy view and its reload watcher.					*
+*  Remarks:		* Readers never lock. The watcher publishes a new view with a	*
+*					single pointer store, then reclaims the old view once no	*
+*					reader uses it (RCU-style).									*
+********************************************************************************/
+typedef struct _POLICY
+{
+	PPOLICY_VIEW volatile ptCurrent;				// The published view, or NULL
+	BYTE abPadding[CACHE_LINE_SIZE];				// Keeps readers off the watcher's fields
+	POLICY_READER atReaders[POLICY_MAX_READERS];	// Views in use, by reader index
+	CHAR szPath[MAX_PATH];							// The policy file
+	HANDLE hWatcher;								// Reloads on file change
+#ifdef _WIN32
+	HANDLE hChange;									// Directory change notification
+	HANDLE hStopEvent;								// Signalled by POLICY_Stop
+#else	// _WIN32
+	INT nNotify;									// inotify on the file's directory
+	INT nStopEvent;									// eventfd signalled by POLICY_Stop
+#endif	// _WIN32
+	volatile LONG nReloads;							// Views swapped in
+	volatile LONG nRejected;						// Missing or invalid files
+} POLICY, *PPOLICY;
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	POLICY_MapView													*
+*  Purpose:		Maps and validates a policy file.								*
+*  Parameters:	@ pszPath ~[in]~ The file.										*
+*				@ pptView ~[out]~ Gets the view.								*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Nothing is copied, the allowlist and rules are used from the	*
+*					mapping.													*
+*				* Validates the header, the checksum, the rule table and that	*
+*					every probe sequence ends, so a bad file can never hang		*
+*					a reader.													*
+*				* Free with POLICY_UnmapView.									*
+********************************************************************************/
+RETSTATUS
+POLICY_MapView(
+	__in_z PCSTR pszPath,
+	__out PPOLICY_VIEW *pptView
+);
+
+/********************************************************************************
+*  Function:	POLICY_UnmapView												*
+*  Purpose:		Unmaps a view.													*
+*  Parameters:	@ ptView ~[in]~ The view, or NULL.								*
+********************************************************************************/
+VOID
+POLICY_UnmapView(
+	__in_opt PPOLICY_VIEW ptView
+);
+
+/********************************************************************************
+*  Function:	POLICY_Write													*
+*  Purpose:		Writes a policy file.											*
+*  Parameters:	@ pszPath ~[in]~ The file.										*
+*				@ ptAllowlist ~[in]~ The approved devices.						*
+*				@ pvRules ~[in_opt]~ A compiled rule table, or NULL.			*
+*				@ cbRules ~[in]~ Its size.										*
+*				@ qwRevision ~[in]~ The revision, greater than any earlier one.	*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Writes a temporary file next to it and renames it over the	*
+*					file, so readers never see a partial file.					*
+********************************************************************************/
+RETSTATUS
+POLICY_Write(
+	__in_z PCSTR pszPath,
+	__in PCALLOWLIST ptAllowlist,
+	__in_bcount_opt(cbRules) PCVOID pvRules,
+	__in SIZE_T cbRules,
+	__in ULONGLONG qwRevision
+);
+
+/********************************************************************************
+*  Function:	POLICY_Start													*
+*  Purpose:		Loads the policy file and reloads it whenever it changes.		*
+*  Parameters:	@ pszPath ~[in]~ The file (need not exist yet).					*
+*				@ ptPolicy ~[out]~ Gets the policy.								*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* A missing or invalid file leaves no view until a valid one	*
+*					is written.													*
+*				* On failure, the policy stays usable but never reloads.		*
+*				* Stop with POLICY_Stop.										*
+********************************************************************************/
+RETSTATUS
+POLICY_Start(
+	__in_z PCSTR pszPath,
+	__out PPOLICY ptPolicy
+);
+
+/********************************************************************************
+*  Function:	POLICY_Stop														*
+*  Purpose:		Stops reloading and unmaps the current view.					*
+*  Parameters:	@ ptPolicy ~[inout]~ The policy, after POLICY_Start (even a		*
+*				failed one).													*
+*  Remarks:		* No reader may be inside POLICY_Enter and POLICY_Leave.		*
+********************************************************************************/
+VOID
+POLICY_Stop(
+	__inout PPOLICY ptPolicy
+);
+
+/********************************************************************************
+*  Function:	POLICY_Reload													*
+*  Purpose:		Maps the policy file and swaps it in if its revision is newer.	*
+*  Parameters:	@ ptPolicy ~[inout]~ The policy.								*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Waits until no reader uses the old view, then unmaps it.		*
+*				* Reload and reclaim times go to the policy-reload and			*
+*					policy-reclaim metrics.										*
+*				* Called by the watcher, only call it directly when the			*
+*					watcher is not running.										*
+********************************************************************************/
+RETSTATUS
+POLICY_Reload(
+	__inout PPOLICY ptPolicy
+);
+
+/********************************************************************************
+*  Function:	POLICY_GetStats													*
+*  Purpose:		Gets the policy counters.										*
+*  Parameters:	@ ptPolicy ~[inout]~ The policy.								*
+*				@ ptStats ~[out]~ Gets the counters.							*
+*  Remarks:		* Reads the view as reader POLICY_STATS_READER, so only call it	*
+*					from one thread at a time.									*
+********************************************************************************/
+VOID
+POLICY_GetStats(
+	__inout PPOLICY ptPolicy,
+	__out PPOLICY_STATS ptStats
+);
+
+/********************************************************************************
+*  Function:	POLICY_Enter													*
+*  Purpose:		Gets the current view for reading.								*
+*  Parameters:	@ ptPolicy ~[inout]~ The policy.								*
+*				@ dwReader ~[in]~ The calling thread's reader index (below		*
+*				POLICY_STATS_READER, one thread per index).						*
+*  Returns:		The view, or NULL without a policy.								*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+*				* Defined as static and inline to be included in object files.	*
+*				* The view stays valid until POLICY_Leave, so keep the section	*
+*					short and never block in it.								*
+********************************************************************************/
+static
+__inline
+PCPOLICY_VIEW
+POLICY_Enter(
+	__inout PPOLICY ptPolicy,
+	__in DWORD dwReader
+)
+{
+	PPOLICY_VIEW ptView = NULL;
+
+	// Announce the view, then make sure it was not replaced before the announcement was visible
+	do
+	{
+		ptView = ATOMIC_LOAD_ACQUIRE_POINTER(&(ptPolicy->ptCurrent));
+		ATOMIC_STORE_RELEASE_POINTER(&(ptPolicy->atReaders[dwReader].ptView), ptView);
+		ATOMIC_FULL_BARRIER();
+	} while (ptView != ATOMIC_LOAD_ACQUIRE_POINTER(&(ptPolicy->ptCurrent)));
+
+	// Return result
+	return ptView;
+}
+
+/********************************************************************************
+*  Function:	POLICY_Leave													*
+*  Purpose:		Ends reading the view from POLICY_Enter.						*
+*  Parameters:	@ ptPolicy ~[inout]~ The policy.								*
+*				@ dwReader ~[in]~ The reader index given to POLICY_Enter.		*
+*  Remarks:		* Defined as static and inline to be included in object files.	*
+********************************************************************************/
+static
+__inline
+VOID
+POLICY_Leave(
+	__inout PPOLICY ptPolicy,
+	__in DWORD dwReader
+)
+{
+	ATOMIC_STORE_RELEASE_POINTER(&(ptPolicy->atReaders[dwReader].ptView), NULL);
+}
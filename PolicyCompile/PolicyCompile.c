@@ -0,0 +1,123 @@
+/********************************************************************************
+*  File:		PolicyCompile.c													*
+*  Purpose:		Compiles an allowlist text file, and optionally a rules file,	*
+*				into a policy file (see Policy/Policy.h).						*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#include <Utilities.h>
+#include "../Allowlist/Allowlist.h"
+#include "../Policy/Policy.h"
+#include "../Rules/Rules.h"
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	main															*
+*  Purpose:		Compiles an allowlist text file into a policy file.				*
+*  Returns:		Zero on success.												*
+*  Remarks:		* Usage: antiduck-policycompile [-r rules file] <allowlist		*
+*					file> <revision> [policy file]								*
+*				* The policy file is replaced in one step, so a running			*
+*					notifier picks it up as-is.									*
+*				* A rules file is compiled into a decision table, see			*
+*					Rules/Rules.h for its syntax.								*
+********************************************************************************/
+INT
+main(
+	__in INT nArgs,
+	__in_ecount(nArgs) PSTR* ppszArgs
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	ALLOWLIST tAllowlist = { 0 };
+	RULES_LIST tRules = { 0 };
+	PVOID pvTable = NULL;
+	SIZE_T cbTable = 0;
+	PPOLICY_VIEW ptView = NULL;
+	PCSTR pszRulesPath = NULL;
+	PCSTR pszPolicyPath = POLICY_DEFAULT_PATH;
+	ULONGLONG qwRevision = 0;
+	PSTR pszEnd = NULL;
+	INT nArg = 1;
+
+	// Validations
+	if ((nArg + 1 < nArgs) && (0 == strcmp(ppszArgs[nArg], "-r")))
+	{
+		pszRulesPath = ppszArgs[nArg + 1];
+		nArg += 2;
+	}
+	if ((nArg + 2 != nArgs) && (nArg + 3 != nArgs))
+	{
+		(VOID)fprintf(stderr, "Usage: %s [-r rules file] <allowlist file> <revision> [policy file]\n", ppszArgs[0]);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	qwRevision = strtoull(ppszArgs[nArg + 1], &pszEnd, DECIMAL_BASE);
+	if ((0 == qwRevision) || ('\0' != *pszEnd))
+	{
+		(VOID)fprintf(stderr, "%s is not a revision (a positive decimal number).\n", ppszArgs[nArg + 1]);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	if (nArg + 3 == nArgs)
+	{
+		pszPolicyPath = ppszArgs[nArg + 2];
+	}
+
+	// Compile
+	eStatus = ALLOWLIST_Load(ppszArgs[nArg], &tAllowlist);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		(VOID)fprintf(stderr, "Cannot load %s.\n", ppszArgs[nArg]);
+		goto lblCleanup;
+	}
+	if (NULL != pszRulesPath)
+	{
+		eStatus = RULES_Load(pszRulesPath, &tRules);
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			(VOID)fprintf(stderr, "Cannot load %s.\n", pszRulesPath);
+			goto lblCleanup;
+		}
+		eStatus = RULES_Compile(&tRules, &pvTable, &cbTable);
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			(VOID)fprintf(stderr, "Cannot compile %s (too many distinct conditions?).\n", pszRulesPath);
+			goto lblCleanup;
+		}
+	}
+	eStatus = POLICY_Write(pszPolicyPath, &tAllowlist, pvTable, cbTable, qwRevision);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		(VOID)fprintf(stderr, "Cannot write %s.\n", pszPolicyPath);
+		goto lblCleanup;
+	}
+
+	// Read it back the way the notifier will
+	eStatus = POLICY_MapView(pszPolicyPath, &ptView);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		(VOID)fprintf(stderr, "%s does not verify.\n", pszPolicyPath);
+		goto lblCleanup;
+	}
+	(VOID)printf("%s: revision %llu, %lu approved devices, %lu rules (%llu bytes)\n",
+		pszPolicyPath,
+		ptView->qwRevision,
+		(unsigned long)ptView->tAllowlist.dwEntries,
+		(unsigned long)((NULL != ptView->tRules.ptHeader) ? ptView->tRules.ptHeader->dwRules : 0),
+		(ULONGLONG)cbTable);
+
+lblCleanup:
+
+	// Free resources
+	POLICY_UnmapView(ptView);
+	FREE(pvTable);
+	RULES_Destroy(&tRules);
+	ALLOWLIST_Destroy(&tAllowlist);
+
+	// Return result
+	return RETSTATUS_FAILED(eStatus) ? 1 : 0;
+}
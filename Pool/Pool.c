@@ -0,0 +1,302 @@
+/********************************************************************************
+*  File:		Pool.c															*
+*  Purpose:		Fixed-size block pools carved out of slabs, alone or as size	*
+*				classes.														*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#include "Pool.h"
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	POOL_SLAB_HEADER_BYTES											*
+*  Purpose:		Bytes at the start of each slab that link it to the next one,	*
+*				keeping the blocks aligned.										*
+********************************************************************************/
+#define POOL_SLAB_HEADER_BYTES (POOL_ALIGNMENT)
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	pool_Grow														*
+*  Purpose:		Takes a slab from the heap and frees all of its blocks.			*
+*  Parameters:	@ ptPool ~[inout]~ The pool, with an empty free list.			*
+*  Returns:		TRUE on success, FALSE if the heap is out of memory.			*
+********************************************************************************/
+static
+BOOL
+pool_Grow(
+	__inout PPOOL ptPool
+)
+{
+	PBYTE pbSlab = NULL;
+	PBYTE pbBlock = NULL;
+	ULONG dwBlock = 0;
+
+	// A zeroed slab, so first-time blocks need no clearing
+	pbSlab = (PBYTE)ALLOCZ(POOL_SLAB_HEADER_BYTES + ((SIZE_T)ptPool->dwBlocksPerSlab * ptPool->cbStride));
+	if (NULL == pbSlab)
+	{
+		DEBUG_MSG(LOG_SEV_ERROR, "ALLOCZ() failure.");
+		return FALSE;
+	}
+	*(PVOID *)pbSlab = ptPool->pvSlabs;
+	ptPool->pvSlabs = pbSlab;
+	ptPool->dwSlabs++;
+
+	// Link the blocks in address order, so they are handed out sequentially
+	pbBlock = pbSlab + POOL_SLAB_HEADER_BYTES + ((SIZE_T)ptPool->dwBlocksPerSlab * ptPool->cbStride);
+	for (dwBlock = 0; dwBlock < ptPool->dwBlocksPerSlab; dwBlock++)
+	{
+		pbBlock -= ptPool->cbStride;
+		((PPOOL_BLOCK)pbBlock)->ptNext = ptPool->ptFree;
+		ptPool->ptFree = (PPOOL_BLOCK)pbBlock;
+	}
+	return TRUE;
+}
+
+/********************************************************************************
+*  Function:	pool_GetClass													*
+*  Purpose:		Finds the size class of a blob.									*
+*  Parameters:	@ ptClasses ~[in]~ The size classes.							*
+*				@ cbBytes ~[in]~ The blob size.									*
+*				@ pcbClass ~[out]~ Gets the size class's block size.			*
+*  Returns:		The size class's pool, or NULL if the blob is too large.		*
+********************************************************************************/
+static
+PPOOL
+pool_GetClass(
+	__in PPOOL_CLASSES ptClasses,
+	__in SIZE_T cbBytes,
+	__out PSIZE_T pcbClass
+)
+{
+	ULONG dwClass = 0;
+
+	// Steps of the alignment, then powers of 2
+	if (POOL_SMALL_CLASS_BYTES >= cbBytes)
+	{
+		dwClass = (ULONG)((MAX(cbBytes, 1) - 1) / POOL_ALIGNMENT);
+		*pcbClass = ((SIZE_T)dwClass + 1) * POOL_ALIGNMENT;
+	}
+	else
+	{
+		dwClass = POOL_SMALL_CLASS_BYTES / POOL_ALIGNMENT;
+		for (*pcbClass = POOL_SMALL_CLASS_BYTES * 2; (*pcbClass < cbBytes) && (POOL_CLASS_COUNT > dwClass); *pcbClass *= 2)
+		{
+			dwClass++;
+		}
+	}
+	return (POOL_CLASS_COUNT > dwClass) ? &(ptClasses->atClasses[dwClass]) : NULL;
+}
+
+/********************************************************************************
+*  Function:	POOL_Alloc														*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+********************************************************************************/
+PVOID
+POOL_Alloc(
+	__inout PPOOL ptPool,
+	__in SIZE_T cbBlock
+)
+{
+	PPOOL_BLOCK ptBlock = NULL;
+
+	// Validations
+	ASSERT(NULL != ptPool);
+	ASSERT((0 != cbBlock) && (POOL_SLAB_BYTES - POOL_SLAB_HEADER_BYTES >= cbBlock));
+
+	// The first allocation fixes the block size
+	if (0 == ptPool->cbStride)
+	{
+		ptPool->cbStride = (ULONG)((MAX(cbBlock, sizeof(POOL_BLOCK)) + POOL_ALIGNMENT - 1) & ~(SIZE_T)(POOL_ALIGNMENT - 1));
+		ptPool->dwBlocksPerSlab = (POOL_SLAB_BYTES - POOL_SLAB_HEADER_BYTES) / ptPool->cbStride;
+	}
+	ASSERT(ptPool->cbStride >= cbBlock);
+
+	// Take the most recently freed block, growing only when none is left
+	if ((NULL == ptPool->ptFree) && (!pool_Grow(ptPool)))
+	{
+		ptPool->qwFailures++;
+		return NULL;
+	}
+	ptBlock = ptPool->ptFree;
+	ptPool->ptFree = ptBlock->ptNext;
+	RtlZeroMemory(ptBlock, ptPool->cbStride);
+
+	// Account for it
+	ptPool->qwAllocations++;
+	ptPool->dwInUse++;
+	if (ptPool->dwInUse > ptPool->dwPeakInUse)
+	{
+		ptPool->dwPeakInUse = ptPool->dwInUse;
+	}
+	return ptBlock;
+}
+
+/********************************************************************************
+*  Function:	POOL_Free														*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+********************************************************************************/
+VOID
+POOL_Free(
+	__inout PPOOL ptPool,
+	__in PVOID pvBlock
+)
+{
+	// Validations
+	ASSERT(NULL != ptPool);
+	ASSERT(NULL != pvBlock);
+	ASSERT(0 != ptPool->dwInUse);
+
+	// Push it, it is the warmest
+	((PPOOL_BLOCK)pvBlock)->ptNext = ptPool->ptFree;
+	ptPool->ptFree = (PPOOL_BLOCK)pvBlock;
+	ptPool->dwInUse--;
+}
+
+/********************************************************************************
+*  Function:	POOL_Finalize													*
+********************************************************************************/
+VOID
+POOL_Finalize(
+	__inout PPOOL ptPool
+)
+{
+	PVOID pvSlab = NULL;
+
+	// Validations
+	ASSERT(NULL != ptPool);
+
+	// Free resources
+	while (NULL != ptPool->pvSlabs)
+	{
+		pvSlab = ptPool->pvSlabs;
+		ptPool->pvSlabs = *(PVOID *)pvSlab;
+		FREE(pvSlab);
+	}
+	RtlZeroMemory(ptPool, sizeof(*ptPool));
+}
+
+/********************************************************************************
+*  Function:	POOL_GetStats													*
+********************************************************************************/
+VOID
+POOL_GetStats(
+	__in PPOOL ptPool,
+	__out PPOOL_STATS ptStats
+)
+{
+	// Validations
+	ASSERT(NULL != ptPool);
+	ASSERT(NULL != ptStats);
+
+	ptStats->cbBlock = ptPool->cbStride;
+	ptStats->dwSlabs = ptPool->dwSlabs;
+	ptStats->dwInUse = ptPool->dwInUse;
+	ptStats->dwPeakInUse = ptPool->dwPeakInUse;
+	ptStats->qwAllocations = ptPool->qwAllocations;
+	ptStats->qwFailures = ptPool->qwFailures;
+}
+
+/********************************************************************************
+*  Function:	POOL_AllocSized													*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+********************************************************************************/
+PVOID
+POOL_AllocSized(
+	__inout PPOOL_CLASSES ptClasses,
+	__in SIZE_T cbBytes
+)
+{
+	PPOOL ptPool = NULL;
+	SIZE_T cbClass = 0;
+
+	// Validations
+	ASSERT(NULL != ptClasses);
+
+	// Every block of a class has the class size, whoever asks first
+	ptPool = pool_GetClass(ptClasses, cbBytes, &cbClass);
+	if (NULL == ptPool)
+	{
+		return ALLOCZ(cbBytes);
+	}
+	return POOL_Alloc(ptPool, cbClass);
+}
+
+/********************************************************************************
+*  Function:	POOL_FreeSized													*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+********************************************************************************/
+VOID
+POOL_FreeSized(
+	__inout PPOOL_CLASSES ptClasses,
+	__in PVOID pvBlob,
+	__in SIZE_T cbBytes
+)
+{
+	PPOOL ptPool = NULL;
+	SIZE_T cbClass = 0;
+
+	// Validations
+	ASSERT(NULL != ptClasses);
+	ASSERT(NULL != pvBlob);
+
+	ptPool = pool_GetClass(ptClasses, cbBytes, &cbClass);
+	if (NULL == ptPool)
+	{
+		FREE(pvBlob);
+		return;
+	}
+	POOL_Free(ptPool, pvBlob);
+}
+
+/********************************************************************************
+*  Function:	POOL_FinalizeClasses											*
+********************************************************************************/
+VOID
+POOL_FinalizeClasses(
+	__inout PPOOL_CLASSES ptClasses
+)
+{
+	DWORD dwClass = 0;
+
+	// Validations
+	ASSERT(NULL != ptClasses);
+
+	// Free resources
+	for (dwClass = 0; dwClass < POOL_CLASS_COUNT; dwClass++)
+	{
+		POOL_Finalize(&(ptClasses->atClasses[dwClass]));
+	}
+}
+
+/********************************************************************************
+*  Function:	POOL_GetClassStats												*
+********************************************************************************/
+VOID
+POOL_GetClassStats(
+	__in PPOOL_CLASSES ptClasses,
+	__in SIZE_T cbBytes,
+	__out PPOOL_STATS ptStats
+)
+{
+	PPOOL ptPool = NULL;
+	SIZE_T cbClass = 0;
+
+	// Validations
+	ASSERT(NULL != ptClasses);
+	ASSERT(NULL != ptStats);
+
+	ptPool = pool_GetClass(ptClasses, cbBytes, &cbClass);
+	if (NULL == ptPool)
+	{
+		RtlZeroMemory(ptStats, sizeof(*ptStats));
+		return;
+	}
+	POOL_GetStats(ptPool, ptStats);
+}
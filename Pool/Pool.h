@@ -0,0 +1,241 @@
+/********************************************************************************
+*  File:		Pool.h															*
+*  Purpose:		Fixed-size block pools carved out of slabs, alone or as size	*
+*				classes.														*
+********************************************************************************/
+#pragma once
+
+
+/** Includes *******************************************************************/
+#include <Utilities.h>
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	POOL_SLAB_BYTES													*
+*  Purpose:		Bytes taken from the heap at a time.							*
+********************************************************************************/
+#define POOL_SLAB_BYTES (4096)
+
+/********************************************************************************
+*  Constant:	POOL_ALIGNMENT													*
+*  Purpose:		Alignment of every block, as the heap guarantees.				*
+*  Remarks:		* Must be a power of 2.											*
+********************************************************************************/
+#define POOL_ALIGNMENT (16)
+
+/********************************************************************************
+*  Constant:	POOL_SMALL_CLASS_BYTES											*
+*  Purpose:		Size classes step by POOL_ALIGNMENT up to here, then double.	*
+********************************************************************************/
+#define POOL_SMALL_CLASS_BYTES (256)
+
+/********************************************************************************
+*  Constant:	POOL_MAX_CLASS_BYTES											*
+*  Purpose:		The largest size class, larger blobs come from the heap.		*
+*  Remarks:		* Keeps at least 3 blocks per slab.								*
+********************************************************************************/
+#define POOL_MAX_CLASS_BYTES (1024)
+
+/********************************************************************************
+*  Constant:	POOL_CLASS_COUNT												*
+*  Purpose:		Number of size classes (16 to 256 bytes, 512 and 1024 bytes).	*
+********************************************************************************/
+#define POOL_CLASS_COUNT ((POOL_SMALL_CLASS_BYTES / POOL_ALIGNMENT) + 2)
+
+
+/** Macros *********************************************************************/
+
+/********************************************************************************
+*  Macro:		POOL_FREE														*
+*  Purpose:		Gives a block back to its pool, like FREE.						*
+*  Parameters:	@ ptPool ~[inout]~ The pool the block came from.				*
+*				@ pvMem ~[inout]~ The block, or NULL. Set to NULL.				*
+********************************************************************************/
+#define POOL_FREE(ptPool, pvMem)		FORCE_SEMICOLON_START									\
+										if (NULL != (pvMem))									\
+										{														\
+											POOL_Free((ptPool), (pvMem));						\
+											(pvMem) = NULL;										\
+										}														\
+										FORCE_SEMICOLON_END
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Structure:	POOL_BLOCK														*
+*  Purpose:		A free block, linked in place.									*
+********************************************************************************/
+typedef struct _POOL_BLOCK
+{
+	struct _POOL_BLOCK *ptNext;						// Next free block, or NULL
+} POOL_BLOCK, *PPOOL_BLOCK;
+
+/********************************************************************************
+*  Structure:	POOL															*
+*  Purpose:		A pool of blocks of a single size, owned by a single thread.	*
+*  Remarks:		* Blocks are handed out from a LIFO free list, so the most		*
+*					recently freed (and cache-warm) block is reused first.		*
+*				* Slabs are only returned to the heap by POOL_Finalize, so		*
+*					churn never reaches the heap once the peak is reached.		*
+*				* A zeroed pool is valid, the block size is fixed by the first	*
+*					allocation.													*
+*				* Each thread that needs blocks owns its own pool, so there		*
+*					are no locks; counters may be read from any thread.			*
+********************************************************************************/
+typedef struct _POOL
+{
+	PPOOL_BLOCK ptFree;								// Free blocks
+	PVOID pvSlabs;									// Slabs, linked through their first bytes
+	ULONG cbStride;									// Block size with padding, or 0
+	ULONG dwBlocksPerSlab;							// Blocks carved out of each slab
+	volatile ULONG dwSlabs;							// Slabs taken from the heap
+	volatile ULONG dwInUse;							// Blocks handed out
+	volatile ULONG dwPeakInUse;						// Most blocks handed out at once
+	volatile ULONGLONG qwAllocations;				// Blocks ever handed out
+	volatile ULONGLONG qwFailures;					// Allocations that found no memory
+} POOL, *PPOOL;
+
+/********************************************************************************
+*  Structure:	POOL_CLASSES													*
+*  Purpose:		Pools for blobs of any size up to POOL_MAX_CLASS_BYTES, each	*
+*				rounded up to its size class.									*
+*  Remarks:		* The allocator behind ALLOCZ_POOLED and FREE_POOLED.			*
+*				* Owned by a single thread, like POOL. A zeroed one is valid.	*
+********************************************************************************/
+typedef struct _POOL_CLASSES
+{
+	POOL atClasses[POOL_CLASS_COUNT];				// By size class, smallest first
+} POOL_CLASSES, *PPOOL_CLASSES;
+
+/********************************************************************************
+*  Structure:	POOL_STATS														*
+*  Purpose:		A snapshot of the pool's counters.								*
+*  Remarks:		* Counters may be slightly stale, as they are read while the	*
+*					pool is in use.												*
+********************************************************************************/
+typedef struct _POOL_STATS
+{
+	ULONG cbBlock;									// Block size with padding, or 0
+	ULONG dwSlabs;									// Slabs taken from the heap
+	ULONG dwInUse;									// Blocks handed out
+	ULONG dwPeakInUse;								// Most blocks handed out at once
+	ULONGLONG qwAllocations;						// Blocks ever handed out
+	ULONGLONG qwFailures;							// Allocations that found no memory
+} POOL_STATS, *PPOOL_STATS;
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	POOL_Alloc														*
+*  Purpose:		Gets a zeroed block, like ALLOCZ.								*
+*  Parameters:	@ ptPool ~[inout]~ The pool (initially zeroed).					*
+*				@ cbBlock ~[in]~ The block size, the same on every call.		*
+*  Returns:		The block, or NULL if no memory is left.						*
+*  Remarks:		* Only goes to the heap when every slab is in use.				*
+*				* Free with POOL_FREE.											*
+********************************************************************************/
+PVOID
+POOL_Alloc(
+	__inout PPOOL ptPool,
+	__in SIZE_T cbBlock
+);
+
+/********************************************************************************
+*  Function:	POOL_Free														*
+*  Purpose:		Gives a block back to its pool.									*
+*  Parameters:	@ ptPool ~[inout]~ The pool the block came from.				*
+*				@ pvBlock ~[in]~ The block.										*
+*  Remarks:		* Prefer POOL_FREE, which also clears the pointer.				*
+********************************************************************************/
+VOID
+POOL_Free(
+	__inout PPOOL ptPool,
+	__in PVOID pvBlock
+);
+
+/********************************************************************************
+*  Function:	POOL_Finalize													*
+*  Purpose:		Returns every slab to the heap.									*
+*  Parameters:	@ ptPool ~[inout]~ The pool (initially zeroed).					*
+*  Remarks:		* Blocks still handed out become invalid.						*
+*				* Leaves the pool zeroed, so it may be used again.				*
+********************************************************************************/
+VOID
+POOL_Finalize(
+	__inout PPOOL ptPool
+);
+
+/********************************************************************************
+*  Function:	POOL_GetStats													*
+*  Purpose:		Gets the pool's usage and counters.								*
+*  Parameters:	@ ptPool ~[in]~ The pool.										*
+*				@ ptStats ~[out]~ Gets the counters.							*
+*  Remarks:		* May be called from any thread.								*
+********************************************************************************/
+VOID
+POOL_GetStats(
+	__in PPOOL ptPool,
+	__out PPOOL_STATS ptStats
+);
+
+/********************************************************************************
+*  Function:	POOL_AllocSized													*
+*  Purpose:		Gets a zeroed blob from its size class.							*
+*  Parameters:	@ ptClasses ~[inout]~ The size classes (initially zeroed).		*
+*				@ cbBytes ~[in]~ The blob size.									*
+*  Returns:		The blob, or NULL if no memory is left.							*
+*  Remarks:		* Prefer ALLOCZ_POOLED.											*
+*				* Blobs larger than POOL_MAX_CLASS_BYTES come from ALLOCZ.		*
+********************************************************************************/
+PVOID
+POOL_AllocSized(
+	__inout PPOOL_CLASSES ptClasses,
+	__in SIZE_T cbBytes
+);
+
+/********************************************************************************
+*  Function:	POOL_FreeSized													*
+*  Purpose:		Gives a blob back to its size class.							*
+*  Parameters:	@ ptClasses ~[inout]~ The size classes it came from.			*
+*				@ pvBlob ~[in]~ The blob.										*
+*				@ cbBytes ~[in]~ The size it was allocated with.				*
+*  Remarks:		* Prefer FREE_POOLED, which also clears the pointer.			*
+********************************************************************************/
+VOID
+POOL_FreeSized(
+	__inout PPOOL_CLASSES ptClasses,
+	__in PVOID pvBlob,
+	__in SIZE_T cbBytes
+);
+
+/********************************************************************************
+*  Function:	POOL_FinalizeClasses											*
+*  Purpose:		Returns every slab of every size class to the heap.				*
+*  Parameters:	@ ptClasses ~[inout]~ The size classes (initially zeroed).		*
+*  Remarks:		* Blobs still handed out become invalid.						*
+*				* Leaves the size classes zeroed, so they may be used again.	*
+********************************************************************************/
+VOID
+POOL_FinalizeClasses(
+	__inout PPOOL_CLASSES ptClasses
+);
+
+/********************************************************************************
+*  Function:	POOL_GetClassStats												*
+*  Purpose:		Gets the usage and counters of the size class for a size.		*
+*  Parameters:	@ ptClasses ~[in]~ The size classes.							*
+*				@ cbBytes ~[in]~ The blob size.									*
+*				@ ptStats ~[out]~ Gets the counters, zeroed if the size has no	*
+*				class.															*
+*  Remarks:		* May be called from any thread.								*
+********************************************************************************/
+VOID
+POOL_GetClassStats(
+	__in PPOOL_CLASSES ptClasses,
+	__in SIZE_T cbBytes,
+	__out PPOOL_STATS ptStats
+);
@@ -0,0 +1,534 @@
+/********************************************************************************
+*  File:		Quarantine.c													*
+*  Purpose:		Holds back the keys of newly arrived keyboards until their		*
+*				cadence is judged, then replays or drops them (POSIX).			*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/uinput.h>
+#endif	// _WIN32
+#include <stdio.h>
+#include "Quarantine.h"
+#include <Clock.h>
+
+#ifndef _WIN32
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	QUARANTINE_KEY_REPEAT											*
+*  Purpose:		The value of a key record that repeats a pressed key.			*
+********************************************************************************/
+#define QUARANTINE_KEY_REPEAT (2)
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	quarantine_Emit													*
+*  Purpose:		Adds a key event and its report to the output buffer.			*
+*  Parameters:	@ ptQuarantine ~[inout]~ The quarantine state.					*
+*				@ ptDevice ~[inout]~ The keyboard it comes from.				*
+*				@ wKeyCode ~[in]~ Its key code.									*
+*				@ wValue ~[in]~ Its value.										*
+*  Remarks:		* Replayed times are the kernel's, the records carry none.		*
+********************************************************************************/
+static
+__inline
+VOID
+quarantine_Emit(
+	__inout PQUARANTINE ptQuarantine,
+	__inout PQUARANTINE_DEVICE ptDevice,
+	__in WORD wKeyCode,
+	__in WORD wValue
+)
+{
+	struct input_event *ptRecord = &(ptQuarantine->atRecords[ptQuarantine->dwRecords]);
+
+	ASSERT(sizeof(ptQuarantine->atRecords) / sizeof(ptQuarantine->atRecords[0]) >= ptQuarantine->dwRecords + 2);
+
+	RtlZeroMemory(ptRecord, sizeof(*ptRecord) * 2);
+	ptRecord[0].type = EV_KEY;
+	ptRecord[0].code = wKeyCode;
+	ptRecord[0].value = wValue;
+	ptRecord[1].type = EV_SYN;
+	ptRecord[1].code = SYN_REPORT;
+	ptQuarantine->dwRecords += 2;
+
+	// Remember what is down, to release it if the keyboard is blocked
+	if (0 != wValue)
+	{
+		ptDevice->abIsDown[wKeyCode / 8] |= (BYTE)(1 << (wKeyCode % 8));
+	}
+	else
+	{
+		ptDevice->abIsDown[wKeyCode / 8] &= (BYTE)~(1 << (wKeyCode % 8));
+	}
+}
+
+/********************************************************************************
+*  Function:	quarantine_Flush												*
+*  Purpose:		Writes the output buffer in one call.							*
+*  Parameters:	@ ptQuarantine ~[inout]~ The quarantine state.					*
+*  Remarks:		* Records the output refuses are counted as lost.				*
+********************************************************************************/
+static
+VOID
+quarantine_Flush(
+	__inout PQUARANTINE ptQuarantine
+)
+{
+	SIZE_T cbRecords = ptQuarantine->dwRecords * sizeof(ptQuarantine->atRecords[0]);
+	ssize_t cbWritten = 0;
+
+	if (0 == ptQuarantine->dwRecords)
+	{
+		return;
+	}
+	do
+	{
+		cbWritten = write(ptQuarantine->nOutput, ptQuarantine->atRecords, cbRecords);
+	} while ((0 > cbWritten) && (EINTR == errno));
+	if ((SIZE_T)cbWritten != cbRecords)
+	{
+		ptQuarantine->qwLost += (cbRecords - (SIZE_T)MAX(cbWritten, 0)) / (sizeof(ptQuarantine->atRecords[0]) * 2);
+	}
+	ptQuarantine->dwRecords = 0;
+}
+
+/********************************************************************************
+*  Function:	quarantine_Replay												*
+*  Purpose:		Adds a keyboard's oldest held keys to the output buffer.		*
+*  Parameters:	@ ptQuarantine ~[inout]~ The quarantine state.					*
+*				@ ptDevice ~[inout]~ The keyboard.								*
+*				@ qwTypedBefore ~[in]~ Replays the keys typed before this		*
+*				time, or all of them with ~0.									*
+********************************************************************************/
+static
+VOID
+quarantine_Replay(
+	__inout PQUARANTINE ptQuarantine,
+	__inout PQUARANTINE_DEVICE ptDevice,
+	__in ULONGLONG qwTypedBefore
+)
+{
+	PCQUARANTINE_KEY ptKey = NULL;
+
+	while (0 != ptDevice->dwHeld)
+	{
+		ptKey = &(ptDevice->atKeys[ptDevice->dwFirst]);
+		if (ptKey->qwTimestamp >= qwTypedBefore)
+		{
+			break;
+		}
+		quarantine_Emit(ptQuarantine, ptDevice, ptKey->wKeyCode, ptKey->wValue);
+		ptDevice->dwFirst = (ptDevice->dwFirst + 1) % QUARANTINE_MAX_HELD_KEYS;
+		ptDevice->dwHeld--;
+		ptQuarantine->qwReplayed++;
+	}
+}
+
+/********************************************************************************
+*  Function:	quarantine_OnExpiry												*
+*  Purpose:		Replays a keyboard's keys held for QUARANTINE_HOLD_US.			*
+*  Parameters:	@ ptTimer ~[inout]~ The keyboard's timer.						*
+*				@ qwNow ~[in]~ The time.										*
+*				@ pvQuarantine ~[inout]~ The quarantine state.					*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+*				* The keyboard is still held, until judged. The timer is armed	*
+*					again for its next held key.								*
+********************************************************************************/
+static
+VOID
+quarantine_OnExpiry(
+	__inout PTIMERWHEEL_TIMER ptTimer,
+	__in ULONGLONG qwNow,
+	__inout_opt PVOID pvQuarantine
+)
+{
+	PQUARANTINE ptQuarantine = (PQUARANTINE)pvQuarantine;
+	PQUARANTINE_DEVICE ptDevice = (PQUARANTINE_DEVICE)((PBYTE)ptTimer - offsetof(QUARANTINE_DEVICE, tExpiry));
+	ULONGLONG qwHold = (ULONGLONG)QUARANTINE_HOLD_US * NANOSECONDS_IN_MICROSECOND;
+
+	quarantine_Replay(ptQuarantine, ptDevice, (qwNow > qwHold) ? qwNow - qwHold + 1 : 0);
+	quarantine_Flush(ptQuarantine);
+	if (0 != ptDevice->dwHeld)
+	{
+		TIMERWHEEL_Arm(ptQuarantine->ptTimers, ptTimer, ptDevice->atKeys[ptDevice->dwFirst].qwTimestamp + qwHold);
+	}
+}
+
+/********************************************************************************
+*  Function:	quarantine_Drop													*
+*  Purpose:		Drops a keyboard's held keys, and releases those it has			*
+*				pressed.														*
+*  Parameters:	@ ptQuarantine ~[inout]~ The quarantine state.					*
+*				@ ptDevice ~[inout]~ The keyboard.								*
+*  Remarks:		* The keyboard is not held anymore, the caller sets its state.	*
+********************************************************************************/
+static
+VOID
+quarantine_Drop(
+	__inout PQUARANTINE ptQuarantine,
+	__inout PQUARANTINE_DEVICE ptDevice
+)
+{
+	WORD wKeyCode = 0;
+
+	ptQuarantine->qwDropped += ptDevice->dwHeld;
+	ptDevice->dwHeld = 0;
+	TIMERWHEEL_Cancel(ptQuarantine->ptTimers, &(ptDevice->tExpiry));
+	for (wKeyCode = 0; wKeyCode < QUARANTINE_MAX_KEY; wKeyCode++)
+	{
+		if (0 != (ptDevice->abIsDown[wKeyCode / 8] & (1 << (wKeyCode % 8))))
+		{
+			quarantine_Emit(ptQuarantine, ptDevice, wKeyCode, 0);
+		}
+	}
+	if (QUARANTINE_STATE_HOLDING == ptDevice->eState)
+	{
+		ATOMIC_STORE_RELEASE(&(ptQuarantine->nHolding), ptQuarantine->nHolding - 1);
+	}
+}
+
+/********************************************************************************
+*  Function:	quarantine_Block												*
+*  Purpose:		Blocks a keyboard: drops its held keys and later ones.			*
+*  Parameters:	@ ptQuarantine ~[inout]~ The quarantine state.					*
+*				@ ptDevice ~[inout]~ The keyboard.								*
+********************************************************************************/
+static
+VOID
+quarantine_Block(
+	__inout PQUARANTINE ptQuarantine,
+	__inout PQUARANTINE_DEVICE ptDevice
+)
+{
+	quarantine_Drop(ptQuarantine, ptDevice);
+	ptDevice->eState = QUARANTINE_STATE_BLOCKED;
+	ptQuarantine->qwBlockedDevices++;
+	DEBUG_MSG(LOG_SEV_INFO, "Blocked held keyboard %lu.", (unsigned long)(ptDevice->dwHoldId));
+}
+
+/********************************************************************************
+*  Function:	quarantine_FindDevice											*
+*  Purpose:		Finds a keyboard's slot, or takes one for it.					*
+*  Parameters:	@ ptQuarantine ~[inout]~ The quarantine state.					*
+*				@ dwHoldId ~[in]~ Its hold ID.									*
+*  Returns:		The slot, or NULL if every slot holds keys or is blocked.		*
+*  Remarks:		* A new keyboard takes a free slot, or else the slot of the		*
+*					released keyboard that typed least recently (which is held	*
+*					again should it type).										*
+*				* Blocked keyboards keep their slots until detached, so they	*
+*					stay blocked.												*
+********************************************************************************/
+static
+PQUARANTINE_DEVICE
+quarantine_FindDevice(
+	__inout PQUARANTINE ptQuarantine,
+	__in DWORD dwHoldId
+)
+{
+	PQUARANTINE_DEVICE ptDevice = NULL;
+	PQUARANTINE_DEVICE ptVictim = NULL;
+	DWORD dwSlot = 0;
+
+	for (dwSlot = 0; dwSlot < QUARANTINE_MAX_DEVICES; dwSlot++)
+	{
+		ptDevice = &(ptQuarantine->atDevices[dwSlot]);
+		if ((QUARANTINE_STATE_FREE != ptDevice->eState) && (dwHoldId == ptDevice->dwHoldId))
+		{
+			return ptDevice;
+		}
+		if (((QUARANTINE_STATE_FREE == ptDevice->eState) &&
+			((NULL == ptVictim) || (QUARANTINE_STATE_FREE != ptVictim->eState))) ||
+			((QUARANTINE_STATE_RELEASED == ptDevice->eState) &&
+			((NULL == ptVictim) ||
+			((QUARANTINE_STATE_RELEASED == ptVictim->eState) && (ptDevice->qwLastTimestamp < ptVictim->qwLastTimestamp)))))
+		{
+			ptVictim = ptDevice;
+		}
+	}
+
+	// Hold it (only held keyboards have an armed timer)
+	if (NULL != ptVictim)
+	{
+		ASSERT(!TIMERWHEEL_IsArmed(&(ptVictim->tExpiry)));
+		RtlZeroMemory(ptVictim, sizeof(*ptVictim) - sizeof(ptVictim->atKeys));
+		TIMERWHEEL_InitializeTimer(&(ptVictim->tExpiry), quarantine_OnExpiry, ptQuarantine);
+		ptVictim->eState = QUARANTINE_STATE_HOLDING;
+		ptVictim->dwHoldId = dwHoldId;
+		ATOMIC_STORE_RELEASE(&(ptQuarantine->nHolding), ptQuarantine->nHolding + 1);
+		DEBUG_MSG(LOG_SEV_INFO, "Holding keyboard %lu.", (unsigned long)dwHoldId);
+	}
+	return ptVictim;
+}
+
+/********************************************************************************
+*  Function:	QUARANTINE_OpenUinput											*
+********************************************************************************/
+RETSTATUS
+QUARANTINE_OpenUinput(
+	__out PINT pnOutput
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	struct uinput_setup tSetup;
+	INT nOutput = -1;
+	INT nKeyCode = 0;
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != pnOutput);
+
+	nOutput = open(QUARANTINE_UINPUT_PATH, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+	if (0 > nOutput)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"open() failure on '%s' (errno=%d).",
+			QUARANTINE_UINPUT_PATH,
+			errno);
+		goto lblCleanup;
+	}
+
+	// A keyboard with every key, without autorepeat (repeats are replayed as typed)
+	if ((0 > ioctl(nOutput, UI_SET_EVBIT, EV_SYN)) || (0 > ioctl(nOutput, UI_SET_EVBIT, EV_KEY)))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"ioctl(UI_SET_EVBIT) failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+	for (nKeyCode = 1; nKeyCode < QUARANTINE_MAX_KEY; nKeyCode++)
+	{
+		if (0 > ioctl(nOutput, UI_SET_KEYBIT, nKeyCode))
+		{
+			eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+				LOG_SEV_ERROR,
+				"ioctl(UI_SET_KEYBIT) failure (errno=%d).",
+				errno);
+			goto lblCleanup;
+		}
+	}
+	RtlZeroMemory(&tSetup, sizeof(tSetup));
+	tSetup.id.bustype = BUS_VIRTUAL;
+	tSetup.id.vendor = EVENTSOURCE_REPLAY_VENDOR_ID;
+	tSetup.id.product = EVENTSOURCE_REPLAY_PRODUCT_ID;
+	(VOID)snprintf(tSetup.name, sizeof(tSetup.name), "%s", QUARANTINE_DEVICE_NAME);
+	if ((0 > ioctl(nOutput, UI_DEV_SETUP, &tSetup)) || (0 > ioctl(nOutput, UI_DEV_CREATE)))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"ioctl(UI_DEV_CREATE) failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+
+	// Success
+	*pnOutput = nOutput;
+	nOutput = -1;
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	CLOSE_FD(nOutput);
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	QUARANTINE_Initialize											*
+********************************************************************************/
+VOID
+QUARANTINE_Initialize(
+	__in INT nOutput,
+	__inout PTIMERWHEEL ptTimers,
+	__out PQUARANTINE ptQuarantine
+)
+{
+	// Validations
+	ASSERT(NULL != ptTimers);
+	ASSERT(NULL != ptQuarantine);
+
+	RtlZeroMemory(ptQuarantine, sizeof(*ptQuarantine));
+	ptQuarantine->nOutput = nOutput;
+	ptQuarantine->ptTimers = ptTimers;
+}
+
+/********************************************************************************
+*  Function:	QUARANTINE_Finalize												*
+********************************************************************************/
+VOID
+QUARANTINE_Finalize(
+	__inout PQUARANTINE ptQuarantine
+)
+{
+	DWORD dwSlot = 0;
+
+	// Validations
+	ASSERT(NULL != ptQuarantine);
+
+	for (dwSlot = 0; dwSlot < QUARANTINE_MAX_DEVICES; dwSlot++)
+	{
+		if (QUARANTINE_STATE_FREE != ptQuarantine->atDevices[dwSlot].eState)
+		{
+			TIMERWHEEL_Cancel(ptQuarantine->ptTimers, &(ptQuarantine->atDevices[dwSlot].tExpiry));
+		}
+	}
+	CLOSE_FD(ptQuarantine->nOutput);
+}
+
+/********************************************************************************
+*  Function:	QUARANTINE_OnKey												*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+********************************************************************************/
+VOID
+QUARANTINE_OnKey(
+	__inout PQUARANTINE ptQuarantine,
+	__in PCEVENTSOURCE_EVENT ptEvent,
+	__in CADENCE_VERDICT eVerdict,
+	__in BOOL bIsHostile
+)
+{
+	PQUARANTINE_DEVICE ptDevice = NULL;
+	PQUARANTINE_KEY ptKey = NULL;
+	WORD wValue = ptEvent->bIsRepeat ? QUARANTINE_KEY_REPEAT : (ptEvent->bIsKeyDown ? 1 : 0);
+
+	ptDevice = quarantine_FindDevice(ptQuarantine, ptEvent->dwHoldId);
+	if ((NULL == ptDevice) || (QUARANTINE_MAX_KEY <= ptEvent->wKeyCode))
+	{
+		ptQuarantine->qwDropped++;
+		return;
+	}
+	ptDevice->qwLastTimestamp = ptEvent->qwTimestamp;
+
+	// Judged an injection (or hostile otherwise), drop everything from now on
+	if ((CADENCE_VERDICT_INJECTION == eVerdict) || (bIsHostile))
+	{
+		if (QUARANTINE_STATE_BLOCKED != ptDevice->eState)
+		{
+			quarantine_Block(ptQuarantine, ptDevice);
+			quarantine_Flush(ptQuarantine);
+		}
+		ptQuarantine->qwDropped++;
+		return;
+	}
+
+	switch (ptDevice->eState)
+	{
+	case QUARANTINE_STATE_HOLDING:
+
+		// Judged human, replay what was held and this key in one write
+		if (CADENCE_VERDICT_HUMAN == eVerdict)
+		{
+			quarantine_Replay(ptQuarantine, ptDevice, ~0ULL);
+			TIMERWHEEL_Cancel(ptQuarantine->ptTimers, &(ptDevice->tExpiry));
+			ptDevice->eState = QUARANTINE_STATE_RELEASED;
+			ATOMIC_STORE_RELEASE(&(ptQuarantine->nHolding), ptQuarantine->nHolding - 1);
+			ptQuarantine->qwReleasedDevices++;
+			DEBUG_MSG(LOG_SEV_INFO, "Released held keyboard %lu.", (unsigned long)(ptDevice->dwHoldId));
+			quarantine_Emit(ptQuarantine, ptDevice, ptEvent->wKeyCode, wValue);
+			ptQuarantine->qwPassed++;
+			quarantine_Flush(ptQuarantine);
+			break;
+		}
+
+		// Not judged yet, hold it (fail closed when full)
+		if (QUARANTINE_MAX_HELD_KEYS == ptDevice->dwHeld)
+		{
+			ptQuarantine->qwDropped++;
+			break;
+		}
+		ptKey = &(ptDevice->atKeys[(ptDevice->dwFirst + ptDevice->dwHeld) % QUARANTINE_MAX_HELD_KEYS]);
+		ptKey->qwTimestamp = ptEvent->qwTimestamp;
+		ptKey->wKeyCode = ptEvent->wKeyCode;
+		ptKey->wValue = wValue;
+		ptDevice->dwHeld++;
+		ptQuarantine->qwHeld++;
+
+		// The oldest held key is due first
+		if (!TIMERWHEEL_IsArmed(&(ptDevice->tExpiry)))
+		{
+			TIMERWHEEL_Arm(ptQuarantine->ptTimers,
+				&(ptDevice->tExpiry),
+				ptKey->qwTimestamp + ((ULONGLONG)QUARANTINE_HOLD_US * NANOSECONDS_IN_MICROSECOND));
+		}
+		break;
+
+	case QUARANTINE_STATE_RELEASED:
+
+		// The hot path: straight through
+		quarantine_Emit(ptQuarantine, ptDevice, ptEvent->wKeyCode, wValue);
+		ptQuarantine->qwPassed++;
+		quarantine_Flush(ptQuarantine);
+		break;
+
+	default:
+
+		// Blocked
+		ptQuarantine->qwDropped++;
+		break;
+	}
+}
+
+/********************************************************************************
+*  Function:	QUARANTINE_OnDetach												*
+********************************************************************************/
+VOID
+QUARANTINE_OnDetach(
+	__inout PQUARANTINE ptQuarantine,
+	__in DWORD dwHoldId
+)
+{
+	PQUARANTINE_DEVICE ptDevice = NULL;
+	DWORD dwSlot = 0;
+
+	for (dwSlot = 0; dwSlot < QUARANTINE_MAX_DEVICES; dwSlot++)
+	{
+		ptDevice = &(ptQuarantine->atDevices[dwSlot]);
+		if ((QUARANTINE_STATE_FREE != ptDevice->eState) && (dwHoldId == ptDevice->dwHoldId))
+		{
+			// Its held keys have nowhere to go, and nothing it pressed may stay down
+			quarantine_Drop(ptQuarantine, ptDevice);
+			quarantine_Flush(ptQuarantine);
+			ptDevice->eState = QUARANTINE_STATE_FREE;
+			ptQuarantine->qwDetachedDevices++;
+			DEBUG_MSG(LOG_SEV_INFO, "Freed the slot of detached keyboard %lu.", (unsigned long)dwHoldId);
+			return;
+		}
+	}
+}
+
+/********************************************************************************
+*  Function:	QUARANTINE_GetStats												*
+********************************************************************************/
+VOID
+QUARANTINE_GetStats(
+	__in PCQUARANTINE ptQuarantine,
+	__out PQUARANTINE_STATS ptStats
+)
+{
+	ptStats->dwHolding = (DWORD)ATOMIC_LOAD_ACQUIRE(&(ptQuarantine->nHolding));
+	ptStats->qwHeld = ptQuarantine->qwHeld;
+	ptStats->qwReplayed = ptQuarantine->qwReplayed;
+	ptStats->qwPassed = ptQuarantine->qwPassed;
+	ptStats->qwDropped = ptQuarantine->qwDropped;
+	ptStats->qwLost = ptQuarantine->qwLost;
+	ptStats->qwReleasedDevices = ptQuarantine->qwReleasedDevices;
+	ptStats->qwBlockedDevices = ptQuarantine->qwBlockedDevices;
+	ptStats->qwDetachedDevices = ptQuarantine->qwDetachedDevices;
+}
+
+#endif	// _WIN32
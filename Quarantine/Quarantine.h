@@ -0,0 +1,268 @@
+/********************************************************************************
+*  File:		Quarantine.h													*
+*  Purpose:		Holds back the keys of newly arrived keyboards until their		*
+*				cadence is judged, then replays or drops them (POSIX).			*
+*  Remarks:		* The event source grabs the keyboards that arrive while it		*
+*					runs (see EVENTSOURCE_HoldNewEvdevDevices), so their keys	*
+*					reach the system only through a virtual keyboard that		*
+*					replays them.												*
+*				* A held keyboard's keys are replayed at once when its			*
+*					cadence is judged human (or it is approved), and passed		*
+*					through from then on. They are dropped when its cadence is	*
+*					judged an injection (or the session is locked over it),		*
+*					and so are its later keys.									*
+*				* A key is held for QUARANTINE_HOLD_US at most: an injection	*
+*					fast enough for the fixed thresholds is judged within a		*
+*					window of intervals shorter than that, so none of its keys	*
+*					is replayed before the verdict.								*
+*				* Each held keyboard arms a timer for its oldest held key, on	*
+*					the analysis thread's timer wheel.							*
+*				* A keyboard keeps its slot until it is detached (see			*
+*					QUARANTINE_OnDetach), whatever its verdict.					*
+********************************************************************************/
+#pragma once
+
+
+/** Includes *******************************************************************/
+#include <Utilities.h>
+#ifndef _WIN32
+#include <linux/input.h>
+#endif	// _WIN32
+#include "../Cadence/Cadence.h"
+#include "../EventSource/EventSource.h"
+#include "../Timer/TimerWheel.h"
+
+#ifndef _WIN32
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	QUARANTINE_MAX_DEVICES											*
+*  Purpose:		Keyboards tracked at once. A keyboard that finds no room is		*
+*				dropped (fail closed).											*
+********************************************************************************/
+#define QUARANTINE_MAX_DEVICES (8)
+
+/********************************************************************************
+*  Constant:	QUARANTINE_MAX_HELD_KEYS										*
+*  Purpose:		Key events held per keyboard. Those that do not fit are			*
+*				dropped (fail closed).											*
+********************************************************************************/
+#define QUARANTINE_MAX_HELD_KEYS (256)
+
+/********************************************************************************
+*  Constant:	QUARANTINE_HOLD_US												*
+*  Purpose:		How long a key is held at most while its keyboard is not		*
+*				judged yet.														*
+*  Remarks:		* Longer than a window of CADENCE_WINDOW_INTERVALS at			*
+*					CADENCE_MAX_MEAN_US (320 ms).								*
+********************************************************************************/
+#define QUARANTINE_HOLD_US (500000)
+
+/********************************************************************************
+*  Constant:	QUARANTINE_MAX_KEY												*
+*  Purpose:		Key codes from this one on are not replayed (BTN_MISC).			*
+********************************************************************************/
+#define QUARANTINE_MAX_KEY (0x100)
+
+/********************************************************************************
+*  Constant:	QUARANTINE_UINPUT_PATH											*
+*  Purpose:		The uinput device, which creates the replaying keyboard.		*
+********************************************************************************/
+#define QUARANTINE_UINPUT_PATH ("/dev/uinput")
+
+/********************************************************************************
+*  Constant:	QUARANTINE_DEVICE_NAME											*
+*  Purpose:		The name of the replaying keyboard.								*
+********************************************************************************/
+#define QUARANTINE_DEVICE_NAME ("AntiDuck replay")
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Enum:		QUARANTINE_STATE												*
+*  Purpose:		Where a held keyboard stands.									*
+********************************************************************************/
+typedef enum _QUARANTINE_STATE
+{
+	QUARANTINE_STATE_FREE = 0,						// The slot is unused
+	QUARANTINE_STATE_HOLDING,						// Not judged yet, keys are held
+	QUARANTINE_STATE_RELEASED,						// Judged human, keys pass through
+	QUARANTINE_STATE_BLOCKED						// Judged an injection, keys are dropped
+} QUARANTINE_STATE, *PQUARANTINE_STATE;
+
+/********************************************************************************
+*  Structure:	QUARANTINE_KEY													*
+*  Purpose:		A held key event.												*
+********************************************************************************/
+typedef struct _QUARANTINE_KEY
+{
+	ULONGLONG qwTimestamp;							// When it was typed
+	WORD wKeyCode;									// Native key code
+	WORD wValue;									// 0 (release), 1 (press) or 2 (repeat)
+} QUARANTINE_KEY, *PQUARANTINE_KEY;
+typedef const QUARANTINE_KEY *PCQUARANTINE_KEY;
+
+/********************************************************************************
+*  Structure:	QUARANTINE_DEVICE												*
+*  Purpose:		A held keyboard.												*
+*  Remarks:		* Held keys are a ring, replayed from the oldest.				*
+*				* The ring comes last, a slot is taken without clearing it.		*
+*				* The timer is armed while keys are held.						*
+********************************************************************************/
+typedef struct _QUARANTINE_DEVICE
+{
+	TIMERWHEEL_TIMER tExpiry;						// Replays the oldest held key when due
+	QUARANTINE_STATE eState;						// Where it stands
+	DWORD dwHoldId;									// Hold ID of its key events
+	ULONGLONG qwLastTimestamp;						// When it last typed
+	DWORD dwFirst;									// Oldest held key
+	DWORD dwHeld;									// Held keys
+	BYTE abIsDown[QUARANTINE_MAX_KEY / 8];			// Keys replayed pressed, by key code
+	QUARANTINE_KEY atKeys[QUARANTINE_MAX_HELD_KEYS];	// Held keys
+} QUARANTINE_DEVICE, *PQUARANTINE_DEVICE;
+
+/********************************************************************************
+*  Structure:	QUARANTINE														*
+*  Purpose:		The quarantine state.											*
+*  Remarks:		* Only used from a single thread, counters excepted.			*
+********************************************************************************/
+typedef struct _QUARANTINE
+{
+	INT nOutput;									// Replaying keyboard (or stand-in), or -1
+	PTIMERWHEEL ptTimers;							// Where the keyboards' timers are armed
+	QUARANTINE_DEVICE atDevices[QUARANTINE_MAX_DEVICES];	// Held keyboards
+	struct input_event atRecords[(QUARANTINE_MAX_HELD_KEYS + QUARANTINE_MAX_KEY) * 2];	// Output buffer
+	DWORD dwRecords;								// Records in it
+	volatile LONG nHolding;							// Keyboards not judged yet
+	volatile ULONGLONG qwHeld;						// Key events held
+	volatile ULONGLONG qwReplayed;					// Held key events replayed
+	volatile ULONGLONG qwPassed;					// Key events passed through
+	volatile ULONGLONG qwDropped;					// Key events dropped
+	volatile ULONGLONG qwLost;						// Key events the output refused
+	volatile ULONGLONG qwReleasedDevices;			// Keyboards judged human
+	volatile ULONGLONG qwBlockedDevices;			// Keyboards judged an injection
+	volatile ULONGLONG qwDetachedDevices;			// Keyboards detached, freeing their slots
+} QUARANTINE, *PQUARANTINE;
+typedef const QUARANTINE *PCQUARANTINE;
+
+/********************************************************************************
+*  Structure:	QUARANTINE_STATS												*
+*  Purpose:		A snapshot of the quarantine's counters.						*
+*  Remarks:		* Counters may be slightly stale, as they are read while the	*
+*					quarantine is in use.										*
+********************************************************************************/
+typedef struct _QUARANTINE_STATS
+{
+	DWORD dwHolding;								// Keyboards not judged yet
+	ULONGLONG qwHeld;								// Key events held
+	ULONGLONG qwReplayed;							// Held key events replayed
+	ULONGLONG qwPassed;								// Key events passed through
+	ULONGLONG qwDropped;							// Key events dropped
+	ULONGLONG qwLost;								// Key events the output refused
+	ULONGLONG qwReleasedDevices;					// Keyboards judged human
+	ULONGLONG qwBlockedDevices;						// Keyboards judged an injection
+	ULONGLONG qwDetachedDevices;					// Keyboards detached, freeing their slots
+} QUARANTINE_STATS, *PQUARANTINE_STATS;
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	QUARANTINE_OpenUinput											*
+*  Purpose:		Creates the replaying keyboard.									*
+*  Parameters:	@ pnOutput ~[out]~ Gets its uinput descriptor.					*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Carries the EVENTSOURCE_REPLAY_VENDOR_ID identity, so evdev	*
+*					sources never read it back.									*
+*				* Create it before the event source, whose arrival it would		*
+*					otherwise be.												*
+*				* Closing the descriptor destroys the keyboard.					*
+********************************************************************************/
+RETSTATUS
+QUARANTINE_OpenUinput(
+	__out PINT pnOutput
+);
+
+/********************************************************************************
+*  Function:	QUARANTINE_Initialize											*
+*  Purpose:		Initializes the quarantine state.								*
+*  Parameters:	@ nOutput ~[in]~ Where replayed keys are written as				*
+*				input_event records: the replaying keyboard, or a stand-in		*
+*				such as a pipe. Owned (and closed) by the quarantine.			*
+*				@ ptTimers ~[inout]~ The timer wheel of the thread that uses	*
+*				the quarantine, which replays held keys as it is advanced.		*
+*				@ ptQuarantine ~[out]~ Gets the quarantine state.				*
+*  Remarks:		* Free with QUARANTINE_Finalize, before the wheel.				*
+********************************************************************************/
+VOID
+QUARANTINE_Initialize(
+	__in INT nOutput,
+	__inout PTIMERWHEEL ptTimers,
+	__out PQUARANTINE ptQuarantine
+);
+
+/********************************************************************************
+*  Function:	QUARANTINE_Finalize												*
+*  Purpose:		Frees the quarantine state.										*
+*  Parameters:	@ ptQuarantine ~[inout]~ The quarantine state.					*
+*  Remarks:		* Keys still held are dropped, and their timers cancelled.		*
+********************************************************************************/
+VOID
+QUARANTINE_Finalize(
+	__inout PQUARANTINE ptQuarantine
+);
+
+/********************************************************************************
+*  Function:	QUARANTINE_OnKey												*
+*  Purpose:		Holds, replays or drops a held key event, by its keyboard's		*
+*				verdict.														*
+*  Parameters:	@ ptQuarantine ~[inout]~ The quarantine state.					*
+*				@ ptEvent ~[in]~ The key event (with a hold ID).				*
+*				@ eVerdict ~[in]~ Its cadence verdict (see DECISION_Decide).	*
+*				@ bIsHostile ~[in]~ Whether it called for a lock, folded or		*
+*				not (see DECISION_Decide).										*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+*				* A human verdict replays the held keys, then this one, in one	*
+*					write. A hostile event or an injection verdict drops		*
+*					them, and releases the keys replayed pressed.				*
+********************************************************************************/
+VOID
+QUARANTINE_OnKey(
+	__inout PQUARANTINE ptQuarantine,
+	__in PCEVENTSOURCE_EVENT ptEvent,
+	__in CADENCE_VERDICT eVerdict,
+	__in BOOL bIsHostile
+);
+
+/********************************************************************************
+*  Function:	QUARANTINE_OnDetach												*
+*  Purpose:		Frees a detached keyboard's slot.								*
+*  Parameters:	@ ptQuarantine ~[inout]~ The quarantine state.					*
+*				@ dwHoldId ~[in]~ Its hold ID (see EVENTSOURCE_EVENT).			*
+*  Remarks:		* Its held keys are dropped and its timer cancelled, and the	*
+*					keys replayed pressed are released.							*
+*				* A keyboard plugged in again gets a new hold ID, so it is		*
+*					held again.													*
+********************************************************************************/
+VOID
+QUARANTINE_OnDetach(
+	__inout PQUARANTINE ptQuarantine,
+	__in DWORD dwHoldId
+);
+
+/********************************************************************************
+*  Function:	QUARANTINE_GetStats												*
+*  Purpose:		Gets the quarantine's counters.									*
+*  Parameters:	@ ptQuarantine ~[in]~ The quarantine state.						*
+*				@ ptStats ~[out]~ Gets the counters.							*
+*  Remarks:		* May be called from any thread.								*
+********************************************************************************/
+VOID
+QUARANTINE_GetStats(
+	__in PCQUARANTINE ptQuarantine,
+	__out PQUARANTINE_STATS ptStats
+);
+
+#endif	// _WIN32
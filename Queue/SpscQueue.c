@@ -0,0 +1,390 @@
+/********************************************************************************
+*  File:		SpscQueue.c														*
+*  Purpose:		Bounded lock-free single-producer single-consumer queue.		*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#ifndef _WIN32
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#endif	// _WIN32
+#include <Clock.h>
+#include "SpscQueue.h"
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	spscqueue_Signal												*
+*  Purpose:		Wakes the consumer.												*
+*  Parameters:	@ ptQueue ~[inout]~ The queue.									*
+*  Remarks:		* Spurious wakeups are harmless, SPSCQUEUE_Wait re-checks.		*
+********************************************************************************/
+static
+VOID
+spscqueue_Signal(
+	__inout PSPSCQUEUE ptQueue
+)
+{
+#ifdef _WIN32
+	(VOID)SetEvent(ptQueue->hWakeup);
+#else	// _WIN32
+	// Cannot block, the counter saturates long after the consumer reads it
+	(VOID)eventfd_write(ptQueue->nWakeup, 1);
+#endif	// _WIN32
+}
+
+/********************************************************************************
+*  Function:	spscqueue_Block													*
+*  Purpose:		Blocks the consumer until signalled, or for a while.			*
+*  Parameters:	@ ptQueue ~[inout]~ The queue.									*
+*				@ dwTimeoutMs ~[in]~ How long to block at most, or				*
+*				SPSCQUEUE_WAIT_FOREVER.											*
+*  Returns:		FALSE if the time ran out.										*
+*  Remarks:		* A bounded wait interrupted by a signal waits for the time		*
+*					left, as it must not fall through to the blocking read.		*
+********************************************************************************/
+static
+BOOL
+spscqueue_Block(
+	__inout PSPSCQUEUE ptQueue,
+	__in DWORD dwTimeoutMs
+)
+{
+#ifdef _WIN32
+	return WAIT_TIMEOUT != WaitForSingleObject(ptQueue->hWakeup, dwTimeoutMs);
+#else	// _WIN32
+	struct pollfd tWakeup = { 0 };
+	eventfd_t qwValue = 0;
+	ULONGLONG qwDeadline = 0;
+	ULONGLONG qwNow = 0;
+	INT nReady = 0;
+
+	// Wait for the counter first when the wait is bounded
+	if (SPSCQUEUE_WAIT_FOREVER != dwTimeoutMs)
+	{
+		tWakeup.fd = ptQueue->nWakeup;
+		tWakeup.events = POLLIN;
+		qwDeadline = CLOCK_GetTimestamp() + ((ULONGLONG)dwTimeoutMs * NANOSECONDS_IN_MILLISECOND);
+		for (;;)
+		{
+			nReady = poll(&tWakeup, 1, (INT)MIN(dwTimeoutMs, (DWORD)INT_MAX));
+			if (0 < nReady)
+			{
+				break;
+			}
+
+			// Out of time, or failed for good
+			if ((0 == nReady) || (EINTR != errno))
+			{
+				return FALSE;
+			}
+
+			// Interrupted, wait for the rest (rounded up, so it never ends early)
+			qwNow = CLOCK_GetTimestamp();
+			if (qwNow >= qwDeadline)
+			{
+				return FALSE;
+			}
+			dwTimeoutMs = (DWORD)((qwDeadline - qwNow + NANOSECONDS_IN_MILLISECOND - 1) / NANOSECONDS_IN_MILLISECOND);
+		}
+	}
+
+	// Reading resets the counter
+	while ((0 > eventfd_read(ptQueue->nWakeup, &qwValue)) && (EINTR == errno))
+	{
+		// Retry
+	}
+	return TRUE;
+#endif	// _WIN32
+}
+
+/********************************************************************************
+*  Function:	spscqueue_GetAvailable											*
+*  Purpose:		Gets the number of queued elements (consumer only).				*
+*  Parameters:	@ ptQueue ~[inout]~ The queue.									*
+*  Returns:		The number of queued elements.									*
+*  Remarks:		* Only reads the producer's index once the cached one is used	*
+*					up.															*
+********************************************************************************/
+static
+__inline
+ULONG
+spscqueue_GetAvailable(
+	__inout PSPSCQUEUE ptQueue
+)
+{
+	ULONG dwHead = (ULONG)(ptQueue->nHead);
+	ULONG dwAvailable = ptQueue->dwCachedTail - dwHead;
+
+	// Refresh the cached index
+	if (0 == dwAvailable)
+	{
+		ptQueue->dwCachedTail = (ULONG)ATOMIC_LOAD_ACQUIRE(&(ptQueue->nTail));
+		dwAvailable = ptQueue->dwCachedTail - dwHead;
+		if (dwAvailable > ptQueue->dwMaxDepth)
+		{
+			ptQueue->dwMaxDepth = dwAvailable;
+		}
+	}
+
+	// Return result
+	return dwAvailable;
+}
+
+/********************************************************************************
+*  Function:	SPSCQUEUE_Create												*
+********************************************************************************/
+RETSTATUS
+SPSCQUEUE_Create(
+	__in ULONG cbElement,
+	__in ULONG dwCapacity,
+	__out PSPSCQUEUE ptQueue
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != ptQueue);
+	ASSERT(0 != cbElement);
+	ASSERT((0 != dwCapacity) && (0 == (dwCapacity & (dwCapacity - 1))));
+
+	// Initialize
+	RtlZeroMemory(ptQueue, sizeof(*ptQueue));
+	ptQueue->dwMask = dwCapacity - 1;
+	ptQueue->cbElement = cbElement;
+#ifndef _WIN32
+	ptQueue->nWakeup = -1;
+#endif	// _WIN32
+
+	// Allocate the ring
+	ptQueue->pbSlots = (PBYTE)ALLOCZ((SIZE_T)cbElement * dwCapacity);
+	if (NULL == ptQueue->pbSlots)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"ALLOCZ() failure (%lu slots of %lu bytes).",
+			(unsigned long)dwCapacity,
+			(unsigned long)cbElement);
+		goto lblCleanup;
+	}
+
+	// Create the wakeup object
+#ifdef _WIN32
+	ptQueue->hWakeup = CreateEventW(NULL, FALSE, FALSE, NULL);
+	if (NULL == ptQueue->hWakeup)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"CreateEventW() failure (LastError=%lu).",
+			GetLastError());
+		goto lblCleanup;
+	}
+#else	// _WIN32
+	ptQueue->nWakeup = eventfd(0, EFD_CLOEXEC);
+	if (0 > ptQueue->nWakeup)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"eventfd() failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+#endif	// _WIN32
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		SPSCQUEUE_Destroy(ptQueue);
+	}
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	SPSCQUEUE_Destroy												*
+********************************************************************************/
+VOID
+SPSCQUEUE_Destroy(
+	__inout PSPSCQUEUE ptQueue
+)
+{
+	// Validations
+	ASSERT(NULL != ptQueue);
+
+	// Free resources
+#ifdef _WIN32
+	CLOSE_HANDLE(ptQueue->hWakeup);
+#else	// _WIN32
+	CLOSE_FD(ptQueue->nWakeup);
+#endif	// _WIN32
+	FREE(ptQueue->pbSlots);
+}
+
+/********************************************************************************
+*  Function:	SPSCQUEUE_Enqueue												*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+********************************************************************************/
+BOOL
+SPSCQUEUE_Enqueue(
+	__inout PSPSCQUEUE ptQueue,
+	__in PCVOID pvElement
+)
+{
+	ULONG dwTail = (ULONG)(ptQueue->nTail);
+
+	// Only read the consumer's index when the cached one says full
+	if ((dwTail - ptQueue->dwCachedHead) > ptQueue->dwMask)
+	{
+		ptQueue->dwCachedHead = (ULONG)ATOMIC_LOAD_ACQUIRE(&(ptQueue->nHead));
+		if ((dwTail - ptQueue->dwCachedHead) > ptQueue->dwMask)
+		{
+			ptQueue->qwDropped++;
+			return FALSE;
+		}
+	}
+
+	// Fill the slot, then publish it
+	RtlCopyMemory(ptQueue->pbSlots + ((SIZE_T)(dwTail & ptQueue->dwMask) * ptQueue->cbElement),
+		pvElement,
+		ptQueue->cbElement);
+	ATOMIC_STORE_RELEASE(&(ptQueue->nTail), (LONG)(dwTail + 1));
+	ptQueue->qwEnqueued++;
+
+	// Order the publish before reading the flag, pairs with SPSCQUEUE_Wait
+	ATOMIC_FULL_BARRIER();
+	if (ATOMIC_LOAD_ACQUIRE(&(ptQueue->nIsWaiting)))
+	{
+		spscqueue_Signal(ptQueue);
+	}
+
+	// Success
+	return TRUE;
+}
+
+/********************************************************************************
+*  Function:	SPSCQUEUE_Close													*
+********************************************************************************/
+VOID
+SPSCQUEUE_Close(
+	__inout PSPSCQUEUE ptQueue
+)
+{
+	// Publish after the last element, and always wake
+	ATOMIC_STORE_RELEASE(&(ptQueue->nIsClosed), TRUE);
+	spscqueue_Signal(ptQueue);
+}
+
+/********************************************************************************
+*  Function:	SPSCQUEUE_Peek													*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+********************************************************************************/
+ULONG
+SPSCQUEUE_Peek(
+	__inout PSPSCQUEUE ptQueue,
+	__out PVOID *ppvElements
+)
+{
+	ULONG dwIndex = (ULONG)(ptQueue->nHead) & ptQueue->dwMask;
+	ULONG dwAvailable = spscqueue_GetAvailable(ptQueue);
+
+	// Stop at the end of the ring
+	*ppvElements = ptQueue->pbSlots + ((SIZE_T)dwIndex * ptQueue->cbElement);
+	return MIN(dwAvailable, ptQueue->dwMask + 1 - dwIndex);
+}
+
+/********************************************************************************
+*  Function:	SPSCQUEUE_Release												*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+********************************************************************************/
+VOID
+SPSCQUEUE_Release(
+	__inout PSPSCQUEUE ptQueue,
+	__in ULONG dwCount
+)
+{
+	// Hand the slots back to the producer
+	ATOMIC_STORE_RELEASE(&(ptQueue->nHead), (LONG)((ULONG)(ptQueue->nHead) + dwCount));
+}
+
+/********************************************************************************
+*  Function:	SPSCQUEUE_Wait													*
+********************************************************************************/
+BOOL
+SPSCQUEUE_Wait(
+	__inout PSPSCQUEUE ptQueue
+)
+{
+	return SPSCQUEUE_WaitFor(ptQueue, SPSCQUEUE_WAIT_FOREVER);
+}
+
+/********************************************************************************
+*  Function:	SPSCQUEUE_WaitFor												*
+********************************************************************************/
+BOOL
+SPSCQUEUE_WaitFor(
+	__inout PSPSCQUEUE ptQueue,
+	__in DWORD dwTimeoutMs
+)
+{
+	BOOL bIsSignalled = TRUE;
+
+	for (;;)
+	{
+		// Closing is published after the last element, so check it first
+		if (ATOMIC_LOAD_ACQUIRE(&(ptQueue->nIsClosed)))
+		{
+			return (0 != spscqueue_GetAvailable(ptQueue));
+		}
+		if ((0 != spscqueue_GetAvailable(ptQueue)) || (!bIsSignalled))
+		{
+			return TRUE;
+		}
+
+		// Announce the wait, then re-check so a racing enqueue is not missed
+		ATOMIC_STORE_RELEASE(&(ptQueue->nIsWaiting), TRUE);
+		ATOMIC_FULL_BARRIER();
+		if ((!ATOMIC_LOAD_ACQUIRE(&(ptQueue->nIsClosed))) &&
+			(0 == spscqueue_GetAvailable(ptQueue)))
+		{
+			bIsSignalled = spscqueue_Block(ptQueue, dwTimeoutMs);
+		}
+		ATOMIC_STORE_RELEASE(&(ptQueue->nIsWaiting), FALSE);
+	}
+}
+
+/********************************************************************************
+*  Function:	SPSCQUEUE_GetStats												*
+********************************************************************************/
+VOID
+SPSCQUEUE_GetStats(
+	__in PSPSCQUEUE ptQueue,
+	__out PSPSCQUEUE_STATS ptStats
+)
+{
+	ULONG dwHead = 0;
+
+	// Validations
+	ASSERT(NULL != ptQueue);
+	ASSERT(NULL != ptStats);
+
+	// Read the consumer's index first, so the depth never underflows
+	dwHead = (ULONG)ATOMIC_LOAD_ACQUIRE(&(ptQueue->nHead));
+	ptStats->dwDepth = (ULONG)ATOMIC_LOAD_ACQUIRE(&(ptQueue->nTail)) - dwHead;
+	ptStats->dwCapacity = ptQueue->dwMask + 1;
+	ptStats->dwMaxDepth = ptQueue->dwMaxDepth;
+	ptStats->qwEnqueued = ptQueue->qwEnqueued;
+	ptStats->qwDropped = ptQueue->qwDropped;
+}
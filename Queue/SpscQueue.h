@@ -0,0 +1,198 @@
+/********************************************************************************
+*  File:		SpscQueue.h														*
+*  Purpose:		Bounded lock-free single-producer single-consumer queue.		*
+********************************************************************************/
+#pragma once
+
+
+/** Includes *******************************************************************/
+#include <Utilities.h>
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	SPSCQUEUE_WAIT_FOREVER											*
+*  Purpose:		A timeout of SPSCQUEUE_WaitFor that never runs out.				*
+********************************************************************************/
+#define SPSCQUEUE_WAIT_FOREVER (0xFFFFFFFFUL)
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Structure:	SPSCQUEUE														*
+*  Purpose:		A bounded ring of fixed-size elements, written by exactly one	*
+*				producer thread and read by exactly one consumer thread.		*
+*  Remarks:		* Indices are free running and masked on access.				*
+*				* Each side keeps a cached copy of the other side's index, and	*
+*					only reads the shared one when the cache says full or empty.	*
+*				* Producer, consumer and shared fields are padded apart so the	*
+*					two threads never write the same cache line.				*
+********************************************************************************/
+typedef struct _SPSCQUEUE
+{
+	// Producer side
+	volatile LONG nTail;							// Next slot to write
+	ULONG dwCachedHead;								// Producer's view of nHead
+	volatile ULONGLONG qwEnqueued;					// Elements enqueued
+	volatile ULONGLONG qwDropped;					// Elements dropped on a full queue
+	BYTE abProducerPadding[CACHE_LINE_SIZE];
+
+	// Consumer side
+	volatile LONG nHead;							// Next slot to read
+	ULONG dwCachedTail;								// Consumer's view of nTail
+	volatile ULONG dwMaxDepth;						// Deepest backlog seen by the consumer
+	BYTE abConsumerPadding[CACHE_LINE_SIZE];
+
+	// Shared (read-mostly)
+	volatile LONG nIsWaiting;						// Consumer is about to block
+	volatile LONG nIsClosed;						// Producer will enqueue no more
+	ULONG dwMask;									// Capacity - 1
+	ULONG cbElement;								// Element size in bytes
+	PBYTE pbSlots;									// The ring
+#ifdef _WIN32
+	HANDLE hWakeup;									// Auto-reset event
+#else	// _WIN32
+	INT nWakeup;									// eventfd
+#endif	// _WIN32
+} SPSCQUEUE, *PSPSCQUEUE;
+
+/********************************************************************************
+*  Structure:	SPSCQUEUE_STATS													*
+*  Purpose:		A snapshot of the queue's counters.								*
+*  Remarks:		* Counters may be slightly stale, as they are read while the	*
+*					queue is in use.											*
+********************************************************************************/
+typedef struct _SPSCQUEUE_STATS
+{
+	ULONG dwCapacity;								// Number of slots
+	ULONG dwDepth;									// Elements currently queued
+	ULONG dwMaxDepth;								// Deepest backlog seen
+	ULONGLONG qwEnqueued;							// Elements enqueued
+	ULONGLONG qwDropped;							// Elements dropped on a full queue
+} SPSCQUEUE_STATS, *PSPSCQUEUE_STATS;
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	SPSCQUEUE_Create												*
+*  Purpose:		Creates an empty queue.											*
+*  Parameters:	@ cbElement ~[in]~ The element size in bytes.					*
+*				@ dwCapacity ~[in]~ The number of slots (a power of two).		*
+*				@ ptQueue ~[out]~ Gets the queue.								*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Free with SPSCQUEUE_Destroy.									*
+********************************************************************************/
+RETSTATUS
+SPSCQUEUE_Create(
+	__in ULONG cbElement,
+	__in ULONG dwCapacity,
+	__out PSPSCQUEUE ptQueue
+);
+
+/********************************************************************************
+*  Function:	SPSCQUEUE_Destroy												*
+*  Purpose:		Frees a queue.													*
+*  Parameters:	@ ptQueue ~[inout]~ The queue.									*
+*  Remarks:		* Neither side may be using the queue.							*
+********************************************************************************/
+VOID
+SPSCQUEUE_Destroy(
+	__inout PSPSCQUEUE ptQueue
+);
+
+/********************************************************************************
+*  Function:	SPSCQUEUE_Enqueue												*
+*  Purpose:		Copies an element into the queue (producer only).				*
+*  Parameters:	@ ptQueue ~[inout]~ The queue.									*
+*				@ pvElement ~[in]~ The element (cbElement bytes).				*
+*  Returns:		TRUE on success, FALSE if the queue is full and the element was	*
+*				dropped.														*
+*  Remarks:		* Never blocks or allocates.									*
+*				* Wakes the consumer only if it is blocked in SPSCQUEUE_Wait.	*
+********************************************************************************/
+BOOL
+SPSCQUEUE_Enqueue(
+	__inout PSPSCQUEUE ptQueue,
+	__in PCVOID pvElement
+);
+
+/********************************************************************************
+*  Function:	SPSCQUEUE_Close													*
+*  Purpose:		Marks the end of the stream and wakes the consumer (producer	*
+*				only).															*
+*  Parameters:	@ ptQueue ~[inout]~ The queue.									*
+********************************************************************************/
+VOID
+SPSCQUEUE_Close(
+	__inout PSPSCQUEUE ptQueue
+);
+
+/********************************************************************************
+*  Function:	SPSCQUEUE_Peek													*
+*  Purpose:		Gets the queued elements that are contiguous in the ring		*
+*				(consumer only).												*
+*  Parameters:	@ ptQueue ~[inout]~ The queue.									*
+*				@ ppvElements ~[out]~ Gets the first element.					*
+*  Returns:		The number of elements available at *ppvElements (may be 0).	*
+*  Remarks:		* The elements stay valid until given to SPSCQUEUE_Release.		*
+*				* A second call may return more, once the ring wraps.			*
+********************************************************************************/
+ULONG
+SPSCQUEUE_Peek(
+	__inout PSPSCQUEUE ptQueue,
+	__out PVOID *ppvElements
+);
+
+/********************************************************************************
+*  Function:	SPSCQUEUE_Release												*
+*  Purpose:		Frees slots obtained with SPSCQUEUE_Peek (consumer only).		*
+*  Parameters:	@ ptQueue ~[inout]~ The queue.									*
+*				@ dwCount ~[in]~ The number of elements consumed.				*
+********************************************************************************/
+VOID
+SPSCQUEUE_Release(
+	__inout PSPSCQUEUE ptQueue,
+	__in ULONG dwCount
+);
+
+/********************************************************************************
+*  Function:	SPSCQUEUE_Wait													*
+*  Purpose:		Blocks until the queue is non-empty or closed (consumer only).	*
+*  Parameters:	@ ptQueue ~[inout]~ The queue.									*
+*  Returns:		FALSE once the queue is closed and drained, TRUE otherwise.		*
+********************************************************************************/
+BOOL
+SPSCQUEUE_Wait(
+	__inout PSPSCQUEUE ptQueue
+);
+
+/********************************************************************************
+*  Function:	SPSCQUEUE_WaitFor												*
+*  Purpose:		Blocks until the queue is non-empty or closed, or until a		*
+*				timeout runs out (consumer only).								*
+*  Parameters:	@ ptQueue ~[inout]~ The queue.									*
+*				@ dwTimeoutMs ~[in]~ The timeout, or SPSCQUEUE_WAIT_FOREVER.	*
+*  Returns:		FALSE once the queue is closed and drained, TRUE otherwise		*
+*				(the queue may be empty if the timeout ran out).				*
+********************************************************************************/
+BOOL
+SPSCQUEUE_WaitFor(
+	__inout PSPSCQUEUE ptQueue,
+	__in DWORD dwTimeoutMs
+);
+
+/********************************************************************************
+*  Function:	SPSCQUEUE_GetStats												*
+*  Purpose:		Gets the queue's depth and counters.							*
+*  Parameters:	@ ptQueue ~[in]~ The queue.										*
+*				@ ptStats ~[out]~ Gets the counters.							*
+*  Remarks:		* May be called from any thread.								*
+********************************************************************************/
+VOID
+SPSCQUEUE_GetStats(
+	__in PSPSCQUEUE ptQueue,
+	__out PSPSCQUEUE_STATS ptStats
+);
@@ -0,0 +1,227 @@
+/********************************************************************************
+*  File:		Replay.c														*
+*  Purpose:		Replays recorded traces through the decision code, as fast as	*
+*				possible and without any device.								*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#include <Utilities.h>
+#include <Clock.h>
+#include "../Decision/Decision.h"
+#include "../Metrics/Histogram.h"
+#include "../Trace/Trace.h"
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	REPLAY_DEFAULT_PASSES											*
+*  Purpose:		How many times each trace is replayed by default.				*
+********************************************************************************/
+#define REPLAY_DEFAULT_PASSES (1)
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Enum:		REPLAY_EXPECT													*
+*  Purpose:		The outcome a trace is expected to have.						*
+********************************************************************************/
+typedef enum
+{
+	REPLAY_EXPECT_ANY,								// Only report
+	REPLAY_EXPECT_HUMAN,							// Never locks
+	REPLAY_EXPECT_INJECTION							// Locks at least once
+} REPLAY_EXPECT, *PREPLAY_EXPECT;
+
+/********************************************************************************
+*  Structure:	REPLAY_RESULT													*
+*  Purpose:		The outcome of replaying a trace.								*
+********************************************************************************/
+typedef struct _REPLAY_RESULT
+{
+	ULONGLONG qwEvents;								// Events replayed, over all passes
+	ULONGLONG qwLocks;								// Lock decisions, over all passes
+	ULONGLONG qwElapsedNs;							// Wall time of all passes
+	HISTOGRAM tLatency;								// Decision latency, in nanoseconds
+} REPLAY_RESULT, *PREPLAY_RESULT;
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	replay_Trace													*
+*  Purpose:		Replays a trace.												*
+*  Parameters:	@ ptReader ~[inout]~ The loaded trace.							*
+*				@ ptSignatures ~[in_opt]~ Payload signatures, or NULL.			*
+*				@ eLayout ~[in]~ The layout typed text is decoded by.			*
+*				@ dwPasses ~[in]~ How many times to replay it.					*
+*				@ ptResult ~[out]~ Gets the outcome.							*
+*  Remarks:		* Every pass starts from a fresh decision state, so passes are	*
+*					identical.													*
+*				* The decision code sees the trace's own timestamps and time of	*
+*					day (following its clock records), the latency is measured	*
+*					on the real clock.											*
+********************************************************************************/
+static
+VOID
+replay_Trace(
+	__inout PTRACE_READER ptReader,
+	__in_opt PCSIGNATURE_SET ptSignatures,
+	__in LAYOUT_ID eLayout,
+	__in DWORD dwPasses,
+	__out PREPLAY_RESULT ptResult
+)
+{
+	DECISION tDecision = { 0 };
+	EVENTSOURCE_EVENT tEvent = { 0 };
+	DWORD dwPass = 0;
+	ULONGLONG qwStart = 0;
+	ULONGLONG qwBefore = 0;
+	ULONGLONG qwAfter = 0;
+	BOOL bShouldLock = FALSE;
+
+	RtlZeroMemory(ptResult, sizeof(*ptResult));
+	qwStart = CLOCK_GetTimestamp();
+	for (dwPass = 0; dwPass < dwPasses; dwPass++)
+	{
+		DECISION_Initialize(NULL, ptSignatures, NULL, 0, ptReader->bDeliversKeystrokes, ptReader->qwClockOffset, &tDecision);
+		SIGNATURE_SetLayout(&(tDecision.tSignatureStreams), eLayout);
+		TRACE_Rewind(ptReader);
+		while (TRACE_Read(ptReader, &tEvent))
+		{
+			(VOID)DECISION_SetClockOffset(&tDecision, ptReader->qwClockOffset);
+			qwBefore = CLOCK_GetTimestamp();
+			bShouldLock = DECISION_Decide(&tDecision, &tEvent, NULL, NULL, NULL);
+			qwAfter = CLOCK_GetTimestamp();
+			HISTOGRAM_Record(&(ptResult->tLatency), qwAfter - qwBefore);
+			ptResult->qwLocks += bShouldLock ? 1 : 0;
+			ptResult->qwEvents++;
+		}
+		DECISION_Finalize(&tDecision);
+	}
+	ptResult->qwElapsedNs = CLOCK_GetTimestamp() - qwStart;
+}
+
+/********************************************************************************
+*  Function:	main															*
+*  Purpose:		Replays traces and reports throughput and decision latency.		*
+*  Returns:		Zero if every trace was read whole and met the expectation.		*
+*  Remarks:		* Usage: antiduck-replay [-n passes] [-s signatures]			*
+*					[-l layout] [-x human|injection] <trace>...					*
+*				* -s, -l and -x apply to the traces after them.					*
+********************************************************************************/
+INT
+main(
+	__in INT nArgs,
+	__in_ecount(nArgs) PSTR* ppszArgs
+)
+{
+	RETSTATUS eStatus = RETSTATUS_SUCCESS;
+	REPLAY_EXPECT eExpect = REPLAY_EXPECT_ANY;
+	DWORD dwPasses = REPLAY_DEFAULT_PASSES;
+	TRACE_READER tReader = { 0 };
+	SIGNATURE_SET tSignatures;
+	PCSIGNATURE_SET ptSignatures = NULL;
+	LAYOUT_ID eLayout = LAYOUT_ID_US;
+	REPLAY_RESULT tResult = { 0 };
+	INT nArg = 0;
+	BOOL bHasTraces = FALSE;
+	BOOL bIsExpected = FALSE;
+
+	RtlZeroMemory(&tSignatures, sizeof(tSignatures));
+	for (nArg = 1; nArg < nArgs; nArg++)
+	{
+		// Options
+		if ((0 == strcmp(ppszArgs[nArg], "-n")) && (nArg + 1 < nArgs))
+		{
+			dwPasses = (DWORD)strtoul(ppszArgs[++nArg], NULL, DECIMAL_BASE);
+			dwPasses = MAX(dwPasses, 1);
+			continue;
+		}
+		if ((0 == strcmp(ppszArgs[nArg], "-s")) && (nArg + 1 < nArgs))
+		{
+			nArg++;
+			SIGNATURE_Destroy(&tSignatures);
+			if (RETSTATUS_FAILED(SIGNATURE_Load(ppszArgs[nArg], &tSignatures)))
+			{
+				(VOID)fprintf(stderr, "Cannot load %s.\n", ppszArgs[nArg]);
+				eStatus = DEBUG_GEN_FAIL_STATUS();
+			}
+			ptSignatures = &tSignatures;
+			continue;
+		}
+		if ((0 == strcmp(ppszArgs[nArg], "-l")) && (nArg + 1 < nArgs))
+		{
+			nArg++;
+			if (!LAYOUT_Parse(ppszArgs[nArg], &eLayout))
+			{
+				break;
+			}
+			continue;
+		}
+		if ((0 == strcmp(ppszArgs[nArg], "-x")) && (nArg + 1 < nArgs))
+		{
+			nArg++;
+			if (0 == strcmp(ppszArgs[nArg], "human"))
+			{
+				eExpect = REPLAY_EXPECT_HUMAN;
+			}
+			else if (0 == strcmp(ppszArgs[nArg], "injection"))
+			{
+				eExpect = REPLAY_EXPECT_INJECTION;
+			}
+			else
+			{
+				break;
+			}
+			continue;
+		}
+		if ('-' == ppszArgs[nArg][0])
+		{
+			break;
+		}
+
+		// A trace
+		bHasTraces = TRUE;
+		if (RETSTATUS_FAILED(TRACE_Open(ppszArgs[nArg], &tReader)))
+		{
+			(VOID)fprintf(stderr, "Cannot load %s.\n", ppszArgs[nArg]);
+			eStatus = DEBUG_GEN_FAIL_STATUS();
+			continue;
+		}
+		replay_Trace(&tReader, ptSignatures, eLayout, dwPasses, &tResult);
+		bIsExpected = (REPLAY_EXPECT_ANY == eExpect) ||
+			((REPLAY_EXPECT_HUMAN == eExpect) && (0 == tResult.qwLocks)) ||
+			((REPLAY_EXPECT_INJECTION == eExpect) && (0 != tResult.qwLocks));
+		(VOID)printf("%-40s %8llu events %5llu locks %12.0f events/s  decide p50 %5llu p99 %6llu max %7llu ns%s%s\n",
+			ppszArgs[nArg],
+			tResult.qwEvents,
+			tResult.qwLocks,
+			(double)tResult.qwEvents * NANOSECONDS_IN_SECOND / (double)MAX(tResult.qwElapsedNs, 1),
+			HISTOGRAM_GetQuantile(&(tResult.tLatency), 50000),
+			HISTOGRAM_GetQuantile(&(tResult.tLatency), 99000),
+			HISTOGRAM_GetQuantile(&(tResult.tLatency), HISTOGRAM_QUANTILE_SCALE),
+			tReader.bIsCorrupt ? "  CORRUPT" : "",
+			bIsExpected ? "" : "  UNEXPECTED");
+		if ((tReader.bIsCorrupt) || (!bIsExpected))
+		{
+			eStatus = DEBUG_GEN_FAIL_STATUS();
+		}
+		TRACE_CloseReader(&tReader);
+	}
+
+	// Validations
+	if ((!bHasTraces) || (nArg < nArgs))
+	{
+		(VOID)fprintf(stderr, "Usage: %s [-n passes] [-s signatures] [-l layout] [-x human|injection] <trace>...\n", ppszArgs[0]);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+	}
+
+	// Free resources
+	SIGNATURE_Destroy(&tSignatures);
+
+	// Return result
+	return RETSTATUS_FAILED(eStatus) ? 1 : 0;
+}
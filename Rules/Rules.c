@@ -0,0 +1,2105 @@
+/********************************************************************************
+*  File:		Rules.c															*
+*  Purpose:		Policy rules, compiled ahead of time into flat decision tables.	*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#include "Rules.h"
+#include <ctype.h>
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	RULES_LINE_CHARS												*
+*  Purpose:		Line buffer size when loading a file (longer lines are			*
+*				malformed).														*
+********************************************************************************/
+#define RULES_LINE_CHARS (512)
+
+/********************************************************************************
+*  Constant:	RULES_SECTION_ALIGNMENT											*
+*  Purpose:		Alignment of every section of a compiled table.					*
+********************************************************************************/
+#define RULES_SECTION_ALIGNMENT (8)
+
+/********************************************************************************
+*  Constant:	RULES_MAX_SERIAL_NODES											*
+*  Purpose:		Serial trie nodes an edge key can address (24 bits).			*
+********************************************************************************/
+#define RULES_MAX_SERIAL_NODES (1UL << 24)
+
+/********************************************************************************
+*  Constant:	RULES_MIN_SETS													*
+*  Purpose:		Initial capacity of a class set.								*
+********************************************************************************/
+#define RULES_MIN_SETS (64)
+
+/********************************************************************************
+*  Constant:	RULES_HASH_MULTIPLIER											*
+*  Purpose:		Fibonacci hashing multiplier (2^64 / golden ratio).				*
+********************************************************************************/
+#define RULES_HASH_MULTIPLIER (0x9E3779B97F4A7C15ULL)
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Structure:	RULES_SETS														*
+*  Purpose:		The distinct rule sets of a dimension or phase, one per class	*
+*				(bitsets by rule index), interned through a hash table.			*
+********************************************************************************/
+typedef struct _RULES_SETS
+{
+	PULONGLONG pqwBits;								// dwCapacity bitsets of dwWords words
+	PDWORD pdwSlots;								// Class + 1 by hash, or 0 if free
+	DWORD dwWords;									// Words per bitset
+	DWORD dwCount;									// Classes so far
+	DWORD dwCapacity;								// Classes room was made for
+	DWORD dwSlotMask;								// Number of slots minus 1
+} RULES_SETS, *PRULES_SETS;
+typedef const RULES_SETS *PCRULES_SETS;
+
+/********************************************************************************
+*  Structure:	RULES_COMPILER													*
+*  Purpose:		The state of a compilation.										*
+********************************************************************************/
+typedef struct _RULES_COMPILER
+{
+	PCRULES_LIST ptList;							// The rules
+	DWORD dwWords;									// Words per rule bitset
+	PULONGLONG pqwScratch;							// A bitset being built
+	RULES_SETS atSets[RULES_CLASS_COUNT];			// The classes, by RULES_CLASS
+	PVOID apvSections[RULES_SECTION_COUNT];			// The sections, by RULES_SECTION
+	SIZE_T acbSections[RULES_SECTION_COUNT];		// Their sizes
+	DWORD adwClasses[RULES_CLASS_COUNT];			// Class counts, once final
+	DWORD dwSerialNodes;							// Serial trie nodes
+	DWORD dwSerialEdgeSlots;						// Serial trie edge slots
+	DWORD dwUnknownSerialClass;						// Serial class without an identity
+} RULES_COMPILER, *PRULES_COMPILER;
+
+
+/** Globals ********************************************************************/
+
+/********************************************************************************
+*  Global:		g_apszActionNames												*
+*  Purpose:		Rule file action names, indexed by RULES_ACTION.				*
+********************************************************************************/
+static
+const PCSTR
+g_apszActionNames[RULES_ACTION_COUNT] = { NULL, "allow", "lock", "alert" };
+
+/********************************************************************************
+*  Global:		g_apszEventNames												*
+*  Purpose:		Rule file event names, indexed by EVENTSOURCE_EVENT_TYPE.		*
+********************************************************************************/
+static
+const PCSTR
+g_apszEventNames[RULES_EVENT_TYPES] = { "arrival", "removal", "key" };
+
+/********************************************************************************
+*  Global:		g_apszClassNames												*
+*  Purpose:		Rule file device class names, indexed by						*
+*				EVENTSOURCE_DEVICE_CLASS.										*
+********************************************************************************/
+static
+const PCSTR
+g_apszClassNames[RULES_DEVICE_CLASSES] = { "other", "keyboard" };
+
+/********************************************************************************
+*  Global:		g_apszVerdictNames												*
+*  Purpose:		Rule file cadence names, indexed by CADENCE_VERDICT.			*
+********************************************************************************/
+static
+const PCSTR
+g_apszVerdictNames[RULES_VERDICTS] = { "pending", "human", "injection" };
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	rules_GetContext												*
+*  Purpose:		Gets the context table index of an event.						*
+*  Parameters:	@ dwType ~[in]~ The EVENTSOURCE_EVENT_TYPE.						*
+*				@ dwClass ~[in]~ The EVENTSOURCE_DEVICE_CLASS.					*
+*				@ dwSession ~[in]~ The RULES_SESSION.							*
+*				@ dwVerdict ~[in]~ The CADENCE_VERDICT.							*
+*  Returns:		The index, below RULES_CONTEXTS.								*
+********************************************************************************/
+static
+__inline
+DWORD
+rules_GetContext(
+	__in DWORD dwType,
+	__in DWORD dwClass,
+	__in DWORD dwSession,
+	__in DWORD dwVerdict
+)
+{
+	return ((((dwType * RULES_DEVICE_CLASSES) + dwClass) * RULES_SESSIONS + dwSession) * RULES_VERDICTS) + dwVerdict;
+}
+
+/********************************************************************************
+*  Function:	rules_FindEdge													*
+*  Purpose:		Probes for a serial trie edge.									*
+*  Parameters:	@ ptEdges ~[in]~ The edge slots.								*
+*				@ dwMask ~[in]~ Number of slots minus 1.						*
+*				@ dwKey ~[in]~ The edge key (parent and character).				*
+*  Returns:		The edge's slot, or the free slot that ends its probe			*
+*				sequence.														*
+********************************************************************************/
+static
+__inline
+DWORD
+rules_FindEdge(
+	__in PCRULES_SERIAL_EDGE ptEdges,
+	__in DWORD dwMask,
+	__in DWORD dwKey
+)
+{
+	DWORD dwSlot = 0;
+
+	// Probe, stopping at the key or the first free slot (one always exists)
+	for (dwSlot = (DWORD)(((ULONGLONG)dwKey * RULES_HASH_MULTIPLIER) >> 32) & dwMask;
+		(0 != ptEdges[dwSlot].dwKey) && (dwKey != ptEdges[dwSlot].dwKey);
+		dwSlot = (dwSlot + 1) & dwMask)
+	{
+	}
+
+	// Return result
+	return dwSlot;
+}
+
+/********************************************************************************
+*  Function:	rules_IsMinuteInRange											*
+*  Purpose:		Checks a rule's time of day condition.							*
+*  Parameters:	@ ptRule ~[in]~ The rule.										*
+*				@ dwMinute ~[in]~ The minute of the day.						*
+*  Returns:		A boolean value.												*
+********************************************************************************/
+static
+BOOL
+rules_IsMinuteInRange(
+	__in PCRULES_RULE ptRule,
+	__in DWORD dwMinute
+)
+{
+	if (!ptRule->bHasTime)
+	{
+		return TRUE;
+	}
+	if (ptRule->wMinuteStart < ptRule->wMinuteEnd)
+	{
+		return (ptRule->wMinuteStart <= dwMinute) && (dwMinute < ptRule->wMinuteEnd);
+	}
+	if (ptRule->wMinuteStart > ptRule->wMinuteEnd)
+	{
+		return (ptRule->wMinuteStart <= dwMinute) || (dwMinute < ptRule->wMinuteEnd);
+	}
+
+	// Equal ends mean the whole day
+	return TRUE;
+}
+
+/********************************************************************************
+*  Function:	rules_IsToken													*
+*  Purpose:		Compares a token to a name.										*
+*  Parameters:	@ pszToken ~[in]~ The token (not NUL terminated).				*
+*				@ cchToken ~[in]~ Its length.									*
+*				@ pszName ~[in_opt]~ The name, or NULL.							*
+*  Returns:		A boolean value.												*
+********************************************************************************/
+static
+BOOL
+rules_IsToken(
+	__in_ecount(cchToken) PCSTR pszToken,
+	__in SIZE_T cchToken,
+	__in_z_opt PCSTR pszName
+)
+{
+	return (NULL != pszName) && (strlen(pszName) == cchToken) && (0 == memcmp(pszToken, pszName, cchToken));
+}
+
+/********************************************************************************
+*  Function:	rules_ParseMask													*
+*  Purpose:		Parses a comma separated list of names into a mask.				*
+*  Parameters:	@ pszValue ~[in]~ The list (not NUL terminated).				*
+*				@ cchValue ~[in]~ Its length.									*
+*				@ ppszNames ~[in]~ The names, by bit (NULL for none).			*
+*				@ dwNames ~[in]~ Number of names.								*
+*				@ pbMask ~[out]~ Gets the mask.									*
+*  Returns:		TRUE if every item is a name.									*
+********************************************************************************/
+static
+BOOL
+rules_ParseMask(
+	__in_ecount(cchValue) PCSTR pszValue,
+	__in SIZE_T cchValue,
+	__in_ecount(dwNames) const PCSTR *ppszNames,
+	__in DWORD dwNames,
+	__out PBYTE pbMask
+)
+{
+	SIZE_T cchItem = 0;
+	DWORD dwName = 0;
+
+	*pbMask = 0;
+	for (;;)
+	{
+		for (cchItem = 0; (cchItem < cchValue) && (',' != pszValue[cchItem]); cchItem++)
+		{
+		}
+		for (dwName = 0; (dwName < dwNames) && (!rules_IsToken(pszValue, cchItem, ppszNames[dwName])); dwName++)
+		{
+		}
+		if (dwName == dwNames)
+		{
+			return FALSE;
+		}
+		*pbMask |= (BYTE)(1 << dwName);
+		if (cchItem == cchValue)
+		{
+			return TRUE;
+		}
+		pszValue += cchItem + 1;
+		cchValue -= cchItem + 1;
+	}
+}
+
+/********************************************************************************
+*  Function:	rules_ParseIdRange												*
+*  Purpose:		Parses "HHHH" or "HHHH-HHHH" (hex, inclusive).					*
+*  Parameters:	@ pszValue ~[in]~ The text (not NUL terminated).				*
+*				@ cchValue ~[in]~ Its length.									*
+*				@ pwLow ~[out]~ Gets the first ID.								*
+*				@ pwHigh ~[out]~ Gets the last ID.								*
+*  Returns:		TRUE if the text is well formed and the range not empty.		*
+********************************************************************************/
+static
+BOOL
+rules_ParseIdRange(
+	__in_ecount(cchValue) PCSTR pszValue,
+	__in SIZE_T cchValue,
+	__out PWORD pwLow,
+	__out PWORD pwHigh
+)
+{
+	DWORD adwIds[2] = { 0 };
+	DWORD dwIds = 0;
+	SIZE_T cchDigits = 0;
+
+	for (dwIds = 0; dwIds < sizeof(adwIds) / sizeof(adwIds[0]); dwIds++)
+	{
+		for (cchDigits = 0; (cchDigits < cchValue) && (isxdigit((UCHAR)pszValue[cchDigits])); cchDigits++)
+		{
+			adwIds[dwIds] = (adwIds[dwIds] << 4) | (DWORD)(isdigit((UCHAR)pszValue[cchDigits]) ?
+				pszValue[cchDigits] - '0' :
+				tolower((UCHAR)pszValue[cchDigits]) - 'a' + 10);
+		}
+		if ((0 == cchDigits) || (4 < cchDigits))
+		{
+			return FALSE;
+		}
+		pszValue += cchDigits;
+		cchValue -= cchDigits;
+		if ((0 == cchValue) || ('-' != *pszValue) || (1 == dwIds))
+		{
+			break;
+		}
+		pszValue++;
+		cchValue--;
+	}
+	if (0 != cchValue)
+	{
+		return FALSE;
+	}
+
+	// A single ID is a range of one
+	*pwLow = (WORD)adwIds[0];
+	*pwHigh = (WORD)((0 == dwIds) ? adwIds[0] : adwIds[1]);
+	return *pwLow <= *pwHigh;
+}
+
+/********************************************************************************
+*  Function:	rules_ParseMinute												*
+*  Purpose:		Parses "HH:MM".													*
+*  Parameters:	@ pszText ~[in]~ The text (at least 5 characters).				*
+*				@ pwMinute ~[out]~ Gets the minute of the day.					*
+*  Returns:		TRUE if the text is well formed.								*
+********************************************************************************/
+static
+BOOL
+rules_ParseMinute(
+	__in_ecount(5) PCSTR pszText,
+	__out PWORD pwMinute
+)
+{
+	DWORD dwHours = 0;
+	DWORD dwMinutes = 0;
+
+	if ((!isdigit((UCHAR)pszText[0])) || (!isdigit((UCHAR)pszText[1])) || (':' != pszText[2]) ||
+		(!isdigit((UCHAR)pszText[3])) || (!isdigit((UCHAR)pszText[4])))
+	{
+		return FALSE;
+	}
+	dwHours = (DWORD)(pszText[0] - '0') * 10 + (DWORD)(pszText[1] - '0');
+	dwMinutes = (DWORD)(pszText[3] - '0') * 10 + (DWORD)(pszText[4] - '0');
+	*pwMinute = (WORD)(dwHours * 60 + dwMinutes);
+	return (24 > dwHours) && (60 > dwMinutes);
+}
+
+/********************************************************************************
+*  Function:	rules_ParseSerial												*
+*  Purpose:		Parses a serial pattern.										*
+*  Parameters:	@ pszValue ~[in]~ The pattern (not NUL terminated).				*
+*				@ cchValue ~[in]~ Its length.									*
+*				@ ptRule ~[inout]~ Gets the serial condition.					*
+*  Returns:		TRUE if the pattern is well formed.								*
+********************************************************************************/
+static
+BOOL
+rules_ParseSerial(
+	__in_ecount(cchValue) PCSTR pszValue,
+	__in SIZE_T cchValue,
+	__inout PRULES_RULE ptRule
+)
+{
+	SIZE_T cchIndex = 0;
+
+	// "-" is a device without a serial, "*" any device
+	if (rules_IsToken(pszValue, cchValue, "-"))
+	{
+		ptRule->eSerialMatch = RULES_SERIAL_MATCH_EXACT;
+		return TRUE;
+	}
+	if (rules_IsToken(pszValue, cchValue, "*"))
+	{
+		ptRule->eSerialMatch = RULES_SERIAL_MATCH_ANY;
+		return TRUE;
+	}
+	ptRule->eSerialMatch = RULES_SERIAL_MATCH_EXACT;
+	if ((0 != cchValue) && ('*' == pszValue[cchValue - 1]))
+	{
+		ptRule->eSerialMatch = RULES_SERIAL_MATCH_PREFIX;
+		cchValue--;
+	}
+	if ((0 == cchValue) || (sizeof(ptRule->szSerial) <= cchValue))
+	{
+		return FALSE;
+	}
+
+	// Upper case, as identities keep it
+	for (cchIndex = 0; cchIndex < cchValue; cchIndex++)
+	{
+		if ('*' == pszValue[cchIndex])
+		{
+			return FALSE;
+		}
+		ptRule->szSerial[cchIndex] = (CHAR)toupper((UCHAR)pszValue[cchIndex]);
+	}
+	ptRule->szSerial[cchValue] = '\0';
+	return TRUE;
+}
+
+/********************************************************************************
+*  Function:	rules_ParseCondition											*
+*  Purpose:		Parses a "name=value" condition into a rule.					*
+*  Parameters:	@ pszToken ~[in]~ The condition (not NUL terminated).			*
+*				@ cchToken ~[in]~ Its length.									*
+*				@ pdwSeen ~[inout]~ Conditions given so far, by bit.			*
+*				@ ptRule ~[inout]~ Gets the condition.							*
+*  Returns:		TRUE if the condition is well formed and new.					*
+********************************************************************************/
+static
+BOOL
+rules_ParseCondition(
+	__in_ecount(cchToken) PCSTR pszToken,
+	__in SIZE_T cchToken,
+	__inout PDWORD pdwSeen,
+	__inout PRULES_RULE ptRule
+)
+{
+	static const PCSTR s_apszConditions[] = { "event", "class", "vid", "pid", "serial", "session", "time", "cadence" };
+	PCSTR pszValue = NULL;
+	SIZE_T cchName = 0;
+	SIZE_T cchValue = 0;
+	DWORD dwCondition = 0;
+	BOOL bIsValid = FALSE;
+
+	// Split at '=', each condition may only be given once
+	for (cchName = 0; (cchName < cchToken) && ('=' != pszToken[cchName]); cchName++)
+	{
+	}
+	if (cchName == cchToken)
+	{
+		return FALSE;
+	}
+	pszValue = pszToken + cchName + 1;
+	cchValue = cchToken - cchName - 1;
+	for (dwCondition = 0;
+		(dwCondition < sizeof(s_apszConditions) / sizeof(s_apszConditions[0])) &&
+		(!rules_IsToken(pszToken, cchName, s_apszConditions[dwCondition]));
+		dwCondition++)
+	{
+	}
+	if ((sizeof(s_apszConditions) / sizeof(s_apszConditions[0]) == dwCondition) || (0 != (*pdwSeen & (1UL << dwCondition))))
+	{
+		return FALSE;
+	}
+	*pdwSeen |= 1UL << dwCondition;
+
+	// Parse the value, in s_apszConditions order
+	switch (dwCondition)
+	{
+	case 0:
+		bIsValid = rules_ParseMask(pszValue, cchValue, g_apszEventNames, RULES_EVENT_TYPES, &(ptRule->bEventMask));
+		break;
+
+	case 1:
+		bIsValid = rules_ParseMask(pszValue, cchValue, g_apszClassNames, RULES_DEVICE_CLASSES, &(ptRule->bClassMask));
+		break;
+
+	case 2:
+		ptRule->bHasVendorId = TRUE;
+		bIsValid = rules_ParseIdRange(pszValue, cchValue, &(ptRule->wVendorLow), &(ptRule->wVendorHigh));
+		break;
+
+	case 3:
+		ptRule->bHasProductId = TRUE;
+		bIsValid = rules_ParseIdRange(pszValue, cchValue, &(ptRule->wProductLow), &(ptRule->wProductHigh));
+		break;
+
+	case 4:
+		bIsValid = rules_ParseSerial(pszValue, cchValue, ptRule);
+		break;
+
+	case 5:
+
+		// The session state is not tracked (see RULES_SESSION), such a rule could never match
+		DEBUG_MSG(LOG_SEV_ERROR,
+			"Line %lu: session= is not supported.",
+			(unsigned long)ptRule->dwLine);
+		bIsValid = FALSE;
+		break;
+
+	case 6:
+		ptRule->bHasTime = TRUE;
+		bIsValid = (11 == cchValue) &&
+			rules_ParseMinute(pszValue, &(ptRule->wMinuteStart)) &&
+			('-' == pszValue[5]) &&
+			rules_ParseMinute(pszValue + 6, &(ptRule->wMinuteEnd));
+		break;
+
+	default:
+		bIsValid = rules_ParseMask(pszValue, cchValue, g_apszVerdictNames, RULES_VERDICTS, &(ptRule->bVerdictMask));
+		break;
+	}
+
+	// Return result
+	return bIsValid;
+}
+
+/********************************************************************************
+*  Function:	rules_FreeSets													*
+*  Purpose:		Frees class sets.												*
+*  Parameters:	@ ptSets ~[inout]~ The sets (may be zeroed).					*
+********************************************************************************/
+static
+VOID
+rules_FreeSets(
+	__inout PRULES_SETS ptSets
+)
+{
+	// Free resources
+	FREE(ptSets->pqwBits);
+	FREE(ptSets->pdwSlots);
+	RtlZeroMemory(ptSets, sizeof(*ptSets));
+}
+
+/********************************************************************************
+*  Function:	rules_GetSet													*
+*  Purpose:		Gets the rule set of a class.									*
+*  Parameters:	@ ptSets ~[in]~ The sets.										*
+*				@ dwClass ~[in]~ The class.										*
+*  Returns:		The bitset.														*
+********************************************************************************/
+static
+__inline
+const ULONGLONG *
+rules_GetSet(
+	__in PCRULES_SETS ptSets,
+	__in DWORD dwClass
+)
+{
+	return ptSets->pqwBits + ((SIZE_T)dwClass * ptSets->dwWords);
+}
+
+/********************************************************************************
+*  Function:	rules_HashSet													*
+*  Purpose:		Hashes a rule set.												*
+*  Parameters:	@ pqwBits ~[in]~ The bitset.									*
+*				@ dwWords ~[in]~ Its words.										*
+*  Returns:		The hash.														*
+********************************************************************************/
+static
+__inline
+DWORD
+rules_HashSet(
+	__in_ecount(dwWords) const ULONGLONG *pqwBits,
+	__in DWORD dwWords
+)
+{
+	ULONGLONG qwHash = 0;
+	DWORD dwWord = 0;
+
+	for (dwWord = 0; dwWord < dwWords; dwWord++)
+	{
+		qwHash = (qwHash ^ pqwBits[dwWord]) * RULES_HASH_MULTIPLIER;
+	}
+
+	// Return result
+	return (DWORD)(qwHash >> 32);
+}
+
+/********************************************************************************
+*  Function:	rules_GrowSets													*
+*  Purpose:		Doubles the capacity of class sets, and rehashes them.			*
+*  Parameters:	@ ptSets ~[inout]~ The sets.									*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+rules_GrowSets(
+	__inout PRULES_SETS ptSets
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	PULONGLONG pqwBits = NULL;
+	PDWORD pdwSlots = NULL;
+	DWORD dwCapacity = MAX(ptSets->dwCapacity * 2, RULES_MIN_SETS);
+	DWORD dwSlotMask = dwCapacity * 2 - 1;
+	DWORD dwClass = 0;
+	DWORD dwSlot = 0;
+
+	// Keep at most 50% load
+	pqwBits = (PULONGLONG)ALLOCZ((SIZE_T)dwCapacity * ptSets->dwWords * sizeof(pqwBits[0]));
+	pdwSlots = (PDWORD)ALLOCZ(((SIZE_T)dwSlotMask + 1) * sizeof(pdwSlots[0]));
+	if ((NULL == pqwBits) || (NULL == pdwSlots))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"ALLOCZ() failure.");
+		goto lblCleanup;
+	}
+	if (0 != ptSets->dwCount)
+	{
+		RtlCopyMemory(pqwBits, ptSets->pqwBits, (SIZE_T)ptSets->dwCount * ptSets->dwWords * sizeof(pqwBits[0]));
+	}
+	for (dwClass = 0; dwClass < ptSets->dwCount; dwClass++)
+	{
+		for (dwSlot = rules_HashSet(rules_GetSet(ptSets, dwClass), ptSets->dwWords) & dwSlotMask;
+			0 != pdwSlots[dwSlot];
+			dwSlot = (dwSlot + 1) & dwSlotMask)
+		{
+		}
+		pdwSlots[dwSlot] = dwClass + 1;
+	}
+
+	// Swap them in
+	FREE(ptSets->pqwBits);
+	FREE(ptSets->pdwSlots);
+	ptSets->pqwBits = pqwBits;
+	ptSets->pdwSlots = pdwSlots;
+	ptSets->dwCapacity = dwCapacity;
+	ptSets->dwSlotMask = dwSlotMask;
+	pqwBits = NULL;
+	pdwSlots = NULL;
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	FREE(pqwBits);
+	FREE(pdwSlots);
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	rules_Intern													*
+*  Purpose:		Gets the class of a rule set, adding it if new.					*
+*  Parameters:	@ ptSets ~[inout]~ The sets (dwWords set).						*
+*				@ pqwBits ~[in]~ The rule set.									*
+*				@ pdwClass ~[out]~ Gets its class.								*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+rules_Intern(
+	__inout PRULES_SETS ptSets,
+	__in const ULONGLONG *pqwBits,
+	__out PDWORD pdwClass
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	SIZE_T cbSet = ptSets->dwWords * sizeof(pqwBits[0]);
+	DWORD dwSlot = 0;
+	DWORD dwClass = 0;
+
+	// Make room first, so the probe below ends on a free slot
+	if (ptSets->dwCount == ptSets->dwCapacity)
+	{
+		eStatus = rules_GrowSets(ptSets);
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			goto lblCleanup;
+		}
+	}
+
+	// Known sets keep their class
+	for (dwSlot = rules_HashSet(pqwBits, ptSets->dwWords) & ptSets->dwSlotMask;
+		0 != ptSets->pdwSlots[dwSlot];
+		dwSlot = (dwSlot + 1) & ptSets->dwSlotMask)
+	{
+		dwClass = ptSets->pdwSlots[dwSlot] - 1;
+		if (0 == memcmp(rules_GetSet(ptSets, dwClass), pqwBits, cbSet))
+		{
+			*pdwClass = dwClass;
+			eStatus = RETSTATUS_SUCCESS;
+			goto lblCleanup;
+		}
+	}
+
+	// New sets get the next class
+	if (RULES_MAX_CLASSES <= ptSets->dwCount)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"Too many classes (over %lu), the rules are too complex.",
+			(unsigned long)RULES_MAX_CLASSES);
+		goto lblCleanup;
+	}
+	dwClass = ptSets->dwCount++;
+	RtlCopyMemory(ptSets->pqwBits + ((SIZE_T)dwClass * ptSets->dwWords), pqwBits, cbSet);
+	ptSets->pdwSlots[dwSlot] = dwClass + 1;
+	*pdwClass = dwClass;
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	rules_AllocateSection											*
+*  Purpose:		Allocates a section of a compilation.							*
+*  Parameters:	@ ptCompiler ~[inout]~ The compilation.							*
+*				@ eSection ~[in]~ The section.									*
+*				@ cbSection ~[in]~ Its size.									*
+*  Returns:		The zeroed section, or NULL.									*
+********************************************************************************/
+static
+PVOID
+rules_AllocateSection(
+	__inout PRULES_COMPILER ptCompiler,
+	__in RULES_SECTION eSection,
+	__in SIZE_T cbSection
+)
+{
+	ptCompiler->apvSections[eSection] = ALLOCZ(MAX(cbSection, 1));
+	ptCompiler->acbSections[eSection] = cbSection;
+	if (NULL == ptCompiler->apvSections[eSection])
+	{
+		DEBUG_MSG(LOG_SEV_ERROR, "ALLOCZ() failure.");
+	}
+
+	// Return result
+	return ptCompiler->apvSections[eSection];
+}
+
+/********************************************************************************
+*  Function:	rules_CompareToggles											*
+*  Purpose:		Orders ID toggles by ID.										*
+*  Parameters:	@ pvFirst ~[in]~ A toggle (ID << 16 | rule index).				*
+*				@ pvSecond ~[in]~ Another toggle.								*
+*  Returns:		Negative, zero or positive, as qsort expects.					*
+********************************************************************************/
+static
+INT
+rules_CompareToggles(
+	__in PCVOID pvFirst,
+	__in PCVOID pvSecond
+)
+{
+	DWORD dwFirst = *(const DWORD *)pvFirst;
+	DWORD dwSecond = *(const DWORD *)pvSecond;
+
+	return (dwFirst > dwSecond) - (dwFirst < dwSecond);
+}
+
+/********************************************************************************
+*  Function:	rules_CompileIds												*
+*  Purpose:		Builds the vendor or product dimension.							*
+*  Parameters:	@ ptCompiler ~[inout]~ The compilation.							*
+*				@ bIsProduct ~[in]~ Product IDs rather than vendor IDs.			*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Sweeps the IDs once: a rule's bit toggles on at its first		*
+*					ID and off past its last, and a class is only looked up		*
+*					where some bit toggled.										*
+********************************************************************************/
+static
+RETSTATUS
+rules_CompileIds(
+	__inout PRULES_COMPILER ptCompiler,
+	__in BOOL bIsProduct
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	PRULES_SETS ptSets = &(ptCompiler->atSets[bIsProduct ? RULES_CLASS_PRODUCT : RULES_CLASS_VENDOR]);
+	PCRULES_RULE ptRule = NULL;
+	PDWORD pdwToggles = NULL;
+	PWORD pwClasses = NULL;
+	DWORD dwToggles = 0;
+	DWORD dwToggle = 0;
+	DWORD dwRule = 0;
+	DWORD dwId = 0;
+	DWORD dwClass = 0;
+	BOOL bHasId = FALSE;
+	BOOL bIsChanged = FALSE;
+	WORD wLow = 0;
+	WORD wHigh = 0;
+
+	pdwToggles = (PDWORD)ALLOCZ(((SIZE_T)ptCompiler->ptList->dwRules * 2 + 1) * sizeof(pdwToggles[0]));
+	pwClasses = (PWORD)rules_AllocateSection(ptCompiler,
+		bIsProduct ? RULES_SECTION_PRODUCTS : RULES_SECTION_VENDORS,
+		RULES_ID_VALUES * sizeof(pwClasses[0]));
+	if ((NULL == pdwToggles) || (NULL == pwClasses))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"ALLOCZ() failure.");
+		goto lblCleanup;
+	}
+
+	// Rules without the condition match every ID, and they alone match events without an identity
+	RtlZeroMemory(ptCompiler->pqwScratch, ptCompiler->dwWords * sizeof(ptCompiler->pqwScratch[0]));
+	for (dwRule = 0; dwRule < ptCompiler->ptList->dwRules; dwRule++)
+	{
+		ptRule = &(ptCompiler->ptList->ptRules[dwRule]);
+		bHasId = bIsProduct ? ptRule->bHasProductId : ptRule->bHasVendorId;
+		wLow = bIsProduct ? ptRule->wProductLow : ptRule->wVendorLow;
+		wHigh = bIsProduct ? ptRule->wProductHigh : ptRule->wVendorHigh;
+		if (!bHasId)
+		{
+			ptCompiler->pqwScratch[dwRule / 64] |= 1ULL << (dwRule % 64);
+			continue;
+		}
+		pdwToggles[dwToggles++] = ((DWORD)wLow << 16) | dwRule;
+		if (0xFFFF != wHigh)
+		{
+			pdwToggles[dwToggles++] = ((DWORD)(wHigh + 1) << 16) | dwRule;
+		}
+	}
+	eStatus = rules_Intern(ptSets, ptCompiler->pqwScratch, &dwClass);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		goto lblCleanup;
+	}
+	pwClasses[RULES_UNKNOWN_ID] = (WORD)dwClass;
+
+	// Sweep the IDs from there
+	qsort(pdwToggles, dwToggles, sizeof(pdwToggles[0]), rules_CompareToggles);
+	for (dwId = 0; dwId < RULES_UNKNOWN_ID; dwId++)
+	{
+		bIsChanged = (0 == dwId);
+		for (; (dwToggle < dwToggles) && ((pdwToggles[dwToggle] >> 16) == dwId); dwToggle++)
+		{
+			dwRule = pdwToggles[dwToggle] & 0xFFFF;
+			ptCompiler->pqwScratch[dwRule / 64] ^= 1ULL << (dwRule % 64);
+			bIsChanged = TRUE;
+		}
+		if (bIsChanged)
+		{
+			eStatus = rules_Intern(ptSets, ptCompiler->pqwScratch, &dwClass);
+			if (RETSTATUS_FAILED(eStatus))
+			{
+				goto lblCleanup;
+			}
+		}
+		pwClasses[dwId] = (WORD)dwClass;
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	FREE(pdwToggles);
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	rules_CompileMinutes											*
+*  Purpose:		Builds the time of day dimension.								*
+*  Parameters:	@ ptCompiler ~[inout]~ The compilation.							*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+rules_CompileMinutes(
+	__inout PRULES_COMPILER ptCompiler
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	PWORD pwClasses = NULL;
+	DWORD dwMinute = 0;
+	DWORD dwRule = 0;
+	DWORD dwClass = 0;
+
+	pwClasses = (PWORD)rules_AllocateSection(ptCompiler, RULES_SECTION_MINUTES, RULES_MINUTES_PER_DAY * sizeof(pwClasses[0]));
+	if (NULL == pwClasses)
+	{
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	for (dwMinute = 0; dwMinute < RULES_MINUTES_PER_DAY; dwMinute++)
+	{
+		RtlZeroMemory(ptCompiler->pqwScratch, ptCompiler->dwWords * sizeof(ptCompiler->pqwScratch[0]));
+		for (dwRule = 0; dwRule < ptCompiler->ptList->dwRules; dwRule++)
+		{
+			if (rules_IsMinuteInRange(&(ptCompiler->ptList->ptRules[dwRule]), dwMinute))
+			{
+				ptCompiler->pqwScratch[dwRule / 64] |= 1ULL << (dwRule % 64);
+			}
+		}
+		eStatus = rules_Intern(&(ptCompiler->atSets[RULES_CLASS_MINUTE]), ptCompiler->pqwScratch, &dwClass);
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			goto lblCleanup;
+		}
+		pwClasses[dwMinute] = (WORD)dwClass;
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	rules_CompileContexts											*
+*  Purpose:		Builds the context dimension (event type, device class,			*
+*				session state and cadence verdict).								*
+*  Parameters:	@ ptCompiler ~[inout]~ The compilation.							*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+rules_CompileContexts(
+	__inout PRULES_COMPILER ptCompiler
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	PCRULES_RULE ptRule = NULL;
+	PWORD pwClasses = NULL;
+	DWORD dwType = 0;
+	DWORD dwClass = 0;
+	DWORD dwSession = 0;
+	DWORD dwVerdict = 0;
+	DWORD dwRule = 0;
+	DWORD dwContext = 0;
+
+	pwClasses = (PWORD)rules_AllocateSection(ptCompiler, RULES_SECTION_CONTEXTS, RULES_CONTEXTS * sizeof(pwClasses[0]));
+	if (NULL == pwClasses)
+	{
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	for (dwContext = 0; dwContext < RULES_CONTEXTS; dwContext++)
+	{
+		// Decode the index the way rules_GetContext builds it
+		dwVerdict = dwContext % RULES_VERDICTS;
+		dwSession = (dwContext / RULES_VERDICTS) % RULES_SESSIONS;
+		dwClass = (dwContext / (RULES_VERDICTS * RULES_SESSIONS)) % RULES_DEVICE_CLASSES;
+		dwType = dwContext / (RULES_VERDICTS * RULES_SESSIONS * RULES_DEVICE_CLASSES);
+		ASSERT(rules_GetContext(dwType, dwClass, dwSession, dwVerdict) == dwContext);
+
+		RtlZeroMemory(ptCompiler->pqwScratch, ptCompiler->dwWords * sizeof(ptCompiler->pqwScratch[0]));
+		for (dwRule = 0; dwRule < ptCompiler->ptList->dwRules; dwRule++)
+		{
+			ptRule = &(ptCompiler->ptList->ptRules[dwRule]);
+			if ((0 != (ptRule->bEventMask & (1 << dwType))) &&
+				(0 != (ptRule->bClassMask & (1 << dwClass))) &&
+				(0 != (ptRule->bSessionMask & (1 << dwSession))) &&
+				(0 != (ptRule->bVerdictMask & (1 << dwVerdict))))
+			{
+				ptCompiler->pqwScratch[dwRule / 64] |= 1ULL << (dwRule % 64);
+			}
+		}
+		eStatus = rules_Intern(&(ptCompiler->atSets[RULES_CLASS_CONTEXT]), ptCompiler->pqwScratch, &dwClass);
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			goto lblCleanup;
+		}
+		pwClasses[dwContext] = (WORD)dwClass;
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	rules_CompileSerials											*
+*  Purpose:		Builds the serial dimension: a trie of the serial patterns.		*
+*  Parameters:	@ ptCompiler ~[inout]~ The compilation.							*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* A serial walks the trie until it ends or leaves it. The		*
+*					node it stops on has the class of the patterns matched		*
+*					either way: prefixes along the path, plus the exact			*
+*					pattern of the node if the serial ended there.				*
+*				* Nodes are numbered in creation order, so parents come			*
+*					before their children.										*
+********************************************************************************/
+static
+RETSTATUS
+rules_CompileSerials(
+	__inout PRULES_COMPILER ptCompiler
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	PRULES_SETS ptSets = &(ptCompiler->atSets[RULES_CLASS_SERIAL]);
+	PCRULES_RULE ptRule = NULL;
+	PRULES_SERIAL_NODE ptNodes = NULL;
+	PRULES_SERIAL_EDGE ptEdges = NULL;
+	PDWORD pdwParents = NULL;
+	PDWORD pdwFirstRules = NULL;
+	PDWORD pdwNextRules = NULL;
+	PDWORD pdwPastClasses = NULL;
+	PCSTR pszCurrent = NULL;
+	SIZE_T cchPatterns = 0;
+	DWORD dwMaxNodes = 1;
+	DWORD dwSlots = 16;
+	DWORD dwNode = 0;
+	DWORD dwSlot = 0;
+	DWORD dwKey = 0;
+	DWORD dwRule = 0;
+	DWORD dwClass = 0;
+
+	// Size the trie by the pattern lengths, at most 50% edge load
+	for (dwRule = 0; dwRule < ptCompiler->ptList->dwRules; dwRule++)
+	{
+		cchPatterns += strlen(ptCompiler->ptList->ptRules[dwRule].szSerial);
+	}
+	dwMaxNodes = (DWORD)cchPatterns + 1;
+	if (RULES_MAX_SERIAL_NODES < dwMaxNodes)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"Too many serial pattern characters (%lu).",
+			(unsigned long)cchPatterns);
+		goto lblCleanup;
+	}
+	while (dwSlots < dwMaxNodes * 2)
+	{
+		dwSlots *= 2;
+	}
+	ptNodes = (PRULES_SERIAL_NODE)ALLOCZ((SIZE_T)dwMaxNodes * sizeof(ptNodes[0]));
+	ptEdges = (PRULES_SERIAL_EDGE)rules_AllocateSection(ptCompiler, RULES_SECTION_SERIAL_EDGES, (SIZE_T)dwSlots * sizeof(ptEdges[0]));
+	pdwParents = (PDWORD)ALLOCZ((SIZE_T)dwMaxNodes * sizeof(pdwParents[0]));
+	pdwFirstRules = (PDWORD)ALLOCZ((SIZE_T)dwMaxNodes * sizeof(pdwFirstRules[0]));
+	pdwNextRules = (PDWORD)ALLOCZ(((SIZE_T)ptCompiler->ptList->dwRules + 1) * sizeof(pdwNextRules[0]));
+	pdwPastClasses = (PDWORD)ALLOCZ((SIZE_T)dwMaxNodes * sizeof(pdwPastClasses[0]));
+	if ((NULL == ptNodes) || (NULL == ptEdges) || (NULL == pdwParents) ||
+		(NULL == pdwFirstRules) || (NULL == pdwNextRules) || (NULL == pdwPastClasses))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"ALLOCZ() failure.");
+		goto lblCleanup;
+	}
+
+	// Insert every pattern, listing its rule on the node it ends on (lists hold rule + 1)
+	ptCompiler->dwSerialNodes = 1;
+	for (dwRule = ptCompiler->ptList->dwRules; dwRule-- > 0;)
+	{
+		ptRule = &(ptCompiler->ptList->ptRules[dwRule]);
+		if (RULES_SERIAL_MATCH_ANY == ptRule->eSerialMatch)
+		{
+			continue;
+		}
+		dwNode = 0;
+		for (pszCurrent = ptRule->szSerial; '\0' != *pszCurrent; pszCurrent++)
+		{
+			dwKey = (dwNode << 8) | (BYTE)*pszCurrent;
+			dwSlot = rules_FindEdge(ptEdges, dwSlots - 1, dwKey);
+			if (0 == ptEdges[dwSlot].dwKey)
+			{
+				pdwParents[ptCompiler->dwSerialNodes] = dwNode;
+				ptEdges[dwSlot].dwKey = dwKey;
+				ptEdges[dwSlot].dwChild = ptCompiler->dwSerialNodes++;
+			}
+			dwNode = ptEdges[dwSlot].dwChild;
+		}
+		pdwNextRules[dwRule] = pdwFirstRules[dwNode];
+		pdwFirstRules[dwNode] = dwRule + 1;
+	}
+
+	// Classes, from the root down: the parent's prefixes, then the node's own patterns
+	for (dwNode = 0; dwNode < ptCompiler->dwSerialNodes; dwNode++)
+	{
+		if (0 == dwNode)
+		{
+			RtlZeroMemory(ptCompiler->pqwScratch, ptCompiler->dwWords * sizeof(ptCompiler->pqwScratch[0]));
+			for (dwRule = 0; dwRule < ptCompiler->ptList->dwRules; dwRule++)
+			{
+				if (RULES_SERIAL_MATCH_ANY == ptCompiler->ptList->ptRules[dwRule].eSerialMatch)
+				{
+					ptCompiler->pqwScratch[dwRule / 64] |= 1ULL << (dwRule % 64);
+				}
+			}
+		}
+		else
+		{
+			RtlCopyMemory(ptCompiler->pqwScratch,
+				rules_GetSet(ptSets, pdwPastClasses[pdwParents[dwNode]]),
+				ptCompiler->dwWords * sizeof(ptCompiler->pqwScratch[0]));
+		}
+		for (dwRule = pdwFirstRules[dwNode]; 0 != dwRule; dwRule = pdwNextRules[dwRule - 1])
+		{
+			if (RULES_SERIAL_MATCH_PREFIX == ptCompiler->ptList->ptRules[dwRule - 1].eSerialMatch)
+			{
+				ptCompiler->pqwScratch[(dwRule - 1) / 64] |= 1ULL << ((dwRule - 1) % 64);
+			}
+		}
+		eStatus = rules_Intern(ptSets, ptCompiler->pqwScratch, &(pdwPastClasses[dwNode]));
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			goto lblCleanup;
+		}
+		if (0 == dwNode)
+		{
+			// Rules without a serial condition alone match events without an identity
+			ptCompiler->dwUnknownSerialClass = pdwPastClasses[0];
+		}
+		ptNodes[dwNode].wPastClass = (WORD)pdwPastClasses[dwNode];
+		for (dwRule = pdwFirstRules[dwNode]; 0 != dwRule; dwRule = pdwNextRules[dwRule - 1])
+		{
+			ptCompiler->pqwScratch[(dwRule - 1) / 64] |= 1ULL << ((dwRule - 1) % 64);
+		}
+		eStatus = rules_Intern(ptSets, ptCompiler->pqwScratch, &dwClass);
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			goto lblCleanup;
+		}
+		ptNodes[dwNode].wEndClass = (WORD)dwClass;
+	}
+
+	// Keep the used nodes
+	if (NULL == rules_AllocateSection(ptCompiler,
+		RULES_SECTION_SERIAL_NODES,
+		(SIZE_T)ptCompiler->dwSerialNodes * sizeof(ptNodes[0])))
+	{
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	RtlCopyMemory(ptCompiler->apvSections[RULES_SECTION_SERIAL_NODES], ptNodes, (SIZE_T)ptCompiler->dwSerialNodes * sizeof(ptNodes[0]));
+	ptCompiler->dwSerialEdgeSlots = dwSlots;
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	FREE(ptNodes);
+	FREE(pdwParents);
+	FREE(pdwFirstRules);
+	FREE(pdwNextRules);
+	FREE(pdwPastClasses);
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	rules_ReleaseClass												*
+*  Purpose:		Records the class count of a dimension or phase that is no		*
+*				longer needed, and frees its sets.								*
+*  Parameters:	@ ptCompiler ~[inout]~ The compilation.							*
+*				@ eClass ~[in]~ The dimension or phase.							*
+********************************************************************************/
+static
+VOID
+rules_ReleaseClass(
+	__inout PRULES_COMPILER ptCompiler,
+	__in RULES_CLASS eClass
+)
+{
+	ptCompiler->adwClasses[eClass] = ptCompiler->atSets[eClass].dwCount;
+	rules_FreeSets(&(ptCompiler->atSets[eClass]));
+}
+
+/********************************************************************************
+*  Function:	rules_CompilePhase												*
+*  Purpose:		Builds a phase table: the class of every pair of classes.		*
+*  Parameters:	@ ptCompiler ~[inout]~ The compilation.							*
+*				@ eFirst ~[in]~ The row dimension or phase.						*
+*				@ eSecond ~[in]~ The column dimension or phase.					*
+*				@ eResult ~[in]~ The phase.										*
+*				@ eSection ~[in]~ The phase table.								*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Releases eFirst and eSecond, nothing else needs them.			*
+********************************************************************************/
+static
+RETSTATUS
+rules_CompilePhase(
+	__inout PRULES_COMPILER ptCompiler,
+	__in RULES_CLASS eFirst,
+	__in RULES_CLASS eSecond,
+	__in RULES_CLASS eResult,
+	__in RULES_SECTION eSection
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	PCRULES_SETS ptFirst = &(ptCompiler->atSets[eFirst]);
+	PCRULES_SETS ptSecond = &(ptCompiler->atSets[eSecond]);
+	const ULONGLONG *pqwFirst = NULL;
+	const ULONGLONG *pqwSecond = NULL;
+	PWORD pwClasses = NULL;
+	ULONGLONG qwEntries = (ULONGLONG)ptFirst->dwCount * ptSecond->dwCount;
+	DWORD dwRow = 0;
+	DWORD dwColumn = 0;
+	DWORD dwWord = 0;
+	DWORD dwClass = 0;
+
+	// Validations
+	if (RULES_MAX_TABLE_ENTRIES < qwEntries)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"Phase %d needs %llu entries (%lu x %lu classes), the rules are too complex.",
+			(INT)eResult,
+			qwEntries,
+			(unsigned long)ptFirst->dwCount,
+			(unsigned long)ptSecond->dwCount);
+		goto lblCleanup;
+	}
+
+	// Intersect every pair
+	pwClasses = (PWORD)rules_AllocateSection(ptCompiler, eSection, (SIZE_T)qwEntries * sizeof(pwClasses[0]));
+	if (NULL == pwClasses)
+	{
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	for (dwRow = 0; dwRow < ptFirst->dwCount; dwRow++)
+	{
+		pqwFirst = rules_GetSet(ptFirst, dwRow);
+		for (dwColumn = 0; dwColumn < ptSecond->dwCount; dwColumn++)
+		{
+			pqwSecond = rules_GetSet(ptSecond, dwColumn);
+			for (dwWord = 0; dwWord < ptCompiler->dwWords; dwWord++)
+			{
+				ptCompiler->pqwScratch[dwWord] = pqwFirst[dwWord] & pqwSecond[dwWord];
+			}
+			eStatus = rules_Intern(&(ptCompiler->atSets[eResult]), ptCompiler->pqwScratch, &dwClass);
+			if (RETSTATUS_FAILED(eStatus))
+			{
+				goto lblCleanup;
+			}
+			pwClasses[((SIZE_T)dwRow * ptSecond->dwCount) + dwColumn] = (WORD)dwClass;
+		}
+	}
+	rules_ReleaseClass(ptCompiler, eFirst);
+	rules_ReleaseClass(ptCompiler, eSecond);
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	rules_CompileMatches											*
+*  Purpose:		Builds the last phase table: the first rule matched by every	*
+*				pair of device and environment classes.							*
+*  Parameters:	@ ptCompiler ~[inout]~ The compilation.							*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+rules_CompileMatches(
+	__inout PRULES_COMPILER ptCompiler
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	PCRULES_SETS ptDevices = &(ptCompiler->atSets[RULES_CLASS_DEVICE]);
+	PCRULES_SETS ptEnvironments = &(ptCompiler->atSets[RULES_CLASS_ENVIRONMENT]);
+	const ULONGLONG *pqwDevice = NULL;
+	const ULONGLONG *pqwEnvironment = NULL;
+	PWORD pwMatches = NULL;
+	ULONGLONG qwEntries = (ULONGLONG)ptDevices->dwCount * ptEnvironments->dwCount;
+	ULONGLONG qwBits = 0;
+	DWORD dwRow = 0;
+	DWORD dwColumn = 0;
+	DWORD dwWord = 0;
+	DWORD dwRule = 0;
+
+	// Validations
+	if (RULES_MAX_TABLE_ENTRIES < qwEntries)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"The match table needs %llu entries (%lu x %lu classes), the rules are too complex.",
+			qwEntries,
+			(unsigned long)ptDevices->dwCount,
+			(unsigned long)ptEnvironments->dwCount);
+		goto lblCleanup;
+	}
+
+	// Only the lowest rule of each intersection matters (rule + 1, 0 for none)
+	pwMatches = (PWORD)rules_AllocateSection(ptCompiler, RULES_SECTION_MATCHES, (SIZE_T)qwEntries * sizeof(pwMatches[0]));
+	if (NULL == pwMatches)
+	{
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	for (dwRow = 0; dwRow < ptDevices->dwCount; dwRow++)
+	{
+		pqwDevice = rules_GetSet(ptDevices, dwRow);
+		for (dwColumn = 0; dwColumn < ptEnvironments->dwCount; dwColumn++)
+		{
+			pqwEnvironment = rules_GetSet(ptEnvironments, dwColumn);
+			for (dwWord = 0, qwBits = 0; (0 == qwBits) && (dwWord < ptCompiler->dwWords); dwWord++)
+			{
+				qwBits = pqwDevice[dwWord] & pqwEnvironment[dwWord];
+			}
+			if (0 == qwBits)
+			{
+				continue;
+			}
+			for (dwRule = (dwWord - 1) * 64; 0 == (qwBits & 1); qwBits >>= 1)
+			{
+				dwRule++;
+			}
+			pwMatches[((SIZE_T)dwRow * ptEnvironments->dwCount) + dwColumn] = (WORD)(dwRule + 1);
+		}
+	}
+	rules_ReleaseClass(ptCompiler, RULES_CLASS_DEVICE);
+	rules_ReleaseClass(ptCompiler, RULES_CLASS_ENVIRONMENT);
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	rules_GetSectionSize											*
+*  Purpose:		Gets the size of a section of a compiled table.					*
+*  Parameters:	@ ptHeader ~[in]~ The table's header.							*
+*				@ eSection ~[in]~ The section.									*
+*  Returns:		The size in bytes.												*
+*  Remarks:		* Counts are 32-bit, so no size overflows 64 bits.				*
+********************************************************************************/
+static
+ULONGLONG
+rules_GetSectionSize(
+	__in PCRULES_TABLE_HEADER ptHeader,
+	__in RULES_SECTION eSection
+)
+{
+	const DWORD *pdwClasses = ptHeader->adwClasses;
+
+	switch (eSection)
+	{
+	case RULES_SECTION_VENDORS:
+	case RULES_SECTION_PRODUCTS:
+		return RULES_ID_VALUES * sizeof(WORD);
+
+	case RULES_SECTION_MINUTES:
+		return RULES_MINUTES_PER_DAY * sizeof(WORD);
+
+	case RULES_SECTION_CONTEXTS:
+		return RULES_CONTEXTS * sizeof(WORD);
+
+	case RULES_SECTION_SERIAL_NODES:
+		return (ULONGLONG)ptHeader->dwSerialNodes * sizeof(RULES_SERIAL_NODE);
+
+	case RULES_SECTION_SERIAL_EDGES:
+		return (ULONGLONG)ptHeader->dwSerialEdgeSlots * sizeof(RULES_SERIAL_EDGE);
+
+	case RULES_SECTION_IDENTITIES:
+		return (ULONGLONG)pdwClasses[RULES_CLASS_VENDOR] * pdwClasses[RULES_CLASS_PRODUCT] * sizeof(WORD);
+
+	case RULES_SECTION_ENVIRONMENTS:
+		return (ULONGLONG)pdwClasses[RULES_CLASS_MINUTE] * pdwClasses[RULES_CLASS_CONTEXT] * sizeof(WORD);
+
+	case RULES_SECTION_DEVICES:
+		return (ULONGLONG)pdwClasses[RULES_CLASS_IDENTITY] * pdwClasses[RULES_CLASS_SERIAL] * sizeof(WORD);
+
+	case RULES_SECTION_MATCHES:
+		return (ULONGLONG)pdwClasses[RULES_CLASS_DEVICE] * pdwClasses[RULES_CLASS_ENVIRONMENT] * sizeof(WORD);
+
+	default:
+		return (ULONGLONG)ptHeader->dwRules * sizeof(RULES_TABLE_RULE);
+	}
+}
+
+/********************************************************************************
+*  Function:	rules_AreClassesValid											*
+*  Purpose:		Checks that every entry of a class array is below a limit.		*
+*  Parameters:	@ pwClasses ~[in]~ The array.									*
+*				@ cEntries ~[in]~ Its entries.									*
+*				@ dwLimit ~[in]~ The limit.										*
+*  Returns:		A boolean value.												*
+********************************************************************************/
+static
+BOOL
+rules_AreClassesValid(
+	__in_ecount(cEntries) const WORD *pwClasses,
+	__in SIZE_T cEntries,
+	__in DWORD dwLimit
+)
+{
+	SIZE_T cIndex = 0;
+
+	for (cIndex = 0; (cIndex < cEntries) && (pwClasses[cIndex] < dwLimit); cIndex++)
+	{
+	}
+
+	// Return result
+	return cIndex == cEntries;
+}
+
+/********************************************************************************
+*  Function:	rules_WalkSerial												*
+*  Purpose:		Gets the serial class of a serial.								*
+*  Parameters:	@ ptTable ~[in]~ The table.										*
+*				@ pszSerial ~[in]~ The serial.									*
+*  Returns:		The class.														*
+*  Remarks:		* At most one probe sequence per character of the serial.		*
+********************************************************************************/
+static
+__inline
+DWORD
+rules_WalkSerial(
+	__in PCRULES_TABLE ptTable,
+	__in_z PCSTR pszSerial
+)
+{
+	DWORD dwNode = 0;
+	DWORD dwSlot = 0;
+
+	for (; '\0' != *pszSerial; pszSerial++)
+	{
+		dwSlot = rules_FindEdge(ptTable->ptSerialEdges, ptTable->dwSerialEdgeMask, (dwNode << 8) | (BYTE)*pszSerial);
+		if (0 == ptTable->ptSerialEdges[dwSlot].dwKey)
+		{
+			return ptTable->ptSerialNodes[dwNode].wPastClass;
+		}
+		dwNode = ptTable->ptSerialEdges[dwSlot].dwChild;
+	}
+
+	// Return result
+	return ptTable->ptSerialNodes[dwNode].wEndClass;
+}
+
+/********************************************************************************
+*  Function:	RULES_Create													*
+********************************************************************************/
+RETSTATUS
+RULES_Create(
+	__in DWORD dwMaxRules,
+	__out PRULES_LIST ptList
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != ptList);
+	if (RULES_MAX_RULES < dwMaxRules)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"Too many rules (%lu).",
+			(unsigned long)dwMaxRules);
+		goto lblCleanup;
+	}
+
+	// This is the only allocation
+	RtlZeroMemory(ptList, sizeof(*ptList));
+	ptList->ptRules = (PRULES_RULE)ALLOCZ((SIZE_T)MAX(dwMaxRules, 1) * sizeof(ptList->ptRules[0]));
+	if (NULL == ptList->ptRules)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"ALLOCZ() failure.");
+		goto lblCleanup;
+	}
+	ptList->dwMaxRules = dwMaxRules;
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	RULES_Load														*
+********************************************************************************/
+RETSTATUS
+RULES_Load(
+	__in_z PCSTR pszPath,
+	__out PRULES_LIST ptList
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	FILE *ptFile = NULL;
+	CHAR szLine[RULES_LINE_CHARS] = { 0 };
+	DWORD dwLines = 0;
+	DWORD dwLine = 0;
+	RULES_RULE tRule = { 0 };
+	PCSTR pszCurrent = NULL;
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != pszPath);
+	ASSERT(NULL != ptList);
+
+	RtlZeroMemory(ptList, sizeof(*ptList));
+
+	// Open the file
+	ptFile = fopen(pszPath, "r");
+	if (NULL == ptFile)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_INFO,
+			"Cannot open '%s'.",
+			pszPath);
+		goto lblCleanup;
+	}
+
+	// Size the list by the line count, so it is allocated once
+	while (NULL != fgets(szLine, sizeof(szLine), ptFile))
+	{
+		dwLines++;
+	}
+	eStatus = RULES_Create(dwLines, ptList);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		DEBUG_MSG(LOG_SEV_ERROR,
+			"RULES_Create() failed (eStatus=0x%.8x).",
+			eStatus);
+		goto lblCleanup;
+	}
+
+	// Add every rule, in order
+	rewind(ptFile);
+	for (dwLine = 1; (dwLine <= dwLines) && (NULL != fgets(szLine, sizeof(szLine), ptFile)); dwLine++)
+	{
+		for (pszCurrent = szLine; (' ' == *pszCurrent) || ('\t' == *pszCurrent); pszCurrent++)
+		{
+		}
+		if (('#' == *pszCurrent) || ('\r' == *pszCurrent) || ('\n' == *pszCurrent) || ('\0' == *pszCurrent))
+		{
+			continue;
+		}
+		if (!RULES_ParseRule(pszCurrent, dwLine, &tRule))
+		{
+			eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+				LOG_SEV_ERROR,
+				"Malformed rule on line %lu of '%s'.",
+				(unsigned long)dwLine,
+				pszPath);
+			goto lblCleanup;
+		}
+		(VOID)RULES_Add(ptList, &tRule);
+	}
+	DEBUG_MSG(LOG_SEV_INFO, "Loaded %lu rules from '%s'.", (unsigned long)ptList->dwRules, pszPath);
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	CLOSE(ptFile, fclose);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		RULES_Destroy(ptList);
+	}
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	RULES_Destroy													*
+********************************************************************************/
+VOID
+RULES_Destroy(
+	__inout PRULES_LIST ptList
+)
+{
+	// Validations
+	ASSERT(NULL != ptList);
+
+	// Free resources
+	FREE(ptList->ptRules);
+	RtlZeroMemory(ptList, sizeof(*ptList));
+}
+
+/********************************************************************************
+*  Function:	RULES_ParseRule													*
+********************************************************************************/
+BOOL
+RULES_ParseRule(
+	__in_z PCSTR pszText,
+	__in DWORD dwLine,
+	__out PRULES_RULE ptRule
+)
+{
+	PCSTR pszToken = NULL;
+	SIZE_T cchToken = 0;
+	DWORD dwAction = 0;
+	DWORD dwSeen = 0;
+
+	// Validations
+	ASSERT(NULL != pszText);
+	ASSERT(NULL != ptRule);
+
+	// No condition matches everything
+	RtlZeroMemory(ptRule, sizeof(*ptRule));
+	ptRule->dwLine = dwLine;
+	ptRule->bEventMask = 0xFF;
+	ptRule->bClassMask = 0xFF;
+	ptRule->bSessionMask = 0xFF;
+	ptRule->bVerdictMask = 0xFF;
+
+	// The action, then the conditions
+	for (pszToken = pszText; ; pszToken += cchToken)
+	{
+		for (; (' ' == *pszToken) || ('\t' == *pszToken) || ('\r' == *pszToken) || ('\n' == *pszToken); pszToken++)
+		{
+		}
+		if ('\0' == *pszToken)
+		{
+			break;
+		}
+		for (cchToken = 0;
+			('\0' != pszToken[cchToken]) && (' ' != pszToken[cchToken]) && ('\t' != pszToken[cchToken]) &&
+			('\r' != pszToken[cchToken]) && ('\n' != pszToken[cchToken]);
+			cchToken++)
+		{
+		}
+		if (RULES_ACTION_NONE == ptRule->eAction)
+		{
+			for (dwAction = RULES_ACTION_NONE + 1;
+				(dwAction < RULES_ACTION_COUNT) && (!rules_IsToken(pszToken, cchToken, g_apszActionNames[dwAction]));
+				dwAction++)
+			{
+			}
+			if (RULES_ACTION_COUNT == dwAction)
+			{
+				return FALSE;
+			}
+			ptRule->eAction = (RULES_ACTION)dwAction;
+			continue;
+		}
+		if (!rules_ParseCondition(pszToken, cchToken, &dwSeen, ptRule))
+		{
+			return FALSE;
+		}
+	}
+
+	// Return result
+	return RULES_ACTION_NONE != ptRule->eAction;
+}
+
+/********************************************************************************
+*  Function:	RULES_Add														*
+********************************************************************************/
+BOOL
+RULES_Add(
+	__inout PRULES_LIST ptList,
+	__in PCRULES_RULE ptRule
+)
+{
+	// Validations
+	ASSERT(NULL != ptList);
+	ASSERT(NULL != ptRule);
+
+	if (ptList->dwMaxRules <= ptList->dwRules)
+	{
+		return FALSE;
+	}
+	ptList->ptRules[ptList->dwRules++] = *ptRule;
+	return TRUE;
+}
+
+/********************************************************************************
+*  Function:	RULES_IsMatch													*
+********************************************************************************/
+BOOL
+RULES_IsMatch(
+	__in PCRULES_RULE ptRule,
+	__in PCRULES_INPUT ptInput
+)
+{
+	PCEVENTSOURCE_EVENT ptEvent = NULL;
+	PCDEVICEID ptId = NULL;
+
+	// Validations
+	ASSERT(NULL != ptRule);
+	ASSERT(NULL != ptInput);
+
+	ptEvent = ptInput->ptEvent;
+	ptId = &(ptEvent->tIdentity);
+
+	// The context
+	if ((0 == (ptRule->bEventMask & (1 << ptEvent->eType))) ||
+		(0 == (ptRule->bClassMask & (1 << ptEvent->eClass))) ||
+		(0 == (ptRule->bSessionMask & (1 << ptInput->eSession))) ||
+		(0 == (ptRule->bVerdictMask & (1 << ptInput->eVerdict))) ||
+		(!rules_IsMinuteInRange(ptRule, ptInput->dwMinuteOfDay)))
+	{
+		return FALSE;
+	}
+
+	// The identity
+	if ((ptRule->bHasVendorId || ptRule->bHasProductId || (RULES_SERIAL_MATCH_ANY != ptRule->eSerialMatch)) && (!ptId->bIsValid))
+	{
+		return FALSE;
+	}
+	if ((ptRule->bHasVendorId) && ((ptId->wVendorId < ptRule->wVendorLow) || (ptId->wVendorId > ptRule->wVendorHigh)))
+	{
+		return FALSE;
+	}
+	if ((ptRule->bHasProductId) && ((ptId->wProductId < ptRule->wProductLow) || (ptId->wProductId > ptRule->wProductHigh)))
+	{
+		return FALSE;
+	}
+	switch (ptRule->eSerialMatch)
+	{
+	case RULES_SERIAL_MATCH_EXACT:
+		return 0 == strcmp(ptId->szInstance, ptRule->szSerial);
+
+	case RULES_SERIAL_MATCH_PREFIX:
+		return 0 == strncmp(ptId->szInstance, ptRule->szSerial, strlen(ptRule->szSerial));
+
+	default:
+		return TRUE;
+	}
+}
+
+/********************************************************************************
+*  Function:	RULES_Compile													*
+********************************************************************************/
+RETSTATUS
+RULES_Compile(
+	__in PCRULES_LIST ptList,
+	__out PVOID *ppvTable,
+	__out PSIZE_T pcbTable
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	RULES_COMPILER tCompiler = { 0 };
+	PRULES_TABLE_HEADER ptHeader = NULL;
+	PRULES_TABLE_RULE ptRules = NULL;
+	PBYTE pbTable = NULL;
+	ULONGLONG cbTable = 0;
+	DWORD dwIndex = 0;
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != ptList);
+	ASSERT(NULL != ppvTable);
+	ASSERT(NULL != pcbTable);
+
+	*ppvTable = NULL;
+	*pcbTable = 0;
+
+	// One bit per rule
+	tCompiler.ptList = ptList;
+	tCompiler.dwWords = MAX((ptList->dwRules + 63) / 64, 1);
+	tCompiler.pqwScratch = (PULONGLONG)ALLOCZ(tCompiler.dwWords * sizeof(tCompiler.pqwScratch[0]));
+	if (NULL == tCompiler.pqwScratch)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"ALLOCZ() failure.");
+		goto lblCleanup;
+	}
+	for (dwIndex = 0; dwIndex < RULES_CLASS_COUNT; dwIndex++)
+	{
+		tCompiler.atSets[dwIndex].dwWords = tCompiler.dwWords;
+	}
+
+	// Every dimension, then every phase down to the first matching rule
+	eStatus = rules_CompileIds(&tCompiler, FALSE);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		goto lblCleanup;
+	}
+	eStatus = rules_CompileIds(&tCompiler, TRUE);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		goto lblCleanup;
+	}
+	eStatus = rules_CompileMinutes(&tCompiler);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		goto lblCleanup;
+	}
+	eStatus = rules_CompileContexts(&tCompiler);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		goto lblCleanup;
+	}
+	eStatus = rules_CompileSerials(&tCompiler);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		goto lblCleanup;
+	}
+	eStatus = rules_CompilePhase(&tCompiler, RULES_CLASS_VENDOR, RULES_CLASS_PRODUCT, RULES_CLASS_IDENTITY, RULES_SECTION_IDENTITIES);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		goto lblCleanup;
+	}
+	eStatus = rules_CompilePhase(&tCompiler, RULES_CLASS_MINUTE, RULES_CLASS_CONTEXT, RULES_CLASS_ENVIRONMENT, RULES_SECTION_ENVIRONMENTS);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		goto lblCleanup;
+	}
+	eStatus = rules_CompilePhase(&tCompiler, RULES_CLASS_IDENTITY, RULES_CLASS_SERIAL, RULES_CLASS_DEVICE, RULES_SECTION_DEVICES);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		goto lblCleanup;
+	}
+	eStatus = rules_CompileMatches(&tCompiler);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		goto lblCleanup;
+	}
+
+	// What the table keeps of each rule
+	ptRules = (PRULES_TABLE_RULE)rules_AllocateSection(&tCompiler,
+		RULES_SECTION_RULES,
+		(SIZE_T)ptList->dwRules * sizeof(ptRules[0]));
+	if (NULL == ptRules)
+	{
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+	for (dwIndex = 0; dwIndex < ptList->dwRules; dwIndex++)
+	{
+		ptRules[dwIndex].dwLine = ptList->ptRules[dwIndex].dwLine;
+		ptRules[dwIndex].dwAction = (DWORD)ptList->ptRules[dwIndex].eAction;
+	}
+
+	// Lay the sections out after the header
+	cbTable = sizeof(*ptHeader);
+	for (dwIndex = 0; dwIndex < RULES_SECTION_COUNT; dwIndex++)
+	{
+		cbTable += (tCompiler.acbSections[dwIndex] + RULES_SECTION_ALIGNMENT - 1) & ~(ULONGLONG)(RULES_SECTION_ALIGNMENT - 1);
+	}
+	pbTable = (PBYTE)ALLOCZ((SIZE_T)cbTable);
+	if (NULL == pbTable)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"ALLOCZ() failure.");
+		goto lblCleanup;
+	}
+	ptHeader = (PRULES_TABLE_HEADER)pbTable;
+	ptHeader->dwRules = ptList->dwRules;
+	ptHeader->dwSerialNodes = tCompiler.dwSerialNodes;
+	ptHeader->dwSerialEdgeSlots = tCompiler.dwSerialEdgeSlots;
+	ptHeader->dwUnknownSerialClass = tCompiler.dwUnknownSerialClass;
+	RtlCopyMemory(ptHeader->adwClasses, tCompiler.adwClasses, sizeof(ptHeader->adwClasses));
+	cbTable = sizeof(*ptHeader);
+	for (dwIndex = 0; dwIndex < RULES_SECTION_COUNT; dwIndex++)
+	{
+		ASSERT(rules_GetSectionSize(ptHeader, (RULES_SECTION)dwIndex) == tCompiler.acbSections[dwIndex]);
+		ptHeader->aqwOffsets[dwIndex] = cbTable;
+		RtlCopyMemory(pbTable + cbTable, tCompiler.apvSections[dwIndex], tCompiler.acbSections[dwIndex]);
+		cbTable += (tCompiler.acbSections[dwIndex] + RULES_SECTION_ALIGNMENT - 1) & ~(ULONGLONG)(RULES_SECTION_ALIGNMENT - 1);
+	}
+	*ppvTable = pbTable;
+	*pcbTable = (SIZE_T)cbTable;
+	pbTable = NULL;
+	DEBUG_MSG(LOG_SEV_INFO,
+		"Compiled %lu rules into %llu bytes (%lu device and %lu environment classes).",
+		(unsigned long)ptList->dwRules,
+		cbTable,
+		(unsigned long)tCompiler.adwClasses[RULES_CLASS_DEVICE],
+		(unsigned long)tCompiler.adwClasses[RULES_CLASS_ENVIRONMENT]);
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	for (dwIndex = 0; dwIndex < RULES_CLASS_COUNT; dwIndex++)
+	{
+		rules_FreeSets(&(tCompiler.atSets[dwIndex]));
+	}
+	for (dwIndex = 0; dwIndex < RULES_SECTION_COUNT; dwIndex++)
+	{
+		FREE(tCompiler.apvSections[dwIndex]);
+	}
+	FREE(tCompiler.pqwScratch);
+	FREE(pbTable);
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	RULES_MapTable													*
+********************************************************************************/
+RETSTATUS
+RULES_MapTable(
+	__in_bcount(cbTable) PCVOID pvTable,
+	__in SIZE_T cbTable,
+	__out PRULES_TABLE ptTable
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	PCRULES_TABLE_HEADER ptHeader = (PCRULES_TABLE_HEADER)pvTable;
+	const BYTE *apbSections[RULES_SECTION_COUNT] = { NULL };
+	const DWORD *pdwClasses = NULL;
+	PCRULES_SERIAL_NODE ptNodes = NULL;
+	PCRULES_SERIAL_EDGE ptEdges = NULL;
+	PCRULES_TABLE_RULE ptRules = NULL;
+	ULONGLONG qwSize = 0;
+	DWORD dwIndex = 0;
+	DWORD dwEdges = 0;
+	BOOL bIsValid = TRUE;
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != pvTable);
+	ASSERT(NULL != ptTable);
+
+	RtlZeroMemory(ptTable, sizeof(*ptTable));
+
+	// The header's counts
+	if (sizeof(*ptHeader) > cbTable)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"Truncated rule table (%llu bytes).",
+			(ULONGLONG)cbTable);
+		goto lblCleanup;
+	}
+	pdwClasses = ptHeader->adwClasses;
+	for (dwIndex = 0; dwIndex < RULES_CLASS_COUNT; dwIndex++)
+	{
+		bIsValid = bIsValid && (0 != pdwClasses[dwIndex]) && (RULES_MAX_CLASSES >= pdwClasses[dwIndex]);
+	}
+	bIsValid = bIsValid &&
+		(RULES_MAX_RULES >= ptHeader->dwRules) &&
+		(0 != ptHeader->dwSerialNodes) &&
+		(RULES_MAX_SERIAL_NODES >= ptHeader->dwSerialNodes) &&
+		(2 <= ptHeader->dwSerialEdgeSlots) &&
+		(0 == (ptHeader->dwSerialEdgeSlots & (ptHeader->dwSerialEdgeSlots - 1))) &&
+		(pdwClasses[RULES_CLASS_SERIAL] > ptHeader->dwUnknownSerialClass);
+
+	// Every section in bounds (phase tables are bounded before they are sized)
+	for (dwIndex = 0; (bIsValid) && (dwIndex < RULES_SECTION_COUNT); dwIndex++)
+	{
+		qwSize = rules_GetSectionSize(ptHeader, (RULES_SECTION)dwIndex);
+		bIsValid = (RULES_MAX_TABLE_ENTRIES * sizeof(WORD) >= qwSize) &&
+			(sizeof(*ptHeader) <= ptHeader->aqwOffsets[dwIndex]) &&
+			(0 == (ptHeader->aqwOffsets[dwIndex] % RULES_SECTION_ALIGNMENT)) &&
+			(cbTable >= ptHeader->aqwOffsets[dwIndex]) &&
+			(cbTable - ptHeader->aqwOffsets[dwIndex] >= qwSize);
+		apbSections[dwIndex] = (const BYTE *)pvTable + (bIsValid ? ptHeader->aqwOffsets[dwIndex] : 0);
+	}
+	if (!bIsValid)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"Malformed rule table header.");
+		goto lblCleanup;
+	}
+
+	// Every class number within its dimension or phase, every rule number within the rules
+	bIsValid = rules_AreClassesValid((const WORD *)apbSections[RULES_SECTION_VENDORS], RULES_ID_VALUES, pdwClasses[RULES_CLASS_VENDOR]) &&
+		rules_AreClassesValid((const WORD *)apbSections[RULES_SECTION_PRODUCTS], RULES_ID_VALUES, pdwClasses[RULES_CLASS_PRODUCT]) &&
+		rules_AreClassesValid((const WORD *)apbSections[RULES_SECTION_MINUTES], RULES_MINUTES_PER_DAY, pdwClasses[RULES_CLASS_MINUTE]) &&
+		rules_AreClassesValid((const WORD *)apbSections[RULES_SECTION_CONTEXTS], RULES_CONTEXTS, pdwClasses[RULES_CLASS_CONTEXT]) &&
+		rules_AreClassesValid((const WORD *)apbSections[RULES_SECTION_IDENTITIES],
+			(SIZE_T)pdwClasses[RULES_CLASS_VENDOR] * pdwClasses[RULES_CLASS_PRODUCT],
+			pdwClasses[RULES_CLASS_IDENTITY]) &&
+		rules_AreClassesValid((const WORD *)apbSections[RULES_SECTION_ENVIRONMENTS],
+			(SIZE_T)pdwClasses[RULES_CLASS_MINUTE] * pdwClasses[RULES_CLASS_CONTEXT],
+			pdwClasses[RULES_CLASS_ENVIRONMENT]) &&
+		rules_AreClassesValid((const WORD *)apbSections[RULES_SECTION_DEVICES],
+			(SIZE_T)pdwClasses[RULES_CLASS_IDENTITY] * pdwClasses[RULES_CLASS_SERIAL],
+			pdwClasses[RULES_CLASS_DEVICE]) &&
+		rules_AreClassesValid((const WORD *)apbSections[RULES_SECTION_MATCHES],
+			(SIZE_T)pdwClasses[RULES_CLASS_DEVICE] * pdwClasses[RULES_CLASS_ENVIRONMENT],
+			ptHeader->dwRules + 1);
+	ptNodes = (PCRULES_SERIAL_NODE)apbSections[RULES_SECTION_SERIAL_NODES];
+	for (dwIndex = 0; (bIsValid) && (dwIndex < ptHeader->dwSerialNodes); dwIndex++)
+	{
+		bIsValid = (pdwClasses[RULES_CLASS_SERIAL] > ptNodes[dwIndex].wEndClass) &&
+			(pdwClasses[RULES_CLASS_SERIAL] > ptNodes[dwIndex].wPastClass);
+	}
+	ptRules = (PCRULES_TABLE_RULE)apbSections[RULES_SECTION_RULES];
+	for (dwIndex = 0; (bIsValid) && (dwIndex < ptHeader->dwRules); dwIndex++)
+	{
+		bIsValid = (RULES_ACTION_NONE != ptRules[dwIndex].dwAction) && (RULES_ACTION_COUNT > ptRules[dwIndex].dwAction);
+	}
+
+	// Every edge between nodes, with a free slot left so every probe sequence ends
+	ptEdges = (PCRULES_SERIAL_EDGE)apbSections[RULES_SECTION_SERIAL_EDGES];
+	for (dwIndex = 0; (bIsValid) && (dwIndex < ptHeader->dwSerialEdgeSlots); dwIndex++)
+	{
+		if (0 == ptEdges[dwIndex].dwKey)
+		{
+			continue;
+		}
+		dwEdges++;
+		bIsValid = (0 != (ptEdges[dwIndex].dwKey & 0xFF)) &&
+			(ptHeader->dwSerialNodes > (ptEdges[dwIndex].dwKey >> 8)) &&
+			(0 != ptEdges[dwIndex].dwChild) &&
+			(ptHeader->dwSerialNodes > ptEdges[dwIndex].dwChild);
+	}
+	if ((!bIsValid) || (dwEdges >= ptHeader->dwSerialEdgeSlots))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"Malformed rule table sections.");
+		goto lblCleanup;
+	}
+
+	// Point into the bytes
+	ptTable->ptHeader = ptHeader;
+	ptTable->pwVendors = (const WORD *)apbSections[RULES_SECTION_VENDORS];
+	ptTable->pwProducts = (const WORD *)apbSections[RULES_SECTION_PRODUCTS];
+	ptTable->pwMinutes = (const WORD *)apbSections[RULES_SECTION_MINUTES];
+	ptTable->pwContexts = (const WORD *)apbSections[RULES_SECTION_CONTEXTS];
+	ptTable->ptSerialNodes = ptNodes;
+	ptTable->ptSerialEdges = ptEdges;
+	ptTable->pwIdentities = (const WORD *)apbSections[RULES_SECTION_IDENTITIES];
+	ptTable->pwEnvironments = (const WORD *)apbSections[RULES_SECTION_ENVIRONMENTS];
+	ptTable->pwDevices = (const WORD *)apbSections[RULES_SECTION_DEVICES];
+	ptTable->pwMatches = (const WORD *)apbSections[RULES_SECTION_MATCHES];
+	ptTable->ptRules = ptRules;
+	ptTable->dwSerialEdgeMask = ptHeader->dwSerialEdgeSlots - 1;
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	RULES_Evaluate													*
+********************************************************************************/
+RULES_ACTION
+RULES_Evaluate(
+	__in PCRULES_TABLE ptTable,
+	__in PCRULES_INPUT ptInput,
+	__out_opt PDWORD pdwLine
+)
+{
+	PCRULES_TABLE_HEADER ptHeader = ptTable->ptHeader;
+	PCEVENTSOURCE_EVENT ptEvent = ptInput->ptEvent;
+	PCRULES_TABLE_RULE ptRule = NULL;
+	DWORD dwVendor = 0;
+	DWORD dwProduct = 0;
+	DWORD dwSerial = 0;
+	DWORD dwEnvironment = 0;
+	DWORD dwDevice = 0;
+	DWORD dwMatch = 0;
+
+	// Validations
+	ASSERT(RULES_MINUTES_PER_DAY > ptInput->dwMinuteOfDay);
+
+	if (NULL != pdwLine)
+	{
+		*pdwLine = 0;
+	}
+	if (NULL == ptHeader)
+	{
+		return RULES_ACTION_NONE;
+	}
+
+	// Every dimension
+	if (ptEvent->tIdentity.bIsValid)
+	{
+		dwVendor = ptTable->pwVendors[ptEvent->tIdentity.wVendorId];
+		dwProduct = ptTable->pwProducts[ptEvent->tIdentity.wProductId];
+		dwSerial = rules_WalkSerial(ptTable, ptEvent->tIdentity.szInstance);
+	}
+	else
+	{
+		dwVendor = ptTable->pwVendors[RULES_UNKNOWN_ID];
+		dwProduct = ptTable->pwProducts[RULES_UNKNOWN_ID];
+		dwSerial = ptHeader->dwUnknownSerialClass;
+	}
+	dwEnvironment = ptTable->pwEnvironments[(ptTable->pwMinutes[ptInput->dwMinuteOfDay] * ptHeader->adwClasses[RULES_CLASS_CONTEXT]) +
+		ptTable->pwContexts[rules_GetContext(ptEvent->eType, ptEvent->eClass, ptInput->eSession, ptInput->eVerdict)]];
+
+	// Then every phase
+	dwDevice = ptTable->pwIdentities[(dwVendor * ptHeader->adwClasses[RULES_CLASS_PRODUCT]) + dwProduct];
+	dwDevice = ptTable->pwDevices[(dwDevice * ptHeader->adwClasses[RULES_CLASS_SERIAL]) + dwSerial];
+	dwMatch = ptTable->pwMatches[(dwDevice * ptHeader->adwClasses[RULES_CLASS_ENVIRONMENT]) + dwEnvironment];
+	if (0 == dwMatch)
+	{
+		return RULES_ACTION_NONE;
+	}
+
+	// Return result
+	ptRule = &(ptTable->ptRules[dwMatch - 1]);
+	if (NULL != pdwLine)
+	{
+		*pdwLine = ptRule->dwLine;
+	}
+	return (RULES_ACTION)ptRule->dwAction;
+}
@@ -0,0 +1,462 @@
+/********************************************************************************
+*  File:		Rules.h															*
+*  Purpose:		Policy rules, compiled ahead of time into flat decision tables.	*
+********************************************************************************/
+#pragma once
+
+
+/** Includes *******************************************************************/
+#include <Utilities.h>
+#include "../Cadence/Cadence.h"
+#include "../EventSource/DeviceId.h"
+#include "../EventSource/EventSource.h"
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	RULES_MAX_RULES													*
+*  Purpose:		Maximal number of rules in a rule file.							*
+********************************************************************************/
+#define RULES_MAX_RULES (65535)
+
+/********************************************************************************
+*  Constant:	RULES_MAX_CLASSES												*
+*  Purpose:		Maximal number of equivalence classes of a dimension or phase	*
+*				(class numbers are 16-bit).										*
+********************************************************************************/
+#define RULES_MAX_CLASSES (65535)
+
+/********************************************************************************
+*  Constant:	RULES_MAX_TABLE_ENTRIES											*
+*  Purpose:		Maximal number of entries of a phase table. Rule sets that		*
+*				need more are rejected by the compiler.							*
+********************************************************************************/
+#define RULES_MAX_TABLE_ENTRIES (16 * 1024 * 1024)
+
+/********************************************************************************
+*  Constant:	RULES_ID_VALUES													*
+*  Purpose:		Entries of the vendor and product tables: every 16-bit ID,		*
+*				then RULES_UNKNOWN_ID.											*
+********************************************************************************/
+#define RULES_ID_VALUES (0x10001)
+
+/********************************************************************************
+*  Constant:	RULES_UNKNOWN_ID												*
+*  Purpose:		The vendor and product table index of events without an			*
+*				identity.														*
+********************************************************************************/
+#define RULES_UNKNOWN_ID (0x10000)
+
+/********************************************************************************
+*  Constant:	RULES_MINUTES_PER_DAY											*
+*  Purpose:		Entries of the time of day table.								*
+********************************************************************************/
+#define RULES_MINUTES_PER_DAY (24 * 60)
+
+/********************************************************************************
+*  Constant:	RULES_EVENT_TYPES												*
+*  Purpose:		Number of EVENTSOURCE_EVENT_TYPE values.						*
+********************************************************************************/
+#define RULES_EVENT_TYPES (3)
+
+/********************************************************************************
+*  Constant:	RULES_DEVICE_CLASSES											*
+*  Purpose:		Number of EVENTSOURCE_DEVICE_CLASS values.						*
+********************************************************************************/
+#define RULES_DEVICE_CLASSES (2)
+
+/********************************************************************************
+*  Constant:	RULES_SESSIONS													*
+*  Purpose:		Number of RULES_SESSION values.									*
+********************************************************************************/
+#define RULES_SESSIONS (3)
+
+/********************************************************************************
+*  Constant:	RULES_VERDICTS													*
+*  Purpose:		Number of CADENCE_VERDICT values.								*
+********************************************************************************/
+#define RULES_VERDICTS (3)
+
+/********************************************************************************
+*  Constant:	RULES_CONTEXTS													*
+*  Purpose:		Entries of the context table, one per combination of event		*
+*				type, device class, session state and cadence verdict.			*
+********************************************************************************/
+#define RULES_CONTEXTS (RULES_EVENT_TYPES * RULES_DEVICE_CLASSES * RULES_SESSIONS * RULES_VERDICTS)
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Enum:		RULES_ACTION													*
+*  Purpose:		What a matching rule calls for.									*
+********************************************************************************/
+typedef enum
+{
+	RULES_ACTION_NONE,								// No rule matched
+	RULES_ACTION_ALLOW,								// Never lock
+	RULES_ACTION_LOCK,								// Lock the session
+	RULES_ACTION_ALERT,								// Only log it
+
+	// Must be last
+	RULES_ACTION_COUNT
+} RULES_ACTION, *PRULES_ACTION;
+
+/********************************************************************************
+*  Enum:		RULES_SESSION													*
+*  Purpose:		The state of the interactive session.							*
+*  Remarks:		* Not tracked: decisions see RULES_SESSION_UNKNOWN, and rules	*
+*					cannot ask for a state (see RULES_ParseRule).				*
+********************************************************************************/
+typedef enum
+{
+	RULES_SESSION_UNKNOWN,							// Matches no session condition
+	RULES_SESSION_UNLOCKED,
+	RULES_SESSION_LOCKED
+} RULES_SESSION, *PRULES_SESSION;
+
+/********************************************************************************
+*  Enum:		RULES_SERIAL_MATCH												*
+*  Purpose:		How a rule matches the device serial.							*
+********************************************************************************/
+typedef enum
+{
+	RULES_SERIAL_MATCH_ANY,
+	RULES_SERIAL_MATCH_EXACT,						// The whole serial (may be empty)
+	RULES_SERIAL_MATCH_PREFIX						// Serials that start with it
+} RULES_SERIAL_MATCH, *PRULES_SERIAL_MATCH;
+
+/********************************************************************************
+*  Structure:	RULES_RULE														*
+*  Purpose:		A parsed rule: an action and the conditions an event must		*
+*				all meet.														*
+*  Remarks:		* Masks hold one bit per enum value, and are all ones for		*
+*					no condition.												*
+*				* Identity conditions (VID, PID and serial) never match			*
+*					events without an identity.									*
+********************************************************************************/
+typedef struct _RULES_RULE
+{
+	DWORD dwLine;									// Line in the rule file
+	RULES_ACTION eAction;							// What it calls for
+	BOOLEAN bHasVendorId;							// Whether wVendorLow and wVendorHigh apply
+	BOOLEAN bHasProductId;							// Whether wProductLow and wProductHigh apply
+	BOOLEAN bHasTime;								// Whether the minutes apply
+	WORD wVendorLow;								// VID range, inclusive
+	WORD wVendorHigh;
+	WORD wProductLow;								// PID range, inclusive
+	WORD wProductHigh;
+	WORD wMinuteStart;								// Time of day range, wraps at midnight
+	WORD wMinuteEnd;								// (exclusive)
+	BYTE bEventMask;								// By EVENTSOURCE_EVENT_TYPE
+	BYTE bClassMask;								// By EVENTSOURCE_DEVICE_CLASS
+	BYTE bSessionMask;								// By RULES_SESSION
+	BYTE bVerdictMask;								// By CADENCE_VERDICT
+	RULES_SERIAL_MATCH eSerialMatch;				// How szSerial applies
+	CHAR szSerial[DEVICEID_MAX_INSTANCE_CHARS];		// Upper case, as identities keep it
+} RULES_RULE, *PRULES_RULE;
+typedef const RULES_RULE *PCRULES_RULE;
+
+/********************************************************************************
+*  Structure:	RULES_LIST														*
+*  Purpose:		Rules in priority order (the first matching rule wins).			*
+********************************************************************************/
+typedef struct _RULES_LIST
+{
+	PRULES_RULE ptRules;							// The rules, or NULL while empty
+	DWORD dwRules;									// Number of rules
+	DWORD dwMaxRules;								// Capacity given at creation
+} RULES_LIST, *PRULES_LIST;
+typedef const RULES_LIST *PCRULES_LIST;
+
+/********************************************************************************
+*  Enum:		RULES_CLASS														*
+*  Purpose:		The dimensions and phases of a compiled table, each with its	*
+*				own equivalence classes.										*
+********************************************************************************/
+typedef enum
+{
+	RULES_CLASS_VENDOR,								// By VID
+	RULES_CLASS_PRODUCT,							// By PID
+	RULES_CLASS_SERIAL,								// By serial
+	RULES_CLASS_MINUTE,								// By time of day
+	RULES_CLASS_CONTEXT,							// By event type, class, session, verdict
+	RULES_CLASS_IDENTITY,							// Vendor x product
+	RULES_CLASS_ENVIRONMENT,						// Minute x context
+	RULES_CLASS_DEVICE,								// Identity x serial
+
+	// Must be last
+	RULES_CLASS_COUNT
+} RULES_CLASS, *PRULES_CLASS;
+
+/********************************************************************************
+*  Enum:		RULES_SECTION													*
+*  Purpose:		The arrays of a compiled table.									*
+********************************************************************************/
+typedef enum
+{
+	RULES_SECTION_VENDORS,							// WORD class per RULES_ID_VALUES
+	RULES_SECTION_PRODUCTS,							// WORD class per RULES_ID_VALUES
+	RULES_SECTION_MINUTES,							// WORD class per RULES_MINUTES_PER_DAY
+	RULES_SECTION_CONTEXTS,							// WORD class per RULES_CONTEXTS
+	RULES_SECTION_SERIAL_NODES,						// RULES_SERIAL_NODE per trie node
+	RULES_SECTION_SERIAL_EDGES,						// RULES_SERIAL_EDGE per edge slot
+	RULES_SECTION_IDENTITIES,						// WORD class per vendor x product
+	RULES_SECTION_ENVIRONMENTS,						// WORD class per minute x context
+	RULES_SECTION_DEVICES,							// WORD class per identity x serial
+	RULES_SECTION_MATCHES,							// WORD rule (1-based, 0 for none)
+													// per device x environment
+	RULES_SECTION_RULES,							// RULES_TABLE_RULE per rule
+
+	// Must be last
+	RULES_SECTION_COUNT
+} RULES_SECTION, *PRULES_SECTION;
+
+/********************************************************************************
+*  Structure:	RULES_TABLE_HEADER												*
+*  Purpose:		The header of a compiled table.									*
+*  Remarks:		* Little endian, and used in place, so sections are 8-byte		*
+*					aligned. Offsets are from the header.						*
+********************************************************************************/
+typedef struct _RULES_TABLE_HEADER
+{
+	DWORD dwRules;									// Compiled rules
+	DWORD dwSerialNodes;							// Serial trie nodes, the root first
+	DWORD dwSerialEdgeSlots;						// Serial trie edge slots (a power of 2)
+	DWORD dwUnknownSerialClass;						// Serial class of events without an identity
+	DWORD adwClasses[RULES_CLASS_COUNT];			// Class counts, by RULES_CLASS
+	ULONGLONG aqwOffsets[RULES_SECTION_COUNT];		// Section offsets, by RULES_SECTION
+} RULES_TABLE_HEADER, *PRULES_TABLE_HEADER;
+typedef const RULES_TABLE_HEADER *PCRULES_TABLE_HEADER;
+
+/********************************************************************************
+*  Structure:	RULES_SERIAL_NODE												*
+*  Purpose:		A serial trie node: the classes of the serials whose walk		*
+*				ends on it.														*
+********************************************************************************/
+typedef struct _RULES_SERIAL_NODE
+{
+	WORD wEndClass;									// The serial is the node's path
+	WORD wPastClass;								// The serial goes on past the trie
+} RULES_SERIAL_NODE, *PRULES_SERIAL_NODE;
+typedef const RULES_SERIAL_NODE *PCRULES_SERIAL_NODE;
+
+/********************************************************************************
+*  Structure:	RULES_SERIAL_EDGE												*
+*  Purpose:		A serial trie edge (open addressing, linear probing).			*
+*  Remarks:		* The key is the parent node shifted left by 8, ORed with the	*
+*					character, so 0 marks a free slot.							*
+********************************************************************************/
+typedef struct _RULES_SERIAL_EDGE
+{
+	DWORD dwKey;									// Parent and character, or 0 if free
+	DWORD dwChild;									// Child node
+} RULES_SERIAL_EDGE, *PRULES_SERIAL_EDGE;
+typedef const RULES_SERIAL_EDGE *PCRULES_SERIAL_EDGE;
+
+/********************************************************************************
+*  Structure:	RULES_TABLE_RULE												*
+*  Purpose:		What a compiled table keeps of a rule.							*
+********************************************************************************/
+typedef struct _RULES_TABLE_RULE
+{
+	DWORD dwLine;									// Line in the rule file
+	DWORD dwAction;									// RULES_ACTION
+} RULES_TABLE_RULE, *PRULES_TABLE_RULE;
+typedef const RULES_TABLE_RULE *PCRULES_TABLE_RULE;
+
+/********************************************************************************
+*  Structure:	RULES_TABLE														*
+*  Purpose:		A validated compiled table, ready for evaluation.				*
+*  Remarks:		* Points into the compiled bytes, which must outlive it.		*
+*				* Zeroed, it holds no rules and matches nothing.				*
+********************************************************************************/
+typedef struct _RULES_TABLE
+{
+	PCRULES_TABLE_HEADER ptHeader;					// The compiled bytes, or NULL
+	const WORD *pwVendors;							// Sections, by RULES_SECTION
+	const WORD *pwProducts;
+	const WORD *pwMinutes;
+	const WORD *pwContexts;
+	PCRULES_SERIAL_NODE ptSerialNodes;
+	PCRULES_SERIAL_EDGE ptSerialEdges;
+	const WORD *pwIdentities;
+	const WORD *pwEnvironments;
+	const WORD *pwDevices;
+	const WORD *pwMatches;
+	PCRULES_TABLE_RULE ptRules;
+	DWORD dwSerialEdgeMask;							// Edge slots minus 1
+} RULES_TABLE, *PRULES_TABLE;
+typedef const RULES_TABLE *PCRULES_TABLE;
+
+/********************************************************************************
+*  Structure:	RULES_INPUT														*
+*  Purpose:		What a rule may match on.										*
+********************************************************************************/
+typedef struct _RULES_INPUT
+{
+	PCEVENTSOURCE_EVENT ptEvent;					// Type, class and identity
+	CADENCE_VERDICT eVerdict;						// Key events only, PENDING for others
+	RULES_SESSION eSession;							// The session state
+	DWORD dwMinuteOfDay;							// Local time, below RULES_MINUTES_PER_DAY
+} RULES_INPUT, *PRULES_INPUT;
+typedef const RULES_INPUT *PCRULES_INPUT;
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	RULES_Create													*
+*  Purpose:		Creates an empty rule list.										*
+*  Parameters:	@ dwMaxRules ~[in]~ Number of rules to make room for (at most	*
+*				RULES_MAX_RULES).												*
+*				@ ptList ~[out]~ Gets the list.									*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Free with RULES_Destroy.										*
+********************************************************************************/
+RETSTATUS
+RULES_Create(
+	__in DWORD dwMaxRules,
+	__out PRULES_LIST ptList
+);
+
+/********************************************************************************
+*  Function:	RULES_Load														*
+*  Purpose:		Creates a rule list from a rule file.							*
+*  Parameters:	@ pszPath ~[in]~ The file.										*
+*				@ ptList ~[out]~ Gets the list.									*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* One rule per line, see RULES_ParseRule. Empty lines and		*
+*					lines starting with '#' are skipped.						*
+*				* Rules are ordered, so unlike the allowlist a malformed		*
+*					line fails the whole file.									*
+*				* Free with RULES_Destroy.										*
+********************************************************************************/
+RETSTATUS
+RULES_Load(
+	__in_z PCSTR pszPath,
+	__out PRULES_LIST ptList
+);
+
+/********************************************************************************
+*  Function:	RULES_Destroy													*
+*  Purpose:		Frees a rule list.												*
+*  Parameters:	@ ptList ~[inout]~ The list (may be zeroed).					*
+********************************************************************************/
+VOID
+RULES_Destroy(
+	__inout PRULES_LIST ptList
+);
+
+/********************************************************************************
+*  Function:	RULES_ParseRule													*
+*  Purpose:		Parses a rule: an action (allow, lock or alert), then any of	*
+*				these conditions, separated by white space:						*
+*				event=arrival|removal|key										*
+*				class=keyboard|other											*
+*				vid=HHHH[-HHHH] and pid=HHHH[-HHHH] (hex, inclusive)			*
+*				serial=TEXT (exact), TEXT* (prefix) or - (no serial)			*
+*				time=HH:MM-HH:MM (local, end exclusive, may wrap)				*
+*				cadence=pending|human|injection									*
+*  Parameters:	@ pszText ~[in]~ The text (up to the end of the line).			*
+*				@ dwLine ~[in]~ Its line number, kept for logging.				*
+*				@ ptRule ~[out]~ Gets the rule.									*
+*  Returns:		TRUE if the text is well formed.								*
+*  Remarks:		* Enum conditions take comma separated lists, such as			*
+*					event=arrival,key.											*
+*				* A condition may only be given once.							*
+*				* session= is rejected, as the session state is not tracked.	*
+********************************************************************************/
+BOOL
+RULES_ParseRule(
+	__in_z PCSTR pszText,
+	__in DWORD dwLine,
+	__out PRULES_RULE ptRule
+);
+
+/********************************************************************************
+*  Function:	RULES_Add														*
+*  Purpose:		Appends a rule, at the lowest priority so far.					*
+*  Parameters:	@ ptList ~[inout]~ The list.									*
+*				@ ptRule ~[in]~ The rule.										*
+*  Returns:		FALSE if the list is full.										*
+********************************************************************************/
+BOOL
+RULES_Add(
+	__inout PRULES_LIST ptList,
+	__in PCRULES_RULE ptRule
+);
+
+/********************************************************************************
+*  Function:	RULES_IsMatch													*
+*  Purpose:		Checks a single rule against an input.							*
+*  Parameters:	@ ptRule ~[in]~ The rule.										*
+*				@ ptInput ~[in]~ The input.										*
+*  Returns:		A boolean value.												*
+*  Remarks:		* The reference the compiler is verified against, too slow		*
+*					to scan a whole list per event.								*
+********************************************************************************/
+BOOL
+RULES_IsMatch(
+	__in PCRULES_RULE ptRule,
+	__in PCRULES_INPUT ptInput
+);
+
+/********************************************************************************
+*  Function:	RULES_Compile													*
+*  Purpose:		Compiles a rule list into a flat decision table.				*
+*  Parameters:	@ ptList ~[in]~ The rules.										*
+*				@ ppvTable ~[out]~ Gets the compiled bytes.						*
+*				@ pcbTable ~[out]~ Gets their size.								*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Recursive flow classification: each dimension maps its		*
+*					values to classes of values that match the same rules,		*
+*					then phase tables map pairs of classes to classes,			*
+*					down to the first matching rule.							*
+*				* Fails if a phase needs over RULES_MAX_CLASSES classes or		*
+*					RULES_MAX_TABLE_ENTRIES entries.							*
+*				* Free with FREE.												*
+********************************************************************************/
+RETSTATUS
+RULES_Compile(
+	__in PCRULES_LIST ptList,
+	__out PVOID *ppvTable,
+	__out PSIZE_T pcbTable
+);
+
+/********************************************************************************
+*  Function:	RULES_MapTable													*
+*  Purpose:		Validates compiled bytes and points a table into them.			*
+*  Parameters:	@ pvTable ~[in]~ The compiled bytes (8-byte aligned).			*
+*				@ cbTable ~[in]~ Their size.									*
+*				@ ptTable ~[out]~ Gets the table.								*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Checks every section bound and class number, and that			*
+*					every edge probe sequence ends, so evaluating a bad			*
+*					table can neither fault nor hang.							*
+********************************************************************************/
+RETSTATUS
+RULES_MapTable(
+	__in_bcount(cbTable) PCVOID pvTable,
+	__in SIZE_T cbTable,
+	__out PRULES_TABLE ptTable
+);
+
+/********************************************************************************
+*  Function:	RULES_Evaluate													*
+*  Purpose:		Finds the first rule that matches an input.						*
+*  Parameters:	@ ptTable ~[in]~ The table (may be zeroed).						*
+*				@ ptInput ~[in]~ The input.										*
+*				@ pdwLine ~[out_opt]~ Gets the matching rule's line, or 0.		*
+*  Returns:		The matching rule's action, or RULES_ACTION_NONE.				*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+*				* Five lookups, a serial walk and four phase lookups,			*
+*					whatever the number of rules.								*
+********************************************************************************/
+RULES_ACTION
+RULES_Evaluate(
+	__in PCRULES_TABLE ptTable,
+	__in PCRULES_INPUT ptInput,
+	__out_opt PDWORD pdwLine
+);
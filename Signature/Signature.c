@@ -0,0 +1,556 @@
+/********************************************************************************
+*  File:		Signature.c														*
+*  Purpose:		Known payload signatures, matched as keystrokes are typed.		*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#include "Signature.h"
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	SIGNATURE_LINE_CHARS											*
+*  Purpose:		Line buffer size when loading a file (longer lines are			*
+*				malformed, and skipped whole).									*
+********************************************************************************/
+#define SIGNATURE_LINE_CHARS (256)
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	signature_Fold													*
+*  Purpose:		Folds a character to lower case.								*
+*  Parameters:	@ bChar ~[in]~ The character.									*
+*  Returns:		The folded character.											*
+********************************************************************************/
+static
+__inline
+BYTE
+signature_Fold(
+	__in BYTE bChar
+)
+{
+	return (('A' <= bChar) && ('Z' >= bChar)) ? (BYTE)(bChar - 'A' + 'a') : bChar;
+}
+
+/********************************************************************************
+*  Function:	signature_ReadLine												*
+*  Purpose:		Reads a line of a signature file.								*
+*  Parameters:	@ ptFile ~[inout]~ The file.									*
+*				@ pszLine ~[out]~ Gets the line, without its line break.		*
+*				@ pbIsWhole ~[out]~ Gets whether the line fit. The rest of a	*
+*				longer line is skipped.											*
+*  Returns:		FALSE at the end of the file.									*
+********************************************************************************/
+static
+BOOL
+signature_ReadLine(
+	__inout FILE *ptFile,
+	__out_ecount(SIGNATURE_LINE_CHARS) PSTR pszLine,
+	__out PBOOL pbIsWhole
+)
+{
+	SIZE_T cchLine = 0;
+	INT nChar = 0;
+
+	if (NULL == fgets(pszLine, SIGNATURE_LINE_CHARS, ptFile))
+	{
+		return FALSE;
+	}
+
+	// A line that does not fit has no line break, unless it ends the file (or the break is next)
+	cchLine = strlen(pszLine);
+	*pbIsWhole = TRUE;
+	if ((0 < cchLine) && ('\n' != pszLine[cchLine - 1]))
+	{
+		nChar = fgetc(ptFile);
+		*pbIsWhole = (EOF == nChar) || ('\n' == nChar);
+		while ((EOF != nChar) && ('\n' != nChar))
+		{
+			nChar = fgetc(ptFile);
+		}
+	}
+	while ((0 != cchLine) && (('\r' == pszLine[cchLine - 1]) || ('\n' == pszLine[cchLine - 1])))
+	{
+		pszLine[--cchLine] = '\0';
+	}
+	return TRUE;
+}
+
+/********************************************************************************
+*  Function:	signature_GetStream												*
+*  Purpose:		Finds a keyboard's stream, or takes one for it.					*
+*  Parameters:	@ ptStreams ~[inout]~ The streams.								*
+*				@ qwDeviceId ~[in]~ The keyboard.								*
+*  Returns:		The stream.														*
+*  Remarks:		* Most keystrokes come from the keyboard that typed last, which	*
+*					is tried first.												*
+*				* A new keyboard takes a free stream, or else the stream of the	*
+*					keyboard that typed least recently.							*
+********************************************************************************/
+static
+__inline
+PSIGNATURE_STREAM
+signature_GetStream(
+	__inout PSIGNATURE_STREAMS ptStreams,
+	__in ULONGLONG qwDeviceId
+)
+{
+	PSIGNATURE_STREAM ptStream = &(ptStreams->atStreams[ptStreams->dwLast]);
+	PSIGNATURE_STREAM ptVictim = NULL;
+	DWORD dwIndex = 0;
+
+	if ((ptStream->bIsUsed) && (qwDeviceId == ptStream->qwDeviceId))
+	{
+		return ptStream;
+	}
+	for (dwIndex = 0; dwIndex < SIGNATURE_MAX_STREAMS; dwIndex++)
+	{
+		ptStream = &(ptStreams->atStreams[dwIndex]);
+		if ((ptStream->bIsUsed) && (qwDeviceId == ptStream->qwDeviceId))
+		{
+			ptStreams->dwLast = dwIndex;
+			return ptStream;
+		}
+		if ((NULL == ptVictim) ||
+			((ptVictim->bIsUsed) && ((!ptStream->bIsUsed) || (ptStream->qwLastTimestamp < ptVictim->qwLastTimestamp))))
+		{
+			ptVictim = ptStream;
+		}
+	}
+
+	// Start following it
+	RtlZeroMemory(ptVictim, sizeof(*ptVictim));
+	ptVictim->qwDeviceId = qwDeviceId;
+	ptVictim->bIsUsed = TRUE;
+	ptStreams->dwLast = (DWORD)(ptVictim - ptStreams->atStreams);
+	return ptVictim;
+}
+
+/********************************************************************************
+*  Function:	signature_Unescape												*
+*  Purpose:		Parses a signature file line.									*
+*  Parameters:	@ pszLine ~[in]~ The line, without its end.						*
+*				@ pszSignature ~[out]~ Gets the signature (no longer than the	*
+*				line).															*
+*  Returns:		The signature's length, or 0 if the line is malformed.			*
+********************************************************************************/
+static
+DWORD
+signature_Unescape(
+	__in_z PCSTR pszLine,
+	__out PSTR pszSignature
+)
+{
+	PCSTR pszCurrent = NULL;
+	DWORD cchSignature = 0;
+	DWORD dwValue = 0;
+	DWORD dwDigit = 0;
+	CHAR cChar = 0;
+
+	for (pszCurrent = pszLine; '\0' != *pszCurrent; pszCurrent++)
+	{
+		if ('\\' != *pszCurrent)
+		{
+			pszSignature[cchSignature++] = *pszCurrent;
+			continue;
+		}
+		switch (*(++pszCurrent))
+		{
+		case '\\':
+			pszSignature[cchSignature++] = '\\';
+			break;
+		case 'n':
+			pszSignature[cchSignature++] = '\n';
+			break;
+		case 't':
+			pszSignature[cchSignature++] = '\t';
+			break;
+		case 'g':
+			pszSignature[cchSignature++] = (CHAR)LAYOUT_GUI_CHAR;
+			break;
+		case 'x':
+			dwValue = 0;
+			for (dwDigit = 0; dwDigit < 2; dwDigit++)
+			{
+				cChar = *(++pszCurrent);
+				if (('0' <= cChar) && ('9' >= cChar))
+				{
+					dwValue = (dwValue * 16) + (DWORD)(cChar - '0');
+				}
+				else if (('a' <= (cChar | 0x20)) && ('f' >= (cChar | 0x20)))
+				{
+					dwValue = (dwValue * 16) + (DWORD)((cChar | 0x20) - 'a' + 10);
+				}
+				else
+				{
+					return 0;
+				}
+			}
+			if (0 == dwValue)
+			{
+				return 0;
+			}
+			pszSignature[cchSignature++] = (CHAR)dwValue;
+			break;
+		default:
+			return 0;
+		}
+	}
+
+	// Return result
+	return cchSignature;
+}
+
+/********************************************************************************
+*  Function:	SIGNATURE_Compile												*
+********************************************************************************/
+RETSTATUS
+SIGNATURE_Compile(
+	__in_ecount(dwSignatures) const PCSTR *ppszSignatures,
+	__in_ecount(dwSignatures) const DWORD *pcchSignatures,
+	__in DWORD dwSignatures,
+	__out PSIGNATURE_SET ptSet
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	BOOLEAN abIsUsed[256] = { FALSE };
+	PWORD pwFailures = NULL;
+	PWORD pwQueue = NULL;
+	ULONGLONG qwMaxStates = 1;
+	DWORD dwSignature = 0;
+	DWORD dwIndex = 0;
+	DWORD dwClass = 0;
+	DWORD dwState = 0;
+	DWORD dwNext = 0;
+	DWORD dwHead = 0;
+	DWORD dwTail = 0;
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT((NULL != ppszSignatures) || (0 == dwSignatures));
+	ASSERT((NULL != pcchSignatures) || (0 == dwSignatures));
+	ASSERT(NULL != ptSet);
+	RtlZeroMemory(ptSet, sizeof(*ptSet));
+	if (SIGNATURE_MAX_STATES <= dwSignatures)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"Too many signatures (%lu).",
+			(unsigned long)dwSignatures);
+		goto lblCleanup;
+	}
+
+	// A class per character in use (letters folded), class 0 for the others
+	for (dwSignature = 0; dwSignature < dwSignatures; dwSignature++)
+	{
+		for (dwIndex = 0; dwIndex < pcchSignatures[dwSignature]; dwIndex++)
+		{
+			abIsUsed[signature_Fold((BYTE)ppszSignatures[dwSignature][dwIndex])] = TRUE;
+		}
+		qwMaxStates += pcchSignatures[dwSignature];
+	}
+	ptSet->dwClasses = 1;
+	for (dwIndex = 0; dwIndex < sizeof(abIsUsed); dwIndex++)
+	{
+		if (abIsUsed[dwIndex])
+		{
+			ptSet->abClasses[dwIndex] = (BYTE)(ptSet->dwClasses++);
+		}
+	}
+	for (dwIndex = 'A'; dwIndex <= 'Z'; dwIndex++)
+	{
+		ptSet->abClasses[dwIndex] = ptSet->abClasses[signature_Fold((BYTE)dwIndex)];
+	}
+
+	// Room for a state per character at most, each part of the way
+	qwMaxStates = MIN(qwMaxStates, SIGNATURE_MAX_STATES);
+	ptSet->pwTransitions = ALLOCZ((SIZE_T)qwMaxStates * ptSet->dwClasses * sizeof(ptSet->pwTransitions[0]));
+	ptSet->pwMatches = ALLOCZ((SIZE_T)qwMaxStates * sizeof(ptSet->pwMatches[0]));
+	pwFailures = ALLOCZ((SIZE_T)qwMaxStates * sizeof(pwFailures[0]));
+	pwQueue = ALLOCZ((SIZE_T)qwMaxStates * sizeof(pwQueue[0]));
+	if ((NULL == ptSet->pwTransitions) || (NULL == ptSet->pwMatches) || (NULL == pwFailures) || (NULL == pwQueue))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"ALLOCZ() failure.");
+		goto lblCleanup;
+	}
+
+	// The trie: 0 marks a missing child, as the start is nobody's child
+	ptSet->dwStates = 1;
+	for (dwSignature = 0; dwSignature < dwSignatures; dwSignature++)
+	{
+		dwState = 0;
+		for (dwIndex = 0; dwIndex < pcchSignatures[dwSignature]; dwIndex++)
+		{
+			dwClass = ptSet->abClasses[(BYTE)ppszSignatures[dwSignature][dwIndex]];
+			if (0 == ptSet->pwTransitions[dwState * ptSet->dwClasses + dwClass])
+			{
+				if (qwMaxStates == ptSet->dwStates)
+				{
+					eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+						LOG_SEV_ERROR,
+						"Too many signature states (over %lu).",
+						(unsigned long)qwMaxStates);
+					goto lblCleanup;
+				}
+				ptSet->pwTransitions[dwState * ptSet->dwClasses + dwClass] = (WORD)(ptSet->dwStates++);
+			}
+			dwState = ptSet->pwTransitions[dwState * ptSet->dwClasses + dwClass];
+		}
+		if ((0 != dwState) && (0 == ptSet->pwMatches[dwState]))
+		{
+			ptSet->pwMatches[dwState] = (WORD)(dwSignature + 1);
+		}
+	}
+
+	// Breadth first, every missing transition follows the longest suffix that is a prefix
+	for (dwClass = 0; dwClass < ptSet->dwClasses; dwClass++)
+	{
+		dwNext = ptSet->pwTransitions[dwClass];
+		if (0 != dwNext)
+		{
+			pwQueue[dwTail++] = (WORD)dwNext;
+		}
+	}
+	while (dwHead < dwTail)
+	{
+		dwState = pwQueue[dwHead++];
+		for (dwClass = 0; dwClass < ptSet->dwClasses; dwClass++)
+		{
+			dwNext = ptSet->pwTransitions[dwState * ptSet->dwClasses + dwClass];
+			if (0 == dwNext)
+			{
+				ptSet->pwTransitions[dwState * ptSet->dwClasses + dwClass] =
+					ptSet->pwTransitions[pwFailures[dwState] * ptSet->dwClasses + dwClass];
+				continue;
+			}
+
+			// A child: its suffix is a step from its parent's, and so are its matches
+			pwFailures[dwNext] = ptSet->pwTransitions[pwFailures[dwState] * ptSet->dwClasses + dwClass];
+			if (0 == ptSet->pwMatches[dwNext])
+			{
+				ptSet->pwMatches[dwNext] = ptSet->pwMatches[pwFailures[dwNext]];
+			}
+			pwQueue[dwTail++] = (WORD)dwNext;
+		}
+	}
+	ptSet->dwSignatures = dwSignatures;
+	DEBUG_MSG(LOG_SEV_INFO,
+		"Compiled %lu signatures into %lu states of %lu classes.",
+		(unsigned long)dwSignatures,
+		(unsigned long)ptSet->dwStates,
+		(unsigned long)ptSet->dwClasses);
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	FREE(pwFailures);
+	FREE(pwQueue);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		SIGNATURE_Destroy(ptSet);
+	}
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	SIGNATURE_Load													*
+********************************************************************************/
+RETSTATUS
+SIGNATURE_Load(
+	__in_z PCSTR pszPath,
+	__out PSIGNATURE_SET ptSet
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	FILE *ptFile = NULL;
+	CHAR szLine[SIGNATURE_LINE_CHARS] = { 0 };
+	PSTR pszSignatures = NULL;
+	PCSTR *ppszSignatures = NULL;
+	PDWORD pcchSignatures = NULL;
+	SIZE_T cchLines = 0;
+	SIZE_T cchUsed = 0;
+	DWORD dwLines = 0;
+	DWORD dwLine = 0;
+	DWORD dwSignatures = 0;
+	BOOL bIsWhole = FALSE;
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != pszPath);
+	ASSERT(NULL != ptSet);
+	RtlZeroMemory(ptSet, sizeof(*ptSet));
+
+	// Open the file
+	ptFile = fopen(pszPath, "r");
+	if (NULL == ptFile)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_INFO,
+			"Cannot open '%s'.",
+			pszPath);
+		goto lblCleanup;
+	}
+
+	// Size the buffers by the lines that fit, so they are allocated once (signatures are never longer)
+	while (signature_ReadLine(ptFile, szLine, &bIsWhole))
+	{
+		dwLines++;
+		cchLines += bIsWhole ? strlen(szLine) : 0;
+	}
+	pszSignatures = ALLOCZ(cchLines + 1);
+	ppszSignatures = ALLOCZ((dwLines + 1) * sizeof(ppszSignatures[0]));
+	pcchSignatures = ALLOCZ((dwLines + 1) * sizeof(pcchSignatures[0]));
+	if ((NULL == pszSignatures) || (NULL == ppszSignatures) || (NULL == pcchSignatures))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"ALLOCZ() failure.");
+		goto lblCleanup;
+	}
+
+	// Unescape every signature
+	rewind(ptFile);
+	for (dwLine = 1; (dwLine <= dwLines) && (signature_ReadLine(ptFile, szLine, &bIsWhole)); dwLine++)
+	{
+		if (!bIsWhole)
+		{
+			DEBUG_MSG(LOG_SEV_ERROR, "Skipping malformed line %lu of '%s' (too long).", (unsigned long)dwLine, pszPath);
+			continue;
+		}
+		if (('#' == szLine[0]) || ('\0' == szLine[0]))
+		{
+			continue;
+		}
+		ppszSignatures[dwSignatures] = &(pszSignatures[cchUsed]);
+		pcchSignatures[dwSignatures] = signature_Unescape(szLine, &(pszSignatures[cchUsed]));
+		if (0 == pcchSignatures[dwSignatures])
+		{
+			DEBUG_MSG(LOG_SEV_ERROR, "Skipping malformed line %lu of '%s'.", (unsigned long)dwLine, pszPath);
+			continue;
+		}
+		cchUsed += pcchSignatures[dwSignatures];
+		dwSignatures++;
+	}
+
+	// Compile them
+	eStatus = SIGNATURE_Compile(ppszSignatures, pcchSignatures, dwSignatures, ptSet);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		DEBUG_MSG(LOG_SEV_ERROR,
+			"SIGNATURE_Compile() failed (eStatus=0x%.8x).",
+			eStatus);
+		goto lblCleanup;
+	}
+	DEBUG_MSG(LOG_SEV_INFO, "Loaded %lu signatures from '%s'.", (unsigned long)dwSignatures, pszPath);
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	CLOSE(ptFile, fclose);
+	FREE(pszSignatures);
+	FREE(ppszSignatures);
+	FREE(pcchSignatures);
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	SIGNATURE_Destroy												*
+********************************************************************************/
+VOID
+SIGNATURE_Destroy(
+	__inout PSIGNATURE_SET ptSet
+)
+{
+	// Validations
+	ASSERT(NULL != ptSet);
+
+	// Free resources
+	FREE(ptSet->pwTransitions);
+	FREE(ptSet->pwMatches);
+	RtlZeroMemory(ptSet, sizeof(*ptSet));
+}
+
+/********************************************************************************
+*  Function:	SIGNATURE_SetLayout												*
+********************************************************************************/
+VOID
+SIGNATURE_SetLayout(
+	__inout PSIGNATURE_STREAMS ptStreams,
+	__in LAYOUT_ID eLayout
+)
+{
+	// Validations
+	ASSERT(NULL != ptStreams);
+	ASSERT(LAYOUT_ID_COUNT > eLayout);
+
+	RtlZeroMemory(ptStreams->atStreams, sizeof(ptStreams->atStreams));
+	ptStreams->eLayout = eLayout;
+}
+
+/********************************************************************************
+*  Function:	SIGNATURE_OnKey													*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+********************************************************************************/
+DWORD
+SIGNATURE_OnKey(
+	__in PCSIGNATURE_SET ptSet,
+	__inout PSIGNATURE_STREAMS ptStreams,
+	__in ULONGLONG qwDeviceId,
+	__in ULONGLONG qwTimestamp,
+	__in WORD wScanCode,
+	__in BOOLEAN bIsKeyDown
+)
+{
+	PSIGNATURE_STREAM ptStream = NULL;
+	WORD awChars[LAYOUT_MAX_CHARS] = { 0 };
+	DWORD dwChars = 0;
+	DWORD dwIndex = 0;
+	DWORD dwSignature = 0;
+
+	// Nothing to match
+	if (0 == ptSet->dwStates)
+	{
+		return 0;
+	}
+
+	// Decode, most keystrokes (releases) type nothing
+	ptStream = signature_GetStream(ptStreams, qwDeviceId);
+	ptStream->qwLastTimestamp = qwTimestamp;
+	dwChars = LAYOUT_Decode(ptStreams->eLayout, &(ptStream->tLayout), wScanCode, bIsKeyDown, awChars);
+	ptStreams->qwCharacters += dwChars;
+
+	// A single step per character (those beyond Latin-1 are in no signature)
+	for (dwIndex = 0; dwIndex < dwChars; dwIndex++)
+	{
+		ptStream->wState = ptSet->pwTransitions[(DWORD)ptStream->wState * ptSet->dwClasses +
+			ptSet->abClasses[(0x100 > awChars[dwIndex]) ? awChars[dwIndex] : 0]];
+		if (0 != ptSet->pwMatches[ptStream->wState])
+		{
+			dwSignature = ptSet->pwMatches[ptStream->wState];
+			ptStreams->qwMatches++;
+		}
+	}
+
+	// Return result
+	return dwSignature;
+}
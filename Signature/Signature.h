@@ -0,0 +1,184 @@
+/********************************************************************************
+*  File:		Signature.h														*
+*  Purpose:		Known payload signatures, matched as keystrokes are typed.		*
+*  Remarks:		* Keystrokes are decoded to text by layout (see Layout.h), and	*
+*					the text runs through an Aho-Corasick automaton compiled to	*
+*					a dense table: one lookup per character, without			*
+*					backtracking or allocation, whatever the number of			*
+*					signatures.													*
+*				* Matching ignores the case of letters.							*
+********************************************************************************/
+#pragma once
+
+
+/** Includes *******************************************************************/
+#include <Utilities.h>
+#include "../Layout/Layout.h"
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	SIGNATURE_DEFAULT_PATH											*
+*  Purpose:		The default signature file, in the working directory.			*
+********************************************************************************/
+#define SIGNATURE_DEFAULT_PATH ("AntiDuck.signatures")
+
+/********************************************************************************
+*  Constant:	SIGNATURE_MAX_STATES											*
+*  Purpose:		Maximal number of automaton states (about one per signature		*
+*				character, less what signatures share as prefixes).				*
+*  Remarks:		* States are WORDs, so the table is at most 32 MB (a WORD per	*
+*					state and class, up to 256 classes).						*
+********************************************************************************/
+#define SIGNATURE_MAX_STATES (0x10000)
+
+/********************************************************************************
+*  Constant:	SIGNATURE_MAX_STREAMS											*
+*  Purpose:		Keyboards whose typing is followed at once. The one that typed	*
+*				least recently makes room for a new one.						*
+********************************************************************************/
+#define SIGNATURE_MAX_STREAMS (32)
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Structure:	SIGNATURE_SET													*
+*  Purpose:		Compiled signatures: a deterministic automaton over character	*
+*				classes.														*
+*  Remarks:		* State 0 is the start. Characters in no signature have class	*
+*					0, which leads back to the start from every state.			*
+*				* Read-only once compiled, so lookups need no locking.			*
+********************************************************************************/
+typedef struct _SIGNATURE_SET
+{
+	BYTE abClasses[256];							// Class of each character
+	DWORD dwClasses;								// Classes (transitions per state)
+	DWORD dwStates;									// States, 0 while empty
+	DWORD dwSignatures;								// Signatures compiled
+	PWORD pwTransitions;							// Next state, by state then class
+	PWORD pwMatches;								// Signature (1-based) ending at each state, or 0
+} SIGNATURE_SET, *PSIGNATURE_SET;
+typedef const SIGNATURE_SET *PCSIGNATURE_SET;
+
+/********************************************************************************
+*  Structure:	SIGNATURE_STREAM												*
+*  Purpose:		Where a keyboard's typing stands.								*
+********************************************************************************/
+typedef struct _SIGNATURE_STREAM
+{
+	ULONGLONG qwDeviceId;							// The keyboard
+	ULONGLONG qwLastTimestamp;						// When it last typed
+	WORD wState;									// Automaton state
+	LAYOUT_STATE tLayout;							// Modifiers and dead key
+	BOOLEAN bIsUsed;								// Whether the stream is in use
+} SIGNATURE_STREAM, *PSIGNATURE_STREAM;
+
+/********************************************************************************
+*  Structure:	SIGNATURE_STREAMS												*
+*  Purpose:		The typing of the followed keyboards.							*
+*  Remarks:		* Only used from a single thread, counters excepted.			*
+********************************************************************************/
+typedef struct _SIGNATURE_STREAMS
+{
+	SIGNATURE_STREAM atStreams[SIGNATURE_MAX_STREAMS];	// Followed keyboards
+	LAYOUT_ID eLayout;								// How keystrokes are decoded
+	DWORD dwLast;									// The stream that last typed
+	volatile ULONGLONG qwCharacters;				// Characters decoded
+	volatile ULONGLONG qwMatches;					// Signatures typed
+} SIGNATURE_STREAMS, *PSIGNATURE_STREAMS;
+typedef const SIGNATURE_STREAMS *PCSIGNATURE_STREAMS;
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	SIGNATURE_Compile												*
+*  Purpose:		Compiles signatures.											*
+*  Parameters:	@ ppszSignatures ~[in]~ The signatures (not NUL-terminated).	*
+*				@ pcchSignatures ~[in]~ Their lengths.							*
+*				@ dwSignatures ~[in]~ Their number.								*
+*				@ ptSet ~[out]~ Gets the compiled signatures.					*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Free with SIGNATURE_Destroy.									*
+*				* Allocates the table once, and temporary room to compile it.	*
+*				* Matches are reported by signature number (index + 1). Empty	*
+*					signatures never match.										*
+********************************************************************************/
+RETSTATUS
+SIGNATURE_Compile(
+	__in_ecount(dwSignatures) const PCSTR *ppszSignatures,
+	__in_ecount(dwSignatures) const DWORD *pcchSignatures,
+	__in DWORD dwSignatures,
+	__out PSIGNATURE_SET ptSet
+);
+
+/********************************************************************************
+*  Function:	SIGNATURE_Load													*
+*  Purpose:		Compiles the signatures of a file, one per line.				*
+*  Parameters:	@ pszPath ~[in]~ The file.										*
+*				@ ptSet ~[out]~ Gets the compiled signatures.					*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Free with SIGNATURE_Destroy.									*
+*				* Empty lines and lines that start with '#' are skipped.		*
+*				* Escapes: "\\", "\n" (Enter), "\t" (Tab), "\g" (the Windows	*
+*					key) and "\xHH". Lines with others are skipped.				*
+*				* Lines of more than 255 characters are skipped whole.			*
+*				* Signatures are numbered in file order, skipped lines aside.	*
+********************************************************************************/
+RETSTATUS
+SIGNATURE_Load(
+	__in_z PCSTR pszPath,
+	__out PSIGNATURE_SET ptSet
+);
+
+/********************************************************************************
+*  Function:	SIGNATURE_Destroy												*
+*  Purpose:		Frees compiled signatures.										*
+*  Parameters:	@ ptSet ~[inout]~ The compiled signatures (or zeroed).			*
+********************************************************************************/
+VOID
+SIGNATURE_Destroy(
+	__inout PSIGNATURE_SET ptSet
+);
+
+/********************************************************************************
+*  Function:	SIGNATURE_SetLayout												*
+*  Purpose:		Sets the layout keystrokes are decoded by.						*
+*  Parameters:	@ ptStreams ~[inout]~ The streams.								*
+*				@ eLayout ~[in]~ The layout.									*
+*  Remarks:		* The streams are reset. Zeroed streams decode by the US		*
+*					layout.														*
+********************************************************************************/
+VOID
+SIGNATURE_SetLayout(
+	__inout PSIGNATURE_STREAMS ptStreams,
+	__in LAYOUT_ID eLayout
+);
+
+/********************************************************************************
+*  Function:	SIGNATURE_OnKey													*
+*  Purpose:		Feeds a keystroke to its keyboard's stream.						*
+*  Parameters:	@ ptSet ~[in]~ The compiled signatures (or zeroed).				*
+*				@ ptStreams ~[inout]~ The streams (initially zeroed).			*
+*				@ qwDeviceId ~[in]~ The device the key came from.				*
+*				@ qwTimestamp ~[in]~ The key time, in nanoseconds.				*
+*				@ wScanCode ~[in]~ The set 1 scan code.							*
+*				@ bIsKeyDown ~[in]~ Press or release (repeats are presses).		*
+*  Returns:		The number of a signature the keyboard just finished typing,	*
+*				or 0.															*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+*				* O(1), never allocates.										*
+*				* Decodes by the streams' layout (see LAYOUT_Decode).			*
+*					Characters beyond Latin-1 are in no signature.				*
+********************************************************************************/
+DWORD
+SIGNATURE_OnKey(
+	__in PCSIGNATURE_SET ptSet,
+	__inout PSIGNATURE_STREAMS ptStreams,
+	__in ULONGLONG qwDeviceId,
+	__in ULONGLONG qwTimestamp,
+	__in WORD wScanCode,
+	__in BOOLEAN bIsKeyDown
+);
@@ -0,0 +1,298 @@
+/********************************************************************************
+*  File:		Sketch.c														*
+*  Purpose:		Bounded, mergeable streaming quantile sketches.					*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#include <stdlib.h>
+#include "Sketch.h"
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	SKETCH_LEVEL_BITS												*
+*  Purpose:		Bits of a sort key that hold the item's level.					*
+********************************************************************************/
+#define SKETCH_LEVEL_BITS (3)
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	sketch_SortItems												*
+*  Purpose:		Sorts a level's items in place.									*
+*  Parameters:	@ pwItems ~[inout]~ The items.									*
+*				@ dwCount ~[in]~ Number of items.								*
+*  Remarks:		* Insertion sort, levels are short.								*
+********************************************************************************/
+static
+VOID
+sketch_SortItems(
+	__inout_ecount(dwCount) PWORD pwItems,
+	__in DWORD dwCount
+)
+{
+	DWORD dwIndex = 0;
+	DWORD dwHole = 0;
+	WORD wItem = 0;
+
+	for (dwIndex = 1; dwIndex < dwCount; dwIndex++)
+	{
+		wItem = pwItems[dwIndex];
+		for (dwHole = dwIndex; (0 != dwHole) && (pwItems[dwHole - 1] > wItem); dwHole--)
+		{
+			pwItems[dwHole] = pwItems[dwHole - 1];
+		}
+		pwItems[dwHole] = wItem;
+	}
+}
+
+/********************************************************************************
+*  Function:	sketch_CompareKeys												*
+*  Purpose:		Compares two sort keys.											*
+*  Parameters:	@ pvFirst ~[in]~ The first key.									*
+*				@ pvSecond ~[in]~ The second key.								*
+*  Returns:		Negative, zero or positive, as qsort expects.					*
+********************************************************************************/
+static
+INT
+sketch_CompareKeys(
+	__in PCVOID pvFirst,
+	__in PCVOID pvSecond
+)
+{
+	DWORD dwFirst = *(const DWORD *)pvFirst;
+	DWORD dwSecond = *(const DWORD *)pvSecond;
+
+	return (dwFirst > dwSecond) - (dwFirst < dwSecond);
+}
+
+/********************************************************************************
+*  Function:	sketch_Compact													*
+*  Purpose:		Halves a level: every other item moves one level up (or is		*
+*				dropped from the top level).									*
+*  Parameters:	@ ptSketch ~[inout]~ The sketch.								*
+*				@ dwLevel ~[in]~ The level.										*
+*  Remarks:		* An odd item out (the largest) stays, so no weight is lost.	*
+*				* Makes room on the level above first, recursively.				*
+********************************************************************************/
+static
+VOID
+sketch_Compact(
+	__inout PSKETCH ptSketch,
+	__in DWORD dwLevel
+)
+{
+	PWORD pwItems = ptSketch->aawItems[dwLevel];
+	DWORD dwCount = ptSketch->abCounts[dwLevel];
+	DWORD dwPaired = dwCount & ~1UL;
+	DWORD dwIndex = (ptSketch->bOffsets >> dwLevel) & 1;
+	DWORD dwKept = 0;
+
+	// Sort, and keep the other half next time
+	sketch_SortItems(pwItems, dwCount);
+	ptSketch->bOffsets ^= (BYTE)(1 << dwLevel);
+
+	if (SKETCH_LEVELS - 1 == dwLevel)
+	{
+		// Nowhere to go, forget half of the oldest values
+		for (; dwIndex < dwPaired; dwIndex += 2)
+		{
+			pwItems[dwKept++] = pwItems[dwIndex];
+		}
+	}
+	else
+	{
+		// Promote every other item
+		if (SKETCH_LEVEL_ITEMS < ptSketch->abCounts[dwLevel + 1] + (dwPaired / 2))
+		{
+			sketch_Compact(ptSketch, dwLevel + 1);
+		}
+		for (; dwIndex < dwPaired; dwIndex += 2)
+		{
+			ptSketch->aawItems[dwLevel + 1][ptSketch->abCounts[dwLevel + 1]++] = pwItems[dwIndex];
+		}
+	}
+
+	// The odd one out stays
+	if (dwPaired != dwCount)
+	{
+		pwItems[dwKept++] = pwItems[dwPaired];
+	}
+	ptSketch->abCounts[dwLevel] = (BYTE)dwKept;
+}
+
+/********************************************************************************
+*  Function:	sketch_Append													*
+*  Purpose:		Adds an item to a level, compacting it first if full.			*
+*  Parameters:	@ ptSketch ~[inout]~ The sketch.								*
+*				@ dwLevel ~[in]~ The level.										*
+*				@ wItem ~[in]~ The item.										*
+********************************************************************************/
+static
+__inline
+VOID
+sketch_Append(
+	__inout PSKETCH ptSketch,
+	__in DWORD dwLevel,
+	__in WORD wItem
+)
+{
+	if (SKETCH_LEVEL_ITEMS == ptSketch->abCounts[dwLevel])
+	{
+		sketch_Compact(ptSketch, dwLevel);
+	}
+	ptSketch->aawItems[dwLevel][ptSketch->abCounts[dwLevel]++] = wItem;
+}
+
+/********************************************************************************
+*  Function:	SKETCH_Add														*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+********************************************************************************/
+VOID
+SKETCH_Add(
+	__inout PSKETCH ptSketch,
+	__in WORD wValue
+)
+{
+	sketch_Append(ptSketch, 0, wValue);
+}
+
+/********************************************************************************
+*  Function:	SKETCH_Merge													*
+********************************************************************************/
+VOID
+SKETCH_Merge(
+	__inout PSKETCH ptSketch,
+	__in PCSKETCH ptOther
+)
+{
+	DWORD dwLevel = 0;
+	DWORD dwIndex = 0;
+
+	// Validations
+	ASSERT(NULL != ptSketch);
+	ASSERT(NULL != ptOther);
+	ASSERT(ptSketch != ptOther);
+
+	// Items keep their weight, so they go to the same level
+	for (dwLevel = 0; dwLevel < SKETCH_LEVELS; dwLevel++)
+	{
+		for (dwIndex = 0; dwIndex < ptOther->abCounts[dwLevel]; dwIndex++)
+		{
+			sketch_Append(ptSketch, dwLevel, ptOther->aawItems[dwLevel][dwIndex]);
+		}
+	}
+}
+
+/********************************************************************************
+*  Function:	SKETCH_GetCount													*
+********************************************************************************/
+DWORD
+SKETCH_GetCount(
+	__in PCSKETCH ptSketch
+)
+{
+	DWORD dwCount = 0;
+	DWORD dwLevel = 0;
+
+	// Validations
+	ASSERT(NULL != ptSketch);
+
+	// Weigh every level
+	for (dwLevel = 0; dwLevel < SKETCH_LEVELS; dwLevel++)
+	{
+		dwCount += (DWORD)ptSketch->abCounts[dwLevel] << dwLevel;
+	}
+
+	// Return result
+	return dwCount;
+}
+
+/********************************************************************************
+*  Function:	SKETCH_GetQuantiles												*
+********************************************************************************/
+BOOL
+SKETCH_GetQuantiles(
+	__in PCSKETCH ptSketch,
+	__in_ecount(dwQuantiles) const DWORD *pdwQuantiles,
+	__in DWORD dwQuantiles,
+	__out_ecount(dwQuantiles) PWORD pwValues
+)
+{
+	DWORD adwKeys[SKETCH_LEVELS * SKETCH_LEVEL_ITEMS] = { 0 };
+	DWORD dwKeys = 0;
+	DWORD dwKey = 0;
+	DWORD dwLevel = 0;
+	DWORD dwIndex = 0;
+	DWORD dwQuantile = 0;
+	ULONGLONG qwCount = 0;
+	ULONGLONG qwRank = 0;
+	ULONGLONG qwSeen = 0;
+
+	// Validations
+	ASSERT(NULL != ptSketch);
+	ASSERT(NULL != pdwQuantiles);
+	ASSERT(NULL != pwValues);
+
+	// Sort all items at once, each key carries its level (and so its weight)
+	for (dwLevel = 0; dwLevel < SKETCH_LEVELS; dwLevel++)
+	{
+		for (dwIndex = 0; dwIndex < ptSketch->abCounts[dwLevel]; dwIndex++)
+		{
+			adwKeys[dwKeys++] = ((DWORD)ptSketch->aawItems[dwLevel][dwIndex] << SKETCH_LEVEL_BITS) | dwLevel;
+		}
+		qwCount += (ULONGLONG)ptSketch->abCounts[dwLevel] << dwLevel;
+	}
+	if (0 == dwKeys)
+	{
+		return FALSE;
+	}
+	qsort(adwKeys, dwKeys, sizeof(adwKeys[0]), sketch_CompareKeys);
+
+	// Walk the weights once, the shares are ascending
+	for (dwQuantile = 0; dwQuantile < dwQuantiles; dwQuantile++)
+	{
+		ASSERT(SKETCH_QUANTILE_SCALE >= pdwQuantiles[dwQuantile]);
+		ASSERT((0 == dwQuantile) || (pdwQuantiles[dwQuantile - 1] <= pdwQuantiles[dwQuantile]));
+
+		// The rank of the value, rounding up so the maximum is reachable
+		qwRank = MAX(1, (qwCount * pdwQuantiles[dwQuantile] + SKETCH_QUANTILE_SCALE - 1) / SKETCH_QUANTILE_SCALE);
+		while ((qwSeen < qwRank) && (dwKey < dwKeys))
+		{
+			qwSeen += 1ULL << (adwKeys[dwKey] & ((1 << SKETCH_LEVEL_BITS) - 1));
+			dwKey++;
+		}
+		pwValues[dwQuantile] = (WORD)(adwKeys[dwKey - 1] >> SKETCH_LEVEL_BITS);
+	}
+
+	// Success
+	return TRUE;
+}
+
+/********************************************************************************
+*  Function:	SKETCH_IsValid													*
+********************************************************************************/
+BOOL
+SKETCH_IsValid(
+	__in PCSKETCH ptSketch
+)
+{
+	DWORD dwLevel = 0;
+
+	// Validations
+	ASSERT(NULL != ptSketch);
+
+	for (dwLevel = 0; dwLevel < SKETCH_LEVELS; dwLevel++)
+	{
+		if (SKETCH_LEVEL_ITEMS < ptSketch->abCounts[dwLevel])
+		{
+			return FALSE;
+		}
+	}
+
+	// Success
+	return TRUE;
+}
@@ -0,0 +1,578 @@
+/********************************************************************************
+*  File:		Telemetry.c														*
+*  Purpose:		Batched telemetry export of arrivals, verdicts and locks to a	*
+*				local collector socket (POSIX).									*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#include <time.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#endif	// _WIN32
+#include "Telemetry.h"
+#include <Clock.h>
+
+#ifndef _WIN32
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	TELEMETRY_MAX_EVENT_BYTES										*
+*  Purpose:		The most an encoded event takes: its kind, then at most five	*
+*				varints of at most 10 bytes.									*
+********************************************************************************/
+#define TELEMETRY_MAX_EVENT_BYTES (1 + (5 * 10))
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	telemetry_PutVarint												*
+*  Purpose:		Encodes an unsigned LEB128 varint.								*
+*  Parameters:	@ pbOut ~[out]~ Gets the varint (up to 10 bytes).				*
+*				@ qwValue ~[in]~ The value.										*
+*  Returns:		The number of bytes written.									*
+********************************************************************************/
+static
+__inline
+ULONG
+telemetry_PutVarint(
+	__out_bcount(10) PBYTE pbOut,
+	__in ULONGLONG qwValue
+)
+{
+	ULONG cbOut = 0;
+
+	while (0x80 <= qwValue)
+	{
+		pbOut[cbOut++] = (BYTE)(qwValue | 0x80);
+		qwValue >>= 7;
+	}
+	pbOut[cbOut++] = (BYTE)qwValue;
+	return cbOut;
+}
+
+/********************************************************************************
+*  Function:	telemetry_GetVarint												*
+*  Purpose:		Decodes an unsigned LEB128 varint.								*
+*  Parameters:	@ pbIn ~[in]~ The encoded data.									*
+*				@ cbIn ~[in]~ Its size.											*
+*				@ pcbOffset ~[inout]~ Where the varint starts, then ends.		*
+*				@ pqwValue ~[out]~ Gets the value.								*
+*  Returns:		FALSE if it is truncated or too long.							*
+********************************************************************************/
+static
+BOOL
+telemetry_GetVarint(
+	__in_bcount(cbIn) const BYTE *pbIn,
+	__in SIZE_T cbIn,
+	__inout PSIZE_T pcbOffset,
+	__out PULONGLONG pqwValue
+)
+{
+	ULONG dwShift = 0;
+	BYTE bByte = 0;
+
+	*pqwValue = 0;
+	for (dwShift = 0; (dwShift < 64) && (*pcbOffset < cbIn); dwShift += 7)
+	{
+		bByte = pbIn[(*pcbOffset)++];
+		*pqwValue |= (ULONGLONG)(bByte & 0x7F) << dwShift;
+		if (0 == (bByte & 0x80))
+		{
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/********************************************************************************
+*  Function:	telemetry_GetThreadCpuNs										*
+*  Purpose:		Gets the CPU time of the calling thread.						*
+*  Returns:		The time, in nanoseconds.										*
+********************************************************************************/
+static
+ULONGLONG
+telemetry_GetThreadCpuNs(VOID)
+{
+	struct timespec tNow = { 0 };
+
+	(VOID)clock_gettime(CLOCK_THREAD_CPUTIME_ID, &tNow);
+	return ((ULONGLONG)tNow.tv_sec * NANOSECONDS_IN_SECOND) + (ULONGLONG)tNow.tv_nsec;
+}
+
+/********************************************************************************
+*  Function:	telemetry_SendBatch												*
+*  Purpose:		Sends the batch being filled, and starts over.					*
+*  Parameters:	@ ptTelemetry ~[inout]~ The exporter.							*
+*  Remarks:		* Exporter only.												*
+*				* Never waits: a collector that is missing or has no room		*
+*					misses the batch, which is counted.							*
+********************************************************************************/
+static
+VOID
+telemetry_SendBatch(
+	__inout PTELEMETRY ptTelemetry
+)
+{
+	if (0 == ptTelemetry->dwBatchEvents)
+	{
+		return;
+	}
+	if ((ssize_t)(ptTelemetry->cbBatch) == sendto(ptTelemetry->nSocket,
+		ptTelemetry->abBatch,
+		ptTelemetry->cbBatch,
+		MSG_DONTWAIT | MSG_NOSIGNAL,
+		(const struct sockaddr *)&(ptTelemetry->tCollector),
+		ptTelemetry->cbCollector))
+	{
+		ptTelemetry->qwExported += ptTelemetry->dwBatchEvents;
+		ptTelemetry->qwBatches++;
+		ptTelemetry->qwBytes += ptTelemetry->cbBatch;
+	}
+	else
+	{
+		ptTelemetry->qwDroppedEvents += ptTelemetry->dwBatchEvents;
+		ptTelemetry->qwDroppedBatches++;
+	}
+	ptTelemetry->cbBatch = 0;
+	ptTelemetry->dwBatchEvents = 0;
+}
+
+/********************************************************************************
+*  Function:	telemetry_AppendEvent											*
+*  Purpose:		Encodes an event into the batch, sending the batch first if		*
+*				the event might not fit.										*
+*  Parameters:	@ ptTelemetry ~[inout]~ The exporter.							*
+*				@ ptEvent ~[in]~ The event.										*
+*  Remarks:		* Exporter only.												*
+********************************************************************************/
+static
+VOID
+telemetry_AppendEvent(
+	__inout PTELEMETRY ptTelemetry,
+	__in PCTELEMETRY_EVENT ptEvent
+)
+{
+	SPSCQUEUE_STATS tStats = { 0 };
+	PBYTE pbOut = NULL;
+	ULONGLONG qwUs = (ULONGLONG)((LONGLONG)(ptEvent->qwTimestamp / NANOSECONDS_IN_MICROSECOND) + ptTelemetry->llUnixOffsetUs);
+	LONGLONG llDeltaUs = 0;
+
+	if (TELEMETRY_BATCH_BYTES - ptTelemetry->cbBatch < TELEMETRY_MAX_EVENT_BYTES)
+	{
+		telemetry_SendBatch(ptTelemetry);
+	}
+
+	// A new batch starts with its number and the drops so far, and its first delta is from 0
+	if (0 == ptTelemetry->dwBatchEvents)
+	{
+		SPSCQUEUE_GetStats(&(ptTelemetry->tQueue), &tStats);
+		ptTelemetry->abBatch[0] = TELEMETRY_FORMAT_VERSION;
+		ptTelemetry->cbBatch = 1;
+		ptTelemetry->cbBatch += telemetry_PutVarint(&(ptTelemetry->abBatch[ptTelemetry->cbBatch]), ptTelemetry->qwSequence++);
+		ptTelemetry->cbBatch += telemetry_PutVarint(&(ptTelemetry->abBatch[ptTelemetry->cbBatch]), tStats.qwDropped + ptTelemetry->qwDroppedEvents);
+		ptTelemetry->qwPreviousUs = 0;
+	}
+
+	// Kind, zigzag timestamp delta, then the kind's fields
+	pbOut = &(ptTelemetry->abBatch[ptTelemetry->cbBatch]);
+	llDeltaUs = (LONGLONG)(qwUs - ptTelemetry->qwPreviousUs);
+	ptTelemetry->qwPreviousUs = qwUs;
+	*(pbOut++) = (BYTE)(ptEvent->eKind);
+	pbOut += telemetry_PutVarint(pbOut, ((ULONGLONG)llDeltaUs << 1) ^ (ULONGLONG)(llDeltaUs >> 63));
+	switch (ptEvent->eKind)
+	{
+	case TELEMETRY_KIND_ARRIVAL:
+		pbOut += telemetry_PutVarint(pbOut, (ULONGLONG)(ptEvent->eClass));
+		pbOut += telemetry_PutVarint(pbOut, ptEvent->wVendorId);
+		pbOut += telemetry_PutVarint(pbOut, ptEvent->wProductId);
+		break;
+
+	case TELEMETRY_KIND_VERDICT:
+		pbOut += telemetry_PutVarint(pbOut, (ULONGLONG)(ptEvent->eType));
+		pbOut += telemetry_PutVarint(pbOut, (ULONGLONG)(ptEvent->eClass));
+		pbOut += telemetry_PutVarint(pbOut, (ULONGLONG)!!(ptEvent->bIsLocked));
+		break;
+
+	case TELEMETRY_KIND_LOCK:
+		pbOut += telemetry_PutVarint(pbOut, ptEvent->qwLatencyNs);
+		break;
+
+	default:
+		return;
+	}
+	pbOut += telemetry_PutVarint(pbOut, ptEvent->qwDeviceId);
+	ptTelemetry->cbBatch = (ULONG)(pbOut - ptTelemetry->abBatch);
+	ptTelemetry->dwBatchEvents++;
+}
+
+/********************************************************************************
+*  Function:	telemetry_ExportPass											*
+*  Purpose:		Encodes and sends every queued event.							*
+*  Parameters:	@ ptTelemetry ~[inout]~ The exporter.							*
+*  Remarks:		* Exporter only (or TELEMETRY_Stop, once the exporter is		*
+*					gone).														*
+********************************************************************************/
+static
+VOID
+telemetry_ExportPass(
+	__inout PTELEMETRY ptTelemetry
+)
+{
+	PTELEMETRY_EVENT ptEvents = NULL;
+	ULONGLONG qwStartCpuNs = telemetry_GetThreadCpuNs();
+	ULONG dwCount = 0;
+	ULONG dwIndex = 0;
+
+	// Drain in contiguous batches, then send the partial batch
+	for (;;)
+	{
+		dwCount = SPSCQUEUE_Peek(&(ptTelemetry->tQueue), (PVOID *)&ptEvents);
+		if (0 == dwCount)
+		{
+			break;
+		}
+		for (dwIndex = 0; dwIndex < dwCount; dwIndex++)
+		{
+			telemetry_AppendEvent(ptTelemetry, &(ptEvents[dwIndex]));
+		}
+		SPSCQUEUE_Release(&(ptTelemetry->tQueue), dwCount);
+	}
+	telemetry_SendBatch(ptTelemetry);
+	ptTelemetry->qwCpuNs += telemetry_GetThreadCpuNs() - qwStartCpuNs;
+	(VOID)ATOMIC_INCREMENT(&(ptTelemetry->nPasses));
+}
+
+/********************************************************************************
+*  Function:	telemetry_ExporterThread										*
+*  Purpose:		Exports every TELEMETRY_FLUSH_INTERVAL_MS, or when woken.		*
+*  Parameters:	@ pvTelemetry ~[inout]~ The exporter.							*
+*  Returns:		0.																*
+********************************************************************************/
+static
+UINT
+WINAPI
+telemetry_ExporterThread(
+	__inout_opt PVOID pvTelemetry
+)
+{
+	PTELEMETRY ptTelemetry = (PTELEMETRY)pvTelemetry;
+	struct pollfd tWakeup = { 0 };
+	eventfd_t qwValue = 0;
+	sigset_t tSignals;
+
+	// Leave signals to the threads that wait for them
+	(VOID)sigfillset(&tSignals);
+	(VOID)pthread_sigmask(SIG_BLOCK, &tSignals, NULL);
+	tWakeup.fd = ptTelemetry->nWakeup;
+	tWakeup.events = POLLIN;
+
+	while (!ATOMIC_LOAD_ACQUIRE(&(ptTelemetry->nIsStopping)))
+	{
+		if (0 < poll(&tWakeup, 1, TELEMETRY_FLUSH_INTERVAL_MS))
+		{
+			(VOID)eventfd_read(ptTelemetry->nWakeup, &qwValue);
+		}
+		telemetry_ExportPass(ptTelemetry);
+	}
+
+	// Return result
+	return 0;
+}
+
+/********************************************************************************
+*  Function:	TELEMETRY_Start													*
+********************************************************************************/
+RETSTATUS
+TELEMETRY_Start(
+	__in_z PCSTR pszCollectorPath,
+	__out PTELEMETRY ptTelemetry
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	struct timespec tUnixTime = { 0 };
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != pszCollectorPath);
+	ASSERT(NULL != ptTelemetry);
+
+	RtlZeroMemory(ptTelemetry, sizeof(*ptTelemetry));
+	ptTelemetry->nSocket = -1;
+	ptTelemetry->nWakeup = -1;
+	ptTelemetry->tCollector.sun_family = AF_UNIX;
+	if (sizeof(ptTelemetry->tCollector.sun_path) <= (SIZE_T)snprintf(ptTelemetry->tCollector.sun_path, sizeof(ptTelemetry->tCollector.sun_path), "%s", pszCollectorPath))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"Path too long ('%s').",
+			pszCollectorPath);
+		goto lblCleanup;
+	}
+	ptTelemetry->cbCollector = (socklen_t)sizeof(ptTelemetry->tCollector);
+
+	// Anchor the monotonic clock to Unix time, for the collector
+	(VOID)clock_gettime(CLOCK_REALTIME, &tUnixTime);
+	ptTelemetry->llUnixOffsetUs = ((LONGLONG)(tUnixTime.tv_sec) * 1000000) + (tUnixTime.tv_nsec / 1000) -
+		(LONGLONG)(CLOCK_GetTimestamp() / NANOSECONDS_IN_MICROSECOND);
+
+	// Create the queue, the socket and the wakeup object
+	eStatus = SPSCQUEUE_Create(sizeof(TELEMETRY_EVENT), TELEMETRY_QUEUE_CAPACITY, &(ptTelemetry->tQueue));
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		DEBUG_MSG(LOG_SEV_ERROR,
+			"SPSCQUEUE_Create() failed (eStatus=0x%.8x).",
+			eStatus);
+		goto lblCleanup;
+	}
+	ptTelemetry->nSocket = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (0 > ptTelemetry->nSocket)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"socket() failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+	ptTelemetry->nWakeup = eventfd(0, EFD_CLOEXEC);
+	if (0 > ptTelemetry->nWakeup)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"eventfd() failure (errno=%d).",
+			errno);
+		goto lblCleanup;
+	}
+
+	// Start the exporter
+	ptTelemetry->hExporter = BEGIN_THREAD(telemetry_ExporterThread, ptTelemetry, 0);
+	if (NULL == ptTelemetry->hExporter)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"BEGIN_THREAD() failure.");
+		goto lblCleanup;
+	}
+	DEBUG_MSG(LOG_SEV_INFO, "Exporting telemetry to '%s'.", pszCollectorPath);
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		TELEMETRY_Stop(ptTelemetry);
+	}
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	TELEMETRY_Record												*
+********************************************************************************/
+VOID
+TELEMETRY_Record(
+	__inout PTELEMETRY ptTelemetry,
+	__in PCTELEMETRY_EVENT ptEvent
+)
+{
+	if (!SPSCQUEUE_Enqueue(&(ptTelemetry->tQueue), ptEvent))
+	{
+		return;
+	}
+
+	// About a batch's worth, export it now rather than at the next interval
+	if (TELEMETRY_WAKE_EVENTS <= ++(ptTelemetry->dwUnsignaled))
+	{
+		ptTelemetry->dwUnsignaled = 0;
+		(VOID)eventfd_write(ptTelemetry->nWakeup, 1);
+	}
+}
+
+/********************************************************************************
+*  Function:	TELEMETRY_Flush													*
+********************************************************************************/
+VOID
+TELEMETRY_Flush(
+	__inout PTELEMETRY ptTelemetry
+)
+{
+	LONG nPasses = 0;
+
+	if (NULL == ptTelemetry->hExporter)
+	{
+		return;
+	}
+
+	// The pass in progress may have missed our events, wait for the next one
+	nPasses = ATOMIC_LOAD_ACQUIRE(&(ptTelemetry->nPasses));
+	(VOID)eventfd_write(ptTelemetry->nWakeup, 1);
+	while (2 > (ATOMIC_LOAD_ACQUIRE(&(ptTelemetry->nPasses)) - nPasses))
+	{
+		(VOID)sched_yield();
+		if (1 == (ATOMIC_LOAD_ACQUIRE(&(ptTelemetry->nPasses)) - nPasses))
+		{
+			(VOID)eventfd_write(ptTelemetry->nWakeup, 1);
+		}
+	}
+}
+
+/********************************************************************************
+*  Function:	TELEMETRY_Stop													*
+********************************************************************************/
+VOID
+TELEMETRY_Stop(
+	__inout PTELEMETRY ptTelemetry
+)
+{
+	if (NULL == ptTelemetry->tQueue.pbSlots)
+	{
+		return;
+	}
+
+	// Stop the exporter, then send what is left on this thread
+	if (NULL != ptTelemetry->hExporter)
+	{
+		ATOMIC_STORE_RELEASE(&(ptTelemetry->nIsStopping), TRUE);
+		(VOID)eventfd_write(ptTelemetry->nWakeup, 1);
+		JOIN_THREAD(ptTelemetry->hExporter);
+		telemetry_ExportPass(ptTelemetry);
+	}
+
+	// Free resources
+	CLOSE_FD(ptTelemetry->nWakeup);
+	CLOSE_FD(ptTelemetry->nSocket);
+	SPSCQUEUE_Destroy(&(ptTelemetry->tQueue));
+	ptTelemetry->tQueue.pbSlots = NULL;
+}
+
+/********************************************************************************
+*  Function:	TELEMETRY_GetStats												*
+********************************************************************************/
+VOID
+TELEMETRY_GetStats(
+	__in PTELEMETRY ptTelemetry,
+	__out PTELEMETRY_STATS ptStats
+)
+{
+	SPSCQUEUE_STATS tQueueStats = { 0 };
+
+	SPSCQUEUE_GetStats(&(ptTelemetry->tQueue), &tQueueStats);
+	ptStats->qwRecorded = tQueueStats.qwEnqueued + tQueueStats.qwDropped;
+	ptStats->qwExported = ptTelemetry->qwExported;
+	ptStats->qwBatches = ptTelemetry->qwBatches;
+	ptStats->qwBytes = ptTelemetry->qwBytes;
+	ptStats->qwDroppedEvents = tQueueStats.qwDropped + ptTelemetry->qwDroppedEvents;
+	ptStats->qwDroppedBatches = ptTelemetry->qwDroppedBatches;
+	ptStats->qwCpuNs = ptTelemetry->qwCpuNs;
+}
+
+/********************************************************************************
+*  Function:	TELEMETRY_DecodeBatch											*
+********************************************************************************/
+BOOL
+TELEMETRY_DecodeBatch(
+	__in_bcount(cbBatch) const BYTE *pbBatch,
+	__in SIZE_T cbBatch,
+	__out PTELEMETRY_BATCH_HEADER ptHeader,
+	__in PFN_TELEMETRY_EVENT pfnEvent,
+	__inout_opt PVOID pvContext
+)
+{
+	TELEMETRY_EVENT tEvent = { 0 };
+	SIZE_T cbOffset = 1;
+	ULONGLONG qwDelta = 0;
+	ULONGLONG qwValue = 0;
+	ULONGLONG qwPreviousUs = 0;
+
+	RtlZeroMemory(ptHeader, sizeof(*ptHeader));
+	if ((0 == cbBatch) || (TELEMETRY_FORMAT_VERSION != pbBatch[0]) ||
+		(!telemetry_GetVarint(pbBatch, cbBatch, &cbOffset, &(ptHeader->qwSequence))) ||
+		(!telemetry_GetVarint(pbBatch, cbBatch, &cbOffset, &(ptHeader->qwDroppedEvents))))
+	{
+		return FALSE;
+	}
+	while (cbOffset < cbBatch)
+	{
+		RtlZeroMemory(&tEvent, sizeof(tEvent));
+		tEvent.eKind = (TELEMETRY_KIND)(pbBatch[cbOffset++]);
+		if (!telemetry_GetVarint(pbBatch, cbBatch, &cbOffset, &qwDelta))
+		{
+			return FALSE;
+		}
+		qwPreviousUs += (qwDelta >> 1) ^ (0 - (qwDelta & 1));
+		tEvent.qwTimestamp = qwPreviousUs;
+		switch (tEvent.eKind)
+		{
+		case TELEMETRY_KIND_ARRIVAL:
+			if ((!telemetry_GetVarint(pbBatch, cbBatch, &cbOffset, &qwValue)) ||
+				(EVENTSOURCE_DEVICE_CLASS_KEYBOARD < qwValue))
+			{
+				return FALSE;
+			}
+			tEvent.eClass = (EVENTSOURCE_DEVICE_CLASS)qwValue;
+			if ((!telemetry_GetVarint(pbBatch, cbBatch, &cbOffset, &qwValue)) || (0xFFFF < qwValue))
+			{
+				return FALSE;
+			}
+			tEvent.wVendorId = (WORD)qwValue;
+			if ((!telemetry_GetVarint(pbBatch, cbBatch, &cbOffset, &qwValue)) || (0xFFFF < qwValue))
+			{
+				return FALSE;
+			}
+			tEvent.wProductId = (WORD)qwValue;
+			break;
+
+		case TELEMETRY_KIND_VERDICT:
+			if ((!telemetry_GetVarint(pbBatch, cbBatch, &cbOffset, &qwValue)) ||
+				(EVENTSOURCE_EVENT_TYPE_KEY < qwValue))
+			{
+				return FALSE;
+			}
+			tEvent.eType = (EVENTSOURCE_EVENT_TYPE)qwValue;
+			if ((!telemetry_GetVarint(pbBatch, cbBatch, &cbOffset, &qwValue)) ||
+				(EVENTSOURCE_DEVICE_CLASS_KEYBOARD < qwValue))
+			{
+				return FALSE;
+			}
+			tEvent.eClass = (EVENTSOURCE_DEVICE_CLASS)qwValue;
+			if ((!telemetry_GetVarint(pbBatch, cbBatch, &cbOffset, &qwValue)) || (1 < qwValue))
+			{
+				return FALSE;
+			}
+			tEvent.bIsLocked = (BOOL)qwValue;
+			break;
+
+		case TELEMETRY_KIND_LOCK:
+			if (!telemetry_GetVarint(pbBatch, cbBatch, &cbOffset, &(tEvent.qwLatencyNs)))
+			{
+				return FALSE;
+			}
+			break;
+
+		default:
+			return FALSE;
+		}
+		if (!telemetry_GetVarint(pbBatch, cbBatch, &cbOffset, &(tEvent.qwDeviceId)))
+		{
+			return FALSE;
+		}
+		pfnEvent(&tEvent, pvContext);
+	}
+
+	// Return result
+	return TRUE;
+}
+
+#endif	// _WIN32
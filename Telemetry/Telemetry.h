@@ -0,0 +1,260 @@
+/********************************************************************************
+*  File:		Telemetry.h														*
+*  Purpose:		Batched telemetry export of arrivals, verdicts and locks to a	*
+*				local collector socket (POSIX).									*
+*  Remarks:		* The producer only copies a fixed-size event into a bounded	*
+*					queue. An exporter thread encodes batches (varints, and		*
+*					timestamps as deltas from the previous event) and sends		*
+*					each as one datagram, when full or every					*
+*					TELEMETRY_FLUSH_INTERVAL_MS.								*
+*				* A slow or missing collector costs dropped batches, which		*
+*					are counted, never memory or blocking.						*
+********************************************************************************/
+#pragma once
+
+
+/** Includes *******************************************************************/
+#include <Utilities.h>
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif	// _WIN32
+#include "../EventSource/EventSource.h"
+#include "../Queue/SpscQueue.h"
+
+#ifndef _WIN32
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	TELEMETRY_FORMAT_VERSION										*
+*  Purpose:		The first byte of every batch. Batches of any other version		*
+*				are rejected.													*
+********************************************************************************/
+#define TELEMETRY_FORMAT_VERSION (1)
+
+/********************************************************************************
+*  Constant:	TELEMETRY_QUEUE_CAPACITY										*
+*  Purpose:		Events the producer can record ahead of the exporter before		*
+*				dropping (a power of two).										*
+********************************************************************************/
+#define TELEMETRY_QUEUE_CAPACITY (4096)
+
+/********************************************************************************
+*  Constant:	TELEMETRY_BATCH_BYTES											*
+*  Purpose:		The largest batch (datagram) sent to the collector.				*
+********************************************************************************/
+#define TELEMETRY_BATCH_BYTES (2048)
+
+/********************************************************************************
+*  Constant:	TELEMETRY_WAKE_EVENTS											*
+*  Purpose:		Events recorded before the exporter is woken up early, about	*
+*				what fills a batch.												*
+********************************************************************************/
+#define TELEMETRY_WAKE_EVENTS (128)
+
+/********************************************************************************
+*  Constant:	TELEMETRY_FLUSH_INTERVAL_MS										*
+*  Purpose:		The longest an event waits for its batch to be sent.			*
+********************************************************************************/
+#define TELEMETRY_FLUSH_INTERVAL_MS (250)
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Enum:		TELEMETRY_KIND													*
+*  Purpose:		What a telemetry event reports (its first byte once encoded).	*
+********************************************************************************/
+typedef enum
+{
+	TELEMETRY_KIND_ARRIVAL = 1,						// Class, VID, PID, device ID
+	TELEMETRY_KIND_VERDICT,							// Event type, class, verdict, device ID
+	TELEMETRY_KIND_LOCK,							// Device ID, receipt to lock latency
+
+	// Must be last
+	TELEMETRY_KIND_END
+} TELEMETRY_KIND, *PTELEMETRY_KIND;
+
+/********************************************************************************
+*  Structure:	TELEMETRY_EVENT													*
+*  Purpose:		A telemetry event, as recorded and as decoded.					*
+*  Remarks:		* Only the fields of its kind are exported (see					*
+*					TELEMETRY_KIND), the others decode as 0.					*
+********************************************************************************/
+typedef struct _TELEMETRY_EVENT
+{
+	TELEMETRY_KIND eKind;							// What it reports
+	EVENTSOURCE_EVENT_TYPE eType;					// Device event type (verdicts)
+	EVENTSOURCE_DEVICE_CLASS eClass;				// Device class (arrivals, verdicts)
+	BOOL bIsLocked;									// Verdict (verdicts)
+	WORD wVendorId;									// USB vendor ID (arrivals)
+	WORD wProductId;								// USB product ID (arrivals)
+	ULONGLONG qwTimestamp;							// CLOCK_GetTimestamp when recorded, Unix
+													// time in microseconds when decoded
+	ULONGLONG qwDeviceId;							// Source-specific device ID
+	ULONGLONG qwLatencyNs;							// Receipt to lock requested or published (locks)
+} TELEMETRY_EVENT, *PTELEMETRY_EVENT;
+typedef const TELEMETRY_EVENT *PCTELEMETRY_EVENT;
+
+/********************************************************************************
+*  Structure:	TELEMETRY_BATCH_HEADER											*
+*  Purpose:		What a batch says about itself, once decoded.					*
+*  Remarks:		* Encoded as the version byte, then varints.					*
+********************************************************************************/
+typedef struct _TELEMETRY_BATCH_HEADER
+{
+	ULONGLONG qwSequence;							// Batch number, from 0 (gaps are lost batches)
+	ULONGLONG qwDroppedEvents;						// Events dropped before this batch
+} TELEMETRY_BATCH_HEADER, *PTELEMETRY_BATCH_HEADER;
+
+/********************************************************************************
+*  Callback:	PFN_TELEMETRY_EVENT												*
+*  Purpose:		Receives a decoded event.										*
+*  Parameters:	@ ptEvent ~[in]~ The event.										*
+*				@ pvContext ~[inout]~ The context given to						*
+*				TELEMETRY_DecodeBatch.											*
+********************************************************************************/
+typedef VOID (*PFN_TELEMETRY_EVENT)(
+	__in PCTELEMETRY_EVENT ptEvent,
+	__inout_opt PVOID pvContext
+);
+
+/********************************************************************************
+*  Structure:	TELEMETRY														*
+*  Purpose:		An exporter.													*
+*  Remarks:		* Events are recorded from a single thread.						*
+********************************************************************************/
+typedef struct _TELEMETRY
+{
+	SPSCQUEUE tQueue;								// Events (producer to exporter)
+	ULONG dwUnsignaled;								// Events since the last wakeup (producer)
+	INT nSocket;									// Unbound datagram socket
+	struct sockaddr_un tCollector;					// The collector's address
+	socklen_t cbCollector;							// Its length
+	LONGLONG llUnixOffsetUs;						// Unix time minus CLOCK_GetTimestamp, in us
+	HANDLE hExporter;								// Exporter thread
+	INT nWakeup;									// eventfd
+	volatile LONG nIsStopping;						// Exporter should exit
+	volatile LONG nPasses;							// Completed exporter passes
+	BYTE abBatch[TELEMETRY_BATCH_BYTES];			// The batch being filled (exporter)
+	ULONG cbBatch;									// Its size
+	ULONG dwBatchEvents;							// Its events
+	ULONGLONG qwPreviousUs;							// Its last event's timestamp
+	ULONGLONG qwSequence;							// Batches started so far
+	volatile ULONGLONG qwExported;					// Events sent
+	volatile ULONGLONG qwBatches;					// Batches sent
+	volatile ULONGLONG qwBytes;						// Bytes sent
+	volatile ULONGLONG qwDroppedEvents;				// Events in batches the collector missed
+	volatile ULONGLONG qwDroppedBatches;			// Batches the collector missed
+	volatile ULONGLONG qwCpuNs;						// Exporter CPU time
+} TELEMETRY, *PTELEMETRY;
+
+/********************************************************************************
+*  Structure:	TELEMETRY_STATS													*
+*  Purpose:		A snapshot of an exporter's counters.							*
+********************************************************************************/
+typedef struct _TELEMETRY_STATS
+{
+	ULONGLONG qwRecorded;							// Events recorded
+	ULONGLONG qwExported;							// Events sent
+	ULONGLONG qwBatches;							// Batches sent
+	ULONGLONG qwBytes;								// Bytes sent
+	ULONGLONG qwDroppedEvents;						// Events dropped, queue full or batch missed
+	ULONGLONG qwDroppedBatches;						// Batches the collector missed
+	ULONGLONG qwCpuNs;								// Exporter CPU time
+} TELEMETRY_STATS, *PTELEMETRY_STATS;
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	TELEMETRY_Start													*
+*  Purpose:		Starts exporting to a collector.								*
+*  Parameters:	@ pszCollectorPath ~[in]~ The collector's UNIX-domain datagram	*
+*				socket (need not exist yet).									*
+*				@ ptTelemetry ~[out]~ Gets the exporter.						*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Call before starting any thread that waits for signals, as	*
+*					the exporter thread blocks them all.						*
+*				* Stop with TELEMETRY_Stop.										*
+********************************************************************************/
+RETSTATUS
+TELEMETRY_Start(
+	__in_z PCSTR pszCollectorPath,
+	__out PTELEMETRY ptTelemetry
+);
+
+/********************************************************************************
+*  Function:	TELEMETRY_Record												*
+*  Purpose:		Queues an event for export.										*
+*  Parameters:	@ ptTelemetry ~[inout]~ The exporter.							*
+*				@ ptEvent ~[in]~ The event.										*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+*				* Never blocks or allocates. Events that do not fit are			*
+*					dropped and counted.										*
+********************************************************************************/
+VOID
+TELEMETRY_Record(
+	__inout PTELEMETRY ptTelemetry,
+	__in PCTELEMETRY_EVENT ptEvent
+);
+
+/********************************************************************************
+*  Function:	TELEMETRY_Flush													*
+*  Purpose:		Waits until every event recorded so far was sent (or			*
+*				dropped).														*
+*  Parameters:	@ ptTelemetry ~[inout]~ The exporter.							*
+*  Remarks:		* Producer only.												*
+********************************************************************************/
+VOID
+TELEMETRY_Flush(
+	__inout PTELEMETRY ptTelemetry
+);
+
+/********************************************************************************
+*  Function:	TELEMETRY_Stop													*
+*  Purpose:		Sends what is left and stops the exporter.						*
+*  Parameters:	@ ptTelemetry ~[inout]~ The exporter, after TELEMETRY_Start		*
+*				(even a failed one), or zeroed.									*
+*  Remarks:		* The producer must be done.									*
+********************************************************************************/
+VOID
+TELEMETRY_Stop(
+	__inout PTELEMETRY ptTelemetry
+);
+
+/********************************************************************************
+*  Function:	TELEMETRY_GetStats												*
+*  Purpose:		Gets an exporter's counters.									*
+*  Parameters:	@ ptTelemetry ~[in]~ The exporter.								*
+*				@ ptStats ~[out]~ Gets the counters.							*
+*  Remarks:		* May be called from any thread.								*
+********************************************************************************/
+VOID
+TELEMETRY_GetStats(
+	__in PTELEMETRY ptTelemetry,
+	__out PTELEMETRY_STATS ptStats
+);
+
+/********************************************************************************
+*  Function:	TELEMETRY_DecodeBatch											*
+*  Purpose:		Decodes a batch, as a collector would.							*
+*  Parameters:	@ pbBatch ~[in]~ The batch (one datagram).						*
+*				@ cbBatch ~[in]~ Its size.										*
+*				@ ptHeader ~[out]~ Gets the batch header.						*
+*				@ pfnEvent ~[in]~ Receives every event, in order.				*
+*				@ pvContext ~[inout]~ Optional context for the callback.		*
+*  Returns:		TRUE if the whole batch is valid. Events before a malformed		*
+*				one are still delivered.										*
+********************************************************************************/
+BOOL
+TELEMETRY_DecodeBatch(
+	__in_bcount(cbBatch) const BYTE *pbBatch,
+	__in SIZE_T cbBatch,
+	__out PTELEMETRY_BATCH_HEADER ptHeader,
+	__in PFN_TELEMETRY_EVENT pfnEvent,
+	__inout_opt PVOID pvContext
+);
+
+#endif	// _WIN32
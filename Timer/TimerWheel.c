@@ -0,0 +1,396 @@
+/********************************************************************************
+*  File:		TimerWheel.c													*
+*  Purpose:		Hierarchical timer wheel: many deadlines behind a single wait	*
+*				timeout.														*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#include "TimerWheel.h"
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif	// _MSC_VER
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	TIMERWHEEL_MAX_AHEAD											*
+*  Purpose:		The furthest a timer is placed ahead of the wheel, in ticks.	*
+********************************************************************************/
+#define TIMERWHEEL_MAX_AHEAD ((1ULL << (TIMERWHEEL_SLOT_BITS * TIMERWHEEL_LEVELS)) - 1)
+
+/********************************************************************************
+*  Constant:	TIMERWHEEL_NO_TICK												*
+*  Purpose:		The next tick with work of an empty wheel.						*
+********************************************************************************/
+#define TIMERWHEEL_NO_TICK (~0ULL)
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	timerwheel_GetSlotsAhead										*
+*  Purpose:		Counts the slots from an index to the next occupied one,		*
+*				wrapping around.												*
+*  Parameters:	@ qwOccupied ~[in]~ A level's occupancy bitmap (non-zero).		*
+*				@ dwIndex ~[in]~ The index to count from.						*
+*  Returns:		The count, 0 if the index itself is occupied.					*
+********************************************************************************/
+static
+__inline
+DWORD
+timerwheel_GetSlotsAhead(
+	__in ULONGLONG qwOccupied,
+	__in DWORD dwIndex
+)
+{
+	ULONGLONG qwRotated = (qwOccupied >> dwIndex) | (qwOccupied << ((TIMERWHEEL_SLOTS - dwIndex) & (TIMERWHEEL_SLOTS - 1)));
+	DWORD dwLowestBit = 0;
+
+#if defined(_MSC_VER) && defined(_M_X64)
+	(VOID)_BitScanForward64((unsigned long *)&dwLowestBit, qwRotated);
+#elif defined(_MSC_VER)	// _MSC_VER && _M_X64
+	if (0 != (ULONG)qwRotated)
+	{
+		(VOID)_BitScanForward((unsigned long *)&dwLowestBit, (ULONG)qwRotated);
+	}
+	else
+	{
+		(VOID)_BitScanForward((unsigned long *)&dwLowestBit, (ULONG)(qwRotated >> 32));
+		dwLowestBit += 32;
+	}
+#else	// _MSC_VER
+	dwLowestBit = (DWORD)__builtin_ctzll(qwRotated);
+#endif	// _MSC_VER
+	return dwLowestBit;
+}
+
+/********************************************************************************
+*  Function:	timerwheel_GetNextTick											*
+*  Purpose:		Finds the next tick with timers to run or spread down.			*
+*  Parameters:	@ ptWheel ~[in]~ The wheel.										*
+*  Returns:		The tick, or TIMERWHEEL_NO_TICK if the wheel is empty.			*
+*  Remarks:		* A level's slot is spread down on the first tick that is a		*
+*					multiple of the level's slot width and indexes it.			*
+********************************************************************************/
+static
+ULONGLONG
+timerwheel_GetNextTick(
+	__in PCTIMERWHEEL ptWheel
+)
+{
+	ULONGLONG qwNextTick = TIMERWHEEL_NO_TICK;
+	ULONGLONG qwWidth = 0;
+	ULONGLONG qwBoundary = 0;
+	ULONGLONG qwTick = 0;
+	DWORD dwShift = 0;
+	DWORD dwLevel = 0;
+
+	for (dwLevel = 0; dwLevel < TIMERWHEEL_LEVELS; dwLevel++)
+	{
+		if (0 == ptWheel->aqwOccupied[dwLevel])
+		{
+			continue;
+		}
+		dwShift = TIMERWHEEL_SLOT_BITS * dwLevel;
+		qwWidth = 1ULL << dwShift;
+		qwBoundary = (ptWheel->qwTick + qwWidth - 1) & ~(qwWidth - 1);
+		qwTick = qwBoundary + ((ULONGLONG)timerwheel_GetSlotsAhead(ptWheel->aqwOccupied[dwLevel],
+			(DWORD)((qwBoundary >> dwShift) & (TIMERWHEEL_SLOTS - 1))) << dwShift);
+		qwNextTick = MIN(qwNextTick, qwTick);
+	}
+
+	// Return result
+	return qwNextTick;
+}
+
+/********************************************************************************
+*  Function:	timerwheel_Link													*
+*  Purpose:		Puts a timer in the slot its due tick falls in, at the level	*
+*				just wide enough.												*
+*  Parameters:	@ ptWheel ~[inout]~ The wheel.									*
+*				@ ptTimer ~[inout]~ The timer, disarmed.						*
+********************************************************************************/
+static
+VOID
+timerwheel_Link(
+	__inout PTIMERWHEEL ptWheel,
+	__inout PTIMERWHEEL_TIMER ptTimer
+)
+{
+	ULONGLONG qwAhead = (ptTimer->qwDueTick > ptWheel->qwTick) ? ptTimer->qwDueTick - ptWheel->qwTick : 0;
+	ULONGLONG qwTick = ptWheel->qwTick + MIN(qwAhead, TIMERWHEEL_MAX_AHEAD);
+	DWORD dwLevel = 0;
+	DWORD dwIndex = 0;
+
+	// Past deadlines run on the next tick, the furthest ones wait in the last level
+	while ((TIMERWHEEL_LEVELS - 1 > dwLevel) && (0 != (MIN(qwAhead, TIMERWHEEL_MAX_AHEAD) >> (TIMERWHEEL_SLOT_BITS * (dwLevel + 1)))))
+	{
+		dwLevel++;
+	}
+	dwIndex = (DWORD)((qwTick >> (TIMERWHEEL_SLOT_BITS * dwLevel)) & (TIMERWHEEL_SLOTS - 1));
+	ptTimer->dwSlot = (dwLevel * TIMERWHEEL_SLOTS) + dwIndex;
+	ptTimer->ptNext = ptWheel->aptSlots[ptTimer->dwSlot];
+	if (NULL != ptTimer->ptNext)
+	{
+		ptTimer->ptNext->pptLink = &(ptTimer->ptNext);
+	}
+	ptTimer->pptLink = &(ptWheel->aptSlots[ptTimer->dwSlot]);
+	ptWheel->aptSlots[ptTimer->dwSlot] = ptTimer;
+	ptWheel->aqwOccupied[dwLevel] |= 1ULL << dwIndex;
+}
+
+/********************************************************************************
+*  Function:	timerwheel_Unlink												*
+*  Purpose:		Takes an armed timer out of its slot (or out of a list taken	*
+*				from it).														*
+*  Parameters:	@ ptWheel ~[inout]~ The wheel.									*
+*				@ ptTimer ~[inout]~ The timer.									*
+********************************************************************************/
+static
+VOID
+timerwheel_Unlink(
+	__inout PTIMERWHEEL ptWheel,
+	__inout PTIMERWHEEL_TIMER ptTimer
+)
+{
+	*(ptTimer->pptLink) = ptTimer->ptNext;
+	if (NULL != ptTimer->ptNext)
+	{
+		ptTimer->ptNext->pptLink = ptTimer->pptLink;
+	}
+	ptTimer->ptNext = NULL;
+	ptTimer->pptLink = NULL;
+	if (NULL == ptWheel->aptSlots[ptTimer->dwSlot])
+	{
+		ptWheel->aqwOccupied[ptTimer->dwSlot / TIMERWHEEL_SLOTS] &= ~(1ULL << (ptTimer->dwSlot % TIMERWHEEL_SLOTS));
+	}
+}
+
+/********************************************************************************
+*  Function:	timerwheel_TakeSlot												*
+*  Purpose:		Empties a slot into a list of its own.							*
+*  Parameters:	@ ptWheel ~[inout]~ The wheel.									*
+*				@ dwSlot ~[in]~ The slot, by level then slot.					*
+*				@ pptList ~[out]~ Gets the list, which its timers link to (so	*
+*				they may still be cancelled).									*
+********************************************************************************/
+static
+VOID
+timerwheel_TakeSlot(
+	__inout PTIMERWHEEL ptWheel,
+	__in DWORD dwSlot,
+	__out PTIMERWHEEL_TIMER *pptList
+)
+{
+	*pptList = ptWheel->aptSlots[dwSlot];
+	if (NULL != *pptList)
+	{
+		(*pptList)->pptLink = pptList;
+	}
+	ptWheel->aptSlots[dwSlot] = NULL;
+	ptWheel->aqwOccupied[dwSlot / TIMERWHEEL_SLOTS] &= ~(1ULL << (dwSlot % TIMERWHEEL_SLOTS));
+}
+
+/********************************************************************************
+*  Function:	timerwheel_RunTick												*
+*  Purpose:		Spreads down the slots a tick reaches, then runs its timers.	*
+*  Parameters:	@ ptWheel ~[inout]~ The wheel, at the tick.						*
+*				@ qwNow ~[in]~ The time the wheel is advanced to.				*
+********************************************************************************/
+static
+VOID
+timerwheel_RunTick(
+	__inout PTIMERWHEEL ptWheel,
+	__in ULONGLONG qwNow
+)
+{
+	ULONGLONG qwTick = ptWheel->qwTick;
+	PTIMERWHEEL_TIMER ptList = NULL;
+	PTIMERWHEEL_TIMER ptTimer = NULL;
+	DWORD dwShift = 0;
+	DWORD dwLevel = 0;
+
+	// Lower levels first, a higher level only spreads when the one below wraps
+	for (dwLevel = 1; dwLevel < TIMERWHEEL_LEVELS; dwLevel++)
+	{
+		dwShift = TIMERWHEEL_SLOT_BITS * dwLevel;
+		if (0 != (qwTick & ((1ULL << dwShift) - 1)))
+		{
+			break;
+		}
+		timerwheel_TakeSlot(ptWheel,
+			(dwLevel * TIMERWHEEL_SLOTS) + (DWORD)((qwTick >> dwShift) & (TIMERWHEEL_SLOTS - 1)),
+			&ptList);
+		while (NULL != ptList)
+		{
+			ptTimer = ptList;
+			timerwheel_Unlink(ptWheel, ptTimer);
+			timerwheel_Link(ptWheel, ptTimer);
+			ptWheel->qwCascaded++;
+		}
+	}
+
+	// Callbacks arm from the next tick on, so this slot is not refilled under us
+	timerwheel_TakeSlot(ptWheel, (DWORD)(qwTick & (TIMERWHEEL_SLOTS - 1)), &ptList);
+	ptWheel->qwTick = qwTick + 1;
+	while (NULL != ptList)
+	{
+		ptTimer = ptList;
+		timerwheel_Unlink(ptWheel, ptTimer);
+		ptWheel->dwArmed--;
+		ptWheel->qwFired++;
+		ptTimer->pfnCallback(ptTimer, qwNow, ptTimer->pvContext);
+	}
+}
+
+/********************************************************************************
+*  Function:	TIMERWHEEL_Initialize											*
+********************************************************************************/
+VOID
+TIMERWHEEL_Initialize(
+	__out PTIMERWHEEL ptWheel,
+	__in ULONGLONG qwNow
+)
+{
+	// Validations
+	ASSERT(NULL != ptWheel);
+
+	RtlZeroMemory(ptWheel, sizeof(*ptWheel));
+	ptWheel->qwTick = qwNow / TIMERWHEEL_TICK_NS;
+}
+
+/********************************************************************************
+*  Function:	TIMERWHEEL_InitializeTimer										*
+********************************************************************************/
+VOID
+TIMERWHEEL_InitializeTimer(
+	__out PTIMERWHEEL_TIMER ptTimer,
+	__in PFN_TIMERWHEEL_CALLBACK pfnCallback,
+	__in_opt PVOID pvContext
+)
+{
+	// Validations
+	ASSERT(NULL != ptTimer);
+	ASSERT(NULL != pfnCallback);
+
+	RtlZeroMemory(ptTimer, sizeof(*ptTimer));
+	ptTimer->pfnCallback = pfnCallback;
+	ptTimer->pvContext = pvContext;
+}
+
+/********************************************************************************
+*  Function:	TIMERWHEEL_Arm													*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+********************************************************************************/
+VOID
+TIMERWHEEL_Arm(
+	__inout PTIMERWHEEL ptWheel,
+	__inout PTIMERWHEEL_TIMER ptTimer,
+	__in ULONGLONG qwDeadline
+)
+{
+	if (TIMERWHEEL_IsArmed(ptTimer))
+	{
+		timerwheel_Unlink(ptWheel, ptTimer);
+	}
+	else
+	{
+		ptWheel->dwArmed++;
+	}
+
+	// Round up, a timer never runs early
+	ptTimer->qwDueTick = (qwDeadline / TIMERWHEEL_TICK_NS) + ((0 != (qwDeadline % TIMERWHEEL_TICK_NS)) ? 1 : 0);
+	timerwheel_Link(ptWheel, ptTimer);
+}
+
+/********************************************************************************
+*  Function:	TIMERWHEEL_Cancel												*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+********************************************************************************/
+VOID
+TIMERWHEEL_Cancel(
+	__inout PTIMERWHEEL ptWheel,
+	__inout PTIMERWHEEL_TIMER ptTimer
+)
+{
+	if (TIMERWHEEL_IsArmed(ptTimer))
+	{
+		timerwheel_Unlink(ptWheel, ptTimer);
+		ptWheel->dwArmed--;
+	}
+}
+
+/********************************************************************************
+*  Function:	TIMERWHEEL_Advance												*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+********************************************************************************/
+VOID
+TIMERWHEEL_Advance(
+	__inout PTIMERWHEEL ptWheel,
+	__in ULONGLONG qwNow
+)
+{
+	ULONGLONG qwNowTick = qwNow / TIMERWHEEL_TICK_NS;
+	ULONGLONG qwTick = 0;
+
+	// Jump over the ticks without work, whatever their number
+	while (ptWheel->qwTick <= qwNowTick)
+	{
+		qwTick = timerwheel_GetNextTick(ptWheel);
+		if (qwTick > qwNowTick)
+		{
+			ptWheel->qwTick = qwNowTick + 1;
+			break;
+		}
+		ptWheel->qwTick = qwTick;
+		timerwheel_RunTick(ptWheel, qwNow);
+	}
+}
+
+/********************************************************************************
+*  Function:	TIMERWHEEL_GetTimeoutMs											*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+********************************************************************************/
+DWORD
+TIMERWHEEL_GetTimeoutMs(
+	__in PCTIMERWHEEL ptWheel,
+	__in ULONGLONG qwNow
+)
+{
+	ULONGLONG qwTick = timerwheel_GetNextTick(ptWheel);
+	ULONGLONG qwWakeup = 0;
+
+	if (TIMERWHEEL_NO_TICK == qwTick)
+	{
+		return TIMERWHEEL_WAIT_FOREVER;
+	}
+	qwWakeup = qwTick * TIMERWHEEL_TICK_NS;
+	if (qwWakeup <= qwNow)
+	{
+		return 0;
+	}
+
+	// Return result (rounding up, waking early would only wait again)
+	return (DWORD)MIN((qwWakeup - qwNow + NANOSECONDS_IN_MILLISECOND - 1) / NANOSECONDS_IN_MILLISECOND,
+		(ULONGLONG)(TIMERWHEEL_WAIT_FOREVER - 1));
+}
+
+/********************************************************************************
+*  Function:	TIMERWHEEL_GetStats												*
+********************************************************************************/
+VOID
+TIMERWHEEL_GetStats(
+	__in PCTIMERWHEEL ptWheel,
+	__out PTIMERWHEEL_STATS ptStats
+)
+{
+	// Validations
+	ASSERT(NULL != ptWheel);
+	ASSERT(NULL != ptStats);
+
+	ptStats->dwArmed = ptWheel->dwArmed;
+	ptStats->qwFired = ptWheel->qwFired;
+	ptStats->qwCascaded = ptWheel->qwCascaded;
+}
